@@ -263,6 +263,7 @@ macro (osl_add_all_tests)
                 initops initops-instance-clash
                 intbits isconnected
                 isconstant
+                jit-free-with-group
                 layers layers-Ciassign layers-entry layers-lazy layers-lazyerror
                 layers-nonlazycopy layers-repeatedoutputs
                 length-reg linearstep
@@ -285,6 +286,9 @@ macro (osl_add_all_tests)
                 pnoise-generic pnoise-perlin
                 pnoise-reg
                 operator-overloading
+                opt-alias-connections
+                opt-batch-getattribute
+                opt-shared-constant-arrays
                 opt-warnings
                 oslc-comma oslc-D oslc-M
                 oslc-err-arrayindex oslc-err-assignmenttypes
@@ -301,6 +305,7 @@ macro (osl_add_all_tests)
                 oslc-err-unknown-ctr
                 oslc-literalfold
                 oslc-pragma-warnerr
+                oslc-pure-functions
                 oslc-warn-commainit
                 oslc-variadic-macro
                 oslc-version
@@ -406,3 +411,67 @@ macro (osl_add_all_tests)
     set_tests_properties (matrix-reg.regress.rsbitcode.opt
                           PROPERTIES TIMEOUT ${OSL_TEST_BIG_TIMEOUT})
 endmacro()
+
+
+
+# add_one_perftest() - set up one timing test, labelled "perf", which
+# perftest.py runs in ${CMAKE_BINARY_DIR}/testsuite/${testname}
+#
+# Usage:
+#   add_one_perftest ( testname
+#                  testsrcdir - Test directory of the shaders in testsuite
+#                  app args...  - testshade or testrender, and its arguments
+#                 )
+#
+macro (add_one_perftest testname testsrcdir app)
+    set (testsuite "${CMAKE_SOURCE_DIR}/testsuite")
+    set (testdir "${CMAKE_BINARY_DIR}/testsuite/${testname}")
+    file (MAKE_DIRECTORY "${testdir}")
+    set (_perf_COMMAND ${Python_EXECUTABLE} "${testsuite}/perftest.py"
+                       --srcdir "${testsuite}/${testsrcdir}"
+                       --repeats ${OSL_PERF_REPEATS}
+                       --tolerance ${OSL_PERF_TOLERANCE})
+    if (OSL_PERF_BASELINES)
+        list (APPEND _perf_COMMAND --baselines "${OSL_PERF_BASELINES}")
+    endif ()
+    add_test (NAME ${testname}
+              COMMAND ${_perf_COMMAND} ${testname} ${app} ${ARGN}
+              WORKING_DIRECTORY "${testdir}")
+    set_tests_properties (${testname} PROPERTIES
+                          LABELS perf RUN_SERIAL TRUE
+                          TIMEOUT ${OSL_TEST_BIG_TIMEOUT}
+                          ENVIRONMENT "OpenImageIO_ROOT=${OpenImageIO_ROOT};OSL_BUILD_DIR=${CMAKE_BINARY_DIR}")
+endmacro ()
+
+
+
+# Timing tests of some of the heavier testsuite scenes, at larger sizes
+# than their regression tests, run with `ctest -L perf`.  Each records its
+# times in testsuite/perf-*/perf-*.json, and with OSL_PERF_BASELINES set
+# fails if it's slower than its baseline there by more than
+# OSL_PERF_TOLERANCE (run with OSL_PERF_UPDATE=1 in the environment to
+# store new baselines instead).
+set (OSL_PERF_BASELINES "" CACHE FILEPATH "JSON file of perf test baselines")
+set (OSL_PERF_TOLERANCE 0.1 CACHE STRING
+     "Fraction slower than its baseline that fails a perf test")
+set (OSL_PERF_REPEATS 5 CACHE STRING "Timed runs of each perf test")
+
+macro (osl_add_perf_tests)
+    add_one_perftest (perf-render-cornell render-cornell
+                      testrender -r 256 256 -aa 8 cornell.xml out.exr)
+    add_one_perftest (perf-render-veachmis render-veachmis
+                      testrender -r 320 240 -aa 8 veach.xml out.exr)
+    add_one_perftest (perf-render-microfacet render-microfacet
+                      testrender -r 320 240 -aa 8 scene.xml out.exr)
+    add_one_perftest (perf-render-mx-layer render-mx-layer
+                      testrender -r 320 240 -aa 8 scene.xml out.exr)
+    add_one_perftest (perf-noise noise
+                      testshade -g 1024 1024 --iters 4 -od uint8
+                                -o Cout out.tif test)
+    add_one_perftest (perf-spline spline
+                      testshade -g 1024 1024 --iters 4 -od uint8
+                                -o Cspline color.tif test)
+    add_one_perftest (perf-texture-swirl texture-swirl
+                      testshade -g 1024 1024 --center --param swirl 2.0
+                                -od uint8 -o Cout out.tif swirl)
+endmacro ()
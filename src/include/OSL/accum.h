@@ -4,10 +4,10 @@
 
 #pragma once
 
+#include <OSL/device_accum.h>
 #include <OSL/optautomata.h>
 #include <OSL/oslconfig.h>
 #include <list>
-#include <stack>
 
 OSL_NAMESPACE_ENTER
 
@@ -102,11 +102,16 @@ public:
     ~AccumAutomata();
 
     /// Support the given symbol as event tag on lpe expressions
-    void addEventType(ustring symbol) { m_user_events.push_back(symbol); };
+    void addEventType(ustring symbol)
+    {
+        m_user_events.push_back(symbol);
+        m_rules_key += fmtformat("E {}\n", symbol);
+    };
     /// Support the given symbol as scattering tag on lpe expressions
     void addScatteringType(ustring symbol)
     {
         m_user_scatterings.push_back(symbol);
+        m_rules_key += fmtformat("S {}\n", symbol);
     };
 
     /// Add a single rule for rendering outputs
@@ -121,6 +126,39 @@ public:
     /// Once all the desired rules have been added, compile the automata
     void compile();
 
+    /// A hash of the event and scattering types and the rules added, in
+    /// order, which are all that compile() depends on, to key cached
+    /// automata by.
+    uint64_t getRulesHash() const;
+
+    /// Write the compiled automata to buffer, for deserialize() to read
+    /// back into an automata set up with the same types and rules.
+    void serialize(std::string& buffer) const;
+
+    /// Instead of compile(), read back what serialize() wrote for the same
+    /// types and rules.  Return false, and leave the automata to be
+    /// compiled, if buffer isn't the automata of these rules.
+    bool deserialize(string_view buffer);
+
+    /// Like compile(), but first look in cache_dir for the automata of
+    /// the same rules, written there by an earlier compileCached() of
+    /// this or another process, and write it there if it wasn't found.
+    /// Return true if it was read from the cache.
+    bool compileCached(string_view cache_dir);
+
+    /// What compile() built, to see the cost of a set of rules
+    struct Stats {
+        size_t ndf_states   = 0;      ///< States of the NDF automata
+        size_t df_states    = 0;      ///< States after determinization
+        size_t states       = 0;      ///< States left after minimization
+        int symbols         = 0;      ///< Label IDs, see getSymbolId
+        size_t rule_entries = 0;      ///< Rules stored for the final states
+        size_t memory       = 0;      ///< Bytes used by the compiled automata
+        double compile_time = 0;      ///< Seconds spent in compile()
+        bool cached         = false;  ///< Read from compileCached's cache
+    };
+    const Stats& getStats() const { return m_stats; }
+
     /// Performs an accumulation in the given outputs vector if any rule is activated in the given state
     void accum(int state, const Color3& color,
                std::vector<AovOutput>& outputs) const;
@@ -131,6 +169,26 @@ public:
         return m_dfoptautomata.getTransition(state, symbol);
     };
 
+    /// Get the small integer ID of a label, so integrators can look their
+    /// labels up once after compile() and then move by ID, which skips
+    /// comparing ustrings altogether
+    int getSymbolId(ustring symbol) const
+    {
+        return m_dfoptautomata.getSymbolId(symbol);
+    };
+
+    /// Get an specific transition by label ID
+    int getTransition(int state, int symbol_id) const
+    {
+        return m_dfoptautomata.getTransition(state, symbol_id);
+    };
+
+    /// Write the compiled automata and its rules as one block of plain
+    /// data, starting with a DeviceAccumAutomata, for a DeviceAccumulator
+    /// to step.  The block has no pointers, so it can be copied as it is
+    /// to a GPU.
+    void getDeviceTable(std::vector<char>& table) const;
+
     /// The rule list is for public use in read-only, so Accumulator knows what AOVS are we using
     const std::list<AccumRule>& getRuleList() const { return m_accumrules; };
 
@@ -152,6 +210,9 @@ private:
     std::vector<ustring> m_user_events;
     // Custom symbols to support on expressions as scattering
     std::vector<ustring> m_user_scatterings;
+    // The types and rules added, one per line, for getRulesHash
+    std::string m_rules_key;
+    Stats m_stats;
 };
 
 
@@ -162,6 +223,9 @@ private:
 /// integrator functions during the light walk. Knows what state
 /// we are at and keeps record of the accumulated values (AovOutput)
 ///
+/// Saving and restoring states doesn't allocate: the stack is inline, up
+/// to OSL_ACCUMULATOR_MAX_DEPTH deep.
+///
 class OSLEXECPUBLIC Accumulator {
 public:
     Accumulator(const AccumAutomata* accauto);
@@ -171,8 +235,27 @@ public:
     /// If the machine is broken no result will be stored, you can cut the branch
     bool broken() const { return m_state < 0; }
 
-    void pushState();
-    void popState();
+    void pushState()
+    {
+        OSL_ASSERT(m_state >= 0);
+        OSL_ASSERT(m_depth < OSL_ACCUMULATOR_MAX_DEPTH);
+        m_stack[m_depth++] = m_state;
+    }
+
+    void popState()
+    {
+        OSL_ASSERT(m_depth > 0);
+        m_state = m_stack[--m_depth];
+    }
+
+    /// Go back to the initial state with an empty stack and cleared
+    /// outputs, keeping the AOVs, to start another path
+    void reset()
+    {
+        m_state = 0;
+        m_depth = 0;
+        begin();
+    }
 
     /// Push a single label
     void move(ustring symbol);
@@ -186,14 +269,20 @@ public:
     void move(ustring event, ustring scatt, const ustring* custom,
               ustring stop);
 
+    /// The same as the above, but with label IDs from
+    /// AccumAutomata::getSymbolId.  Arrays of IDs are -1 terminated.
+    void move(int symbol_id);
+    void move(const int* symbol_ids);
+    void move(int event, int scatt, const int* custom, int stop);
+
     /// Check if a given movement is possible without breaking the automata.
     /// Leaves the state untouched
     bool test(ustring dir, ustring sca, const ustring* custom, ustring stop)
     {
-        pushState();
+        int state = m_state;
         move(dir, sca, custom, stop);
         bool active = !broken();
-        popState();
+        m_state     = state;
         return active;
     }
 
@@ -223,10 +312,12 @@ private:
     // the same index so m_outputs[aov->getIndex()].aov == aov for AOV's linked
     // by rules and NULL for the rest
     std::vector<AovOutput> m_outputs;
-    // Current state stack, this is state information
-    std::stack<int> m_stack;
-    // And the current state
+    // The current state
     int m_state;
+    // And the stack of saved states, this is state information. It goes
+    // last, so only the inline methods above depend on its size.
+    int m_depth = 0;
+    int m_stack[OSL_ACCUMULATOR_MAX_DEPTH];
 };
 
 
@@ -0,0 +1,233 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/accum.h>
+#include <OSL/wide.h>
+
+#include <vector>
+
+OSL_NAMESPACE_ENTER
+
+template<int WidthT> struct BatchedAovOutput;
+
+/// AOV receiving the results of a batch of paths at once
+template<int WidthT> class BatchedAov {
+public:
+    virtual ~BatchedAov() {}
+    /// Write the lanes of mask.  Lanes that nothing was added to have
+    /// zero color and alpha, and has_color / has_alpha off.
+    virtual void write(void* flush_data, Mask<WidthT> mask,
+                       const BatchedAovOutput<WidthT>& output)
+        = 0;
+};
+
+
+
+/// AOV slot for a batch of paths, one lane each
+///
+/// The batched counterpart of AovOutput, with the values stored as
+/// structures of arrays.
+template<int WidthT> struct BatchedAovOutput {
+    // Accumulated values
+    float r[WidthT];
+    float g[WidthT];
+    float b[WidthT];
+    float alpha[WidthT];
+    // Lanes that had some value added to color or alpha
+    Mask<WidthT> has_color;
+    Mask<WidthT> has_alpha;
+    // It is also possible to "invert" values before flushing
+    bool neg_color          = false;
+    bool neg_alpha          = false;
+    BatchedAov<WidthT>* aov = nullptr;
+
+    BatchedAovOutput() { reset(); }
+
+    // Reset the accumulated values to start a new integration
+    void reset()
+    {
+        for (int i = 0; i < WidthT; ++i)
+            r[i] = g[i] = b[i] = alpha[i] = 0.0f;
+        has_color = Mask<WidthT>(false);
+        has_alpha = Mask<WidthT>(false);
+    }
+
+    Color3 color(int lane) const { return Color3(r[lane], g[lane], b[lane]); }
+
+    /// Sends the lanes of mask to the AOV
+    void flush(void* flush_data, Mask<WidthT> mask)
+    {
+        if (!aov)
+            return;
+        if (neg_color) {
+            for (int i = 0; i < WidthT; ++i) {
+                r[i] = 1.0f - r[i];
+                g[i] = 1.0f - g[i];
+                b[i] = 1.0f - b[i];
+            }
+            has_color = Mask<WidthT>(true);
+        }
+        if (neg_alpha) {
+            for (int i = 0; i < WidthT; ++i)
+                alpha[i] = 1.0f - alpha[i];
+            has_alpha = Mask<WidthT>(true);
+        }
+        aov->write(flush_data, mask, *this);
+    }
+};
+
+
+
+/// State sensitive render accumulator for a batch of paths
+///
+/// The batched counterpart of Accumulator, for integrators that trace
+/// WidthT paths at once: every lane has its own automata state, moved
+/// and accumulated only where a mask says so.  Saved states live in a
+/// fixed size stack inside the accumulator, of up to MaxDepthT levels,
+/// rather than on the heap.
+template<int WidthT, int MaxDepthT = 16> class BatchedAccumulator {
+public:
+    BatchedAccumulator(const AccumAutomata* accauto)
+        : m_accum_automata(accauto)
+    {
+        const auto& rules = m_accum_automata->getRuleList();
+        // Make sure we have as many outputs as the rules need
+        int maxouts = 0;
+        for (const auto& i : rules)
+            maxouts = std::max(i.getOutputIndex(), maxouts);
+        m_outputs.resize(maxouts + 1);
+
+        // 0 is our initial state always
+        for (int i = 0; i < WidthT; ++i)
+            m_state[i] = 0;
+    }
+
+    void setAov(int outidx, BatchedAov<WidthT>* aov, bool neg_color,
+                bool neg_alpha)
+    {
+        OSL_ASSERT(0 <= outidx && outidx < (int)m_outputs.size());
+        m_outputs[outidx].aov       = aov;
+        m_outputs[outidx].neg_color = neg_color;
+        m_outputs[outidx].neg_alpha = neg_alpha;
+    }
+
+    /// The lanes whose machine is broken: they store no more results,
+    /// you can cut those branches
+    Mask<WidthT> broken() const
+    {
+        Mask<WidthT> result(false);
+        for (int i = 0; i < WidthT; ++i)
+            result.set_on_if(i, m_state[i] < 0);
+        return result;
+    }
+
+    /// Save or restore the states of all the lanes
+    void pushState()
+    {
+        OSL_ASSERT(m_depth < MaxDepthT);
+        for (int i = 0; i < WidthT; ++i)
+            m_stack[m_depth][i] = m_state[i];
+        ++m_depth;
+    }
+    void popState()
+    {
+        OSL_ASSERT(m_depth > 0);
+        --m_depth;
+        for (int i = 0; i < WidthT; ++i)
+            m_state[i] = m_stack[m_depth][i];
+    }
+
+    /// Move the lanes of mask by the same label ID (from
+    /// AccumAutomata::getSymbolId)
+    void move(Mask<WidthT> mask, int symbol_id)
+    {
+        for (int i = 0; i < WidthT; ++i)
+            if (mask.is_on(i) && m_state[i] >= 0)
+                m_state[i] = m_accum_automata->getTransition(m_state[i],
+                                                             symbol_id);
+    }
+
+    /// Move the lanes of mask, each by its own label ID
+    void move(Mask<WidthT> mask, const Block<int, WidthT>& symbol_ids)
+    {
+        for (int i = 0; i < WidthT; ++i)
+            if (mask.is_on(i) && m_state[i] >= 0)
+                m_state[i] = m_accum_automata->getTransition(
+                    m_state[i], symbol_ids.get(i));
+    }
+
+    /// Move the lanes of mask by all the labels of a hit, as
+    /// Accumulator::move does.  custom is -1 terminated, and may be NULL.
+    void move(Mask<WidthT> mask, int event, int scatt, const int* custom,
+              int stop)
+    {
+        move(mask, event);
+        move(mask, scatt);
+        while (custom && *custom >= 0)
+            move(mask, *(custom++));
+        move(mask, stop);
+    }
+
+    /// Clears all the outputs to start integrating
+    void begin()
+    {
+        for (auto& output : m_outputs)
+            output.reset();
+    }
+
+    /// Finishes and flushes the lanes of mask to the sample store
+    void end(Mask<WidthT> mask, void* flush_data)
+    {
+        for (auto& output : m_outputs)
+            output.flush(flush_data, mask);
+    }
+
+    /// Send each lane's result to whatever rules might be active in its
+    /// current state, for the lanes of mask
+    void accum(Mask<WidthT> mask, const Block<Color3, WidthT>& color)
+    {
+        for (int i = 0; i < WidthT; ++i) {
+            if (!mask.is_on(i) || m_state[i] < 0)
+                continue;
+            int nrules = 0;
+            void* const* rules
+                = m_accum_automata->getRulesInState(m_state[i], nrules);
+            Color3 c = color.get(i);
+            for (int r = 0; r < nrules; ++r) {
+                const AccumRule* rule = (const AccumRule*)rules[r];
+                BatchedAovOutput<WidthT>& out(
+                    m_outputs[rule->getOutputIndex()]);
+                if (rule->toAlpha()) {
+                    out.alpha[i] += (c.x + c.y + c.z) * 1.0f / 3.0f;
+                    out.has_alpha.set_on(i);
+                } else {
+                    out.r[i] += c.x;
+                    out.g[i] += c.y;
+                    out.b[i] += c.z;
+                    out.has_color.set_on(i);
+                }
+            }
+        }
+    }
+
+    const BatchedAovOutput<WidthT>& getOutput(int idx) const
+    {
+        return m_outputs[idx];
+    }
+
+private:
+    // A reference to the stateless automata that can be shared between
+    // multiple threads
+    const AccumAutomata* m_accum_automata;
+    // One output per AOV, sharing the indices like in Accumulator
+    std::vector<BatchedAovOutput<WidthT>> m_outputs;
+    // Saved states and the current ones, one per lane
+    int m_stack[MaxDepthT][WidthT];
+    int m_depth = 0;
+    int m_state[WidthT];
+};
+
+OSL_NAMESPACE_EXIT
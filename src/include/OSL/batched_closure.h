@@ -0,0 +1,200 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#if !defined(OSL_USE_BATCHED) || (OSL_USE_BATCHED == 0)
+#    error batched_closure.h should not be included unless OSL_USE_BATCHED is defined to 1
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <OSL/genclosure.h>
+#include <OSL/oslclosure.h>
+#include <OSL/oslexec.h>
+#include <OSL/wide.h>
+
+OSL_NAMESPACE_ENTER
+
+/// Structure-of-arrays view of the closure trees of a batch.
+///
+/// Batched shading leaves one closure tree per lane (e.g. in Ci), whose
+/// components each hold their parameters as a struct, so evaluating a BSDF
+/// for a whole batch means gathering every parameter back out lane by lane.
+/// build() does that once: it flattens the trees of the active lanes,
+/// folding the weights of the mul nodes into the components, and gathers
+/// the components with the same closure id into a ClosureBlock holding a
+/// lane mask, the wide weights, and each registered parameter as a Block of
+/// WidthT values.  A renderer can then evaluate each block with SIMD.
+///
+/// The k-th component with a given id in a lane lands in the k-th block of
+/// that id, so lanes whose closure trees have the same shape share blocks.
+/// Components whose (folded) weight is zero are dropped.
+template<int WidthT> class BatchedClosureSoA {
+public:
+    class ClosureBlock {
+    public:
+        int id() const { return m_id; }
+
+        /// Lanes that have this component.
+        Mask<WidthT> mask() const { return m_mask; }
+
+        /// The registered parameters of the closure (ending with the
+        /// CLOSURE_FINISH_PARAM entry), also the layout of param().
+        const ClosureParam* params() const { return m_params; }
+        int nparams() const { return int(m_param_offsets.size()); }
+
+        /// Weight of the component in each lane, including the weights of
+        /// the mul nodes above it.
+        Wide<const Color3, WidthT> weight() const
+        {
+            return Wide<const Color3, WidthT>(m_base + m_weight_offset);
+        }
+
+        /// Parameter i of each lane, with T matching params()[i].type
+        /// (float, int, Vec3/Color3, ustringhash, or arrays of those).
+        template<typename T> Wide<const T, WidthT> param(int i) const
+        {
+            return Wide<const T, WidthT>(m_base + m_param_offsets[i]);
+        }
+
+    private:
+        friend class BatchedClosureSoA;
+        int m_id;
+        int m_occurrence;
+        Mask<WidthT> m_mask { false };
+        const ClosureParam* m_params = nullptr;
+        size_t m_weight_offset       = 0;
+        std::vector<size_t> m_param_offsets;
+        const char* m_base = nullptr;
+    };
+
+    /// Flatten the closure trees of the lanes of mask.  Replaces the
+    /// results of any previous build().  Closure ids that the shading
+    /// system doesn't know are skipped.
+    void build(ShadingSystem& shadingsys,
+               Wide<const ClosureColorPtr, WidthT> wclosure, Mask<WidthT> mask)
+    {
+        m_blocks.clear();
+        m_storage.clear();
+        mask.foreach ([&](ActiveLane lane) {
+            m_occurrences.clear();
+            flatten(shadingsys, lane, wclosure[lane], Color3(1.0f));
+        });
+        for (auto& b : m_blocks)
+            b.m_base = base();
+    }
+
+    int size() const { return int(m_blocks.size()); }
+    const ClosureBlock& operator[](int i) const { return m_blocks[i]; }
+    typename std::vector<ClosureBlock>::const_iterator begin() const
+    {
+        return m_blocks.begin();
+    }
+    typename std::vector<ClosureBlock>::const_iterator end() const
+    {
+        return m_blocks.end();
+    }
+
+private:
+    static constexpr size_t alignment = 64;
+
+    // m_storage is over-allocated by the alignment, and offsets are
+    // relative to its first aligned byte.
+    char* base()
+    {
+        size_t misalign = size_t((uintptr_t)m_storage.data() % alignment);
+        return m_storage.data() + (misalign ? alignment - misalign : 0);
+    }
+
+    size_t allot(size_t size)
+    {
+        size             = (size + alignment - 1) / alignment * alignment;
+        size_t used      = m_storage.empty() ? 0 : m_storage.size() - alignment;
+        size_t old_shift = m_storage.empty() ? 0 : base() - m_storage.data();
+        m_storage.resize(used + size + alignment, 0);
+        size_t new_shift = base() - m_storage.data();
+        if (new_shift != old_shift)  // Reallocation moved the alignment
+            memmove(m_storage.data() + new_shift,
+                    m_storage.data() + old_shift, used);
+        memset(base() + used, 0, size);
+        return used;
+    }
+
+    ClosureBlock* find_block(ShadingSystem& shadingsys, int id)
+    {
+        // Count the components with this id seen so far in this lane
+        int occurrence = -1;
+        for (auto& o : m_occurrences)
+            if (o.first == id)
+                occurrence = o.second++;
+        if (occurrence < 0) {
+            occurrence = 0;
+            m_occurrences.emplace_back(id, 1);
+        }
+        for (auto& b : m_blocks)
+            if (b.m_id == id && b.m_occurrence == occurrence)
+                return &b;
+
+        const char* name           = nullptr;
+        const ClosureParam* params = nullptr;
+        if (!shadingsys.query_closure(&name, &id, &params) || !params)
+            return nullptr;
+        ClosureBlock b;
+        b.m_id            = id;
+        b.m_occurrence    = occurrence;
+        b.m_params        = params;
+        b.m_weight_offset = allot(3 * WidthT * sizeof(float));
+        for (const ClosureParam* p = params; p->type != TypeDesc(); ++p)
+            b.m_param_offsets.push_back(allot(p->type.size() * WidthT));
+        m_blocks.push_back(std::move(b));
+        return &m_blocks.back();
+    }
+
+    void flatten(ShadingSystem& shadingsys, int lane, const ClosureColor* c,
+                 const Color3& w)
+    {
+        if (!c)
+            return;
+        if (c->id == ClosureColor::MUL) {
+            flatten(shadingsys, lane, c->as_mul()->closure,
+                    w * c->as_mul()->weight);
+        } else if (c->id == ClosureColor::ADD) {
+            flatten(shadingsys, lane, c->as_add()->closureA, w);
+            flatten(shadingsys, lane, c->as_add()->closureB, w);
+        } else {
+            const ClosureComponent* comp = c->as_comp();
+            Color3 cw                    = w * Color3(comp->w);
+            if (cw == Color3(0.0f))
+                return;
+            ClosureBlock* b = find_block(shadingsys, comp->id);
+            if (!b)
+                return;
+            b->m_mask.set_on(lane);
+            // Blocks are SOA: WidthT values of each scalar component.
+            float* wp             = (float*)(base() + b->m_weight_offset);
+            wp[0 * WidthT + lane] = cw.x;
+            wp[1 * WidthT + lane] = cw.y;
+            wp[2 * WidthT + lane] = cw.z;
+            const char* data = (const char*)comp->data();
+            for (int i = 0, n = b->nparams(); i < n; ++i) {
+                const ClosureParam& p = b->m_params[i];
+                size_t size           = p.type.basesize();
+                char* dst             = base() + b->m_param_offsets[i];
+                for (size_t e = 0, ne = p.type.size() / size; e < ne; ++e)
+                    memcpy(dst + (e * WidthT + lane) * size,
+                           data + p.offset + e * size, size);
+            }
+        }
+    }
+
+    std::vector<ClosureBlock> m_blocks;
+    std::vector<char> m_storage;
+    std::vector<std::pair<int, int>> m_occurrences;  // Per lane: id, count
+};
+
+OSL_NAMESPACE_EXIT
@@ -329,6 +329,11 @@ public:
     /// for the operations.
     ///
     /// out_num_points will contain the number of points found, always < max_points
+    ///
+    /// One call covers every active lane of the batch (results.mask()),
+    /// each lane being its own query, so a renderer with a kNN search
+    /// that handles several queries at once can answer the whole batch
+    /// in a single pass.  Lanes not in the mask must be left untouched.
 
     // To enable sharing of single mask with multiple outputs we use
     // a class to encapsulate multiple wide pointers with a single mask.
@@ -436,6 +441,11 @@ public:
 
     /// Immediately trace a ray from P in the direction R.  Return true
     /// if anything hit, otherwise false.
+    ///
+    /// The rays of all active lanes (result.mask()) that share the same
+    /// options arrive in one call, as a packet suitable for a stream or
+    /// packet BVH traversal; lanes whose optional trace arguments differ
+    /// are split into separate calls, one per distinct set of options.
     virtual void trace(TraceOpt& options, BatchedShaderGlobals* bsg,
                        Masked<int> result, Wide<const Vec3> wP,
                        Wide<const Vec3> wdPdx, Wide<const Vec3> wdPdy,
@@ -446,8 +456,6 @@ public:
                             ustringhash source, ustringhash name,
                             MaskedData wval);
 
-    // pointcloud_search is T.B.D.
-
     /// Return a pointer to the texture system (if available).
     virtual TextureSystem* texturesys() const;
 
@@ -139,6 +139,48 @@ template<int WidthT> struct alignas(64) VaryingShaderGlobals {
     /// If nonzero, we are shading the back side of a surface.
     Block<int> backfacing;
 
+    /// Set the lanes of the mask from an array of ShaderGlobals, lane i's
+    /// at sg + i*stride_bytes (so the array may be of a renderer's own
+    /// per-hit structs, each holding a ShaderGlobals at the same offset).
+    /// Each member is transposed by a gather_strided, rather than a lane
+    /// at a time.
+    void gather(const ShaderGlobals* sg, size_t stride_bytes,
+                Mask<WidthT> mask)
+    {
+#define __OSL_GATHER(VARIABLE_NAME) \
+    gather_strided(VARIABLE_NAME, &sg->VARIABLE_NAME, stride_bytes, mask)
+        __OSL_GATHER(P);
+        __OSL_GATHER(dPdx);
+        __OSL_GATHER(dPdy);
+        __OSL_GATHER(dPdz);
+        __OSL_GATHER(I);
+        __OSL_GATHER(dIdx);
+        __OSL_GATHER(dIdy);
+        __OSL_GATHER(N);
+        __OSL_GATHER(Ng);
+        __OSL_GATHER(u);
+        __OSL_GATHER(dudx);
+        __OSL_GATHER(dudy);
+        __OSL_GATHER(v);
+        __OSL_GATHER(dvdx);
+        __OSL_GATHER(dvdy);
+        __OSL_GATHER(dPdu);
+        __OSL_GATHER(dPdv);
+        __OSL_GATHER(time);
+        __OSL_GATHER(dtime);
+        __OSL_GATHER(dPdtime);
+        __OSL_GATHER(Ps);
+        __OSL_GATHER(dPsdx);
+        __OSL_GATHER(dPsdy);
+        __OSL_GATHER(object2common);
+        __OSL_GATHER(shader2common);
+        __OSL_GATHER(Ci);
+        __OSL_GATHER(surfacearea);
+        __OSL_GATHER(flipHandedness);
+        __OSL_GATHER(backfacing);
+#undef __OSL_GATHER
+    }
+
     void dump()
     {
 #define __OSL_DUMP(VARIABLE_NAME) VARIABLE_NAME.dump(#VARIABLE_NAME)
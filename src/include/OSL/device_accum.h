@@ -0,0 +1,164 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/oslconfig.h>
+
+/// Deepest an Accumulator's pushState() may go.  The saved states live
+/// inside the Accumulator, so define this before including accum.h to
+/// trade its size for depth (the library doesn't depend on it).
+#ifndef OSL_ACCUMULATOR_MAX_DEPTH
+#    define OSL_ACCUMULATOR_MAX_DEPTH 16
+#endif
+
+OSL_NAMESPACE_ENTER
+
+/// The compiled tables of an AccumAutomata, as plain ints in one block
+/// with no pointers, ustrings or containers, so that it can be copied as
+/// it is to a GPU and stepped there by label IDs.  The block starts with
+/// this header, and AccumAutomata::getDeviceTable() makes it.  Label IDs
+/// are those of AccumAutomata::getSymbolId(), looked up on the host.
+struct DeviceAccumAutomata {
+    int nstates;
+    int nsymbols;  ///< Label IDs, 0 to nsymbols-1
+    int noutputs;  ///< Outputs the rules write, 0 to noutputs-1
+    // Offsets, in ints from the start of the header, of the arrays
+    int transitions_offset;  ///< Next state by [state * nsymbols + ID]
+    int states_offset;       ///< First rule and number of rules by state
+    int rules_offset;        ///< Output index and to-alpha flag by rule
+
+    OSL_HOSTDEVICE const int* ints() const { return (const int*)this; }
+
+    OSL_HOSTDEVICE int getTransition(int state, int symbol_id) const
+    {
+        return ints()[transitions_offset + state * nsymbols + symbol_id];
+    }
+
+    /// The rules of a state, as count pairs of output index and to-alpha
+    /// flag.
+    OSL_HOSTDEVICE const int* getRules(int state, int& count) const
+    {
+        const int* s = ints() + states_offset + 2 * state;
+        count        = s[1];
+        return ints() + rules_offset + 2 * s[0];
+    }
+};
+
+
+
+/// What a DeviceAccumulator accumulated for one output of the rules
+struct DeviceAovOutput {
+    Color3 color;
+    float alpha;
+    bool has_color;  ///< Whether some value was added to color
+    bool has_alpha;  ///< Whether some value was added to alpha
+
+    OSL_HOSTDEVICE void reset()
+    {
+        color     = Color3(0.0f, 0.0f, 0.0f);
+        alpha     = 0.0f;
+        has_color = has_alpha = false;
+    }
+};
+
+
+
+/// The Accumulator of a DeviceAccumAutomata: the same walk of the light
+/// path, by label IDs only, with no allocations and no virtual calls, so
+/// that it can live on the stack of a GPU thread as well as of a CPU
+/// one.  The caller owns the outputs, noutputs of them, and reads them
+/// once the path is done (applying any inversion of its AOVs itself).
+class DeviceAccumulator {
+public:
+    OSL_HOSTDEVICE DeviceAccumulator(const DeviceAccumAutomata* automata,
+                                     DeviceAovOutput* outputs)
+        : m_automata(automata), m_outputs(outputs)
+    {
+    }
+
+    /// If the machine is broken no result will be stored, you can cut the
+    /// branch
+    OSL_HOSTDEVICE bool broken() const { return m_state < 0; }
+
+    OSL_HOSTDEVICE void pushState()
+    {
+        OSL_DASSERT(m_state >= 0);
+        OSL_DASSERT(m_depth < OSL_ACCUMULATOR_MAX_DEPTH);
+        m_stack[m_depth++] = m_state;
+    }
+
+    OSL_HOSTDEVICE void popState()
+    {
+        OSL_DASSERT(m_depth > 0);
+        m_state = m_stack[--m_depth];
+    }
+
+    /// Go back to the initial state with an empty stack and cleared
+    /// outputs, to start another path
+    OSL_HOSTDEVICE void reset()
+    {
+        m_state = 0;
+        m_depth = 0;
+        for (int i = 0; i < m_automata->noutputs; ++i)
+            m_outputs[i].reset();
+    }
+
+    /// Push a single label
+    OSL_HOSTDEVICE void move(int symbol_id)
+    {
+        if (m_state >= 0)
+            m_state = m_automata->getTransition(m_state, symbol_id);
+    }
+
+    /// Push a -1 terminated array of labels
+    OSL_HOSTDEVICE void move(const int* symbol_ids)
+    {
+        while (m_state >= 0 && symbol_ids && *symbol_ids >= 0)
+            m_state = m_automata->getTransition(m_state, *(symbol_ids++));
+    }
+
+    /// Push the labels of a scattering event, custom can be null
+    OSL_HOSTDEVICE void move(int event, int scatt, const int* custom,
+                             int stop)
+    {
+        move(event);
+        move(scatt);
+        move(custom);
+        move(stop);
+    }
+
+    /// Send a result to whatever rules might be active in the current state
+    OSL_HOSTDEVICE void accum(const Color3& color)
+    {
+        if (m_state < 0)
+            return;
+        int count        = 0;
+        const int* rules = m_automata->getRules(m_state, count);
+        for (int i = 0; i < count; ++i) {
+            DeviceAovOutput& out = m_outputs[rules[2 * i]];
+            if (rules[2 * i + 1]) {
+                out.alpha += (color.x + color.y + color.z) * (1.0f / 3.0f);
+                out.has_alpha = true;
+            } else {
+                out.color += color;
+                out.has_color = true;
+            }
+        }
+    }
+
+    OSL_HOSTDEVICE const DeviceAovOutput& getOutput(int idx) const
+    {
+        return m_outputs[idx];
+    }
+
+private:
+    const DeviceAccumAutomata* m_automata;
+    DeviceAovOutput* m_outputs;
+    int m_state = 0;
+    int m_depth = 0;
+    int m_stack[OSL_ACCUMULATOR_MAX_DEPTH];
+};
+
+OSL_NAMESPACE_EXIT
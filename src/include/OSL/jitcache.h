@@ -0,0 +1,63 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <string>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_ENTER
+
+/// A store of JIT compiled objects (or PTX) shared more widely than a
+/// node's "jit_cache_dir" -- by all the nodes of a render farm, say.  Set
+/// one with the "jit_cache_backend" ShadingSystem attribute, and it backs
+/// the jit_cache_dir: what a node misses in its directory it looks for in
+/// the backend before compiling, and what it compiles it stores in both,
+/// so each group is compiled about once for the whole farm.
+///
+/// The keys are the names of the cache files, fingerprints of everything
+/// that went into the object, so a key always names the same bytes and
+/// a backend never needs to invalidate anything.  The methods are called
+/// from whichever threads compile, at the same time, so they must be
+/// thread safe.  A backend that fails should just report a miss, or that
+/// it didn't store the object; the group still compiles.
+class OSLEXECPUBLIC JITCacheBackend {
+public:
+    virtual ~JITCacheBackend() {}
+
+    /// Set data to what was stored under key and return true, or return
+    /// false if nothing was.
+    virtual bool get(string_view key, std::string& data) = 0;
+
+    /// Store data under key, returning true if it was stored.
+    virtual bool put(string_view key, string_view data) = 0;
+};
+
+
+
+/// A JITCacheBackend that keeps the objects in a Redis server, as the
+/// values of keys "<prefix><key>", expiring ttl seconds after they're
+/// stored (or never, if ttl is 0).  Each call makes a connection of its
+/// own, which costs little next to compiling a group, and gives up on a
+/// server that takes more than timeout_ms to answer.  Setting the
+/// "jit_cache_redis" ShadingSystem attribute to "host[:port]" makes one.
+/// (Not available on Windows, where get and put always fail.)
+class OSLEXECPUBLIC RedisJITCache final : public JITCacheBackend {
+public:
+    RedisJITCache(string_view host, int port = 6379, int ttl = 0,
+                  int timeout_ms = 2000, string_view prefix = "osl:jit:");
+
+    bool get(string_view key, std::string& data) override;
+    bool put(string_view key, string_view data) override;
+
+private:
+    std::string m_host;
+    int m_port;
+    int m_ttl;
+    int m_timeout_ms;
+    std::string m_prefix;
+};
+
+OSL_NAMESPACE_EXIT
@@ -6,6 +6,10 @@
 
 #include <OSL/oslconfig.h>
 
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -17,6 +21,7 @@ namespace llvm {
 class BasicBlock;
 class Constant;
 class ConstantFolder;
+class DataLayout;
 class DIBuilder;
 class DICompileUnit;
 class DIFile;
@@ -34,6 +39,7 @@ class LLVMContext;
 class Module;
 class PointerType;
 class StringRef;
+class TargetOptions;
 class Type;
 class Value;
 class VectorType;
@@ -48,6 +54,8 @@ class PassManager;
 
 OSL_NAMESPACE_ENTER
 
+class JITCacheBackend;
+
 namespace pvt {  // OSL::pvt
 
 
@@ -107,6 +115,34 @@ public:
     bool jit_fma() const { return m_jit_fma; }
     void jit_aggressive(bool val) { m_jit_aggressive = val; }
     bool jit_aggressive() const { return m_jit_aggressive; }
+    /// Favor JIT speed over code quality: no machine code optimization.
+    /// Used for tier-0 code that will later be replaced.
+    void jit_fast(bool val) { m_jit_fast = val; }
+    bool jit_fast() const { return m_jit_fast; }
+    /// Emit constant pointers (ustring characters, constant data,
+    /// texture handles, ...) as references to external symbols that are
+    /// bound to this process's addresses when the object is loaded, rather
+    /// than as immediate addresses. The machine code is then valid in any
+    /// process, which is what lets the JIT object cache be shared between
+    /// runs and machines. MCJIT only; must be set before generating IR.
+    void jit_relocatable(bool val) { m_jit_relocatable = val; }
+    bool jit_relocatable() const { return m_jit_relocatable; }
+
+    /// Optimize with this new pass manager pipeline rather than the legacy
+    /// passes picked by setup_optimization_passes(): one of the presets
+    /// "fast", "default" (for the optimization level) or "heavy", or a
+    /// textual pipeline description as used by `opt -passes=`. Empty
+    /// means to use the legacy passes. Ignored for LLVM < 14. Must be set
+    /// before setup_optimization_passes().
+    void pass_pipeline(string_view p) { m_pass_pipeline = p; }
+    const std::string& pass_pipeline() const { return m_pass_pipeline; }
+
+    /// Seconds spent in each named pass by do_optimize() when running a
+    /// new pass manager pipeline, exclusive of nested passes.
+    const std::map<std::string, double>& pass_times() const
+    {
+        return m_pass_times;
+    }
 
     // Select whether the representation of a ustring is going to be
     // the character pointer, or the hash.
@@ -132,6 +168,8 @@ public:
         m_llvm_module       = m;
         m_ModuleIsFinalized = false;
         m_ModuleIsPruned    = false;
+        m_reloc_globals.clear();
+        m_reloc_symbols.clear();
     }
 
     /// Create a new empty module.
@@ -139,7 +177,9 @@ public:
 
     /// Create a new module, populated with functions from the buffer
     /// bitcode[0..size-1].  The name identifies the buffer.  If err is not
-    /// NULL, error messages will be stored there.
+    /// NULL, error messages will be stored there.  The bitcode is parsed
+    /// only the first time it's asked for on this thread, and copied
+    /// after that, so it must not change while the PerThreadInfo lives.
     llvm::Module* module_from_bitcode(const char* bitcode, size_t size,
                                       const std::string& name = std::string(),
                                       std::string* err        = NULL);
@@ -198,6 +238,24 @@ public:
         std::string* err = nullptr, TargetISA requestedISA = TargetISA::NONE,
         bool debugging_symbols = false, bool profiling_events = false);
 
+    /// As an alternative to make_jit_execengine(), JIT the current module
+    /// with a shared ORC LLJIT rather than a new MCJIT ExecutionEngine.
+    /// The JIT (and the code it compiles) is shared by all LLVM_Util
+    /// instances using the same target, with the same lifetime rules as
+    /// MCJIT memory (see ScopedJitMemoryUser). If compile_threads > 1,
+    /// the module is split into that many partitions that are compiled
+    /// concurrently. If lazy is true, each function is only compiled the
+    /// first time it is called (through a stub), so functions that never
+    /// run are never compiled. Debugging symbols and profiling events are
+    /// not supported. Return true on success; on failure (including when
+    /// built against an LLVM too old for ORC), put any errors in err.
+    bool make_orc_jit(std::string* err = nullptr,
+                      TargetISA requestedISA = TargetISA::NONE,
+                      int compile_threads = 0, bool lazy = false);
+
+    /// Is the current module being JITed by ORC (see make_orc_jit)?
+    bool using_orc_jit() const { return m_orc != nullptr; }
+
     /// Report the host's TargetISA as chosen by the last call to
     /// make_jit_execengine() or to detect_cpu_features(). Don't call
     /// target_isa() unless one of those has previously been called.
@@ -249,6 +307,10 @@ public:
         llvm::Type* Ty,
         const std::vector<unsigned int>& expected_offset_by_index);
 
+    /// Return the offset in bytes of element `index` of the struct type
+    /// Ty, as the JIT lays it out.
+    size_t struct_element_offset(llvm::Type* Ty, int index) const;
+
 
     /// Return a pointer to the current ExecutionEngine.  Create a JITing
     /// ExecutionEngine if one isn't already set up.
@@ -263,6 +325,83 @@ public:
     /// current one).
     void execengine(llvm::ExecutionEngine* exec);
 
+    /// Use a persistent on-disk cache of JIT-compiled object code, kept in
+    /// directory `dir`, for the current module and ExecutionEngine. The
+    /// cache key is a fingerprint of the module's bitcode combined with
+    /// the OSL/LLVM versions and the JIT target and options, so this must
+    /// be called after the IR is complete but before the first call to
+    /// getPointerToFunction(). Return true if a previously cached object
+    /// was found, in which case the caller may skip IR optimization since
+    /// the cached code will be used instead of generating it anew.
+    ///
+    /// If wait_ms > 0 and the object isn't cached yet, but another
+    /// process sharing the directory is already compiling it, wait up to
+    /// wait_ms milliseconds for it to be stored rather than compiling it
+    /// here as well.
+    ///
+    /// For a cache shared by hosts with different ISAs, `variant_isas`
+    /// lists ISAs whose objects are kept in it too: without an object for
+    /// this host's ISA, the one for the best of those that this host
+    /// supports is used, and compiling the module also stores the
+    /// objects for all of them, for the other hosts to load.
+    bool jit_object_cache(string_view dir, int wait_ms = 0,
+                          const std::vector<TargetISA>& variant_isas = {});
+
+    /// Was a newly compiled object written to the JIT object cache?
+    bool jit_object_cache_stored() const;
+
+    /// Was the cached object found by waiting for another process to
+    /// compile it?
+    bool jit_object_cache_waited() const;
+
+    /// Was the cached object one compiled for another of the
+    /// variant_isas than this host's?
+    bool jit_object_cache_variant() const;
+
+    /// How many objects for other variant_isas were compiled and stored.
+    int jit_object_cache_variants_stored() const;
+
+    /// Back the JIT object and PTX caches with `backend` (or none, if
+    /// it's null): a cache file missing from the directory is fetched from
+    /// it before compiling, and a newly stored file is also put in it.
+    void jit_cache_backend(JITCacheBackend* backend)
+    {
+        m_cache_backend = backend;
+    }
+
+    /// Did the cached object or PTX come from the backend?
+    bool jit_cache_fetched() const { return m_cache_fetched; }
+
+    /// How many newly compiled objects or PTX were put in the backend.
+    int jit_cache_shared() const;
+
+    /// The name within cache directory `dir` for the result of compiling
+    /// the current module, a fingerprint of the module's bitcode and of
+    /// `options`, which must name everything else that affects the result.
+    std::string module_cache_file(string_view dir, string_view options,
+                                  string_view extension);
+
+    /// module_cache_file() for each of several `options`, fingerprinting
+    /// the bitcode only once.
+    std::vector<std::string>
+    module_cache_files(string_view dir, const std::vector<std::string>& options,
+                       string_view extension);
+
+    /// Bytes of code and data that the JIT has allocated for the modules
+    /// of this LLVM_Util so far (MCJIT only; ORC allocates on its own).
+    size_t jit_memory() const { return m_jit_memory; }
+
+    /// Have the modules JITed from now on (by MCJIT) allocate their code
+    /// and data from a memory manager of their own, rather than from the
+    /// one shared by everything this thread compiles, so that the memory
+    /// can be freed by letting go of jit_memory_owner().
+    void own_jit_memory();
+
+    /// What holds the memory of the modules JITed since own_jit_memory()
+    /// (null if there was none, or ORC was used): their code stays valid
+    /// only as long as some copy of it is kept.
+    std::shared_ptr<void> jit_memory_owner() const;
+
     enum class Linkage {
         External,  // Externally visible
         LinkOnceODR,  // One Definition Rule:  Inline version, but allow replacement by equivalent.
@@ -280,6 +419,35 @@ public:
         Linkage default_linkage = Linkage::Internal,
         std::string* out_err    = nullptr);
 
+    /// Materialize every function of the current module and give each
+    /// defined one external linkage, so that all of them survive
+    /// optimization and can be looked up after JIT. Used to compile a
+    /// function library once, for many modules to share. Return the
+    /// defined functions.
+    std::vector<llvm::Function*> export_all_functions(std::string* out_err
+                                                      = nullptr);
+
+    /// Replace each function defined in the current module that also has
+    /// a compiled copy in `library` (by name) with a declaration bound to
+    /// that copy, unless it is in `keep`, is marked always-inline, or has
+    /// fewer than `min_instructions` instructions -- those are the ones
+    /// worth cloning in for the optimizer to inline. Call after pruning.
+    /// Return the number of functions so linked.
+    int link_shared_functions(
+        const std::unordered_map<std::string, void*>& library,
+        const std::unordered_set<llvm::Function*>& keep,
+        int min_instructions);
+
+    /// Settle inlining at each call to a function defined in the current
+    /// module (and not in `keep`), by a rough estimate of the cycles one
+    /// run of the callee takes: callees no costlier than `call_cost`, the
+    /// price of the call itself, are always inlined, and those costlier
+    /// than `max_inline_cost`, for which the call is noise, never are.
+    /// The calls in between are left to the optimizer's inliner. Call
+    /// before optimization. Return the number of call sites decided.
+    int apply_inline_costs(const std::unordered_set<llvm::Function*>& keep,
+                           int call_cost, int max_inline_cost);
+
     OSL_DEPRECATED("prune_and_internalize_module is better (1.13)")
     void internalize_module_functions(
         const std::string& prefix, const std::vector<std::string>& exceptions,
@@ -533,6 +701,11 @@ public:
     llvm::Type* type_longlong() const { return m_llvm_type_longlong; }
     llvm::Type* type_void() const { return m_llvm_type_void; }
     llvm::Type* type_triple() const { return m_llvm_type_triple; }
+    /// A triple as the LLVM vector <3 x float>, rather than a Vec3 struct
+    llvm::Type* type_triple_vector() const
+    {
+        return m_llvm_type_triple_vector;
+    }
     llvm::Type* type_matrix() const { return m_llvm_type_matrix; }
     llvm::Type* type_typedesc() const { return m_llvm_type_longlong; }
     llvm::Type* type_ustring() { return m_llvm_type_ustring; }
@@ -837,6 +1010,13 @@ public:
     /// call_function()) as using the 'fast' calling convention.
     void mark_fast_func_call(llvm::Value* funccall);
 
+    /// Mark the function as rarely executed (cold), so it is optimized for
+    /// size, not inlined into its callers, and laid out away from hot code.
+    void mark_function_cold(llvm::Function* func);
+
+    /// Mark the function as frequently executed, encouraging the inliner.
+    void mark_function_hot(llvm::Function* func);
+
     /// Set the code insertion point for subsequent ops to block.
     void set_insert_point(llvm::BasicBlock* block);
 
@@ -854,6 +1034,20 @@ public:
     void op_branch(llvm::Value* cond, llvm::BasicBlock* trueblock,
                    llvm::BasicBlock* falseblock);
 
+    /// As above, but also attach profile branch weights telling the
+    /// optimizer how often each direction was observed to be taken.
+    void op_branch(llvm::Value* cond, llvm::BasicBlock* trueblock,
+                   llvm::BasicBlock* falseblock, uint32_t trueweight,
+                   uint32_t falseweight);
+
+    /// Generate an atomic (relaxed) *ptr += val, for counters that may be
+    /// bumped by many threads at once.
+    void op_atomic_add(llvm::Value* ptr, llvm::Value* val);
+
+    /// Generate a read of the processor's cycle counter, as a long long
+    /// (llvm.readcyclecounter; rdtsc on x86).
+    llvm::Value* op_readcyclecounter();
+
     /// Generate code for a memset.
     void op_memset(llvm::Value* ptr, int val, int len, int align = 1);
 
@@ -876,6 +1070,17 @@ public:
 
     llvm::Value* op_gather(llvm::Value* ptr, llvm::Value* index);
 
+    /// Load the triple that ptr points to as one <3 x float> (see
+    /// type_triple_vector), rather than as three floats.
+    llvm::Value* op_load_triple_vector(llvm::Value* ptr);
+
+    /// Store a <3 x float> to the triple that ptr points to.
+    void op_store_triple_vector(llvm::Value* val, llvm::Value* ptr);
+
+    /// Return the <3 x float> of the floats x, y and z.
+    llvm::Value* op_triple_vector(llvm::Value* x, llvm::Value* y,
+                                  llvm::Value* z);
+
     /// Store to a dereferenced pointer
     /// respecting the current mask & masking_enabled flag:   *ptr = val
     void op_store(llvm::Value* val, llvm::Value* ptr);
@@ -894,6 +1099,11 @@ public:
     void op_scatter(llvm::Value* wide_val, llvm::Value* ptr,
                     llvm::Value* wide_index);
 
+    /// Scatter a wide int8 or int16 (e.g. from op_float_to_storage) to
+    /// ptr[wide_index] for the lanes of the current mask.
+    void op_scatter_narrow(llvm::Value* wide_val, llvm::Value* ptr,
+                           llvm::Value* wide_index);
+
     // N.B. "GEP" -- GetElementPointer -- is a particular LLVM-ism that is
     // the means for retrieving elements from some kind of aggregate: the
     // i-th field in a struct, the i-th element of an array.  They can be
@@ -944,6 +1154,13 @@ public:
     llvm::Value* op_float_to_double(llvm::Value* a);
     llvm::Value* op_int_to_longlong(llvm::Value* a);
 
+    /// Convert a float (or wide float) to how a renderer stores it: the
+    /// bits of a half (as an int16) for HALF, or for UINT8 the value
+    /// clamped to [0,1] and scaled to a rounded [0,255] (as an int8).
+    /// Any other storage returns a as it is.
+    llvm::Value* op_float_to_storage(llvm::Value* a,
+                                     TypeDesc::BASETYPE storage);
+
     llvm::Value* op_and(llvm::Value* a, llvm::Value* b);
     llvm::Value* op_or(llvm::Value* a, llvm::Value* b);
     llvm::Value* op_xor(llvm::Value* a, llvm::Value* b);
@@ -992,15 +1209,35 @@ public:
     bool ptx_compile_group(llvm::Module* lib_module, const std::string& name,
                            std::string& out);
 
+    /// Use a persistent on-disk cache, kept in directory `dir`, of the PTX
+    /// that ptx_compile_group() generates for the current module (with no
+    /// lib_module).  It is keyed like jit_object_cache(), by the module's
+    /// bitcode and the versions and CUDA target.  Return true if cached
+    /// PTX was found, in which case it is in `out` and the module needn't
+    /// be optimized or compiled at all.  Otherwise the next
+    /// ptx_compile_group() stores the PTX it generates.
+    bool ptx_cache(string_view dir, std::string& out);
+
+    /// Was newly generated PTX written to the PTX cache?
+    bool ptx_cache_stored() const { return m_ptx_cache_stored; }
+
     /// Convert all functions in module's bitcode to a string.
     std::string bitcode_string(llvm::Module* module);
 
     /// Convert one function's bitcode to a string.
     std::string bitcode_string(llvm::Function* func);
 
+    /// Return a hash of the code of func, alike for functions that differ
+    /// only in their own name and the names of their values (which are
+    /// cleared).
+    uint64_t function_fingerprint(llvm::Function* func);
+
     /// Convert entire module's bitcode to a string.
     std::string module_string();
 
+    /// Number of IR instructions in the function bodies of the module.
+    size_t module_instruction_count() const;
+
     /// Delete the IR for the body of the given function to reclaim its
     /// memory (only helpful if we know we won't use it again).
     void delete_func_body(llvm::Function* func);
@@ -1010,29 +1247,67 @@ public:
 
     std::string func_name(llvm::Function* f);
 
+    /// Total bytes of code and data that the JIT has allocated, and which
+    /// are held until the last ScopedJitMemoryUser is gone.
     static size_t total_jit_memory_held();
 
+    /// Total bytes of code and data that the JIT allocated for modules
+    /// with memory of their own (see own_jit_memory), since freed.
+    static size_t total_jit_memory_freed();
+
+    /// Should the memory managers made from now on pack the JITed code
+    /// and data of all groups into shared huge-page regions (on Linux)?
+    static void use_jit_huge_pages(bool on);
+
 private:
     class MemoryManager;
+    struct OwnedJitMemory;
+    class ObjectCache;
     class IRBuilder;
+    struct OrcState;
 
     void SetupLLVM();
     IRBuilder& builder();
+    llvm::TargetOptions jit_target_options() const;
+    const llvm::DataLayout& jit_data_layout() const;
+    void orc_finalize_module();
+    llvm::Constant* relocatable_ptr(void* p);
+    void run_pass_pipeline(std::string* out_err);
+    std::string jit_cache_options(TargetISA isa) const;
+    bool emit_cache_object(const llvm::Module& module, TargetISA isa,
+                           const std::string& filename) const;
 
     int m_debug;
     bool m_dumpasm           = false;
     bool m_jit_fma           = false;
     bool m_jit_aggressive    = false;
+    bool m_jit_fast          = false;
+    bool m_jit_relocatable   = false;
+    std::string m_pass_pipeline;
+    std::map<std::string, double> m_pass_times;
+    int m_optlevel           = 0;  ///< Last setup_optimization_passes level
     UstringRep m_ustring_rep = UstringRep::charptr;
     PerThreadInfo::Impl* m_thread;
     llvm::LLVMContext* m_llvm_context;
     llvm::Module* m_llvm_module;
     IRBuilder* m_builder;
     llvm::SectionMemoryManager* m_llvm_jitmm;
+    size_t m_jit_memory = 0;  ///< Bytes the JIT allocated for our modules
+    std::shared_ptr<OwnedJitMemory> m_owned_jitmm;  ///< See own_jit_memory
     llvm::Function* m_current_function;
     llvm::legacy::PassManager* m_llvm_module_passes;
     llvm::legacy::FunctionPassManager* m_llvm_func_passes;
     llvm::ExecutionEngine* m_llvm_exec;
+    std::unique_ptr<ObjectCache> m_object_cache;
+    bool m_object_cache_variant = false;  ///< Loaded another ISA's object
+    std::string m_ptx_cache_file;     ///< Where ptx_compile_group stores
+    bool m_ptx_cache_stored = false;  ///< ptx_compile_group stored PTX
+    JITCacheBackend* m_cache_backend = nullptr;  ///< Behind the cache dir
+    bool m_cache_fetched             = false;  ///< Cache hit from backend
+    bool m_ptx_cache_shared          = false;  ///< Put PTX in the backend
+    std::unordered_map<void*, llvm::Constant*> m_reloc_globals;
+    std::vector<std::pair<std::string, void*>> m_reloc_symbols;
+    std::unique_ptr<OrcState> m_orc;
     TargetISA m_target_isa = TargetISA::UNKNOWN;
 
     std::vector<llvm::BasicBlock*> m_return_block;      // stack for func call
@@ -1053,6 +1328,7 @@ private:
     llvm::Type* m_llvm_type_longlong;
     llvm::Type* m_llvm_type_void;
     llvm::Type* m_llvm_type_triple;
+    llvm::Type* m_llvm_type_triple_vector;
     llvm::Type* m_llvm_type_matrix;
     llvm::Type* m_llvm_type_ustring;
     llvm::PointerType* m_llvm_type_void_ptr;
@@ -1184,6 +1460,7 @@ private:
 
     llvm::Value* op_linearize_16x_indices(llvm::Value* wide_index);
     llvm::Value* op_linearize_8x_indices(llvm::Value* wide_index);
+    llvm::Value* op_linearize_4x_indices(llvm::Value* wide_index);
     std::array<llvm::Value*, 2> op_split_16x(llvm::Value* vector_val);
     std::array<llvm::Value*, 2> op_split_8x(llvm::Value* vector_val);
     std::array<llvm::Value*, 4> op_quarter_16x(llvm::Value* vector_val);
@@ -9,6 +9,8 @@
 #include <OSL/export.h>
 #include <OSL/oslversion.h>
 
+#include <algorithm>
+#include <string>
 #include <vector>
 
 OSL_NAMESPACE_ENTER
@@ -20,50 +22,85 @@ class DfAutomata;
 ///
 /// Apparently hash maps suck in speed for our transition tables. This
 /// is a fast compact equivalent of the DfAutomata designed for read
-/// only operations.
+/// only operations. Every symbol that appears in a transition gets a
+/// small integer ID, and the transitions are a dense table of states by
+/// symbol IDs with the wildcards already folded in, so a transition by
+/// ID is a single load.
 ///
 class OSLEXECPUBLIC DfOptimizedAutomata {
 public:
     void compileFrom(const DfAutomata& dfautomata);
 
+    /// Append the tables to out, to be read back by deserialize in this
+    /// or another process.  Each rule is written as its index in rules,
+    /// which must hold all the rules of the states.
+    void serialize(std::string& out, const std::vector<void*>& rules) const;
+
+    /// Read back, from the start of in, tables that serialize wrote,
+    /// taking each rule index back to the pointer in rules, and advance in
+    /// past them.  Return false, leaving the automata as it was, if in
+    /// doesn't hold valid tables for these rules.
+    bool deserialize(OIIO::string_view& in, const std::vector<void*>& rules);
+
+    /// Get the ID of a symbol, for the getTransition taking IDs.  All
+    /// the symbols no transition mentions share one ID, that only
+    /// wildcards can follow.  Look up IDs once and reuse them, this is
+    /// a search.
+    int getSymbolId(OIIO::ustring symbol) const
+    {
+        auto found = std::lower_bound(m_symbols.begin(), m_symbols.end(),
+                                      symbol, symbol_comp);
+        if (found != m_symbols.end() && *found == symbol)
+            return int(found - m_symbols.begin());
+        return int(m_symbols.size());
+    }
+
+    /// Number of symbol IDs, which are 0 to getNumSymbolIds()-1
+    int getNumSymbolIds() const { return m_nsymbol_ids; }
+
+    size_t getNumStates() const { return m_states.size(); }
+
+    /// Number of rule pointers stored, after sharing identical lists
+    size_t getNumRuleEntries() const { return m_rules.size(); }
+
+    /// Bytes used by the tables
+    size_t memory() const
+    {
+        return m_symbols.size() * sizeof(OIIO::ustring)
+               + m_table.size() * sizeof(int)
+               + m_rules.size() * sizeof(void*)
+               + m_states.size() * sizeof(State);
+    }
+
+    int getTransition(int state, int symbol_id) const
+    {
+        return m_table[size_t(state) * m_nsymbol_ids + symbol_id];
+    }
+
     int getTransition(int state, OIIO::ustring symbol) const
     {
-        const State& mystate    = m_states[state];
-        const Transition* begin = &m_trans[mystate.begin_trans];
-        const Transition* end   = begin + mystate.ntrans;
-        while (begin < end) {  // binary search
-            const Transition* middle = begin + ((end - begin) >> 1);
-            if (symbol.data() < middle->symbol.data())
-                end = middle;
-            else if (middle->symbol.data() < symbol.data())
-                begin = middle + 1;
-            else  // match
-                return middle->state;
-        }
-        return mystate.wildcard_trans;
+        return getTransition(state, getSymbolId(symbol));
     }
 
     void* const* getRules(int state, int& count) const
     {
         count = m_states[state].nrules;
-        return &m_rules[m_states[state].begin_rules];
+        return m_rules.data() + m_states[state].begin_rules;
     }
 
 protected:
     struct State {
-        unsigned int begin_trans;
-        unsigned int ntrans;
         unsigned int begin_rules;
         unsigned int nrules;
-        int wildcard_trans;
-    };
-    struct Transition {
-        // we use this only for sorting
-        static bool trans_comp(const Transition& a, const Transition& b);
-        OIIO::ustring symbol;
-        int state;
     };
-    std::vector<Transition> m_trans;
+    // Order of m_symbols, any order will do as long as it's fast
+    static bool symbol_comp(OIIO::ustring a, OIIO::ustring b)
+    {
+        return a.data() < b.data();
+    }
+    std::vector<OIIO::ustring> m_symbols;  ///< Symbol of each ID, sorted
+    int m_nsymbol_ids = 1;  ///< m_symbols.size(), plus the "other" ID
+    std::vector<int> m_table;  ///< Next state by [state][symbol ID]
     std::vector<void*> m_rules;
     std::vector<State> m_states;
 };
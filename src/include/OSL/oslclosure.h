@@ -146,6 +146,21 @@ struct OSLEXECPUBLIC ClosureAdd : public ClosureColor {
     const ClosureColor* closureB;
 };
 
+/// ClosureFlatComponent is one entry of a closure flattened into a
+/// contiguous list (see ShadingSystem::flatten_closure), so that a renderer
+/// can build its BSDFs with a simple loop rather than a walk of the tree.
+struct ClosureFlatComponent {
+    int id;            ///< Closure id of the primitive component
+    Color3 weight;     ///< Its weight times those of the muls above it
+    const void* data;  ///< Its parameters, as ClosureComponent::data()
+
+    /// Handy method for extracting the parameters as a struct
+    template<typename T> OSL_HOSTDEVICE const T* as() const
+    {
+        return reinterpret_cast<const T*>(data);
+    }
+};
+
 /// Type for pointers to closures
 typedef ClosureColor* ClosureColorPtr;
 typedef ClosureComponent* ClosureComponentPtr;
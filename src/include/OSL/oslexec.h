@@ -5,6 +5,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include <OSL/oslconfig.h>
 #include <OSL/shaderglobals.h>
@@ -19,6 +20,8 @@ class RendererServices;
 class ShaderGroup;
 typedef std::shared_ptr<ShaderGroup> ShaderGroupRef;
 struct ClosureParam;
+struct ClosureFlatComponent;
+struct DeferredTraces;
 struct PerThreadInfo;
 class ShadingContext;
 class ShaderSymbol;
@@ -80,16 +83,31 @@ public:
     SymLocationDesc() {}
     SymLocationDesc(string_view name, TypeDesc type, bool derivs = false,
                     SymArena arena = SymArena::Heap, offset_t offset = -1,
-                    stride_t stride = AutoStride)
+                    stride_t stride = AutoStride,
+                    TypeDesc storage = TypeDesc::UNKNOWN)
         : name(name)
         , type(type)
+        , storage(storage)
         , offset(offset)
-        , stride(stride == AutoStride ? type.size() : stride)
         , arena(arena)
         , derivs(derivs)
     {
+        this->stride = (stride == AutoStride) ? stored_type().size() : stride;
     }
 
+    /// The type of the data at the location: `type`, but with the base
+    /// type of `storage` if one is given.
+    TypeDesc stored_type() const
+    {
+        TypeDesc t(type);
+        if (storage.basetype != TypeDesc::UNKNOWN)
+            t.basetype = storage.basetype;
+        return t;
+    }
+
+    /// Does the shader convert the symbol's values as it stores them?
+    bool converts() const { return stored_type().basetype != type.basetype; }
+
     bool operator==(ustring n) const { return name == n; }
     friend bool operator<(ustring n, const SymLocationDesc& sld)
     {
@@ -102,6 +120,9 @@ public:
 
     ustring name;   ///< Name of the symbol
     TypeDesc type;  ///< Data type of the symbol
+    /// For a float based output, the base type it is stored as instead of
+    /// float: HALF, or UINT8 (clamped to [0,1] and scaled to [0,255]).
+    TypeDesc storage;
     offset_t offset
         = -1;  ///< Offset from arena base for point 0 (batched mode assumes userdata at point 0 is readable)
     stride_t stride = AutoStride;      ///< Stride in bytes between shade points
@@ -184,8 +205,33 @@ public:
     /// Documented attributes are as follows:
     /// 1. Attributes that should be exposed to users:
     ///    int statistics:level   Automatically print OSL statistics (0).
+    ///    int fast_shutdown      If nonzero, destroying the ShadingSystem
+    ///                              only stops its threads and finishes
+    ///                              its output (printfs, point cloud
+    ///                              writes, captures and statistics),
+    ///                              leaving all its memory and JITed code
+    ///                              for the process exit to reclaim, for
+    ///                              a renderer about to exit. (0)
     ///    string searchpath:shader  Colon-separated path to search for .oso
     ///                                files ("", meaning test "." only)
+    ///    string searchpath:manifest  File listing shaders with the paths
+    ///                                of their .oso (or .osob), one
+    ///                                "name path" per line, relative to
+    ///                                the file unless absolute.  Shaders
+    ///                                it lists are loaded from there,
+    ///                                without searching. ("")
+    ///    int searchpath_index   If nonzero, list each searchpath:shader
+    ///                              dir once, on the first load, and find
+    ///                              shaders in that listing rather than
+    ///                              look for each in every dir, which
+    ///                              saves a storm of stats on network
+    ///                              file systems.  Shaders added to the
+    ///                              dirs later are not seen until the
+    ///                              searchpath is set again. (0)
+    ///    string shader_library_pack  An .oslpack (see "oslc -pack") to
+    ///                                mount; the shaders in it are loaded
+    ///                                from its memory mapping, ahead of
+    ///                                any searchpath.  "" unmounts. ("")
     ///    string colorspace      Name of RGB color space ("Rec709")
     ///    int range_checking     Generate extra code for component & array
     ///                              range checking (1)
@@ -193,22 +239,94 @@ public:
     ///                              when NaN/Inf happens (0).
     ///    int debug_uninit       Add extra (expensive) code to pinpoint
     ///                              use of uninitialized variables (0).
+    ///    int debug_sample       Run the debug_nan and debug_uninit checks
+    ///                              of groups JITed from now on for only
+    ///                              about 1 in N shades, picked at random
+    ///                              per context, so they may stay on in
+    ///                              production; the other shades branch
+    ///                              around them, and leave any NaN or
+    ///                              uninitialized value unrepaired. Range
+    ///                              checks, cheap and what keeps indexing
+    ///                              in bounds, still run for every shade.
+    ///                              (1, every shade)
     ///    int compile_report     Issue info messages to the renderer for
-    ///                              every shader compiled (0).
+    ///                              every shader compiled (0). At 2, also
+    ///                              list what each group needs; at 3, also
+    ///                              explain what the optimizer could not
+    ///                              remove (unfolded connections, costly
+    ///                              ops that survived, layers that can't be
+    ///                              lazy), by rough estimated cost.
     ///    int max_warnings_per_thread  Number of warning calls that should be
     ///                              processed per thread (100).
     ///    int buffer_printf      Buffer printf output from shaders and
     ///                              output atomically, to prevent threads
     ///                              from interleaving lines. (1)
+    ///    int printf_async       Hand the printf output of non-batched
+    ///                              shading over to a background thread to
+    ///                              print, so that threads printing don't
+    ///                              wait on each other.  Each context has a
+    ///                              ring of 4096 messages, and drops what
+    ///                              doesn't fit, counting it in a warning.
+    ///                              Errors and warnings are still printed
+    ///                              right away. (0)
+    ///    int printf_sample      Print only the first of every N calls of
+    ///                              each printf call site, per thread
+    ///                              (scalar shading only). (0 = all)
+    ///    int printf_rate_limit  Print at most N calls of each printf call
+    ///                              site per second, per thread (scalar
+    ///                              shading only). (0 = no limit)
     ///    int profile            Perform some rudimentary profiling (0)
+    ///    int lock_stats         Time the waits of all threads for the
+    ///                              locks of the shader masters, the
+    ///                              dictionaries and the point clouds, as
+    ///                              "stat:masters_lock_time" and so on.
+    ///                              The totals are for the whole process,
+    ///                              and stay on once any system sets it (0).
+    ///    int profile_instrument  Make scalar JITed code time itself with
+    ///                              probes that read a cycle counter: 1
+    ///                              times each layer, 2 also each source
+    ///                              line. Time spent running upstream
+    ///                              layers goes to those layers. Results
+    ///                              appear in getstats() and, as JSON, in
+    ///                              the string attribute
+    ///                              "stat:profile_instrument" (0).
     ///    int no_noise           Replace noise with constant value. (0)
     ///    int no_pointcloud      Skip pointcloud lookups. (0)
+    ///    int texture_stochastic  Make each texture() one fetch at a
+    ///                              random position in its footprint and
+    ///                              a random one of the MIP levels it
+    ///                              spans, rather than a filtered lookup;
+    ///                              it averages to the filtered result
+    ///                              over many samples.  1 fetches
+    ///                              bilinearly, 2 the closest texel. (0)
     ///    int exec_repeat        How many times to run each group (1).
+    ///    int shading_cache_size  MB of results of shading points to keep,
+    ///                              so that a group whose results depend
+    ///                              only on P, u, v, the ray type,
+    ///                              backfacing and objdata isn't run again
+    ///                              for a point it already ran on (see
+    ///                              "stat:shading_cache_hits").  Setting
+    ///                              it empties the cache; 0 is off. (0)
+    ///    float shading_cache_quantize  Size of the cells of P that are
+    ///                              treated as the same point by the
+    ///                              shading cache; 0 is exact. (0.001)
+    ///    float shading_cache_uv_quantize  Same, for u and v. (0.001)
     ///    int opt_warnings       Warn on failure to runtime-optimize certain
     ///                              shader constructs. (0)
     ///    int gpu_opt_error      Issue a hard error if certain shader
     ///                              constructs cannot be optimized away, which
     ///                              have no way to run on GPU. (0)
+    ///    string optix_entry_points  How the init and entry functions of
+    ///                              groups compiled for OptiX are emitted:
+    ///                              "direct" as direct callables,
+    ///                              "continuation" as continuation
+    ///                              callables, or "inline" as plain
+    ///                              functions, for a renderer that links
+    ///                              the group's code into its own hit
+    ///                              program.  The group_init_name and
+    ///                              group_entry_name group attributes
+    ///                              give the names to look them up by.
+    ///                              ("direct")
     /// 2. Attributes that should be set by applications/renderers that
     /// incorporate OSL:
     ///    string commonspace     Name of "common" coord system ("world")
@@ -237,8 +355,25 @@ public:
     ///    int userdata_isconnected  Should interpolated=1 params (that may
     ///                              receive userdata) return true from
     ///                              isconnected()? (0)
+    ///    int attribute_cache    Remember, per ShadingContext, the results
+    ///                              of getattribute queries that the
+    ///                              RendererServices declares cacheable
+    ///                              (see attribute_is_cacheable()), keyed by
+    ///                              objdata, object, name, type and index.
+    ///                              Call invalidate_attribute_cache() when
+    ///                              those values change, e.g. per frame (0).
+    ///    int regex_optimize     Compile regex_search/regex_match patterns
+    ///                              for faster matching, at some extra cost
+    ///                              for each pattern, which every context
+    ///                              shares (1).
     ///    int greedyjit          Optimize and compile all shaders up front,
     ///                              versus only as needed (0).
+    ///    int prefetch_textures  After optimize_all_groups, prefetch_textures()
+    ///                              everything textures_needed() returns (0).
+    ///    ptr compile_thread_pool  An OIIO::thread_pool* on which greedy
+    ///                              optimize_all_groups/jit_all_groups run
+    ///                              their workers, rather than spawning
+    ///                              threads of their own (nullptr).
     ///    int llvm_target_host   Target the specific host architecture for
     ///                              LLVM IR generation. (1)
     ///    int llvm_jit_fma       Allow fused mul/add (0). This can increase
@@ -250,13 +385,184 @@ public:
     ///                              "AVX2", "AVX2_noFMA", "AVX512",
     ///                              "AVX512_noFMA", or "host" means to
     ///                              figure out what the host can do. ("")
+    ///    string math_precision  Precision of the trig and transcendental
+    ///                              functions (sin, pow, exp, log, ...)
+    ///                              of groups JITed from now on: "fast"
+    ///                              for OIIO's fast_* approximations, or
+    ///                              "exact" for the system math library.
+    ///                              "" means the USE_FAST_MATH of the
+    ///                              build. Not yet honored by batched
+    ///                              shading. ("")
     ///    int llvm_jit_aggressive  Use LLVM "aggressive" JIT mode. (0)
+    ///    int llvm_vector_triples  Generate the add, sub, mul and neg of
+    ///                              triples (and their derivatives) as
+    ///                              <3 x float> vector ops, one load, op
+    ///                              and store each, rather than a float
+    ///                              at a time. Scalar shading only. (0)
+    ///    int llvm_jit_orc       JIT with LLVM's ORC LLJIT, shared by all
+    ///                              groups, rather than a separate MCJIT
+    ///                              engine per group (0).
+    ///    int jit_huge_pages     Pack the MCJIT code and data of all
+    ///                              groups into shared 2MB regions marked
+    ///                              for transparent huge pages (Linux), to
+    ///                              spare iTLB misses when there are many
+    ///                              groups. Takes effect for threads that
+    ///                              have not JITed yet, so set it early (0).
+    ///    int llvm_jit_threads   With llvm_jit_orc, split each group into
+    ///                              this many partitions that are compiled
+    ///                              concurrently (0 = compile serially).
+    ///    int llvm_jit_lazy      With llvm_jit_orc and lazylayers, compile
+    ///                              each layer function only when it is
+    ///                              first called, so layers that never run
+    ///                              cost no codegen (0).
+    ///    int llvm_shared_shadeops  Compile the shadeop library once per
+    ///                              process, and have groups call its
+    ///                              larger functions rather than clone and
+    ///                              compile them again, keeping only what
+    ///                              gets inlined (0).
+    ///    int llvm_inline_max_cost  Nonzero: inline every call to a
+    ///                              library function estimated to cost
+    ///                              less than the call, and none to one
+    ///                              estimated to cost more than this many
+    ///                              cycles, leaving the rest to LLVM (0).
+    ///    int tiered_jit         Nonzero: JIT each group quickly with cheap
+    ///                              optimization first, then re-JIT it at
+    ///                              full optimization on a background
+    ///                              thread, most-executed groups first (0).
+    ///    int opt_share_groups   Nonzero: groups that are structurally
+    ///                              identical (same shaders, parameter
+    ///                              values, connections, entry layers,
+    ///                              outputs, raytypes and symlocs) share a
+    ///                              single optimized and JITed copy instead
+    ///                              of each being compiled (0). Groups with
+    ///                              interactive parameters never share.
+    ///    int reparam_reoptimize Nonzero: allow ReParameter of ordinary
+    ///                              (not interactive) params of optimized
+    ///                              groups. If the optimized code never
+    ///                              depended on the value, it is just
+    ///                              stored; otherwise the group is rebuilt
+    ///                              to be re-optimized and re-JITed on its
+    ///                              next use. The group must not be
+    ///                              executing at the time (0).
+    ///    int jit_release_memory  Once a group is JITed for good, also free
+    ///                              the connection lists of all its layers
+    ///                              (not only the unused ones) and cut its
+    ///                              symbol tables down to the params. The
+    ///                              "pickle" of such a group then lacks its
+    ///                              connections, and find_symbol only finds
+    ///                              its params (0).
+    ///    int tiered_jit_profile With tiered_jit, if nonzero, have the fast
+    ///                              code count how often each layer runs,
+    ///                              and re-JIT a group only after it has
+    ///                              executed this many times, using the
+    ///                              counts to mark layers hot or cold and
+    ///                              weight their call branches (0).
+    ///    int async_compile_threads  Number of threads that compile the
+    ///                              groups of optimize_group_async (1).
+    ///    int async_placeholder  Nonzero: a shade of a group still waiting
+    ///                              for optimize_group_async does nothing
+    ///                              (execute returns false), instead of
+    ///                              compiling the group itself (0).
+    ///    int raytype_variant_threshold  If nonzero, a raytype variant of a
+    ///                              group (see add_raytype_variant) is not
+    ///                              compiled on its first use, but in the
+    ///                              background once this many shades have
+    ///                              asked for it, running the general group
+    ///                              in the meantime (0).
     ///    int vector_width       Vector width to allow for SIMD ops (4).
     ///    int llvm_debugging_symbols  When JITing, generate debug symbols
     ///                             that associate machine code with shader
     ///                             source and lines. (0)
     ///    int llvm_profiling_events  When JITing, generate events to enable
-    ///                             full profiling of shaders. (0)
+    ///                             full profiling of shaders: for VTune
+    ///                             and, on Linux, for perf, which finds
+    ///                             the JITed "group_layer" functions in
+    ///                             /tmp/perf-<pid>.map (and in jitdump
+    ///                             files, if LLVM was built with
+    ///                             LLVM_USE_PERF). (0)
+    ///    string jit_cache_dir   Directory for a persistent cache of JIT
+    ///                              compiled objects, reused when a later
+    ///                              run compiles an identical group. The
+    ///                              objects are address independent, so a
+    ///                              cache may be filled ahead of time (e.g.
+    ///                              by testshade) and shared by many
+    ///                              processes. With OptiX, the cache holds
+    ///                              each group's PTX instead, and since
+    ///                              identical PTX makes identical OptiX
+    ///                              modules, OptiX's own module disk cache
+    ///                              then hits as well. ("", meaning no cache)
+    ///    int jit_cache_wait     If nonzero, render processes sharing a
+    ///                              jit_cache_dir (e.g. one in /dev/shm,
+    ///                              for processes on one node) JIT each
+    ///                              group once: when one process is
+    ///                              already compiling a group, the others
+    ///                              wait up to this many milliseconds for
+    ///                              its object and load that. (0)
+    ///    string jit_cache_targets  Comma-separated list of other ISAs
+    ///                              (e.g. "AVX2,AVX512") whose objects
+    ///                              the jit_cache_dir also holds, for a
+    ///                              cache shared by hosts of several ISAs:
+    ///                              compiling a group also stores its
+    ///                              objects for all of these, and a host
+    ///                              with no object for its own ISA loads
+    ///                              the best of these that it can run.
+    ///                              ("")
+    ///    ptr jit_cache_backend  A JITCacheBackend* (see OSL/jitcache.h)
+    ///                              behind the jit_cache_dir, shared by the
+    ///                              nodes of a farm: objects (or PTX) that
+    ///                              miss the directory are fetched from it
+    ///                              before compiling, and compiled ones
+    ///                              are put in it, so every node gets the
+    ///                              group that one of them compiled. It
+    ///                              must outlive the ShadingSystem. The
+    ///                              jit_cache_dir is still needed, as the
+    ///                              node's copy. (nullptr)
+    ///    string jit_cache_redis "host[:port]" of a Redis server to use as
+    ///                              the jit_cache_backend, through the
+    ///                              RedisJITCache of OSL/jitcache.h. ("")
+    ///    int jit_free_with_group If nonzero, each group's JITed scalar
+    ///                              code gets memory of its own, freed as
+    ///                              soon as the last reference to the group
+    ///                              is gone, rather than memory shared with
+    ///                              other groups that's held until the
+    ///                              ShadingSystem is destroyed. This suits
+    ///                              long sessions that make and discard
+    ///                              many groups, at the cost of some pages
+    ///                              per group. (Not with ORC, or for
+    ///                              batched code.) (0)
+    ///    int jit_share_layers   If nonzero, a layer that reads no
+    ///                              upstream layer and compiles to the
+    ///                              same code as a layer of an earlier
+    ///                              group -- the same master with the same
+    ///                              folded params, as for a texture node
+    ///                              used by many materials -- calls that
+    ///                              layer's JITed code rather than JIT its
+    ///                              own. Such layers find their group data
+    ///                              through a table of its offsets. (Only
+    ///                              scalar code with MCJIT, and not with
+    ///                              a jit_cache_dir or a
+    ///                              jit_memory_budget_MB.) (0)
+    ///    int jit_memory_budget_MB If nonzero, bound the JITed code of the
+    ///                              groups to about this many MB: once a
+    ///                              JIT goes over it, the code of the
+    ///                              groups gone longest without running is
+    ///                              freed (down to 3/4 of the budget),
+    ///                              keeping their optimized form,
+    ///                              and JITed again (or reloaded from the
+    ///                              jit_cache_dir) if they run again.
+    ///                              Only scalar code is bounded, and not
+    ///                              with tiered_jit, ORC or a batched
+    ///                              renderer, and an execution counts the
+    ///                              group it runs with an atomic. (0)
+    ///    string capture         Record a sample of the points executed to
+    ///                              "<capture>.<groupname>.sg", one file
+    ///                              per group, as CapturedPoint records
+    ///                              that testshade --sgfile can replay.
+    ///                              Setting it closes any files already
+    ///                              being written. ("", meaning no capture)
+    ///    int capture_every      Capture only one of every N points
+    ///                              executed (1).
+    ///    int capture_max        Most points captured per group (1000000).
     ///    int lockgeom           Default 'lockgeom' value for shader params
     ///                              that don't specify it (1).  Lockgeom
     ///                              means a param CANNOT be overridden by
@@ -281,8 +587,51 @@ public:
     ///         opt_peephole, opt_coalesce_temps, opt_assign, opt_mix
     ///         opt_merge_instances, opt_merge_instance_with_userdata,
     ///         opt_fold_getattribute, opt_middleman, opt_texture_handle
-    ///         opt_seed_bblock_aliases
+    ///         opt_seed_bblock_aliases, opt_texture_reuse,
+    ///         opt_alias_connections
+    ///    int opt_fold_gettextureinfo  Fold gettextureinfo() of constant
+    ///                              file and data names (and, when given
+    ///                              coordinates, of a file that isn't
+    ///                              UDIM) by asking the renderer while
+    ///                              optimizing, which assumes the files
+    ///                              won't change as long as the group is
+    ///                              in use (1).
+    ///    int opt_batch_getattribute  Make independent getattribute()
+    ///                              calls in a row in scalar code as one
+    ///                              call of the renderer's
+    ///                              get_attributes() (1).
+    ///    int opt_shared_constant_arrays  Read the int and float array params
+    ///                              of at least this many bytes whose
+    ///                              values are the same in every shade
+    ///                              from one copy in the group's
+    ///                              constants, rather than storing them
+    ///                              into the group data in every shade
+    ///                              (0 turns it off) (64).
+    ///    int opt_unroll_loops   Fully unroll "for" loops that run a constant
+    ///                              number of times, at most this many, so
+    ///                              that their array indexing and index
+    ///                              math fold (8).
+    ///    int opt_batched_compaction  When doing batched analysis, find the
+    ///                              expensive ops (texture, trace, closures,
+    ///                              pointclouds, non-uniform getattribute)
+    ///                              that run under varying control flow,
+    ///                              where batches tend to be sparse. See the
+    ///                              group's "batched_compaction_layers" (0).
+    ///    int batched_uniformity_profile  Instrument batched JIT code to count,
+    ///                              for each varying symbol, how often all
+    ///                              active lanes of a batch hold the same
+    ///                              value. See the group's
+    ///                              "batched_uniformity_rates" (0).
+    ///    int batched_min_ops    Groups with fewer ops than this report a
+    ///                              "preferred_execution" of scalar (16).
+    ///    int batched_max_divergence  Groups with more than this percentage
+    ///                              of their ops under varying control flow
+    ///                              report a "preferred_execution" of
+    ///                              scalar (50).
     ///    int opt_passes         Number of optimization passes per layer (10)
+    ///    int opt_parallel_layers  Groups with at least this many layers
+    ///                              run their layer-local optimization
+    ///                              phases concurrently; 0 disables (8).
     ///    int llvm_optimize      Which of several LLVM optimize strategies (1)
     ///    int llvm_debug         Set LLVM extra debug level (0)
     ///    int llvm_debug_layers  Extra printfs upon entering and leaving
@@ -294,8 +643,30 @@ public:
     ///    int llvm_dumpasm       Print the CPU assembly code from the JIT (0)
     ///    string llvm_prune_ir_strategy  Strategy for pruning unnecessary
     ///                              IR (choices: "prune" [default], or "none").
+    ///    string llvm_pass_pipeline  With LLVM 14+, optimize with the new
+    ///                              pass manager: "fast" (cheap, for
+    ///                              interactive use), "default" (for the
+    ///                              llvm_optimize level), "heavy" (O3 plus
+    ///                              loop/SLP vectorization, for final
+    ///                              frames), or a textual pipeline as for
+    ///                              `opt -passes=`. Pass times are added to
+    ///                              the stats. ("" = legacy passes)
     ///    int max_local_mem_KB   Error if shader group needs more than this
     ///                              much local storage to execute (1024K)
+    ///    int context_pool_size  Idle ShadingContexts kept in a pool
+    ///                              shared by all threads, so a context
+    ///                              released on one thread can be reused
+    ///                              by another (64; 0 = only per-thread)
+    ///    int numa_aware         If nonzero, on machines with several NUMA
+    ///                              nodes, split the shared context pool
+    ///                              by node: a context is only reused by
+    ///                              threads whose PerThreadInfo was made
+    ///                              (by create_thread_info) on the same
+    ///                              node as its own, so that the context's
+    ///                              heap and scratch stay node-local.
+    ///                              Threads should be pinned, and the
+    ///                              "numa_nodes" attribute tells how many
+    ///                              nodes were found. (0)
     ///    string debug_groupname Name of shader group -- debug only this one
     ///    string debug_layername Name of shader layer -- debug only this one
     ///    int optimize_nondebug  If 1, fully optimize shaders that are not
@@ -343,6 +714,12 @@ public:
     ///                                 be elided, but nor will they be
     ///                                 called unconditionally.
     ///    int exec_repeat            How many times to run the group (1).
+    ///    static_attribute:NAME      Any type: the value attribute NAME of
+    ///                                 the shaded object is known to have
+    ///                                 wherever this group runs, so that
+    ///                                 getattribute("NAME", ...) without
+    ///                                 an object name folds to it. Set it
+    ///                                 before the group is optimized.
     ///
     bool attribute(ShaderGroup* group, string_view name, TypeDesc type,
                    const void* val);
@@ -393,6 +770,14 @@ public:
     ///   library build dependencies and their versions (for example,
     ///   "OIIO-2.3.0,LLVM-10.0.0,OpenEXR-2.5.0").
     ///
+    /// - `string stat:json` : The statistics that `getstats()` reports, as
+    ///   a JSON object, with histograms of the groups' compile times and
+    ///   layer counts, and the most executed groups. Groups count their
+    ///   executions only when the "profile" attribute is nonzero.
+    ///
+    /// - `string stat:profile_instrument` : The results of the
+    ///   "profile_instrument" attribute, as JSON.
+    ///
     bool getattribute(string_view name, TypeDesc type, void* val);
 
     /// Shortcut getattribute() for retrieving a single integer.
@@ -501,14 +886,117 @@ public:
     ///   int unknown_attributes_needed  Nonzero if additional attributes may be
     ///                                  needed, whose names will not be known
     ///                                  until the shader actually runs.
+    ///   int num_constant_outputs   The number of outputs found to have
+    ///                                 the same value at every point: the
+    ///                                 renderer outputs ("layer.name") and
+    ///                                 Ci whose values don't depend on the
+    ///                                 point shaded.
+    ///   ptr constant_outputs       Retrieves a pointer to the ustring array
+    ///                                 of their names.
+    ///   ptr constant_output_types  Retrieves a pointer to the TypeDesc
+    ///                                 array of their types (PTR for a
+    ///                                 closure).
+    ///   ptr constant_output_values  Retrieves a pointer to the array of
+    ///                                 const void* to each value; for a
+    ///                                 closure, the const ClosureColor* of
+    ///                                 its tree, null if it's empty.  They
+    ///                                 stay valid until the group is
+    ///                                 re-optimized.
+    ///   int all_outputs_constant   Nonzero if every renderer output and
+    ///                                 Ci are constant and the group has no
+    ///                                 other effect, so that a renderer may
+    ///                                 use the constant outputs instead of
+    ///                                 executing it.
     ///   int num_renderer_outputs   Number of named renderer outputs.
     ///   string renderer_outputs[]  List of renderer outputs.
     ///   int raytype_queries        Bit field of all possible rayquery
+    ///   int scratch_highwater      The most per-execution scratch memory
+    ///                                 (closures, messages, etc.), in bytes,
+    ///                                 that any execution of the group has
+    ///                                 used so far.  Contexts reserve this
+    ///                                 much up front.
     ///   int num_entry_layers       Number of named entry point layers.
     ///   string entry_layers[]      List of entry point layers.
+    ///   int num_batched_compaction_layers  Number of layers with expensive
+    ///                                 ops under varying control flow (only
+    ///                                 with "opt_batched_compaction").
+    ///   string batched_compaction_layers[]  List of those layers.  These are
+    ///                                 the layer boundaries at which a renderer
+    ///                                 driving execute_layer() itself gains
+    ///                                 the most by re-batching active points.
+    ///   int num_batched_uniformity_syms  Number of varying symbols profiled
+    ///                                 (with "batched_uniformity_profile").
+    ///   string batched_uniformity_syms[]  Names ("layer.sym") of them.
+    ///   float batched_uniformity_rates[]  For each of those symbols, the
+    ///                                 fraction of executed batches in which
+    ///                                 it was uniform across the active lanes.
+    ///   int batched_uniformity_samples[]  For each of those symbols, the
+    ///                                 number of batches sampled.
+    ///   string preferred_execution  "batched" or "scalar": which execution
+    ///                                 path is likely faster for this group,
+    ///                                 judged from its size and divergence
+    ///                                 (see "batched_min_ops" and
+    ///                                 "batched_max_divergence"), for
+    ///                                 renderers that support both.
     ///   string pickle              Retrieves a serialized representation
     ///                                 of the shader group declaration.
     ///   int llvm_groupdata_size    Size of the GroupData struct.
+    ///   int closure_memory_bound   Most bytes of closures one execution of
+    ///                                 the group allocates (times the width
+    ///                                 when batched), following the loops
+    ///                                 whose trips are known, or -1 if that
+    ///                                 can't be bounded.  With the
+    ///                                 llvm_groupdata_size, enough for GPU
+    ///                                 renderers to size their per-thread
+    ///                                 arenas.
+    ///   float cost_estimate        Rough cost of one execution of the
+    ///                                 group, in about nanoseconds, for
+    ///                                 balancing tiles or sorting shading
+    ///                                 queues.  It weighs the optimized
+    ///                                 ops by kind (texture, trace, noise,
+    ///                                 closure), counting loops by their
+    ///                                 trips; once "profile" has timed
+    ///                                 enough executions, it's their mean.
+    ///   string gpu_stats           For a group compiled to PTX (else
+    ///                                 empty), what its functions declare,
+    ///                                 as "functions=N registers=N
+    ///                                 max_registers=N predicates=N
+    ///                                 local_bytes=N max_local_bytes=N":
+    ///                                 the PTX virtual registers, in 32-bit
+    ///                                 units, before ptxas allocates them,
+    ///                                 and the local memory of their stack
+    ///                                 frames.  The totals are over all the
+    ///                                 functions, the maxima of any one.
+    ///                                 Renderers after ptxas' own counts
+    ///                                 find them in the OptiX module log.
+    ///   ptr interactive_params     Pointer to the block holding the values
+    ///                                 of the group's interactive=1 params,
+    ///                                 which the JITed code reads and
+    ///                                 ReParameter writes (null if none).
+    ///   int interactive_params_size  Bytes in that block, a multiple of 16
+    ///                                 so that the blocks of many groups may
+    ///                                 be packed into one device buffer.
+    ///   int num_interactive_params  Number of params in the block.
+    ///   string interactive_param_names[]  Their names, as "layer.param".
+    ///   int interactive_param_offsets[]  Their byte offsets in the block.
+    ///   int64 memory:jit           Bytes of JITed code and data held for
+    ///                                 the group (with MCJIT; 0 with ORC).
+    ///   int64 memory:symbols       Bytes of the layers' symbol tables and
+    ///                                 parameter override records.
+    ///   int64 memory:params        Bytes of the layers' parameter values.
+    ///   int64 memory:ops           Bytes of the layers' ops and arguments,
+    ///                                 which are freed once it is JITed.
+    ///   int64 memory:connections   Bytes of the layers' connection lists.
+    ///   int64 memory:total         The sum of all the above.
+    ///   int64 memory:groupdata     Bytes of heap that each execution of
+    ///                                 the group needs, scalar plus batched
+    ///                                 (held by contexts, not the group).
+    ///   int64 memory:constants     Bytes of the pools of the constant
+    ///                                 values of the group's symbols, which
+    ///                                 groups sharing layers share (so they
+    ///                                 are not in memory:total).
+    ///                              The memory attributes may also be
+    ///                                 retrieved as int.
     /// Note: the attributes referred to as "string" are actually on the app
     /// side as ustring or const char* (they have the same data layout), NOT
     /// std::string!
@@ -553,6 +1041,26 @@ public:
     /// shader lookups in the shader search path
     bool LoadMemoryCompiledShader(string_view shadername, string_view buffer);
 
+    /// Start loading the named shader masters in the background, on the
+    /// "compile_thread_pool" if the renderer supplied one and otherwise on
+    /// OIIO's default thread pool. Returns right away.
+    /// A later Shader() call that names one of these waits only for that
+    /// one master (or loads it itself if nobody has started on it yet).
+    /// Errors are reported just as they would be by Shader().
+    void prefetch_shaders(cspan<string_view> shadernames);
+
+    /// Start reading the headers and coarsest MIP levels of the named
+    /// textures in the background, on the same thread pool as
+    /// prefetch_shaders(), so that the first shades don't wait for the
+    /// files to open. Returns right away; errors are not reported here,
+    /// but by the texture lookups that follow.
+    void prefetch_textures(cspan<ustring> filenames);
+
+    /// Return the names of all the textures that the optimized shader
+    /// groups are known to need (see the "textures_needed" group
+    /// attribute), sorted and without duplicates.
+    std::vector<ustring> textures_needed() const;
+
     // The basic sequence for declaring a shader group looks like this:
     // ShadingSystem *ss = ...;
     // ShaderGroupRef group = ss->ShaderGroupBegin (groupname);
@@ -577,6 +1085,12 @@ public:
 
     /// Signal the start of a new shader group.  The return value is a
     /// reference-counted opaque handle to the ShaderGroup.
+    ///
+    /// Any number of threads may construct groups at once: ShaderGroupBegin,
+    /// Parameter, Shader, ConnectShaders, and ShaderGroupEnd only lock
+    /// briefly (and shader masters already loaded are looked up without
+    /// blocking other readers). Each individual group, though, should be
+    /// specified by only one thread at a time.
     ShaderGroupRef ShaderGroupBegin(string_view groupname = string_view());
 
     /// Alternate way to specify a shader group. The group specification
@@ -718,14 +1232,68 @@ public:
                            (const char**)&val);
     }
 
-    // Non-threadsafe versions of Parameter, Shader, ConnectShaders, and
-    // ShaderGroupEnd. These depend on some persistent state about which
-    // shader group is the "current" one being amended. It's fine to use
-    // that as long as all shader specification is done from one thread only
-    // (or at least that you are sure no two groups are being specified
-    // concurrently). If there is any doubt about that, use the versions
-    // above that take an explicit `ShaderGroup&`, which are thread-safe
-    // and re-entrant.
+    /// One change for the bulk ReParameter: the value of the given type
+    /// at val for the named param of the named layer.  The first
+    /// ReParameter to apply an edit keeps the indices of the layer and
+    /// param in it, so an edit made again (every frame of a lookdev
+    /// session, say) skips looking them up; leave them -1 for new edits.
+    struct ParamEdit {
+        string_view layername;
+        string_view paramname;
+        TypeDesc type;
+        const void* val = nullptr;
+        int layerindex  = -1;  ///< Found by ReParameter
+        int paramindex  = -1;  ///< Found by ReParameter
+    };
+
+    /// Make many ReParameter changes to the group at once.  All the edits
+    /// are checked before any is made, so that either all are made or,
+    /// returning false, none are; and the params in the group's block of
+    /// interactive params are all written under one lock, with the bytes
+    /// they change noted once.  If changed_begin and changed_end are
+    /// given, they are set to those bytes [begin,end) of the block
+    /// (begin == end if none).
+    bool ReParameter(ShaderGroup& group, span<ParamEdit> edits,
+                     int* changed_begin = nullptr, int* changed_end = nullptr);
+
+    /// Retrieve the bytes [begin,end) of the group's block of interactive
+    /// params (see the "interactive_params" attribute of groups) that
+    /// ReParameter has changed since the last call, and forget them, so a
+    /// renderer keeping a copy of the block (on a GPU, say) can update
+    /// just those bytes.  The first call after the group is optimized
+    /// returns the whole block.  Return false, with begin == end, if
+    /// nothing has changed.
+    bool take_interactive_changes(ShaderGroup* group, int& begin, int& end);
+
+    /// Return the compact index of the string in the ShadingSystem's
+    /// device string table, adding it if it isn't there already.  The
+    /// table holds each string once, in the order they were added: first
+    /// those of <OSL/strdecls.h>, in their order (so their indices are
+    /// the same in every ShadingSystem, and "" is 0), then the string
+    /// constants and string param values of each group as it is
+    /// optimized, then any that ReParameter sets.  Renderers may add
+    /// their own strings too.
+    uint32_t device_string_index(ustring str);
+
+    /// Return the index of the string with the given hash in the device
+    /// string table, or ~0u if it is not there.
+    uint32_t find_device_string(ustringhash hash) const;
+
+    /// Append the hashes of the device string table's strings, from
+    /// index `first` on, to `hashes`, and return the size of the table.
+    /// Strings are never removed or reordered, so a renderer keeping a
+    /// copy of the table (on a GPU, say) can pass the size returned by
+    /// its previous call and upload just the strings added since.
+    size_t device_string_table(size_t first,
+                               std::vector<uint64_t>& hashes) const;
+
+    // Versions of Parameter, Shader, ConnectShaders, and ShaderGroupEnd
+    // that amend the "current" shader group, which is the one most
+    // recently begun by ShaderGroupBegin on the calling thread. The
+    // current group is kept per thread, so different threads may each
+    // specify their own groups concurrently, but a group must be begun
+    // and ended on the same thread. The versions above that take an
+    // explicit `ShaderGroup&` have no such restriction.
     bool Parameter(string_view name, TypeDesc t, const void* val,
                    ParamHints hints = ParamHints::none);
     bool Shader(string_view shaderusage, string_view shadername,
@@ -780,6 +1348,40 @@ public:
                  ShaderGlobals& globals, void* userdata_base_ptr,
                  void* output_base_ptr, bool run = true);
 
+    /// Execute several shader groups on the same shading point, one after
+    /// another in the given order -- displacement, then surface, then
+    /// light filters, say -- paying the fixed cost of an execution (the
+    /// heap and scratch reservation, clearing messages and closures) once
+    /// for all of them. The groups share the context's messages, so a
+    /// later group's getmessage sees what an earlier one set with
+    /// setmessage, and closures made by earlier groups remain valid. Ci is
+    /// cleared only before the first group, so afterwards it holds the
+    /// closure of the last group that set it. Outputs of an earlier group
+    /// can feed interpolated params of a later one by placing both, with
+    /// symlocs, in the same buffer passed as the userdata and output base
+    /// pointers. Each group runs its last layer, as with execute(), and
+    /// get_symbol afterwards sees only the last group that ran. The groups
+    /// are still compiled separately. Returns false if none of them had
+    /// anything to run.
+    bool execute(ShadingContext& ctx, cspan<ShaderGroup*> groups,
+                 int shadeindex, ShaderGlobals& globals,
+                 void* userdata_base_ptr, void* output_base_ptr);
+
+    /// Execute the shader group on each of a run of shading points, the
+    /// i-th with globals[i] as shade index `shadeindex + i`, paying the
+    /// fixed cost of an execution (the heap and scratch reservation, the
+    /// group's checks) once for all of them rather than per point. Each
+    /// point still gets messages of its own, and the closures of all the
+    /// points -- each point's globals Ci -- stay valid until the context's
+    /// next execution. For outputs, give the symlocs a stride so that
+    /// each point's go to a place of their own; get_symbol afterwards sees
+    /// only the last point. Groups that repeat, defer traces or use the
+    /// shading cache run each point as execute() would. Returns false if
+    /// no point had anything to run.
+    bool execute(ShadingContext& ctx, ShaderGroup& group, int shadeindex,
+                 span<ShaderGlobals> globals, void* userdata_base_ptr,
+                 void* output_base_ptr);
+
     /// Future execute signature that will be range based. Shader globals will be
     /// obtained from renderer services.
 #if 0  // TODO in future PR
@@ -861,6 +1463,37 @@ public:
     /// execute_layer.
     bool execute_cleanup(ShadingContext& ctx);
 
+    /// Have the trace() calls of the executions in ctx record their rays
+    /// in traces rather than call RendererServices::trace, and take their
+    /// results from it once those are set (see DeferredTraces). Pass
+    /// nullptr to trace immediately again. The renderer keeps one
+    /// DeferredTraces per shading point it has in flight, and sets it
+    /// before each execution of that point.
+    void deferred_traces(ShadingContext& ctx, DeferredTraces* traces);
+
+    /// Was the last execution in ctx deferred, by a texture lookup that
+    /// couldn't be done without waiting (RendererServices::defer_shade)?
+    /// If so, its results aren't final, and the point should be shaded
+    /// again later, after the renderer has brought in what it needs.
+    bool shade_deferred(const ShadingContext& ctx) const;
+
+    /// Flatten a closure tree, such as the Ci left by an execution, into
+    /// a contiguous array of its primitive components, each with the
+    /// weights of the mul nodes above it folded into its own.  Components
+    /// whose weight comes to zero are left out.  The array belongs to ctx
+    /// and stays valid until the next flatten_closure call on it.
+    cspan<ClosureFlatComponent> flatten_closure(ShadingContext& ctx,
+                                                const ClosureColor* closure);
+
+    /// Flatten the closure trees of several shading points at once, as
+    /// flatten_closure does, into one array belonging to ctx (valid until
+    /// the next flatten on it).  The components of closures[i] are the
+    /// entries [begins[i], begins[i+1]) of the array, so begins must have
+    /// room for closures.size() + 1 entries.
+    cspan<ClosureFlatComponent>
+    flatten_closures(ShadingContext& ctx, cspan<const ClosureColor*> closures,
+                     span<int> begins);
+
     /// Find the named layer within a group and return its index, or -1
     /// if no such named layer exists.
     int find_layer(const ShaderGroup& group, ustring layername) const;
@@ -923,6 +1556,14 @@ public:
     /// Returns true if supported, false otherwise
     bool configure_batch_execution_at(int width);
 
+    /// One scalar shading point, see BatchedExecutor::execute_points().
+    struct ShadePoint {
+        ShaderGroup* group;       ///< Group to execute for the point
+        const ShaderGlobals* sg;  ///< The point's globals
+        int shadeindex;           ///< Index of its userdata and outputs
+        unsigned int sortkey;     ///< Coherence key (spatial, UV), or 0
+    };
+
     template<int WidthT> class OSLEXECPUBLIC BatchedExecutor {
         ShadingSystem& m_shading_system;
 
@@ -969,6 +1610,26 @@ public:
                            BatchedShaderGlobals<WidthT>& globals_batch,
                            void* userdata_base_ptr, void* output_base_ptr,
                            const ShaderSymbol* symbol);
+
+        /// Shade a stream of scalar shading points in full batches.  The
+        /// points are binned by group and by the globals that must be
+        /// uniform within a batch (raytype, renderstate, tracedata,
+        /// objdata), ordered by sortkey within each bin, packed WidthT at
+        /// a time into a BatchedShaderGlobals and executed.  Each point's
+        /// results land wherever its shadeindex places them, so they come
+        /// back in the caller's order regardless of the batching.  Returns
+        /// true if every batch executed successfully.
+        bool execute_points(ShadingContext& ctx, cspan<ShadePoint> points,
+                            void* userdata_base_ptr, void* output_base_ptr);
+
+        /// Flatten the Ci closures of the first batch_size lanes of the
+        /// globals (as left by execute), as flatten_closures does.  The
+        /// components of lane i are [lane_begins[i], lane_begins[i+1]),
+        /// so lane_begins must have room for batch_size + 1 entries.
+        cspan<ClosureFlatComponent>
+        flatten_closures(ShadingContext& ctx, int batch_size,
+                         const BatchedShaderGlobals<WidthT>& globals_batch,
+                         span<int> lane_begins);
     };
 
     template<int WidthT> OSL_FORCEINLINE BatchedExecutor<WidthT> batched()
@@ -982,6 +1643,23 @@ public:
     ///
     std::string getstats(int level = 1) const;
 
+    /// Running totals of the shading done so far, which, unlike the
+    /// statistics above, are kept up to date as contexts shade and may be
+    /// read from any thread while a render is under way.  Rates such as
+    /// shades per second come from differencing two snapshots.
+    struct LiveStats {
+        double elapsed          = 0;  ///< Seconds since the system was made
+        long long shades        = 0;  ///< Points shaded (lanes, if batched)
+        long long layers        = 0;  ///< Layers run ("countlayerexecs" only)
+        long long texture_calls = 0;  ///< texture, texture3d, environment
+        long long trace_calls   = 0;  ///< trace() calls
+        long long closures      = 0;  ///< Closure components allocated
+    };
+
+    /// Return a snapshot of the live statistics.  This takes no lock that
+    /// shading contends for, so it is cheap enough to poll.
+    LiveStats live_stats() const;
+
     void register_closure(string_view name, int id, const ClosureParam* params,
                           PrepareClosureFunc prepare, SetupClosureFunc setup);
 
@@ -1011,11 +1689,146 @@ public:
     /// to the optimizer, and will be determined strictly at execution time.
     void set_raytypes(ShaderGroup* group, int raytypes_on, int raytypes_off);
 
+    /// Give the group a variant specialized, as by set_raytypes, for the
+    /// raytypes_on bits being set and the raytypes_off bits clear (on top
+    /// of any set_raytypes of the group itself), such as one for shadow
+    /// rays that can skip most of the layers.  From then on, execute() of
+    /// the group runs each point whose sg->raytype matches a variant with
+    /// the first one added that matches, optimizing and JITing it on its
+    /// first use (or in the background, see the option
+    /// "raytype_variant_threshold"), and the general group for points that
+    /// match none.  The
+    /// variant keeps the group's renderer outputs, symlocs and entry
+    /// layers, and ReParameter of the group also changes its variants.
+    /// Retrieve outputs of a point through the context, or through their
+    /// placement, rather than with symbols found in the group itself,
+    /// since a variant has its own.  Variants are added after
+    /// ShaderGroupEnd, and before the group is optimized unless the
+    /// "reparam_reoptimize" option keeps its source.  Return false if the
+    /// variant couldn't be made.
+    bool add_raytype_variant(ShaderGroup* group, int raytypes_on,
+                             int raytypes_off);
+
+    /// Give the group a variant in which the parameters that would bind
+    /// to the named userdata instead have the value `val` of the given
+    /// type, so that the optimizer folds it and removes whatever it makes
+    /// dead -- for userdata, such as a material variant index, that takes
+    /// only a few hot values across the scene.  Call it once per hot
+    /// value; all variants of a group must be for the same userdata.
+    /// From then on, scalar execute() of the group looks up the userdata
+    /// of each point (from its placement if there is one, or else with
+    /// RendererServices::get_userdata) and runs the variant for that
+    /// value, optimizing and JITing it on its first use, or the general
+    /// group for any other value.  The raytype variants of the group are
+    /// not applied to its userdata variants, and batched execution always
+    /// runs the general group.  As for add_raytype_variant, the variant
+    /// keeps the group's settings, follows its ReParameter, and is added
+    /// after ShaderGroupEnd and before the group is optimized unless the
+    /// "reparam_reoptimize" option keeps its source.  Return false if the
+    /// variant couldn't be made.
+    bool add_userdata_variant(ShaderGroup* group, string_view name,
+                              TypeDesc type, const void* val);
+
+    /// Return a copy of the group that computes only the named outputs
+    /// (output params, as "param" or "layer.param", and "Ci" for the
+    /// closures) -- for a consumer needing just one of them, such as the
+    /// opacity for shadow rays or a single AOV for a pre-pass.  The copy
+    /// is optimized as if those were its only renderer outputs, so every
+    /// other output param, whatever only fed them, the layers only they
+    /// needed, and (unless "Ci" is named) every closure are removed as
+    /// dead code.  It is made on the first request for a set of outputs,
+    /// in any order, and the same copy is returned for later requests;
+    /// run it like any group, e.g. with execute(), optimizing and JITing
+    /// it on its first use.  As for add_raytype_variant, the copy keeps
+    /// the group's settings (but not its other renderer outputs), follows
+    /// its ReParameter, and must be requested after ShaderGroupEnd and
+    /// before the group is optimized unless the "reparam_reoptimize"
+    /// option keeps its source.  Return an empty ref if it couldn't be
+    /// made.
+    ShaderGroupRef output_variant(ShaderGroup* group, cspan<ustring> outputs);
+
+    /// Declare which closures (by the ids given to register_closure) the
+    /// renderer reads from the results of rays of the given raytype, for
+    /// example only a transparency closure for "shadow" rays.  When a
+    /// group is optimized with that raytype known to be on (see
+    /// set_raytypes), the construction of every other closure -- and
+    /// anything, such as texture lookups, computed only to feed it -- is
+    /// removed.  If several declared raytypes are known to be on, a
+    /// closure is kept only if all of them read it.  Declarations should
+    /// be made before groups are optimized; a later call for the same
+    /// raytype replaces the earlier one.  Return false if the raytype is
+    /// not one of the "raytypes" attribute names.
+    bool set_raytype_closures(ustring raytype, cspan<int> closure_ids);
+
+    /// Declare that the renderer doesn't need derivatives when shading
+    /// rays of the given raytype, for example diffuse bounces.  When a
+    /// group is optimized with that raytype known to be on (see
+    /// set_raytypes), no symbol is given derivatives for the sake of
+    /// texture lookups or Dx/Dy, which see zero derivatives instead.  The
+    /// texture lookups that would have used the derivatives of their
+    /// coordinates filter over a constant texture_width in s and t
+    /// instead, if it is nonzero, rather than point sample (batched
+    /// shading always point samples).  Declarations should be made before
+    /// groups are optimized; a later call for the same raytype replaces
+    /// the earlier one.  Return false if the raytype is not one of the
+    /// "raytypes" attribute names.
+    bool set_raytype_noderivs(ustring raytype, float texture_width = 0.0f);
+
+    /// Discard every ShadingContext's cached getattribute results (see
+    /// the "attribute_cache" option), for example at the start of a frame
+    /// or after object attributes have been edited.  Contexts notice
+    /// lazily, on their next cache lookup.
+    void invalidate_attribute_cache();
+
+    /// Merge the points that pointcloud_write() has buffered (per thread)
+    /// into their clouds and save the files.  This happens anyway when the
+    /// ShadingSystem is destroyed; call it to get the files sooner, e.g.
+    /// at the end of a frame whose clouds another process will read.
+    void flush_pointclouds();
+
+    /// One shading point as recorded by the "capture" attribute.  Capture
+    /// files are just these records back to back, in native byte order.
+    /// The raytype holds the raytype_bit() bits of the point.  Userdata
+    /// and renderer callback results are not recorded; their layout is
+    /// up to the renderer.
+    struct CapturedPoint {
+        Vec3 P, dPdx, dPdy;
+        Vec3 I;
+        Vec3 N, Ng;
+        float u, v, dudx, dudy, dvdx, dvdy;
+        Vec3 dPdu, dPdv;
+        int32_t raytype;
+        int32_t backfacing;
+    };
+
+    /// Close the files that the "capture" attribute is writing, so that
+    /// they may be replayed while the renderer keeps running.  Capture
+    /// then stops until the "capture" attribute is set again.
+    void flush_capture();
+
     /// Clear any known mappings of symbol locations.
     void clear_symlocs();
     void clear_symlocs(ShaderGroup* group);
 
     /// Add symbol location mappings.
+    ///
+    /// A symloc in the SymArena::ShaderGlobals arena, named for a global
+    /// such as "P" or "N", places that global in a compact per-point
+    /// struct of the renderer's: the scalar JIT reads (and writes) it at
+    /// the symloc's offset and stride from the userdata base pointer
+    /// passed to execute, rather than in the ShaderGlobals. Together with
+    /// the "globals_read" attribute of the optimized group, this lets a
+    /// renderer compute and store only the globals the group reads. A
+    /// global whose derivatives are used must be placed with derivs, its
+    /// value followed by its x and y derivatives. Shadeops and renderer
+    /// services still see the ShaderGlobals itself (for example its time,
+    /// for transformations), and batched execution ignores these symlocs.
+    ///
+    /// A float based symloc in the SymArena::Outputs arena may give a
+    /// `storage` of HALF or UINT8, for a framebuffer of that type: the
+    /// JIT, scalar or batched, converts each value as it stores it (UINT8
+    /// clamped to [0,1] and scaled to [0,255]), and the default stride is
+    /// that of the stored type.
     void add_symlocs(cspan<SymLocationDesc> symlocs);
     void add_symlocs(ShaderGroup* group, cspan<SymLocationDesc> symlocs);
 
@@ -1035,6 +1848,38 @@ public:
     /// specified number of threads (0 means use all available HW cores).
     void optimize_all_groups(int nthreads = 0, bool do_jit = true);
 
+    /// Where a group is in its compile by optimize_group_async.
+    enum class CompileStatus {
+        None,       ///< Never queued (it may have compiled on first use)
+        Queued,     ///< Waiting for a compile thread
+        Compiling,  ///< Being optimized and JITed
+        Done,       ///< Optimized and JITed
+        Cancelled   ///< Taken off the queue by cancel_optimize_group
+    };
+
+    /// Queue the group to be optimized and JITed in the background, by
+    /// "async_compile_threads" threads of the ShadingSystem, and return
+    /// at once. Queued groups compile highest priority first (e.g. the
+    /// visible objects first), and queuing a group that is still queued
+    /// just changes its priority. A shade of a group still queued
+    /// compiles it right away, as it would any uncompiled group (with
+    /// tiered_jit on, cheaply), unless "async_placeholder" is set, in
+    /// which case the shade does nothing until the compile is done.
+    /// Return false if the group was already compiled.
+    bool optimize_group_async(ShaderGroup* group, int priority = 0);
+
+    /// Take a queued group off the compile queue, e.g. a group removed
+    /// from the scene. A compile already under way finishes. Return true
+    /// if the group was queued.
+    bool cancel_optimize_group(ShaderGroup* group);
+
+    /// Where the group is in its compile by optimize_group_async.
+    CompileStatus compile_status(ShaderGroup* group) const;
+
+    /// Wait for a queued or compiling group to be compiled, for at most
+    /// timeout seconds if it is >= 0. Return true if it's done.
+    bool wait_optimize_group(ShaderGroup* group, float timeout = -1.0f);
+
     /// Return a pointer to the TextureSystem being used.
     TextureSystem* texturesys() const;
 
@@ -1048,6 +1893,23 @@ public:
     // DEPRECATED(2.0)
     bool archive_shadergroup(ShaderGroup* group, string_view filename);
 
+    /// Run the runtime optimizer on the group (without JIT) and save the
+    /// result -- the optimized code, symbols and constants of every layer
+    /// -- to a binary snapshot file. The group must not have been
+    /// optimized yet. Return true on success.
+    bool save_group_snapshot(ShaderGroup& group, string_view filename);
+
+    /// Load a snapshot saved by save_group_snapshot() into a group that
+    /// has been built (ShaderGroupBegin/End) exactly like the one that
+    /// was saved, but not yet optimized. The group is then considered
+    /// optimized, so compiling it skips the runtime optimizer and goes
+    /// straight to JIT. The snapshot is only accepted from the same OSL
+    /// version, for the same masters, params, connections, and optimize
+    /// level; other ShadingSystem options that affect optimization are
+    /// expected to match as well. Return true on success, false (leaving
+    /// the group untouched) if the snapshot can't be used.
+    bool load_group_snapshot(ShaderGroup& group, string_view filename);
+
     /// Construct and return an OSLQuery initialized with an existing
     /// ShaderGroup. For a shader group already loaded by the ShadingSystem,
     /// this is much less expensive than constructing an OSLQuery by reading
@@ -1120,6 +1982,18 @@ enum ShadeImageLocations {
 /// themselves will either be at "pixel centers" (position (i+0.5)/res), or
 /// as if it were a grid that is shaded at exact endpoints (position
 /// i/(res+1)). In either case, derivatives will be set appropriately.
+///
+/// If the buffer has local pixels and all the outputs are float-based,
+/// the outputs are placed (with add_symlocs, in the SymArena::Outputs
+/// arena) so that the shader writes them straight into the pixels. This
+/// adds symlocs to the group if it is not yet optimized, so from then on
+/// it must be shaded with an output base pointer laid out like the
+/// pixels of a buffer with the same number of channels. When the outputs
+/// are placed and the shading system is set up for batched shading (the
+/// renderer supplies batched services and "opt_batched_analysis" is on),
+/// runs of pixels are shaded in batches with the BatchedExecutor.
+/// Otherwise, every pixel is shaded one at a time and the outputs are
+/// copied from the context (converting int-based outputs to float).
 OSLEXECPUBLIC
 bool
 shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
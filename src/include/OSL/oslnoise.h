@@ -128,6 +128,15 @@ float simplexnoise4 (float x, float y, float z, float w, int seed=0,
                      float *dnoise_dx=NULL, float *dnoise_dy=NULL,
                      float *dnoise_dz=NULL, float *dnoise_dw=NULL);
 
+#ifndef __CUDA_ARCH__
+// simplexnoise3() for seeds 0, 1, 2 and 3 at once, one seed per lane, as
+// the vector simplex noises need.
+OSLNOISEPUBLIC
+vfloat4 simplexnoise3x4 (float x, float y, float z,
+                         vfloat4 *dnoise_dx=NULL, vfloat4 *dnoise_dy=NULL,
+                         vfloat4 *dnoise_dz=NULL);
+#endif
+
 
 namespace {
 
@@ -2829,9 +2838,14 @@ struct SimplexNoise {
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p) const {
+#ifndef __CUDA_ARCH__
+        vfloat4 r = simplexnoise3x4 (p.x, p.y, p.z);
+        result.setValue (r[0], r[1], r[2]);
+#else
         result.x = simplexnoise3 (p.x, p.y, p.z, 0);
         result.y = simplexnoise3 (p.x, p.y, p.z, 1);
         result.z = simplexnoise3 (p.x, p.y, p.z, 2);
+#endif
     }
     
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p, float t) const {
@@ -2893,11 +2907,22 @@ struct SimplexNoise {
     }
 
     inline OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p) const {
+#ifndef __CUDA_ARCH__
+        // All three channels at once
+        vfloat4 dndx, dndy, dndz;
+        vfloat4 r = simplexnoise3x4 (p.val().x, p.val().y, p.val().z,
+                                     &dndx, &dndy, &dndz);
+        vfloat4 rdx = dndx * p.dx().x + dndy * p.dx().y + dndz * p.dx().z;
+        vfloat4 rdy = dndx * p.dy().x + dndy * p.dy().y + dndz * p.dy().z;
+        result.set (Vec3 (r[0], r[1], r[2]), Vec3 (rdx[0], rdx[1], rdx[2]),
+                    Vec3 (rdy[0], rdy[1], rdy[2]));
+#else
         Dual2<float> r0, r1, r2;
         (*this)(r0, p, 0);
         (*this)(r1, p, 1);
         (*this)(r2, p, 2);
         result = make_Vec3 (r0, r1, r2);
+#endif
     }
 
     inline OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p, const Dual2<float> &t) const {
@@ -3057,9 +3082,14 @@ struct USimplexNoise {
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p) const {
+#ifndef __CUDA_ARCH__
+        vfloat4 r = 0.5f * (simplexnoise3x4 (p.x, p.y, p.z) + 1.0f);
+        result.setValue (r[0], r[1], r[2]);
+#else
         result.x = 0.5f * (simplexnoise3 (p.x, p.y, p.z, 0) + 1.0f);
         result.y = 0.5f * (simplexnoise3 (p.x, p.y, p.z, 1) + 1.0f);
         result.z = 0.5f * (simplexnoise3 (p.x, p.y, p.z, 2) + 1.0f);
+#endif
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p, float t) const {
@@ -3135,11 +3165,26 @@ struct USimplexNoise {
     }
 
     inline OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p) const {
+#ifndef __CUDA_ARCH__
+        // All three channels at once
+        vfloat4 dndx, dndy, dndz;
+        vfloat4 r = simplexnoise3x4 (p.val().x, p.val().y, p.val().z,
+                                     &dndx, &dndy, &dndz);
+        r = 0.5f * (r + 1.0f);
+        dndx *= 0.5f;
+        dndy *= 0.5f;
+        dndz *= 0.5f;
+        vfloat4 rdx = dndx * p.dx().x + dndy * p.dx().y + dndz * p.dx().z;
+        vfloat4 rdy = dndx * p.dy().x + dndy * p.dy().y + dndz * p.dy().z;
+        result.set (Vec3 (r[0], r[1], r[2]), Vec3 (rdx[0], rdx[1], rdx[2]),
+                    Vec3 (rdy[0], rdy[1], rdy[2]));
+#else
         Dual2<float> r0, r1, r2;
         (*this)(r0, p, 0);
         (*this)(r1, p, 1);
         (*this)(r2, p, 2);
         result = make_Vec3 (r0, r1, r2);
+#endif
     }
 
     inline OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p, const Dual2<float> &t) const {
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <vector>
 
 #include <OSL/oslconfig.h>
 
@@ -13,6 +14,7 @@ OSL_NAMESPACE_ENTER
 class RendererServices;
 template<int WidthT> class BatchedRendererServices;
 class ShadingContext;
+class ShaderGroup;
 struct ShaderGlobals;
 
 // Tags for polymorphic dispatch
@@ -50,7 +52,11 @@ public:
 
     /// Given the name of a 'feature', return whether this RendererServices
     /// supports it. Feature names include:
-    ///    <none>
+    ///    "transform_cache"  The matrices returned by get_matrix and
+    ///                       get_inverse_matrix depend only on the space
+    ///                       (or transformation), time and sg->objdata,
+    ///                       so OSL may reuse them for the rest of an
+    ///                       execution rather than asking again.
     ///
     /// This allows some customization of JIT generated code based on the
     /// facilities and features of a particular renderer. It also allows
@@ -179,6 +185,38 @@ public:
                                      ustringhash object, TypeDesc type,
                                      ustringhash name, int index, void* val);
 
+    /// One attribute query of a get_attributes() call: the arguments of a
+    /// get_attribute(), or of a get_array_attribute() if index >= 0, and
+    /// where get_attributes() puts what that would return.
+    struct AttributeRequest {
+        ustringhash object;
+        ustringhash name;
+        TypeDesc type;
+        void* val;
+        int index;  ///< Array element, or -1 for the whole attribute
+        bool derivatives;
+        bool ok;  ///< Set by get_attributes(): was it found?
+    };
+
+    /// Get several attributes of the point being shaded at once, setting
+    /// each request's `ok`. A shader's independent getattribute() calls in
+    /// a row are made as one call of this (see the
+    /// "opt_batch_getattribute" option), letting the renderer look up the
+    /// object once for all of them. The default calls get_attribute() or
+    /// get_array_attribute() for each request in turn.
+    virtual void get_attributes(ShaderGlobals* sg,
+                                span<AttributeRequest> requests);
+
+    /// Return true if the named attribute of the object depends only on
+    /// the object (the ShaderGlobals' objdata), never on the point being
+    /// shaded, so that with the "attribute_cache" option the ShadingSystem
+    /// may remember a get_attribute() result and reuse it for later
+    /// queries of the same objdata, object, name, type and array index,
+    /// including from batched shading.  The default is false: nothing is
+    /// cached.
+    virtual bool attribute_is_cacheable(ustringhash object, TypeDesc type,
+                                        ustringhash name);
+
     /// Get the named user-data from the current object and write it into
     /// 'val'. If derivatives is true, the derivatives should be written into val
     /// as well. Return false if no user-data with the given name and type was
@@ -186,6 +224,21 @@ public:
     virtual bool get_userdata(bool derivatives, ustringhash name, TypeDesc type,
                               ShaderGlobals* sg, void* val);
 
+    /// Called once for each group as it is optimized, before any of it is
+    /// JITed, with the names, types and derivative needs of all the
+    /// userdata the group may retrieve.  A renderer that keeps its
+    /// userdata in a fixed table for each object may bind them to their
+    /// slots here, calling ShadingSystem::add_symlocs(group, ...) with
+    /// SymArena::UserData symlocs whose offsets (and, for data that
+    /// varies per point, strides) are relative to the userdata_base_ptr
+    /// it passes to execute().  The JIT then loads those directly rather
+    /// than calling get_userdata(), which remains the fallback for the
+    /// names left unbound.  A symloc replaces any other of the same name,
+    /// so beware of colliding with the group's output placements.  The
+    /// default binds nothing.
+    virtual void bind_userdata(ShaderGroup* group, cspan<ustring> names,
+                               cspan<TypeDesc> types, cspan<char> derivs);
+
     /// Given the name of a texture, return an opaque handle that can be used
     /// with texture calls to avoid the name lookups. The `options`, if not
     /// null, may be used in renderer-specific ways to specialize a handle
@@ -203,6 +256,13 @@ public:
     /// get_texture_handle()) is udim
     virtual bool is_udim(TextureHandle* texture_handle);
 
+    /// Given the handle of a udim texture (see is_udim()), return the
+    /// handle of the tile that (s,t) falls in, or nullptr if the texture
+    /// has no such tile.
+    virtual TextureHandle* resolve_udim(TextureHandle* texture_handle,
+                                        TexturePerthread* texture_thread_info,
+                                        float s, float t);
+
     /// Filtered 2D texture lookup for a single point.
     ///
     /// s,t are the texture coordinates; dsdx, dtdx, dsdy, and dtdy are
@@ -237,6 +297,15 @@ public:
                          float* dresultds, float* dresultdt,
                          ustringhash* errormessage);
 
+    /// Called by a texture(), texture3d() or environment() lookup that
+    /// can't be done without waiting, such as one whose tiles aren't
+    /// resident yet (and that the renderer has started to fetch): it marks
+    /// the shade of sg as deferred, so that the lookup can return at once
+    /// (returning true, with any result). The shade runs on, but its
+    /// results aren't final. The renderer should shade the point again
+    /// once the tiles are in (see ShadingSystem::shade_deferred).
+    static void defer_shade(ShaderGlobals* sg);
+
     /// Filtered 3D texture lookup for a single point.
     ///
     /// P is the volumetric texture coordinate; dPd{x,y,z} are the
@@ -420,12 +489,14 @@ public:
         Vec3 direction;
         float bandwidth;
         float impulses;
+        int fast;
         NoiseOpt()
             : anisotropic(0)
             , do_filter(true)
             , direction(1.0f, 0.0f, 0.0f)
             , bandwidth(1.0f)
             , impulses(16.0f)
+            , fast(0)
         {
         }
     };
@@ -436,11 +507,54 @@ public:
     /// Unless overridden, a nullptr is returned.
     virtual BatchedRendererServices<16>* batched(WidthOf<16>);
     virtual BatchedRendererServices<8>* batched(WidthOf<8>);
+    virtual BatchedRendererServices<4>* batched(WidthOf<4>);
 
 protected:
     TextureSystem* m_texturesys;  // A place to hold a TextureSystem
 };
 
 
+
+/// The rays that the trace() calls of one shading point asked for, for a
+/// renderer that traces rays in batches rather than one at a time from
+/// the middle of a shade (see ShadingSystem::deferred_traces). The shade
+/// doesn't stop at a trace() whose ray hasn't been traced: it records
+/// the ray and goes on as if it missed. Once the renderer has traced the
+/// pending rays, set their results, and executed the point again, those
+/// calls return the results, and any trace() calls they lead to record
+/// rays of their own, until no rays are pending and the shade's results
+/// are final. The shader must therefore compute the same rays each time,
+/// as it does given the same globals.
+struct DeferredTraces {
+    struct Ray {
+        RendererServices::TraceOpt options;
+        Vec3 P, dPdx, dPdy;  ///< Origin
+        Vec3 R, dRdx, dRdy;  ///< Direction
+        int result = -1;     ///< -1 untraced, else 1 for a hit, 0 a miss
+    };
+    std::vector<Ray> rays;  ///< In the order the shader called trace()
+    int next    = 0;        ///< The next trace() of this execution
+    int current = -1;  ///< The ray that trace() last returned, so that
+                       ///< getmessage("trace", ...) knows which hit
+
+    /// Are any rays untraced, so that the point must be executed again?
+    bool pending() const
+    {
+        for (const Ray& ray : rays)
+            if (ray.result < 0)
+                return true;
+        return false;
+    }
+
+    /// Forget the rays, to start a new shading point.
+    void clear()
+    {
+        rays.clear();
+        next    = 0;
+        current = -1;
+    }
+};
+
+
 OSL_PRAGMA_WARNING_POP
 OSL_NAMESPACE_EXIT
@@ -125,4 +125,22 @@ OSL_RSOP bool
 rs_transform_points(OSL::ShaderGlobals* sg, OSL::StringParam from,
                     OSL::StringParam to, float time, const OSL::Vec3* Pin,
                     OSL::Vec3* Pout, int npoints,
-                    OSL::TypeDesc::VECSEMANTICS vectype);
\ No newline at end of file
+                    OSL::TypeDesc::VECSEMANTICS vectype);
+
+/// Get the named attribute from the renderer and if found then
+/// write it into 'val'.  Otherwise, return false.  If no object is
+/// specified (object is the empty string), the attribute is retrieved
+/// from the object being shaded, for example through sg->objdata or
+/// sg->renderstate.  If 'derivatives' is true, 'val' has room for the
+/// derivatives as well, which should be written (or zeroed) too.
+OSL_RSOP bool
+rs_get_attribute(OSL::ShaderGlobals* sg, bool derivatives,
+                 OSL::StringParam object, OSL::TypeDesc type,
+                 OSL::StringParam name, void* val);
+
+/// Like rs_get_attribute, but retrieve element 'index' of an array
+/// attribute.
+OSL_RSOP bool
+rs_get_array_attribute(OSL::ShaderGlobals* sg, bool derivatives,
+                       OSL::StringParam object, OSL::TypeDesc type,
+                       OSL::StringParam name, int index, void* val);
\ No newline at end of file
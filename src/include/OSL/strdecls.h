@@ -111,6 +111,7 @@ STRDECL("direction", direction)
 STRDECL("do_filter", do_filter)
 STRDECL("bandwidth", bandwidth)
 STRDECL("impulses", impulses)
+STRDECL("fast", fast)
 STRDECL("dowhile", op_dowhile)
 STRDECL("for", op_for)
 STRDECL("while", op_while)
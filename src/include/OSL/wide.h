@@ -154,6 +154,19 @@ template<typename DataT, int WidthT>
 OSL_FORCEINLINE void
 assign_all(Block<DataT, WidthT>&, const DataT&);
 
+// Utilities to transpose between Block's of data and the strided arrays
+// of structures a renderer keeps per hit, where lane i's DataT is at
+// base + i*stride_bytes.  Only the lanes of the mask are read or written
+// (so base need only be valid for those), the others are left untouched.
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+gather_strided(Block<DataT, WidthT>&, const DataT* base, size_t stride_bytes,
+               Mask<WidthT>);
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+scatter_strided(const Block<DataT, WidthT>&, DataT* base, size_t stride_bytes,
+                Mask<WidthT>);
+
 // Scalar execution of Functor for each unique value in the Wide data out
 // of the data_mask, the functor must be of the form
 //     (const DataT &, Mask<WidthT>)->void
@@ -1345,6 +1358,41 @@ assign_all(Block<DataT, WidthT>& wide_data, const DataT& value)
     }
 }
 
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+gather_strided(Block<DataT, WidthT>& wide_data, const DataT* base,
+               size_t stride_bytes, Mask<WidthT> mask)
+{
+    const char* bytes = reinterpret_cast<const char*>(base);
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int i = 0; i < WidthT; ++i) {
+            // Test before loading, masked off lanes may not be readable
+            if (mask.is_on(i))
+                wide_data.set(i, *reinterpret_cast<const DataT*>(
+                                     bytes + i * stride_bytes));
+        }
+    }
+}
+
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+scatter_strided(const Block<DataT, WidthT>& wide_data, DataT* base,
+                size_t stride_bytes, Mask<WidthT> mask)
+{
+    char* bytes = reinterpret_cast<char*>(base);
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int i = 0; i < WidthT; ++i) {
+            if (mask.is_on(i))
+                *reinterpret_cast<DataT*>(bytes + i * stride_bytes)
+                    = wide_data.get(i);
+        }
+    }
+}
+
 namespace pvt {
 
 template<typename DataT, int WidthT, bool IsConstT>
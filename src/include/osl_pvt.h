@@ -1112,6 +1112,7 @@ public:
         m_argtakesderivs = 0;   // Default - doesn't take derivs
         m_requires_masking = 0;  // Default - doesn't require masking
         m_analysis_flag    = 0;  // Default - optional analysis flag is not set
+        m_pure             = 0;  // Default - not known to be pure
     }
 
     ustring opname() const { return m_op; }
@@ -1285,6 +1286,13 @@ public:
     bool analysis_flag() const { return m_analysis_flag; }
     void analysis_flag(bool v) { m_analysis_flag = v; }
 
+    /// Is this a "functioncall" whose range of ops (the inlined body of a
+    /// user function) is pure: no output, messages, traces, exits, or
+    /// writes to globals, only writes to the symbols it was given?  oslc
+    /// marks these with the %pure hint.
+    bool pure() const { return m_pure; }
+    void pure(bool v) { m_pure = v; }
+
 private:
     ustring m_op;                   ///< Name of opcode
     int m_firstarg;                 ///< Index of first argument
@@ -1306,6 +1314,8 @@ private:
     unsigned m_requires_masking : 1;
     ///< Op specific analysis flag, meaning depends on type of op
     unsigned m_analysis_flag : 1;
+    ///< A functioncall whose body has no side effects
+    unsigned m_pure : 1;
 };
 
 
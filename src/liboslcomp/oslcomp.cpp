@@ -3,11 +3,13 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <fstream>
 #include <streambuf>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "oslcomp_pvt.h"
@@ -17,6 +19,7 @@
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/thread.h>
+#include <OpenImageIO/timer.h>
 
 #if !defined(__STDC_CONSTANT_MACROS)
 #    define __STDC_CONSTANT_MACROS 1
@@ -84,6 +87,7 @@ namespace pvt {  // OSL::pvt
 static ustring op_for("for");
 static ustring op_while("while");
 static ustring op_dowhile("dowhile");
+static ustring op_functioncall("functioncall");
 
 
 
@@ -140,6 +144,25 @@ OSLCompilerImpl::preprocess_file(const std::string& filename,
 
 
 
+namespace {
+
+// What stdosl.h and the -include headers preprocess to, which is the same
+// for every shader compiled with the same defines and include paths:
+// their text, and the macros they leave defined for the shader's own
+// source.  Keeping it lets later compiles in this process (oslc with
+// several files, or tools compiling buffers on the fly) skip them.
+struct Prelude {
+    std::string text;
+    std::string macros;
+};
+
+static OIIO::mutex prelude_mutex;
+static std::unordered_map<std::string, Prelude> prelude_cache;
+
+}  // namespace
+
+
+
 bool
 OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
                                    const std::string& filename,
@@ -149,19 +172,76 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
                                    std::string& result)
 {
     using OIIO::Strutil::fmt::format;
-    std::string instring;
-    if (!stdoslpath.empty()) {
-        instring = format("#include \"{}\"\n",
-                          OIIO::Strutil::escape_chars(stdoslpath));
+    std::vector<std::string> headers;
+    if (!stdoslpath.empty())
+        headers.push_back(stdoslpath);
+    headers.insert(headers.end(), m_force_includes.begin(),
+                   m_force_includes.end());
+    if (headers.empty()) {
+        std::string instring = "\n" + buffer;
+        return run_preprocessor(instring, filename, defines, includepaths,
+                                false, result);
+    }
+
+    // The cache key: the headers (and when they last changed), defines
+    // and include paths.
+    std::string key, prelude_source;
+    for (auto&& h : headers) {
+        key += format("{}@{}\n", h,
+                      OIIO::Filesystem::exists(h)
+                          ? OIIO::Filesystem::last_write_time(h)
+                          : 0);
+        prelude_source += format("#include \"{}\"\n",
+                                 OIIO::Strutil::escape_chars(h));
         // Note: because we're turning this from a regular string into a
         // double-quoted string injected into the OSL parse stream, we need
         // to fully escape any backslashes used in Windows file paths. We
         // don't want "c:\path\to\new\osl" to be interpreted as
         // "c:\path<tab>o<newline>ew\osl" !
-    } else {
-        instring = "\n";
     }
-    instring += buffer;
+    key += OIIO::Strutil::join(defines, "\n") + "\n"
+           + OIIO::Strutil::join(includepaths, "\n");
+
+    Prelude prelude;
+    bool cached = false;
+    {
+        OIIO::lock_guard lock(prelude_mutex);
+        auto found = prelude_cache.find(key);
+        if (found != prelude_cache.end()) {
+            prelude = found->second;
+            cached  = true;
+        }
+    }
+    if (!cached) {
+        // A "<pseudo>" name keeps it out of the depfiles, and keeps the
+        // text free of any one shader's file name.
+        if (!run_preprocessor(prelude_source, "<prelude>", defines,
+                              includepaths, false, prelude.text)
+            || !run_preprocessor(prelude_source, "<prelude>", defines,
+                                 includepaths, true, prelude.macros))
+            return false;
+        OIIO::lock_guard lock(prelude_mutex);
+        prelude_cache[key] = prelude;
+    }
+
+    // The shader's own lines start at 2, where they would be if stdosl.h
+    // were #included in front of them (osllex.l takes the one back).
+    std::string instring = prelude.macros + "#line 2\n" + buffer;
+    result += prelude.text;
+    return run_preprocessor(instring, filename, defines, includepaths, false,
+                            result);
+}
+
+
+
+bool
+OSLCompilerImpl::run_preprocessor(const std::string& instring,
+                                  const std::string& filename,
+                                  const std::vector<std::string>& defines,
+                                  const std::vector<std::string>& includepaths,
+                                  bool macros_only, std::string& result)
+{
+    using OIIO::Strutil::fmt::format;
     std::unique_ptr<llvm::MemoryBuffer> mbuf(
         llvm::MemoryBuffer::getMemBuffer(instring, filename));
 
@@ -193,8 +273,8 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
     clang::SourceManager& sm = inst.getSourceManager();
     sm.setMainFileID(sm.createFileID(std::move(mbuf), clang::SrcMgr::C_User));
 
-    inst.getPreprocessorOutputOpts().ShowCPP               = 1;
-    inst.getPreprocessorOutputOpts().ShowMacros            = 0;
+    inst.getPreprocessorOutputOpts().ShowCPP               = !macros_only;
+    inst.getPreprocessorOutputOpts().ShowMacros            = macros_only;
     inst.getPreprocessorOutputOpts().ShowComments          = 0;
     inst.getPreprocessorOutputOpts().ShowLineMarkers       = 1;
     inst.getPreprocessorOutputOpts().ShowMacroComments     = 0;
@@ -259,6 +339,7 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
 {
     m_output_filename.clear();
     m_preprocess_only = false;
+    m_force_includes.clear();
     for (size_t i = 0; i < options.size(); ++i) {
         if (options[i] == "-v") {
             // verbose mode
@@ -282,6 +363,8 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
             m_optimizelevel = 2;
         } else if (options[i] == "-Werror") {
             m_err_on_warning = true;
+        } else if (options[i] == "-time" || options[i] == "--time") {
+            m_time = true;
         } else if (options[i] == "-embed-source"
                    || options[i] == "--embed-source") {
             m_embed_source = true;
@@ -311,6 +394,8 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
             m_deps_filename = options[++i];
         } else if (OIIO::Strutil::starts_with(options[i], "-MF")) {
             m_deps_filename = options[i].substr(3);
+        } else if (options[i] == "-include" && i < options.size() - 1) {
+            m_force_includes.push_back(options[++i]);
         } else if (options[i] == "-MT") {
             m_deps_target = options[++i];
         } else if (OIIO::Strutil::starts_with(options[i], "-MT")) {
@@ -415,6 +500,9 @@ OSLCompilerImpl::compile(string_view filename,
     m_cwd           = OIIO::Filesystem::current_path();
     m_main_filename = ustring(filename);
     clear_filecontents_cache();
+    m_overload_cache.clear();
+    std::fill_n(m_phase_time, int(NumCompilePhases), 0.0);
+    OIIO::Timer timer;
 
     read_compile_options(options, defines, includepaths);
 
@@ -435,17 +523,20 @@ OSLCompilerImpl::compile(string_view filename,
                          preprocess_result)) {
         return false;
     }
+    m_phase_time[PhasePreprocess] = timer.lap();
 
     if (m_preprocess_only && !m_generate_deps) {
         std::cout << preprocess_result;
     } else {
-        bool parseerr = osl_parse_buffer(preprocess_result);
+        bool parseerr            = osl_parse_buffer(preprocess_result);
+        m_phase_time[PhaseParse] = timer.lap();
         if (!parseerr) {
             if (shader())
                 shader()->typecheck();
             else
                 errorfmt(ustring(), 0, "No shader function defined");
         }
+        m_phase_time[PhaseTypecheck] = timer.lap();
 
         // Print the parse tree if there were no errors
         if (m_debug) {
@@ -462,8 +553,12 @@ OSLCompilerImpl::compile(string_view filename,
             track_variable_dependencies();
             track_variable_lifetimes();
             check_for_illegal_writes();
+            find_pure_functions();
+            if (m_optimizelevel >= 1 && strip_dead_functions())
+                track_variable_lifetimes();
             //            if (m_optimizelevel >= 1)
             //                coalesce_temporaries ();
+            m_phase_time[PhaseCodegen] = timer.lap();
         }
 
         if (!error_encountered()) {
@@ -490,7 +585,10 @@ OSLCompilerImpl::compile(string_view filename,
                          m_output_filename);
                 return false;
             }
+            m_phase_time[PhaseWrite] = timer.lap();
         }
+        if (m_time)
+            report_phase_times();
     }
 
     return !error_encountered();
@@ -508,11 +606,14 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
 
     std::vector<std::string> defines;
     std::vector<std::string> includepaths;
+    OIIO::Timer timer;
     read_compile_options(options, defines, includepaths);
 
     m_cwd           = OIIO::Filesystem::current_path();
     m_main_filename = ustring(filename);
     clear_filecontents_cache();
+    m_overload_cache.clear();
+    std::fill_n(m_phase_time, int(NumCompilePhases), 0.0);
 
     // Determine where the installed shader include directory is, and
     // look for ../shaders/stdosl.h and force it to include.
@@ -527,17 +628,20 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
                            includepaths, preprocess_result)) {
         return false;
     }
+    m_phase_time[PhasePreprocess] = timer.lap();
 
     if (m_preprocess_only) {
         std::cout << preprocess_result;
     } else {
-        bool parseerr = osl_parse_buffer(preprocess_result);
+        bool parseerr            = osl_parse_buffer(preprocess_result);
+        m_phase_time[PhaseParse] = timer.lap();
         if (!parseerr) {
             if (shader())
                 shader()->typecheck();
             else
                 errorfmt(ustring(), 0, "No shader function defined");
         }
+        m_phase_time[PhaseTypecheck] = timer.lap();
 
         // Print the parse tree if there were no errors
         if (m_debug) {
@@ -551,8 +655,12 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
             track_variable_dependencies();
             track_variable_lifetimes();
             check_for_illegal_writes();
+            find_pure_functions();
+            if (m_optimizelevel >= 1 && strip_dead_functions())
+                track_variable_lifetimes();
             //            if (m_optimizelevel >= 1)
             //                coalesce_temporaries ();
+            m_phase_time[PhaseCodegen] = timer.lap();
         }
 
         if (!error_encountered()) {
@@ -568,7 +676,10 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
                            preprocess_result);
             osobuffer = oso_output.str();
             OSL_DASSERT(m_osofile == nullptr);
+            m_phase_time[PhaseWrite] = timer.lap();
         }
+        if (m_time)
+            report_phase_times();
     }
 
     return !error_encountered();
@@ -576,16 +687,36 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
 
 
 
+void
+OSLCompilerImpl::report_phase_times() const
+{
+    double total = 0.0;
+    for (double t : m_phase_time)
+        total += t;
+    // A message rather than info, so that it shows without -v
+    m_errhandler->messagefmt(
+        "{}: compile time {:.3f}s: preprocess {:.3f}s, parse {:.3f}s, "
+        "typecheck {:.3f}s, codegen {:.3f}s, oso write {:.3f}s\n",
+        m_main_filename, total, m_phase_time[PhasePreprocess],
+        m_phase_time[PhaseParse], m_phase_time[PhaseTypecheck],
+        m_phase_time[PhaseCodegen], m_phase_time[PhaseWrite]);
+}
+
+
+
 void
 OSLCompilerImpl::write_dependency_file(string_view filename)
 {
     if (m_deps_filename.empty())
         m_deps_filename = OIIO::Filesystem::replace_extension(filename, ".d");
+    // Name the file we are about to write, so that the depfile can tell
+    // whether it is up to date (see oslc -incremental).
     std::string target = m_deps_target;
     if (target.empty())
-        target = m_output_filename.size()
-                     ? m_output_filename
-                     : OIIO::Filesystem::replace_extension(filename, ".oso");
+        target = m_output_filename.size() ? m_output_filename
+                                          : default_output_filename();
+    if (target.empty())
+        target = OIIO::Filesystem::replace_extension(filename, ".oso");
     FILE* depfile = (m_deps_filename == "stdout"
                          ? stdout
                          : OIIO::Filesystem::fopen(m_deps_filename, "w"));
@@ -960,6 +1091,12 @@ OSLCompilerImpl::write_oso_file(string_view options,
             firsthint = false;
         }
 
+        // %pure marks a functioncall whose body has no side effects
+        if (op.pure()) {
+            osofmt("{}%pure", firsthint ? '\t' : ' ');
+            firsthint = false;
+        }
+
         osofmt("\n");
     }
 
@@ -1163,6 +1300,111 @@ OSLCompilerImpl::check_for_illegal_writes()
 
 
 
+// Does the op do something beyond writing its written args: output,
+// messages, traces (which leave a message), leaving the shader, or
+// writing a point cloud?
+static bool
+op_has_side_effects(ustring opname)
+{
+    static const ustring side_effect_ops[]
+        = { ustring("printf"),     ustring("fprintf"),
+            ustring("warning"),    ustring("error"),
+            ustring("setmessage"), ustring("getmessage"),
+            ustring("trace"),      ustring("exit"),
+            ustring("pointcloud_write") };
+    for (ustring s : side_effect_ops)
+        if (opname == s)
+            return true;
+    return false;
+}
+
+
+
+void
+OSLCompilerImpl::find_pure_functions()
+{
+    for (int opnum = 0, e = int(m_ircode.size()); opnum < e; ++opnum) {
+        Opcode& call(m_ircode[opnum]);
+        if (call.opname() != op_functioncall)
+            continue;
+        bool pure = true;
+        for (int i = opnum + 1, end = call.jump(0); i < end && pure; ++i) {
+            const Opcode& op(m_ircode[i]);
+            if (op_has_side_effects(op.opname()))
+                pure = false;
+            for (int a = 0; a < op.nargs() && pure; ++a)
+                if (op.argwrite(a)
+                    && m_opargs[op.firstarg() + a]->symtype() == SymTypeGlobal)
+                    pure = false;
+        }
+        call.pure(pure);
+    }
+}
+
+
+
+bool
+OSLCompilerImpl::strip_dead_functions()
+{
+    // A pure function's body is dead if nothing it writes is an output
+    // of the shader or read anywhere outside it.  Lifetimes already span
+    // any loop the body is in, so a value read on the next iteration
+    // counts as read outside.
+    std::vector<bool> dead(m_ircode.size(), false);
+    bool any = false;
+    for (int opnum = 0, e = int(m_ircode.size()); opnum < e; ++opnum) {
+        const Opcode& call(m_ircode[opnum]);
+        if (call.opname() != op_functioncall || !call.pure()
+            || call.method() != main_method_name())
+            continue;
+        int end   = call.jump(0);
+        bool used = false;
+        for (int i = opnum + 1; i < end && !used; ++i) {
+            const Opcode& op(m_ircode[i]);
+            for (int a = 0; a < op.nargs() && !used; ++a) {
+                const Symbol* s = m_opargs[op.firstarg() + a];
+                if (op.argwrite(a)
+                    && (s->symtype() == SymTypeOutputParam
+                        || s->symtype() == SymTypeGlobal
+                        || s->firstread() < opnum || s->lastread() >= end))
+                    used = true;
+            }
+        }
+        if (!used) {
+            std::fill(dead.begin() + opnum, dead.begin() + end, true);
+            any   = true;
+            opnum = end - 1;  // Nested calls went with it
+        }
+    }
+    if (!any)
+        return false;
+
+    // Renumber, a removed op's number going to the next op that stays, and
+    // fix up the jumps and the ranges that refer to op numbers.
+    std::vector<int> newnum(m_ircode.size() + 1);
+    OpcodeVec code;
+    for (size_t i = 0; i < m_ircode.size(); ++i) {
+        newnum[i] = int(code.size());
+        if (!dead[i])
+            code.push_back(m_ircode[i]);
+    }
+    newnum[m_ircode.size()] = int(code.size());
+    auto renumber = [&](int opnum) {
+        return opnum >= 0 && opnum < int(newnum.size()) ? newnum[opnum]
+                                                        : opnum;
+    };
+    for (auto&& op : code)
+        for (int j = 0; j < (int)Opcode::max_jumps; ++j)
+            op.jump(j) = renumber(op.jump(j));
+    for (auto&& s : symtab().allsyms())
+        s->set_initrange(renumber(s->initbegin()), renumber(s->initend()));
+    m_main_method_start = renumber(m_main_method_start);
+    m_ircode.swap(code);
+    return true;
+}
+
+
+
 /// Called after code is generated, this function loops over all the ops
 /// and figures out the lifetimes of all variables, based on whether the
 /// args in each op are read or written.
@@ -7,6 +7,7 @@
 #include <map>
 #include <set>
 #include <stack>
+#include <unordered_map>
 #include <vector>
 
 #include <OSL/genclosure.h>
@@ -165,6 +166,15 @@ public:
                            const std::vector<std::string>& includepaths,
                            std::string& result);
 
+    /// Run the preprocessor over instring (named filename), appending its
+    /// output -- or, if macros_only, just the #defines it leaves in
+    /// effect -- to result.
+    bool run_preprocessor(const std::string& instring,
+                          const std::string& filename,
+                          const std::vector<std::string>& defines,
+                          const std::vector<std::string>& includepaths,
+                          bool macros_only, std::string& result);
+
     /// Has a shader already been defined?
     bool shader_is_defined() const { return (bool)m_shader; }
 
@@ -204,6 +214,13 @@ public:
     /// to the type.
     std::string code_from_type(TypeSpec type) const;
 
+    /// Overloads that calls have resolved to, with their return types,
+    /// keyed on the overload chain and the type codes of the arguments.
+    typedef std::unordered_map<std::string,
+                               std::pair<FunctionSymbol*, TypeSpec>>
+        OverloadCache;
+    OverloadCache& overload_cache() { return m_overload_cache; }
+
     /// Take a type code string (possibly containing many types)
     /// and turn it into a human-readable string.
     std::string typelist_from_code(const char* code) const;
@@ -410,6 +427,17 @@ private:
     /// Must be called AFTER track_variable_lifetimes.
     void check_for_illegal_writes();
 
+    /// Mark as pure (see Opcode::pure) each "functioncall" whose body has
+    /// no side effects.
+    void find_pure_functions();
+
+    /// Remove the inlined bodies of pure functions in the main code
+    /// whose results are never used, renumbering the ops that remain.
+    /// Must be called AFTER track_variable_lifetimes and
+    /// find_pure_functions, and returns true if it removed anything (so
+    /// lifetimes should be tracked again).
+    bool strip_dead_functions();
+
     /// Helper for check_for_illegal_writes: check one statement and one
     /// symbol.
     void check_write_legality(const Opcode& op, int opnum, const Symbol* sym);
@@ -454,6 +482,19 @@ private:
     // Clear internal caches that speed up retrieve_source().
     void clear_filecontents_cache();
 
+    // Phases of a compile, timed for the -time report.
+    enum CompilePhase {
+        PhasePreprocess,
+        PhaseParse,
+        PhaseTypecheck,
+        PhaseCodegen,
+        PhaseWrite,
+        NumCompilePhases
+    };
+
+    // Print the time taken by each phase of the compile (-time).
+    void report_phase_times() const;
+
     ustring m_filename;                      ///< Current file we're parsing
     int m_lineno;                            ///< Current line we're parsing
     std::string m_output_filename;           ///< Output filename
@@ -474,6 +515,9 @@ private:
     bool m_generate_system_deps = false;  ///< Generate system header deps? -MD
     bool m_embed_source         = false;  ///< Embed preprocessed source in oso?
     bool m_err_on_warning;                ///< Treat warnings as errors?
+    bool m_time = false;                  ///< Report the time of each phase?
+    double m_phase_time[NumCompilePhases];  ///< Seconds spent in each phase
+    OverloadCache m_overload_cache;         ///< Resolved function overloads
     int m_optimizelevel;                  ///< Optimization level
     OpcodeVec m_ircode;                   ///< Generated IR code
     SymbolPtrVec m_opargs;                ///< Arguments for all instructions
@@ -498,6 +542,7 @@ private:
     size_t m_last_sourceline_offset;
     std::string m_deps_filename;            ///< Where to write deps? -MF
     std::string m_deps_target;              ///< Custom target: -MF
+    std::vector<std::string> m_force_includes;  ///< -include headers
     std::set<ustring> m_file_dependencies;  ///< All include file dependencies
     std::stack<TypeSpec> m_typespec_stack;  ///< Just for function_declaration
 };
@@ -1481,6 +1481,7 @@ class CandidateFunctions {
     size_t m_nargs;
     FunctionSymbol* m_called;  // Function called by name (can be NULL!)
     bool m_had_initlist;
+    std::string m_cachekey;  // Key of the overload cache, empty if unusable
 
     const char* scoreWildcard(int& argscore, size_t& fargs,
                               const char* args) const
@@ -1655,11 +1656,35 @@ public:
         , m_had_initlist(false)
     {
         //std::cerr << "Matching " << func->name() << " formals='" << (rval.simpletype().basetype != TypeDesc::UNKNOWN ?  compiler->code_from_type (rval) : " ");
+        bool cacheable = func != nullptr;
+        if (cacheable)
+            m_cachekey = Strutil::fmt::format("{:p}(", (const void*)func);
         for (ASTNode::ref arg = m_args; arg; arg = arg->next()) {
             //std::cerr << compiler->code_from_type (arg->typespec());
             ++m_nargs;
+            // Initializer lists take the type of the formal they bind to,
+            // so calls passing them are always resolved from scratch.
+            if (arg->nodetype() == ASTNode::compound_initializer_node)
+                cacheable = false;
+            else if (cacheable)
+                m_cachekey += compiler->code_from_type(arg->typespec());
         }
         //std::cerr << "'\n";
+        if (!cacheable)
+            m_cachekey.clear();
+
+        // The scores only depend on the argument types and the overloads
+        // (new declarations go to the head of the chain), so a call
+        // matching a single candidate binds the same way every time.
+        if (!m_cachekey.empty()) {
+            auto found = compiler->overload_cache().find(m_cachekey);
+            if (found != compiler->overload_cache().end()) {
+                m_candidates.emplace_back(found->second.first,
+                                          found->second.second, kExactMatch,
+                                          kExactMatch);
+                return;
+            }
+        }
 
         while (func) {
             //int score =
@@ -1733,6 +1758,9 @@ public:
             return { nullptr, TypeSpec() };
 
         case 1:  // Success
+            if (!m_cachekey.empty())
+                m_compiler->overload_cache()[m_cachekey]
+                    = { m_candidates[0].sym, m_candidates[0].rtype };
             return best(&m_candidates[0]);
 
         default: break;
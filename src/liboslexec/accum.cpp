@@ -4,8 +4,15 @@
 
 #include <OSL/accum.h>
 #include <OSL/oslclosure.h>
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/hash.h>
+#include <OpenImageIO/timer.h>
 #include "lpeparse.h"
 
+#include <cstdio>
+#include <cstring>
+#include <map>
+
 
 OSL_NAMESPACE_ENTER
 
@@ -65,6 +72,7 @@ AccumAutomata::addRule(const char* pattern, int outidx, bool toalpha)
         return NULL;
     }
     m_accumrules.emplace_back(outidx, toalpha);
+    m_rules_key += fmtformat("R {} {} {}\n", outidx, int(toalpha), pattern);
     // it is a list, so as long as we don't remove it from there, the pointer is valid
     void* rule = (void*)&(m_accumrules.back());
     m_rules.push_back(new lpexp::Rule(e, rule));
@@ -76,6 +84,7 @@ AccumAutomata::addRule(const char* pattern, int outidx, bool toalpha)
 void
 AccumAutomata::compile()
 {
+    OIIO::Timer timer;
     NdfAutomata ndfautomata;
     for (auto& r : m_rules) {
         r->genAuto(ndfautomata);
@@ -84,8 +93,180 @@ AccumAutomata::compile()
     // Nuke the compiled regexps, we don't need them anymore
     m_rules.clear();
     DfAutomata dfautomata;
-    ndfautoToDfauto(ndfautomata, dfautomata);
+    ndfautoToDfauto(ndfautomata, dfautomata, &m_stats.df_states);
     m_dfoptautomata.compileFrom(dfautomata);
+
+    m_stats.ndf_states   = ndfautomata.size();
+    m_stats.states       = m_dfoptautomata.getNumStates();
+    m_stats.symbols      = m_dfoptautomata.getNumSymbolIds();
+    m_stats.rule_entries = m_dfoptautomata.getNumRuleEntries();
+    m_stats.memory       = m_dfoptautomata.memory();
+    m_stats.compile_time = timer();
+}
+
+
+
+// Serialized automata: the magic, the version, the rules hash, the stats
+// of the compile, and then the tables of the DfOptimizedAutomata.
+static const char serialized_magic[8] = { 'O', 'S', 'L', 'L',
+                                          'P', 'E', 'A', 0 };
+static const uint32_t serialized_version = 1;
+
+
+
+uint64_t
+AccumAutomata::getRulesHash() const
+{
+    return OIIO::farmhash::Hash64(m_rules_key.data(), m_rules_key.size());
+}
+
+
+
+void
+AccumAutomata::serialize(std::string& buffer) const
+{
+    uint64_t header[6] = { getRulesHash(),       m_stats.ndf_states,
+                           m_stats.df_states,    m_stats.states,
+                           m_stats.rule_entries, m_stats.memory };
+    buffer.assign(serialized_magic, sizeof(serialized_magic));
+    buffer.append((const char*)&serialized_version,
+                  sizeof(serialized_version));
+    buffer.append((const char*)header, sizeof(header));
+    std::vector<void*> rules;
+    for (const auto& r : m_accumrules)
+        rules.push_back((void*)&r);
+    m_dfoptautomata.serialize(buffer, rules);
+}
+
+
+
+bool
+AccumAutomata::deserialize(string_view buffer)
+{
+    uint32_t version   = 0;
+    uint64_t header[6] = {};
+    size_t header_size = sizeof(serialized_magic) + sizeof(version)
+                         + sizeof(header);
+    if (buffer.size() < header_size
+        || memcmp(buffer.data(), serialized_magic, sizeof(serialized_magic)))
+        return false;
+    memcpy(&version, buffer.data() + sizeof(serialized_magic),
+           sizeof(version));
+    memcpy(header, buffer.data() + sizeof(serialized_magic) + sizeof(version),
+           sizeof(header));
+    if (version != serialized_version || header[0] != getRulesHash())
+        return false;
+    buffer.remove_prefix(header_size);
+
+    std::vector<void*> rules;
+    for (auto& r : m_accumrules)
+        rules.push_back((void*)&r);
+    if (!m_dfoptautomata.deserialize(buffer, rules) || !buffer.empty())
+        return false;
+    // Nuke the parsed rules, as compile() would
+    for (auto& r : m_rules)
+        delete r;
+    m_rules.clear();
+    m_stats.ndf_states   = size_t(header[1]);
+    m_stats.df_states    = size_t(header[2]);
+    m_stats.states       = size_t(header[3]);
+    m_stats.rule_entries = size_t(header[4]);
+    m_stats.memory       = size_t(header[5]);
+    m_stats.symbols      = m_dfoptautomata.getNumSymbolIds();
+    return true;
+}
+
+
+
+bool
+AccumAutomata::compileCached(string_view cache_dir)
+{
+    OIIO::Timer timer;
+    std::string filename = fmtformat("{}/lpe_{:016x}.oslaccum", cache_dir,
+                                     getRulesHash());
+    std::string buffer;
+    uint64_t size = OIIO::Filesystem::file_size(filename);
+    if (size) {
+        buffer.resize(size_t(size));
+        if (OIIO::Filesystem::read_bytes(filename, &buffer[0], buffer.size())
+                == buffer.size()
+            && deserialize(buffer)) {
+            m_stats.compile_time = timer();
+            m_stats.cached       = true;
+            return true;
+        }
+    }
+
+    compile();
+    m_stats.cached = false;
+    // Write to a uniquely named temporary and rename it into place, so
+    // that other processes never read a partial file
+    serialize(buffer);
+    std::string tmpname = fmtformat("{}.{}.tmp", filename,
+                                    OIIO::Filesystem::unique_path());
+    FILE* file          = OIIO::Filesystem::fopen(tmpname, "wb");
+    if (file) {
+        bool ok = fwrite(buffer.data(), 1, buffer.size(), file)
+                  == buffer.size();
+        ok &= (fclose(file) == 0);
+        std::string err;
+        if (!ok || !OIIO::Filesystem::rename(tmpname, filename, err))
+            OIIO::Filesystem::remove(tmpname, err);
+    }
+    return false;
+}
+
+
+
+void
+AccumAutomata::getDeviceTable(std::vector<char>& table) const
+{
+    int nstates  = int(m_dfoptautomata.getNumStates());
+    int nsymbols = m_dfoptautomata.getNumSymbolIds();
+    int noutputs = 0;
+    for (const auto& r : m_accumrules)
+        noutputs = std::max(r.getOutputIndex() + 1, noutputs);
+
+    // States with the same rules share one copy of the list, as they do
+    // in the automata
+    std::vector<int> states(2 * size_t(nstates)), rules;
+    std::map<std::pair<void* const*, int>, int> lists;
+    for (int s = 0; s < nstates; ++s) {
+        int nrules        = 0;
+        void* const* list = getRulesInState(s, nrules);
+        int first         = int(rules.size() / 2);
+        auto found        = lists.emplace(std::make_pair(list, nrules), first);
+        if (found.second) {
+            for (int i = 0; i < nrules; ++i) {
+                const AccumRule* rule = (const AccumRule*)list[i];
+                rules.push_back(rule->getOutputIndex());
+                rules.push_back(rule->toAlpha());
+            }
+        }
+        states[2 * s]     = found.first->second;
+        states[2 * s + 1] = nrules;
+    }
+
+    DeviceAccumAutomata header;
+    const int header_ints     = int(sizeof(header) / sizeof(int));
+    header.nstates            = nstates;
+    header.nsymbols           = nsymbols;
+    header.noutputs           = noutputs;
+    header.transitions_offset = header_ints;
+    header.states_offset      = header_ints + nstates * nsymbols;
+    header.rules_offset       = header.states_offset + 2 * nstates;
+    size_t nints              = size_t(header.rules_offset) + rules.size();
+    std::vector<int> ints(nints);
+    memcpy(ints.data(), &header, sizeof(header));
+    for (int s = 0; s < nstates; ++s)
+        for (int id = 0; id < nsymbols; ++id)
+            ints[header.transitions_offset + s * nsymbols + id]
+                = m_dfoptautomata.getTransition(s, id);
+    std::copy(states.begin(), states.end(),
+              ints.begin() + header.states_offset);
+    std::copy(rules.begin(), rules.end(), ints.begin() + header.rules_offset);
+    table.assign((const char*)ints.data(),
+                 (const char*)(ints.data() + ints.size()));
 }
 
 
@@ -133,51 +314,65 @@ Accumulator::setAov(int outidx, Aov* aov, bool neg_color, bool neg_alpha)
 
 
 void
-Accumulator::pushState()
+Accumulator::move(ustring symbol)
 {
-    OSL_ASSERT(m_state >= 0);
-    m_stack.push(m_state);
+    if (m_state >= 0)
+        m_state = m_accum_automata->getTransition(m_state, symbol);
 }
 
 
 
 void
-Accumulator::popState()
+Accumulator::move(const ustring* symbols)
 {
-    OSL_ASSERT(m_stack.size());
-    m_state = m_stack.top();
-    m_stack.pop();
+    while (m_state >= 0 && symbols && *symbols != Labels::NONE)
+        m_state = m_accum_automata->getTransition(m_state, *(symbols++));
 }
 
 
 
 void
-Accumulator::move(ustring symbol)
+Accumulator::move(ustring event, ustring scatt, const ustring* custom,
+                  ustring stop)
 {
     if (m_state >= 0)
-        m_state = m_accum_automata->getTransition(m_state, symbol);
+        m_state = m_accum_automata->getTransition(m_state, event);
+    if (m_state >= 0)
+        m_state = m_accum_automata->getTransition(m_state, scatt);
+    while (m_state >= 0 && custom && *custom != Labels::NONE)
+        m_state = m_accum_automata->getTransition(m_state, *(custom++));
+    if (m_state >= 0)
+        m_state = m_accum_automata->getTransition(m_state, stop);
 }
 
 
 
 void
-Accumulator::move(const ustring* symbols)
+Accumulator::move(int symbol_id)
 {
-    while (m_state >= 0 && symbols && *symbols != Labels::NONE)
-        m_state = m_accum_automata->getTransition(m_state, *(symbols++));
+    if (m_state >= 0)
+        m_state = m_accum_automata->getTransition(m_state, symbol_id);
 }
 
 
 
 void
-Accumulator::move(ustring event, ustring scatt, const ustring* custom,
-                  ustring stop)
+Accumulator::move(const int* symbol_ids)
+{
+    while (m_state >= 0 && symbol_ids && *symbol_ids >= 0)
+        m_state = m_accum_automata->getTransition(m_state, *(symbol_ids++));
+}
+
+
+
+void
+Accumulator::move(int event, int scatt, const int* custom, int stop)
 {
     if (m_state >= 0)
         m_state = m_accum_automata->getTransition(m_state, event);
     if (m_state >= 0)
         m_state = m_accum_automata->getTransition(m_state, scatt);
-    while (m_state >= 0 && custom && *custom != Labels::NONE)
+    while (m_state >= 0 && custom && *custom >= 0)
         m_state = m_accum_automata->getTransition(m_state, *(custom++));
     if (m_state >= 0)
         m_state = m_accum_automata->getTransition(m_state, stop);
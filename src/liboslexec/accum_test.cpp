@@ -3,9 +3,12 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 #include <OSL/accum.h>
+#include <OSL/batched_accum.h>
 #include <OSL/oslclosure.h>
 #include <OpenImageIO/unittest.h>
 
+#include <cstring>
+
 using namespace OSL;
 
 #define END_AOV 65535
@@ -58,9 +61,11 @@ protected:
     std::vector<bool> m_received;
 };
 
-// Simulate the tracing of a path with the accumulator
+// Simulate the tracing of a path with the accumulator, moving by label
+// IDs from the automata rather than by ustrings if it's given
 void
-simulate(Accumulator& accum, const char** events, size_t testno)
+simulate(Accumulator& accum, const char** events, size_t testno,
+         const AccumAutomata* ids = nullptr)
 {
     accum.begin();
     accum.pushState();
@@ -71,11 +76,17 @@ simulate(Accumulator& accum, const char** events, size_t testno)
         while (*e) {
             ustring sym(e, 1);
             // advance our state with the label
-            accum.move(sym);
+            if (ids)
+                accum.move(ids->getSymbolId(sym));
+            else
+                accum.move(sym);
             e++;
         }
         // always finish the hit with a stop label
-        accum.move(Labels::STOP);
+        if (ids)
+            accum.move(ids->getSymbolId(Labels::STOP));
+        else
+            accum.move(Labels::STOP);
         events++;
     }
     // Here is were we have reached a light, accumulate color
@@ -85,6 +96,101 @@ simulate(Accumulator& accum, const char** events, size_t testno)
     accum.end(reinterpret_cast<void*>(testno));
 }
 
+// Simulate the same with the DeviceAccumulator, as a GPU integrator
+// would, and hand its outputs over to the AOVs
+void
+simulate_device(DeviceAccumulator& accum, const AccumAutomata& automata,
+                std::vector<MyAov>& aovs, const char** events, size_t testno)
+{
+    accum.reset();
+    accum.pushState();
+    while (*events) {
+        for (const char* e = *events; *e; ++e)
+            accum.move(automata.getSymbolId(ustring(e, 1)));
+        accum.move(automata.getSymbolId(Labels::STOP));
+        events++;
+    }
+    accum.accum(Color3(1, 1, 1));
+    accum.popState();
+    for (size_t i = 0; i < aovs.size(); ++i) {
+        DeviceAovOutput out = accum.getOutput(int(i));
+        aovs[i].write(reinterpret_cast<void*>(testno), out.color, out.alpha,
+                      out.has_color, out.has_alpha);
+    }
+}
+
+// Batched AOV handing each lane over to a MyAov. Lane i of a batch is
+// test case first + i, where first is the flush data.
+class MyBatchedAov final : public BatchedAov<4> {
+public:
+    MyBatchedAov(MyAov& aov) : m_aov(aov) {}
+
+    void write(void* flush_data, Mask<4> mask,
+               const BatchedAovOutput<4>& output) override
+    {
+        size_t first = reinterpret_cast<size_t>(flush_data);
+        for (int i = 0; i < 4; ++i) {
+            if (mask.is_on(i)) {
+                Color3 color = output.color(i);
+                m_aov.write(reinterpret_cast<void*>(first + i), color,
+                            output.alpha[i], output.has_color.is_on(i),
+                            output.has_alpha.is_on(i));
+            }
+        }
+    }
+
+private:
+    MyAov& m_aov;
+};
+
+// Simulate the tracing of the paths of test cases first.. at once, one
+// per lane of the batched accumulator
+void
+simulate_batched(BatchedAccumulator<4>& accum, const AccumAutomata& automata,
+                 const TestPath* test, int first, int ntests)
+{
+    Mask<4> lanes(false);
+    for (int i = 0; i < 4; ++i)
+        lanes.set_on_if(i, first + i < ntests);
+    accum.begin();
+    accum.pushState();
+    // for each ray stop, in the lanes whose path has one ...
+    for (int hit = 0;; ++hit) {
+        Mask<4> hitting(false);
+        for (int i = 0; i < 4; ++i)
+            hitting.set_on_if(i, lanes.is_on(i) && test[first + i].path[hit]);
+        if (!hitting.any_on())
+            break;
+        // advance each lane's state with its own labels of this hit
+        for (int label = 0;; ++label) {
+            Block<int, 4> ids;
+            Mask<4> labeled(false);
+            for (int i = 0; i < 4; ++i) {
+                const char* e = hitting.is_on(i) ? test[first + i].path[hit]
+                                                 : "";
+                bool has_label = strlen(e) > size_t(label);
+                ids.set(i, has_label
+                               ? automata.getSymbolId(ustring(e + label, 1))
+                               : 0);
+                labeled.set_on_if(i, has_label);
+            }
+            if (!labeled.any_on())
+                break;
+            accum.move(labeled, ids);
+        }
+        // always finish the hit with a stop label
+        accum.move(hitting, automata.getSymbolId(Labels::STOP));
+    }
+    // Here is were we have reached a light, accumulate color
+    Block<Color3, 4> white;
+    for (int i = 0; i < 4; ++i)
+        white.set(i, Color3(1, 1, 1));
+    accum.accum(lanes, white);
+    // Restore state and flush
+    accum.popState();
+    accum.end(lanes, reinterpret_cast<void*>(size_t(first)));
+}
+
 int
 main()
 {
@@ -134,23 +240,30 @@ main()
         aovs.emplace_back(test, i);
 
     // Create the automata and add the rules
-    AccumAutomata automata;
-
-    automata.addEventType(ustring("U"));
-    automata.addScatteringType(ustring("Y"));
-
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*L", beauty));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D{2,3}L", diffuse2_3));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*<L.'3'>", light3));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*<.D'1'>D*L", object_1));
-    OIIO_CHECK_ASSERT(automata.addRule("C<.[SG]>+D*L", specular));
-    OIIO_CHECK_ASSERT(automata.addRule("CD+L", diffuse));
-    OIIO_CHECK_ASSERT(automata.addRule("CD+<Ts>L", transpshadow));
-    OIIO_CHECK_ASSERT(automata.addRule("C<R[^D]>+D*L", reflections));
-    OIIO_CHECK_ASSERT(automata.addRule("C([SG]*D){1,2}L", nocaustic));
-    OIIO_CHECK_ASSERT(automata.addRule("CDY+U", custom));
+    auto add_rules = [&](AccumAutomata& automata) {
+        automata.addEventType(ustring("U"));
+        automata.addScatteringType(ustring("Y"));
 
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*L", beauty));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D{2,3}L", diffuse2_3));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*<L.'3'>", light3));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*<.D'1'>D*L", object_1));
+        OIIO_CHECK_ASSERT(automata.addRule("C<.[SG]>+D*L", specular));
+        OIIO_CHECK_ASSERT(automata.addRule("CD+L", diffuse));
+        OIIO_CHECK_ASSERT(automata.addRule("CD+<Ts>L", transpshadow));
+        OIIO_CHECK_ASSERT(automata.addRule("C<R[^D]>+D*L", reflections));
+        OIIO_CHECK_ASSERT(automata.addRule("C([SG]*D){1,2}L", nocaustic));
+        OIIO_CHECK_ASSERT(automata.addRule("CDY+U", custom));
+    };
+    AccumAutomata automata;
+    add_rules(automata);
     automata.compile();
+    // Minimization merges the equivalent states of the determinized
+    // automata
+    const AccumAutomata::Stats& stats = automata.getStats();
+    OIIO_CHECK_EQUAL(stats.df_states, size_t(651));
+    OIIO_CHECK_EQUAL(stats.states, size_t(468));
+    OIIO_CHECK_ASSERT(stats.states < stats.df_states);
 
     // now create the accumulator
     Accumulator accum(&automata);
@@ -159,21 +272,118 @@ main()
     for (int i = 0; i < naovs; ++i)
         accum.setAov(i, &aovs[i], false, false);
 
-    // do the simulation for each test case
+    // do the simulation for each test case, first moving by label
+    // ustrings and then by label IDs, which must agree
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; test[i].path[0]; ++i)
+            simulate(accum, test[i].path, i, pass ? &automata : nullptr);
+
+        // And check. We unroll this loop for boost to give us a useful
+        // error in case they fail
+        OIIO_CHECK_ASSERT(aovs[beauty].check());
+        OIIO_CHECK_ASSERT(aovs[diffuse2_3].check());
+        OIIO_CHECK_ASSERT(aovs[light3].check());
+        OIIO_CHECK_ASSERT(aovs[object_1].check());
+        OIIO_CHECK_ASSERT(aovs[specular].check());
+        OIIO_CHECK_ASSERT(aovs[diffuse].check());
+        OIIO_CHECK_ASSERT(aovs[transpshadow].check());
+        OIIO_CHECK_ASSERT(aovs[reflections].check());
+        OIIO_CHECK_ASSERT(aovs[nocaustic].check());
+    }
+
+    // reset() goes back to the initial state, with an empty stack and
+    // cleared outputs, from wherever an abandoned path left it: here the
+    // next test case, lit but never flushed, with its state still pushed
+    std::vector<MyAov> reset_aovs;
+    for (int i = 0; i < naovs; ++i)
+        reset_aovs.emplace_back(test, i);
+    Accumulator reset_accum(&automata);
+    for (int i = 0; i < naovs; ++i)
+        reset_accum.setAov(i, &reset_aovs[i], false, false);
+    for (int i = 0; test[i].path[0]; ++i) {
+        const char** abandoned = test[i + 1].path[0] ? test[i + 1].path
+                                                     : test[0].path;
+        reset_accum.reset();
+        reset_accum.pushState();
+        for (; *abandoned; ++abandoned) {
+            for (const char* e = *abandoned; *e; ++e)
+                reset_accum.move(ustring(e, 1));
+            reset_accum.move(Labels::STOP);
+        }
+        reset_accum.accum(Color3(1, 1, 1));
+        reset_accum.reset();
+        OIIO_CHECK_ASSERT(!reset_accum.broken());
+        reset_accum.pushState();
+        for (const char** events = test[i].path; *events; ++events) {
+            for (const char* e = *events; *e; ++e)
+                reset_accum.move(ustring(e, 1));
+            reset_accum.move(Labels::STOP);
+        }
+        reset_accum.accum(Color3(1, 1, 1));
+        reset_accum.popState();
+        reset_accum.end(reinterpret_cast<void*>(size_t(i)));
+    }
+    for (int i = beauty; i <= nocaustic; ++i)
+        OIIO_CHECK_ASSERT(reset_aovs[i].check());
+
+    // And once more with all the test cases shaded 4 at a time
+    std::vector<MyAov> batched_aovs;
+    for (int i = 0; i < naovs; ++i)
+        batched_aovs.emplace_back(test, i);
+    std::vector<MyBatchedAov> batched_outputs;
+    for (int i = 0; i < naovs; ++i)
+        batched_outputs.emplace_back(batched_aovs[i]);
+    BatchedAccumulator<4> batched_accum(&automata);
+    for (int i = 0; i < naovs; ++i)
+        batched_accum.setAov(i, &batched_outputs[i], false, false);
+    int ntests = 0;
+    while (test[ntests].path[0])
+        ++ntests;
+    for (int first = 0; first < ntests; first += 4)
+        simulate_batched(batched_accum, automata, test, first, ntests);
+    // (checking the same AOVs as above)
+    for (int i = beauty; i <= nocaustic; ++i)
+        OIIO_CHECK_ASSERT(batched_aovs[i].check());
+
+    // And with the flattened tables of the device accumulator
+    std::vector<char> table;
+    automata.getDeviceTable(table);
+    const DeviceAccumAutomata* device_automata
+        = (const DeviceAccumAutomata*)table.data();
+    OIIO_CHECK_EQUAL(device_automata->nstates, int(stats.states));
+    OIIO_CHECK_EQUAL(device_automata->noutputs, naovs);
+    std::vector<MyAov> device_aovs;
+    for (int i = 0; i < naovs; ++i)
+        device_aovs.emplace_back(test, i);
+    std::vector<DeviceAovOutput> device_outputs(naovs);
+    DeviceAccumulator device_accum(device_automata, device_outputs.data());
+    for (int i = 0; test[i].path[0]; ++i)
+        simulate_device(device_accum, automata, device_aovs, test[i].path, i);
+    for (int i = beauty; i <= nocaustic; ++i)
+        OIIO_CHECK_ASSERT(device_aovs[i].check());
+
+    // An automata with the same rules reads back the serialized one and
+    // accumulates the same, while other rules can't read it
+    std::string serialized;
+    automata.serialize(serialized);
+    AccumAutomata reread;
+    add_rules(reread);
+    OIIO_CHECK_EQUAL(reread.getRulesHash(), automata.getRulesHash());
+    OIIO_CHECK_ASSERT(reread.deserialize(serialized));
+    OIIO_CHECK_EQUAL(reread.getStats().states, stats.states);
+    AccumAutomata other;
+    OIIO_CHECK_ASSERT(other.addRule("CD+L", diffuse));
+    OIIO_CHECK_ASSERT(!other.deserialize(serialized));
+    std::vector<MyAov> reread_aovs;
+    for (int i = 0; i < naovs; ++i)
+        reread_aovs.emplace_back(test, i);
+    Accumulator reread_accum(&reread);
+    for (int i = 0; i < naovs; ++i)
+        reread_accum.setAov(i, &reread_aovs[i], false, false);
     for (int i = 0; test[i].path[0]; ++i)
-        simulate(accum, test[i].path, i);
-
-    // And check. We unroll this loop for boost to give us a useful
-    // error in case they fail
-    OIIO_CHECK_ASSERT(aovs[beauty].check());
-    OIIO_CHECK_ASSERT(aovs[diffuse2_3].check());
-    OIIO_CHECK_ASSERT(aovs[light3].check());
-    OIIO_CHECK_ASSERT(aovs[object_1].check());
-    OIIO_CHECK_ASSERT(aovs[specular].check());
-    OIIO_CHECK_ASSERT(aovs[diffuse].check());
-    OIIO_CHECK_ASSERT(aovs[transpshadow].check());
-    OIIO_CHECK_ASSERT(aovs[reflections].check());
-    OIIO_CHECK_ASSERT(aovs[nocaustic].check());
+        simulate(reread_accum, test[i].path, i, &reread);
+    for (int i = beauty; i <= nocaustic; ++i)
+        OIIO_CHECK_ASSERT(reread_aovs[i].check());
 
     std::cout << "Light expressions check OK" << std::endl;
     return unit_test_failures;
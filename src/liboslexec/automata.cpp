@@ -6,6 +6,9 @@
 #include <OSL/optautomata.h>
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <map>
+#include <unordered_map>
 
 
 OSL_NAMESPACE_ENTER
@@ -414,105 +417,86 @@ DfAutomata::tostr() const
 
 
 
-bool
-DfAutomata::equivalent(const State* dfstateA, const State* dfstateB)
-{
-    // early exit if the size of the tables is different
-    if (dfstateA->m_symbol_trans.size() != dfstateB->m_symbol_trans.size())
-        return false;
-    // The pointed state by both transitions have to be the same or any of dfstateA and dfstateB
-    int destA = (dfstateA->m_wildcard_trans == dfstateA->getId()
-                 || dfstateA->m_wildcard_trans == dfstateB->getId())
-                    ? -2
-                    : dfstateA->m_wildcard_trans;
-    int destB = (dfstateB->m_wildcard_trans == dfstateA->getId()
-                 || dfstateB->m_wildcard_trans == dfstateB->getId())
-                    ? -2
-                    : dfstateB->m_wildcard_trans;
-    if (destA != destB)
-        return false;
-    // Rules have to be the same
-    if (dfstateA->m_rules != dfstateB->m_rules)
-        return false;
-    for (SymbolToInt::const_iterator i = dfstateA->m_symbol_trans.begin();
-         i != dfstateA->m_symbol_trans.end(); ++i) {
-        SymbolToInt::const_iterator other = dfstateB->m_symbol_trans.find(
-            i->first);
-        if (other == dfstateB->m_symbol_trans.end())
-            return false;
-        // The pointed state by both transitions have to be the same or any of dfstateA and dfstateB
-        int destA = (i->second == dfstateA->getId()
-                     || i->second == dfstateB->getId())
-                        ? -2
-                        : i->second;
-        int destB = (other->second == dfstateA->getId()
-                     || other->second == dfstateB->getId())
-                        ? -2
-                        : other->second;
-        // when they are -1 is because they are in the wildcard black list, anyway they have to match so ...
-        if (destA != destB)
-            return false;
-    }
-    // if everything passed, they are equivalent, congratulations.
-    return true;
-}
-
-
-
 void
 DfAutomata::removeEquivalentStates()
 {
-    std::vector<State*> newstatelist;
-    HashIntInt newfromold;
-
-    // First go through all states and delete all those
-    // that are equivalent with a previous one
-    for (size_t i = 0; i < m_states.size(); ++i) {
-        if (!m_states[i])  // it has already been removed
-            continue;
-        // create a new state id from newstatelist.size()
-        // move the pointer there and register the translation
-        int newstate = newfromold[i] = newstatelist.size();
-        newstatelist.push_back(m_states[i]);
-        for (size_t j = i + 1; j < m_states.size(); ++j)
-            if (m_states[j] && equivalent(m_states[i], m_states[j])) {
-                // put in the record that this state will be known as
-                // the one in newstate from now on
-                newfromold[j] = newstate;
-                delete m_states[j];
-                m_states[j] = NULL;
-            }
+    // Minimize by partition refinement: split the states into classes by
+    // their rules, then keep splitting the classes whose members go to
+    // different classes by some symbol, until no class splits any more.
+    // The states left in a class are equivalent.
+    size_t nstates = m_states.size();
+    if (nstates < 2)
+        return;
+    auto symbol_comp = [](ustring a, ustring b) { return a.data() < b.data(); };
+    std::vector<ustring> symbols;
+    for (const State* state : m_states)
+        for (const auto& trans : state->m_symbol_trans)
+            symbols.push_back(trans.first);
+    std::sort(symbols.begin(), symbols.end(), symbol_comp);
+    symbols.erase(std::unique(symbols.begin(), symbols.end()), symbols.end());
+
+    // Classes are numbered in order of their first state, so that the
+    // initial state 0 stays state 0
+    std::vector<int> classes(nstates);
+    size_t nclasses = 0;
+    {
+        std::map<RuleSet, int> byrules;
+        for (size_t i = 0; i < nstates; ++i) {
+            RuleSet rules = m_states[i]->m_rules;
+            std::sort(rules.begin(), rules.end());
+            classes[i] = byrules.emplace(rules, int(byrules.size()))
+                             .first->second;
+        }
+        nclasses = byrules.size();
     }
-    // Everything has been moved now, but we still have to fix the
-    // transitions so they point to the right states!
-    for (size_t i = 0; i < newstatelist.size(); ++i) {
-        State* state = newstatelist[i];
-        for (SymbolToInt::iterator j = state->m_symbol_trans.begin();
-             j != state->m_symbol_trans.end(); ++j) {
-            if (j->second
-                != -1) {  // if it is -1 it is just in the wildcards black list
-                // Get the new state that maps to the oldstate pointed by the transition
-                HashIntInt::const_iterator trans = newfromold.find(j->second);
-                if (trans != newfromold.end())
-                    j->second = trans->second;
-                else
-                    std::cerr
-                        << "[pathexp] broken translation list between states"
-                        << std::endl;
-            }
+    // Class of the state that symbol number s (or any other symbol, if
+    // s is symbols.size()) leads to, -1 if none
+    auto dest_class = [&](const State* state, size_t s) -> int {
+        int dest = state->m_wildcard_trans;
+        if (s < symbols.size()) {
+            SymbolToInt::const_iterator i = state->m_symbol_trans.find(
+                symbols[s]);
+            if (i != state->m_symbol_trans.end())
+                dest = i->second;
         }
-        // Do the same with the wildcard
-        if (state->m_wildcard_trans >= 0) {
-            HashIntInt::const_iterator trans = newfromold.find(
-                state->m_wildcard_trans);
-            if (trans != newfromold.end())
-                state->m_wildcard_trans = trans->second;
-            else
-                std::cerr << "[pathexp] broken translation list between states"
-                          << std::endl;
+        return dest >= 0 ? classes[dest] : -1;
+    };
+    std::vector<int> signature, newclasses(nstates);
+    while (true) {
+        std::map<std::vector<int>, int> bysignature;
+        for (size_t i = 0; i < nstates; ++i) {
+            signature.clear();
+            signature.push_back(classes[i]);
+            for (size_t s = 0; s <= symbols.size(); ++s)
+                signature.push_back(dest_class(m_states[i], s));
+            newclasses[i] = bysignature.emplace(signature,
+                                                int(bysignature.size()))
+                                .first->second;
         }
+        classes.swap(newclasses);
+        if (bysignature.size() == nclasses)
+            break;  // nothing split, we're done
+        nclasses = bysignature.size();
+    }
+
+    // Keep the first state of each class, pointed to its new state ids
+    std::vector<State*> newstatelist(nclasses, nullptr);
+    for (size_t i = 0; i < nstates; ++i) {
+        if (!newstatelist[classes[i]])
+            newstatelist[classes[i]] = m_states[i];
+        else
+            delete m_states[i];
+    }
+    for (size_t c = 0; c < nclasses; ++c) {
+        State* state = newstatelist[c];
+        state->m_id  = int(c);
+        for (auto& trans : state->m_symbol_trans)
+            if (trans.second >= 0)  // -1 is just the wildcard's black list
+                trans.second = classes[trans.second];
+        if (state->m_wildcard_trans >= 0)
+            state->m_wildcard_trans = classes[state->m_wildcard_trans];
     }
-    // switch to the new hopefully reduced state vector
+    // switch to the new reduced state vector
     m_states = newstatelist;
 }
 
@@ -584,7 +568,8 @@ StateSetRecord::getRulesFromSet(DfAutomata::State* dfstate,
 
 
 void
-ndfautoToDfauto(const NdfAutomata& ndfautomata, DfAutomata& dfautomata)
+ndfautoToDfauto(const NdfAutomata& ndfautomata, DfAutomata& dfautomata,
+                size_t* determinized_states)
 {
     std::list<StateSetRecord::Discovery> toexplore, discovered;
     // our initial state is the lambda closure
@@ -633,58 +618,157 @@ ndfautoToDfauto(const NdfAutomata& ndfautomata, DfAutomata& dfautomata)
         toexplore.swap(discovered);
     }
     // final optimizations
+    if (determinized_states)
+        *determinized_states = dfautomata.size();
     dfautomata.removeEquivalentStates();
     dfautomata.removeUselessTransitions();
 }
 
 
 
-bool
-DfOptimizedAutomata::Transition::trans_comp(
-    const DfOptimizedAutomata::Transition& a,
-    const DfOptimizedAutomata::Transition& b)
+void
+DfOptimizedAutomata::compileFrom(const DfAutomata& dfautomata)
 {
-    return a.symbol.data() < b.symbol.data();
+    // Give an ID to every symbol that some state has a transition for
+    m_symbols.clear();
+    for (const DfAutomata::State* state : dfautomata.m_states)
+        for (const auto& trans : state->m_symbol_trans)
+            m_symbols.push_back(trans.first);
+    std::sort(m_symbols.begin(), m_symbols.end(), symbol_comp);
+    m_symbols.erase(std::unique(m_symbols.begin(), m_symbols.end()),
+                    m_symbols.end());
+    m_nsymbol_ids = int(m_symbols.size()) + 1;
+
+    m_states.resize(dfautomata.m_states.size());
+    m_table.resize(m_states.size() * m_nsymbol_ids);
+    m_rules.clear();
+    // States with the same rules share one copy of the list
+    std::map<RuleSet, unsigned int> rule_lists;
+    for (size_t s = 0; s < m_states.size(); ++s) {
+        const DfAutomata::State* state = dfautomata.m_states[s];
+        // Whatever has no transition of its own follows the wildcard
+        int* row = &m_table[s * m_nsymbol_ids];
+        std::fill(row, row + m_nsymbol_ids, state->m_wildcard_trans);
+        for (const auto& trans : state->m_symbol_trans)
+            row[getSymbolId(trans.first)] = trans.second;
+        auto found = rule_lists.emplace(state->m_rules,
+                                        (unsigned int)m_rules.size());
+        if (found.second)
+            m_rules.insert(m_rules.end(), state->m_rules.begin(),
+                           state->m_rules.end());
+        m_states[s].begin_rules = found.first->second;
+        m_states[s].nrules      = state->m_rules.size();
+    }
 }
 
 
 
+namespace {
+
+template<typename T>
+inline void
+append_pod(std::string& out, const T& value)
+{
+    out.append((const char*)&value, sizeof(T));
+}
+
+template<typename T>
+inline bool
+read_pod(string_view& in, T* values, size_t count = 1)
+{
+    if (in.size() / sizeof(T) < count)
+        return false;
+    memcpy((void*)values, in.data(), count * sizeof(T));
+    in.remove_prefix(count * sizeof(T));
+    return true;
+}
+
+}  // namespace
+
+
+
 void
-DfOptimizedAutomata::compileFrom(const DfAutomata& dfautomata)
+DfOptimizedAutomata::serialize(std::string& out,
+                               const std::vector<void*>& rules) const
 {
-    m_states.resize(dfautomata.m_states.size());
-    size_t totaltrans = 0;
-    size_t totalrules = 0;
-    for (size_t s = 0; s < m_states.size(); ++s) {
-        totaltrans += dfautomata.m_states[s]->m_symbol_trans.size();
-        totalrules += dfautomata.m_states[s]->m_rules.size();
+    append_pod(out, uint32_t(m_symbols.size()));
+    for (ustring symbol : m_symbols) {
+        append_pod(out, uint32_t(symbol.size()));
+        out.append(symbol.data(), symbol.size());
     }
-    m_trans.resize(totaltrans);
-    m_rules.resize(totalrules);
-    size_t trans_offset = 0;
-    size_t rules_offset = 0;
-    for (size_t s = 0; s < m_states.size(); ++s) {
-        m_states[s].begin_trans = trans_offset;
-        m_states[s].begin_rules = rules_offset;
-        for (SymbolToInt::const_iterator i
-             = dfautomata.m_states[s]->m_symbol_trans.begin();
-             i != dfautomata.m_states[s]->m_symbol_trans.end();
-             ++i, ++trans_offset) {
-            m_trans[trans_offset].symbol = i->first;
-            m_trans[trans_offset].state  = i->second;
-        }
-        for (RuleSet::const_iterator i = dfautomata.m_states[s]->m_rules.begin();
-             i != dfautomata.m_states[s]->m_rules.end(); ++i, ++rules_offset)
-            m_rules[rules_offset] = *i;
-        m_states[s].ntrans = dfautomata.m_states[s]->m_symbol_trans.size();
-        m_states[s].nrules = dfautomata.m_states[s]->m_rules.size();
-        std::sort(m_trans.begin() + m_states[s].begin_trans,
-                  m_trans.begin() + m_states[s].begin_trans
-                      + m_states[s].ntrans,
-                  DfOptimizedAutomata::Transition::trans_comp);
-        m_states[s].wildcard_trans = dfautomata.m_states[s]->m_wildcard_trans;
+    append_pod(out, uint32_t(m_states.size()));
+    out.append((const char*)m_table.data(), m_table.size() * sizeof(int));
+    out.append((const char*)m_states.data(), m_states.size() * sizeof(State));
+    std::unordered_map<void*, uint32_t> rule_index;
+    for (size_t i = 0; i < rules.size(); ++i)
+        rule_index.emplace(rules[i], uint32_t(i));
+    append_pod(out, uint32_t(m_rules.size()));
+    for (void* rule : m_rules) {
+        OSL_DASSERT(rule_index.count(rule));
+        append_pod(out, rule_index[rule]);
     }
 }
 
 
+
+bool
+DfOptimizedAutomata::deserialize(string_view& in,
+                                 const std::vector<void*>& rules)
+{
+    string_view data = in;
+    uint32_t nsymbols, nstates, nrules;
+    if (!read_pod(data, &nsymbols))
+        return false;
+    std::vector<ustring> symbols(nsymbols);
+    for (ustring& symbol : symbols) {
+        uint32_t len;
+        if (!read_pod(data, &len) || data.size() < len)
+            return false;
+        symbol = ustring(data.substr(0, len));
+        data.remove_prefix(len);
+    }
+    if (!read_pod(data, &nstates) || !nstates)
+        return false;
+    size_t nids = size_t(nsymbols) + 1;
+    std::vector<int> table(nstates * nids);
+    std::vector<State> states(nstates);
+    if (!read_pod(data, table.data(), table.size())
+        || !read_pod(data, states.data(), states.size())
+        || !read_pod(data, &nrules))
+        return false;
+    std::vector<void*> state_rules(nrules);
+    for (void*& rule : state_rules) {
+        uint32_t r;
+        if (!read_pod(data, &r) || r >= rules.size())
+            return false;
+        rule = rules[r];
+    }
+    for (int next : table)
+        if (next < -1 || next >= int(nstates))
+            return false;
+    for (const State& state : states)
+        if (state.begin_rules > nrules
+            || state.nrules > nrules - state.begin_rules)
+            return false;
+
+    // The symbol IDs were by the order of the symbols in the process that
+    // wrote them, so sort them for this one and move the columns along.
+    std::vector<ustring> sorted(symbols);
+    std::sort(sorted.begin(), sorted.end(), symbol_comp);
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+        return false;
+    m_symbols.swap(sorted);
+    m_nsymbol_ids = int(nids);
+    m_table.resize(table.size());
+    for (size_t i = 0; i < nids; ++i) {
+        size_t id = i < nsymbols ? size_t(getSymbolId(symbols[i])) : i;
+        for (size_t s = 0; s < nstates; ++s)
+            m_table[s * nids + id] = table[s * nids + i];
+    }
+    m_states.swap(states);
+    m_rules.swap(state_rules);
+    in = data;
+    return true;
+}
+
 OSL_NAMESPACE_EXIT
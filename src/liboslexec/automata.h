@@ -250,7 +250,8 @@ public:
     // an automata, we provide this method
     void clear();
 
-    /// Colapse all the equivalent states into single ones
+    /// Colapse all the equivalent states into single ones, which leaves
+    /// the minimal automata recognizing the same paths with the same rules
     void removeEquivalentStates();
     /// Go through all the states and perform removeUselessTransitions
     /// method call on them
@@ -260,12 +261,6 @@ public:
     std::string tostr() const;
 
 protected:
-    /// Return true if two states are equivalent
-    ///
-    /// Two states are equivalent if their transition tables lead
-    /// to the same states for the same symbols
-    bool equivalent(const State* dfstateA, const State* dfstateB);
-
     // State vector with the automata
     std::vector<State*> m_states;
 };
@@ -311,7 +306,10 @@ private:
 /// This function is the most important pice of the whole process. It takes
 /// a non-deterministic finite automata and computes an equivalent deterministic
 /// one. It is equivalente in the sense that they  both recognize the same language
+/// The result is minimized; if determinized_states isn't NULL, it gets the
+/// number of states before that.
 void
-ndfautoToDfauto(const NdfAutomata& ndfautomata, DfAutomata& dfautomata);
+ndfautoToDfauto(const NdfAutomata& ndfautomata, DfAutomata& dfautomata,
+                size_t* determinized_states = NULL);
 
 OSL_NAMESPACE_EXIT
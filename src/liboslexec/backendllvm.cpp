@@ -3,6 +3,8 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
+
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/strutil.h>
 
@@ -30,6 +32,7 @@ BackendLLVM::BackendLLVM(ShadingSystemImpl& shadingsys, ShaderGroup& group,
     m_use_optix      = shadingsys.use_optix();
     m_use_rs_bitcode = !shadingsys.m_rs_bitcode.empty();
     m_name_llvm_syms = shadingsys.m_llvm_output_bitcode;
+    m_llvm_optimize  = shadingsys.llvm_optimize();
 
     // Select the appropriate ustring representation
     ll.ustring_rep(m_use_optix ? LLVM_Util::UstringRep::hash
@@ -46,6 +49,96 @@ BackendLLVM::~BackendLLVM() {}
 
 
 
+float
+BackendLLVM::layer_profile(int layer) const
+{
+    long long runs = group().layer_executions(layer);
+    if (m_profile_layers || runs < 0 || group().executions() <= 0)
+        return -1.0f;
+    return std::min(1.0f, float(runs) / float(group().executions()));
+}
+
+
+
+llvm::Value*
+BackendLLVM::llvm_profile_clock()
+{
+    // Must read the same clock as profile_clock()
+#if defined(__x86_64__)
+    return ll.op_readcyclecounter();
+#else
+    llvm::Value* now = ll.op_alloca(ll.type_longlong(), 1, "profile_now");
+    ll.call_function("osl_profile_clock", ll.void_ptr(now));
+    return ll.op_load(ll.type_longlong(), now);
+#endif
+}
+
+
+
+void
+BackendLLVM::llvm_profile_charge(llvm::Value* now)
+{
+    llvm::Value* last = ll.op_load(ll.type_longlong(), m_llvm_profile_last);
+    llvm::Value* site = ll.op_load(ll.type_longlong_ptr(), m_llvm_profile_site);
+    ll.op_atomic_add(site, ll.op_sub(now, last));
+    ll.op_store(now, m_llvm_profile_last);
+}
+
+
+
+void
+BackendLLVM::llvm_profile_begin()
+{
+    m_llvm_profile_last = nullptr;
+    m_llvm_profile_site = nullptr;
+    m_profile_site      = nullptr;
+    if (!shadingsys().profile_instrument() || use_optix())
+        return;
+    ProfileSite* site   = group().profile_site(layer());
+    m_llvm_profile_last = ll.op_alloca(ll.type_longlong(), 1, "profile_last");
+    m_llvm_profile_site = ll.op_alloca(ll.type_longlong_ptr(), 1,
+                                       "profile_site");
+    ll.op_atomic_add(ll.constant_ptr((void*)&site->runs,
+                                     ll.type_longlong_ptr()),
+                     ll.constanti64(1));
+    ll.op_store(ll.constant_ptr((void*)&site->ticks, ll.type_longlong_ptr()),
+                m_llvm_profile_site);
+    ll.op_store(llvm_profile_clock(), m_llvm_profile_last);
+    m_profile_site = site;
+}
+
+
+
+void
+BackendLLVM::llvm_profile_op(const Opcode& op)
+{
+    if (!llvm_profiling() || shadingsys().profile_instrument() < 2)
+        return;
+    ProfileSite* site = group().profile_site(layer(), op.sourcefile(),
+                                             op.sourceline());
+    if (site == m_profile_site)
+        return;  // Still on the source line of the last probe
+    llvm_profile_charge(llvm_profile_clock());
+    ll.op_store(ll.constant_ptr((void*)&site->ticks, ll.type_longlong_ptr()),
+                m_llvm_profile_site);
+    m_profile_site = site;
+}
+
+
+
+void
+BackendLLVM::llvm_profile_end()
+{
+    if (!llvm_profiling())
+        return;
+    llvm_profile_charge(llvm_profile_clock());
+    m_llvm_profile_last = nullptr;
+    m_llvm_profile_site = nullptr;
+    m_profile_site      = nullptr;
+}
+
+
+
 int
 BackendLLVM::llvm_debug() const
 {
@@ -220,6 +313,20 @@ BackendLLVM::getLLVMSymbolBase(const Symbol& sym)
     Symbol* dealiased = sym.dealias();
 
     if (sym.symtype() == SymTypeGlobal) {
+        // The renderer may have placed the global in its own compact
+        // struct, found at the userdata base pointer.
+        if (auto symloc = group().find_symloc(sym.name(),
+                                              SymArena::ShaderGlobals)) {
+            if (equivalent(symloc->type, sym.typespec().simpletype())
+                && (symloc->derivs || !sym.has_derivs()))
+                return ll.ptr_to_cast(symloc_ptr(symloc,
+                                                 m_llvm_userdata_base_ptr),
+                                      llvm_type(sym.typespec().elementtype()));
+            shadingcontext()->errorfmt(
+                "Placement of global '{}' as {}{} does not fit its use in group {}",
+                sym.name(), symloc->type, symloc->derivs ? " with derivs" : "",
+                group().name());
+        }
         llvm::Value* result = llvm_global_symbol_ptr(sym.name());
         OSL_ASSERT(result);
         result = ll.ptr_to_cast(result,
@@ -371,7 +478,9 @@ BackendLLVM::llvm_get_pointer(const Symbol& sym, int deriv,
     }
 
     llvm::Value* result = NULL;
-    if (sym.symtype() == SymTypeConst) {
+    auto shared         = m_shared_constant_params.find(&sym);
+    if (sym.symtype() == SymTypeConst
+        || shared != m_shared_constant_params.end()) {
         TypeSpec elemtype = sym.typespec().elementtype();
 #if OSL_USE_OPTIX
         if (use_optix()) {
@@ -389,8 +498,11 @@ BackendLLVM::llvm_get_pointer(const Symbol& sym, int deriv,
         {
             // For constants on the CPU side, start with *OUR* pointer to the
             // constant values.
-            result = ll.constant_ptr(sym.data(),
-                                     ll.type_ptr(llvm_type(elemtype)));
+            void* data = shared != m_shared_constant_params.end()
+                             ? shared->second
+                             : sym.data();
+            result     = ll.constant_ptr(data,
+                                         ll.type_ptr(llvm_type(elemtype)));
         }
     } else {
         // If the symbol is not a SymTypeConst, then start with the initial
@@ -665,6 +777,47 @@ BackendLLVM::llvm_store_value(llvm::Value* new_val, llvm::Value* dst_ptr,
 
 
 
+llvm::Value*
+BackendLLVM::llvm_load_triple_vector(const Symbol& sym, int deriv)
+{
+    OSL_DASSERT(!sym.typespec().is_array()
+                && !sym.typespec().is_closure_based());
+    if (sym.typespec().is_triple() && !sym.is_constant()
+        && (deriv == 0 || sym.has_derivs())) {
+        llvm::Value* ptr = llvm_get_pointer(sym, deriv);
+        return ptr ? ll.op_load_triple_vector(ptr) : NULL;
+    }
+
+    // Constants, floats, ints, and missing derivs: from the components
+    llvm::Value* x = llvm_load_value(sym, deriv, 0, TypeDesc::TypeFloat);
+    llvm::Value* y = llvm_load_value(sym, deriv, 1, TypeDesc::TypeFloat);
+    llvm::Value* z = llvm_load_value(sym, deriv, 2, TypeDesc::TypeFloat);
+    if (!x || !y || !z)
+        return NULL;  // Error
+    return ll.op_triple_vector(x, y, z);
+}
+
+
+
+bool
+BackendLLVM::llvm_store_triple_vector(llvm::Value* new_val, const Symbol& sym,
+                                      int deriv)
+{
+    OSL_DASSERT(sym.typespec().is_triple());
+    if (!sym.has_derivs() && deriv != 0) {
+        // Attempt to store deriv in symbol that doesn't have it is just a nop
+        return true;
+    }
+
+    llvm::Value* ptr = llvm_get_pointer(sym, deriv);
+    if (!ptr)
+        return false;  // Error
+    ll.op_store_triple_vector(new_val, ptr);
+    return true;
+}
+
+
+
 bool
 BackendLLVM::llvm_store_component_value(llvm::Value* new_val, const Symbol& sym,
                                         int deriv, llvm::Value* component)
@@ -696,6 +849,25 @@ BackendLLVM::llvm_store_component_value(llvm::Value* new_val, const Symbol& sym,
 llvm::Value*
 BackendLLVM::groupdata_field_ref(int fieldnum)
 {
+    if (m_llvm_groupdata_offsets) {
+        // A shared layer body: the field is at the offset that's in the
+        // caller's table, in the slot given to this field at first use.
+        auto found = std::find(m_relocated_fields.begin(),
+                               m_relocated_fields.end(), fieldnum);
+        int slot   = int(found - m_relocated_fields.begin());
+        if (found == m_relocated_fields.end())
+            m_relocated_fields.push_back(fieldnum);
+        llvm::Value* offset = ll.op_load(ll.type_int(),
+                                         ll.GEP(ll.type_int(),
+                                                m_llvm_groupdata_offsets,
+                                                slot));
+        llvm::Value* ref    = ll.GEP(ll.type_int8(), groupdata_void_ptr(),
+                                     ll.op_int_to_longlong(offset));
+        llvm::Type* fieldtype = static_cast<llvm::StructType*>(
+                                    m_llvm_type_groupdata)
+                                    ->getElementType(fieldnum);
+        return ll.ptr_to_cast(ref, fieldtype);
+    }
     return ll.GEP(groupdata_ptr(), 0, fieldnum,
                   llnamefmt("{}_ref", m_groupdata_field_names[fieldnum]));
 }
@@ -717,9 +889,29 @@ BackendLLVM::groupdata_field_ptr(int fieldnum, TypeDesc type)
 llvm::Value*
 BackendLLVM::layer_run_ref(int layer)
 {
-    int fieldnum           = 0;  // field 0 is the layer_run array
+    int fieldnum           = 0;  // field 0 is the layer_run bitmap
     llvm::Value* layer_run = groupdata_field_ref(fieldnum);
-    return ll.GEP(layer_run, 0, layer);
+    return ll.GEP(layer_run, 0, layer / 32);
+}
+
+
+
+llvm::Value*
+BackendLLVM::llvm_layer_has_run(int layer)
+{
+    llvm::Value* bit = ll.constant(int(1u << (layer % 32)));
+    return ll.op_ne(ll.op_and(ll.op_load(layer_run_ref(layer)), bit),
+                    ll.constant(0));
+}
+
+
+
+void
+BackendLLVM::llvm_mark_layer_run(int layer)
+{
+    llvm::Value* wordptr = layer_run_ref(layer);
+    llvm::Value* bit     = ll.constant(int(1u << (layer % 32)));
+    ll.op_store(ll.op_or(ll.op_load(wordptr), bit), wordptr);
 }
 
 
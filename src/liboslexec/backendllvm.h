@@ -41,6 +41,29 @@ public:
     /// and store the llvm::Function* handle to it with the ShaderGroup.
     virtual void run();
 
+    /// For tiered JIT: compile quickly with only cheap IR optimization and
+    /// no machine code optimization, for a group that will be re-JITed
+    /// at full optimization later.
+    void tier0(bool fast)
+    {
+        m_llvm_optimize = fast ? 11 : shadingsys().llvm_optimize();
+        ll.jit_fast(fast);
+    }
+
+    /// For profile-guided tiered JIT: make the generated code count how
+    /// often each layer runs. (When not instrumenting, any layer profile
+    /// the group already has is used to guide optimization.)
+    void profile_layers(bool instrument) { m_profile_layers = instrument; }
+
+    /// Fraction of the group's executions that ran the layer, according
+    /// to its profile, or -1 if there is no usable profile.
+    float layer_profile(int layer) const;
+
+    /// The shadeop library compiled once for the whole process (for the
+    /// current JIT target and options), as a map from function name to
+    /// its code, or nullptr if it couldn't be built.
+    const std::unordered_map<std::string, void*>* shared_shadeops();
+
 
     /// What LLVM debug level are we at?
     int llvm_debug() const;
@@ -55,6 +78,17 @@ public:
     /// This will end up being the group entry if 'groupentry' is true.
     llvm::Function* build_llvm_instance(bool groupentry);
 
+    /// With jit_share_layers, may the current layer's code (all but its
+    /// bookkeeping of having run) be compiled as a body that doesn't
+    /// depend on this group, to be called by other groups' layers?
+    bool layer_shareable(bool groupentry);
+
+    /// Return the function to call for the layer body just built: the
+    /// body itself, an identical one built earlier for this module (and
+    /// the new one is deleted), or (with the body deleted) a declaration
+    /// of a JITed one of another group.
+    llvm::Function* share_layer_body(llvm::Function* body);
+
     /// Create an llvm function for group initialization code.
     llvm::Function* build_llvm_init();
 
@@ -204,6 +238,19 @@ public:
         return llvm_store_value(new_val, sym, deriv, component);
     }
 
+    /// Load the value (deriv 0) or a derivative of a float-based symbol as
+    /// one <3 x float>: a triple in memory with a single vector load, and
+    /// a float (or int, converted) in all three elements.  Derivatives the
+    /// symbol doesn't have load as 0.  Used by the "llvm_vector_triples"
+    /// option.
+    llvm::Value* llvm_load_triple_vector(const Symbol& sym, int deriv = 0);
+
+    /// Store a <3 x float> as the value or a derivative of the triple
+    /// sym.  As with llvm_store_value, a derivative that sym doesn't have
+    /// is a nop.
+    bool llvm_store_triple_vector(llvm::Value* new_val, const Symbol& sym,
+                                  int deriv = 0);
+
     /// Generate an alloca instruction to allocate space for the given
     /// type, with derivs if derivs==true, and return the its pointer.
     llvm::Value* llvm_alloca(const TypeSpec& type, bool derivs,
@@ -301,6 +348,17 @@ public:
     /// data that holds all the shader params.
     llvm::Type* llvm_type_groupdata();
 
+    /// Find the array connections whose downstream param can share the
+    /// group data of the upstream output rather than be copied into, and
+    /// record them in m_connection_alias.
+    void find_connection_aliases();
+
+    /// Find the large array params whose values are constant for the
+    /// group, and put them in the group's constants (shared by all the
+    /// contexts, and read in place) rather than in the group data,
+    /// recording them in m_shared_constant_params.
+    void find_shared_constant_params();
+
     /// Return the LLVM type handle for a pointer to the common group
     /// data that holds all the shader params.
     llvm::Type* llvm_type_groupdata_ptr();
@@ -361,10 +419,21 @@ public:
         return ll.offset_ptr(base_ptr, fulloffset);
     }
 
-    /// Return a ref to the bool where the "layer_run" flag is stored for
-    /// the specified layer.
+    /// The "layer_run" flags are a bitmap, one bit per used layer, packed
+    /// into this many 32 bit words at the start of the group data.
+    int layer_run_words() const { return (m_num_used_layers + 31) / 32; }
+
+    /// Return a ref to the 32 bit word of the "layer_run" bitmap that holds
+    /// the flag for the specified layer.
     llvm::Value* layer_run_ref(int layer);
 
+    /// Generate code that returns a bool: has the specified (remapped)
+    /// layer already run?
+    llvm::Value* llvm_layer_has_run(int layer);
+
+    /// Generate code to mark the specified (remapped) layer as having run.
+    void llvm_mark_layer_run(int layer);
+
     /// Return a ref to the bool where the "userdata_initialized" flag is
     /// stored for the specified userdata index.
     llvm::Value* userdata_initialized_ref(int userdata_index = 0);
@@ -391,11 +460,35 @@ public:
     /// Generate an error message at shader execution time.
     void llvm_gen_error(string_view message);
 
+    /// Instrumented profiling ("profile_instrument"): probes that read
+    /// the profile clock and charge the ticks since the previous probe to
+    /// the site (layer or source line) that was running.  Begin and end
+    /// bracket the layer function; llvm_profile_op starts the site of an
+    /// op's source line (at level 2); time spent calling upstream layers
+    /// is charged to those layers instead.
+    void llvm_profile_begin();
+    void llvm_profile_op(const Opcode& op);
+    void llvm_profile_end();
+    bool llvm_profiling() const { return m_llvm_profile_site != nullptr; }
+
     /// Generate code to call the given layer.  If 'unconditional' is
     /// true, call it without even testing if the layer has already been
     /// called.
     void llvm_call_layer(int layer, bool unconditional = false);
 
+    /// Note that ops [begin, end) of the current layer, a run of
+    /// getattribute, were all made by the first of them as one call.
+    void getattribute_batch(int begin, int end)
+    {
+        m_getattribute_batch = { begin, end };
+    }
+    /// Was op opnum already made as part of an earlier op's batch?
+    bool in_getattribute_batch(int opnum) const
+    {
+        return opnum > m_getattribute_batch.first
+               && opnum < m_getattribute_batch.second;
+    }
+
     /// Execute the upstream connection (if any, and if not yet run) that
     /// establishes the value of symbol sym, which has index 'symindex'
     /// within the current layer rop.inst().  If already_run is not NULL,
@@ -488,6 +581,13 @@ public:
     /// Print debugging line for the op
     void llvm_generate_debug_op_printf(const Opcode& op);
 
+    /// With "debug_sample" over 1, begin code that only the shades picked
+    /// for debug checks run, returning the block that llvm_end_debug_check
+    /// resumes in; nullptr if every shade runs the checks.
+    llvm::BasicBlock* llvm_begin_debug_check();
+    /// End the code begun by llvm_begin_debug_check.
+    void llvm_end_debug_check(llvm::BasicBlock* after);
+
     llvm::Function* layer_func() const
     {
         return ll.current_function();
@@ -547,6 +647,26 @@ private:
     std::vector<int> m_layer_remap;      ///< Remapping of layer ordering
     std::set<int> m_layers_already_run;  ///< List of layers run
     int m_num_used_layers;               ///< Number of layers actually used
+    int m_llvm_optimize;                 ///< LLVM optimization level to use
+    bool m_profile_layers = false;       ///< Instrument layer execution?
+    std::pair<int, int> m_getattribute_batch { -1, -1 };  ///< Ops made as one
+
+    // Layer bodies shared between groups (see jit_share_layers). While a
+    // body is built, its groupdata fields are found at the offsets given
+    // by m_llvm_groupdata_offsets, in the order of m_relocated_fields.
+    bool m_share_layers = false;
+    llvm::Value* m_llvm_groupdata_offsets = nullptr;
+    std::vector<int> m_relocated_fields;
+    std::map<std::string, llvm::Function*> m_layer_bodies;  ///< By key
+    std::vector<std::pair<std::string, llvm::Function*>> m_new_layer_bodies;
+    std::vector<std::shared_ptr<void>> m_borrowed_layer_code;
+
+    // Instrumented profiling of the current layer function
+    llvm::Value* llvm_profile_clock();
+    void llvm_profile_charge(llvm::Value* now);
+    llvm::Value* m_llvm_profile_last = nullptr;  ///< Clock at the last probe
+    llvm::Value* m_llvm_profile_site = nullptr;  ///< Ticks counter charged
+    const ProfileSite* m_profile_site = nullptr;  ///< Site of the last probe
 
     double m_stat_total_llvm_time;  ///<   total time spent on LLVM
     double m_stat_llvm_setup_time;  ///<     llvm setup time
@@ -557,11 +677,16 @@ private:
     // LLVM stuff
     AllocationMap m_named_values;
     std::map<const Symbol*, int> m_param_order_map;
+    /// Downstream params that live in the upstream output they connect to
+    std::map<const Symbol*, const Symbol*> m_connection_alias;
+    /// Params read straight from the group's constants
+    std::map<const Symbol*, void*> m_shared_constant_params;
     llvm::Value* m_llvm_shaderglobals_ptr;
     llvm::Value* m_llvm_groupdata_ptr;
     llvm::Value* m_llvm_userdata_base_ptr;
     llvm::Value* m_llvm_output_base_ptr;
     llvm::Value* m_llvm_shadeindex;
+    llvm::Value* m_llvm_debug_sampled = nullptr;  // Run this shade's checks?
     llvm::BasicBlock* m_exit_instance_block;  // exit point for the instance
     llvm::Type* m_llvm_type_sg;         // LLVM type of ShaderGlobals struct
     llvm::Type* m_llvm_type_groupdata;  // LLVM type of group data
@@ -40,6 +40,7 @@ static ustring op_compl("compl");
 static ustring op_concat("concat");
 static ustring op_continue("continue");
 static ustring op_endswith("endswith");
+static ustring op_environment("environment");
 static ustring op_eq("eq");
 static ustring op_functioncall("functioncall");
 static ustring op_functioncall_nr("functioncall_nr");
@@ -121,6 +122,81 @@ are_op_results_always_implicitly_varying(ustring opname)
 }
 
 
+// Ops expensive enough (a renderer callback, a texture lookup, a closure
+// allocation) that running them for a sparse batch wastes most of the
+// work, making them good points at which to compact lanes.
+bool
+is_op_worth_compacting_for(const Opcode& opcode)
+{
+    ustring opname = opcode.opname();
+    // analysis_flag marks getattribute calls proven to be uniform, which
+    // execute once per batch regardless of how many lanes are active.
+    return (opname == Strings::op_trace) | (opname == Strings::op_texture)
+           | (opname == Strings::op_texture3d)
+           | (opname == Strings::op_environment)
+           | (opname == Strings::op_pointcloud_search)
+           | (opname == Strings::op_pointcloud_get)
+           | (opname == Strings::op_closure)
+           | ((opname == Strings::op_getattribute) && !opcode.analysis_flag());
+}
+
+
+
+// Ops that do work of their own, as opposed to the control flow ops that
+// only delimit the blocks beneath them.
+bool
+is_op_not_control_flow(const Opcode& opcode)
+{
+    return opcode.jump(0) < 0;
+}
+
+
+
+// Count the ops between begin and end that satisfy counts_op and
+// execute under varying control flow (varying_depth > 0 on entry, or
+// nested in a conditional or loop with a varying condition).
+int
+count_ops_under_varying_control_flow(ShaderInstance& inst, int begin,
+                                     int end, int varying_depth,
+                                     bool (*counts_op)(const Opcode&))
+{
+    int count = 0;
+    for (int op_index = begin; op_index < end; ++op_index) {
+        const Opcode& opcode = inst.ops()[op_index];
+        if (varying_depth && counts_op(opcode))
+            ++count;
+        if (opcode.jump(0) < 0)
+            continue;
+        ustring opname = opcode.opname();
+        if (opname == Strings::op_if) {
+            const Symbol* cond = inst.argsymbol(opcode.firstarg());
+            int depth          = varying_depth + !cond->is_uniform();
+            count += count_ops_under_varying_control_flow(
+                inst, op_index + 1, opcode.jump(0), depth, counts_op);
+            count += count_ops_under_varying_control_flow(
+                inst, opcode.jump(0), opcode.jump(1), depth, counts_op);
+            op_index = opcode.jump(1) - 1;
+        } else if ((opname == Strings::op_for) || (opname == Strings::op_while)
+                   || (opname == Strings::op_dowhile)) {
+            const Symbol* cond = inst.argsymbol(opcode.firstarg());
+            int depth          = varying_depth + !cond->is_uniform();
+            count += count_ops_under_varying_control_flow(
+                inst, op_index + 1, opcode.jump(0), varying_depth, counts_op);
+            count += count_ops_under_varying_control_flow(
+                inst, opcode.jump(0), opcode.jump(3), depth, counts_op);
+            op_index = opcode.jump(3) - 1;
+        } else if ((opname == Strings::op_functioncall)
+                   || (opname == Strings::op_functioncall_nr)) {
+            count += count_ops_under_varying_control_flow(
+                inst, op_index + 1, opcode.jump(0), varying_depth, counts_op);
+            op_index = opcode.jump(0) - 1;
+        }
+    }
+    return count;
+}
+
+
+
 // Even when all inputs to an operation are varying,
 // the results written to output symbols maybe uniform.
 bool
@@ -1712,10 +1788,16 @@ struct Analyzer {
                     // specific BatchedRendererServices.
                     // Right here we don't know which width will be used,
                     // so we will just require all widths provide the same answer
+                    auto rs4  = m_ba.renderer()->batched(WidthOf<4>());
                     auto rs8  = m_ba.renderer()->batched(WidthOf<8>());
                     auto rs16 = m_ba.renderer()->batched(WidthOf<16>());
-                    if (rs8 || rs16) {
+                    if (rs4 || rs8 || rs16) {
                         get_attr_is_uniform = true;
+                        if (rs4) {
+                            get_attr_is_uniform
+                                &= rs4->is_attribute_uniform(obj_name,
+                                                             attr_name);
+                        }
                         if (rs8) {
                             get_attr_is_uniform
                                 &= rs8->is_attribute_uniform(obj_name,
@@ -2411,6 +2493,18 @@ BatchedAnalysis::analyze_layer(ShaderInstance* inst)
     analyzer.push_varying_of_implicitly_varying_ops();
 
     analyzer.process_deferred_masking();
+
+    if (shadingsys().opt_batched_compaction())
+        find_compaction_points(inst);
+
+    // Cheap enough to always gather, for the "preferred_execution" query
+    inst->batched_op_counts(
+        count_ops_under_varying_control_flow(*inst, inst->maincodebegin(),
+                                             inst->maincodeend(), 1,
+                                             is_op_not_control_flow),
+        count_ops_under_varying_control_flow(*inst, inst->maincodebegin(),
+                                             inst->maincodeend(), 0,
+                                             is_op_not_control_flow));
 #ifdef OSL_DEV
     dump_symbol_uniformity(inst);
     dump_layer(inst);
@@ -2419,6 +2513,23 @@ BatchedAnalysis::analyze_layer(ShaderInstance* inst)
 
 
 
+void
+BatchedAnalysis::find_compaction_points(ShaderInstance* inst)
+{
+    // Only meaningful once uniformity of the layer's symbols is settled
+    int points = count_ops_under_varying_control_flow(
+        *inst, inst->maincodebegin(), inst->maincodeend(), 0,
+        is_op_worth_compacting_for);
+    inst->batched_compaction_points(points);
+    shadingsys().m_stat_batched_compaction_points += points;
+    if (points && shadingsys().debug() > 1)
+        shadingsys().infofmt(
+            "Batched layer {} has {} costly ops under varying control flow",
+            inst->layername(), points);
+}
+
+
+
 void
 BatchedAnalysis::dump_symbol_uniformity(ShaderInstance* inst)
 {
@@ -23,6 +23,10 @@ public:
 
     void analyze_layer(ShaderInstance* inst);
 
+    /// Record on inst how many expensive ops run under varying control
+    /// flow, i.e. likely with a sparse mask (see opt_batched_compaction).
+    void find_compaction_points(ShaderInstance* inst);
+
     void dump_layer(ShaderInstance* inst);
     void dump_symbol_uniformity(ShaderInstance* inst);
 
@@ -67,6 +67,14 @@ public:
     /// Create an llvm function for group initialization code.
     llvm::Function* build_llvm_init();
 
+    /// Choose the varying symbols of the used layers whose runtime
+    /// uniformity is to be counted, and set up the group's counters.
+    void setup_uniformity_profile();
+
+    /// Emit code counting, for each profiled symbol of the current layer,
+    /// whether its value agrees across all lanes of mask.
+    void llvm_profile_uniformity(llvm::Value* mask);
+
     /// Build up LLVM IR code for the given range [begin,end) or
     /// opcodes, putting them (initially) into basic block bb (or the
     /// current basic block if bb==NULL).
@@ -771,6 +779,8 @@ private:
     std::vector<int> m_layer_remap;      ///< Remapping of layer ordering
     std::set<int> m_layers_already_run;  ///< List of layers run
     int m_num_used_layers;               ///< Number of layers actually used
+    std::unordered_map<const Symbol*, int>
+        m_uniformity_profile_index;  ///< Profiled sym -> group counter pair
 
     double m_stat_total_llvm_time;  ///<   total time spent on LLVM
     double m_stat_llvm_setup_time;  ///<     llvm setup time
@@ -4893,7 +4893,6 @@ LLVMGEN(llvm_gen_texture)
     llvm::Value* args[17];
     args[0] = rop.sg_void_ptr();
 
-    const char* texFuncName = rop.build_name(FuncSpec("texture").mask());
     RendererServices::TextureHandle* texture_handle = NULL;
     if (Filename.is_constant() && rop.shadingsys().opt_texture_handle()) {
         OSL_ASSERT(Filename.is_uniform());
@@ -4912,6 +4911,21 @@ LLVMGEN(llvm_gen_texture)
 
     args[2] = rop.ll.constant_ptr(texture_handle);
     rop.generated_texture_call(texture_handle != NULL);
+    if (texture_handle && S.is_uniform() && T.is_uniform()
+        && rop.renderer()->is_udim(texture_handle)) {
+        // Every lane is in the same tile of a constant udim texture, so
+        // find it once through the group's table of tiles.  (Varying
+        // coordinates are left for the renderer to resolve lane by lane.)
+        UdimTileTable* table       = rop.group().udim_table(texture_handle);
+        llvm::Value* resolve_args[] = { rop.sg_void_ptr(), filenameVal,
+                                        rop.ll.constant_ptr(table),
+                                        rop.llvm_load_value(S),
+                                        rop.llvm_load_value(T) };
+        args[2] = rop.ll.call_function(
+            rop.build_name(FuncSpec("resolve_udim_table")), resolve_args);
+    }
+    // NOTE: named after any other build_name() call, whose buffer it shares.
+    const char* texFuncName = rop.build_name(FuncSpec("texture").mask());
 
     // check S & T are not uniform
 
@@ -5798,6 +5812,10 @@ llvm_batched_noise_options(BatchedBackendLLVM& rop, int opnum,
             rop.ll.call_function("osl_noiseparams_set_impulses", opt,
                                  rop.llvm_load_value(Val, 0, NULL, 0,
                                                      TypeDesc::TypeFloat));
+        } else if (name == Strings::fast && Val.typespec().is_int()) {
+            // The batched gabor noise has no fast mode, it already
+            // evaluates the lanes in SIMD with the full kernels.
+            continue;
         } else {
             rop.shadingcontext()->errorfmt(
                 "Unknown {} optional argument: \"{}\", <{}> ({}:{})",
@@ -5907,6 +5925,9 @@ llvm_batched_noise_varying_options(BatchedBackendLLVM& rop, int opnum,
             // with the uniform noise options, there is no need to
             // do any binning for the varying direction.
             continue;
+        } else if (name == Strings::fast && Val.typespec().is_int()) {
+            // Ignored by the batched gabor noise, see above
+            continue;
         } else {
             rop.shadingcontext()->errorfmt(
                 "Unknown {} optional argument: \"{}\", <{}> ({}:{})",
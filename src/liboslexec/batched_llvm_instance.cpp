@@ -526,6 +526,33 @@ const char*
     = "b8_AVX_";
 #endif
 
+#ifdef __OSL_SUPPORTS_b4_SSE4_2
+template<>
+const NameAndSignature
+    ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>::library_functions[]
+    = {
+#    define DECL_INDIRECT(name, signature) \
+        NameAndSignature { #name, signature },
+#    define DECL(name, signature) DECL_INDIRECT(name, signature)
+#    define __OSL_WIDTH           4
+#    define __OSL_TARGET_ISA      SSE4_2
+// Don't allow order of xmacro includes be rearranged
+// clang-format off
+#    include "wide/define_opname_macros.h"
+#    include "builtindecl_wide_xmacro.h"
+#    include "wide/undef_opname_macros.h"
+// clang-format on
+#    undef __OSL_TARGET_ISA
+#    undef __OSL_WIDTH
+#    undef DECL
+#    undef DECL_INDIRECT
+      };
+template<>
+const char*
+    ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>::library_selector_string
+    = "b4_SSE4_2_";
+#endif
+
 
 
 std::unique_ptr<BatchedBackendLLVM::TargetLibraryHelper>
@@ -577,6 +604,16 @@ BatchedBackendLLVM::TargetLibraryHelper::build(ShadingContext* context,
         case TargetISA::AVX:
             return RetType(
                 new ConcreteTargetLibraryHelper<8, TargetISA::AVX>());
+#endif
+        default: break;
+        }
+        break;
+    case 4:
+        switch (target_isa) {
+#ifdef __OSL_SUPPORTS_b4_SSE4_2
+        case TargetISA::SSE4_2:
+            return RetType(
+                new ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>());
 #endif
         default: break;
         }
@@ -726,6 +763,9 @@ BatchedBackendLLVM::llvm_type_batched_texture_options()
     {
         std::vector<unsigned int> offset_by_index;
         switch (m_width) {
+        case 4:
+            build_offsets_of_BatchedTextureOptions<4>(offset_by_index);
+            break;
         case 8:
             build_offsets_of_BatchedTextureOptions<8>(offset_by_index);
             break;
@@ -849,6 +889,10 @@ BatchedBackendLLVM::llvm_type_groupdata()
             // TODO: why do we always make deriv room? Do we not know
             int n         = type.numelements() * 3;  // always make deriv room
             type.arraylen = n;
+            // Placed userdata is gathered straight from the renderer's data
+            // into the params, so keep just a placeholder for the field.
+            if (group().userdata_placed(i))
+                type = TypeDesc::TypeInt;
             fields.push_back(llvm_wide_type(type));
             // Alignment
             int align = type.basesize() * m_width;
@@ -871,47 +915,45 @@ BatchedBackendLLVM::llvm_type_groupdata()
 
     // For each layer in the group, add entries for all params that are
     // connected or interpolated, and output params.  Also mark those
-    // symbols with their offset within the group struct.
+    // symbols with their offset within the group struct. They're placed
+    // hottest first and packed by alignment, not in layer order.
     m_param_order_map.clear();
-    for (int layer = 0; layer < group().nlayers(); ++layer) {
+    // TODO:  Does anything bad happen from not skipping unused layers?
+    // We wanted space for default parameters to still be
+    // part of group data so we have a place to create a wide version
+    // So we choose to always have a run function for a layer
+    // just to broadcast out the scalar default value.
+    // TODO: Optimize to only run unused layers once, shouldn't
+    // need to be run again as nothing should overwrite the values.
+    for (auto& param : group().groupdata_param_order(false)) {
+        int layer            = param.first;
         ShaderInstance* inst = group()[layer];
-        // TODO:  Does anything bad happen from not skipping unused layers?
-        // We wanted space for default parameters to still be
-        // part of group data so we have a place to create a wide version
-        // So we choose to always have a run function for a layer
-        // just to broadcast out the scalar default value.
-        // TODO: Optimize to only run unused layers once, shouldn't
-        // need to be run again as nothing should overwrite the values.
-        FOREACH_PARAM(Symbol & sym, inst)
-        {
-            TypeSpec ts = sym.typespec();
-            if (ts.is_structure())  // skip the struct symbol itself
-                continue;
-            const int arraylen  = std::max(1, sym.typespec().arraylength());
-            const int derivSize = (sym.has_derivs() ? 3 : 1);
-            ts.make_array(arraylen * derivSize);
-            fields.push_back(llvm_wide_type(ts));
-
-            // Alignment
-            // TODO:  this isn't quite right, can't rely on batch size to == ISA SIMD requirements
-            size_t base_size = sym.typespec().is_closure_based()
-                                   ? sizeof(void*)
-                                   : sym.typespec().simpletype().basesize();
-            size_t align     = base_size * m_width;
-            if (offset & (align - 1))
-                offset += align - (offset & (align - 1));
-            if (llvm_debug() >= 2)
-                std::cout << "  " << inst->layername() << " (" << inst->id()
-                          << ") " << sym.mangled() << " " << ts.c_str()
-                          << ", field " << order << ", size "
-                          << derivSize * int(sym.size()) << ", offset "
-                          << offset << std::endl;
-            sym.wide_dataoffset((int)offset);
-            offset += derivSize * int(sym.size()) * m_width;
-
-            m_param_order_map[&sym] = order;
-            ++order;
-        }
+        Symbol& sym(*param.second);
+        TypeSpec ts         = sym.typespec();
+        const int arraylen  = std::max(1, sym.typespec().arraylength());
+        const int derivSize = (sym.has_derivs() ? 3 : 1);
+        ts.make_array(arraylen * derivSize);
+        fields.push_back(llvm_wide_type(ts));
+
+        // Alignment
+        // TODO:  this isn't quite right, can't rely on batch size to == ISA SIMD requirements
+        size_t base_size = sym.typespec().is_closure_based()
+                               ? sizeof(void*)
+                               : sym.typespec().simpletype().basesize();
+        size_t align     = base_size * m_width;
+        if (offset & (align - 1))
+            offset += align - (offset & (align - 1));
+        if (llvm_debug() >= 2)
+            std::cout << "  " << inst->layername() << " (" << inst->id()
+                      << ") " << sym.mangled() << " " << ts.c_str()
+                      << ", field " << order << ", size "
+                      << derivSize * int(sym.size()) << ", offset "
+                      << offset << std::endl;
+        sym.wide_dataoffset((int)offset);
+        offset += derivSize * int(sym.size()) * m_width;
+
+        m_param_order_map[&sym] = order;
+        ++order;
     }
     group().llvm_groupdata_wide_size(offset);
     if (llvm_debug() >= 2)
@@ -1857,6 +1899,83 @@ BatchedBackendLLVM::build_llvm_init()
 
 
 
+void
+BatchedBackendLLVM::setup_uniformity_profile()
+{
+    // Only symbols the analysis left varying are interesting, and only
+    // named ones: temps are many and can't be mapped back to the source.
+    // Arrays, closures and structs are skipped to keep the check cheap.
+    m_uniformity_profile_index.clear();
+    std::vector<ustring> names;
+    for (int layer = 0, nlayers = group().nlayers(); layer < nlayers;
+         ++layer) {
+        if (m_layer_remap[layer] < 0)
+            continue;
+        ShaderInstance* inst = group()[layer];
+        for (const Symbol& s : inst->symbols()) {
+            SymType st = s.symtype();
+            if (st != SymTypeParam && st != SymTypeOutputParam
+                && st != SymTypeLocal)
+                continue;
+            const TypeSpec& t(s.typespec());
+            if (!s.everused() || s.is_uniform() || s.forced_llvm_bool()
+                || t.is_array() || t.is_closure_based()
+                || t.is_structure_based()
+                || !(t.is_int() || t.is_float() || t.is_triple()
+                     || t.is_string()))
+                continue;
+            m_uniformity_profile_index[&s] = int(names.size());
+            names.push_back(
+                ustring::fmtformat("{}.{}", inst->layername(), s.name()));
+        }
+    }
+    group().m_batched_uniformity_counts.reset(
+        new atomic_ll[2 * names.size()]);
+    for (size_t i = 0; i < 2 * names.size(); ++i)
+        group().m_batched_uniformity_counts[i] = 0;
+    group().m_batched_uniformity_syms = std::move(names);
+}
+
+
+
+void
+BatchedBackendLLVM::llvm_profile_uniformity(llvm::Value* mask)
+{
+    // The first active lane is the reference value; with an empty mask
+    // there is nothing to sample and lane 0 is as good as any.
+    llvm::Value* mask_bits = ll.mask_as_int(mask);
+    llvm::Value* any_on    = ll.test_if_mask_is_non_zero(mask);
+    llvm::Value* lane      = ll.op_1st_active_lane_of(
+        ll.op_select(any_on, mask, ll.wide_constant_bool(true)));
+    llvm::Value* sampled   = ll.op_int_to_longlong(ll.op_bool_to_int(any_on));
+    for (const Symbol& s : inst()->symbols()) {
+        auto found = m_uniformity_profile_index.find(&s);
+        if (found == m_uniformity_profile_index.end())
+            continue;
+        llvm::Value* is_uniform = nullptr;
+        int ncomps              = s.typespec().is_triple() ? 3 : 1;
+        for (int c = 0; c < ncomps; ++c) {
+            llvm::Value* wide = llvm_load_value(s, 0, nullptr, c,
+                                                TypeDesc::UNKNOWN,
+                                                /*op_is_uniform*/ false);
+            llvm::Value* matches
+                = ll.op_lanes_that_match_masked(ll.op_extract(wide, lane),
+                                                wide, mask);
+            llvm::Value* same = ll.op_eq(ll.mask_as_int(matches), mask_bits);
+            is_uniform = is_uniform ? ll.op_and(is_uniform, same) : same;
+        }
+        is_uniform = ll.op_and(is_uniform, any_on);
+        atomic_ll* counts
+            = &group().m_batched_uniformity_counts[2 * found->second];
+        ll.op_atomic_add(ll.constant_ptr(&counts[0], ll.type_longlong_ptr()),
+                         sampled);
+        ll.op_atomic_add(ll.constant_ptr(&counts[1], ll.type_longlong_ptr()),
+                         ll.op_int_to_longlong(ll.op_bool_to_int(is_uniform)));
+    }
+}
+
+
+
 llvm::Function*
 BatchedBackendLLVM::build_llvm_instance(bool groupentry)
 {
@@ -2226,18 +2345,34 @@ BatchedBackendLLVM::build_llvm_instance(bool groupentry)
             //     s.typespec(), s.name(), symloc->type);
             continue;  // types didn't match
         }
+        if (symloc->converts() && !stores_converted(*symloc))
+            continue;  // can't store it as the type it wants
         auto type = s.typespec().simpletype();
 
         //const int deriv_count = (symloc->derivs && s.has_derivs()) ? 3 : 1;
         const int output_deriv_count = symloc->derivs ? 3 : 1;
         const int s_deriv_count      = s.has_derivs() ? 3 : 1;
 
+        // A converted output is stored as the half bits or 8 bit ints of
+        // op_float_to_storage
+        TypeDesc::BASETYPE storage(
+            TypeDesc::BASETYPE(symloc->stored_type().basetype));
         llvm::Value* sym_offset = ll.constanti64(symloc->offset);
         llvm::Value* output_sym_base_ptr
-            = ll.ptr_cast(ll.offset_ptr(m_llvm_output_base_ptr, sym_offset),
-                          type.scalartype());
-        bool isBase32bit = (symloc->type != TypeDesc::STRING);
-        int bytesPerElem = isBase32bit ? 4 : 8;
+            = ll.offset_ptr(m_llvm_output_base_ptr, sym_offset);
+        int bytesPerElem;
+        if (symloc->converts()) {
+            bool is_half        = (storage == TypeDesc::HALF);
+            output_sym_base_ptr = ll.ptr_to_cast(output_sym_base_ptr,
+                                                 is_half ? ll.type_int16()
+                                                         : ll.type_int8());
+            bytesPerElem        = is_half ? 2 : 1;
+        } else {
+            output_sym_base_ptr = ll.ptr_cast(output_sym_base_ptr,
+                                              type.scalartype());
+            bool isBase32bit    = (symloc->type != TypeDesc::STRING);
+            bytesPerElem        = isBase32bit ? 4 : 8;
+        }
         // TODO:  could move assert inside SymLocation
         OSL_ASSERT((symloc->stride % bytesPerElem) == 0);
 
@@ -2277,13 +2412,22 @@ BatchedBackendLLVM::build_llvm_instance(bool groupentry)
                         wide_index = ll.op_add(wide_index_to_output,
                                                ll.wide_constant(c));
                     }
-                    ll.op_scatter(wide_val, output_sym_base_ptr, wide_index);
+                    if (symloc->converts())
+                        ll.op_scatter_narrow(ll.op_float_to_storage(wide_val,
+                                                                    storage),
+                                             output_sym_base_ptr, wide_index);
+                    else
+                        ll.op_scatter(wide_val, output_sym_base_ptr,
+                                      wide_index);
                 }
             }
         }
     }
     ll.pop_mask();
 
+    if (!m_uniformity_profile_index.empty())
+        llvm_profile_uniformity(initial_shader_mask);
+
     // All done
     if (shadingsys().llvm_debug_layers())
         llvm_gen_debug_printf(fmtformat("exit layer {} {} {}", this->layer(),
@@ -2325,6 +2469,7 @@ BatchedBackendLLVM::initialize_llvm_group()
         ll.debug_setup_compilation_unit(compile_unit_name);
     }
 
+    ll.pass_pipeline(shadingsys().llvm_pass_pipeline());
     ll.setup_optimization_passes(shadingsys().llvm_optimize(),
                                  true /*targetHost*/);
 
@@ -2629,6 +2774,9 @@ BatchedBackendLLVM::run()
     }
     shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
 
+    if (shadingsys().batched_uniformity_profile())
+        setup_uniformity_profile();
+
     initialize_llvm_group();
 
     // Generate the LLVM IR for each layer.  Skip unused layers.
@@ -2646,6 +2794,9 @@ BatchedBackendLLVM::run()
     {
         std::vector<unsigned int> offset_by_index;
         switch (m_width) {
+        case 4:
+            build_offsets_of_BatchedShaderGlobals<4>(offset_by_index);
+            break;
         case 8:
             build_offsets_of_BatchedShaderGlobals<8>(offset_by_index);
             break;
@@ -2655,7 +2806,7 @@ BatchedBackendLLVM::run()
         default:
             OSL_ASSERT(
                 0
-                && "Unsupported width of batch.  Only widths 8 and 16 are allowed");
+                && "Unsupported width of batch.  Only widths 4, 8, and 16 are allowed");
             break;
         };
         ll.validate_struct_data_layout(m_llvm_type_sg, offset_by_index);
@@ -2727,7 +2878,9 @@ BatchedBackendLLVM::run()
     // Optimize the LLVM IR EVEN IF it's a do-nothing group.
     // We choose to always run a JIT function to allow scalar default values to be
     // broadcast out to GroupData, so do not skip running if a group().does_nothing()
+    shadingsys().m_stat_llvm_preopt_insts += ll.module_instruction_count();
     ll.do_optimize();
+    shadingsys().m_stat_llvm_postopt_insts += ll.module_instruction_count();
 
     m_stat_llvm_opt_time += timer.lap();
 
@@ -2784,6 +2937,7 @@ BatchedBackendLLVM::run()
     else
         group().llvm_compiled_wide_version(
             group().llvm_compiled_wide_layer(nlayers - 1));
+    group().add_jit_memory(ll.jit_memory());
 
     // We are destroying the entire module below, no reason to bother
     // destroying individual functions
@@ -302,9 +302,7 @@ BatchedRendererServices<WidthT>::trace(
     Wide<const Vec3> wP, Wide<const Vec3> wdPdx, Wide<const Vec3> wdPdy,
     Wide<const Vec3> wR, Wide<const Vec3> wdRdx, Wide<const Vec3> wdRdy)
 {
-    for (int lane = 0; lane < WidthT; ++lane) {
-        wresult[lane] = 0;
-    }
+    assign_all(wresult, 0);
 }
 
 
@@ -328,5 +326,6 @@ BatchedRendererServices<WidthT>::getmessage(BatchedShaderGlobals* bsg,
 // Explicitly instantiate BatchedRendererServices template
 template class OSLEXECPUBLIC BatchedRendererServices<16>;
 template class OSLEXECPUBLIC BatchedRendererServices<8>;
+template class OSLEXECPUBLIC BatchedRendererServices<4>;
 
 OSL_NAMESPACE_EXIT
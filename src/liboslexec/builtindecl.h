@@ -123,6 +123,7 @@ DECL(osl_error, "xXs*")
 DECL(osl_warning, "xXs*")
 DECL(osl_split, "isXsii")
 DECL(osl_incr_layers_executed, "xX")
+DECL(osl_profile_clock, "xX")
 
 NOISE_IMPL(cellnoise)
 //NOISE_DERIV_IMPL(cellnoise)
@@ -155,6 +156,7 @@ DECL(osl_noiseparams_set_do_filter, "xXi")
 DECL(osl_noiseparams_set_direction, "xXv")
 DECL(osl_noiseparams_set_bandwidth, "xXf")
 DECL(osl_noiseparams_set_impulses, "xXf")
+DECL(osl_noiseparams_set_fast, "xXi")
 DECL(osl_count_noise, "xX")
 DECL(osl_hash_ii, "ii")
 DECL(osl_hash_if, "if")
@@ -209,7 +211,10 @@ DECL(osl_range_check, "iiisXsisiss")
 DECL(osl_range_check_err, "iiisXsisiss")
 DECL(osl_naninf_check, "xiXiXsisiis")
 DECL(osl_uninit_check, "xLXXsisissisisii")
+DECL(osl_debug_sampled, "iX")
 DECL(osl_get_attribute, "iXissiiLX")
+DECL(osl_get_attributes, "xXXiX")
+DECL(osl_rs_get_attribute, "iXissiiLX")
 DECL(osl_bind_interpolated_param, "iXsLiXiXiXi")
 DECL(osl_get_texture_options, "XX");
 DECL(osl_get_noise_options, "XX");
@@ -261,6 +266,47 @@ UNARY_OP_IMPL(sqrt)
 UNARY_OP_IMPL(inversesqrt)
 UNARY_OP_IMPL(cbrt)
 
+// The precision the build didn't choose of the transcendentals above,
+// for the math_precision option (see llvm_ops.cpp).
+#    define TRANSCENDENTAL_OP_IMPL(prefix)         \
+        UNARY_OP_IMPL(prefix##sin)                 \
+        UNARY_OP_IMPL(prefix##cos)                 \
+        UNARY_OP_IMPL(prefix##tan)                 \
+        UNARY_OP_IMPL(prefix##asin)                \
+        UNARY_OP_IMPL(prefix##acos)                \
+        UNARY_OP_IMPL(prefix##atan)                \
+        BINARY_OP_IMPL(prefix##atan2)              \
+        UNARY_OP_IMPL(prefix##sinh)                \
+        UNARY_OP_IMPL(prefix##cosh)                \
+        UNARY_OP_IMPL(prefix##tanh)                \
+        DECL(osl_##prefix##sincos_fff, "xfXX")     \
+        DECL(osl_##prefix##sincos_dfdff, "xXXX")   \
+        DECL(osl_##prefix##sincos_dffdf, "xXXX")   \
+        DECL(osl_##prefix##sincos_dfdfdf, "xXXX")  \
+        DECL(osl_##prefix##sincos_vvv, "xXXX")     \
+        DECL(osl_##prefix##sincos_dvdvv, "xXXX")   \
+        DECL(osl_##prefix##sincos_dvvdv, "xXXX")   \
+        DECL(osl_##prefix##sincos_dvdvdv, "xXXX")  \
+        UNARY_OP_IMPL(prefix##log)                 \
+        UNARY_OP_IMPL(prefix##log2)                \
+        UNARY_OP_IMPL(prefix##log10)               \
+        UNARY_OP_IMPL(prefix##exp)                 \
+        UNARY_OP_IMPL(prefix##exp2)                \
+        UNARY_OP_IMPL(prefix##expm1)               \
+        UNARY_OP_IMPL(prefix##erf)                 \
+        UNARY_OP_IMPL(prefix##erfc)                \
+        BINARY_OP_IMPL(prefix##pow)                \
+        DECL(osl_##prefix##pow_vvf, "xXXf")        \
+        DECL(osl_##prefix##pow_dvdvdf, "xXXX")     \
+        DECL(osl_##prefix##pow_dvvdf, "xXXX")      \
+        DECL(osl_##prefix##pow_dvdvf, "xXXf")      \
+        UNARY_OP_IMPL(prefix##cbrt)
+#    if OSL_FAST_MATH
+TRANSCENDENTAL_OP_IMPL(exact_)
+#    else
+TRANSCENDENTAL_OP_IMPL(fast_)
+#    endif
+
 DECL(osl_logb_ff, "ff")
 DECL(osl_logb_vv, "xXX")
 
@@ -371,6 +417,7 @@ DECL(osl_texture_set_subimage, "xXi")
 DECL(osl_texture_set_subimagename, "xXs")
 DECL(osl_texture_set_missingcolor_arena, "xXX")
 DECL(osl_texture_set_missingcolor_alpha, "xXif")
+DECL(osl_resolve_udim, "XXXff")
 DECL(osl_texture, "iXXXXffffffiXXXXXXX")
 DECL(osl_texture3d, "iXXXXXXXXiXXXXXXX")
 DECL(osl_environment, "iXXXXXXXiXXXXXXX")
@@ -401,3 +448,4 @@ DECL(osl_raytype_bit, "iXi")
 #undef GENERIC_PNOISE_DERIV_IMPL
 #undef UNARY_OP_IMPL
 #undef BINARY_OP_IMPL
+#undef TRANSCENDENTAL_OP_IMPL
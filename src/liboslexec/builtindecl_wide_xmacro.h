@@ -620,6 +620,7 @@ DECL(__OSL_MASKED_OP(texture), "iXXXXXXXXXXiXiXiXi")
 DECL(__OSL_MASKED_OP(texture3d), "iXXXXXXXXiXiXiXi")
 DECL(__OSL_MASKED_OP(environment), "iXXXXXXXiXiXiXi")
 DECL(__OSL_OP(resolve_udim_uniform), "XXXXff")
+DECL(__OSL_OP(resolve_udim_table), "XXXXff")
 DECL(__OSL_MASKED_OP(resolve_udim), "xXXXXXXi")
 DECL(__OSL_OP(get_textureinfo_uniform), "iXXXXXX")
 
@@ -0,0 +1,166 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cctype>
+#include <cstdio>
+
+#include <OpenImageIO/filesystem.h>
+
+#include "oslexec_pvt.h"
+#if OSL_USE_BATCHED
+#    include <OSL/batched_shaderglobals.h>
+#endif
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+// The "capture" attribute records a sample of the points executed, one
+// file of ShadingSystem::CapturedPoint records per group, for testshade
+// --sgfile to replay.
+
+using CapturedPoint = ShadingSystem::CapturedPoint;
+static_assert(sizeof(CapturedPoint) == 32 * 4,
+              "CapturedPoint must be packed, it is written as is");
+
+
+
+// The name of the file capturing the group with the given name: the
+// prefix, then the group name made safe for a filename.
+static std::string
+capture_filename(ustring prefix, ustring groupname)
+{
+    std::string name = groupname.string();
+    for (char& c : name)
+        if (!isalnum((unsigned char)c) && c != '-' && c != '.')
+            c = '_';
+    return fmtformat("{}.{}.sg", prefix, name);
+}
+
+
+
+void
+ShadingSystemImpl::write_captures(ShaderGroup& group,
+                                  const CapturedPoint* points, int n)
+{
+    lock_guard lock(m_capture_mutex);
+    if (m_capture.empty())
+        return;  // Flushed while we were sampling
+    ustring groupname = group.name().empty()
+                            ? ustring::fmtformat("group{}", group.id())
+                            : group.name();
+    CaptureFile& cf   = m_capture_files[groupname];
+    if (!cf.file) {
+        if (cf.npoints >= m_capture_max)
+            return;  // Full, or could not be opened
+        std::string filename = capture_filename(m_capture, groupname);
+        cf.file              = OIIO::Filesystem::fopen(filename, "wb");
+        if (!cf.file) {
+            errorfmt("Could not open \"{}\" to capture shading points",
+                     filename);
+            cf.npoints = m_capture_max;
+            return;
+        }
+    }
+    int64_t room = m_capture_max - cf.npoints;
+    if (n > room)
+        n = int(std::max(room, int64_t(0)));
+    if (n)
+        fwrite(points, sizeof(CapturedPoint), n, cf.file);
+    cf.npoints += n;
+    if (cf.npoints >= m_capture_max) {
+        // Nothing more will go in, so don't hold the file open
+        fclose(cf.file);
+        cf.file = nullptr;
+    }
+}
+
+
+
+void
+ShadingSystemImpl::capture_point(ShaderGroup& group, const ShaderGlobals& sg)
+{
+    int every = std::max(m_capture_every, 1);
+    if (m_capture_count.fetch_add(1) % every)
+        return;
+    CapturedPoint p;
+    p.P          = sg.P;
+    p.dPdx       = sg.dPdx;
+    p.dPdy       = sg.dPdy;
+    p.I          = sg.I;
+    p.N          = sg.N;
+    p.Ng         = sg.Ng;
+    p.u          = sg.u;
+    p.v          = sg.v;
+    p.dudx       = sg.dudx;
+    p.dudy       = sg.dudy;
+    p.dvdx       = sg.dvdx;
+    p.dvdy       = sg.dvdy;
+    p.dPdu       = sg.dPdu;
+    p.dPdv       = sg.dPdv;
+    p.raytype    = sg.raytype;
+    p.backfacing = sg.backfacing;
+    write_captures(group, &p, 1);
+}
+
+
+
+#if OSL_USE_BATCHED
+template<int WidthT>
+void
+ShadingSystemImpl::capture_batch(ShaderGroup& group, int batch_size,
+                                 const BatchedShaderGlobals<WidthT>& bsg)
+{
+    int every    = std::max(m_capture_every, 1);
+    int64_t base = m_capture_count.fetch_add(batch_size);
+    const auto& vsg = bsg.varying;
+    CapturedPoint points[WidthT];
+    int n = 0;
+    for (int i = 0; i < batch_size; ++i) {
+        if ((base + i) % every)
+            continue;
+        CapturedPoint& p = points[n++];
+        p.P              = vsg.P.get(i);
+        p.dPdx           = vsg.dPdx.get(i);
+        p.dPdy           = vsg.dPdy.get(i);
+        p.I              = vsg.I.get(i);
+        p.N              = vsg.N.get(i);
+        p.Ng             = vsg.Ng.get(i);
+        p.u              = vsg.u.get(i);
+        p.v              = vsg.v.get(i);
+        p.dudx           = vsg.dudx.get(i);
+        p.dudy           = vsg.dudy.get(i);
+        p.dvdx           = vsg.dvdx.get(i);
+        p.dvdy           = vsg.dvdy.get(i);
+        p.dPdu           = vsg.dPdu.get(i);
+        p.dPdv           = vsg.dPdv.get(i);
+        p.raytype        = bsg.uniform.raytype;
+        p.backfacing     = vsg.backfacing.get(i);
+    }
+    if (n)
+        write_captures(group, points, n);
+}
+
+template void ShadingSystemImpl::capture_batch<16>(
+    ShaderGroup&, int, const BatchedShaderGlobals<16>&);
+template void ShadingSystemImpl::capture_batch<8>(
+    ShaderGroup&, int, const BatchedShaderGlobals<8>&);
+template void ShadingSystemImpl::capture_batch<4>(
+    ShaderGroup&, int, const BatchedShaderGlobals<4>&);
+#endif
+
+
+
+void
+ShadingSystemImpl::flush_capture()
+{
+    lock_guard lock(m_capture_mutex);
+    for (auto& f : m_capture_files)
+        if (f.second.file)
+            fclose(f.second.file);
+    m_capture_files.clear();
+    m_capture = ustring();
+}
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
@@ -4,9 +4,13 @@
 
 #pragma once
 
-#include <list>
-#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
 
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/thread.h>
 
 using namespace OSL;
@@ -23,49 +27,116 @@ namespace pvt {
 /// address or be deallocated until the entire ConstantPool is
 /// destroyed.  Allocating from the pool is completely thread-safe.
 ///
-/// It is implemented as a linked list of memory blocks.  A request for
-/// a new allocation tries to fit it in one of the allocated blocks, but
-/// if it won't fit anywhere, it makes a new block and adds it to the
-/// head of the list.
+/// It is implemented as a chain of memory blocks.  A request for a new
+/// allocation bumps an atomic offset into the newest block, taking no
+/// lock; only when that block is full does one thread take the lock and
+/// add a block to the head of the chain.  Blocks start small and double,
+/// so a pool per ShaderGroup costs little for small groups.
+///
+/// intern() copies values into the pool but hands back the same storage
+/// for values it has seen before, so repeated constants take the room
+/// of one.
 template<class T> class ConstantPool {
 public:
     /// Allocate a new pool of T's.  The quanta, if supplied, is the
-    /// number of T's to malloc at a time.
-    ConstantPool(size_t quanta = 1000000) : m_quanta(quanta), m_total(0) {}
+    /// number of T's in the first block.
+    ConstantPool(size_t quanta = 256) : m_quanta(quanta), m_total(0) {}
+
+    ConstantPool(const ConstantPool&)            = delete;
+    ConstantPool& operator=(const ConstantPool&) = delete;
 
-    ~ConstantPool() {}
+    ~ConstantPool()
+    {
+        for (Block* b = m_head.load(); b;) {
+            Block* prev = b->prev;
+            delete b;
+            b = prev;
+        }
+    }
 
     /// Allocate space enough for n T's, and return a pointer to the
     /// start of that space.
     T* alloc(size_t n)
     {
-        OIIO::lock_guard lock(m_mutex);
-        // Check each block in the block list to see if it has enough space
-        for (auto&& block : m_block_list) {
-            size_t s = block.size();
-            if ((s + n) <= block.capacity()) {
-                // Enough space in this block.  Use it.
-                block.resize(s + n);
-                return &block[s];
+        for (;;) {
+            Block* block = m_head.load(std::memory_order_acquire);
+            if (block) {
+                size_t s = block->used.fetch_add(n, std::memory_order_relaxed);
+                if (s + n <= block->capacity)
+                    return &block->data[s];
+            }
+            // The block is full (others may have overshot it too).  Make
+            // a new one unless another thread just did.
+            OIIO::lock_guard lock(m_mutex);
+            if (m_head.load(std::memory_order_relaxed) == block) {
+                size_t s = std::max(block ? 2 * block->capacity : m_quanta,
+                                    n);
+                m_total += s * sizeof(T);
+                m_head.store(new Block(s, block), std::memory_order_release);
             }
         }
-        // If we got here, there were no mini-blocks in the list with enough
-        // space.  Make a new one.
-        m_block_list.push_front(block_t());
-        block_t& block(m_block_list.front());
-        size_t s = std::max(m_quanta, n);
-        block.reserve(s);
-        m_total += s * sizeof(T);
-        block.resize(n);
-        return &block[0];
     }
 
+    /// Return pool storage holding a copy of the n values, reusing the
+    /// storage of an earlier identical request if there was one (so it
+    /// must never be modified).
+    T* intern(const T* values, size_t n)
+    {
+        size_t hash = OIIO::Strutil::strhash(
+            string_view((const char*)values, n * sizeof(T)));
+        // Sharded so that threads seldom wait on each other
+        Shard& shard(m_shards[hash % nshards]);
+        OIIO::spin_lock lock(shard.mutex);
+        auto range = shard.map.equal_range(hash);
+        for (auto i = range.first; i != range.second; ++i)
+            if (i->second.n == n
+                && !memcmp(i->second.data, values, n * sizeof(T)))
+                return i->second.data;
+        T* data = alloc(n);
+        std::copy(values, values + n, data);
+        shard.map.emplace(hash, Interned { data, n });
+        return data;
+    }
+
+    /// Total memory allocated (bytes)
+    size_t total() const { return m_total; }
+
 private:
-    typedef std::vector<T> block_t;   ///< Type of block
-    std::list<block_t> m_block_list;  ///< List of memory blocks
-    size_t m_quanta;      ///< How big each memory block is (in T's, not bytes)
+    struct Block {
+        Block(size_t size, Block* prev)
+            : capacity(size), used(0), data(new T[size]), prev(prev)
+        {
+        }
+        const size_t capacity;     ///< In T's
+        std::atomic<size_t> used;  ///< May overshoot capacity when full
+        std::unique_ptr<T[]> data;
+        Block* prev;  ///< Next older block
+    };
+    struct Interned {
+        T* data;
+        size_t n;
+    };
+    struct Shard {
+        OIIO::spin_mutex mutex;
+        std::unordered_multimap<size_t, Interned> map;  ///< hash -> values
+    };
+    static constexpr int nshards = 8;
+
+    std::atomic<Block*> m_head { nullptr };  ///< Newest memory block
+    size_t m_quanta;      ///< How big the first block is (in T's, not bytes)
     size_t m_total;       ///< Total memory allocated (bytes!)
-    OIIO::mutex m_mutex;  ///< Thread-safe lock
+    OIIO::mutex m_mutex;  ///< Guards adding blocks
+    Shard m_shards[nshards];
+};
+
+
+
+/// The pools holding the constant values of one ShaderGroup's symbols.
+/// Groups sharing layers share them, and they are freed with the last.
+struct GroupConstants {
+    ConstantPool<int> ints;
+    ConstantPool<Float> floats;
+    ConstantPool<ustring> strings;
 };
 
 
@@ -1287,22 +1287,33 @@ DECLFOLDER(constfold_split)
 
 DECLFOLDER(constfold_concat)
 {
-    // Try to turn R=concat(s,...) into R=C
+    // Try to turn R=concat(s,...) into R=C, or R=concat(s,"") into R=s
     Opcode& op(rop.inst()->ops()[opnum]);
-    ustring result;
+    std::string result;
+    int nonconst = -1;  // the only non-constant arg, if there is one
     for (int i = 1; i < op.nargs(); ++i) {
         Symbol& S(*rop.inst()->argsymbol(op.firstarg() + i));
-        if (!S.is_constant())
-            return 0;  // something non-constant
-        ustring old = result;
-        ustring s   = S.get_string();
-        result      = ustring::fmtformat("{}{}", old, s);
-    }
-    // If we made it this far, all args were constants, and the
-    // concatenation is in result.
-    int cind = rop.add_constant(TypeDesc::TypeString, &result);
-    rop.turn_into_assign(op, cind, "const fold concat");
-    return 1;
+        if (S.is_constant())
+            result += S.get_string().string();
+        else if (nonconst < 0)
+            nonconst = i;
+        else
+            return 0;  // more than one thing non-constant
+    }
+    if (nonconst < 0) {
+        // If we made it this far, all args were constants. Intern only
+        // the whole concatenation, not each step along the way.
+        int cind = rop.add_constant(ustring(result));
+        rop.turn_into_assign(op, cind, "const fold concat");
+        return 1;
+    }
+    if (result.empty()) {
+        // Everything but one arg is the empty string
+        rop.turn_into_assign(op, rop.inst()->arg(op.firstarg() + nonconst),
+                             "concat with empty strings");
+        return 1;
+    }
+    return 0;
 }
 
 
@@ -1424,6 +1435,12 @@ DECLFOLDER(constfold_substr)
     Symbol& S(*rop.opargsym(op, 1));
     Symbol& Start(*rop.opargsym(op, 2));
     Symbol& Len(*rop.opargsym(op, 3));
+    if (S.is_constant() && S.get_string().empty()) {
+        // Any substring of the empty string is empty
+        rop.turn_into_assign(op, rop.add_constant(ustring()),
+                             "substr of empty string");
+        return 1;
+    }
     if (S.is_constant() && Start.is_constant() && Len.is_constant()) {
         OSL_DASSERT(S.typespec().is_string() && Start.typespec().is_int()
                     && Len.typespec().is_int());
@@ -1445,21 +1462,34 @@ DECLFOLDER(constfold_substr)
 
 
 
-DECLFOLDER(constfold_regex_search)
+// Shared by the regex_search and regex_match folders: turn
+// R=regex_X(subj,reg) into R=C if both are constant, or else at least
+// compile a constant pattern now, so the first shade needn't.
+static int
+constfold_regex(RuntimeOptimizer& rop, int opnum, bool fullmatch)
 {
-    // Try to turn R=regex_search(subj,reg) into R=C
     Opcode& op(rop.inst()->ops()[opnum]);
     Symbol& Subj(*rop.inst()->argsymbol(op.firstarg() + 1));
     Symbol& Reg(*rop.inst()->argsymbol(op.firstarg() + 2));
+    if (!Reg.is_constant())
+        return 0;
+    OSL_DASSERT(Subj.typespec().is_string() && Reg.typespec().is_string());
+    const std::regex* reg = nullptr;
+    try {
+        reg = &rop.shadingsys().find_regex(Reg.get_string());
+    } catch (const std::regex_error&) {
+        // Leave a bad pattern for the shader to report when it runs
+        return 0;
+    }
     if (op.nargs() == 3  // only the 2-arg version without search results
-        && Subj.is_constant() && Reg.is_constant()) {
-        OSL_DASSERT(Subj.typespec().is_string() && Reg.typespec().is_string());
-        ustring s(Subj.get_string());
-        ustring r(Reg.get_string());
-        std::regex reg(r.string());
-        int result = std::regex_search(s.string(), reg);
+        && Subj.is_constant()) {
+        const std::string& s(Subj.get_string().string());
+        int result = fullmatch ? std::regex_match(s, *reg)
+                               : std::regex_search(s, *reg);
         int cind   = rop.add_constant(result);
-        rop.turn_into_assign(op, cind, "const fold regex_search");
+        rop.turn_into_assign(op, cind,
+                             fullmatch ? "const fold regex_match"
+                                       : "const fold regex_search");
         return 1;
     }
     return 0;
@@ -1467,6 +1497,20 @@ DECLFOLDER(constfold_regex_search)
 
 
 
+DECLFOLDER(constfold_regex_search)
+{
+    return constfold_regex(rop, opnum, false);
+}
+
+
+
+DECLFOLDER(constfold_regex_match)
+{
+    return constfold_regex(rop, opnum, true);
+}
+
+
+
 inline float
 clamp(float x, float minv, float maxv)
 {
@@ -1766,8 +1810,10 @@ DECLFOLDER(constfold_max)
 
 // Handy macro for automatically constructing a constant-folder for
 // a simple function of one argument that can be float or triple
-// and returns the same type as its argument.
-#define AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(name, impl)                     \
+// and returns the same type as its argument.  The transcendentals fold
+// with fastimpl or exactimpl to match the shadeop the JIT will call for
+// them (see the math_precision option); others pass the same for both.
+#define AUTO_DECLFOLDER_FAST_OR_EXACT(name, fastimpl, exactimpl)        \
     DECLFOLDER(constfold_##name)                                        \
     {                                                                   \
         /* Try to turn R=f(x) into R=C */                               \
@@ -1776,12 +1822,11 @@ DECLFOLDER(constfold_max)
         if (X.is_constant()                                             \
             && (X.typespec().is_float() || X.typespec().is_triple())) { \
             const float* x = (const float*)X.dataptr();                 \
+            bool fast      = rop.shadingsys().fast_math();              \
+            int n          = X.typespec().is_triple() ? 3 : 1;          \
             float result[3];                                            \
-            result[0] = impl(x[0]);                                     \
-            if (X.typespec().is_triple()) {                             \
-                result[1] = impl(x[1]);                                 \
-                result[2] = impl(x[2]);                                 \
-            }                                                           \
+            for (int i = 0; i < n; ++i)                                 \
+                result[i] = fast ? fastimpl(x[i]) : exactimpl(x[i]);    \
             int cind = rop.add_constant(X.typespec(), &result);         \
             rop.turn_into_assign(op, cind, "const fold " #name);        \
             return 1;                                                   \
@@ -1789,6 +1834,9 @@ DECLFOLDER(constfold_max)
         return 0;                                                       \
     }
 
+#define AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(name, impl) \
+    AUTO_DECLFOLDER_FAST_OR_EXACT(name, impl, impl)
+
 
 
 AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(sqrt, OIIO::safe_sqrt)
@@ -1797,34 +1845,20 @@ AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(degrees, OIIO::degrees)
 AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(radians, OIIO::radians)
 AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(floor, floorf)
 AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(ceil, ceilf)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(erf, OIIO::fast_erf)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(erfc, OIIO::fast_erfc)
 AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(logb, OIIO::fast_logb)
-#if OSL_FAST_MATH
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(cos, OIIO::fast_cos)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(sin, OIIO::fast_sin)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(acos, OIIO::fast_acos)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(asin, OIIO::fast_asin)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(exp, OIIO::fast_exp)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(exp2, OIIO::fast_exp2)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(expm1, OIIO::fast_expm1)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(log, OIIO::fast_log)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(log10, OIIO::fast_log10)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(log2, OIIO::fast_log2)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(cbrt, OIIO::fast_cbrt)
-#else
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(cos, cosf)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(sin, sinf)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(acos, OIIO::safe_acos)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(asin, OIIO::safe_asin)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(exp, expf)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(exp2, exp2f)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(expm1, expm1f)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(log, OIIO::safe_log)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(log10, OIIO::safe_log10)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(log2, OIIO::safe_log2)
-AUTO_DECLFOLDER_FLOAT_OR_TRIPLE(cbrt, cbrtf)
-#endif
+AUTO_DECLFOLDER_FAST_OR_EXACT(erf, OIIO::fast_erf, erff)
+AUTO_DECLFOLDER_FAST_OR_EXACT(erfc, OIIO::fast_erfc, erfcf)
+AUTO_DECLFOLDER_FAST_OR_EXACT(cos, OIIO::fast_cos, cosf)
+AUTO_DECLFOLDER_FAST_OR_EXACT(sin, OIIO::fast_sin, sinf)
+AUTO_DECLFOLDER_FAST_OR_EXACT(acos, OIIO::fast_acos, OIIO::safe_acos)
+AUTO_DECLFOLDER_FAST_OR_EXACT(asin, OIIO::fast_asin, OIIO::safe_asin)
+AUTO_DECLFOLDER_FAST_OR_EXACT(exp, OIIO::fast_exp, expf)
+AUTO_DECLFOLDER_FAST_OR_EXACT(exp2, OIIO::fast_exp2, exp2f)
+AUTO_DECLFOLDER_FAST_OR_EXACT(expm1, OIIO::fast_expm1, expm1f)
+AUTO_DECLFOLDER_FAST_OR_EXACT(log, OIIO::fast_log, OIIO::safe_log)
+AUTO_DECLFOLDER_FAST_OR_EXACT(log10, OIIO::fast_log10, OIIO::safe_log10)
+AUTO_DECLFOLDER_FAST_OR_EXACT(log2, OIIO::fast_log2, OIIO::safe_log2)
+AUTO_DECLFOLDER_FAST_OR_EXACT(cbrt, OIIO::fast_cbrt, cbrtf)
 
 DECLFOLDER(constfold_pow)
 {
@@ -1857,11 +1891,9 @@ DECLFOLDER(constfold_pow)
         float result[3];
         for (int i = 0; i < nxcomps; ++i) {
             int j = std::min(i, nycomps - 1);
-#if OSL_FAST_MATH
-            result[i] = OIIO::fast_safe_pow(x[i], y[j]);
-#else
-            result[i] = OIIO::safe_pow(x[i], y[j]);
-#endif
+            result[i] = rop.shadingsys().fast_math()
+                            ? OIIO::fast_safe_pow(x[i], y[j])
+                            : OIIO::safe_pow(x[i], y[j]);
         }
         int cind = rop.add_constant(X.typespec(), &result);
         rop.turn_into_assign(op, cind, "const fold pow");
@@ -1910,11 +1942,10 @@ DECLFOLDER(constfold_sincos)
         int cosarg  = rop.inst()->args()[op.firstarg() + 2];
         float angle = A.get_float();
         float s, c;
-#if OSL_FAST_MATH
-        OIIO::fast_sincos(angle, &s, &c);
-#else
-        OIIO::sincos(angle, &s, &c);
-#endif
+        if (rop.shadingsys().fast_math())
+            OIIO::fast_sincos(angle, &s, &c);
+        else
+            OIIO::sincos(angle, &s, &c);
         // Turn this op into the sin assignment
         rop.turn_into_new_op(op, u_assign, sinarg, rop.add_constant(s), -1,
                              "const fold sincos");
@@ -2267,6 +2298,32 @@ DECLFOLDER(constfold_getmessage)
 
 
 
+DECLFOLDER(constfold_dict_find)
+{
+    // Try to turn dict_find into a constant node ID, when the dictionary
+    // (or the starting node) and the query are constant.  Node IDs are
+    // the same in every context, so the lookup needn't wait for shading.
+    Opcode& op(rop.inst()->ops()[opnum]);
+    Symbol& Source(*rop.opargsym(op, 1));
+    Symbol& Query(*rop.opargsym(op, 2));
+    if (!Source.is_constant() || !Query.is_constant())
+        return 0;
+
+    std::string err;
+    int result = Source.typespec().is_int()
+                     ? rop.shadingsys().dict_find(Source.get_int(),
+                                                  Query.get_string(), err)
+                     : rop.shadingsys().dict_find(Source.get_string(),
+                                                  Query.get_string(), err);
+    if (!err.empty())
+        return 0;  // Leave it to shade time, which reports the error
+    rop.turn_into_assign(op, rop.add_constant(result),
+                         "const fold dict_find");
+    return 1;
+}
+
+
+
 DECLFOLDER(constfold_getattribute)
 {
     if (!rop.shadingsys().fold_getattribute())
@@ -2337,14 +2394,35 @@ DECLFOLDER(constfold_getattribute)
         found       = true;
     }
 
+    ustring obj_name;
+    if (object_lookup)
+        obj_name = ObjectName.get_string();
+
+    if (!found && obj_name.empty()) {
+        // The renderer may have told us the values some attributes of the
+        // shaded object have wherever the group runs.
+        const ParamValueList& statics(rop.group().static_attributes());
+        auto a = statics.find(attr_name);
+        if (a != statics.end()) {
+            TypeDesc t = a->type();
+            int index  = array_lookup ? Index.get_int() : 0;
+            if (!array_lookup && t == attr_type) {
+                memcpy(buf, a->data(), attr_type.size());
+                found = true;
+            } else if (array_lookup && t.elementtype() == attr_type
+                       && index >= 0 && index < t.arraylen) {
+                memcpy(buf, (const char*)a->data() + index * attr_type.size(),
+                       attr_type.size());
+                found = true;
+            }
+        }
+    }
+
     if (!found) {
         // If the object name is not supplied, it implies that we are
         // supposed to search the shaded object first, then if that fails,
         // the scene-wide namespace.  We can't do that yet, have to wait
         // until shade time.
-        ustring obj_name;
-        if (object_lookup)
-            obj_name = ObjectName.get_string();
         if (obj_name.empty())
             return 0;
 
@@ -2390,14 +2468,16 @@ DECLFOLDER(constfold_gettextureinfo)
 {
     Opcode& op(rop.inst()->ops()[opnum]);
 
-    // FIXME: For now, punt on constant folding the variety of gettextureinfo
-    // that is passed texture coordinates. Eventually, if we can determine that
-    // the filename is constant and is known to not be UDIM, we can fall back
-    // to the other case.
-    bool use_coords = (op.nargs() == 6);
-    if (use_coords)
+    // Folding assumes the textures won't change for as long as the
+    // optimized group is used.
+    if (!rop.shadingsys().fold_gettextureinfo())
         return 0;
 
+    // The variety of gettextureinfo that is passed texture coordinates
+    // only needs them to pick the tile of a UDIM texture, so with any
+    // other it folds like the variety without them.
+    bool use_coords = (op.nargs() == 6);
+
     OSL_MAYBE_UNUSED Symbol& Result(*rop.inst()->argsymbol(op.firstarg() + 0));
     Symbol& Filename(*rop.inst()->argsymbol(op.firstarg() + 1));
     Symbol& Dataname(
@@ -2409,6 +2489,13 @@ DECLFOLDER(constfold_gettextureinfo)
     if (Filename.is_constant() && Dataname.is_constant()) {
         ustring filename = Filename.get_string();
         ustring dataname = Dataname.get_string();
+        if (use_coords) {
+            RendererServices::TextureHandle* handle
+                = rop.renderer()->get_texture_handle(filename,
+                                                     rop.shadingcontext());
+            if (!handle || rop.renderer()->is_udim(handle))
+                return 0;
+        }
         TypeDesc t       = Data.typespec().simpletype();
         void* mydata     = OSL_ALLOCA(char, t.size());
         // FIXME(ptex) -- exclude folding of ptex, since these things
@@ -2429,7 +2516,8 @@ DECLFOLDER(constfold_gettextureinfo)
         //       assign result 0
         if (result) {
             int oldresultarg = rop.inst()->args()[op.firstarg() + 0];
-            int dataarg      = rop.inst()->args()[op.firstarg() + 3];
+            int dataarg = rop.inst()->args()[op.firstarg() + (use_coords ? 5
+                                                                          : 3)];
             // Make data the first argument
             rop.inst()->args()[op.firstarg() + 0] = dataarg;
             // Now turn it into an assignment
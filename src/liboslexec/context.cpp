@@ -2,8 +2,10 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -47,6 +49,10 @@ ShadingContext::ShadingContext(ShadingSystemImpl& shadingsys,
     : m_shadingsys(shadingsys)
     , m_renderer(m_shadingsys.renderer())
     , m_group(NULL)
+    , m_messages(m_arena)
+#if OSL_USE_BATCHED
+    , m_batched_messages_buffer(m_arena)
+#endif
     , m_max_warnings(shadingsys.max_warnings_per_thread())
     , m_dictionary(NULL)
     , batch_size_executed(0)
@@ -54,6 +60,8 @@ ShadingContext::ShadingContext(ShadingSystemImpl& shadingsys,
     m_shadingsys.m_stat_contexts += 1;
     m_threadinfo = threadinfo ? threadinfo : shadingsys.get_perthread_info();
     m_texture_thread_info = NULL;
+    m_debug_sample_rng    = uint32_t(uintptr_t(this) >> 4) | 1;
+    m_shadingsys.register_live_counters(&m_live_counters);
 }
 
 
@@ -61,69 +69,132 @@ ShadingContext::ShadingContext(ShadingSystemImpl& shadingsys,
 ShadingContext::~ShadingContext()
 {
     process_errors();
+    if (m_printf_ring)
+        m_printf_ring->close();
 #if OSL_USE_BATCHED
     process_file_output();
 #endif
     m_shadingsys.m_stat_contexts -= 1;
+    m_shadingsys.unregister_live_counters(&m_live_counters);
+    unpin_jit_groups();
     free_dict_resources();
 }
 
 
 
+ShaderGroup&
+ShadingContext::group_to_run(ShaderGroup& group, ShaderGlobals& ssg,
+                             void* userdata_base_ptr, int shadeindex)
+{
+    // Run the userdata or raytype variant of the group made for this
+    // point, if any
+    return group.has_userdata_variants()
+               ? shadingsys().userdata_variant(group, ssg, userdata_base_ptr,
+                                               shadeindex)
+           : group.has_raytype_variants()
+               ? shadingsys().raytype_variant(group, ssg.raytype, 0)
+               : group;
+}
+
+
+
 bool
-ShadingContext::execute_init(ShaderGroup& sgroup, int shadeindex,
+ShadingContext::prepare_group(ShaderGroup& sgroup)
+{
+    // Optimize if we haven't already
+    if (!sgroup.nlayers())
+        return false;  // empty shader - nothing to do!
+    m_live_counters.incr(LiveCounters::Shades);
+    sgroup.start_running(shadingsys().profile());
+    if (shadingsys().jit_memory_budget_MB()) {
+        // Keep its code from being evicted until execute_cleanup, and
+        // mark it as recently used
+        ++sgroup.m_jit_users;
+        m_jit_pins.push_back(&sgroup);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sgroup.m_jit_evicting.load()) {
+            // It's being evicted, and didn't see us in time: wait for that
+            // to finish, then pin it again, and JIT it again below.
+            --sgroup.m_jit_users;
+            lock_guard lock(sgroup.m_mutex);
+            ++sgroup.m_jit_users;
+        }
+        sgroup.m_jit_last_used.store(shadingsys().m_jit_clock.load(),
+                                     std::memory_order_relaxed);
+    }
+    if (!sgroup.jitted()) {
+        // Maybe a placeholder shade, if the group is queued to compile
+        if (!shadingsys().async_compile_on_shade(sgroup))
+            return false;
+        auto ctx = shadingsys().get_context(thread_info());
+        shadingsys().optimize_group(sgroup, ctx, true /*do_jit*/);
+        shadingsys().async_compile_done(sgroup);
+        if (shadingsys().m_greedyjit
+            && shadingsys().m_groups_to_compile_count) {
+            // If we are greedily JITing, optimize/JIT everything now
+            shadingsys().optimize_all_groups();
+        }
+        shadingsys().release_context(ctx);
+    }
+    return !sgroup.does_nothing();
+}
+
+
+
+void
+ShadingContext::reset_execution(size_t heap_size, size_t scratch_size)
+{
+    // Allocate enough space on the heap
+    reserve_heap(heap_size);
+
+    // Reset the closures, messages and scratch space of the last
+    // execution, and make room for as much as its groups have ever needed
+    m_arena.clear();
+    m_arena.reserve(scratch_size);
+    m_messages.clear();
+    clear_matrix_cache();
+
+    // Zero out stats for this execution
+    clear_runtime_stats();
+
+    m_shade_deferred = false;
+
+    // Replay the deferred traces from the first
+    if (m_deferred_traces) {
+        m_deferred_traces->next    = 0;
+        m_deferred_traces->current = -1;
+    }
+}
+
+
+
+bool
+ShadingContext::execute_init(ShaderGroup& group, int shadeindex,
                              ShaderGlobals& ssg, void* userdata_base_ptr,
                              void* output_base_ptr, bool run)
 {
+    ShaderGroup& sgroup(group_to_run(group, ssg, userdata_base_ptr,
+                                     shadeindex));
     if (m_group)
         execute_cleanup();
     batch_size_executed = 0;
     m_group             = &sgroup;
     m_ticks             = 0;
 
-    // Optimize if we haven't already
-    if (sgroup.nlayers()) {
-        sgroup.start_running();
-        if (!sgroup.jitted()) {
-            auto ctx = shadingsys().get_context(thread_info());
-            shadingsys().optimize_group(sgroup, ctx, true /*do_jit*/);
-            if (shadingsys().m_greedyjit
-                && shadingsys().m_groups_to_compile_count) {
-                // If we are greedily JITing, optimize/JIT everything now
-                shadingsys().optimize_all_groups();
-            }
-            shadingsys().release_context(ctx);
-        }
-        if (sgroup.does_nothing())
-            return false;
-    } else {
-        // empty shader - nothing to do!
+    if (!prepare_group(sgroup))
         return false;
-    }
+    next_debug_sample();
 
     int profile = shadingsys().m_profile;
     OIIO::Timer timer(profile ? OIIO::Timer::StartNow
                               : OIIO::Timer::DontStartNow);
 
-    // Allocate enough space on the heap
     size_t heap_size_needed = sgroup.llvm_groupdata_size();
-    reserve_heap(heap_size_needed);
+    reset_execution(heap_size_needed, sgroup.scratch_highwater());
     // Zero out the heap memory we will be using
     if (shadingsys().m_clearmemory)
         memset(m_heap.get(), 0, heap_size_needed);
 
-    // Set up closure storage
-    m_closure_pool.clear();
-
-    // Clear the message blackboard
-    m_messages.clear();
-
-    // Clear miscellaneous scratch space
-    m_scratch_pool.clear();
-
-    // Zero out stats for this execution
-    clear_runtime_stats();
-
     if (run) {
         RunLLVMGroupFunc run_func = sgroup.llvm_compiled_init();
         if (!run_func)
@@ -171,9 +242,70 @@ ShadingContext::execute_layer(int shadeindex, ShaderGlobals& ssg,
 
 
 
+cspan<ClosureFlatComponent>
+ShadingContext::flatten_closure(const ClosureColor* closure)
+{
+    m_flat_closure.clear();
+    append_flat_closure(closure);
+    return m_flat_closure;
+}
+
+
+
+cspan<ClosureFlatComponent>
+ShadingContext::flatten_closures(cspan<const ClosureColor*> closures,
+                                 span<int> begins)
+{
+    OSL_DASSERT(begins.size() > closures.size());
+    m_flat_closure.clear();
+    for (size_t i = 0; i < closures.size(); ++i) {
+        begins[i] = int(m_flat_closure.size());
+        append_flat_closure(closures[i]);
+    }
+    begins[closures.size()] = int(m_flat_closure.size());
+    return m_flat_closure;
+}
+
+
+
+void
+ShadingContext::append_flat_closure(const ClosureColor* closure)
+{
+    // Walk the tree with our own stack of nodes still to visit, each with
+    // the product of the weights of the muls above it.
+    m_flat_closure_todo.clear();
+    if (closure)
+        m_flat_closure_todo.emplace_back(closure, Color3(1.0f));
+    while (!m_flat_closure_todo.empty()) {
+        const ClosureColor* c = m_flat_closure_todo.back().first;
+        Color3 w              = m_flat_closure_todo.back().second;
+        m_flat_closure_todo.pop_back();
+        if (c->id == ClosureColor::MUL) {
+            w *= c->as_mul()->weight;
+            if (c->as_mul()->closure && w != Color3(0.0f))
+                m_flat_closure_todo.emplace_back(c->as_mul()->closure, w);
+        } else if (c->id == ClosureColor::ADD) {
+            // B first, so that A's components come out first, as in the
+            // recursive walk renderers used to do
+            if (c->as_add()->closureB)
+                m_flat_closure_todo.emplace_back(c->as_add()->closureB, w);
+            if (c->as_add()->closureA)
+                m_flat_closure_todo.emplace_back(c->as_add()->closureA, w);
+        } else {
+            const ClosureComponent* comp = c->as_comp();
+            w *= Color3(comp->w);
+            if (w != Color3(0.0f))
+                m_flat_closure.push_back({ comp->id, w, comp->data() });
+        }
+    }
+}
+
+
+
 bool
 ShadingContext::execute_cleanup()
 {
+    unpin_jit_groups();
     if (!group()) {
         errorfmt("execute_cleanup called again on a cleaned-up context");
         return false;
@@ -185,17 +317,32 @@ ShadingContext::execute_cleanup()
     process_file_output();
 #endif
 
+    if (!m_points_recorded)
+        group()->update_scratch_highwater(m_arena.used());
+
     if (shadingsys().m_profile) {
         record_runtime_stats();  // Transfer runtime stats to the shadingsys
-        shadingsys().m_stat_total_shading_time_ticks += m_ticks;
-        group()->m_stat_total_shading_time_ticks += m_ticks;
+        if (!m_points_recorded)
+            record_shading_time(*group(), m_ticks);
     }
+    m_points_recorded = false;
 
     return true;
 }
 
 
 
+void
+ShadingContext::record_shading_time(ShaderGroup& sgroup, long long ticks)
+{
+    shadingsys().m_stat_total_shading_time_ticks += ticks;
+    sgroup.m_stat_total_shading_time_ticks += ticks;
+    sgroup.m_timed_ticks += ticks;
+    ++sgroup.m_timed_executions;
+}
+
+
+
 bool
 ShadingContext::execute(ShaderGroup& sgroup, int shadeindex, ShaderGlobals& ssg,
                         void* userdata_base_ptr, void* output_base_ptr,
@@ -213,6 +360,16 @@ ShadingContext::execute(ShaderGroup& sgroup, int shadeindex, ShaderGlobals& ssg,
             n = 1;
     }
 
+    // A single run of a cacheable group may be answered by the results
+    // of a point close enough to this one
+    ShadingCache::Key key;
+    bool cached = run && n == 1
+                  && shading_cache_key(sgroup, shadeindex, ssg,
+                                       userdata_base_ptr, output_base_ptr,
+                                       key);
+    if (cached && execute_from_cache(key, shadeindex, ssg, output_base_ptr))
+        return execute_cleanup();
+
     bool result = true;
     while (1) {
         if (!execute_init(sgroup, shadeindex, ssg, userdata_base_ptr,
@@ -232,19 +389,184 @@ ShadingContext::execute(ShaderGroup& sgroup, int shadeindex, ShaderGlobals& ssg,
             ssg.Ci = NULL;
         }
     }
+    if (cached && result)
+        cache_result(key, shadeindex, ssg, output_base_ptr);
     return result;
 }
 
 
+
+bool
+ShadingContext::execute(cspan<ShaderGroup*> groups, int shadeindex,
+                        ShaderGlobals& ssg, void* userdata_base_ptr,
+                        void* output_base_ptr)
+{
+    if (m_group)
+        execute_cleanup();
+    batch_size_executed = 0;
+    m_ticks             = 0;
+
+    // Settle which groups (or variants) will run, compiling them if
+    // needed, and how much of the heap and scratch they need. They run one
+    // after another, so each may reuse the heap of the one before it.
+    m_chain.clear();
+    size_t heap_size = 0, scratch_size = 0;
+    for (ShaderGroup* g : groups) {
+        if (!g)
+            continue;
+        ShaderGroup& sgroup(group_to_run(*g, ssg, userdata_base_ptr,
+                                         shadeindex));
+        m_group = &sgroup;
+        if (!prepare_group(sgroup) || !sgroup.llvm_compiled_init())
+            continue;
+        m_chain.push_back(&sgroup);
+        heap_size = std::max(heap_size, sgroup.llvm_groupdata_size());
+        scratch_size += sgroup.scratch_highwater();
+    }
+    if (m_chain.empty())
+        return false;
+
+    int profile = shadingsys().m_profile;
+    OIIO::Timer timer(profile ? OIIO::Timer::StartNow
+                              : OIIO::Timer::DontStartNow);
+
+    // The fixed cost of an execution, paid once for all the groups
+    reset_execution(heap_size, scratch_size);
+    ssg.context             = this;
+    ssg.shadingStateUniform = &(shadingsys().m_shading_state_uniform);
+    ssg.renderer            = renderer();
+    ssg.Ci                  = NULL;
+
+    for (ShaderGroup* sgroup : m_chain) {
+        m_group = sgroup;
+        if (shadingsys().m_clearmemory)
+            memset(m_heap.get(), 0, sgroup->llvm_groupdata_size());
+        RunLLVMGroupFunc init_func = sgroup->llvm_compiled_init();
+        if (!init_func)
+            continue;
+        size_t scratch_used = m_arena.used();
+        init_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr,
+                  shadeindex);
+        RunLLVMGroupFunc run_func = sgroup->llvm_compiled_layer(
+            sgroup->nlayers() - 1);
+        if (run_func)
+            run_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr,
+                     shadeindex);
+        sgroup->update_scratch_highwater(m_arena.used() - scratch_used);
+    }
+
+    if (profile)
+        m_ticks += timer.ticks();
+    return execute_cleanup();
+}
+
+
+
+bool
+ShadingContext::execute(ShaderGroup& group, int shadeindex,
+                        span<ShaderGlobals> globals, void* userdata_base_ptr,
+                        void* output_base_ptr)
+{
+    // Repeats, deferred traces and the shading cache each need the whole
+    // of a single execution per point
+    if (group.m_exec_repeat > 1 || m_deferred_traces
+        || shadingsys().m_shading_cache) {
+        bool result = false;
+        for (size_t i = 0; i < globals.size(); ++i)
+            if (execute(group, shadeindex + int(i), globals[i],
+                        userdata_base_ptr, output_base_ptr, true))
+                result = true;
+        return result;
+    }
+
+    if (m_group)
+        execute_cleanup();
+    batch_size_executed = 0;
+    m_ticks             = 0;
+
+    int profile = shadingsys().m_profile;
+    bool reset  = false;  // Has the first point reset the context?
+    bool result = false;
+    ShaderGroup* prepared = nullptr;  // The last group prepare_group passed
+    for (size_t i = 0; i < globals.size(); ++i) {
+        ShaderGlobals& ssg(globals[i]);
+        int index = shadeindex + int(i);
+        ShaderGroup& sgroup(group_to_run(group, ssg, userdata_base_ptr,
+                                         index));
+        m_group = &sgroup;
+        if (&sgroup == prepared) {
+            // Count it as prepare_group would have
+            m_live_counters.incr(LiveCounters::Shades);
+            sgroup.start_running(profile);
+        } else if (prepare_group(sgroup) && sgroup.llvm_compiled_init()) {
+            prepared = &sgroup;
+        } else {
+            prepared = nullptr;
+            continue;
+        }
+
+        RunLLVMGroupFunc init_func = sgroup.llvm_compiled_init();
+        if (!init_func)
+            continue;
+
+        OIIO::Timer timer(profile ? OIIO::Timer::StartNow
+                                  : OIIO::Timer::DontStartNow);
+        // The fixed cost of an execution is paid once.  After that, each
+        // point only forgets the messages and matrices of the last; the
+        // closures of all the points stay in the arena until the next
+        // execution, so the renderer may read each point's Ci.
+        size_t heap_size = sgroup.llvm_groupdata_size();
+        if (!reset) {
+            reset_execution(heap_size, sgroup.scratch_highwater());
+            reset = true;
+        } else {
+            reserve_heap(heap_size);
+            m_messages.clear();
+            clear_matrix_cache();
+        }
+        if (shadingsys().m_clearmemory)
+            memset(m_heap.get(), 0, heap_size);
+        next_debug_sample();
+        ssg.context             = this;
+        ssg.shadingStateUniform = &(shadingsys().m_shading_state_uniform);
+        ssg.renderer            = renderer();
+        ssg.Ci                  = NULL;
+        size_t scratch_used     = m_arena.used();
+        init_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr,
+                  index);
+        RunLLVMGroupFunc run_func = sgroup.llvm_compiled_layer(
+            sgroup.nlayers() - 1);
+        if (run_func)
+            run_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr,
+                     index);
+        sgroup.update_scratch_highwater(m_arena.used() - scratch_used);
+        if (profile)
+            record_shading_time(sgroup, timer.ticks());
+        result = true;
+    }
+
+    if (!result)
+        return false;
+    m_points_recorded = true;
+    return execute_cleanup();
+}
+
+
+
 #if OSL_USE_BATCHED
 
 template<int WidthT>
 bool
 ShadingContext::Batched<WidthT>::execute_init(
-    ShaderGroup& sgroup, int batch_size,
+    ShaderGroup& group, int batch_size,
     Wide<const int, WidthT> wide_shadeindex, BatchedShaderGlobals<WidthT>& bsg,
     void* userdata_base_ptr, void* output_base_ptr, bool run)
 {
+    // The raytype is uniform across the batch, so is the variant
+    ShaderGroup& sgroup(group.has_raytype_variants()
+                            ? shadingsys().raytype_variant(
+                                group, bsg.uniform.raytype, WidthT)
+                            : group);
     if (context().m_group)
         context().execute_cleanup();
 
@@ -254,7 +576,8 @@ ShadingContext::Batched<WidthT>::execute_init(
 
     // Optimize if we haven't already
     if (sgroup.nlayers()) {
-        sgroup.start_running();
+        context().incr_live_counter(LiveCounters::Shades, batch_size);
+        sgroup.start_running(shadingsys().profile());
         if (!sgroup.batch_jitted()) {
             // Matching ShadingContext::execute_init behavior
             // of grabbing another context.
@@ -295,16 +618,14 @@ ShadingContext::Batched<WidthT>::execute_init(
     if (shadingsys().m_clearmemory)
         memset(context().m_heap.get(), 0, heap_size_needed);
 
-    // Set up closure storage
-    context().m_closure_pool.clear();
-
-    // Clear the message blackboard
+    // Reset the closures, messages and scratch space of the last
+    // execution, and make room for as much as this group has ever needed
+    context().m_arena.clear();
+    context().m_arena.reserve(sgroup.scratch_highwater());
     context().m_messages.clear();
+    context().clear_matrix_cache();
     context().batched_messages_buffer().clear();
 
-    // Clear miscellaneous scratch space
-    context().m_scratch_pool.clear();
-
     // Zero out stats for this execution
     context().clear_runtime_stats();
 
@@ -487,13 +808,99 @@ process_errors_helper(ShadingSystemImpl& shading_sys, const ErrorsT& errors,
     }
 }
 
+void
+ShadingContext::filter_repeated_errors() const
+{
+    if (shadingsys().m_error_repeats)
+        return;
+    int epoch = shadingsys().m_errseen_epoch.load(std::memory_order_relaxed);
+    if (epoch != m_errseen_epoch) {
+        m_errseen.clear();
+        m_warnseen.clear();
+        m_errseen_epoch = epoch;
+    }
+    auto repeated = [&](const ErrorItem& e) {
+        std::unordered_set<std::string>* seen = nullptr;
+        if (e.err_code == ErrorHandler::EH_ERROR
+            || e.err_code == ErrorHandler::EH_SEVERE)
+            seen = &m_errseen;
+        else if (e.err_code == ErrorHandler::EH_WARNING)
+            seen = &m_warnseen;
+        else
+            return false;
+        if (seen->count(e.msgString))
+            return true;
+        if (seen->size() >= m_errseenmax)
+            seen->clear();
+        seen->insert(e.msgString);
+        return false;
+    };
+    m_buffered_errors.erase(std::remove_if(m_buffered_errors.begin(),
+                                           m_buffered_errors.end(), repeated),
+                            m_buffered_errors.end());
+}
+
+
+
+bool
+ShadingContext::printf_site_sampled(const char* format)
+{
+    const ShadingSystemImpl& ss(shadingsys());
+    PrintfSite& site = m_printf_sites[format];
+    if (ss.m_printf_sample > 1 && site.calls++ % ss.m_printf_sample)
+        return false;
+    if (ss.m_printf_rate_limit > 0) {
+        using namespace std::chrono;
+        int64_t second = duration_cast<seconds>(
+                             steady_clock::now().time_since_epoch())
+                             .count();
+        if (second != site.second) {
+            site.second  = second;
+            site.printed = 0;
+        }
+        if (site.printed >= ss.m_printf_rate_limit)
+            return false;
+        ++site.printed;
+    }
+    return true;
+}
+
+
+
 void
 ShadingContext::process_errors() const
 {
+    // Repeats are rejected here, without taking any lock
+    filter_repeated_errors();
     int nerrors(m_buffered_errors.size());
     if (!nerrors)
         return;
 
+    // With printf_async, the printf output goes to the background thread,
+    // and only errors and warnings are left to print here
+    bool batched = false;
+#if OSL_USE_BATCHED
+    batched = execution_is_batched();
+#endif
+    if (shadingsys().m_printf_async && !batched) {
+        if (!m_printf_ring)
+            m_printf_ring = shadingsys().new_printf_ring();
+        auto printed = [&](ErrorItem& e) {
+            if (e.err_code != ErrorHandler::EH_MESSAGE
+                && e.err_code != ErrorHandler::EH_INFO)
+                return false;
+            m_printf_ring->push(e.err_code, std::move(e.msgString));
+            return true;
+        };
+        m_buffered_errors.erase(std::remove_if(m_buffered_errors.begin(),
+                                               m_buffered_errors.end(),
+                                               printed),
+                                m_buffered_errors.end());
+        nerrors = int(m_buffered_errors.size());
+        if (!nerrors)
+            return;
+    }
+
     // Use a mutex to make sure output from different threads stays
     // together, at least for one shader invocation, rather than being
     // interleaved with other threads.
@@ -614,11 +1021,37 @@ ShadingContext::find_regex(ustring r)
     RegexMap::const_iterator found = m_regex_map.find(r);
     if (found != m_regex_map.end())
         return *found->second;
-    // otherwise, it wasn't found, add it
-    m_regex_map[r].reset(new std::regex(r.c_str()));
-    m_shadingsys.m_stat_regexes += 1;
-    // std::cerr << "Made new regex for " << r << "\n";
-    return *m_regex_map[r];
+    // otherwise, it wasn't found, ask the shading system and remember it
+    const std::regex* regex = &m_shadingsys.find_regex(r);
+    m_regex_map[r]          = regex;
+    return *regex;
+}
+
+
+
+const std::regex&
+ShadingSystemImpl::find_regex(ustring pattern)
+{
+    RegexShard& shard(m_regex_shards[pattern.hash() % 16]);
+    {
+        spin_rw_read_lock lock(shard.mutex);
+        auto found = shard.map.find(pattern);
+        if (found != shard.map.end())
+            return *found->second;
+    }
+    // Compile without holding the lock; if another thread beats us to
+    // it, its regex wins.
+    auto flags = std::regex::ECMAScript;
+    if (m_regex_optimize)
+        flags |= std::regex::optimize;
+    std::unique_ptr<std::regex> regex(new std::regex(pattern.c_str(), flags));
+    spin_rw_write_lock lock(shard.mutex);
+    auto& entry = shard.map[pattern];
+    if (!entry) {
+        entry = std::move(regex);
+        m_stat_regexes += 1;
+    }
+    return *entry;
 }
 
 
@@ -636,6 +1069,26 @@ ShadingContext::osl_get_attribute(ShaderGlobals* sg, void* objdata,
 #endif
     bool ok;
 
+    bool use_cache = shadingsys().attribute_cache();
+    AttributeCacheKey key { objdata, obj_name, attr_name, attr_type,
+                            array_lookup ? index : -1 };
+    if (use_cache) {
+        if (const AttributeCacheEntry* e = find_cached_attribute(key)) {
+            if (e->cacheable) {
+                // Object-constant, so any derivatives are zero
+                if (e->ok) {
+                    memcpy(attr_dest, e->value.data(), e->value.size());
+                    if (dest_derivs)
+                        memset((char*)attr_dest + e->value.size(), 0,
+                               2 * e->value.size());
+                }
+                incr_attribute_cache_hits();
+                return e->ok;
+            }
+            use_cache = false;
+        }
+    }
+
     if (array_lookup)
         ok = renderer()->get_array_attribute(sg, dest_derivs, obj_name,
                                              attr_type, attr_name, index,
@@ -644,6 +1097,9 @@ ShadingContext::osl_get_attribute(ShaderGlobals* sg, void* objdata,
         ok = renderer()->get_attribute(sg, dest_derivs, obj_name, attr_type,
                                        attr_name, attr_dest);
 
+    if (use_cache)
+        cache_attribute(key, ok, attr_dest);
+
 #if 0
     double time = timer();
     shadingsys().m_stat_getattribute_time += time;
@@ -657,6 +1113,84 @@ ShadingContext::osl_get_attribute(ShaderGlobals* sg, void* objdata,
 
 
 
+void
+ShadingContext::osl_get_attributes(
+    ShaderGlobals* sg, void* objdata,
+    span<RendererServices::AttributeRequest> requests)
+{
+    if (shadingsys().attribute_cache()) {
+        // Any of them may be answered by the cache
+        for (RendererServices::AttributeRequest& r : requests)
+            r.ok = osl_get_attribute(sg, objdata, r.derivatives, r.object,
+                                     r.name, r.index >= 0, r.index, r.type,
+                                     r.val);
+        return;
+    }
+    renderer()->get_attributes(sg, requests);
+}
+
+
+
+const ShadingContext::AttributeCacheEntry*
+ShadingContext::find_cached_attribute(const AttributeCacheKey& key)
+{
+    int epoch = shadingsys().attribute_cache_epoch();
+    if (epoch != m_attribute_cache_epoch) {
+        m_attribute_cache.clear();
+        m_attribute_cache_epoch = epoch;
+        return nullptr;
+    }
+    auto found = m_attribute_cache.find(key);
+    return found != m_attribute_cache.end() ? &found->second : nullptr;
+}
+
+
+
+void
+ShadingContext::cache_attribute(const AttributeCacheKey& key, bool ok,
+                                const void* value)
+{
+    AttributeCacheEntry& e = m_attribute_cache[key];
+    e.cacheable = renderer()->attribute_is_cacheable(key.object, key.type,
+                                                     key.name);
+    e.ok        = ok;
+    if (e.cacheable && ok)
+        e.value.assign((const char*)value,
+                       (const char*)value + key.type.size());
+}
+
+
+
+void
+ShadingContext::next_debug_sample()
+{
+    // A per-context xorshift rather than a count, so the checked shades
+    // don't fall in step with whatever order the renderer shades in.
+    int n = shadingsys().debug_sample();
+    if (n > 1) {
+        uint32_t x = m_debug_sample_rng;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        m_debug_sample_rng = x;
+        m_debug_sampled    = x % uint32_t(n) == 0;
+    } else {
+        m_debug_sampled = true;
+    }
+}
+
+
+
+// Does this shade run the debug checks that "debug_sample" thins out?
+OSL_SHADEOP int
+osl_debug_sampled(ShaderGlobals* sg)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    return ctx->debug_sampled();
+}
+
+
+
 OSL_SHADEOP void
 osl_incr_layers_executed(ShaderGlobals* sg)
 {
@@ -664,10 +1198,21 @@ osl_incr_layers_executed(ShaderGlobals* sg)
     ctx->incr_layers_executed();
 }
 
+
+
+// Read profile_clock() for "profile_instrument" probes, where JITed code
+// can't read it inline
+OSL_SHADEOP void
+osl_profile_clock(void* ticks)
+{
+    *(long long*)ticks = pvt::profile_clock();
+}
+
 #if OSL_USE_BATCHED
 // Explicit template instantiation for supported batch sizes
 template class ShadingContext::Batched<16>;
 template class ShadingContext::Batched<8>;
+template class ShadingContext::Batched<4>;
 #endif
 
 
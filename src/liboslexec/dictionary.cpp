@@ -2,9 +2,11 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <atomic>
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -25,7 +27,7 @@ OSL_NAMESPACE_ENTER
 namespace pvt {  // OSL::pvt
 
 
-// Helper class to manage the dictionaries.
+// Helper classes to manage the dictionaries.
 //
 // Shaders are written as if they parse arbitrary things from whole
 // cloth on every call: from potentially loading XML from disk, parsing
@@ -34,63 +36,267 @@ namespace pvt {  // OSL::pvt
 // But that is expensive, so we really cache all this stuff at several
 // levels.
 //
-// We have parsed xml (as pugi::xml_document *'s) cached in a hash table,
-// looked up by the xml and/or dictionary name.  Either will do, if it
-// looks like a filename, it will read the XML from the file, otherwise it
-// will interpret it as xml directly.
+// The SharedDictionary, one per ShadingSystem, holds what every context
+// can reuse: the parsed xml (as pugi::xml_document's), looked up by the
+// xml and/or dictionary name -- either will do, if it looks like a
+// filename, it will read the XML from the file, otherwise it will
+// interpret it as xml directly -- the compiled XPath queries, and the
+// nodes each query found.  Node IDs are indices into its node table, so
+// they mean the same thing in every context, and the optimizer can fold
+// dict_find calls with constant arguments into constant node IDs.
 //
-// Also, individual queries are cached in a hash table.  The key is a
+// Each ShadingContext's Dictionary caches, without any locking, the
+// query results and decoded values it has asked for.  The key is a
 // tuple of (nodeID, query_string, type_requested), so that asking for a
 // particular query to return a string is a totally different cache
 // entry than asking for it to be converted to a matrix, say.
 //
-class Dictionary {
+
+namespace {
+
+// We cache individual queries with a key that is a tuple of the
+// (nodeID, query_string, type_requested).
+struct Query {
+    int document;   // which dictionary document
+    int node;       // root node for the search
+    ustring name;   // name for the the search
+    TypeDesc type;  // UNKNOWN signifies a node, versus an attribute value
+    Query(int doc_, int node_, ustring name_,
+          TypeDesc type_ = TypeDesc::UNKNOWN)
+        : document(doc_), node(node_), name(name_), type(type_)
+    {
+    }
+    bool operator==(const Query& q) const
+    {
+        return document == q.document && node == q.node && name == q.name
+               && type == q.type;
+    }
+};
+
+// Must define a hash operation to build the unordered_map.
+struct QueryHash {
+    size_t operator()(const Query& key) const
+    {
+        return key.name.hash() + 17 * key.node + 79 * key.document;
+    }
+};
+
+}  // namespace
+
+
+
+class SharedDictionary {
 public:
-    Dictionary(ShadingContext* ctx) : m_context(ctx)
+    // Nodes we've looked up.  Includes a 'next' index of the matching node
+    // for the query that generated this one.
+    struct Node {
+        int document;         // which document the node belongs to
+        pugi::xml_node node;  // which node within the dictionary
+        int next;             // next node for the same query
+    };
+
+    SharedDictionary()
     {
         // Create placeholder element 0 == 'not found'
-        m_nodes.emplace_back(0, pugi::xml_node());
+        m_chunks[0].reset(new Node[chunk_size]);
+        m_chunks[0][0] = { 0, pugi::xml_node(), 0 };
+        m_nnodes       = 1;
     }
-    ~Dictionary()
+
+    // Return the index of the named document, reading or parsing it the
+    // first time, or -1 (and set errmessage) if it doesn't parse.
+    int document(ustring dictionaryname, std::string& errmessage);
+
+    // Run the query from the root of the document (node == 0) or from
+    // the given node of it, returning the first match (0 if none).  Set
+    // errmessage if the query is invalid.
+    int find(int document, int node, ustring query, std::string& errmessage);
+
+    // The node with the given ID, or nullptr if there is none.  Nodes are
+    // never moved or changed once they are visible, so this takes no lock.
+    const Node* node(int nodeID) const
     {
-        // Free all the documents.
-        for (auto& doc : m_documents)
-            delete doc;
+        if (nodeID <= 0 || nodeID >= m_nnodes.load(std::memory_order_acquire))
+            return nullptr;
+        return &m_chunks[nodeID >> chunk_bits][nodeID & (chunk_size - 1)];
     }
 
-    int dict_find(ustring dictionaryname, ustring query);
-    int dict_find(int nodeID, ustring query);
-    int dict_next(int nodeID);
-    int dict_value(int nodeID, ustring attribname, TypeDesc type, void* data);
-
 private:
-    // We cache individual queries with a key that is a tuple of the
-    // (nodeID, query_string, type_requested).
-    struct Query {
-        int document;   // which dictionary document
-        int node;       // root node for the search
-        ustring name;   // name for the the search
-        TypeDesc type;  // UNKNOWN signifies a node, versus an attribute value
-        Query(int doc_, int node_, ustring name_,
-              TypeDesc type_ = TypeDesc::UNKNOWN)
-            : document(doc_), node(node_), name(name_), type(type_)
-        {
+    static constexpr int chunk_bits = 12;
+    static constexpr int chunk_size = 1 << chunk_bits;
+    static constexpr int max_chunks = 4096;  // So at most 16M nodes
+
+    struct Compiled {
+        std::unique_ptr<pugi::xpath_query> query;
+        std::string error;  // Why it didn't compile
+    };
+
+    spin_rw_mutex m_mutex;  // Guards all but the nodes already visible
+    std::vector<std::unique_ptr<pugi::xml_document>> m_documents;
+    std::unordered_map<ustring, int> m_document_map;  // name -> document
+    std::unordered_map<ustring, std::string> m_document_errors;
+    std::unordered_map<ustring, Compiled> m_compiled;  // XPath queries
+    std::unordered_map<Query, int, QueryHash> m_results;  // -> first match
+    std::unique_ptr<Node[]> m_chunks[max_chunks];
+    std::atomic<int> m_nnodes;
+};
+
+
+
+int
+SharedDictionary::document(ustring dictionaryname, std::string& errmessage)
+{
+    {
+        LockWait wait(LockSite::Dictionary);
+        spin_rw_read_lock lock(m_mutex);
+        wait.done();
+        auto found = m_document_map.find(dictionaryname);
+        if (found != m_document_map.end()) {
+            if (found->second < 0)
+                errmessage = m_document_errors.at(dictionaryname);
+            return found->second;
         }
-        bool operator==(const Query& q) const
-        {
-            return document == q.document && node == q.node && name == q.name
-                   && type == q.type;
+    }
+
+    // Parse without holding the lock; if another thread beats us to it,
+    // its document wins.
+    std::unique_ptr<pugi::xml_document> doc(new pugi::xml_document);
+    pugi::xml_parse_result parse_result;
+    if (Strutil::ends_with(dictionaryname, ".xml")) {
+        // xml file -- read it
+        parse_result = doc->load_file(dictionaryname.c_str());
+    } else {
+        // load xml directly from the string
+        parse_result = doc->load_string(dictionaryname.c_str());
+    }
+
+    LockWait wait(LockSite::Dictionary);
+    spin_rw_write_lock lock(m_mutex);
+    wait.done();
+    auto found = m_document_map.find(dictionaryname);
+    if (found == m_document_map.end()) {
+        int dindex = -1;
+        if (parse_result) {
+            dindex = (int)m_documents.size();
+            m_documents.push_back(std::move(doc));
+        } else {
+            m_document_errors[dictionaryname]
+                = fmtformat("XML parsed with errors: {}, at offset {}",
+                            parse_result.description(), parse_result.offset);
         }
-    };
+        found = m_document_map.emplace(dictionaryname, dindex).first;
+    }
+    if (found->second < 0)
+        errmessage = m_document_errors[dictionaryname];
+    return found->second;
+}
 
-    // Must define a hash operation to build the unordered_map.
-    struct QueryHash {
-        size_t operator()(const Query& key) const
-        {
-            return key.name.hash() + 17 * key.node + 79 * key.document;
+
+
+int
+SharedDictionary::find(int document, int nodeID, ustring query,
+                       std::string& errmessage)
+{
+    Query q(document, nodeID, query);
+    const pugi::xpath_query* xquery = nullptr;
+    pugi::xml_node root;
+    {
+        LockWait wait(LockSite::Dictionary);
+        spin_rw_read_lock lock(m_mutex);
+        wait.done();
+        auto found = m_results.find(q);
+        if (found != m_results.end())
+            return found->second;
+        auto compiled = m_compiled.find(query);
+        if (compiled != m_compiled.end()) {
+            if (!compiled->second.query) {
+                errmessage = compiled->second.error;
+                return 0;
+            }
+            xquery = compiled->second.query.get();
         }
-    };
+        if (nodeID)
+            root = node(nodeID)->node;
+        else
+            root = *m_documents[document];
+    }
+
+    if (!xquery) {
+        // Compile the query once, for every context and starting node
+        Compiled c;
+        try {
+            c.query.reset(new pugi::xpath_query(query.c_str()));
+        } catch (const pugi::xpath_exception& e) {
+            c.error = fmtformat("Invalid dict_find query '{}': {}", query,
+                                e.what());
+        }
+        LockWait wait(LockSite::Dictionary);
+        spin_rw_write_lock lock(m_mutex);
+        wait.done();
+        auto compiled = m_compiled.emplace(query, std::move(c)).first;
+        if (!compiled->second.query) {
+            errmessage = compiled->second.error;
+            return 0;
+        }
+        xquery = compiled->second.query.get();
+    }
+
+    // Query was not found.  Do the expensive lookup (documents are never
+    // modified, so other threads may search them too) and cache it.
+    pugi::xpath_node_set matches;
+    try {
+        matches = root.select_nodes(*xquery);
+    } catch (const pugi::xpath_exception& e) {
+        errmessage = fmtformat("Invalid dict_find query '{}': {}", query,
+                               e.what());
+        return 0;
+    }
+
+    LockWait wait(LockSite::Dictionary);
+    spin_rw_write_lock lock(m_mutex);
+    wait.done();
+    auto found = m_results.find(q);
+    if (found != m_results.end())
+        return found->second;  // Another thread got there first
+
+    int nnodes = m_nnodes.load(std::memory_order_relaxed);
+    if (nnodes + matches.size() > size_t(max_chunks) * chunk_size) {
+        errmessage = fmtformat("Too many dict_find matches, for query '{}'",
+                               query);
+        return 0;
+    }
+    int firstmatch = matches.empty() ? 0 : nnodes;
+    for (auto&& m : matches) {
+        std::unique_ptr<Node[]>& chunk(m_chunks[nnodes >> chunk_bits]);
+        if (!chunk)
+            chunk.reset(new Node[chunk_size]);
+        // Each match's 'next' is the one after it, the last one's is 0
+        int next = nnodes + 1 - firstmatch < int(matches.size()) ? nnodes + 1
+                                                                 : 0;
+        chunk[nnodes & (chunk_size - 1)] = { document, m.node(), next };
+        ++nnodes;
+    }
+    // Make the new nodes visible before their IDs are handed out
+    m_nnodes.store(nnodes, std::memory_order_release);
+    m_results[q] = firstmatch;
+    return firstmatch;
+}
+
+
+
+class Dictionary {
+public:
+    Dictionary(ShadingContext* ctx)
+        : m_context(ctx), m_shared(ctx->shadingsys().shared_dictionary())
+    {
+    }
+
+    int dict_find(ustring dictionaryname, ustring query);
+    int dict_find(int nodeID, ustring query);
+    int dict_next(int nodeID);
+    int dict_value(int nodeID, ustring attribname, TypeDesc type, void* data);
 
+private:
     // The cached query result is mostly just a 'valueoffset', which is
     // the index into floatdata/intdata/stringdata (depending on the type
     // being asked for) at which the decoded data live, or a node ID
@@ -105,31 +311,17 @@ private:
         }
     };
 
-    // Nodes we've looked up.  Includes a 'next' index of the matching node
-    // for the query that generated this one.
-    struct Node {
-        int document;         // which document the node belongs to
-        pugi::xml_node node;  // which node within the dictionary
-        int next;             // next node for the same query
-        Node(int d, const pugi::xml_node& n) : document(d), node(n), next(0) {}
-    };
-
     typedef std::unordered_map<Query, QueryResult, QueryHash> QueryMap;
     typedef std::unordered_map<ustring, int> DocMap;
 
     ShadingContext* m_context;  // back-pointer to shading context
+    SharedDictionary& m_shared;  // documents and nodes of all contexts
 
-    // List of XML documents we've read in.
-    std::vector<pugi::xml_document*> m_documents;
-
-    // Map xml strings and/or filename to indices in m_documents.
+    // Map xml strings and/or filename to the shared document indices.
     DocMap m_document_map;
 
     // Cache of fully resolved queries.
-    Dictionary::QueryMap m_cache;  // query cache
-
-    // List of all the nodes we've found by queries.
-    std::vector<Dictionary::Node> m_nodes;
+    QueryMap m_cache;  // query cache
 
     // m_floatdata, m_intdata, and m_stringdata hold the decoded data
     // results (including type conversion) of cached queries.
@@ -139,6 +331,10 @@ private:
 
     // Helper function: return the document index given dictionary name.
     int get_document_index(ustring dictionaryname);
+
+    // Helper function: the first node matching the query, from the root
+    // of the document (nodeID 0) or the given node of it.
+    int find(int document, int nodeID, ustring query);
 };
 
 
@@ -147,128 +343,59 @@ int
 Dictionary::get_document_index(ustring dictionaryname)
 {
     DocMap::iterator dm = m_document_map.find(dictionaryname);
-    int dindex;
-    if (dm == m_document_map.end()) {
-        dindex                         = m_documents.size();
-        m_document_map[dictionaryname] = dindex;
-        pugi::xml_document* doc        = new pugi::xml_document;
-        m_documents.push_back(doc);
-        pugi::xml_parse_result parse_result;
-        if (Strutil::ends_with(dictionaryname, ".xml")) {
-            // xml file -- read it
-            parse_result = doc->load_file(dictionaryname.c_str());
-        } else {
-            // load xml directly from the string
-            parse_result = doc->load_string(dictionaryname.c_str());
-        }
-        if (!parse_result) {
-            m_context->errorfmt("XML parsed with errors: {}, at offset {}",
-                                parse_result.description(),
-                                parse_result.offset);
-            m_document_map[dictionaryname] = -1;
-            return -1;
-        }
-    } else {
-        dindex = dm->second;
-    }
-
-    OSL_DASSERT(dindex < (int)m_documents.size());
+    if (dm != m_document_map.end())
+        return dm->second;
+    std::string err;
+    int dindex                     = m_shared.document(dictionaryname, err);
+    m_document_map[dictionaryname] = dindex;
+    if (dindex < 0)
+        m_context->errorfmt("{}", err);
     return dindex;
 }
 
 
 
 int
-Dictionary::dict_find(ustring dictionaryname, ustring query)
+Dictionary::find(int document, int nodeID, ustring query)
 {
-    int dindex = get_document_index(dictionaryname);
-    if (dindex < 0)
-        return dindex;
-
-    Query q(dindex, 0, query);
+    Query q(document, nodeID, query);
     QueryMap::iterator qfound = m_cache.find(q);
     if (qfound != m_cache.end()) {
         return qfound->second.valueoffset;
     }
 
-    pugi::xml_document* doc = m_documents[dindex];
-
-    // Query was not found.  Do the expensive lookup and cache it
-    pugi::xpath_node_set matches;
-
-    try {
-        matches = doc->select_nodes(query.c_str());
-    } catch (const pugi::xpath_exception& e) {
-        m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                            e.what());
+    // Query was not found here, ask the shared cache
+    std::string err;
+    int firstmatch = m_shared.find(document, nodeID, query, err);
+    if (!err.empty()) {
+        m_context->errorfmt("{}", err);
         return 0;
     }
-
-    if (matches.empty()) {
-        m_cache[q] = QueryResult(false);  // mark invalid
-        return 0;                         // Not found
-    }
-    int firstmatch = (int)m_nodes.size();
-    int last       = -1;
-    for (auto&& m : matches) {
-        m_nodes.emplace_back(dindex, m.node());
-        int nodeid = (int)m_nodes.size() - 1;
-        if (last < 0) {
-            // If this is the first match, add a cache entry for it
-            m_cache[q] = QueryResult(true /* it's a node */, nodeid);
-        } else {
-            // If this is a subsequent match, set the last match's 'next'
-            m_nodes[last].next = nodeid;
-        }
-        last = nodeid;
-    }
+    m_cache[q] = firstmatch ? QueryResult(true /* it's a node */, firstmatch)
+                            : QueryResult(false);  // mark invalid
     return firstmatch;
 }
 
 
 
 int
-Dictionary::dict_find(int nodeID, ustring query)
+Dictionary::dict_find(ustring dictionaryname, ustring query)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
-        return 0;  // invalid node ID
+    int dindex = get_document_index(dictionaryname);
+    if (dindex < 0)
+        return dindex;
+    return find(dindex, 0, query);
+}
 
-    int document = m_nodes[nodeID].document;
-    Query q(document, nodeID, query);
-    QueryMap::iterator qfound = m_cache.find(q);
-    if (qfound != m_cache.end()) {
-        return qfound->second.valueoffset;
-    }
 
-    // Query was not found.  Do the expensive lookup and cache it
-    pugi::xpath_node_set matches;
-    try {
-        matches = m_nodes[nodeID].node.select_nodes(query.c_str());
-    } catch (const pugi::xpath_exception& e) {
-        m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                            e.what());
-        return 0;
-    }
 
-    if (matches.empty()) {
-        m_cache[q] = QueryResult(false);  // mark invalid
-        return 0;                         // Not found
-    }
-    int firstmatch = (int)m_nodes.size();
-    int last       = -1;
-    for (auto&& m : matches) {
-        m_nodes.emplace_back(document, m.node());
-        int nodeid = (int)m_nodes.size() - 1;
-        if (last < 0) {
-            // If this is the first match, add a cache entry for it
-            m_cache[q] = QueryResult(true /* it's a node */, nodeid);
-        } else {
-            // If this is a subsequent match, set the last match's 'next'
-            m_nodes[last].next = nodeid;
-        }
-        last = nodeid;
-    }
-    return firstmatch;
+int
+Dictionary::dict_find(int nodeID, ustring query)
+{
+    const SharedDictionary::Node* node = m_shared.node(nodeID);
+    if (!node)
+        return 0;  // invalid node ID
+    return find(node->document, nodeID, query);
 }
 
 
@@ -276,9 +403,10 @@ Dictionary::dict_find(int nodeID, ustring query)
 int
 Dictionary::dict_next(int nodeID)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
+    const SharedDictionary::Node* node = m_shared.node(nodeID);
+    if (!node)
         return 0;  // invalid node ID
-    return m_nodes[nodeID].next;
+    return node->next;
 }
 
 
@@ -287,11 +415,12 @@ int
 Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
                        void* data)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
+    const SharedDictionary::Node* nodeptr = m_shared.node(nodeID);
+    if (!nodeptr)
         return 0;  // invalid node ID
 
-    const Dictionary::Node& node(m_nodes[nodeID]);
-    Dictionary::Query q(node.document, nodeID, attribname, type);
+    const SharedDictionary::Node& node(*nodeptr);
+    Query q(node.document, nodeID, attribname, type);
     Dictionary::QueryMap::iterator qfound = m_cache.find(q);
     if (qfound != m_cache.end()) {
         // previously found
@@ -374,6 +503,56 @@ Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
 }
 
 
+
+SharedDictionary&
+ShadingSystemImpl::shared_dictionary()
+{
+    SharedDictionary* dict = m_shared_dictionary.load();
+    if (!dict) {
+        SharedDictionary* created = new SharedDictionary;
+        if (m_shared_dictionary.compare_exchange_strong(dict, created))
+            dict = created;
+        else
+            delete created;  // another thread made it first
+    }
+    return *dict;
+}
+
+
+
+int
+ShadingSystemImpl::dict_find(ustring dictionaryname, ustring query,
+                             std::string& errmessage)
+{
+    SharedDictionary& dict(shared_dictionary());
+    int dindex = dict.document(dictionaryname, errmessage);
+    if (dindex < 0)
+        return dindex;
+    return dict.find(dindex, 0, query, errmessage);
+}
+
+
+
+int
+ShadingSystemImpl::dict_find(int nodeID, ustring query,
+                             std::string& errmessage)
+{
+    SharedDictionary& dict(shared_dictionary());
+    const SharedDictionary::Node* node = dict.node(nodeID);
+    if (!node)
+        return 0;  // invalid node ID
+    return dict.find(node->document, nodeID, query, errmessage);
+}
+
+
+
+void
+ShadingSystemImpl::free_dict_resources()
+{
+    delete m_shared_dictionary.exchange(nullptr);
+}
+
+
 };  // namespace pvt
 
 
@@ -0,0 +1,145 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+// Check that shader groups can be built from many threads at once, and
+// report how construction throughput scales with the thread count.
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <OpenImageIO/argparse.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/sysutil.h>
+#include <OpenImageIO/thread.h>
+#include <OpenImageIO/timer.h>
+#include <OpenImageIO/unittest.h>
+
+#include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+
+using namespace OSL;
+
+
+static int groups_per_thread = 200;
+static int max_threads       = 128;
+static bool verbose          = false;
+
+
+
+// Equivalent of:
+//     shader layer (float in = 0.5, output float out = 0) { out = in; }
+static const char* layer_oso = R"OSO(OpenShadingLanguage 1.00
+# Compiled by oslc 1.13.0
+shader layer
+param	float	in	0.5		%read{0,0} %write{2147483647,-1}
+oparam	float	out	0		%read{2147483647,-1} %write{0,0}
+code ___main___
+	assign		out in 	%line{1} %argrw{"wr"}
+	end
+)OSO";
+
+
+
+static void
+getargs(int argc, char* argv[])
+{
+    bool help = false;
+    OIIO::ArgParse ap;
+    // clang-format off
+    ap.intro("groupbuild_test\n" OIIO_INTRO_STRING);
+    ap.usage("groupbuild_test [options]");
+    ap.arg("-v", &verbose)
+      .help("Verbose output");
+    ap.arg("--groups %d:N", &groups_per_thread)
+      .help("Groups built by each thread");
+    ap.arg("--threads %d:N", &max_threads)
+      .help("Largest thread count to try");
+    // clang-format on
+    if (ap.parse(argc, (const char**)argv) < 0) {
+        std::cerr << ap.geterror() << std::endl;
+        ap.usage();
+        exit(EXIT_FAILURE);
+    }
+    if (help) {
+        ap.usage();
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+
+// Build a three layer chain, alternating between the explicit-group calls
+// and the per-thread "current group" calls so that both get exercised.
+static bool
+build_group(ShadingSystem& ss, int thread, int index)
+{
+    bool ok = true;
+    ShaderGroupRef group
+        = ss.ShaderGroupBegin(OIIO::Strutil::fmt::format("g_{}_{}", thread,
+                                                         index));
+    if (index & 1) {
+        float in = float(index);
+        ok &= ss.Parameter(*group, "in", TypeDesc::TypeFloat, &in);
+        ok &= ss.Shader(*group, "surface", "layer", "a");
+        ok &= ss.Shader(*group, "surface", "layer", "b");
+        ok &= ss.Shader(*group, "surface", "layer", "c");
+        ok &= ss.ConnectShaders(*group, "a", "out", "b", "in");
+        ok &= ss.ConnectShaders(*group, "b", "out", "c", "in");
+        ok &= ss.ShaderGroupEnd(*group);
+    } else {
+        float in = float(index);
+        ok &= ss.Parameter("in", TypeDesc::TypeFloat, &in);
+        ok &= ss.Shader("surface", "layer", "a");
+        ok &= ss.Shader("surface", "layer", "b");
+        ok &= ss.Shader("surface", "layer", "c");
+        ok &= ss.ConnectShaders("a", "out", "b", "in");
+        ok &= ss.ConnectShaders("b", "out", "c", "in");
+        ok &= ss.ShaderGroupEnd();
+    }
+    int nlayers = 0;
+    ss.getattribute(group.get(), "num_layers", nlayers);
+    return ok && nlayers == 3;
+}
+
+
+
+int
+main(int argc, char* argv[])
+{
+    getargs(argc, argv);
+
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("layer", layer_oso));
+
+    double base_rate = 0.0;
+    for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        std::atomic<int> failures(0);
+        OIIO::Timer timer;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < groups_per_thread; ++i)
+                    if (!build_group(ss, t, i))
+                        ++failures;
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        double time = timer();
+        OIIO_CHECK_EQUAL(failures.load(), 0);
+
+        double rate = nthreads * groups_per_thread / std::max(time, 1e-6);
+        if (nthreads == 1)
+            base_rate = rate;
+        if (verbose || nthreads * 2 > max_threads)
+            std::cout << OIIO::Strutil::fmt::format(
+                "{:4d} threads: {:10.0f} groups/s ({:.2f}x)\n", nthreads,
+                rate, rate / base_rate);
+    }
+
+    return unit_test_failures;
+}
@@ -0,0 +1,770 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+/////////////////////////////////////////////////////////////////////////
+/// \file
+///
+/// Binary snapshots of optimized (but not yet JITed) shader groups.
+///
+/// A snapshot holds what the RuntimeOptimizer leaves behind for each
+/// layer -- the op stream, the op arguments, the symbol table including
+/// the values of all resolved constants, and the connections -- plus the
+/// group-wide needs (textures, closures, globals, userdata, attributes)
+/// that it gathered.  Loading a snapshot into a freshly built group
+/// makes it look just as if it had been optimized, so the next
+/// optimize_group() goes straight to code generation.
+///
+/// Strings are stored once each in a table at the head of the file and
+/// referenced by index.  Pointers are never stored: constant values are
+/// copied into the shading system's constant pools at load time, and
+/// params get their data from the instance, exactly as
+/// copy_code_from_master would set them up.
+///
+/////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "oslexec_pvt.h"
+
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/hash.h>
+#include <OpenImageIO/strutil.h>
+
+
+
+OSL_NAMESPACE_ENTER
+
+namespace pvt {  // OSL::pvt
+
+
+namespace {
+
+static const char snapshot_magic[8] = { 'O', 'S', 'L', 'G', 'S', 'N', 'P', 0 };
+static const uint32_t snapshot_version = 1;
+
+
+
+// Accumulates the snapshot body, collecting the strings it references
+// into a table that gets written ahead of it.
+class SnapshotWriter {
+public:
+    template<typename T> void put(const T& v)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "snapshot values must be plain data");
+        m_body.append((const char*)&v, sizeof(T));
+    }
+    void put(ustring s)
+    {
+        auto found = m_stringids.emplace(s, uint32_t(m_strings.size()));
+        if (found.second)
+            m_strings.push_back(s);
+        put(found.first->second);
+    }
+    template<typename T> void put_vector(const std::vector<T>& v)
+    {
+        put(uint32_t(v.size()));
+        for (auto&& x : v)
+            put(x);
+    }
+
+    // Return the full file contents.
+    std::string finish(uint64_t key) const
+    {
+        std::string out(snapshot_magic, sizeof(snapshot_magic));
+        uint32_t version = snapshot_version;
+        uint32_t oslver  = OSL_LIBRARY_VERSION_CODE;
+        uint32_t nstr    = uint32_t(m_strings.size());
+        out.append((const char*)&version, sizeof(version));
+        out.append((const char*)&oslver, sizeof(oslver));
+        out.append((const char*)&key, sizeof(key));
+        out.append((const char*)&nstr, sizeof(nstr));
+        for (ustring s : m_strings) {
+            uint32_t len = uint32_t(s.length());
+            out.append((const char*)&len, sizeof(len));
+            out.append(s.c_str(), len);
+        }
+        out += m_body;
+        return out;
+    }
+
+private:
+    std::string m_body;
+    std::vector<ustring> m_strings;
+    std::unordered_map<ustring, uint32_t> m_stringids;
+};
+
+
+
+// Sequential reader over a snapshot in memory. Reading past the end or
+// an out-of-range string index just marks the reader as failed, so
+// callers may check ok() once at the end of a section.
+class SnapshotReader {
+public:
+    SnapshotReader(const char* begin, const char* end) : m_p(begin), m_end(end)
+    {
+    }
+    bool ok() const { return m_ok; }
+    void fail() { m_ok = false; }
+
+    template<typename T> T get()
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "snapshot values must be plain data");
+        T v {};
+        if (size_t(m_end - m_p) < sizeof(T)) {
+            m_ok = false;
+            m_p  = m_end;
+            return v;
+        }
+        memcpy((char*)&v, m_p, sizeof(T));
+        m_p += sizeof(T);
+        return v;
+    }
+    ustring get_ustring()
+    {
+        uint32_t i = get<uint32_t>();
+        if (i >= m_strings.size()) {
+            m_ok = false;
+            return ustring();
+        }
+        return m_strings[i];
+    }
+    template<typename T> void get_vector(std::vector<T>& v)
+    {
+        uint32_t n = get<uint32_t>();
+        if (size_t(m_end - m_p) < size_t(n) * sizeof(T)) {
+            m_ok = false;
+            return;
+        }
+        v.resize(n);
+        for (auto&& x : v)
+            x = get<T>();
+    }
+    void get_vector(std::vector<ustring>& v)
+    {
+        uint32_t n = get<uint32_t>();
+        if (size_t(m_end - m_p) < size_t(n) * sizeof(uint32_t)) {
+            m_ok = false;
+            return;
+        }
+        v.resize(n);
+        for (auto&& x : v)
+            x = get_ustring();
+    }
+
+    bool read_header(uint64_t& key)
+    {
+        if (size_t(m_end - m_p) < sizeof(snapshot_magic)
+            || memcmp(m_p, snapshot_magic, sizeof(snapshot_magic)))
+            return false;
+        m_p += sizeof(snapshot_magic);
+        if (get<uint32_t>() != snapshot_version
+            || get<uint32_t>() != OSL_LIBRARY_VERSION_CODE)
+            return false;
+        key           = get<uint64_t>();
+        uint32_t nstr = get<uint32_t>();
+        if (!m_ok || size_t(m_end - m_p) < size_t(nstr) * sizeof(uint32_t))
+            return false;
+        m_strings.reserve(nstr);
+        for (uint32_t i = 0; i < nstr && m_ok; ++i) {
+            uint32_t len = get<uint32_t>();
+            if (size_t(m_end - m_p) < len)
+                return false;
+            m_strings.emplace_back(string_view(m_p, len));
+            m_p += len;
+        }
+        return m_ok;
+    }
+
+private:
+    const char* m_p;
+    const char* m_end;
+    bool m_ok = true;
+    std::vector<ustring> m_strings;
+};
+
+
+
+// Flag bits for the boolean Symbol properties.
+enum SnapshotSymFlags : uint32_t {
+    SymHasDerivs      = 1 << 0,
+    SymConnectedDown  = 1 << 1,
+    SymInitialized    = 1 << 2,
+    SymInterpolated   = 1 << 3,
+    SymInteractive    = 1 << 4,
+    SymNoninteractive = 1 << 5,
+    SymAllowconnect   = 1 << 6,
+    SymRendererOutput = 1 << 7,
+    SymReadonly       = 1 << 8,
+    SymVarying        = 1 << 9,
+    SymForcedBool     = 1 << 10,
+};
+
+
+
+void
+write_symbol(SnapshotWriter& out, const Symbol& s)
+{
+    const TypeSpec& t(s.typespec());
+    out.put(s.name());
+    out.put(t.simpletype());
+    out.put(uint8_t(t.is_closure_based()));
+    out.put(t.structure() ? t.structspec()->name() : ustring());
+    out.put(uint8_t(s.symtype()));
+    out.put(uint8_t(s.valuesource()));
+    uint32_t flags = (s.has_derivs() ? SymHasDerivs : 0)
+                     | (s.connected_down() ? SymConnectedDown : 0)
+                     | (s.initialized() ? SymInitialized : 0)
+                     | (s.interpolated() ? SymInterpolated : 0)
+                     | (s.interactive() ? SymInteractive : 0)
+                     | (s.noninteractive() ? SymNoninteractive : 0)
+                     | (s.allowconnect() ? SymAllowconnect : 0)
+                     | (s.renderer_output() ? SymRendererOutput : 0)
+                     | (s.readonly() ? SymReadonly : 0)
+                     | (s.is_varying() ? SymVarying : 0)
+                     | (s.forced_llvm_bool() ? SymForcedBool : 0);
+    out.put(flags);
+    out.put(int32_t(s.size()));
+    out.put(int32_t(s.fieldid()));
+    out.put(int32_t(s.layer()));
+    out.put(int32_t(s.scope()));
+    out.put(int32_t(s.dataoffset()));
+    out.put(int32_t(s.wide_dataoffset()));
+    out.put(int32_t(s.initializers()));
+    out.put(int32_t(s.initbegin()));
+    out.put(int32_t(s.initend()));
+    out.put(int32_t(s.firstread()));
+    out.put(int32_t(s.lastread()));
+    out.put(int32_t(s.firstwrite()));
+    out.put(int32_t(s.lastwrite()));
+
+    // Constants carry their values. Everything else gets its data
+    // pointer from the instance when loaded.
+    TypeDesc type = t.simpletype();
+    uint32_t n    = 0;
+    if (s.is_constant() && s.data() && !t.is_closure_based()
+        && !t.is_structure_based())
+        n = uint32_t(type.aggregate * type.numelements());
+    if (type.basetype == TypeDesc::STRING) {
+        out.put(n);
+        for (uint32_t i = 0; i < n; ++i)
+            out.put(((const ustring*)s.data())[i]);
+    } else if (type.basetype == TypeDesc::INT
+               || type.basetype == TypeDesc::FLOAT) {
+        // int and float are both 4 bytes, copy them as raw bits
+        out.put(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t bits;
+            memcpy(&bits, (const char*)s.data() + 4 * i, 4);
+            out.put(bits);
+        }
+    } else {
+        out.put(uint32_t(0));
+    }
+}
+
+
+
+bool
+read_symbol(SnapshotReader& in, ShaderGroup& group, Symbol& s)
+{
+    ustring name       = in.get_ustring();
+    TypeDesc simple    = in.get<TypeDesc>();
+    bool closure       = in.get<uint8_t>();
+    ustring structname = in.get_ustring();
+    TypeSpec t(simple, closure);
+    if (structname) {
+        int id = TypeSpec::structure_id(structname.c_str());
+        if (!id)
+            return false;  // struct not known to the loaded masters
+        t = TypeSpec(structname.c_str(), id, simple.arraylen);
+    }
+    SymType symtype = SymType(in.get<uint8_t>());
+    s               = Symbol(name, t, symtype);
+    s.valuesource(Symbol::ValueSource(in.get<uint8_t>()));
+    uint32_t flags = in.get<uint32_t>();
+    s.has_derivs(flags & SymHasDerivs);
+    s.connected_down(flags & SymConnectedDown);
+    s.initialized(flags & SymInitialized);
+    s.interpolated(flags & SymInterpolated);
+    s.interactive(flags & SymInteractive);
+    s.noninteractive(flags & SymNoninteractive);
+    s.allowconnect(flags & SymAllowconnect);
+    s.renderer_output(flags & SymRendererOutput);
+    s.readonly(flags & SymReadonly);
+    if (flags & SymVarying)
+        s.make_varying();
+    s.forced_llvm_bool(flags & SymForcedBool);
+    s.size(size_t(in.get<int32_t>()));
+    s.fieldid(in.get<int32_t>());
+    s.layer(in.get<int32_t>());
+    s.scope(in.get<int32_t>());
+    s.dataoffset(in.get<int32_t>());
+    s.wide_dataoffset(in.get<int32_t>());
+    s.initializers(in.get<int32_t>());
+    int initbegin = in.get<int32_t>();
+    int initend   = in.get<int32_t>();
+    s.set_initrange(initbegin, initend);
+    int firstread  = in.get<int32_t>();
+    int lastread   = in.get<int32_t>();
+    int firstwrite = in.get<int32_t>();
+    int lastwrite  = in.get<int32_t>();
+    s.set_read(firstread, lastread);
+    s.set_write(firstwrite, lastwrite);
+
+    uint32_t n = in.get<uint32_t>();
+    if (n && (!in.ok() || n != simple.aggregate * simple.numelements()))
+        return false;
+    if (n && simple.basetype == TypeDesc::STRING) {
+        std::vector<ustring> data(n);
+        for (uint32_t i = 0; i < n; ++i)
+            data[i] = in.get_ustring();
+        s.set_dataptr(SymArena::Absolute,
+                      group.string_constants(data.data(), n));
+    } else if (n
+               && (simple.basetype == TypeDesc::INT
+                   || simple.basetype == TypeDesc::FLOAT)) {
+        std::vector<uint32_t> bits(n);
+        for (uint32_t i = 0; i < n; ++i)
+            bits[i] = in.get<uint32_t>();
+        void* data = simple.basetype == TypeDesc::INT
+                         ? (void*)group.int_constants((const int*)bits.data(),
+                                                      n)
+                         : (void*)group.float_constants(
+                             (const float*)bits.data(), n);
+        s.set_dataptr(SymArena::Absolute, data);
+    } else if (n) {
+        return false;
+    }
+    return in.ok();
+}
+
+
+
+void
+write_op(SnapshotWriter& out, const Opcode& op)
+{
+    out.put(op.opname());
+    out.put(op.method());
+    out.put(op.sourcefile());
+    out.put(int32_t(op.sourceline()));
+    out.put(int32_t(op.firstarg()));
+    out.put(int32_t(op.nargs()));
+    for (int j = 0; j < (int)Opcode::max_jumps; ++j)
+        out.put(int32_t(op.jump(j)));
+    out.put(uint32_t(op.argread_bits()));
+    out.put(uint32_t(op.argwrite_bits()));
+    out.put(uint32_t(op.argtakesderivs_all()));
+    out.put(uint8_t(op.requires_masking()));
+    out.put(uint8_t(op.analysis_flag()));
+}
+
+
+
+Opcode
+read_op(SnapshotReader& in)
+{
+    ustring opname     = in.get_ustring();
+    ustring method     = in.get_ustring();
+    ustring sourcefile = in.get_ustring();
+    int sourceline     = in.get<int32_t>();
+    int firstarg       = in.get<int32_t>();
+    int nargs          = in.get<int32_t>();
+    Opcode op(opname, method, firstarg, nargs);
+    op.source(sourcefile, sourceline);
+    int jumps[Opcode::max_jumps];
+    for (int j = 0; j < (int)Opcode::max_jumps; ++j)
+        jumps[j] = in.get<int32_t>();
+    op.set_jump(jumps[0], jumps[1], jumps[2], jumps[3]);
+    unsigned int read  = in.get<uint32_t>();
+    unsigned int write = in.get<uint32_t>();
+    unsigned int deriv = in.get<uint32_t>();
+    op.set_argbits(read, write, deriv);
+    op.requires_masking(in.get<uint8_t>());
+    op.analysis_flag(in.get<uint8_t>());
+    return op;
+}
+
+
+
+void
+write_connection(SnapshotWriter& out, const Connection& c)
+{
+    out.put(int32_t(c.srclayer));
+    for (const ConnectedParam* p : { &c.src, &c.dst }) {
+        out.put(int32_t(p->param));
+        out.put(int32_t(p->arrayindex));
+        out.put(int32_t(p->channel));
+        out.put(p->type.simpletype());
+        out.put(uint8_t(p->type.is_closure_based()));
+        out.put(p->type.structure() ? p->type.structspec()->name()
+                                    : ustring());
+    }
+}
+
+
+
+Connection
+read_connection(SnapshotReader& in)
+{
+    int srclayer = in.get<int32_t>();
+    ConnectedParam params[2];
+    for (auto& p : params) {
+        p.param            = in.get<int32_t>();
+        p.arrayindex       = in.get<int32_t>();
+        p.channel          = in.get<int32_t>();
+        TypeDesc simple    = in.get<TypeDesc>();
+        bool closure       = in.get<uint8_t>();
+        ustring structname = in.get_ustring();
+        p.type             = TypeSpec(simple, closure);
+        if (structname)
+            p.type = TypeSpec(structname.c_str(), 0, simple.arraylen);
+    }
+    return Connection(srclayer, params[0], params[1]);
+}
+
+}  // namespace
+
+
+
+std::string
+ShadingSystemImpl::group_snapshot_key(const ShaderGroup& group) const
+{
+    // Everything that determines what the optimizer makes of the group:
+    // its masters (and a cheap check that they haven't been recompiled),
+    // the layers, params and connections, and the settings applied after
+    // ShaderGroupEnd.
+    std::string key = fmtformat("opt {} raytypes {} {}\n", optimize(),
+                                group.raytypes_on(), group.raytypes_off());
+    for (int layer = 0, n = group.nlayers(); layer < n; ++layer) {
+        const ShaderMaster* m = group[layer]->master();
+        key += fmtformat("{} {} {}{}\n", m->shadername(), m->osofilename(),
+                         m->num_ops(),
+                         group[layer]->entry_layer() ? " entry" : "");
+    }
+    for (auto&& r : group.m_renderer_outputs)
+        key += fmtformat("out {}\n", r);
+    if (group.m_outputs_only)
+        key += "outputs only\n";
+    key += group.m_source_spec.size() ? group.m_source_spec
+                                      : group.serialize();
+    return key;
+}
+
+
+
+bool
+ShadingSystemImpl::save_group_snapshot(ShaderGroup& group,
+                                       string_view filename)
+{
+    if (!group.m_complete) {
+        errorfmt("save_group_snapshot: group \"{}\" is not complete",
+                 group.name());
+        return false;
+    }
+    if (group.optimized() && group.m_source_spec.empty()) {
+        // The key is computed from the unoptimized group, which we can
+        // no longer reconstruct.
+        errorfmt(
+            "save_group_snapshot: group \"{}\" was already optimized; save it before it is optimized or jitted",
+            group.name());
+        return false;
+    }
+    std::string keystring = group_snapshot_key(group);
+    uint64_t key = OIIO::farmhash::Fingerprint64(keystring.data(),
+                                                 keystring.size());
+
+    optimize_group(group, nullptr, false /* no jit */);
+
+    SnapshotWriter out;
+    {
+        lock_guard lock(group.m_mutex);
+        int nlayers = group.nlayers();
+        for (int layer = 0; layer < nlayers; ++layer) {
+            const ShaderInstance* inst = group[layer];
+            if (!inst->unused() && inst->m_instops.empty()) {
+                errorfmt(
+                    "save_group_snapshot: group \"{}\" no longer has its optimized code",
+                    group.name());
+                return false;
+            }
+        }
+
+        out.put(int32_t(nlayers));
+        out.put(uint8_t(group.does_nothing()));
+        out.put(uint8_t(group.m_unknown_textures_needed));
+        out.put_vector(group.m_textures_needed);
+        out.put(uint8_t(group.m_unknown_closures_needed));
+        out.put_vector(group.m_closures_needed);
+        out.put_vector(group.m_globals_needed);
+        out.put(int32_t(group.m_globals_read));
+        out.put(int32_t(group.m_globals_write));
+        out.put_vector(group.m_userdata_names);
+        out.put_vector(group.m_userdata_types);
+        out.put_vector(group.m_userdata_derivs);
+        out.put_vector(group.m_userdata_layers);
+        out.put(uint8_t(group.m_unknown_attributes_needed));
+        out.put_vector(group.m_attributes_needed);
+        out.put_vector(group.m_attribute_scopes);
+        out.put_vector(group.m_attribute_types);
+
+        for (int layer = 0; layer < nlayers; ++layer) {
+            const ShaderInstance* inst = group[layer];
+            out.put(uint8_t(inst->m_writes_globals));
+            out.put(uint8_t(inst->m_userdata_params));
+            out.put(uint8_t(inst->m_outgoing_connections));
+            out.put(uint8_t(inst->m_renderer_outputs));
+            out.put(uint8_t(inst->m_has_error_op));
+            out.put(uint8_t(inst->m_merged_unused));
+            out.put(int32_t(inst->m_firstparam));
+            out.put(int32_t(inst->m_lastparam));
+            out.put(int32_t(inst->m_maincodebegin));
+            out.put(int32_t(inst->m_maincodeend));
+            out.put(int32_t(inst->m_Psym));
+            out.put(int32_t(inst->m_Nsym));
+            out.put_vector(inst->m_folded_params);
+            out.put(uint32_t(inst->m_instsymbols.size()));
+            for (auto&& s : inst->m_instsymbols)
+                write_symbol(out, s);
+            out.put(uint32_t(inst->m_instops.size()));
+            for (auto&& op : inst->m_instops)
+                write_op(out, op);
+            out.put_vector(inst->m_instargs);
+            out.put(uint32_t(inst->m_connections.size()));
+            for (auto&& c : inst->m_connections)
+                write_connection(out, c);
+        }
+    }
+
+    std::string contents = out.finish(key);
+    OIIO::ofstream file;
+    OIIO::Filesystem::open(file, filename, std::ios::out | std::ios::binary);
+    if (!file.good()) {
+        errorfmt("save_group_snapshot: could not open \"{}\"", filename);
+        return false;
+    }
+    file.write(contents.data(), contents.size());
+    file.close();
+    if (!file.good()) {
+        errorfmt("save_group_snapshot: error writing \"{}\"", filename);
+        return false;
+    }
+    return true;
+}
+
+
+
+bool
+ShadingSystemImpl::load_group_snapshot(ShaderGroup& group,
+                                       string_view filename)
+{
+    if (!group.m_complete || group.optimized()) {
+        errorfmt(
+            "load_group_snapshot: group \"{}\" must be complete and not yet optimized",
+            group.name());
+        return false;
+    }
+
+    std::string contents;
+    uint64_t filesize = OIIO::Filesystem::file_size(filename);
+    contents.resize(filesize);
+    if (!filesize
+        || OIIO::Filesystem::read_bytes(filename, &contents[0], filesize)
+               != filesize) {
+        errorfmt("load_group_snapshot: could not read \"{}\"", filename);
+        return false;
+    }
+
+    SnapshotReader in(contents.data(), contents.data() + contents.size());
+    uint64_t key = 0;
+    if (!in.read_header(key)) {
+        errorfmt(
+            "load_group_snapshot: \"{}\" is not a snapshot from this version of OSL",
+            filename);
+        return false;
+    }
+    std::string keystring = group_snapshot_key(group);
+    if (key
+        != OIIO::farmhash::Fingerprint64(keystring.data(), keystring.size())) {
+        errorfmt(
+            "load_group_snapshot: \"{}\" was not saved from a group matching \"{}\"",
+            filename, group.name());
+        return false;
+    }
+
+    lock_guard lock(group.m_mutex);
+    int nlayers = in.get<int32_t>();
+    if (nlayers != group.nlayers()) {
+        errorfmt("load_group_snapshot: \"{}\" is corrupt", filename);
+        return false;
+    }
+
+    bool does_nothing             = in.get<uint8_t>();
+    bool unknown_textures_needed  = in.get<uint8_t>();
+    std::vector<ustring> textures_needed;
+    in.get_vector(textures_needed);
+    bool unknown_closures_needed = in.get<uint8_t>();
+    std::vector<ustring> closures_needed, globals_needed;
+    in.get_vector(closures_needed);
+    in.get_vector(globals_needed);
+    int globals_read  = in.get<int32_t>();
+    int globals_write = in.get<int32_t>();
+    std::vector<ustring> userdata_names;
+    std::vector<TypeDesc> userdata_types;
+    std::vector<char> userdata_derivs;
+    std::vector<int> userdata_layers;
+    in.get_vector(userdata_names);
+    in.get_vector(userdata_types);
+    in.get_vector(userdata_derivs);
+    in.get_vector(userdata_layers);
+    bool unknown_attributes_needed = in.get<uint8_t>();
+    std::vector<ustring> attributes_needed, attribute_scopes;
+    std::vector<TypeDesc> attribute_types;
+    in.get_vector(attributes_needed);
+    in.get_vector(attribute_scopes);
+    in.get_vector(attribute_types);
+    size_t nuserdata = userdata_names.size();
+    if (!in.ok() || userdata_types.size() != nuserdata
+        || userdata_derivs.size() != nuserdata
+        || userdata_layers.size() != nuserdata) {
+        errorfmt("load_group_snapshot: \"{}\" is corrupt", filename);
+        return false;
+    }
+
+    // Read every layer before touching the group, so that a bad file
+    // leaves it intact (and still optimizable the usual way).
+    struct LayerState {
+        bool flags[6];
+        int ranges[6];
+        std::vector<char> folded_params;
+        SymbolVec symbols;
+        OpcodeVec ops;
+        std::vector<int> args;
+        ConnectionVec connections;
+    };
+    std::vector<LayerState> layers(nlayers);
+    for (auto& l : layers) {
+        for (auto& f : l.flags)
+            f = in.get<uint8_t>();
+        for (auto& r : l.ranges)
+            r = in.get<int32_t>();
+        in.get_vector(l.folded_params);
+        uint32_t nsyms = in.get<uint32_t>();
+        if (!in.ok() || nsyms > contents.size())
+            break;
+        l.symbols.resize(nsyms);
+        for (auto& s : l.symbols)
+            if (!read_symbol(in, group, s))
+                in.fail();
+        uint32_t nops = in.get<uint32_t>();
+        if (!in.ok() || nops > contents.size())
+            break;
+        l.ops.reserve(nops);
+        for (uint32_t i = 0; i < nops; ++i)
+            l.ops.push_back(read_op(in));
+        in.get_vector(l.args);
+        uint32_t ncon = in.get<uint32_t>();
+        if (!in.ok() || ncon > contents.size())
+            break;
+        l.connections.reserve(ncon);
+        for (uint32_t i = 0; i < ncon; ++i)
+            l.connections.push_back(read_connection(in));
+        for (int a : l.args)
+            if (a < 0 || a >= (int)nsyms)
+                in.fail();
+    }
+    if (!in.ok()) {
+        errorfmt("load_group_snapshot: \"{}\" is corrupt", filename);
+        return false;
+    }
+
+    for (int layer = 0; layer < nlayers; ++layer) {
+        ShaderInstance* inst = group[layer];
+        LayerState& l(layers[layer]);
+
+        // Let copy_code_from_master resolve the instance values (and the
+        // param data pointers) as usual, then give the params in the
+        // snapshot the same data as their namesakes.
+        inst->copy_code_from_master(group);
+        std::unordered_map<ustring, const Symbol*> params;
+        for (auto&& s : inst->m_instsymbols)
+            if (s.symtype() == SymTypeParam
+                || s.symtype() == SymTypeOutputParam)
+                params.emplace(s.name(), &s);
+        for (auto&& s : l.symbols) {
+            if (s.symtype() == SymTypeParam
+                || s.symtype() == SymTypeOutputParam) {
+                auto found = params.find(s.name());
+                if (found != params.end() && found->second->data())
+                    s.set_dataptr(SymArena::Absolute, found->second->data());
+            }
+        }
+
+        off_t symmem = vectorbytes(l.symbols)
+                       - vectorbytes(inst->m_instsymbols);
+        std::swap(inst->m_instsymbols, l.symbols);
+        std::swap(inst->m_instops, l.ops);
+        std::swap(inst->m_instargs, l.args);
+        std::swap(inst->m_connections, l.connections);
+        std::swap(inst->m_folded_params, l.folded_params);
+        inst->m_writes_globals       = l.flags[0];
+        inst->m_userdata_params      = l.flags[1];
+        inst->m_outgoing_connections = l.flags[2];
+        inst->m_renderer_outputs     = l.flags[3];
+        inst->m_has_error_op         = l.flags[4];
+        inst->m_merged_unused        = l.flags[5];
+        inst->m_firstparam           = l.ranges[0];
+        inst->m_lastparam            = l.ranges[1];
+        inst->m_maincodebegin        = l.ranges[2];
+        inst->m_maincodeend          = l.ranges[3];
+        inst->m_Psym                 = l.ranges[4];
+        inst->m_Nsym                 = l.ranges[5];
+
+        spin_lock stat_lock(m_stat_mutex);
+        m_stat_mem_inst_syms += symmem;
+        m_stat_mem_inst += symmem;
+        m_stat_memory += symmem;
+    }
+
+    group.m_does_nothing              = does_nothing;
+    group.m_unknown_textures_needed   = unknown_textures_needed;
+    group.m_textures_needed           = std::move(textures_needed);
+    group.m_unknown_closures_needed   = unknown_closures_needed;
+    group.m_closures_needed           = std::move(closures_needed);
+    group.m_globals_needed            = std::move(globals_needed);
+    group.m_globals_read              = globals_read;
+    group.m_globals_write             = globals_write;
+    group.m_unknown_attributes_needed = unknown_attributes_needed;
+    group.m_attributes_needed         = std::move(attributes_needed);
+    group.m_attribute_scopes          = std::move(attribute_scopes);
+    group.m_attribute_types           = std::move(attribute_types);
+    group.m_userdata_offsets.assign(nuserdata, 0);
+    group.m_userdata_init_vals.assign(nuserdata, nullptr);
+    for (size_t i = 0; i < nuserdata; ++i) {
+        // The initial value is the (loaded) param's own data.
+        int layer = userdata_layers[i];
+        if (layer >= 0 && layer < nlayers) {
+            ShaderInstance* inst = group[layer];
+            int p                = inst->findparam(userdata_names[i]);
+            if (p >= 0)
+                group.m_userdata_init_vals[i] = inst->symbol(p)->data();
+        }
+    }
+    group.m_userdata_names  = std::move(userdata_names);
+    group.m_userdata_types  = std::move(userdata_types);
+    group.m_userdata_derivs = std::move(userdata_derivs);
+    group.m_userdata_layers = std::move(userdata_layers);
+    add_device_strings(group);
+    group.m_optimized = true;
+    return true;
+}
+
+
+};  // namespace pvt
+OSL_NAMESPACE_EXIT
@@ -7,6 +7,7 @@
 #include <string>
 #include <vector>
 
+#include <OpenImageIO/hash.h>
 #include <OpenImageIO/strutil.h>
 
 #include "oslexec_pvt.h"
@@ -38,6 +39,9 @@ ShaderInstance::ShaderInstance(ShaderMaster::ref master, string_view layername)
     , m_merged_unused(false)
     , m_last_layer(false)
     , m_entry_layer(false)
+    , m_batched_compaction_points(0)
+    , m_batched_ops(0)
+    , m_batched_divergent_ops(0)
     , m_firstparam(m_master->m_firstparam)
     , m_lastparam(m_master->m_lastparam)
     , m_maincodebegin(m_master->m_maincodebegin)
@@ -95,14 +99,20 @@ ShaderInstance::~ShaderInstance()
 int
 ShaderInstance::findsymbol(ustring name) const
 {
+    // If we haven't yet copied the syms from the master, get it from there
+    int m = m_master->findsymbol(name);
+    if (m_instsymbols.empty())
+        return m;
+
+    // The copied syms keep the master's indices until the optimizer
+    // collapses them, and only ever move down, so a symbol found where
+    // the master has it is the first of its name.
+    if (m >= 0 && m < (int)m_instsymbols.size()
+        && m_instsymbols[m].name() == name)
+        return m;
     for (size_t i = 0, e = m_instsymbols.size(); i < e; ++i)
         if (m_instsymbols[i].name() == name)
             return (int)i;
-
-    // If we haven't yet copied the syms from the master, get it from there
-    if (m_instsymbols.empty())
-        return m_master->findsymbol(name);
-
     return -1;
 }
 
@@ -111,17 +121,21 @@ ShaderInstance::findsymbol(ustring name) const
 int
 ShaderInstance::findparam(ustring name) const
 {
-    if (m_instsymbols.size())
+    int m = m_master->findsymbol(name);
+    if (m < m_master->m_firstparam || m >= m_master->m_lastparam)
+        m = -1;
+
+    if (m_instsymbols.size()) {
+        if (m >= m_firstparam && m < m_lastparam
+            && m_instsymbols[m].name() == name)
+            return m;
         for (int i = m_firstparam, e = m_lastparam; i < e; ++i)
             if (m_instsymbols[i].name() == name)
                 return i;
+    }
 
     // Not found? Try the master.
-    for (int i = m_firstparam, e = m_lastparam; i < e; ++i)
-        if (master()->symbol(i)->name() == name)
-            return i;
-
-    return -1;
+    return m;
 }
 
 
@@ -363,6 +377,33 @@ ShaderInstance::parameters(const ParamValueList& params,
 
 
 
+int
+ShaderInstance::fold_userdata(ustring name, TypeDesc type, const void* val)
+{
+    int folded = 0;
+    for (int i = firstparam(); i < lastparam(); ++i) {
+        const Symbol* sm    = master()->symbol(i);
+        SymOverrideInfo* so = &m_instoverrides[i];
+        if (sm->name() != name || !so->interpolated() || so->interactive()
+            || sm->typespec().is_closure_based()
+            || sm->typespec().is_structure()
+            || !equivalent(sm->typespec().simpletype(), type))
+            continue;
+        bool connected = false;
+        for (auto&& c : m_connections)
+            connected |= (c.dst.param == i);
+        if (connected)
+            continue;  // The upstream value wins over the userdata
+        so->valuesource(Symbol::InstanceVal);
+        so->interpolated(false);
+        memcpy(param_storage(i), val, type.size());
+        ++folded;
+    }
+    return folded;
+}
+
+
+
 void
 ShaderInstance::make_symbol_room(size_t moresyms)
 {
@@ -728,6 +769,68 @@ ShaderInstance::mergeable(const ShaderInstance& b,
 }
 
 
+
+uint64_t
+ShaderInstance::merge_hash() const
+{
+    // Everything that goes into the key must be something that
+    // mergeable() insists be identical for both instances, otherwise
+    // mergeable instances could land in different buckets.
+    std::vector<uint64_t> key;
+    key.reserve(4 + 7 * m_connections.size() + 4 * m_instops.size()
+                + m_instargs.size());
+    key.push_back(uint64_t(uintptr_t(master())));
+    key.push_back(uint64_t(run_lazily()));
+    for (auto&& c : m_connections) {
+        key.push_back(uint64_t(c.srclayer));
+        key.push_back(uint64_t(c.src.param));
+        key.push_back(uint64_t(c.src.arrayindex));
+        key.push_back(uint64_t(c.src.channel));
+        key.push_back(uint64_t(c.dst.param));
+        key.push_back(uint64_t(c.dst.arrayindex));
+        key.push_back(uint64_t(c.dst.channel));
+    }
+
+    bool optimized = (m_instsymbols.size() != 0 || m_instops.size() != 0);
+    if (!optimized) {
+        // Before optimization, mergeable() compares the values of every
+        // non-closure param that the master says may be used, so those
+        // are what we hash.
+        std::string values;
+        for (int i = firstparam(); i < lastparam(); ++i) {
+            const Symbol* sym = mastersymbol(i);
+            if (!sym->everused_in_group() || sym->typespec().is_closure())
+                continue;
+            if (sym->valuesource() == Symbol::InstanceVal
+                || sym->valuesource() == Symbol::DefaultVal)
+                values.append((const char*)param_storage(i),
+                              sym->typespec().simpletype().size());
+        }
+        key.push_back(OIIO::farmhash::Fingerprint64(values.data(),
+                                                    values.size()));
+    } else {
+        // After optimization, the param values have mostly been folded
+        // into the code, and which symbols count as "used" may differ
+        // between instances that still turn out to be equivalent, so
+        // just hash the code layout, which must match exactly.
+        key.push_back(uint64_t(m_firstparam) << 32 | uint32_t(m_lastparam));
+        key.push_back(uint64_t(m_maincodebegin) << 32
+                      | uint32_t(m_maincodeend));
+        for (auto&& op : m_instops) {
+            key.push_back(op.opname().hash());
+            key.push_back(uint64_t(op.firstarg()) << 32
+                          | uint32_t(op.nargs()));
+            key.push_back(uint64_t(op.jump(0)) << 32 | uint32_t(op.jump(1)));
+            key.push_back(uint64_t(op.jump(2)) << 32 | uint32_t(op.jump(3)));
+        }
+        for (auto&& a : m_instargs)
+            key.push_back(uint64_t(a));
+    }
+    return OIIO::farmhash::Fingerprint64((const char*)key.data(),
+                                         key.size() * sizeof(uint64_t));
+}
+
+
 };  // namespace pvt
 
 
@@ -750,6 +853,7 @@ ShaderGroup::ShaderGroup(const ShaderGroup& g, string_view name)
 {
     m_num_entry_layers = g.m_num_entry_layers;
     m_layers           = g.m_layers;
+    m_constants        = g.m_constants;  // the layers' constants live there
 }
 
 
@@ -772,6 +876,25 @@ ShaderGroup::~ShaderGroup()
 
 
 
+pvt::ProfileSite*
+ShaderGroup::profile_site(int layer, ustring sourcefile, int sourceline)
+{
+    spin_lock lock(m_profile_sites_mutex);
+    auto key = std::make_tuple(layer, sourcefile.c_str(), sourceline);
+    auto found = m_profile_site_index.find(key);
+    if (found != m_profile_site_index.end())
+        return found->second;
+    m_profile_sites.emplace_back();
+    pvt::ProfileSite* site = &m_profile_sites.back();
+    site->layer            = layer;
+    site->sourcefile       = sourcefile;
+    site->sourceline       = sourceline;
+    m_profile_site_index[key] = site;
+    return site;
+}
+
+
+
 int
 ShaderGroup::find_layer(ustring layername) const
 {
@@ -799,6 +922,31 @@ ShaderGroup::find_symbol(ustring layername, ustring symbolname) const
 
 
 
+bool
+ShaderGroup::userdata_placed(int index) const
+{
+    ustring name  = m_userdata_names[index];
+    TypeDesc type = m_userdata_types[index];
+    for (int layer = 0; layer < nlayers(); ++layer) {
+        const ShaderInstance* inst(m_layers[layer].get());
+        for (int p = inst->firstparam(); p < inst->lastparam(); ++p) {
+            const Symbol* sym = inst->symbol(p);
+            if (sym->name() != name || sym->lockgeom()
+                || sym->typespec().is_closure()
+                || !equivalent(sym->typespec().simpletype(), type))
+                continue;
+            ustring layersym = ustring::fmtformat("{}.{}", inst->layername(),
+                                                  name);
+            if (!find_symloc(layersym, SymArena::UserData)
+                && !find_symloc(name, SymArena::UserData))
+                return false;
+        }
+    }
+    return true;
+}
+
+
+
 void
 ShaderGroup::clear_entry_layers()
 {
@@ -820,6 +968,19 @@ ShaderGroup::mark_entry_layer(int layer)
 
 
 
+UdimTileTable*
+ShaderGroup::udim_table(RendererServices::TextureHandle* udim_handle)
+{
+    spin_lock lock(m_udim_tables_mutex);
+    for (auto& table : m_udim_tables)
+        if (table->udim_handle == udim_handle)
+            return table.get();
+    m_udim_tables.emplace_back(new UdimTileTable(udim_handle));
+    return m_udim_tables.back().get();
+}
+
+
+
 std::string
 ShaderGroup::serialize() const
 {
@@ -909,4 +1070,72 @@ ShaderGroup::serialize() const
 }
 
 
+
+std::vector<std::pair<int, Symbol*>>
+ShaderGroup::groupdata_param_order(bool skip_unused_layers)
+{
+    // The group data holds every layer's params. Lay them out so that the
+    // ones used most often share cache lines: estimate each one's "heat"
+    // as the number of op arguments that refer to it, weighted by how
+    // often its layer runs (if there is a profile). Params at least a
+    // quarter as hot as the hottest go in a hot region at the front, the
+    // rest after. Within each region, sorting by decreasing alignment
+    // packs the fields with the least padding.
+    struct Field {
+        std::pair<int, Symbol*> param;
+        bool cold;
+        size_t align;
+        float heat;
+        int seq;
+    };
+    std::vector<Field> fields;
+    long long group_runs = executions();
+    float maxheat        = 0.0f;
+    for (int layer = 0; layer < nlayers(); ++layer) {
+        ShaderInstance* inst = (*this)[layer];
+        if ((skip_unused_layers && inst->unused()) || inst->symbols().empty())
+            continue;
+        std::vector<int> refs(inst->symbols().size(), 0);
+        for (int a : inst->args())
+            if (a >= 0 && a < int(refs.size()))
+                ++refs[a];
+        float weight   = 1.0f;
+        long long runs = layer_executions(layer);
+        if (runs >= 0 && group_runs > 0)
+            weight = std::min(1.0f, float(runs) / float(group_runs));
+        for (int p = inst->firstparam(); p < inst->lastparam(); ++p) {
+            Symbol* sym = inst->symbol(p);
+            if (sym->typespec().is_structure())  // skip the struct itself
+                continue;
+            Field f;
+            f.param = { layer, sym };
+            f.cold  = false;
+            f.align = sym->typespec().is_closure_based()
+                          ? sizeof(void*)
+                          : sym->typespec().simpletype().basesize();
+            // Connections and outputs are touched by other layers too
+            f.heat = weight
+                     * (refs[p] + (sym->connected() || sym->connected_down()));
+            f.seq = int(fields.size());
+            maxheat = std::max(maxheat, f.heat);
+            fields.push_back(f);
+        }
+    }
+    for (auto& f : fields)
+        f.cold = f.heat * 4.0f < maxheat;
+    std::sort(fields.begin(), fields.end(), [](const Field& a, const Field& b) {
+        if (a.cold != b.cold)
+            return b.cold;
+        if (a.align != b.align)
+            return a.align > b.align;
+        return a.seq < b.seq;
+    });
+    std::vector<std::pair<int, Symbol*>> order;
+    order.reserve(fields.size());
+    for (auto& f : fields)
+        order.push_back(f.param);
+    return order;
+}
+
+
 OSL_NAMESPACE_EXIT
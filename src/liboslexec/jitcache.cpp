@@ -0,0 +1,194 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstdlib>
+#include <initializer_list>
+
+#ifndef _WIN32
+#    include <netdb.h>
+#    include <sys/socket.h>
+#    include <sys/time.h>
+#    include <unistd.h>
+#endif
+
+#include <OSL/jitcache.h>
+
+OSL_NAMESPACE_ENTER
+
+
+RedisJITCache::RedisJITCache(string_view host, int port, int ttl,
+                             int timeout_ms, string_view prefix)
+    : m_host(host)
+    , m_port(port)
+    , m_ttl(ttl)
+    , m_timeout_ms(timeout_ms)
+    , m_prefix(prefix)
+{
+}
+
+
+
+#ifndef _WIN32
+
+namespace {
+
+// One connection to a Redis server, speaking just enough of its protocol
+// (RESP) for GET and SET, and closed when it goes out of scope.
+class RedisConnection {
+public:
+    RedisConnection(const std::string& host, int port, int timeout_ms)
+    {
+        addrinfo hints      = {};
+        hints.ai_family     = AF_UNSPEC;
+        hints.ai_socktype   = SOCK_STREAM;
+        addrinfo* addrs     = nullptr;
+        std::string service = fmtformat("{}", port);
+        if (getaddrinfo(host.c_str(), service.c_str(), &hints, &addrs))
+            return;
+        timeval tv;
+        tv.tv_sec  = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        for (addrinfo* a = addrs; a && m_fd < 0; a = a->ai_next) {
+            int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0)
+                continue;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#    ifdef SO_NOSIGPIPE
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#    endif
+            if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+                m_fd = fd;
+            else
+                close(fd);
+        }
+        freeaddrinfo(addrs);
+    }
+
+    ~RedisConnection()
+    {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    bool ok() const { return m_fd >= 0; }
+
+    // Send a command, as an array of bulk strings
+    bool command(std::initializer_list<string_view> args)
+    {
+        std::string request = fmtformat("*{}\r\n", args.size());
+        for (string_view a : args) {
+            request += fmtformat("${}\r\n", a.size());
+            request.append(a.data(), a.size());
+            request += "\r\n";
+        }
+#    ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;  // A closed server mustn't kill us
+#    else
+        const int flags = 0;
+#    endif
+        for (size_t sent = 0; sent < request.size();) {
+            ssize_t n = send(m_fd, request.data() + sent,
+                             request.size() - sent, flags);
+            if (n <= 0)
+                return false;
+            sent += size_t(n);
+        }
+        return true;
+    }
+
+    // Read a line of the reply, without its CRLF
+    bool read_line(std::string& line)
+    {
+        size_t eol;
+        while ((eol = m_buf.find("\r\n", m_pos)) == std::string::npos)
+            if (!fill())
+                return false;
+        line.assign(m_buf, m_pos, eol - m_pos);
+        m_pos = eol + 2;
+        return true;
+    }
+
+    // Read the n bytes of a bulk string, and its CRLF
+    bool read_bulk(size_t n, std::string& data)
+    {
+        while (m_buf.size() - m_pos < n + 2)
+            if (!fill())
+                return false;
+        data.assign(m_buf, m_pos, n);
+        m_pos += n + 2;
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        char chunk[64 * 1024];
+        ssize_t n = recv(m_fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return false;
+        m_buf.erase(0, m_pos);
+        m_pos = 0;
+        m_buf.append(chunk, size_t(n));
+        return true;
+    }
+
+    int m_fd = -1;
+    std::string m_buf;  ///< What's been received
+    size_t m_pos = 0;   ///< How much of m_buf has been read
+};
+
+}  // namespace
+
+
+
+bool
+RedisJITCache::get(string_view key, std::string& data)
+{
+    RedisConnection redis(m_host, m_port, m_timeout_ms);
+    std::string rkey = m_prefix + std::string(key);
+    std::string reply;
+    if (!redis.ok() || !redis.command({ "GET", rkey })
+        || !redis.read_line(reply) || reply.size() < 2 || reply[0] != '$')
+        return false;
+    long long n = std::strtoll(reply.c_str() + 1, nullptr, 10);
+    return n >= 0 && redis.read_bulk(size_t(n), data);  // $-1 for none
+}
+
+
+
+bool
+RedisJITCache::put(string_view key, string_view data)
+{
+    RedisConnection redis(m_host, m_port, m_timeout_ms);
+    std::string rkey = m_prefix + std::string(key);
+    std::string ttl  = fmtformat("{}", m_ttl);
+    std::string reply;
+    if (!redis.ok())
+        return false;
+    bool sent = m_ttl > 0 ? redis.command({ "SET", rkey, data, "EX", ttl })
+                          : redis.command({ "SET", rkey, data });
+    return sent && redis.read_line(reply) && reply == "+OK";
+}
+
+#else
+
+bool
+RedisJITCache::get(string_view /*key*/, std::string& /*data*/)
+{
+    return false;
+}
+
+
+
+bool
+RedisJITCache::put(string_view /*key*/, string_view /*data*/)
+{
+    return false;
+}
+
+#endif
+
+OSL_NAMESPACE_EXIT
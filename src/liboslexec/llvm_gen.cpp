@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cmath>
 
 #include <OpenImageIO/fmath.h>
@@ -35,6 +36,7 @@ static ustring op_for("for");
 static ustring op_format("format");
 static ustring op_fprintf("fprintf");
 static ustring op_ge("ge");
+static ustring op_getattribute("getattribute");
 static ustring op_gt("gt");
 static ustring op_hashnoise("hashnoise");
 static ustring op_if("if");
@@ -122,24 +124,36 @@ BackendLLVM::llvm_call_layer(int layer, bool unconditional)
                             output_base_ptr(), shadeindex() };
 
     ShaderInstance* parent       = group()[layer];
-    llvm::Value* trueval         = ll.constant_bool(true);
-    llvm::Value* layerfield      = layer_run_ref(layer_remap(layer));
     llvm::BasicBlock *then_block = NULL, *after_block = NULL;
     if (!unconditional) {
-        llvm::Value* executed = ll.op_load(layerfield);
-        executed              = ll.op_ne(executed, trueval);
+        llvm::Value* executed = ll.op_not(
+            llvm_layer_has_run(layer_remap(layer)));
         then_block            = ll.new_basic_block("");
         after_block           = ll.new_basic_block("");
-        ll.op_branch(executed, then_block, after_block);
+        float profile         = layer_profile(layer);
+        if (profile >= 0.0f)
+            ll.op_branch(executed, then_block, after_block,
+                         1 + uint32_t(1000.0f * profile),
+                         1 + uint32_t(1000.0f * (1.0f - profile)));
+        else
+            ll.op_branch(executed, then_block, after_block);
         // insert point is now then_block
     }
 
+    // The called layer profiles itself, so charge the time up to the call
+    // and restart the clock after it.
+    if (llvm_profiling())
+        llvm_profile_charge(llvm_profile_clock());
+
     // Mark the call as a fast call
     llvm::Value* funccall
         = ll.call_function(layer_function_name(group(), *parent).c_str(), args);
     if (!parent->entry_layer())
         ll.mark_fast_func_call(funccall);
 
+    if (llvm_profiling())
+        ll.op_store(llvm_profile_clock(), m_llvm_profile_last);
+
     if (!unconditional)
         ll.op_branch(after_block);  // also moves insert point
 
@@ -478,6 +492,55 @@ LLVMGEN(llvm_gen_printf)
 
 
 
+// With the "llvm_vector_triples" option, the add, sub and mul of a triple
+// Result (and its derivs) are done on <3 x float> vectors: one load of
+// each operand, one op, and one store, rather than three of each.  Only
+// the registers are vectors; symbols keep their Vec3 layout, so the group
+// data, the shadeops and the renderer all see the same memory either way.
+static bool
+llvm_use_triple_vectors(BackendLLVM& rop, const Symbol& Result)
+{
+    return rop.shadingsys().llvm_vector_triples()
+           && Result.typespec().is_triple();
+}
+
+
+
+static bool
+llvm_gen_triple_vector_arith(BackendLLVM& rop, char arith, const Symbol& Result,
+                             const Symbol& A, const Symbol& B)
+{
+    llvm::Value* a = rop.llvm_load_triple_vector(A);
+    llvm::Value* b = rop.llvm_load_triple_vector(B);
+    if (!a || !b)
+        return false;
+    llvm::Value* r = arith == '+'   ? rop.ll.op_add(a, b)
+                     : arith == '-' ? rop.ll.op_sub(a, b)
+                                    : rop.ll.op_mul(a, b);
+    rop.llvm_store_triple_vector(r, Result);
+
+    if (Result.has_derivs() && (A.has_derivs() || B.has_derivs())) {
+        for (int d = 1; d <= 2; ++d) {  // dx, dy
+            llvm::Value* ad = rop.llvm_load_triple_vector(A, d);
+            llvm::Value* bd = rop.llvm_load_triple_vector(B, d);
+            llvm::Value* rd;
+            if (arith == '+')
+                rd = rop.ll.op_add(ad, bd);
+            else if (arith == '-')
+                rd = rop.ll.op_sub(ad, bd);
+            else  // Multiplication of duals: a*b.dx + a.dx*b
+                rd = rop.ll.op_add(rop.ll.op_mul(a, bd), rop.ll.op_mul(ad, b));
+            rop.llvm_store_triple_vector(rd, Result, d);
+        }
+    } else if (Result.has_derivs()) {
+        // Result has derivs, operands do not
+        rop.llvm_zero_derivs(Result);
+    }
+    return true;
+}
+
+
+
 LLVMGEN(llvm_gen_add)
 {
     Opcode& op(rop.inst()->ops()[opnum]);
@@ -496,6 +559,9 @@ LLVMGEN(llvm_gen_add)
         return true;
     }
 
+    if (llvm_use_triple_vectors(rop, Result))
+        return llvm_gen_triple_vector_arith(rop, '+', Result, A, B);
+
     TypeDesc type      = Result.typespec().simpletype();
     int num_components = type.aggregate;
 
@@ -543,6 +609,9 @@ LLVMGEN(llvm_gen_sub)
     OSL_DASSERT(!Result.typespec().is_closure_based()
                 && "subtraction of closures not supported");
 
+    if (llvm_use_triple_vectors(rop, Result))
+        return llvm_gen_triple_vector_arith(rop, '-', Result, A, B);
+
     // The following should handle f-f, v-v, v-f, f-v, i-i
     // That's all that should be allowed by oslc.
     for (int i = 0; i < num_components; i++) {
@@ -628,6 +697,9 @@ LLVMGEN(llvm_gen_mul)
         return true;
     }
 
+    if (llvm_use_triple_vectors(rop, Result))
+        return llvm_gen_triple_vector_arith(rop, '*', Result, A, B);
+
     // The following should handle f*f, v*v, v*f, f*v, i*i
     // That's all that should be allowed by oslc.
     for (int i = 0; i < num_components; i++) {
@@ -816,6 +888,16 @@ LLVMGEN(llvm_gen_neg)
     Symbol& Result = *rop.opargsym(op, 0);
     Symbol& A      = *rop.opargsym(op, 1);
 
+    if (llvm_use_triple_vectors(rop, Result)) {
+        for (int d = 0; d < (Result.has_derivs() ? 3 : 1); ++d) {
+            llvm::Value* a = rop.llvm_load_triple_vector(A, d);
+            if (!a)
+                return false;
+            rop.llvm_store_triple_vector(rop.ll.op_neg(a), Result, d);
+        }
+        return true;
+    }
+
     TypeDesc type      = Result.typespec().simpletype();
     int num_components = type.aggregate;
     for (int d = 0; d < 3; ++d) {  // dx, dy
@@ -1973,6 +2055,43 @@ LLVMGEN(llvm_gen_regex)
 
 
 
+// Does llvm_ops.cpp compile the shadeops of this op in both precisions,
+// OIIO's fast_* approximations and the system math library?
+static bool
+has_precision_variants(ustring opname)
+{
+    static const ustring ops[]
+        = { ustring("sin"),  ustring("cos"),   ustring("tan"),
+            ustring("asin"), ustring("acos"),  ustring("atan"),
+            ustring("atan2"), ustring("sinh"), ustring("cosh"),
+            ustring("tanh"), ustring("sincos"), ustring("log"),
+            ustring("log2"), ustring("log10"), ustring("exp"),
+            ustring("exp2"), ustring("expm1"), ustring("pow"),
+            ustring("erf"),  ustring("erfc"),  ustring("cbrt") };
+    for (ustring o : ops)
+        if (o == opname)
+            return true;
+    return false;
+}
+
+
+
+// The start of the name of the shadeop implementing op: "osl_NAME_", or
+// for the transcendentals when the math_precision option asks for the
+// precision the build didn't default to, "osl_fast_NAME_" or
+// "osl_exact_NAME_".
+static std::string
+shadeop_prefix(BackendLLVM& rop, ustring opname)
+{
+    std::string name("osl_");
+    if (rop.shadingsys().fast_math() != bool(OSL_FAST_MATH)
+        && has_precision_variants(opname))
+        name += OSL_FAST_MATH ? "exact_" : "fast_";
+    return name + opname.string() + "_";
+}
+
+
+
 // Generic llvm code generation.  See the comments in llvm_ops.cpp for
 // the full list of assumptions and conventions.  But in short:
 //   1. All polymorphic and derivative cases implemented as functions in
@@ -2020,7 +2139,7 @@ LLVMGEN(llvm_gen_generic)
             || op.opname() == op_sign)
             any_deriv_args = false;
 
-    std::string name = std::string("osl_") + op.opname().string() + "_";
+    std::string name = shadeop_prefix(rop, op.opname());
     for (int i = 0; i < op.nargs(); ++i) {
         Symbol* s(rop.opargsym(op, i));
         if (any_deriv_args && Result.has_derivs() && s->has_derivs()
@@ -2071,7 +2190,7 @@ LLVMGEN(llvm_gen_sincos)
     bool theta_deriv   = Theta.has_derivs();
     bool result_derivs = (Sin_out.has_derivs() || Cos_out.has_derivs());
 
-    std::string name = std::string("osl_sincos_");
+    std::string name = shadeop_prefix(rop, op.opname());
     for (int i = 0; i < op.nargs(); ++i) {
         Symbol* s(rop.opargsym(op, i));
         if (s->has_derivs() && result_derivs && theta_deriv)
@@ -2445,6 +2564,51 @@ llvm_gen_texture_options(BackendLLVM& rop, int opnum, int first_optional_arg,
 
 
 
+// Return the handle of the tile of a udim texture that (s,t) falls in.
+// The generated code looks the tile up in the group's UdimTileTable, and
+// only calls out to the renderer (through osl_resolve_udim) the first time
+// a tile is needed.
+static llvm::Value*
+llvm_udim_tile_handle(BackendLLVM& rop,
+                      RendererServices::TextureHandle* udim_handle,
+                      llvm::Value* s, llvm::Value* t)
+{
+    LLVM_Util& ll        = rop.ll;
+    UdimTileTable* table = rop.group().udim_table(udim_handle);
+    llvm::Value* zero    = ll.constant(0.0f);
+    llvm::Value* in_table
+        = ll.op_and(ll.op_and(ll.op_ge(s, zero, true),
+                              ll.op_lt(s, ll.constant(float(table->ncols)),
+                                       true)),
+                    ll.op_and(ll.op_ge(t, zero, true),
+                              ll.op_lt(t, ll.constant(float(table->nrows)),
+                                       true)));
+    llvm::Value* index
+        = ll.op_add(ll.op_mul(ll.op_float_to_int(t), ll.constant(table->ncols)),
+                    ll.op_float_to_int(s));
+    index             = ll.op_select(in_table, index, ll.constant(0));
+    llvm::Value* tile = ll.op_load(
+        ll.type_void_ptr(),
+        ll.GEP(ll.type_void_ptr(),
+               ll.constant_ptr(table->tiles, ll.type_ptr(ll.type_void_ptr())),
+               index));
+    llvm::Value* unknown = ll.op_or(ll.op_not(in_table),
+                                    ll.op_eq(tile, ll.void_ptr_null()));
+
+    llvm::Value* result = ll.op_alloca(ll.type_void_ptr(), 1, "udimtile");
+    ll.op_store(tile, result);
+    llvm::BasicBlock* resolve_block = ll.new_basic_block("resolve_udim");
+    llvm::BasicBlock* after_block   = ll.new_basic_block("");
+    ll.op_branch(unknown, resolve_block, after_block);
+    // insert point is now resolve_block
+    llvm::Value* args[] = { rop.sg_void_ptr(), ll.constant_ptr(table), s, t };
+    ll.op_store(ll.call_function("osl_resolve_udim", args), result);
+    ll.op_branch(after_block);  // insert point is now after_block
+    return ll.op_load(ll.type_void_ptr(), result);
+}
+
+
+
 LLVMGEN(llvm_gen_texture)
 {
     Opcode& op(rop.inst()->ops()[opnum]);
@@ -2480,22 +2644,41 @@ LLVMGEN(llvm_gen_texture)
         // that has the colorspace set.
     }
 
+    // With a constant udim filename, find the tile here, so the texture
+    // call doesn't have to.
+    llvm::Value* handle = rop.ll.constant_ptr(texture_handle);
+    if (texture_handle && !rop.use_optix()
+        && rop.renderer()->is_udim(texture_handle))
+        handle = llvm_udim_tile_handle(rop, texture_handle,
+                                       rop.llvm_load_value(S),
+                                       rop.llvm_load_value(T));
+
+    // If the raytypes we know are on need no derivatives (see
+    // set_raytype_noderivs), filter over the width the renderer gave for
+    // them rather than point sample.
+    float width = 0.0f;
+    if (!user_derivs && !S.has_derivs() && !T.has_derivs())
+        rop.shadingsys().raytype_noderivs(rop.group().raytypes_on(), &width);
+    llvm::Value* stwidth = width > 0.0f ? rop.ll.constant(width) : nullptr;
+
     // Now call the osl_texture function, passing the options and all the
     // explicit args like texture coordinates.
     llvm::Value* args[] = {
         rop.sg_void_ptr(),
         rop.llvm_load_value(Filename),
-        rop.ll.constant_ptr(texture_handle),
+        handle,
         opt,
         rop.llvm_load_value(S),
         rop.llvm_load_value(T),
         user_derivs ? rop.llvm_load_value(*rop.opargsym(op, 4))
+        : stwidth   ? stwidth
                     : rop.llvm_load_value(S, 1),
         user_derivs ? rop.llvm_load_value(*rop.opargsym(op, 5))
                     : rop.llvm_load_value(T, 1),
         user_derivs ? rop.llvm_load_value(*rop.opargsym(op, 6))
                     : rop.llvm_load_value(S, 2),
         user_derivs ? rop.llvm_load_value(*rop.opargsym(op, 7))
+        : stwidth   ? stwidth
                     : rop.llvm_load_value(T, 2),
         rop.ll.constant(nchans),
         rop.ll.void_ptr(rop.llvm_get_pointer(Result, 0)),
@@ -2769,6 +2952,9 @@ llvm_gen_noise_options(BackendLLVM& rop, int opnum, int first_optional_arg)
             rop.ll.call_function("osl_noiseparams_set_impulses", opt,
                                  rop.llvm_load_value(Val, 0, NULL, 0,
                                                      TypeDesc::TypeFloat));
+        } else if (name == Strings::fast && Val.typespec().is_int()) {
+            rop.ll.call_function("osl_noiseparams_set_fast", opt,
+                                 rop.llvm_load_value(Val));
         } else {
             rop.shadingcontext()->errorfmt(
                 "Unknown {} optional argument: \"{}\", <{}> ({}:{})",
@@ -2974,62 +3160,157 @@ LLVMGEN(llvm_gen_noise)
 
 
 
+// The symbols of a getattribute op, which has eight "flavors":
+//   * getattribute (attribute_name, value)
+//   * getattribute (attribute_name, value[])
+//   * getattribute (attribute_name, index, value)
+//   * getattribute (attribute_name, index, value[])
+//   * getattribute (object, attribute_name, value)
+//   * getattribute (object, attribute_name, value[])
+//   * getattribute (object, attribute_name, index, value)
+//   * getattribute (object, attribute_name, index, value[])
+// ObjectName and Index are null for the flavors without them.
+struct GetattributeArgs {
+    Symbol* Result;
+    Symbol* ObjectName;
+    Symbol* Attribute;
+    Symbol* Index;
+    Symbol* Destination;
+
+    GetattributeArgs(BackendLLVM& rop, const Opcode& op)
+    {
+        int nargs = op.nargs();
+        OSL_DASSERT(nargs >= 3 && nargs <= 5);
+        bool array_lookup  = rop.opargsym(op, nargs - 2)->typespec().is_int();
+        bool object_lookup = rop.opargsym(op, 2)->typespec().is_string()
+                             && nargs >= 4;
+        Result      = rop.opargsym(op, 0);
+        ObjectName  = object_lookup ? rop.opargsym(op, 1) : nullptr;
+        Attribute   = rop.opargsym(op, 1 + int(object_lookup));
+        Index       = array_lookup ? rop.opargsym(op, nargs - 2) : nullptr;
+        Destination = rop.opargsym(op, nargs - 1);
+        OSL_DASSERT(!Result->typespec().is_closure_based()
+                    && !Attribute->typespec().is_closure_based()
+                    && !Destination->typespec().is_closure_based());
+    }
+};
+
+
+
+// The end of the run of getattribute ops starting at opnum that may be
+// made as one get_attributes call: ops in a row in one basic block, none
+// reading or writing what an earlier one of them writes.
+static int
+getattribute_batch_end(BackendLLVM& rop, int opnum)
+{
+    const int max_batch = 32;
+    const OpcodeVec& ops(rop.inst()->ops());
+    int limit = std::min(int(ops.size()), opnum + max_batch);
+    std::vector<const Symbol*> written;
+    auto was_written = [&](const Symbol* s) {
+        return s
+               && std::find(written.begin(), written.end(), s)
+                      != written.end();
+    };
+    int end = opnum;
+    for (; end < limit; ++end) {
+        if (ops[end].opname() != op_getattribute
+            || rop.bblockid(end) != rop.bblockid(opnum))
+            break;
+        GetattributeArgs a(rop, ops[end]);
+        if (was_written(a.ObjectName) || was_written(a.Attribute)
+            || was_written(a.Index) || was_written(a.Result)
+            || was_written(a.Destination) || a.Result == a.Destination)
+            break;
+        written.push_back(a.Result);
+        written.push_back(a.Destination);
+    }
+    return end;
+}
+
+
+
 LLVMGEN(llvm_gen_getattribute)
 {
-    // getattribute() has eight "flavors":
-    //   * getattribute (attribute_name, value)
-    //   * getattribute (attribute_name, value[])
-    //   * getattribute (attribute_name, index, value)
-    //   * getattribute (attribute_name, index, value[])
-    //   * getattribute (object, attribute_name, value)
-    //   * getattribute (object, attribute_name, value[])
-    //   * getattribute (object, attribute_name, index, value)
-    //   * getattribute (object, attribute_name, index, value[])
     Opcode& op(rop.inst()->ops()[opnum]);
-    int nargs = op.nargs();
-    OSL_DASSERT(nargs >= 3 && nargs <= 5);
-
-    bool array_lookup  = rop.opargsym(op, nargs - 2)->typespec().is_int();
-    bool object_lookup = rop.opargsym(op, 2)->typespec().is_string()
-                         && nargs >= 4;
-    int object_slot = (int)object_lookup;
-    int attrib_slot = object_slot + 1;
-    int index_slot  = array_lookup ? nargs - 2 : 0;
+    if (rop.in_getattribute_batch(opnum))
+        return true;  // made along with the first of its run
+
+    // A run of independent getattribute calls is made as one call of the
+    // renderer's get_attributes (not with the renderer's free function
+    // bitcode, whose rs_get_attribute calls are better inlined).
+    int end = opnum + 1;
+    if (rop.shadingsys().opt_batch_getattribute() && !rop.use_rs_bitcode()
+        && !rop.use_optix())
+        end = getattribute_batch_end(rop, opnum);
+    if (end - opnum > 1) {
+        int n                  = end - opnum;
+        llvm::Type* fields[]   = { rop.ll.type_ustring(), rop.ll.type_ustring(),
+                                   rop.ll.type_longlong(),
+                                   rop.ll.type_void_ptr(), rop.ll.type_int(),
+                                   rop.ll.type_int() };
+        llvm::Type* query_type = rop.ll.type_struct(fields);
+        llvm::Value* queries   = rop.ll.op_alloca(query_type, n);
+        llvm::Value* results   = rop.ll.op_alloca(rop.ll.type_int(), n);
+        for (int i = 0; i < n; ++i) {
+            GetattributeArgs a(rop, rop.inst()->ops()[opnum + i]);
+            llvm::Value* vals[] = {
+                a.ObjectName ? rop.llvm_load_value(*a.ObjectName)
+                             : rop.llvm_load_string(ustring()),
+                rop.llvm_load_value(*a.Attribute),
+                rop.ll.constant(a.Destination->typespec().simpletype()),
+                rop.llvm_void_ptr(*a.Destination),
+                a.Index ? rop.llvm_load_value(*a.Index) : rop.ll.constant(-1),
+                rop.ll.constant((int)a.Destination->has_derivs()),
+            };
+            for (int f = 0; f < 6; ++f)
+                rop.ll.op_store(vals[f],
+                                rop.ll.GEP(query_type, queries, i, f));
+        }
+        llvm::Value* args[] = { rop.sg_void_ptr(), rop.ll.void_ptr(queries),
+                                rop.ll.constant(n), rop.ll.void_ptr(results) };
+        rop.ll.call_function("osl_get_attributes", args);
+        for (int i = 0; i < n; ++i) {
+            GetattributeArgs a(rop, rop.inst()->ops()[opnum + i]);
+            llvm::Value* r = rop.ll.op_load(rop.ll.type_int(),
+                                            rop.ll.GEP(rop.ll.type_int(),
+                                                       results, i));
+            rop.llvm_store_value(r, *a.Result);
+        }
+        rop.getattribute_batch(opnum, end);
+        return true;
+    }
 
-    Symbol& Result = *rop.opargsym(op, 0);
-    Symbol& ObjectName
-        = *rop.opargsym(op, object_slot);  // only valid if object_slot is true
-    Symbol& Attribute = *rop.opargsym(op, attrib_slot);
-    Symbol& Index
-        = *rop.opargsym(op, index_slot);  // only valid if array_lookup is true
-    Symbol& Destination = *rop.opargsym(op, nargs - 1);
-    OSL_DASSERT(!Result.typespec().is_closure_based()
-                && !ObjectName.typespec().is_closure_based()
-                && !Attribute.typespec().is_closure_based()
-                && !Index.typespec().is_closure_based()
-                && !Destination.typespec().is_closure_based());
+    GetattributeArgs a(rop, op);
+    Symbol& Destination = *a.Destination;
 
     // We'll pass the destination's attribute type directly to the
     // RenderServices callback so that the renderer can perform any
     // necessary conversions from its internal format to OSL's.
     TypeDesc dest_type = Destination.typespec().simpletype();
 
-    llvm::Value* obj_name_arg  = object_lookup ? rop.llvm_load_value(ObjectName)
-                                               : rop.llvm_load_string(ustring());
-    llvm::Value* attr_name_arg = rop.llvm_load_value(Attribute);
+    llvm::Value* obj_name_arg  = a.ObjectName
+                                     ? rop.llvm_load_value(*a.ObjectName)
+                                     : rop.llvm_load_string(ustring());
+    llvm::Value* attr_name_arg = rop.llvm_load_value(*a.Attribute);
 
     llvm::Value* args[] = {
         rop.sg_void_ptr(),
         rop.ll.constant((int)Destination.has_derivs()),
         obj_name_arg,
         attr_name_arg,
-        rop.ll.constant((int)array_lookup),
-        rop.llvm_load_value(Index),
+        rop.ll.constant((int)(a.Index != nullptr)),
+        a.Index ? rop.llvm_load_value(*a.Index) : rop.ll.constant(0),
         rop.ll.constant(dest_type),
         rop.llvm_void_ptr(Destination),
     };
-    llvm::Value* r = rop.ll.call_function("osl_get_attribute", args);
-    rop.llvm_store_value(r, Result);
+    // With the renderer's free function bitcode, call its rs_get_attribute
+    // directly, so its lookups can inline.
+    llvm::Value* r = rop.ll.call_function(rop.use_rs_bitcode()
+                                              ? "osl_rs_get_attribute"
+                                              : "osl_get_attribute",
+                                          args);
+    rop.llvm_store_value(r, *a.Result);
 
     return true;
 }
@@ -5,6 +5,8 @@
 #include <bitset>
 #include <cmath>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -179,6 +181,77 @@ helper_function_lookup(const std::string& name)
 
 
 
+// Process-wide compiled copies of the shadeop library, one per JIT
+// target and options, that every group may call into.
+typedef std::unordered_map<std::string, void*> SharedShadeops;
+static std::mutex shared_shadeops_mutex;
+static std::map<std::string, std::unique_ptr<SharedShadeops>>
+    shared_shadeops_libs;
+
+// Library functions shorter than this are still cloned into each group,
+// as they are the ones the optimizer is likely to inline.
+static const int shared_shadeop_min_instructions = 100;
+
+// The estimated cycles a call to a library function costs by itself,
+// passing arguments and saving registers around it, for
+// llvm_inline_max_cost.
+static const int shadeop_call_cost = 12;
+
+
+
+const SharedShadeops*
+BackendLLVM::shared_shadeops()
+{
+#ifdef OSL_LLVM_NO_BITCODE
+    return nullptr;
+#else
+    std::string key = fmtformat("{} fma={} aggressive={} O{}",
+                                shadingsys().llvm_jit_target(), ll.jit_fma(),
+                                ll.jit_aggressive(),
+                                shadingsys().llvm_optimize());
+    std::lock_guard<std::mutex> lock(shared_shadeops_mutex);
+    std::unique_ptr<SharedShadeops>& lib = shared_shadeops_libs[key];
+    if (lib)
+        return lib->empty() ? nullptr : lib.get();
+    lib.reset(new SharedShadeops);
+
+    // Compile all of llvm_ops in a module of its own. Its code outlives
+    // the module and engine, like that of any group.
+    OIIO::Timer timer;
+    LLVM_Util libll(shadingcontext()->llvm_thread_info());
+    libll.jit_fma(ll.jit_fma());
+    libll.jit_aggressive(ll.jit_aggressive());
+    std::string err;
+    libll.module(libll.module_from_bitcode((char*)osl_llvm_compiled_ops_block,
+                                           osl_llvm_compiled_ops_size,
+                                           "llvm_ops_shared", &err));
+    std::vector<llvm::Function*> libfuncs;
+    if (libll.module() && err.empty())
+        libfuncs = libll.export_all_functions(&err);
+    if (libfuncs.empty()
+        || !libll.make_jit_execengine(&err,
+                                      libll.lookup_isa_by_name(
+                                          shadingsys().llvm_jit_target()),
+                                      false, false)) {
+        shadingcontext()->errorfmt(
+            "Could not build the shared shadeop library: {}", err);
+        return nullptr;
+    }
+    libll.InstallLazyFunctionCreator(helper_function_lookup);
+    libll.setup_optimization_passes(shadingsys().llvm_optimize(),
+                                    shadingsys().llvm_target_host());
+    libll.do_optimize();
+    for (llvm::Function* f : libfuncs)
+        (*lib)[f->getName().str()] = libll.getPointerToFunction(f);
+    shadingsys().infofmt(
+        "Compiled shared shadeop library ({} functions) in {}", lib->size(),
+        Strutil::timeintervalformat(timer(), 2));
+    return lib.get();
+#endif
+}
+
+
+
 llvm::Type*
 BackendLLVM::llvm_type_sg()
 {
@@ -236,6 +309,92 @@ BackendLLVM::llvm_type_sg_ptr()
 
 
 
+void
+BackendLLVM::find_connection_aliases()
+{
+    // A downstream param that is only ever read, and gets all of its
+    // value from one upstream output of just the same type, can simply
+    // be that output's group data: the upstream layer has always run
+    // (it runs before the param is first read), and nothing changes it
+    // after, so the copy of it into the param at the end of the upstream
+    // layer is a waste. That matters for arrays, whose copies are big.
+    m_connection_alias.clear();
+    if (!shadingsys().m_opt_alias_connections)
+        return;
+    for (int layer = 1; layer < group().nlayers(); ++layer) {
+        ShaderInstance* child = group()[layer];
+        if (child->unused())
+            continue;
+        // How many connections write to each param of the child
+        std::map<const Symbol*, int> nwrites;
+        for (int c = 0, Nc = child->nconnections(); c < Nc; ++c)
+            ++nwrites[child->symbol(child->connection(c).dst.param)];
+        for (int c = 0, Nc = child->nconnections(); c < Nc; ++c) {
+            const Connection& con(child->connection(c));
+            ShaderInstance* parent = group()[con.srclayer];
+            const Symbol* src      = parent->symbol(con.src.param);
+            const Symbol* dst      = child->symbol(con.dst.param);
+            if (parent->unused() || nwrites[dst] != 1
+                || con.src.channel != -1 || con.dst.channel != -1
+                || !dst->typespec().is_array()
+                || dst->typespec().is_closure_based()
+                || src->typespec() != dst->typespec()
+                || src->has_derivs() != dst->has_derivs()
+                || dst->symtype() != SymTypeParam || dst->everwritten()
+                || dst->connected_down() || dst->renderer_output())
+                continue;
+            m_connection_alias[dst] = src;
+        }
+    }
+    shadingsys().m_stat_connections_aliased += int(m_connection_alias.size());
+}
+
+
+
+void
+BackendLLVM::find_shared_constant_params()
+{
+    // A param that takes its default or instance value, which is never
+    // written and is the same in every shade, needn't be stored into the
+    // group data at the start of every shade: the code can read it from
+    // one copy of it in the group's constants, as it does a constant
+    // array. Only arrays are worth it, as smaller values fold into code.
+    m_shared_constant_params.clear();
+    int minbytes = shadingsys().m_opt_shared_constant_arrays;
+    if (minbytes <= 0)
+        return;
+    for (int layer = 0; layer < group().nlayers(); ++layer) {
+        ShaderInstance* inst = group()[layer];
+        if (inst->unused())
+            continue;
+        FOREACH_PARAM(Symbol & s, inst)
+        {
+            const TypeSpec& ts(s.typespec());
+            TypeDesc t = ts.simpletype();
+            if (s.symtype() != SymTypeParam || !ts.is_array()
+                || ts.is_closure_based() || ts.is_structure()
+                || (t.basetype != TypeDesc::FLOAT
+                    && t.basetype != TypeDesc::INT)
+                || int(t.size()) < minbytes || !s.lockgeom()
+                || (s.valuesource() != Symbol::DefaultVal
+                    && s.valuesource() != Symbol::InstanceVal)
+                || s.has_init_ops() || s.has_derivs() || s.everwritten()
+                || s.connected_down() || s.renderer_output() || !s.data())
+                continue;
+            size_t n = t.numelements() * t.aggregate;
+            void* data
+                = t.basetype == TypeDesc::FLOAT
+                      ? (void*)group().float_constants((const float*)s.data(),
+                                                       n)
+                      : (void*)group().int_constants((const int*)s.data(), n);
+            m_shared_constant_params[&s] = data;
+            shadingsys().m_stat_shared_constant_bytes += t.size();
+        }
+    }
+}
+
+
+
 llvm::Type*
 BackendLLVM::llvm_type_groupdata()
 {
@@ -251,15 +410,16 @@ BackendLLVM::llvm_type_groupdata()
     if (llvm_debug() >= 2)
         std::cout << "Group param struct:\n";
 
-    // First, add the array that tells if each layer has run.  But only make
-    // slots for the layers that may be called/used.
+    // First, add the bitmap that tells if each layer has run.  But only
+    // make bits for the layers that may be called/used. Packing them as
+    // bits keeps the per-shade clearing down to a store or two.
     if (llvm_debug() >= 2)
         std::cout << "  layers run flags: " << m_num_used_layers
                   << " at offset " << offset << "\n";
-    int sz = (m_num_used_layers + 3) & (~3);  // Round up to 32 bit boundary
-    fields.push_back(ll.type_array(ll.type_bool(), sz));
+    int nwords = layer_run_words();
+    fields.push_back(ll.type_array(ll.type_int(), nwords));
     m_groupdata_field_names.emplace_back("layer_runflags");
-    offset += sz * sizeof(bool);
+    offset += nwords * sizeof(int);
     ++order;
 
     // Now add the array that tells which userdata have been initialized,
@@ -283,6 +443,11 @@ BackendLLVM::llvm_type_groupdata()
             type.arraylen = type.basetype == TypeDesc::FLOAT
                                 ? type.numelements() * 3
                                 : type.numelements();
+            // Placed userdata is copied straight from the renderer's data
+            // into the params and never retrieved into its slot, so keep
+            // just a placeholder to hold the field numbering.
+            if (group().userdata_placed(i))
+                type = TypeDesc::TypeInt;
             fields.push_back(llvm_type(type));
             m_groupdata_field_names.emplace_back(
                 fmtformat("userdata{}_{}_", i, names[i]));
@@ -301,51 +466,60 @@ BackendLLVM::llvm_type_groupdata()
 
     // For each layer in the group, add entries for all params that are
     // connected or interpolated, and output params.  Also mark those
-    // symbols with their offset within the group struct.
+    // symbols with their offset within the group struct. They're placed
+    // hottest first and packed by alignment, not in layer order.
     m_param_order_map.clear();
-    for (int layer = 0; layer < group().nlayers(); ++layer) {
+    find_connection_aliases();
+    find_shared_constant_params();
+    for (auto& param : group().groupdata_param_order(true)) {
+        int layer            = param.first;
         ShaderInstance* inst = group()[layer];
-        if (inst->unused())
+        Symbol& sym(*param.second);
+        if (m_connection_alias.count(&sym))
+            continue;  // placed below, in its upstream output
+        if (m_shared_constant_params.count(&sym)) {
+            sym.dataoffset(-1);  // not in the group data at all
             continue;
-        FOREACH_PARAM(Symbol & sym, inst)
-        {
-            TypeSpec ts = sym.typespec();
-            if (ts.is_structure())  // skip the struct symbol itself
-                continue;
-            const int arraylen  = std::max(1, sym.typespec().arraylength());
-            const int derivSize = (sym.has_derivs() ? 3 : 1);
-            ts.make_array(arraylen * derivSize);
-            fields.push_back(llvm_type(ts));
-            m_groupdata_field_names.emplace_back(
-                fmtformat("lay{}param_{}_", layer, sym.name()));
-
-            // FIXME(arena) -- temporary debugging
-            if (debug() && sym.symtype() == SymTypeOutputParam
-                && !sym.connected_down()) {
-                auto found = group().find_symloc(sym.name());
-                if (found)
-                    OIIO::Strutil::print("layer {} \"{}\" : OUTPUT {}\n", layer,
-                                         inst->layername(), found->name);
-            }
-
-            // Alignment
-            size_t align = sym.typespec().is_closure_based()
-                               ? sizeof(void*)
-                               : sym.typespec().simpletype().basesize();
-            if (offset & (align - 1))
-                offset += align - (offset & (align - 1));
-            if (llvm_debug() >= 2)
-                std::cout << "  " << inst->layername() << " (" << inst->id()
-                          << ") " << sym.mangled() << " " << ts.c_str()
-                          << ", field " << order << ", size "
-                          << derivSize * int(sym.size()) << ", offset "
-                          << offset << std::endl;
-            sym.dataoffset((int)offset);
-            // TODO(arenas): sym.set_dataoffset(SymArena::Heap, offset);
-            offset += derivSize * sym.size();
-            m_param_order_map[&sym] = order;
-            ++order;
         }
+        TypeSpec ts         = sym.typespec();
+        const int arraylen  = std::max(1, sym.typespec().arraylength());
+        const int derivSize = (sym.has_derivs() ? 3 : 1);
+        ts.make_array(arraylen * derivSize);
+        fields.push_back(llvm_type(ts));
+        m_groupdata_field_names.emplace_back(
+            fmtformat("lay{}param_{}_", layer, sym.name()));
+
+        // FIXME(arena) -- temporary debugging
+        if (debug() && sym.symtype() == SymTypeOutputParam
+            && !sym.connected_down()) {
+            auto found = group().find_symloc(sym.name());
+            if (found)
+                OIIO::Strutil::print("layer {} \"{}\" : OUTPUT {}\n", layer,
+                                     inst->layername(), found->name);
+        }
+
+        // Alignment
+        size_t align = sym.typespec().is_closure_based()
+                           ? sizeof(void*)
+                           : sym.typespec().simpletype().basesize();
+        if (offset & (align - 1))
+            offset += align - (offset & (align - 1));
+        if (llvm_debug() >= 2)
+            std::cout << "  " << inst->layername() << " (" << inst->id()
+                      << ") " << sym.mangled() << " " << ts.c_str()
+                      << ", field " << order << ", size "
+                      << derivSize * int(sym.size()) << ", offset "
+                      << offset << std::endl;
+        sym.dataoffset((int)offset);
+        // TODO(arenas): sym.set_dataoffset(SymArena::Heap, offset);
+        offset += derivSize * sym.size();
+        m_param_order_map[&sym] = order;
+        ++order;
+    }
+    for (auto& alias : m_connection_alias) {
+        Symbol* dst = const_cast<Symbol*>(alias.first);
+        dst->dataoffset(alias.second->dataoffset());
+        m_param_order_map[dst] = m_param_order_map[alias.second];
     }
     group().llvm_groupdata_size(offset);
     if (llvm_debug() >= 2)
@@ -404,6 +578,10 @@ BackendLLVM::llvm_assign_initial_value(const Symbol& sym, bool force)
     // For "globals" that are closures, there is nothing to initialize.
     if (sym.typespec().is_closure_based() && sym.symtype() == SymTypeGlobal)
         return;
+    // Nor for params read from the group's constants, already holding
+    // their values.
+    if (m_shared_constant_params.count(&sym))
+        return;
 
     // Closures need to get their storage before anything can be
     // assigned to them.  Unless they are params, in which case we took
@@ -519,7 +697,8 @@ BackendLLVM::llvm_assign_initial_value(const Symbol& sym, bool force)
         }
         if (shadingsys().debug_nan() && type.basetype == TypeDesc::FLOAT) {
             // check for NaN/Inf for float-based types
-            int ncomps          = type.numelements() * type.aggregate;
+            llvm::BasicBlock* after = llvm_begin_debug_check();
+            int ncomps              = type.numelements() * type.aggregate;
             llvm::Value* args[] = { ll.constant(ncomps),
                                     llvm_void_ptr(sym),
                                     ll.constant((int)sym.has_derivs()),
@@ -531,6 +710,7 @@ BackendLLVM::llvm_assign_initial_value(const Symbol& sym, bool force)
                                     ll.constant(ncomps),
                                     llvm_load_string("<get_userdata>") };
             ll.call_function("osl_naninf_check", args);
+            llvm_end_debug_check(after);
         }
         // userdata pre-placement always succeeds, we don't need to bother
         // with handing partial results possibly from bind_interpolated_param
@@ -608,11 +788,35 @@ BackendLLVM::llvm_assign_initial_value(const Symbol& sym, bool force)
 
 
 
+llvm::BasicBlock*
+BackendLLVM::llvm_begin_debug_check()
+{
+    if (!m_llvm_debug_sampled)
+        return nullptr;
+    llvm::BasicBlock* check_block = ll.new_basic_block("debug_check");
+    llvm::BasicBlock* after_block = ll.new_basic_block("");
+    ll.op_branch(m_llvm_debug_sampled, check_block, after_block, 1,
+                 uint32_t(std::max(shadingsys().debug_sample() - 1, 1)));
+    return after_block;
+}
+
+
+
+void
+BackendLLVM::llvm_end_debug_check(llvm::BasicBlock* after)
+{
+    if (after)
+        ll.op_branch(after);
+}
+
+
+
 void
 BackendLLVM::llvm_generate_debugnan(const Opcode& op)
 {
     // This function inserts extra debugging code to make sure that this op
     // did not produce any NaN values.
+    llvm::BasicBlock* after = llvm_begin_debug_check();
 
     // Check each argument to the op...
     for (int i = 0; i < op.nargs(); ++i) {
@@ -677,6 +881,7 @@ BackendLLVM::llvm_generate_debugnan(const Opcode& op)
                                 ll.constant(op.opname()) };
         ll.call_function("osl_naninf_check", args);
     }
+    llvm_end_debug_check(after);
 }
 
 
@@ -695,6 +900,8 @@ BackendLLVM::llvm_generate_debug_uninit(const Opcode& op)
         return;
     }
 
+    llvm::BasicBlock* after = llvm_begin_debug_check();
+
     // Check each argument to the op...
     for (int i = 0; i < op.nargs(); ++i) {
         // Only consider the arguments that this op READS
@@ -787,6 +994,7 @@ BackendLLVM::llvm_generate_debug_uninit(const Opcode& op)
                                 ncheck };
         ll.call_function("osl_uninit_check", args);
     }
+    llvm_end_debug_check(after);
 }
 
 
@@ -809,6 +1017,9 @@ BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
 {
     if (bb)
         ll.set_insert_point(bb);
+    // Control may enter this block from anywhere, so it starts with a
+    // fresh profile probe
+    m_profile_site = nullptr;
 
     for (int opnum = beginop; opnum < endop; ++opnum) {
         const Opcode& op        = inst()->ops()[opnum];
@@ -821,6 +1032,7 @@ BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
             if (ll.debug_is_enabled())
                 ll.debug_set_location(op.sourcefile(),
                                       std::max(op.sourceline(), 1));
+            llvm_profile_op(op);
             bool ok = (*opd->llvmgen)(*this, opnum);
             if (!ok)
                 return false;
@@ -838,10 +1050,13 @@ BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
         }
 
         // If the op we coded jumps around, skip past its recursive block
-        // executions.
+        // executions.  Whichever of its blocks ran, the next op needs a
+        // fresh profile probe too.
         int next = op.farthest_jump();
-        if (next >= 0)
-            opnum = next - 1;
+        if (next >= 0) {
+            opnum          = next - 1;
+            m_profile_site = nullptr;
+        }
     }
     return true;
 }
@@ -853,7 +1068,8 @@ BackendLLVM::build_llvm_init()
 {
     // Make a group init function: void group_init(ShaderGlobals*, GroupData*)
     // Note that the GroupData* is passed as a void*.
-    std::string unique_name = fmtformat("__direct_callable__group_{}_init",
+    std::string unique_name = fmtformat("{}group_{}_init",
+                                        shadingsys().optix_entry_prefix(),
                                         group().name());
     ll.current_function(
         ll.make_function(unique_name, false,
@@ -888,9 +1104,10 @@ BackendLLVM::build_llvm_init()
 #endif
 
     // Group init clears all the "layer_run" and "userdata_initialized" flags.
+    // The run flags are a bitmap, so this is just one store per 32 layers.
     if (m_num_used_layers > 1) {
-        int sz = (m_num_used_layers + 3) & (~3);  // round up to 32 bits
-        ll.op_memset(ll.void_ptr(layer_run_ref(0)), 0, sz, 4 /*align*/);
+        for (int w = 0, n = layer_run_words(); w < n; ++w)
+            ll.op_store(ll.constant(0), layer_run_ref(32 * w));
     }
     int num_userdata = (int)group().m_userdata_names.size();
     if (num_userdata) {
@@ -947,8 +1164,9 @@ BackendLLVM::build_llvm_instance(bool groupentry)
 {
     // Make a layer function: void layer_func(ShaderGlobals*, GroupData*)
     // Note that the GroupData* is passed as a void*.
-    std::string unique_layer_name = (groupentry ? "__direct_callable__" : "")
-                                    + layer_function_name();
+    std::string unique_layer_name
+        = (groupentry ? shadingsys().optix_entry_prefix() : "")
+          + layer_function_name();
     bool is_entry_layer = group().is_entry_layer(layer());
     ll.current_function(ll.make_function(
         unique_layer_name,
@@ -959,6 +1177,16 @@ BackendLLVM::build_llvm_instance(bool groupentry)
           ll.type_void_ptr(),  // output_base_ptr
           ll.type_int() }));
 
+    // With a layer profile, keep rarely run layers out of the way of the
+    // hot code, and encourage inlining of the ones that almost always run.
+    float profile = layer_profile(layer());
+    if (profile >= 0.0f && !is_entry_layer) {
+        if (profile < 0.01f)
+            ll.mark_function_cold(ll.current_function());
+        else if (profile > 0.5f)
+            ll.mark_function_hot(ll.current_function());
+    }
+
     if (ll.debug_is_enabled()) {
         const Opcode& mainbegin(inst()->op(inst()->maincodebegin()));
         ll.debug_push_function(unique_layer_name, mainbegin.sourcefile(),
@@ -978,7 +1206,6 @@ BackendLLVM::build_llvm_instance(bool groupentry)
     // Set up a new IR builder
     ll.new_builder(entry_bb);
 
-    llvm::Value* layerfield = layer_run_ref(layer_remap(layer()));
     if (is_entry_layer && !group().is_last_layer(layer())) {
         // For entry layers, we need an extra check to see if it already
         // ran. If it has, do an early return. Otherwise, set the 'ran' flag
@@ -988,8 +1215,7 @@ BackendLLVM::build_llvm_instance(bool groupentry)
                 fmtformat("checking for already-run layer {} {} {}",
                           this->layer(), inst()->layername(),
                           inst()->shadername()));
-        llvm::Value* executed         = ll.op_eq(ll.op_load(layerfield),
-                                                 ll.constant_bool(true));
+        llvm::Value* executed = llvm_layer_has_run(layer_remap(layer()));
         llvm::BasicBlock* then_block  = ll.new_basic_block();
         llvm::BasicBlock* after_block = ll.new_basic_block();
         ll.op_branch(executed, then_block, after_block);
@@ -1007,16 +1233,56 @@ BackendLLVM::build_llvm_instance(bool groupentry)
         llvm_gen_debug_printf(fmtformat("enter layer {} {} {}", this->layer(),
                                         inst()->layername(),
                                         inst()->shadername()));
+    llvm_profile_begin();
     // Mark this layer as executed
     if (!group().is_last_layer(layer())) {
-        ll.op_store(ll.constant_bool(true), layerfield);
+        llvm_mark_layer_run(layer_remap(layer()));
         if (shadingsys().countlayerexecs())
             ll.call_function("osl_incr_layers_executed", sg_void_ptr());
+        if (m_profile_layers) {
+            void* counter = &group().m_layer_exec_counts[layer()];
+            ll.op_atomic_add(ll.constant_ptr(counter, ll.type_longlong_ptr()),
+                             ll.constanti64(1));
+        }
     }
 
+    // A shareable layer's function does only the bookkeeping above, then
+    // calls a body, built from here on, that finds the group data through
+    // a table of offsets (passed last) rather than by this group's
+    // Groupdata type, so it's the same code for any group.
+    llvm::Function* layer_func   = ll.current_function();
+    llvm::BasicBlock* call_block = nullptr;
+    if (layer_shareable(groupentry)) {
+        call_block = ll.new_basic_block();
+        ll.op_branch(call_block);
+        ll.current_function(ll.make_function(
+            unique_layer_name + "_body", false, ll.type_void(),
+            { llvm_type_sg_ptr(), ll.type_void_ptr(),
+              ll.type_void_ptr(),  // userdata_base_ptr
+              ll.type_void_ptr(),  // output_base_ptr
+              ll.type_int(), ll.type_int_ptr() }));
+        m_llvm_shaderglobals_ptr = ll.current_function_arg(0);
+        m_llvm_groupdata_ptr     = ll.current_function_arg(1);
+        m_llvm_userdata_base_ptr = ll.current_function_arg(2);
+        m_llvm_output_base_ptr   = ll.current_function_arg(3);
+        m_llvm_shadeindex        = ll.current_function_arg(4);
+        m_llvm_groupdata_offsets = ll.current_function_arg(5);
+        m_relocated_fields.clear();
+        ll.new_builder(ll.new_basic_block(unique_layer_name + "_body"));
+    }
+
+    // With "debug_sample", whether this shade runs its debug checks is
+    // asked once per layer, and each check branches on the answer.
+    m_llvm_debug_sampled = nullptr;
+    if (shadingsys().debug_sample() > 1
+        && (shadingsys().debug_nan() || shadingsys().debug_uninit()))
+        m_llvm_debug_sampled = ll.op_int_to_bool(
+            ll.call_function("osl_debug_sampled", sg_void_ptr()));
+
     // Setup the symbols
     m_named_values.clear();
     m_layers_already_run.clear();
+    m_getattribute_batch = { -1, -1 };
     for (auto&& s : inst()->symbols()) {
         // Skip constants -- we always inline scalar constants, and for
         // array constants we will just use the pointers to the copy of
@@ -1044,7 +1310,8 @@ BackendLLVM::build_llvm_instance(bool groupentry)
             TypeDesc t = s.typespec().simpletype();
             if (t.basetype
                 == TypeDesc::FLOAT) {  // just check float-based types
-                int ncomps = t.numelements() * t.aggregate;
+                llvm::BasicBlock* after = llvm_begin_debug_check();
+                int ncomps              = t.numelements() * t.aggregate;
                 llvm::Value* args[]
                     = { ll.constant(ncomps),
                         llvm_void_ptr(s),
@@ -1057,6 +1324,7 @@ BackendLLVM::build_llvm_instance(bool groupentry)
                         ll.constant(ncomps),
                         ll.constant("<none>") };
                 ll.call_function("osl_naninf_check", args);
+                llvm_end_debug_check(after);
             }
         }
     }
@@ -1168,6 +1436,10 @@ BackendLLVM::build_llvm_instance(bool groupentry)
                 // so no need to do it here as well
                 llvm_run_connected_layers(*srcsym, con.src.param);
 
+                // An aliased param already is the output, nothing to copy
+                if (m_connection_alias.count(dstsym))
+                    continue;
+
                 // FIXME -- I'm not sure I understand this.  Isn't this
                 // unnecessary if we wrote to the parameter ourself?
                 llvm_assign_impl(*dstsym, *srcsym, -1, con.src.channel,
@@ -1204,6 +1476,43 @@ BackendLLVM::build_llvm_instance(bool groupentry)
                       << "\n";
             continue;  // types didn't match
         }
+        if (symloc->converts() && !stores_converted(*symloc)) {
+            std::cout << "No output copy for " << s.name()
+                      << " because it can't be stored as "
+                      << symloc->stored_type() << "\n";
+            continue;
+        }
+
+        if (symloc->converts()) {
+            // Convert and store each float, zeroing any derivs the output
+            // wants but the symbol doesn't have
+            if (!sindex)
+                sindex = ll.op_int_to_longlong(m_llvm_shadeindex);
+            llvm::Value* dstptr = symloc_ptr(symloc, m_llvm_output_base_ptr,
+                                             sindex);
+            TypeDesc::BASETYPE storage(
+                TypeDesc::BASETYPE(symloc->stored_type().basetype));
+            llvm::Type* elemtype = (storage == TypeDesc::HALF)
+                                       ? ll.type_int16()
+                                       : ll.type_int8();
+            dstptr               = ll.ptr_to_cast(dstptr, elemtype);
+            llvm::Value* srcptr  = ll.ptr_to_cast(llvm_void_ptr(s),
+                                                  ll.type_float());
+            int nfloats = int(symloc->type.numelements()
+                              * symloc->type.aggregate);
+            int nsrc    = nfloats * (s.has_derivs() ? 3 : 1);
+            int ndst    = nfloats * (symloc->derivs ? 3 : 1);
+            for (int i = 0; i < ndst; ++i) {
+                llvm::Value* val
+                    = (i < nsrc) ? ll.op_load(ll.type_float(),
+                                              ll.GEP(ll.type_float(), srcptr,
+                                                     i))
+                                 : ll.constant(0.0f);
+                ll.op_store(ll.op_float_to_storage(val, storage),
+                            ll.GEP(elemtype, dstptr, i));
+            }
+            continue;
+        }
 
         int size = int(symloc->type.size());
         if (symloc->derivs && s.has_derivs())
@@ -1232,7 +1541,36 @@ BackendLLVM::build_llvm_instance(bool groupentry)
         llvm_gen_debug_printf(fmtformat("exit layer {} {} {}", this->layer(),
                                         inst()->layername(),
                                         inst()->shadername()));
+    llvm_profile_end();
     ll.op_return();
+    m_llvm_debug_sampled = nullptr;
+
+    if (call_block) {
+        ll.end_builder();
+        llvm::Function* body = share_layer_body(ll.current_function());
+        // This group's offsets of the fields the body uses, which must
+        // outlive any code calling it
+        int* offsets = nullptr;
+        if (m_relocated_fields.size()) {
+            offsets = new int[m_relocated_fields.size()];
+            group().m_shared_layer_offsets.emplace_back(offsets);
+            for (size_t i = 0; i < m_relocated_fields.size(); ++i)
+                offsets[i] = int(
+                    ll.struct_element_offset(m_llvm_type_groupdata,
+                                             m_relocated_fields[i]));
+        }
+        m_llvm_groupdata_offsets = nullptr;
+        ll.current_function(layer_func);
+        ll.new_builder(call_block);
+        llvm::Value* args[] = { ll.current_function_arg(0),
+                                ll.void_ptr(ll.current_function_arg(1)),
+                                ll.current_function_arg(2),
+                                ll.current_function_arg(3),
+                                ll.current_function_arg(4),
+                                ll.constant_ptr(offsets, ll.type_int_ptr()) };
+        ll.call_function(body, args);
+        ll.op_return();
+    }
 
     if (llvm_debug())
         std::cout << "layer_func (" << unique_layer_name << ") "
@@ -1251,6 +1589,55 @@ BackendLLVM::build_llvm_instance(bool groupentry)
 
 
 
+bool
+BackendLLVM::layer_shareable(bool groupentry)
+{
+    // Calls to upstream layers, or the debugging of this one, would tie
+    // the code to the group.
+    if (!m_share_layers || inst()->nconnections() || llvm_debug())
+        return false;
+    if (groupentry) {
+        for (int i = 0; i < group().nlayers() - 1; ++i) {
+            ShaderInstance* gi = group()[i];
+            if (!gi->unused() && !gi->empty_instance() && !gi->run_lazily())
+                return false;  // it runs earlier layers of the group
+        }
+    }
+    return true;
+}
+
+
+
+llvm::Function*
+BackendLLVM::share_layer_body(llvm::Function* body)
+{
+    // Identical IR compiled the same way is an identical body
+    std::string key = fmtformat("{:016x} O{} {} {}",
+                                ll.function_fingerprint(body),
+                                m_llvm_optimize, shadingsys().llvm_jit_target(),
+                                shadingsys().llvm_jit_fma());
+    auto found = m_layer_bodies.find(key);
+    if (found != m_layer_bodies.end()) {
+        body->eraseFromParent();
+        shadingsys().m_stat_layers_shared += 1;
+        return found->second;
+    }
+    std::shared_ptr<void> owner;
+    if (void* code = shadingsys().find_shared_layer(key, owner)) {
+        body->deleteBody();
+        ll.add_function_mapping(body, code);
+        if (owner)
+            m_borrowed_layer_code.push_back(std::move(owner));
+        shadingsys().m_stat_layers_shared += 1;
+    } else {
+        m_new_layer_bodies.emplace_back(key, body);
+    }
+    m_layer_bodies[key] = body;
+    return body;
+}
+
+
+
 void
 BackendLLVM::initialize_llvm_group()
 {
@@ -1263,7 +1650,11 @@ BackendLLVM::initialize_llvm_group()
 
     // Set up optimization passes. Don't target the host if we're building
     // for OptiX.
-    ll.setup_optimization_passes(shadingsys().llvm_optimize(),
+    // Tier-0 code gets the cheap preset of a new pass manager pipeline.
+    ustring pipeline = shadingsys().llvm_pass_pipeline();
+    ll.pass_pipeline(ll.jit_fast() && !pipeline.empty() ? string_view("fast")
+                                                        : string_view(pipeline));
+    ll.setup_optimization_passes(m_llvm_optimize,
                                  shadingsys().llvm_target_host()
                                      && !use_optix());
 
@@ -1434,8 +1825,23 @@ BackendLLVM::run()
 #endif
 
         // Create the ExecutionEngine. We don't create an ExecutionEngine in the
-        // OptiX case, because we are using the NVPTX backend and not MCJIT
+        // OptiX case, because we are using the NVPTX backend and not MCJIT.
+        // ORC doesn't handle debugging symbols or profiling events, so
+        // those always use MCJIT, as does any build whose LLVM lacks ORC.
+        // With lazy layers, ORC can also defer compiling each layer
+        // function until it's first called, so unused layers cost nothing.
+        bool use_orc  = shadingsys().llvm_jit_orc()
+                        && !shadingsys().llvm_debugging_symbols()
+                        && !shadingsys().llvm_profiling_events();
+        bool lazy_jit = shadingsys().llvm_jit_lazy()
+                        && shadingsys().m_lazylayers;
         if (!use_optix()
+            && !(use_orc
+                 && ll.make_orc_jit(&err,
+                                    ll.lookup_isa_by_name(
+                                        shadingsys().m_llvm_jit_target),
+                                    shadingsys().llvm_jit_threads(),
+                                    lazy_jit))
             && !ll.make_jit_execengine(
                 &err, ll.lookup_isa_by_name(shadingsys().m_llvm_jit_target),
                 shadingsys().llvm_debugging_symbols(),
@@ -1450,6 +1856,31 @@ BackendLLVM::run()
 
     m_stat_llvm_setup_time += timer.lap();
 
+    // A persistent JIT object cache can only be shared between processes
+    // if the machine code doesn't bake in this process's addresses.
+    bool use_jit_cache = !use_optix() && !ll.using_orc_jit()
+                         && !shadingsys().jit_cache_dir().empty()
+                         && !shadingsys().profile_instrument()
+                         && !shadingsys().llvm_debugging_symbols()
+                         && !shadingsys().llvm_profiling_events()
+                         && !ll.dumpasm();
+    ll.jit_relocatable(use_jit_cache);
+    // Layers may call the code other groups JITed for the same layer only
+    // if it stays put for as long as they use it.
+    m_share_layers = shadingsys().jit_share_layers() && !use_optix()
+                     && !ll.using_orc_jit() && !use_jit_cache
+                     && !use_rs_bitcode()
+                     && !shadingsys().jit_memory_budget_MB()
+                     && !shadingsys().profile_instrument()
+                     && !shadingsys().llvm_debugging_symbols()
+                     && !shadingsys().llvm_debug_layers();
+    m_layer_bodies.clear();
+    m_new_layer_bodies.clear();
+    m_borrowed_layer_code.clear();
+    // PTX has no addresses in it to begin with
+    bool use_ptx_cache = use_optix() && !shadingsys().jit_cache_dir().empty()
+                         && !shadingsys().llvm_debugging_symbols();
+
     // Set up m_num_used_layers to be the number of layers that are
     // actually used, and m_layer_remap[] to map original layer numbers
     // to the shorter list of actually-called layers. We also note that
@@ -1472,7 +1903,8 @@ BackendLLVM::run()
             m_layer_remap[layer] = m_num_used_layers++;
         }
     }
-    shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
+    if (!group().jitted())  // don't count again for a tiered re-JIT
+        shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
 
     initialize_llvm_group();
 
@@ -1529,9 +1961,39 @@ BackendLLVM::run()
                 external_functions.insert(f);
             }
         }
+        // New shareable layer bodies are looked up after the JIT
+        for (auto& body : m_new_layer_bodies)
+            external_functions.insert(body.second);
         ll.prune_and_internalize_module(external_functions);
     }
 
+    // Call into the process's shared shadeop library for any bigger
+    // library function, rather than compiling it yet again for this group.
+    if (shadingsys().llvm_shared_shadeops() && !use_optix()
+        && !use_rs_bitcode()) {
+        if (const SharedShadeops* library = shared_shadeops()) {
+            std::unordered_set<llvm::Function*> keep(funcs.begin(),
+                                                     funcs.end());
+            keep.insert(init_func);
+            for (auto& body : m_new_layer_bodies)
+                keep.insert(body.second);
+            shadingsys().m_stat_shadeops_linked += ll.link_shared_functions(
+                *library, keep, shared_shadeop_min_instructions);
+        }
+    }
+
+    // Settle by estimated cost the inlining of the library calls left
+    int inline_calls_decided = 0;
+    if (shadingsys().llvm_inline_max_cost() > 0) {
+        std::unordered_set<llvm::Function*> keep(funcs.begin(), funcs.end());
+        keep.insert(init_func);
+        for (auto& body : m_new_layer_bodies)
+            keep.insert(body.second);
+        inline_calls_decided = ll.apply_inline_costs(
+            keep, shadeop_call_cost, shadingsys().llvm_inline_max_cost());
+        shadingsys().m_stat_inline_calls_decided += inline_calls_decided;
+    }
+
     // Debug code to dump the pre-optimized bitcode to a file
     if (llvm_debug() >= 2 || shadingsys().llvm_output_bitcode()) {
         // Make a safe group name that doesn't have "/" in it! Also beware
@@ -1568,9 +2030,49 @@ BackendLLVM::run()
         }
     }
 
+    // With a persistent JIT object cache, look for the machine code from
+    // an earlier compile of identical IR. On a hit there's no point in
+    // optimizing the IR, since the cached object is what will be loaded.
+    bool jit_cache_hit = false;
+    ll.jit_cache_backend(shadingsys().jit_cache_backend());
+    if (use_jit_cache) {
+        std::vector<TargetISA> variant_isas;
+        for (auto name :
+             Strutil::splitsv(shadingsys().jit_cache_targets(), ",")) {
+            TargetISA isa = ll.lookup_isa_by_name(Strutil::strip(name));
+            if (isa != TargetISA::UNKNOWN && isa != TargetISA::HOST)
+                variant_isas.push_back(isa);
+        }
+        jit_cache_hit = ll.jit_object_cache(shadingsys().jit_cache_dir(),
+                                            shadingsys().jit_cache_wait(),
+                                            variant_isas);
+        if (ll.jit_object_cache_variant())
+            shadingsys().m_stat_jit_cache_variant_hits += 1;
+        if (ll.jit_object_cache_waited())
+            shadingsys().m_stat_jit_cache_waits += 1;
+    } else if (use_ptx_cache) {
+        jit_cache_hit = ll.ptx_cache(shadingsys().jit_cache_dir(),
+                                     group().m_llvm_ptx_compiled_version);
+    }
+    if (use_jit_cache || use_ptx_cache) {
+        if (jit_cache_hit)
+            shadingsys().m_stat_jit_cache_hits += 1;
+        else
+            shadingsys().m_stat_jit_cache_misses += 1;
+        if (ll.jit_cache_fetched())
+            shadingsys().m_stat_jit_cache_fetches += 1;
+    }
+
     // Optimize the LLVM IR unless it's a do-nothing group.
-    if (!group().does_nothing())
-        ll.do_optimize();
+    if (!group().does_nothing() && !jit_cache_hit) {
+        shadingsys().m_stat_llvm_preopt_insts += ll.module_instruction_count();
+        std::string opterr;
+        ll.do_optimize(&opterr);
+        if (!opterr.empty())
+            shadingcontext()->warningfmt("{}", opterr);
+        shadingsys().m_stat_llvm_postopt_insts
+            += ll.module_instruction_count();
+    }
 
     m_stat_llvm_opt_time += timer.lap();
 
@@ -1603,8 +2105,7 @@ BackendLLVM::run()
             safegroup = fmtformat("TRUNC_{}_{}",
                                   safegroup.substr(safegroup.size() - 235),
                                   group().id());
-        std::string name = fmtformat("{}_O{}.ll", safegroup,
-                                     shadingsys().llvm_optimize());
+        std::string name = fmtformat("{}_O{}.ll", safegroup, m_llvm_optimize);
         OIIO::ofstream out;
         OIIO::Filesystem::open(out, name);
         if (out) {
@@ -1617,11 +2118,15 @@ BackendLLVM::run()
 
 #if OSL_USE_OPTIX
     if (use_optix()) {
-        ll.ptx_compile_group(nullptr, group().name().string(),
-                             group().m_llvm_ptx_compiled_version);
+        if (!jit_cache_hit)
+            ll.ptx_compile_group(nullptr, group().name().string(),
+                                 group().m_llvm_ptx_compiled_version);
         if (group().m_llvm_ptx_compiled_version.empty()) {
             OSL_ASSERT(0 && "Unable to generate PTX");
         }
+        if (ll.ptx_cache_stored())
+            shadingsys().m_stat_jit_cache_stores += 1;
+        shadingsys().m_stat_jit_cache_shared += ll.jit_cache_shared();
     } else
 #endif
     {
@@ -1640,6 +2145,21 @@ BackendLLVM::run()
         else
             group().llvm_compiled_version(
                 group().llvm_compiled_layer(nlayers - 1));
+        if (ll.jit_object_cache_stored())
+            shadingsys().m_stat_jit_cache_stores += 1;
+        shadingsys().m_stat_jit_cache_variants_stored
+            += ll.jit_object_cache_variants_stored();
+        shadingsys().m_stat_jit_cache_shared += ll.jit_cache_shared();
+        group().add_jit_memory(ll.jit_memory());
+        // Offer the new layer bodies to later groups, and hold on to the
+        // code of the earlier groups that this one calls.
+        for (auto& body : m_new_layer_bodies)
+            shadingsys().add_shared_layer(body.first,
+                                          ll.getPointerToFunction(body.second),
+                                          ll.jit_memory_owner());
+        for (auto& owner : m_borrowed_layer_code)
+            group().m_jit_borrowed.push_back(std::move(owner));
+        m_borrowed_layer_code.clear();
     }
 
     // We are destroying the entire module below,
@@ -1674,6 +2194,10 @@ BackendLLVM::run()
             m_stat_total_llvm_time, m_stat_llvm_setup_time,
             m_stat_llvm_irgen_time, m_stat_llvm_opt_time, m_stat_llvm_jit_time,
             m_llvm_local_mem / 1024);
+        if (inline_calls_decided)
+            shadingcontext()->infofmt(
+                "    {} library calls inlined or kept by estimated cost",
+                inline_calls_decided);
     }
 }
 
@@ -274,269 +274,149 @@ using ustring_pod = const char*;
     }
 
 
-#if OSL_FAST_MATH
-MAKE_UNARY_PERCOMPONENT_OP(sin, OIIO::fast_sin, fast_sin)
-MAKE_UNARY_PERCOMPONENT_OP(cos, OIIO::fast_cos, fast_cos)
-MAKE_UNARY_PERCOMPONENT_OP(tan, OIIO::fast_tan, fast_tan)
-MAKE_UNARY_PERCOMPONENT_OP(asin, OIIO::fast_asin, fast_asin)
-MAKE_UNARY_PERCOMPONENT_OP(acos, OIIO::fast_acos, fast_acos)
-MAKE_UNARY_PERCOMPONENT_OP(atan, OIIO::fast_atan, fast_atan)
-MAKE_BINARY_PERCOMPONENT_OP(atan2, OIIO::fast_atan2, fast_atan2)
-MAKE_UNARY_PERCOMPONENT_OP(sinh, OIIO::fast_sinh, fast_sinh)
-MAKE_UNARY_PERCOMPONENT_OP(cosh, OIIO::fast_cosh, fast_cosh)
-MAKE_UNARY_PERCOMPONENT_OP(tanh, OIIO::fast_tanh, fast_tanh)
-#else
-MAKE_UNARY_PERCOMPONENT_OP(sin, sinf, sin)
-MAKE_UNARY_PERCOMPONENT_OP(cos, cosf, cos)
-MAKE_UNARY_PERCOMPONENT_OP(tan, tanf, tan)
-MAKE_UNARY_PERCOMPONENT_OP(asin, safe_asin, safe_asin)
-MAKE_UNARY_PERCOMPONENT_OP(acos, safe_acos, safe_acos)
-MAKE_UNARY_PERCOMPONENT_OP(atan, atanf, atan)
-MAKE_BINARY_PERCOMPONENT_OP(atan2, atan2f, atan2)
-MAKE_UNARY_PERCOMPONENT_OP(sinh, sinhf, sinh)
-MAKE_UNARY_PERCOMPONENT_OP(cosh, coshf, cosh)
-MAKE_UNARY_PERCOMPONENT_OP(tanh, tanhf, tanh)
-#endif
-
-OSL_SHADEOP void
-osl_sincos_fff(float x, void* s_, void* c_)
-{
-#if OSL_FAST_MATH
-    OIIO::fast_sincos(x, (float*)s_, (float*)c_);
-#else
-    OIIO::sincos(x, (float*)s_, (float*)c_);
-#endif
-}
-
-OSL_SHADEOP void
-osl_sincos_dfdff(void* x_, void* s_, void* c_)
-{
-    Dual2<float>& x    = DFLOAT(x_);
-    Dual2<float>& sine = DFLOAT(s_);
-    float& cosine      = *(float*)c_;
-
-    float s_f, c_f;
-#if OSL_FAST_MATH
-    OIIO::fast_sincos(x.val(), &s_f, &c_f);
-#else
-    OIIO::sincos(x.val(), &s_f, &c_f);
-#endif
-
-    float xdx = x.dx(), xdy = x.dy();  // x might be aliased
-    sine   = Dual2<float>(s_f, c_f * xdx, c_f * xdy);
-    cosine = c_f;
-}
-
-OSL_SHADEOP void
-osl_sincos_dffdf(void* x_, void* s_, void* c_)
-{
-    Dual2<float>& x      = DFLOAT(x_);
-    float& sine          = *(float*)s_;
-    Dual2<float>& cosine = DFLOAT(c_);
-
-    float s_f, c_f;
-#if OSL_FAST_MATH
-    OIIO::fast_sincos(x.val(), &s_f, &c_f);
-#else
-    OIIO::sincos(x.val(), &s_f, &c_f);
-#endif
-    float xdx = x.dx(), xdy = x.dy();  // x might be aliased
-    sine   = s_f;
-    cosine = Dual2<float>(c_f, -s_f * xdx, -s_f * xdy);
-}
-
-OSL_SHADEOP void
-osl_sincos_dfdfdf(void* x_, void* s_, void* c_)
-{
-    Dual2<float>& x      = DFLOAT(x_);
-    Dual2<float>& sine   = DFLOAT(s_);
-    Dual2<float>& cosine = DFLOAT(c_);
-
-    float s_f, c_f;
-#if OSL_FAST_MATH
-    OIIO::fast_sincos(x.val(), &s_f, &c_f);
-#else
-    OIIO::sincos(x.val(), &s_f, &c_f);
-#endif
-    float xdx = x.dx(), xdy = x.dy();  // x might be aliased
-    sine   = Dual2<float>(s_f, c_f * xdx, c_f * xdy);
-    cosine = Dual2<float>(c_f, -s_f * xdx, -s_f * xdy);
-}
-
-OSL_SHADEOP void
-osl_sincos_vvv(void* x_, void* s_, void* c_)
-{
-#if OSL_FAST_MATH
-    OIIO::fast_sincos(VEC(x_).x, &VEC(s_).x, &VEC(c_).x);
-    OIIO::fast_sincos(VEC(x_).y, &VEC(s_).y, &VEC(c_).y);
-    OIIO::fast_sincos(VEC(x_).z, &VEC(s_).z, &VEC(c_).z);
-#else
-    OIIO::sincos(VEC(x_).x, &VEC(s_).x, &VEC(c_).x);
-    OIIO::sincos(VEC(x_).y, &VEC(s_).y, &VEC(c_).y);
-    OIIO::sincos(VEC(x_).z, &VEC(s_).z, &VEC(c_).z);
-#endif
-}
-
-OSL_SHADEOP void
-osl_sincos_dvdvv(void* x_, void* s_, void* c_)
-{
-    Dual2<Vec3>& x    = DVEC(x_);
-    Dual2<Vec3>& sine = DVEC(s_);
-    Vec3& cosine      = VEC(c_);
-
-#if 0  // older version using [i] deprecated to avoid potential aliasing issues
-    for (int i = 0; i < 3; i++) {
-        float s_f, c_f;
-#    if OSL_FAST_MATH
-        OIIO::fast_sincos(x.val()[i], &s_f, &c_f);
-#    else
-        OIIO::sincos(x.val()[i], &s_f, &c_f);
-#    endif
-        float xdx = x.dx()[i], xdy = x.dy()[i]; // x might be aliased
-        sine.val()[i] = s_f; sine.dx()[i] =  c_f * xdx; sine.dy()[i] =  c_f * xdy;
-        cosine[i] = c_f;
-    }
-#else
-    auto sincos_comp = [](const Dual2<float>& x, float& sine_val,
-                          float& sine_dx, float& sine_dy, float& cosine_val) {
-        float s_f, c_f;
-#    if OSL_FAST_MATH
-        OIIO::fast_sincos(x.val(), &s_f, &c_f);
-#    else
-        OIIO::sincos(x.val(), &s_f, &c_f);
-#    endif
-        sine_val   = s_f;
-        sine_dx    = c_f * x.dx();
-        sine_dy    = c_f * x.dy();
-        cosine_val = c_f;
-    };
-
-    sincos_comp(comp_x(x), sine.val().x, sine.dx().x, sine.dy().x, cosine.x);
-    sincos_comp(comp_y(x), sine.val().y, sine.dx().y, sine.dy().y, cosine.y);
-    sincos_comp(comp_z(x), sine.val().z, sine.dx().z, sine.dy().z, cosine.z);
-#endif
-}
-
-OSL_SHADEOP void
-osl_sincos_dvvdv(void* x_, void* s_, void* c_)
-{
-    Dual2<Vec3>& x      = DVEC(x_);
-    Vec3& sine          = VEC(s_);
-    Dual2<Vec3>& cosine = DVEC(c_);
-
-#if 0  // older version using [i] deprecated to avoid potential aliasing issues
-    for (int i = 0; i < 3; i++) {
-        float s_f, c_f;
-#    if OSL_FAST_MATH
-        OIIO::fast_sincos(x.val()[i], &s_f, &c_f);
-#    else
-        OIIO::sincos(x.val()[i], &s_f, &c_f);
-#    endif
-        float xdx = x.dx()[i], xdy = x.dy()[i]; // x might be aliased
-        sine[i] = s_f;
-        cosine.val()[i] = c_f; cosine.dx()[i] = -s_f * xdx; cosine.dy()[i] = -s_f * xdy;
-    }
-#else
-    auto sincos_comp = [](const Dual2<float>& x, float& sine_val,
-                          float& cosine_val, float& cosine_dx,
-                          float& cosine_dy) {
-        float s_f, c_f;
-#    if OSL_FAST_MATH
-        OIIO::fast_sincos(x.val(), &s_f, &c_f);
-#    else
-        OIIO::sincos(x.val(), &s_f, &c_f);
-#    endif
-        sine_val   = s_f;
-        cosine_val = c_f;
-        cosine_dx  = -s_f * x.dx();
-        cosine_dy  = -s_f * x.dy();
-    };
-
-    sincos_comp(comp_x(x), sine.x, cosine.val().x, cosine.dx().x,
-                cosine.dy().x);
-    sincos_comp(comp_y(x), sine.y, cosine.val().y, cosine.dx().y,
-                cosine.dy().y);
-    sincos_comp(comp_z(x), sine.z, cosine.val().z, cosine.dx().z,
-                cosine.dy().z);
+// The trig and transcendental shadeops come in two precisions: OIIO's
+// fast_* approximations, or the system math library (with OIIO's safe_*
+// wrappers guarding the domain).  The plain names (osl_sin_ff, ...) are
+// whichever precision the build chose with USE_FAST_MATH.  The other one
+// is compiled too, with a "fast_" or "exact_" prefix (osl_fast_sin_ff,
+// osl_exact_sin_ff, ...), for the "math_precision" option to pick when a
+// group is JITed.
 
-#endif
-}
+// clang-format off
+#define MAKE_FAST_TRANSCENDENTAL_OPS(prefix)                                       \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##sin  , OIIO::fast_sin       , fast_sin)      \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##cos  , OIIO::fast_cos       , fast_cos)      \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##tan  , OIIO::fast_tan       , fast_tan)      \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##asin , OIIO::fast_asin      , fast_asin)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##acos , OIIO::fast_acos      , fast_acos)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##atan , OIIO::fast_atan      , fast_atan)     \
+MAKE_BINARY_PERCOMPONENT_OP    (prefix##atan2, OIIO::fast_atan2     , fast_atan2)    \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##sinh , OIIO::fast_sinh      , fast_sinh)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##cosh , OIIO::fast_cosh      , fast_cosh)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##tanh , OIIO::fast_tanh      , fast_tanh)     \
+MAKE_SINCOS_OP                 (prefix##sincos, OIIO::fast_sincos)                   \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##log  , OIIO::fast_log       , fast_log)      \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##log2 , OIIO::fast_log2      , fast_log2)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##log10, OIIO::fast_log10     , fast_log10)    \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##exp  , OIIO::fast_exp       , fast_exp)      \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##exp2 , OIIO::fast_exp2      , fast_exp2)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##expm1, OIIO::fast_expm1     , fast_expm1)    \
+MAKE_BINARY_PERCOMPONENT_OP    (prefix##pow  , OIIO::fast_safe_pow  , fast_safe_pow) \
+MAKE_BINARY_PERCOMPONENT_VF_OP (prefix##pow  , OIIO::fast_safe_pow  , fast_safe_pow) \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##erf  , OIIO::fast_erf       , fast_erf)      \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##erfc , OIIO::fast_erfc      , fast_erfc)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##cbrt , OIIO::fast_cbrt      , fast_cbrt)
+
+#define MAKE_EXACT_TRANSCENDENTAL_OPS(prefix)                                      \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##sin  , sinf                 , sin)           \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##cos  , cosf                 , cos)           \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##tan  , tanf                 , tan)           \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##asin , safe_asin            , safe_asin)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##acos , safe_acos            , safe_acos)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##atan , atanf                , atan)          \
+MAKE_BINARY_PERCOMPONENT_OP    (prefix##atan2, atan2f               , atan2)         \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##sinh , sinhf                , sinh)          \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##cosh , coshf                , cosh)          \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##tanh , tanhf                , tanh)          \
+MAKE_SINCOS_OP                 (prefix##sincos, OIIO::sincos)                        \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##log  , OIIO::safe_log       , safe_log)      \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##log2 , OIIO::safe_log2      , safe_log2)     \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##log10, OIIO::safe_log10     , safe_log10)    \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##exp  , expf                 , exp)           \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##exp2 , exp2f                , exp2)          \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##expm1, expm1f               , expm1)         \
+MAKE_BINARY_PERCOMPONENT_OP    (prefix##pow  , OIIO::safe_pow       , safe_pow)      \
+MAKE_BINARY_PERCOMPONENT_VF_OP (prefix##pow  , OIIO::safe_pow       , safe_pow)      \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##erf  , erff                 , erf)           \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##erfc , erfcf                , erfc)          \
+MAKE_UNARY_PERCOMPONENT_OP     (prefix##cbrt , cbrtf                , cbrt)
+// clang-format on
 
-OSL_SHADEOP void
-osl_sincos_dvdvdv(void* x_, void* s_, void* c_)
-{
-    Dual2<Vec3>& x      = DVEC(x_);
-    Dual2<Vec3>& sine   = DVEC(s_);
-    Dual2<Vec3>& cosine = DVEC(c_);
 
-#if 0  // older version using [i] deprecated to avoid potential aliasing issues
-    for (int i = 0; i < 3; i++) {
-        float s_f, c_f;
-#    if OSL_FAST_MATH
-        OIIO::fast_sincos(x.val()[i], &s_f, &c_f);
-#    else
-        OIIO::sincos(x.val()[i], &s_f, &c_f);
-#    endif
-        float xdx = x.dx()[i], xdy = x.dy()[i]; // x might be aliased
-          sine.val()[i] = s_f;   sine.dx()[i] =  c_f * xdx;   sine.dy()[i] =  c_f * xdy;
-        cosine.val()[i] = c_f; cosine.dx()[i] = -s_f * xdx; cosine.dy()[i] = -s_f * xdy;
+// sincos of a float or each component of a triple, with func(x, &s, &c)
+// computing both of a float.  Derivatives are read before any are
+// written, as x might be aliased with an output.
+#define MAKE_SINCOS_OP(name, func)                                          \
+    OSL_SHADEOP void osl_##name##_fff(float x, void* s_, void* c_)          \
+    {                                                                       \
+        func(x, (float*)s_, (float*)c_);                                    \
+    }                                                                       \
+                                                                            \
+    OSL_SHADEOP void osl_##name##_dfdff(void* x_, void* s_, void* c_)       \
+    {                                                                       \
+        Dual2<float> x = DFLOAT(x_);                                        \
+        float s_f, c_f;                                                     \
+        func(x.val(), &s_f, &c_f);                                          \
+        DFLOAT(s_) = Dual2<float>(s_f, c_f * x.dx(), c_f * x.dy());         \
+        *(float*)c_ = c_f;                                                  \
+    }                                                                       \
+                                                                            \
+    OSL_SHADEOP void osl_##name##_dffdf(void* x_, void* s_, void* c_)       \
+    {                                                                       \
+        Dual2<float> x = DFLOAT(x_);                                        \
+        float s_f, c_f;                                                     \
+        func(x.val(), &s_f, &c_f);                                          \
+        *(float*)s_ = s_f;                                                  \
+        DFLOAT(c_)  = Dual2<float>(c_f, -s_f * x.dx(), -s_f * x.dy());      \
+    }                                                                       \
+                                                                            \
+    OSL_SHADEOP void osl_##name##_dfdfdf(void* x_, void* s_, void* c_)     \
+    {                                                                       \
+        Dual2<float> x = DFLOAT(x_);                                        \
+        float s_f, c_f;                                                     \
+        func(x.val(), &s_f, &c_f);                                          \
+        DFLOAT(s_) = Dual2<float>(s_f, c_f * x.dx(), c_f * x.dy());         \
+        DFLOAT(c_) = Dual2<float>(c_f, -s_f * x.dx(), -s_f * x.dy());       \
+    }                                                                       \
+                                                                            \
+    OSL_SHADEOP void osl_##name##_vvv(void* x_, void* s_, void* c_)         \
+    {                                                                       \
+        func(VEC(x_).x, &VEC(s_).x, &VEC(c_).x);                            \
+        func(VEC(x_).y, &VEC(s_).y, &VEC(c_).y);                            \
+        func(VEC(x_).z, &VEC(s_).z, &VEC(c_).z);                            \
+    }                                                                       \
+                                                                            \
+    OSL_SHADEOP void osl_##name##_dvdvv(void* x_, void* s_, void* c_)       \
+    {                                                                       \
+        Dual2<float> x[3] = { comp_x(DVEC(x_)), comp_y(DVEC(x_)),           \
+                              comp_z(DVEC(x_)) };                           \
+        Dual2<float> s[3];                                                  \
+        for (int i = 0; i < 3; ++i)                                         \
+            osl_##name##_dfdff(&x[i], &s[i], &VEC(c_)[i]);                  \
+        DVEC(s_) = make_Vec3(s[0], s[1], s[2]);                             \
+    }                                                                       \
+                                                                            \
+    OSL_SHADEOP void osl_##name##_dvvdv(void* x_, void* s_, void* c_)       \
+    {                                                                       \
+        Dual2<float> x[3] = { comp_x(DVEC(x_)), comp_y(DVEC(x_)),           \
+                              comp_z(DVEC(x_)) };                           \
+        Dual2<float> c[3];                                                  \
+        for (int i = 0; i < 3; ++i)                                         \
+            osl_##name##_dffdf(&x[i], &VEC(s_)[i], &c[i]);                  \
+        DVEC(c_) = make_Vec3(c[0], c[1], c[2]);                             \
+    }                                                                       \
+                                                                            \
+    OSL_SHADEOP void osl_##name##_dvdvdv(void* x_, void* s_, void* c_)      \
+    {                                                                       \
+        Dual2<float> x[3] = { comp_x(DVEC(x_)), comp_y(DVEC(x_)),           \
+                              comp_z(DVEC(x_)) };                           \
+        Dual2<float> s[3], c[3];                                            \
+        for (int i = 0; i < 3; ++i)                                         \
+            osl_##name##_dfdfdf(&x[i], &s[i], &c[i]);                       \
+        DVEC(s_) = make_Vec3(s[0], s[1], s[2]);                             \
+        DVEC(c_) = make_Vec3(c[0], c[1], c[2]);                             \
     }
-#else
-    auto sincos_comp = [](const Dual2<float>& x, float& sine_val,
-                          float& sine_dx, float& sine_dy, float& cosine_val,
-                          float& cosine_dx, float& cosine_dy) {
-        float s_f, c_f;
-#    if OSL_FAST_MATH
-        OIIO::fast_sincos(x.val(), &s_f, &c_f);
-#    else
-        OIIO::sincos(x.val(), &s_f, &c_f);
-#    endif
-        sine_val   = s_f;
-        sine_dx    = c_f * x.dx();
-        sine_dy    = c_f * x.dy();
-        cosine_val = c_f;
-        cosine_dx  = -s_f * x.dx();
-        cosine_dy  = -s_f * x.dy();
-    };
-
-    sincos_comp(comp_x(x), sine.val().x, sine.dx().x, sine.dy().x,
-                cosine.val().x, cosine.dx().x, cosine.dy().x);
-    sincos_comp(comp_y(x), sine.val().y, sine.dx().y, sine.dy().y,
-                cosine.val().y, cosine.dx().y, cosine.dy().y);
-    sincos_comp(comp_z(x), sine.val().z, sine.dx().z, sine.dy().z,
-                cosine.val().z, cosine.dx().z, cosine.dy().z);
 
 
-#endif
-}
-
-// clang-format off
 #if OSL_FAST_MATH
-MAKE_UNARY_PERCOMPONENT_OP     (log        , OIIO::fast_log       , fast_log)
-MAKE_UNARY_PERCOMPONENT_OP     (log2       , OIIO::fast_log2      , fast_log2)
-MAKE_UNARY_PERCOMPONENT_OP     (log10      , OIIO::fast_log10     , fast_log10)
-MAKE_UNARY_PERCOMPONENT_OP     (exp        , OIIO::fast_exp       , fast_exp)
-MAKE_UNARY_PERCOMPONENT_OP     (exp2       , OIIO::fast_exp2      , fast_exp2)
-MAKE_UNARY_PERCOMPONENT_OP     (expm1      , OIIO::fast_expm1     , fast_expm1)
-MAKE_BINARY_PERCOMPONENT_OP    (pow        , OIIO::fast_safe_pow  , fast_safe_pow)
-MAKE_BINARY_PERCOMPONENT_VF_OP (pow        , OIIO::fast_safe_pow  , fast_safe_pow)
-MAKE_UNARY_PERCOMPONENT_OP     (erf        , OIIO::fast_erf       , fast_erf)
-MAKE_UNARY_PERCOMPONENT_OP     (erfc       , OIIO::fast_erfc      , fast_erfc)
-MAKE_UNARY_PERCOMPONENT_OP     (cbrt       , OIIO::fast_cbrt      , fast_cbrt)
+MAKE_FAST_TRANSCENDENTAL_OPS()
+MAKE_EXACT_TRANSCENDENTAL_OPS(exact_)
 #else
-MAKE_UNARY_PERCOMPONENT_OP     (log        , OIIO::safe_log       , safe_log)
-MAKE_UNARY_PERCOMPONENT_OP     (log2       , OIIO::safe_log2      , safe_log2)
-MAKE_UNARY_PERCOMPONENT_OP     (log10      , OIIO::safe_log10     , safe_log10)
-MAKE_UNARY_PERCOMPONENT_OP     (exp        , expf                 , exp)
-MAKE_UNARY_PERCOMPONENT_OP     (exp2       , exp2f                , exp2)
-MAKE_UNARY_PERCOMPONENT_OP     (expm1      , expm1f               , expm1)
-MAKE_BINARY_PERCOMPONENT_OP    (pow        , OIIO::safe_pow       , safe_pow)
-MAKE_BINARY_PERCOMPONENT_VF_OP (pow        , OIIO::safe_pow       , safe_pow)
-MAKE_UNARY_PERCOMPONENT_OP     (erf        , erff                 , erf)
-MAKE_UNARY_PERCOMPONENT_OP     (erfc       , erfcf                , erfc)
-MAKE_UNARY_PERCOMPONENT_OP     (cbrt       , cbrtf                , cbrt)
+MAKE_EXACT_TRANSCENDENTAL_OPS()
+MAKE_FAST_TRANSCENDENTAL_OPS(fast_)
 #endif
 
+// clang-format off
 MAKE_UNARY_PERCOMPONENT_OP     (sqrt       , OIIO::safe_sqrt      , sqrt)
 MAKE_UNARY_PERCOMPONENT_OP     (inversesqrt, OIIO::safe_inversesqrt, inversesqrt)
 // clang-format on
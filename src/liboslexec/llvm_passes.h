@@ -397,6 +397,8 @@ public:
 // including this file will need its own static members defined. LLVM will
 // assign IDs when they get registered, so this initialization value is not
 // important.
+template<> char PreventBitMasksFromBeingLiveinsToBasicBlocks<4>::ID = 0;
+
 template<> char PreventBitMasksFromBeingLiveinsToBasicBlocks<8>::ID = 0;
 
 template<> char PreventBitMasksFromBeingLiveinsToBasicBlocks<16>::ID = 0;
@@ -3,14 +3,24 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cinttypes>
+#include <ctime>
+#include <deque>
+#include <map>
 #include <memory>
+#include <thread>
 
+#include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/fmath.h>
+#include <OpenImageIO/hash.h>
 #include <OpenImageIO/thread.h>
 
 #include <boost/thread/tss.hpp> /* for thread_specific_ptr */
 
+#include <OSL/jitcache.h>
 #include <OSL/llvm_util.h>
 #include <OSL/oslconfig.h>
 #include <OSL/wide.h>
@@ -39,6 +49,7 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/ValueSymbolTable.h>
 #include <llvm/Linker/Linker.h>
@@ -58,15 +69,29 @@
 #include <llvm/Analysis/TypeBasedAliasAnalysis.h>
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#if OSL_LLVM_VERSION >= 130
+#    include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#    include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#    include <llvm/Transforms/Utils/SplitModule.h>
+#    define OSL_HAS_ORC_JIT 1
+#endif
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Verifier.h>
+#if OSL_LLVM_VERSION >= 140
+#    include <llvm/IR/PassInstrumentation.h>
+#    include <llvm/Passes/PassBuilder.h>
+#    define OSL_HAS_NEW_PASS_MANAGER 1
+#endif
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/PrettyStackTrace.h>
+#include <llvm/Support/Process.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
@@ -82,6 +107,15 @@
 
 #include <llvm/Support/DynamicLibrary.h>
 
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Object/SymbolSize.h>
+
+#ifdef __linux__
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
 #if OSL_LLVM_VERSION >= 120
 #    include <llvm/CodeGen/Passes.h>
 #endif
@@ -151,11 +185,202 @@ struct DefaultMMapper final : public llvm::SectionMemoryManager::MemoryMapper {
 };
 static DefaultMMapper llvm_default_mapper;
 
+
+
+#ifdef __linux__
+// With the jit_huge_pages option, the memory managers of every thread get
+// their pages from this mapper, which packs them into shared 2MB regions
+// aligned to huge pages and marked for transparent huge pages, so all the
+// code of the JITed groups takes few iTLB entries rather than being
+// strewn over as many small mappings as there are sections. Each purpose
+// (code, read-only and read-write data) fills its own region, since a
+// huge page needs the same protection throughout. Big requests, and any
+// failure to map a region, go to the default mapper.
+struct HugePageMMapper final
+    : public llvm::SectionMemoryManager::MemoryMapper {
+    static constexpr size_t region_size = size_t(2) << 20;
+
+    llvm::sys::MemoryBlock allocateMappedMemory(
+        llvm::SectionMemoryManager::AllocationPurpose purpose,
+        size_t NumBytes, const llvm::sys::MemoryBlock* const NearBlock,
+        unsigned Flags, std::error_code& EC) override
+    {
+        size_t pagesize = size_t(getpagesize());
+        size_t size     = OIIO::round_to_multiple(NumBytes, pagesize);
+        if (size && size <= region_size / 4) {
+            OIIO::spin_lock lock(m_mutex);
+            Region*& r = m_current[int(purpose) % 3];
+            if (!r || r->used + size > region_size)
+                r = new_region();
+            if (r) {
+                char* ptr = r->base + r->used;
+                if (!mprotect(ptr, size, prot(Flags))) {
+                    r->used += size;
+                    r->live += 1;
+                    EC = std::error_code();
+                    return llvm::sys::MemoryBlock(ptr, size);
+                }
+            }
+        }
+        return llvm::sys::Memory::allocateMappedMemory(NumBytes, NearBlock,
+                                                       Flags, EC);
+    }
+
+    std::error_code protectMappedMemory(const llvm::sys::MemoryBlock& Block,
+                                        unsigned Flags) override
+    {
+        return llvm::sys::Memory::protectMappedMemory(Block, Flags);
+    }
+
+    std::error_code releaseMappedMemory(llvm::sys::MemoryBlock& M) override
+    {
+        char* ptr = (char*)M.base();
+        OIIO::spin_lock lock(m_mutex);
+        for (Region& r : m_regions) {
+            if (!r.base || ptr < r.base || ptr >= r.base + region_size)
+                continue;
+            // Unmap the region once nothing is left in it, unless it's
+            // still being filled
+            if (--r.live == 0 && m_current[0] != &r && m_current[1] != &r
+                && m_current[2] != &r) {
+                munmap(r.base, region_size);
+                r.base = nullptr;
+            }
+            M = llvm::sys::MemoryBlock();
+            return std::error_code();
+        }
+        return llvm::sys::Memory::releaseMappedMemory(M);
+    }
+
+private:
+    struct Region {
+        char* base;  // nullptr once unmapped
+        size_t used;
+        int live;  // Blocks handed out and not yet released
+    };
+
+    static int prot(unsigned Flags)
+    {
+        return ((Flags & llvm::sys::Memory::MF_READ) ? PROT_READ : 0)
+               | ((Flags & llvm::sys::Memory::MF_WRITE) ? PROT_WRITE : 0)
+               | ((Flags & llvm::sys::Memory::MF_EXEC) ? PROT_EXEC : 0);
+    }
+
+    // Map a new region, over-mapping so it can start on a huge page.
+    Region* new_region()
+    {
+        size_t len = 2 * region_size;
+        void* p    = mmap(nullptr, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1, 0);
+        if (p == MAP_FAILED)
+            return nullptr;
+        char* base = (char*)OIIO::round_to_multiple_of_pow2(uintptr_t(p),
+                                                            region_size);
+        size_t head = base - (char*)p;
+        if (head)
+            munmap(p, head);
+        munmap(base + region_size, len - head - region_size);
+        madvise(base, region_size, MADV_HUGEPAGE);
+        m_regions.push_back({ base, 0, 0 });
+        return &m_regions.back();
+    }
+
+    OIIO::spin_mutex m_mutex;
+    std::deque<Region> m_regions;  // A deque, so they don't move
+    Region* m_current[3] = { nullptr, nullptr, nullptr };
+};
+static HugePageMMapper llvm_hugepage_mapper;
+#endif
+static std::atomic<bool> jit_huge_pages { false };
+
+
+
+#ifdef __linux__
+// Appends the address, size and name of every JITed function to
+// /tmp/perf-<pid>.map, where Linux perf looks up the symbols of code
+// that it can't find in any loaded file. Unlike LLVM's jitdump listener
+// this needs no special LLVM build, nor "perf inject" afterwards. It is
+// shared by all the execution engines, and is never destroyed, since
+// the code stays loaded for as long as the process runs.
+class PerfMapListener final : public llvm::JITEventListener {
+public:
+    static PerfMapListener* get()
+    {
+        static PerfMapListener* listener = new PerfMapListener;
+        return listener;
+    }
+
+    void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile& obj,
+                            const llvm::RuntimeDyld::LoadedObjectInfo& info)
+        override
+    {
+        // The debug object has the symbols at their loaded addresses
+        llvm::object::OwningBinary<llvm::object::ObjectFile> debugobj
+            = info.getObjectForDebug(obj);
+        if (!debugobj.getBinary())
+            return;
+        std::string lines;
+        for (const auto& symsize :
+             llvm::object::computeSymbolSizes(*debugobj.getBinary())) {
+            const llvm::object::SymbolRef& sym(symsize.first);
+            auto type = sym.getType();
+            if (!type) {
+                llvm::consumeError(type.takeError());
+                continue;
+            }
+            if (*type != llvm::object::SymbolRef::ST_Function
+                || !symsize.second)
+                continue;
+            auto name = sym.getName();
+            if (!name) {
+                llvm::consumeError(name.takeError());
+                continue;
+            }
+            auto addr = sym.getAddress();
+            if (!addr) {
+                llvm::consumeError(addr.takeError());
+                continue;
+            }
+            lines += fmtformat("{:x} {:x} {}\n", *addr, symsize.second,
+                               name->str());
+        }
+        OIIO::spin_lock lock(m_mutex);
+        if (!m_file) {
+            m_file = fopen(fmtformat("/tmp/perf-{}.map", getpid()).c_str(),
+                           "a");
+            if (!m_file)
+                return;
+        }
+        fputs(lines.c_str(), m_file);
+        fflush(m_file);
+    }
+
+private:
+    OIIO::spin_mutex m_mutex;
+    FILE* m_file = nullptr;
+};
+#endif
+
 static OIIO::spin_mutex llvm_global_mutex;
 static bool setup_done = false;
 static std::unique_ptr<std::vector<std::shared_ptr<LLVMMemoryManager>>>
     jitmm_hold;
 static int jit_mem_hold_users = 0;
+static std::atomic<size_t> jit_memory_held { 0 };  // Bytes in jitmm_hold
+static std::atomic<size_t> jit_memory_owned { 0 };  // In OwnedJitMemory
+static std::atomic<size_t> jit_memory_freed { 0 };  // By OwnedJitMemory
+
+#if OSL_HAS_ORC_JIT
+// The shared ORC JITs, one per distinct target configuration. Like the
+// memory managers in jitmm_hold, they own the code of every group they
+// compiled, so they live until the last ScopedJitMemoryUser goes away.
+struct OrcJitRecord {
+    std::string key;
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+};
+static std::unique_ptr<std::vector<OrcJitRecord>> orcjit_hold;
+static int orc_dylib_serial = 0;
+#endif
 
 
 #if OSL_LLVM_VERSION >= 120
@@ -174,6 +399,9 @@ LLVM_Util::ScopedJitMemoryUser::ScopedJitMemoryUser()
     if (jit_mem_hold_users == 0) {
         OSL_ASSERT(!jitmm_hold);
         jitmm_hold.reset(new std::vector<std::shared_ptr<LLVMMemoryManager>>());
+#if OSL_HAS_ORC_JIT
+        orcjit_hold.reset(new std::vector<OrcJitRecord>());
+#endif
     }
     ++jit_mem_hold_users;
 }
@@ -186,6 +414,10 @@ LLVM_Util::ScopedJitMemoryUser::~ScopedJitMemoryUser()
     --jit_mem_hold_users;
     if (jit_mem_hold_users == 0) {
         jitmm_hold.reset();
+        jit_memory_held = jit_memory_owned.load();  // Not freed with it
+#if OSL_HAS_ORC_JIT
+        orcjit_hold.reset();
+#endif
     }
 }
 
@@ -197,6 +429,8 @@ struct LLVM_Util::PerThreadInfo::Impl {
     Impl() {}
     ~Impl()
     {
+        // The parsed modules belong to the context, so go first
+        bitcode_modules.clear();
         delete llvm_context;
         // N.B. Do NOT delete the jitmm -- another thread may need the
         // code! Don't worry, we stashed a pointer in jitmm_hold.
@@ -204,6 +438,10 @@ struct LLVM_Util::PerThreadInfo::Impl {
 
     llvm::LLVMContext* llvm_context = nullptr;
     LLVMMemoryManager* llvm_jitmm   = nullptr;
+    // The modules parsed by module_from_bitcode, by the address and size
+    // of their bitcode, which it clones rather than parse them again
+    std::map<std::pair<const char*, size_t>, std::unique_ptr<llvm::Module>>
+        bitcode_modules;
 };
 
 
@@ -230,11 +468,58 @@ LLVM_Util::PerThreadInfo::get() const
 size_t
 LLVM_Util::total_jit_memory_held()
 {
-    // FIXME: This can't possibly be correct. It will always return 0,
-    // since jitmem is a local variable.
-    size_t jitmem = 0;
-    OIIO::spin_lock lock(llvm_global_mutex);
-    return jitmem;
+    return jit_memory_held;
+}
+
+
+
+size_t
+LLVM_Util::total_jit_memory_freed()
+{
+    return jit_memory_freed;
+}
+
+
+
+void
+LLVM_Util::use_jit_huge_pages(bool on)
+{
+    jit_huge_pages = on;
+}
+
+
+
+// The memory manager given to one LLVM_Util by own_jit_memory, not kept
+// in jitmm_hold: the code and data it holds are freed with it.
+struct LLVM_Util::OwnedJitMemory {
+    LLVMMemoryManager mm { &llvm_default_mapper };
+    size_t bytes = 0;  // of it, in jit_memory_held
+
+    ~OwnedJitMemory()
+    {
+        jit_memory_held -= bytes;
+        jit_memory_owned -= bytes;
+        jit_memory_freed += bytes;
+    }
+};
+
+
+
+void
+LLVM_Util::own_jit_memory()
+{
+    m_owned_jitmm = std::make_shared<OwnedJitMemory>();
+    m_llvm_jitmm  = &m_owned_jitmm->mm;
+}
+
+
+
+std::shared_ptr<void>
+LLVM_Util::jit_memory_owner() const
+{
+    if (using_orc_jit())
+        return nullptr;
+    return m_owned_jitmm;
 }
 
 
@@ -242,11 +527,20 @@ LLVM_Util::total_jit_memory_held()
 /// MemoryManager - Create a shell that passes on requests
 /// to a real LLVMMemoryManager underneath, but can be retained after the
 /// dummy is destroyed.  Also, we don't pass along any deallocations.
+/// The sizes of the sections allocated are tallied in *bytes, and in the
+/// total held by all the memory managers (and by the OwnedJitMemory, if
+/// the real one is one).
 class LLVM_Util::MemoryManager final : public LLVMMemoryManager {
 protected:
     LLVMMemoryManager* mm;  // the real one
+    size_t* bytes;          // where to tally the sections allocated
+    size_t* owned_bytes;    // the OwnedJitMemory's tally, if any
 public:
-    MemoryManager(LLVMMemoryManager* realmm) : mm(realmm) {}
+    MemoryManager(LLVMMemoryManager* realmm, size_t* bytes,
+                  size_t* owned_bytes = nullptr)
+        : mm(realmm), bytes(bytes), owned_bytes(owned_bytes)
+    {
+    }
 
     void notifyObjectLoaded(llvm::ExecutionEngine* EE,
                             const llvm::object::ObjectFile& oi) override
@@ -306,6 +600,7 @@ public:
                                  unsigned SectionID,
                                  llvm::StringRef SectionName) override
     {
+        tally(Size);
         return mm->allocateCodeSection(Size, Alignment, SectionID, SectionName);
     }
     uint8_t* allocateDataSection(uintptr_t Size, unsigned Alignment,
@@ -313,6 +608,7 @@ public:
                                  llvm::StringRef SectionName,
                                  bool IsReadOnly) override
     {
+        tally(Size);
         return mm->allocateDataSection(Size, Alignment, SectionID, SectionName,
                                        IsReadOnly);
     }
@@ -332,6 +628,295 @@ public:
     {
         return mm->finalizeMemory(ErrMsg);
     }
+
+private:
+    void tally(uintptr_t size)
+    {
+        *bytes += size;
+        jit_memory_held += size;
+        if (owned_bytes) {
+            *owned_bytes += size;
+            jit_memory_owned += size;
+        }
+    }
+};
+
+
+
+// Write a file of a cache shared with other processes: write to a uniquely
+// named temporary and rename it into place, so that they never see a
+// partial file.
+static bool
+write_cache_file(const std::string& filename, llvm::StringRef data)
+{
+    std::string tmpname = fmtformat("{}.{}.tmp", filename,
+                                    OIIO::Filesystem::unique_path());
+    std::error_code ec;
+    {
+        llvm::raw_fd_ostream out(tmpname, ec, llvm::sys::fs::OF_None);
+        if (ec)
+            return false;
+        out << data;
+        out.close();
+        if (out.has_error()) {
+            out.clear_error();
+            ec = std::make_error_code(std::errc::io_error);
+        }
+    }
+    std::string err;
+    bool ok = !ec && OIIO::Filesystem::rename(tmpname, filename, err);
+    if (!ok)
+        OIIO::Filesystem::remove(tmpname, err);
+    return ok;
+}
+
+
+
+// A cache file's name, without its directory, which fingerprints all
+// that went into it, is its key in a JITCacheBackend.  Fetching copies
+// the backend's file into the directory.
+static bool
+fetch_cache_file(JITCacheBackend* backend, const std::string& filename)
+{
+    std::string data;
+    return backend
+           && backend->get(OIIO::Filesystem::filename(filename), data)
+           && write_cache_file(filename, data);
+}
+
+
+
+static bool
+share_cache_file(JITCacheBackend* backend, const std::string& filename,
+                 llvm::StringRef data)
+{
+    return backend
+           && backend->put(OIIO::Filesystem::filename(filename),
+                           string_view(data.data(), data.size()));
+}
+
+
+
+/// ObjectCache - Persist the JIT-compiled object for one module on disk,
+/// so that a later process JITing an identical module can load it rather
+/// than running code generation again. The filename is derived from a
+/// fingerprint of the module contents, so it alone identifies the object.
+///
+/// With a wait, processes that miss at the same time elect one of them
+/// to compile: the first to create "<object>.lock" compiles and stores
+/// the object, and the others wait for it (for at most wait_ms) and load
+/// it, so that processes sharing a cache JIT each group only once.
+class LLVM_Util::ObjectCache final : public llvm::ObjectCache {
+public:
+    ObjectCache(std::string filename, int wait_ms,
+                const LLVM_Util* ll = nullptr)
+        : m_filename(std::move(filename)), m_ll(ll)
+    {
+        // Another node may have compiled it, if the cache has a backend
+        if (load() || fetch() || wait_ms <= 0)
+            return;
+        std::string lockname = m_filename + ".lock";
+        int fd               = -1;
+        if (!llvm::sys::fs::openFileForWrite(lockname, fd,
+                                             llvm::sys::fs::CD_CreateNew)) {
+            llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+            m_lockname = lockname;
+            // It may have been stored between load() and the lock
+            if (load())
+                unlock();
+            return;
+        }
+        // Another process is compiling it. A lock older than the wait is
+        // left from a process that died, so don't wait for it.
+        std::time_t locked = OIIO::Filesystem::last_write_time(lockname);
+        if (locked && std::time(nullptr) - locked > wait_ms / 1000 + 1)
+            return;
+        auto until = std::chrono::steady_clock::now()
+                     + std::chrono::milliseconds(wait_ms);
+        while (OIIO::Filesystem::exists(lockname)
+               && std::chrono::steady_clock::now() < until)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        m_waited = load();
+    }
+
+    ~ObjectCache() { unlock(); }
+
+    bool found() const { return m_cached != nullptr; }
+    bool stored() const { return m_stored; }
+    bool waited() const { return m_waited; }
+    bool fetched() const { return m_fetched; }
+    int variants_stored() const { return m_variants_stored; }
+    int shared() const { return m_shared; }
+
+    /// Also compile the module for these ISAs when it's compiled, and
+    /// store those objects in these files.
+    void variants(std::vector<std::pair<TargetISA, std::string>> v)
+    {
+        m_variants = std::move(v);
+    }
+
+    void notifyObjectCompiled(const llvm::Module* M,
+                              llvm::MemoryBufferRef obj) override
+    {
+        m_stored = write_cache_file(m_filename, obj.getBuffer());
+        unlock();
+        if (m_ll && share_cache_file(m_ll->m_cache_backend, m_filename,
+                                     obj.getBuffer()))
+            ++m_shared;
+        for (auto& v : m_variants) {
+            if (!M || !m_ll || OIIO::Filesystem::exists(v.second)
+                || !m_ll->emit_cache_object(*M, v.first, v.second))
+                continue;
+            ++m_variants_stored;
+            auto buf = llvm::MemoryBuffer::getFile(v.second);
+            if (buf
+                && share_cache_file(m_ll->m_cache_backend, v.second,
+                                    (*buf)->getBuffer()))
+                ++m_shared;
+        }
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer>
+    getObject(const llvm::Module* /*M*/) override
+    {
+        // Hand over our copy; MCJIT asks at most once per module.
+        return std::move(m_cached);
+    }
+
+private:
+    // Map the cached object, if there is one. Without the need for a
+    // terminating null, a large object is mapped rather than read, so
+    // processes on one node share its pages in the page cache.
+    bool load()
+    {
+#if OSL_LLVM_VERSION >= 130
+        auto buf = llvm::MemoryBuffer::getFile(m_filename, false, false);
+#else
+        auto buf = llvm::MemoryBuffer::getFile(m_filename, -1, false);
+#endif
+        if (buf)
+            m_cached = std::move(*buf);
+        return m_cached != nullptr;
+    }
+
+    // Copy the object from the cache's backend, if it has one, and load it
+    bool fetch()
+    {
+        m_fetched = m_ll && fetch_cache_file(m_ll->m_cache_backend, m_filename)
+                    && load();
+        return m_fetched;
+    }
+
+    void unlock()
+    {
+        if (m_lockname.size()) {
+            std::string err;
+            OIIO::Filesystem::remove(m_lockname, err);
+            m_lockname.clear();
+        }
+    }
+
+    std::string m_filename;
+    std::string m_lockname;  ///< The lock we hold while compiling
+    std::unique_ptr<llvm::MemoryBuffer> m_cached;
+    const LLVM_Util* m_ll;  ///< To compile the variants
+    std::vector<std::pair<TargetISA, std::string>> m_variants;
+    int m_variants_stored = 0;
+    int m_shared          = 0;  ///< Objects put in the backend
+    bool m_stored         = false;
+    bool m_waited         = false;
+    bool m_fetched        = false;
+};
+
+
+
+#if OSL_HAS_ORC_JIT
+#    if OSL_LLVM_VERSION >= 170
+using OrcSymbol = llvm::orc::ExecutorSymbolDef;
+
+static OrcSymbol
+orc_symbol(void* addr)
+{
+    return OrcSymbol(llvm::orc::ExecutorAddr::fromPtr(addr),
+                     llvm::JITSymbolFlags::Exported);
+}
+
+static void*
+orc_symbol_address(const OrcSymbol& sym)
+{
+    return sym.getAddress().toPtr<void*>();
+}
+#    else
+using OrcSymbol = llvm::JITEvaluatedSymbol;
+
+static OrcSymbol
+orc_symbol(void* addr)
+{
+    return OrcSymbol(llvm::pointerToJITTargetAddress(addr),
+                     llvm::JITSymbolFlags::Exported);
+}
+
+static void*
+orc_symbol_address(const OrcSymbol& sym)
+{
+    return llvm::jitTargetAddressToPointer<void*>(sym.getAddress());
+}
+#    endif
+
+
+
+// Resolve symbols that our modules reference but don't define, the same
+// way MCJIT does: anything known to the process (including symbols added
+// with add_global_mapping), then the lazy function creator.
+class OrcSymbolGenerator final : public llvm::orc::DefinitionGenerator {
+public:
+    OrcSymbolGenerator(void* (*creator)(const std::string&), char prefix)
+        : m_creator(creator), m_prefix(prefix)
+    {
+    }
+
+    llvm::Error tryToGenerate(llvm::orc::LookupState&, llvm::orc::LookupKind,
+                              llvm::orc::JITDylib& jd,
+                              llvm::orc::JITDylibLookupFlags,
+                              const llvm::orc::SymbolLookupSet& symbols) override
+    {
+        llvm::orc::SymbolMap found;
+        for (auto& sym : symbols) {
+            llvm::StringRef name = *sym.first;
+            if (m_prefix && name.size() && name.front() == m_prefix)
+                name = name.drop_front();
+            std::string n = name.str();
+            void* addr    = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(
+                n);
+            if (!addr && m_creator)
+                addr = m_creator(n);
+            if (addr)
+                found[sym.first] = orc_symbol(addr);
+        }
+        if (found.empty())
+            return llvm::Error::success();
+        return jd.define(llvm::orc::absoluteSymbols(std::move(found)));
+    }
+
+private:
+    void* (*m_creator)(const std::string&);
+    char m_prefix;
+};
+#endif
+
+
+
+// State needed when JITing with ORC rather than an MCJIT ExecutionEngine.
+struct LLVM_Util::OrcState {
+#if OSL_HAS_ORC_JIT
+    llvm::orc::LLJIT* jit = nullptr;  // shared, owned by orcjit_hold
+    std::unique_ptr<llvm::TargetMachine> target_machine;
+    llvm::orc::SymbolMap symbols;  // JITed addresses of module functions
+#endif
+    int compile_threads = 0;
+    bool lazy           = false;  // jit is an LLLazyJIT
+    std::vector<std::pair<std::string, void*>> function_mappings;
+    void* (*lazy_function_creator)(const std::string&) = nullptr;
 };
 
 
@@ -404,7 +989,14 @@ LLVM_Util::LLVM_Util(const PerThreadInfo& per_thread_info, int debuglevel,
         }
 
         if (!m_thread->llvm_jitmm) {
-            m_thread->llvm_jitmm = new LLVMMemoryManager(&llvm_default_mapper);
+#ifdef __linux__
+            if (jit_huge_pages)
+                m_thread->llvm_jitmm = new LLVMMemoryManager(
+                    &llvm_hugepage_mapper);
+            else
+#endif
+                m_thread->llvm_jitmm = new LLVMMemoryManager(
+                    &llvm_default_mapper);
             OSL_DASSERT(m_thread->llvm_jitmm);
             OSL_ASSERT(
                 jitmm_hold
@@ -452,6 +1044,7 @@ LLVM_Util::LLVM_Util(const PerThreadInfo& per_thread_info, int debuglevel,
     m_llvm_type_triple = type_struct(triplefields, "Vec3");
     m_llvm_type_triple_ptr
         = (llvm::PointerType*)llvm::PointerType::get(m_llvm_type_triple, 0);
+    m_llvm_type_triple_vector = llvm_vector_type(m_llvm_type_float, 3);
 
     // A matrix is a struct composed 16 floats
     std::vector<llvm::Type*> matrixfields(16, m_llvm_type_float);
@@ -555,6 +1148,11 @@ LLVM_Util::SetupLLVM()
     llvm::initializeCodeGen(registry);
 
     // PreventBitMasksFromBeingLiveinsToBasicBlocks
+    static llvm::RegisterPass<PreventBitMasksFromBeingLiveinsToBasicBlocks<4>>
+        sRegCustomPass2(
+            "PreventBitMasksFromBeingLiveinsToBasicBlocks<4>",
+            "Prevent Bit Masks <4xi1> From Being Liveins To Basic Blocks Pass",
+            false /* Only looks at CFG */, false /* Analysis Pass */);
     static llvm::RegisterPass<PreventBitMasksFromBeingLiveinsToBasicBlocks<8>>
         sRegCustomPass0(
             "PreventBitMasksFromBeingLiveinsToBasicBlocks<8>",
@@ -908,32 +1506,27 @@ LLVM_Util::module_from_bitcode(const char* bitcode, size_t size,
 
     typedef llvm::Expected<std::unique_ptr<llvm::Module>> ErrorOrModule;
 
-    llvm::MemoryBufferRef buf
-        = llvm::MemoryBufferRef(llvm::StringRef(bitcode, size), name);
-#ifdef OSL_FORCE_BITCODE_PARSE
-    //
-    // None of the below seems to be an issue for 3.9 and above.
-    // In other JIT code I've seen a related issue, though only on OS X.
-    // So if it is still is broken somewhere between 3.6 and 3.8: instead of
-    // defining OSL_FORCE_BITCODE_PARSE (which is slower), you may want to
-    // try prepending a "_" in two methods above:
-    //   LLVM_Util::MemoryManager::getPointerToNamedFunction
-    //   LLVM_Util::MemoryManager::getSymbolAddress.
-    //
-    // Using MCJIT should not require unconditionally parsing
-    // the bitcode. But for now, when using getLazyBitcodeModule to
-    // lazily deserialize the bitcode, MCJIT is unable to find the
-    // called functions due to disagreement about whether a leading "_"
-    // is part of the symbol name.
-    ErrorOrModule ModuleOrErr = llvm::parseBitcodeFile(buf, context());
-#else
-    ErrorOrModule ModuleOrErr = llvm::getLazyBitcodeModule(buf, context());
-#endif
-
-    if (err) {
-        error_string(ModuleOrErr.takeError(), err);
+    // The shadeop libraries are megabytes of bitcode, and every group
+    // JITed wants them, so each is parsed once, fully, into the thread's
+    // context, and each group gets a copy of that to link and prune.
+    // Copying the parsed module is much cheaper than reading the bitcode.
+    std::unique_ptr<llvm::Module>& parsed
+        = m_thread->bitcode_modules[std::make_pair(bitcode, size)];
+    if (!parsed) {
+        llvm::MemoryBufferRef buf
+            = llvm::MemoryBufferRef(llvm::StringRef(bitcode, size), name);
+        ErrorOrModule ModuleOrErr = llvm::parseBitcodeFile(buf, context());
+        if (!ModuleOrErr) {
+            if (err)
+                error_string(ModuleOrErr.takeError(), err);
+            else
+                llvm::consumeError(ModuleOrErr.takeError());
+            m_thread->bitcode_modules.erase(std::make_pair(bitcode, size));
+            return nullptr;
+        }
+        parsed = std::move(*ModuleOrErr);
     }
-    llvm::Module* m = ModuleOrErr ? ModuleOrErr->release() : nullptr;
+    llvm::Module* m = llvm::CloneModule(*parsed).release();
 #if 0
     // Debugging: print all functions in the module
     for (llvm::Module::iterator i = m->begin(); i != m->end(); ++i)
@@ -1419,32 +2012,9 @@ LLVM_Util::supports_isa(TargetISA target)
 
 
 
-// N.B. This method is never called for PTX generation, so don't be alarmed
-// if it's doing x86 specific things.
-llvm::ExecutionEngine*
-LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
-                               bool debugging_symbols, bool profiling_events)
+llvm::TargetOptions
+LLVM_Util::jit_target_options() const
 {
-    execengine(NULL);  // delete and clear any existing engine
-    if (err)
-        err->clear();
-    llvm::EngineBuilder engine_builder(
-        (std::unique_ptr<llvm::Module>(module())));
-
-    engine_builder.setEngineKind(llvm::EngineKind::JIT);
-    engine_builder.setErrorStr(err);
-    //engine_builder.setRelocationModel(llvm::Reloc::PIC_);
-    //engine_builder.setCodeModel(llvm::CodeModel::Default);
-    engine_builder.setVerifyModules(true);
-
-    // We are actually holding a LLVMMemoryManager
-    engine_builder.setMCJITMemoryManager(
-        std::unique_ptr<llvm::RTDyldMemoryManager>(
-            new MemoryManager(m_llvm_jitmm)));
-
-    engine_builder.setOptLevel(jit_aggressive() ? llvm::CodeGenOpt::Aggressive
-                                                : llvm::CodeGenOpt::Default);
-
     llvm::TargetOptions options;
     // Enables FMA's in IR generation.
     // However cpu feature set may or may not support FMA's independently
@@ -1484,8 +2054,40 @@ LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
     // It is instead accomplished with a MachineFunctionPrinterPass.
     options.PrintMachineCode = dumpasm();
 #endif
+    return options;
+}
+
 
-    engine_builder.setTargetOptions(options);
+
+// N.B. This method is never called for PTX generation, so don't be alarmed
+// if it's doing x86 specific things.
+llvm::ExecutionEngine*
+LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
+                               bool debugging_symbols, bool profiling_events)
+{
+    execengine(NULL);  // delete and clear any existing engine
+    if (err)
+        err->clear();
+    llvm::EngineBuilder engine_builder(
+        (std::unique_ptr<llvm::Module>(module())));
+
+    engine_builder.setEngineKind(llvm::EngineKind::JIT);
+    engine_builder.setErrorStr(err);
+    //engine_builder.setRelocationModel(llvm::Reloc::PIC_);
+    //engine_builder.setCodeModel(llvm::CodeModel::Default);
+    engine_builder.setVerifyModules(true);
+
+    // We are actually holding a LLVMMemoryManager
+    engine_builder.setMCJITMemoryManager(
+        std::unique_ptr<llvm::RTDyldMemoryManager>(
+            new MemoryManager(m_llvm_jitmm, &m_jit_memory,
+                              m_owned_jitmm ? &m_owned_jitmm->bytes
+                                            : nullptr)));
+
+    engine_builder.setOptLevel(jit_fast() ? llvm::CodeGenOpt::None
+                               : jit_aggressive() ? llvm::CodeGenOpt::Aggressive
+                                                  : llvm::CodeGenOpt::Default);
+    engine_builder.setTargetOptions(jit_target_options());
 
     detect_cpu_features(requestedISA, !jit_fma());
 
@@ -1573,6 +2175,16 @@ LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
         if (mVTuneNotifier != NULL) {
             m_llvm_exec->RegisterJITEventListener(mVTuneNotifier);
         }
+
+        // For Linux perf: a jitdump file (only if LLVM was built with
+        // -DLLVM_USE_PERF=ON, otherwise this returns nullptr), and a perf
+        // map, whose symbols are the group_layer function names.
+        if (llvm::JITEventListener* perf
+            = llvm::JITEventListener::createPerfJITEventListener())
+            m_llvm_exec->RegisterJITEventListener(perf);
+#ifdef __linux__
+        m_llvm_exec->RegisterJITEventListener(PerfMapListener::get());
+#endif
     }
 
     // Force it to JIT as soon as we ask it for the code pointer,
@@ -1585,6 +2197,212 @@ LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
 
 
 
+bool
+LLVM_Util::make_orc_jit(std::string* err,
+                        TargetISA requestedISA OSL_MAYBE_UNUSED,
+                        int compile_threads OSL_MAYBE_UNUSED,
+                        bool lazy OSL_MAYBE_UNUSED)
+{
+    m_orc.reset();
+    execengine(NULL);  // delete and clear any existing engine
+    if (err)
+        err->clear();
+#if OSL_HAS_ORC_JIT
+    detect_cpu_features(requestedISA, !jit_fma());
+
+    // Like the MCJIT engine, target a generic CPU of the process's triple
+    // plus just the features of the selected ISA.
+    llvm::orc::JITTargetMachineBuilder jtmb(
+        llvm::Triple(llvm::sys::getProcessTriple()));
+    jtmb.setCodeGenOptLevel(jit_fast() ? llvm::CodeGenOpt::None
+                            : jit_aggressive() ? llvm::CodeGenOpt::Aggressive
+                                               : llvm::CodeGenOpt::Default);
+    jtmb.setOptions(jit_target_options());
+    if (initCpuFeatures()) {
+        std::vector<std::string> attrvec;
+        for (auto f : get_required_cpu_features_for(m_target_isa))
+            attrvec.push_back(f);
+        jtmb.addFeatures(attrvec);
+    }
+
+    m_llvm_type_native_mask = m_supports_avx512f
+                                  ? m_llvm_type_wide_bool
+                                  : llvm_vector_type(m_llvm_type_int,
+                                                     m_vector_width);
+
+    auto tm = jtmb.createTargetMachine();
+    if (!tm) {
+        std::string msg = llvm::toString(tm.takeError());
+        if (err)
+            *err = msg;
+        return false;
+    }
+
+    compile_threads = std::max(0, compile_threads);
+    std::string key
+        = fmtformat("{} {} fma={} aggressive={} fast={} threads={} lazy={}",
+                    jtmb.getTargetTriple().str(),
+                    jtmb.getFeatures().getString(), jit_fma(), jit_aggressive(),
+                    jit_fast(), compile_threads, lazy);
+    llvm::orc::LLJIT* jit = nullptr;
+    {
+        OIIO::spin_lock lock(llvm_global_mutex);
+        OSL_ASSERT(
+            orcjit_hold
+            && "An instance of OSL::pvt::LLVM_Util::ScopedJitMemoryUser must exist with a longer lifetime than this LLVM_Util object");
+        for (auto& rec : *orcjit_hold)
+            if (rec.key == key)
+                jit = rec.jit.get();
+        if (!jit) {
+            auto create_jit
+                = [&]() -> llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>> {
+                if (lazy)
+                    return llvm::orc::LLLazyJITBuilder()
+                        .setJITTargetMachineBuilder(jtmb)
+                        .setNumCompileThreads(compile_threads)
+                        .create();
+                return llvm::orc::LLJITBuilder()
+                    .setJITTargetMachineBuilder(jtmb)
+                    .setNumCompileThreads(compile_threads)
+                    .create();
+            };
+            auto newjit = create_jit();
+            if (!newjit) {
+                std::string msg = llvm::toString(newjit.takeError());
+                if (err)
+                    *err = msg;
+                return false;
+            }
+            jit = newjit->get();
+            orcjit_hold->push_back({ key, std::move(*newjit) });
+        }
+    }
+
+    m_orc.reset(new OrcState);
+    m_orc->jit             = jit;
+    m_orc->target_machine  = std::move(*tm);
+    m_orc->compile_threads = compile_threads;
+    m_orc->lazy            = lazy;
+    module()->setDataLayout(jit->getDataLayout());
+    module()->setTargetTriple(jit->getTargetTriple().str());
+    return true;
+#else
+    if (err)
+        *err = "ORC JIT requires LLVM 13 or newer";
+    return false;
+#endif
+}
+
+
+
+#if OSL_HAS_ORC_JIT
+// Hand the finished module over to ORC, then JIT all of its externally
+// visible functions with a single lookup. With compile threads, the
+// module is first split into that many partitions, which the ORC thread
+// pool compiles concurrently, so a single huge group no longer has to
+// codegen serially.
+static llvm::Error
+orc_add_module(llvm::orc::LLJIT& jit, llvm::orc::JITDylib& dylib,
+               llvm::Module& module, bool lazy = false)
+{
+    // Each ThreadSafeModule needs a context of its own (ours is shared by
+    // everything this thread compiles), so move it over as bitcode.
+    llvm::SmallVector<char, 0> bitcode;
+    llvm::raw_svector_ostream bitcode_out(bitcode);
+    llvm::WriteBitcodeToFile(module, bitcode_out);
+    auto context = std::make_unique<llvm::LLVMContext>();
+#    if OSL_LLVM_VERSION >= 150
+    context->setOpaquePointers(false);
+#    endif
+    auto copy = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(), bitcode.size()),
+                              module.getModuleIdentifier()),
+        *context);
+    if (!copy)
+        return copy.takeError();
+    llvm::orc::ThreadSafeModule tsm(std::move(*copy), std::move(context));
+    if (lazy) {
+        // Every function gets a stub in dylib that compiles it on first
+        // call; internal functions are promoted so they can be stubbed too.
+        return static_cast<llvm::orc::LLLazyJIT&>(jit).addLazyIRModule(
+            dylib, std::move(tsm));
+    }
+    return jit.addIRModule(dylib, std::move(tsm));
+}
+#endif
+
+
+
+void
+LLVM_Util::orc_finalize_module()
+{
+#if OSL_HAS_ORC_JIT
+    llvm::orc::LLJIT& jit             = *m_orc->jit;
+    llvm::orc::ExecutionSession& sess = jit.getExecutionSession();
+    std::string dylibname;
+    {
+        OIIO::spin_lock lock(llvm_global_mutex);
+        dylibname = fmtformat("osl_module_{}", orc_dylib_serial++);
+    }
+    // A JITDylib per module, so that same-named functions of different
+    // groups never collide.
+    auto dylib = sess.createJITDylib(dylibname);
+    if (!dylib) {
+        OSL_ASSERT_MSG(0, "Could not create JITDylib: %s",
+                       llvm::toString(dylib.takeError()).c_str());
+        return;
+    }
+    dylib->addGenerator(std::make_unique<OrcSymbolGenerator>(
+        m_orc->lazy_function_creator, jit.getDataLayout().getGlobalPrefix()));
+
+    // Explicit function mappings, for those that are still only declared
+    // (a definition in the module itself takes precedence, as with MCJIT).
+    llvm::orc::SymbolMap mapped;
+    for (auto& m : m_orc->function_mappings) {
+        llvm::Function* f = m_llvm_module->getFunction(m.first);
+        if (f && f->isDeclaration())
+            mapped[jit.mangleAndIntern(m.first)] = orc_symbol(m.second);
+    }
+    if (!mapped.empty())
+        llvm::cantFail(dylib->define(llvm::orc::absoluteSymbols(mapped)));
+
+    llvm::orc::SymbolLookupSet lookupset;
+    for (llvm::Function& f : *m_llvm_module)
+        if (!f.isDeclaration() && !f.hasLocalLinkage())
+            lookupset.add(jit.mangleAndIntern(f.getName()));
+
+    auto add_modules = [&]() -> llvm::Error {
+        if (m_orc->lazy)  // compiled per function on demand, no splitting
+            return orc_add_module(jit, *dylib, *m_llvm_module, true);
+        if (m_orc->compile_threads < 2 || lookupset.size() < 2)
+            return orc_add_module(jit, *dylib, *m_llvm_module);
+        llvm::Error err = llvm::Error::success();
+        llvm::SplitModule(*m_llvm_module, m_orc->compile_threads,
+                          [&](std::unique_ptr<llvm::Module> part) {
+                              if (!err)
+                                  err = orc_add_module(jit, *dylib, *part);
+                          });
+        return err;
+    };
+    if (llvm::Error err = add_modules()) {
+        OSL_ASSERT_MSG(0, "Could not add module to ORC JIT: %s",
+                       llvm::toString(std::move(err)).c_str());
+        return;
+    }
+
+    auto syms = sess.lookup(llvm::orc::makeJITDylibSearchOrder(&*dylib),
+                            std::move(lookupset));
+    if (!syms) {
+        OSL_ASSERT_MSG(0, "ORC JIT failed: %s",
+                       llvm::toString(syms.takeError()).c_str());
+        return;
+    }
+    m_orc->symbols = std::move(*syms);
+#endif
+}
+
+
+
 #ifdef OSL_DEV
 // The return value of llvm::StructLayout::getAlignment()
 // changed from an int to llvm::Align, hide with accessor function
@@ -1609,7 +2427,7 @@ LLVM_Util::dump_struct_data_layout(llvm::Type* Ty OSL_MAYBE_UNUSED)
     OSL_ASSERT(Ty->isStructTy());
 
     llvm::StructType* structTy          = static_cast<llvm::StructType*>(Ty);
-    const llvm::DataLayout& data_layout = m_llvm_exec->getDataLayout();
+    const llvm::DataLayout& data_layout = jit_data_layout();
 
     int number_of_elements           = structTy->getNumElements();
     const llvm::StructLayout* layout = data_layout.getStructLayout(structTy);
@@ -1640,74 +2458,335 @@ LLVM_Util::validate_struct_data_layout(
     OSL_ASSERT(Ty);
     OSL_ASSERT(Ty->isStructTy());
 
-    llvm::StructType* structTy          = static_cast<llvm::StructType*>(Ty);
-    const llvm::DataLayout& data_layout = m_llvm_exec->getDataLayout();
+    llvm::StructType* structTy          = static_cast<llvm::StructType*>(Ty);
+    const llvm::DataLayout& data_layout = jit_data_layout();
+
+    int number_of_elements = structTy->getNumElements();
+
+    const llvm::StructLayout* layout = data_layout.getStructLayout(structTy);
+    OSL_DEV_ONLY(std::cout << "dump_struct_data_layout: getSizeInBytes("
+                           << layout->getSizeInBytes() << ") ")
+    OSL_DEV_ONLY(<< " getAlignment(" << get_alignment(layout) << ")")
+    OSL_DEV_ONLY(<< " hasPadding(" << layout->hasPadding() << ")" << std::endl);
+
+    for (int index = 0; index < number_of_elements; ++index) {
+        OSL_DEV_ONLY(llvm::Type* et = structTy->getElementType(index));
+
+        auto actual_offset = layout->getElementOffset(index);
+
+        OSL_ASSERT(index < static_cast<int>(expected_offset_by_index.size()));
+        OSL_DEV_ONLY(std::cout << "   element[" << index
+                               << "] offset in bytes = " << actual_offset
+                               << " expect offset = "
+                               << expected_offset_by_index[index] <<)
+        OSL_DEV_ONLY(" type is ");
+        {
+            llvm::raw_os_ostream os_cout(std::cout);
+            OSL_DEV_ONLY(et->print(os_cout));
+        }
+        OSL_ASSERT(expected_offset_by_index[index] == actual_offset);
+        OSL_DEV_ONLY(std::cout << std::endl);
+    }
+    if (static_cast<int>(expected_offset_by_index.size())
+        != number_of_elements) {
+        std::cout << "   expected " << expected_offset_by_index.size()
+                  << " members but actual member count is = "
+                  << number_of_elements << std::endl;
+        OSL_ASSERT(static_cast<int>(expected_offset_by_index.size())
+                   == number_of_elements);
+    }
+}
+
+
+
+size_t
+LLVM_Util::struct_element_offset(llvm::Type* Ty, int index) const
+{
+    OSL_ASSERT(Ty && Ty->isStructTy());
+    llvm::StructType* structTy = static_cast<llvm::StructType*>(Ty);
+    return jit_data_layout().getStructLayout(structTy)->getElementOffset(
+        index);
+}
+
+
+
+const llvm::DataLayout&
+LLVM_Util::jit_data_layout() const
+{
+#if OSL_HAS_ORC_JIT
+    if (m_orc)
+        return m_orc->jit->getDataLayout();
+#endif
+    return m_llvm_exec->getDataLayout();
+}
+
+
+
+void
+LLVM_Util::execengine(llvm::ExecutionEngine* exec)
+{
+    if (nullptr != m_llvm_exec) {
+        if (nullptr != mVTuneNotifier) {
+            // We explicitly remove the VTune listener, so it can't be notified of the object's release.
+            // As we are holding onto the memory backing the object, this should be fine.
+            // It is necessary because a profiler could try and lookup info from an object that otherwise
+            // would have been unregistered.
+            m_llvm_exec->UnregisterJITEventListener(mVTuneNotifier);
+            delete mVTuneNotifier;
+            mVTuneNotifier = nullptr;
+        }
+
+        // Likewise for the perf listeners, which are static. It's not an
+        // error to unregister a listener that isn't registered.
+        if (llvm::JITEventListener* perf
+            = llvm::JITEventListener::createPerfJITEventListener())
+            m_llvm_exec->UnregisterJITEventListener(perf);
+#ifdef __linux__
+        m_llvm_exec->UnregisterJITEventListener(PerfMapListener::get());
+#endif
+
+        if (debug_is_enabled()) {
+            // We explicitly remove the GDB listener, so it can't be notified of the object's release.
+            // As we are holding onto the memory backing the object, this should be fine.
+            // It is necessary because a debugger could try and lookup info from an object that otherwise
+            // would have been unregistered.
+
+            // The GDB listener is a static object, we really aren't creating one here
+            m_llvm_exec->UnregisterJITEventListener(
+                llvm::JITEventListener::createGDBRegistrationListener());
+        }
+        delete m_llvm_exec;
+        // The engine only borrows the object cache, so it must go second.
+        m_object_cache.reset();
+    }
+    if (m_orc) {
+        // ORC took a copy of the module, so the original is still ours.
+        m_orc.reset();
+        delete m_llvm_module;
+        m_llvm_module = nullptr;
+    }
+    m_llvm_exec = exec;
+}
+
+
+
+std::string
+LLVM_Util::jit_cache_options(TargetISA isa) const
+{
+    // Everything that can change the generated machine code for the same
+    // IR has to be part of the key, along with the IR itself.
+    return fmtformat("OSL {} LLVM {} {} fma={} aggressive={} fast={} O{} {}",
+                     OSL_LIBRARY_VERSION_STRING, LLVM_VERSION_STRING,
+                     target_isa_name(isa), jit_fma(), jit_aggressive(),
+                     jit_fast(), m_optlevel, m_pass_pipeline);
+}
+
+
+
+// The x86 ISAs, best first, for picking the best cached variant
+static const TargetISA isa_preference[]
+    = { TargetISA::AVX512, TargetISA::AVX512_noFMA, TargetISA::AVX2,
+        TargetISA::AVX2_noFMA, TargetISA::AVX, TargetISA::SSE4_2,
+        TargetISA::x64 };
+
+
+
+bool
+LLVM_Util::jit_object_cache(string_view dir, int wait_ms,
+                            const std::vector<TargetISA>& variant_isas)
+{
+    if (m_orc)
+        return false;  // Not supported with ORC
+    OSL_ASSERT(m_llvm_exec && m_llvm_module);
+    std::string err;
+    if (!OIIO::Filesystem::is_directory(dir)
+        && !OIIO::Filesystem::create_directories(dir, err))
+        return false;
+
+    // This host's ISA first, then the other variants, best first
+    std::vector<TargetISA> isas { m_target_isa };
+    for (TargetISA isa : isa_preference)
+        if (isa != m_target_isa
+            && std::find(variant_isas.begin(), variant_isas.end(), isa)
+                   != variant_isas.end())
+            isas.push_back(isa);
+    std::vector<std::string> options;
+    for (TargetISA isa : isas)
+        options.push_back(jit_cache_options(isa));
+    std::vector<std::string> files = module_cache_files(dir, options, "o");
+
+    // Without an object for this host, load the best variant it can run
+    m_object_cache_variant = false;
+    m_cache_fetched        = false;
+    if (isas.size() > 1 && !OIIO::Filesystem::exists(files[0])) {
+        // A backend's object for this host beats those for the variants
+        m_cache_fetched = fetch_cache_file(m_cache_backend, files[0]);
+        for (size_t i = 1; i < isas.size() && !m_cache_fetched; ++i) {
+            if (!supports_isa(isas[i]) || !OIIO::Filesystem::exists(files[i]))
+                continue;
+            m_object_cache.reset(new ObjectCache(files[i], 0));
+            if (m_object_cache->found()) {
+                m_object_cache_variant = true;
+                m_llvm_exec->setObjectCache(m_object_cache.get());
+                return true;
+            }
+        }
+    }
+
+    m_object_cache.reset(new ObjectCache(files[0], wait_ms, this));
+    m_cache_fetched |= m_object_cache->fetched();
+    if (!m_object_cache->found()) {
+        std::vector<std::pair<TargetISA, std::string>> variants;
+        for (size_t i = 1; i < isas.size(); ++i)
+            variants.emplace_back(isas[i], files[i]);
+        m_object_cache->variants(std::move(variants));
+    }
+    m_llvm_exec->setObjectCache(m_object_cache.get());
+    return m_object_cache->found();
+}
+
+
+
+// Compile the module (MCJIT's, after optimization) to an object for
+// another ISA, with the same target settings as the JIT's own, and store
+// it in the JIT object cache.
+bool
+LLVM_Util::emit_cache_object(const llvm::Module& module, TargetISA isa,
+                             const std::string& filename) const
+{
+    llvm::EngineBuilder engine_builder;
+    engine_builder.setOptLevel(jit_fast() ? llvm::CodeGenOpt::None
+                               : jit_aggressive() ? llvm::CodeGenOpt::Aggressive
+                                                  : llvm::CodeGenOpt::Default);
+    engine_builder.setTargetOptions(jit_target_options());
+    llvm::SmallVector<std::string, 32> attrvec;
+    for (auto f : get_required_cpu_features_for(isa))
+        attrvec.push_back(f);
+    std::unique_ptr<llvm::TargetMachine> target_machine(
+        engine_builder.selectTarget(llvm::Triple(module.getTargetTriple()),
+                                    "", "", attrvec));
+    if (!target_machine)
+        return false;
+
+    std::unique_ptr<llvm::Module> clone = llvm::CloneModule(module);
+    llvm::SmallVector<char, 0> obj;
+    llvm::raw_svector_ostream obj_out(obj);
+    llvm::legacy::PassManager mod_pm;
+#if OSL_LLVM_VERSION >= 100
+    if (target_machine->addPassesToEmitFile(mod_pm, obj_out, nullptr,
+                                            llvm::CGFT_ObjectFile))
+#else
+    if (target_machine->addPassesToEmitFile(
+            mod_pm, obj_out, nullptr, llvm::TargetMachine::CGFT_ObjectFile))
+#endif
+        return false;
+    mod_pm.run(*clone);
+    return write_cache_file(filename, llvm::StringRef(obj.data(), obj.size()));
+}
+
+
+
+bool
+LLVM_Util::jit_object_cache_stored() const
+{
+    return m_object_cache && m_object_cache->stored();
+}
+
+
+
+bool
+LLVM_Util::jit_object_cache_waited() const
+{
+    return m_object_cache && m_object_cache->waited();
+}
+
+
+
+bool
+LLVM_Util::jit_object_cache_variant() const
+{
+    return m_object_cache && m_object_cache_variant;
+}
+
+
+
+int
+LLVM_Util::jit_object_cache_variants_stored() const
+{
+    return m_object_cache ? m_object_cache->variants_stored() : 0;
+}
+
 
-    int number_of_elements = structTy->getNumElements();
 
-    const llvm::StructLayout* layout = data_layout.getStructLayout(structTy);
-    OSL_DEV_ONLY(std::cout << "dump_struct_data_layout: getSizeInBytes("
-                           << layout->getSizeInBytes() << ") ")
-    OSL_DEV_ONLY(<< " getAlignment(" << get_alignment(layout) << ")")
-    OSL_DEV_ONLY(<< " hasPadding(" << layout->hasPadding() << ")" << std::endl);
+int
+LLVM_Util::jit_cache_shared() const
+{
+    return (m_object_cache ? m_object_cache->shared() : 0)
+           + int(m_ptx_cache_shared);
+}
 
-    for (int index = 0; index < number_of_elements; ++index) {
-        OSL_DEV_ONLY(llvm::Type* et = structTy->getElementType(index));
 
-        auto actual_offset = layout->getElementOffset(index);
 
-        OSL_ASSERT(index < static_cast<int>(expected_offset_by_index.size()));
-        OSL_DEV_ONLY(std::cout << "   element[" << index
-                               << "] offset in bytes = " << actual_offset
-                               << " expect offset = "
-                               << expected_offset_by_index[index] <<)
-        OSL_DEV_ONLY(" type is ");
-        {
-            llvm::raw_os_ostream os_cout(std::cout);
-            OSL_DEV_ONLY(et->print(os_cout));
-        }
-        OSL_ASSERT(expected_offset_by_index[index] == actual_offset);
-        OSL_DEV_ONLY(std::cout << std::endl);
-    }
-    if (static_cast<int>(expected_offset_by_index.size())
-        != number_of_elements) {
-        std::cout << "   expected " << expected_offset_by_index.size()
-                  << " members but actual member count is = "
-                  << number_of_elements << std::endl;
-        OSL_ASSERT(static_cast<int>(expected_offset_by_index.size())
-                   == number_of_elements);
-    }
+std::string
+LLVM_Util::module_cache_file(string_view dir, string_view options,
+                             string_view extension)
+{
+    return module_cache_files(dir, { std::string(options) }, extension)[0];
 }
 
 
 
-void
-LLVM_Util::execengine(llvm::ExecutionEngine* exec)
+std::vector<std::string>
+LLVM_Util::module_cache_files(string_view dir,
+                              const std::vector<std::string>& options,
+                              string_view extension)
 {
-    if (nullptr != m_llvm_exec) {
-        if (nullptr != mVTuneNotifier) {
-            // We explicitly remove the VTune listener, so it can't be notified of the object's release.
-            // As we are holding onto the memory backing the object, this should be fine.
-            // It is necessary because a profiler could try and lookup info from an object that otherwise
-            // would have been unregistered.
-            m_llvm_exec->UnregisterJITEventListener(mVTuneNotifier);
-            delete mVTuneNotifier;
-            mVTuneNotifier = nullptr;
-        }
+    llvm::SmallVector<char, 0> bitcode;
+    llvm::raw_svector_ostream bitcode_out(bitcode);
+    llvm::WriteBitcodeToFile(*m_llvm_module, bitcode_out);
+    uint64_t irhash = OIIO::farmhash::Fingerprint64(bitcode.data(),
+                                                    bitcode.size());
+    std::vector<std::string> files;
+    for (const std::string& o : options) {
+        uint64_t opthash = OIIO::farmhash::Fingerprint64(o.data(), o.size());
+        files.push_back(fmtformat("{}/osl_{:016x}{:016x}_{}.{}", dir, irhash,
+                                  opthash, bitcode.size(), extension));
+    }
+    return files;
+}
 
-        if (debug_is_enabled()) {
-            // We explicitly remove the GDB listener, so it can't be notified of the object's release.
-            // As we are holding onto the memory backing the object, this should be fine.
-            // It is necessary because a debugger could try and lookup info from an object that otherwise
-            // would have been unregistered.
 
-            // The GDB listener is a static object, we really aren't creating one here
-            m_llvm_exec->UnregisterJITEventListener(
-                llvm::JITEventListener::createGDBRegistrationListener());
-        }
-        delete m_llvm_exec;
+
+bool
+LLVM_Util::ptx_cache(string_view dir, std::string& out)
+{
+#if OSL_USE_OPTIX
+    OSL_ASSERT(m_llvm_module);
+    std::string err;
+    if (!OIIO::Filesystem::is_directory(dir)
+        && !OIIO::Filesystem::create_directories(dir, err))
+        return false;
+    // ptx_compile_group() always uses the same target machine and options
+    std::string options = fmtformat("OSL {} LLVM {} PTX {}",
+                                    OSL_LIBRARY_VERSION_STRING,
+                                    LLVM_VERSION_STRING, CUDA_TARGET_ARCH);
+    m_ptx_cache_file   = module_cache_file(dir, options, "ptx");
+    m_ptx_cache_stored = false;
+    m_ptx_cache_shared = false;
+    m_cache_fetched    = false;
+    auto buf           = llvm::MemoryBuffer::getFile(m_ptx_cache_file);
+    if (!buf && fetch_cache_file(m_cache_backend, m_ptx_cache_file)) {
+        buf             = llvm::MemoryBuffer::getFile(m_ptx_cache_file);
+        m_cache_fetched = bool(buf);
     }
-    m_llvm_exec = exec;
+    if (!buf)
+        return false;
+    out = (*buf)->getBuffer().str();
+    m_ptx_cache_file.clear();
+    return true;
+#else
+    return false;
+#endif
 }
 
 
@@ -1717,6 +2796,22 @@ LLVM_Util::getPointerToFunction(llvm::Function* func)
 {
     OSL_DASSERT(func && "passed NULL to getPointerToFunction");
 
+    if (m_orc) {
+        if (!m_ModuleIsFinalized) {
+            orc_finalize_module();
+            m_ModuleIsFinalized = true;
+        }
+        void* f = nullptr;
+#if OSL_HAS_ORC_JIT
+        auto found = m_orc->symbols.find(
+            m_orc->jit->mangleAndIntern(func->getName()));
+        if (found != m_orc->symbols.end())
+            f = orc_symbol_address(found->second);
+#endif
+        OSL_ASSERT(f && "could not getPointerToFunction");
+        return f;
+    }
+
     if (debug_is_enabled()) {
         // We have to finalize debug info before jit happens
         m_llvm_debug_builder->finalize();
@@ -1725,6 +2820,10 @@ LLVM_Util::getPointerToFunction(llvm::Function* func)
     llvm::ExecutionEngine* exec = execengine();
     OSL_ASSERT(!exec->isCompilingLazily());
     if (!m_ModuleIsFinalized) {
+        // Bind the relocatable pointers, whether the object is about to be
+        // compiled or loaded from the cache.
+        for (auto& sym : m_reloc_symbols)
+            exec->addGlobalMapping(sym.first, uint64_t(sym.second));
         // Avoid lock overhead when called repeatedly
         // We don't need to finalize for each function we get
         exec->finalizeObject();
@@ -1747,6 +2846,10 @@ LLVM_Util::add_global_mapping(const char* global_var_name,
 void
 LLVM_Util::InstallLazyFunctionCreator(void* (*P)(const std::string&))
 {
+    if (m_orc) {
+        m_orc->lazy_function_creator = P;
+        return;
+    }
     llvm::ExecutionEngine* exec = execengine();
     exec->InstallLazyFunctionCreator(P);
 }
@@ -1758,6 +2861,7 @@ LLVM_Util::setup_optimization_passes(int optlevel, bool target_host)
 {
     OSL_DEV_ONLY(std::cout << "setup_optimization_passes " << optlevel);
     OSL_DASSERT(m_llvm_module_passes == NULL && m_llvm_func_passes == NULL);
+    m_optlevel = optlevel;
 
     // Construct the per-function passes and module-wide (interprocedural
     // optimization) passes.
@@ -1770,7 +2874,8 @@ LLVM_Util::setup_optimization_passes(int optlevel, bool target_host)
 
     llvm::TargetMachine* target_machine = nullptr;
     if (target_host) {
-        target_machine = execengine()->getTargetMachine();
+        target_machine = m_orc ? m_orc->target_machine.get()
+                               : execengine()->getTargetMachine();
         llvm::Triple ModuleTriple(module()->getTargetTriple());
         // Add an appropriate TargetLibraryInfo pass for the module's triple.
         llvm::TargetLibraryInfoImpl TLII(ModuleTriple);
@@ -1794,6 +2899,13 @@ LLVM_Util::setup_optimization_passes(int optlevel, bool target_host)
     // some expensive passes that were repeated many times and omitting
     // other passes that are not applicable or not profitable. Useful for
     // debugging, optlevel 10 adds next to no additional passes.
+    //
+    // With a new pass manager pipeline selected, do_optimize() runs that
+    // instead, and the legacy managers only keep the extra passes below.
+#if OSL_HAS_NEW_PASS_MANAGER
+    if (!m_pass_pipeline.empty())
+        optlevel = 10;
+#endif
     switch (optlevel) {
     default: {
         // For LLVM 3.0 and higher, llvm_optimize 1-3 means to use the
@@ -2048,7 +3160,8 @@ LLVM_Util::setup_optimization_passes(int optlevel, bool target_host)
                 mpm.add(new PreventBitMasksFromBeingLiveinsToBasicBlocks<8>());
                 break;
             case 4:
-                // We don't use masking or SIMD shading for 4-wide
+                // MUST BE THE FINAL PASS!
+                mpm.add(new PreventBitMasksFromBeingLiveinsToBasicBlocks<4>());
                 break;
             default:
                 std::cout << "m_vector_width = " << m_vector_width << "\n";
@@ -2070,6 +3183,11 @@ LLVM_Util::do_optimize(std::string* out_err)
         return;
 #endif
 
+#if OSL_HAS_NEW_PASS_MANAGER
+    if (!m_pass_pipeline.empty())
+        run_pass_pipeline(out_err);
+#endif
+
     m_llvm_func_passes->doInitialization();
     for (auto&& I : m_llvm_module->functions())
         if (!I.isDeclaration())
@@ -2080,6 +3198,108 @@ LLVM_Util::do_optimize(std::string* out_err)
 
 
 
+void
+LLVM_Util::run_pass_pipeline(std::string* out_err OSL_MAYBE_UNUSED)
+{
+#if OSL_HAS_NEW_PASS_MANAGER
+    // Time each pass exclusive of the passes nested inside it (pass
+    // managers and adaptors run other passes), so that the times add up.
+    typedef std::chrono::steady_clock clock;
+    struct Running {
+        clock::time_point start;
+        double nested;
+    };
+    std::vector<Running> running;
+    auto pass_done = [&](llvm::StringRef name) {
+        if (running.empty())
+            return;
+        Running r = running.back();
+        running.pop_back();
+        double t = std::chrono::duration<double>(clock::now() - r.start)
+                       .count();
+        m_pass_times[name.str()] += t - r.nested;
+        if (!running.empty())
+            running.back().nested += t;
+    };
+    llvm::PassInstrumentationCallbacks pic;
+    pic.registerBeforeNonSkippedPassCallback(
+        [&](llvm::StringRef, llvm::Any) {
+            running.push_back({ clock::now(), 0.0 });
+        });
+    pic.registerAfterPassCallback(
+        [&](llvm::StringRef name, llvm::Any, const llvm::PreservedAnalyses&) {
+            pass_done(name);
+        });
+    pic.registerAfterPassInvalidatedCallback(
+        [&](llvm::StringRef name, const llvm::PreservedAnalyses&) {
+            pass_done(name);
+        });
+
+    // OSL presets:
+    //   "fast"    cheap O1 pipeline without loop unrolling, for interactive
+    //             use and for tier-0 code;
+    //   "default" the standard pipeline for the llvm_optimize level;
+    //   "heavy"   O3 with loop and SLP vectorization, for final frames
+    //             (mostly of benefit to batched code).
+    // Anything else is parsed as a textual pipeline, as for `opt -passes`.
+    llvm::OptimizationLevel level = llvm::OptimizationLevel::O2;
+    int optlevel = m_optlevel >= 10 ? m_optlevel - 10 : m_optlevel;
+    switch (optlevel) {
+    case 0: level = llvm::OptimizationLevel::O0; break;
+    case 1: level = llvm::OptimizationLevel::O1; break;
+    case 3: level = llvm::OptimizationLevel::O3; break;
+    default: break;
+    }
+    bool heavy = (m_pass_pipeline == "heavy");
+    bool fast  = (m_pass_pipeline == "fast");
+    if (heavy)
+        level = llvm::OptimizationLevel::O3;
+    else if (fast)
+        level = llvm::OptimizationLevel::O1;
+    llvm::PipelineTuningOptions pto;
+    pto.LoopUnrolling     = !fast;
+    pto.LoopVectorization = heavy;
+    pto.SLPVectorization  = heavy;
+
+    llvm::TargetMachine* target_machine
+        = m_orc ? m_orc->target_machine.get()
+                : (m_llvm_exec ? m_llvm_exec->getTargetMachine() : nullptr);
+    llvm::PassBuilder pb(target_machine, pto, {}, &pic);
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cgam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+    llvm::ModulePassManager mpm;
+    if (!heavy && !fast && m_pass_pipeline != "default") {
+        llvm::Error err = pb.parsePassPipeline(mpm, m_pass_pipeline);
+        if (!err) {
+            mpm.run(*m_llvm_module, mam);
+            return;
+        }
+        // Fall back to the default pipeline rather than not optimizing.
+        std::string msg;
+        error_string(std::move(err), &msg);
+        if (out_err)
+            *out_err = fmtformat("Bad pass pipeline \"{}\": {}",
+                                 m_pass_pipeline, msg);
+        mpm = llvm::ModulePassManager();
+    }
+    if (level == llvm::OptimizationLevel::O0)
+        mpm = pb.buildO0DefaultPipeline(level);
+    else
+        mpm = pb.buildPerModuleDefaultPipeline(level);
+    mpm.run(*m_llvm_module, mam);
+#endif
+}
+
+
+
 // llvm::Value::getNumUses requires that the entire module be materialized
 // which defeats the purpose of the materialize & prune unneeded below we
 // need to avoid getNumUses and use the materialized_* iterators to count
@@ -2420,7 +3640,10 @@ LLVM_Util::validate_global_mappings(
     std::vector<std::string>& names_of_unmapped_globals)
 {
     for (llvm::GlobalVariable& global : m_llvm_module->globals()) {
-        if (global.hasExternalLinkage()) {
+        // Relocatable pointers are bound by us, not by the renderer.
+        if (global.hasExternalLinkage()
+            && !OIIO::Strutil::starts_with(global.getName().str(),
+                                           "osl_reloc_ptr_")) {
             void* global_addr
                 = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(
                     global.getName().data());
@@ -2433,6 +3656,138 @@ LLVM_Util::validate_global_mappings(
 
 
 
+std::vector<llvm::Function*>
+LLVM_Util::export_all_functions(std::string* out_err)
+{
+    std::vector<llvm::Function*> funcs;
+    LLVMErr err = m_llvm_module->materializeAll();
+    if (error_string(std::move(err), out_err))
+        return funcs;
+    for (llvm::Function& func : *m_llvm_module) {
+        if (func.isDeclaration())
+            continue;
+        func.setLinkage(llvm::GlobalValue::ExternalLinkage);
+        func.setVisibility(llvm::GlobalValue::DefaultVisibility);
+        func.setComdat(nullptr);
+        funcs.push_back(&func);
+    }
+    return funcs;
+}
+
+
+
+int
+LLVM_Util::link_shared_functions(
+    const std::unordered_map<std::string, void*>& library,
+    const std::unordered_set<llvm::Function*>& keep, int min_instructions)
+{
+    int linked = 0;
+    for (llvm::Function& func : *m_llvm_module) {
+        if (func.isDeclaration() || func.isMaterializable() || keep.count(&func)
+            || func.hasFnAttribute(llvm::Attribute::AlwaysInline))
+            continue;
+        auto found = library.find(func.getName().str());
+        if (found == library.end() || !found->second
+            || func.getInstructionCount() < unsigned(min_instructions))
+            continue;
+        // Dropping the body also makes the function external again.
+        func.deleteBody();
+        func.setComdat(nullptr);
+        func.setVisibility(llvm::GlobalValue::DefaultVisibility);
+        add_function_mapping(&func, found->second);
+        ++linked;
+    }
+    return linked;
+}
+
+
+
+// A rough count of the cycles one run of func takes, adding up what its
+// instructions cost as if each ran once and the functions of the module
+// it calls were run in place. In-progress is marked by -1 in costs, so
+// recursion counts as a plain call.
+static int
+estimated_cost(const llvm::Function& func,
+               std::unordered_map<const llvm::Function*, int>& costs,
+               int call_cost)
+{
+    auto found = costs.find(&func);
+    if (found != costs.end())
+        return found->second < 0 ? call_cost : found->second;
+    costs[&func] = -1;
+    int64_t cost = 0;
+    for (const llvm::BasicBlock& bb : func) {
+        for (const llvm::Instruction& inst : bb) {
+            switch (inst.getOpcode()) {
+            case llvm::Instruction::FDiv:
+            case llvm::Instruction::FRem:
+            case llvm::Instruction::SDiv:
+            case llvm::Instruction::UDiv:
+            case llvm::Instruction::SRem:
+            case llvm::Instruction::URem: cost += 12; break;
+            case llvm::Instruction::Load:
+            case llvm::Instruction::Store: cost += 2; break;
+            case llvm::Instruction::Call: {
+                const auto* call   = llvm::cast<llvm::CallBase>(&inst);
+                const auto* callee = call->getCalledFunction();
+                if (callee && callee->isIntrinsic())
+                    cost += 4;
+                else if (callee && !callee->isDeclaration())
+                    cost += estimated_cost(*callee, costs, call_cost);
+                else
+                    cost += call_cost + int(call->arg_size());
+                break;
+            }
+            default: cost += 1; break;
+            }
+        }
+    }
+    int c        = int(std::min(cost, int64_t(1) << 30));
+    costs[&func] = c;
+    return c;
+}
+
+
+
+int
+LLVM_Util::apply_inline_costs(const std::unordered_set<llvm::Function*>& keep,
+                              int call_cost, int max_inline_cost)
+{
+    std::unordered_map<const llvm::Function*, int> costs;
+    int decided = 0;
+    for (llvm::Function& caller : *m_llvm_module) {
+        for (llvm::BasicBlock& bb : caller) {
+            for (llvm::Instruction& inst : bb) {
+                auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+                llvm::Function* callee = call ? call->getCalledFunction()
+                                              : nullptr;
+                if (!callee || callee->isDeclaration()
+                    || callee->isMaterializable() || keep.count(callee)
+                    || callee->hasFnAttribute(llvm::Attribute::AlwaysInline)
+                    || callee->hasFnAttribute(llvm::Attribute::NoInline))
+                    continue;
+                int cost = estimated_cost(*callee, costs, call_cost);
+                llvm::Attribute::AttrKind kind;
+                if (cost <= call_cost)
+                    kind = llvm::Attribute::AlwaysInline;
+                else if (cost > max_inline_cost)
+                    kind = llvm::Attribute::NoInline;
+                else
+                    continue;
+#if OSL_LLVM_VERSION >= 140
+                call->addFnAttr(kind);
+#else
+                call->addAttribute(llvm::AttributeList::FunctionIndex, kind);
+#endif
+                ++decided;
+            }
+        }
+    }
+    return decided;
+}
+
+
+
 // DEPRECATED(1.13)
 void
 LLVM_Util::internalize_module_functions(
@@ -2477,6 +3832,10 @@ LLVM_Util::make_function(const std::string& name, bool fastcall,
 void
 LLVM_Util::add_function_mapping(llvm::Function* func, void* addr)
 {
+    if (m_orc) {
+        m_orc->function_mappings.emplace_back(func->getName().str(), addr);
+        return;
+    }
     execengine()->addGlobalMapping(func, addr);
 }
 
@@ -2851,11 +4210,36 @@ LLVM_Util::constant_ptr(void* p, llvm::PointerType* type)
 {
     if (!type)
         type = type_void_ptr();
+    if (m_jit_relocatable && p)
+        return builder().CreatePointerCast(relocatable_ptr(p), type,
+                                           "const pointer");
     return builder().CreateIntToPtr(constant(size_t(p)), type, "const pointer");
 }
 
 
 
+llvm::Constant*
+LLVM_Util::relocatable_ptr(void* p)
+{
+    // One external symbol per distinct address, named by order of first
+    // use, so identical IR implies identical meaning for every symbol even
+    // though the addresses they get bound to differ from run to run.
+    auto found = m_reloc_globals.find(p);
+    if (found != m_reloc_globals.end())
+        return found->second;
+    std::string name = fmtformat("osl_reloc_ptr_{}", m_reloc_symbols.size());
+    llvm::Constant* gv
+        = new llvm::GlobalVariable(*module(), m_llvm_type_int8,
+                                   false /*isConstant*/,
+                                   llvm::GlobalValue::ExternalLinkage,
+                                   nullptr, name);
+    m_reloc_globals[p] = gv;
+    m_reloc_symbols.emplace_back(std::move(name), p);
+    return gv;
+}
+
+
+
 llvm::Value*
 LLVM_Util::constant(ustring s)
 {
@@ -3296,23 +4680,11 @@ LLVM_Util::op_1st_active_lane_of(llvm::Value* mask)
         // and all types are happy
         intMaskType = type_int8();
         break;
-#if 0  // WIP
-        case 4:
-        {
-            // We can just reinterpret cast a 8 bit mask to a 8 bit integer
-            // and all types are happy
-            intMaskType = type_int8();
-
-//            extended_int_vector_type = (llvm::Type *) llvm::VectorType::get(llvm::Type::getInt32Ty (*m_llvm_context), m_vector_width);
-//            llvm::Value * wide_int_mask = builder().CreateSExt(mask, extended_int_vector_type);
-//
-//            int_reinterpret_cast_vector_type = (llvm::Type *) llvm::Type::getInt128Ty (*m_llvm_context);
-//            zeroConstant = constant128(0);
-//
-//            llvm::Value * mask_as_int =  builder().CreateBitCast (wide_int_mask, int_reinterpret_cast_vector_type);
-            break;
-        }
-#endif
+    case 4:
+        // A <4 x i1> reinterprets as an i4, the count of trailing zeros
+        // doesn't care that it is not a byte
+        intMaskType = llvm::IntegerType::get(context(), 4);
+        break;
     default: OSL_ASSERT(0 && "unsupported native bit mask width");
     };
 
@@ -3542,7 +4914,7 @@ LLVM_Util::offset_ptr(llvm::Value* ptr, int offset, llvm::Type* ptrtype)
 void
 LLVM_Util::assume_ptr_is_aligned(llvm::Value* ptr, unsigned alignment)
 {
-    const llvm::DataLayout& data_layout = m_llvm_exec->getDataLayout();
+    const llvm::DataLayout& data_layout = jit_data_layout();
     builder().CreateAlignmentAssumption(data_layout, ptr, alignment);
 }
 
@@ -3659,6 +5031,27 @@ LLVM_Util::mark_fast_func_call(llvm::Value* funccall)
 
 
 
+void
+LLVM_Util::mark_function_cold(llvm::Function* func)
+{
+    func->addFnAttr(llvm::Attribute::Cold);
+    func->addFnAttr(llvm::Attribute::OptimizeForSize);
+    func->addFnAttr(llvm::Attribute::NoInline);
+}
+
+
+
+void
+LLVM_Util::mark_function_hot(llvm::Function* func)
+{
+#if OSL_LLVM_VERSION >= 120
+    func->addFnAttr(llvm::Attribute::Hot);
+#endif
+    func->addFnAttr(llvm::Attribute::InlineHint);
+}
+
+
+
 void
 LLVM_Util::op_branch(llvm::BasicBlock* block)
 {
@@ -3678,6 +5071,46 @@ LLVM_Util::op_branch(llvm::Value* cond, llvm::BasicBlock* trueblock,
 
 
 
+void
+LLVM_Util::op_branch(llvm::Value* cond, llvm::BasicBlock* trueblock,
+                     llvm::BasicBlock* falseblock, uint32_t trueweight,
+                     uint32_t falseweight)
+{
+    llvm::MDBuilder mdbuilder(context());
+    builder().CreateCondBr(cond, trueblock, falseblock,
+                           mdbuilder.createBranchWeights(trueweight,
+                                                         falseweight));
+    set_insert_point(trueblock);
+}
+
+
+
+void
+LLVM_Util::op_atomic_add(llvm::Value* ptr, llvm::Value* val)
+{
+#if OSL_LLVM_VERSION >= 130
+    builder().CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, val,
+                              llvm::MaybeAlign(),
+                              llvm::AtomicOrdering::Monotonic);
+#else
+    builder().CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, val,
+                              llvm::AtomicOrdering::Monotonic);
+#endif
+}
+
+
+
+llvm::Value*
+LLVM_Util::op_readcyclecounter()
+{
+    llvm::Function* func
+        = llvm::Intrinsic::getDeclaration(module(),
+                                          llvm::Intrinsic::readcyclecounter);
+    return builder().CreateCall(func);
+}
+
+
+
 void
 LLVM_Util::set_insert_point(llvm::BasicBlock* block)
 {
@@ -3800,6 +5233,19 @@ LLVM_Util::op_linearize_8x_indices(llvm::Value* wide_index)
 }
 
 
+llvm::Value*
+LLVM_Util::op_linearize_4x_indices(llvm::Value* wide_index)
+{
+    llvm::Value* strided_indices = op_mul(wide_index, wide_constant(4, 4));
+    llvm::Constant* offsets_to_lane[4]
+        = { constant(0), constant(1), constant(2), constant(3) };
+    llvm::Value* const_vec_offsets = llvm::ConstantVector::get(
+        llvm::ArrayRef<llvm::Constant*>(&offsets_to_lane[0], 4));
+
+    return op_add(strided_indices, const_vec_offsets);
+}
+
+
 std::array<llvm::Value*, 2>
 LLVM_Util::op_split_16x(llvm::Value* vector_val)
 {
@@ -4415,6 +5861,38 @@ LLVM_Util::op_gather(llvm::Value* ptr, llvm::Value* wide_index)
 
 
 
+void
+LLVM_Util::op_scatter_narrow(llvm::Value* wide_val, llvm::Value* ptr,
+                             llvm::Value* wide_index)
+{
+    OSL_ASSERT(wide_index->getType() == type_wide_int());
+    // There are no 8 or 16 bit scatters, even with AVX-512, so store each
+    // lane of the mask in a block of its own, extracting everything first
+    llvm::Type* elem_type = wide_val->getType()->getScalarType();
+    llvm::Value* cast_ptr = ptr_to_cast(ptr, elem_type);
+    llvm::Value* cm       = current_mask();
+    llvm::Value* val_per_lane[MaxSupportedSimdLaneCount];
+    llvm::Value* mask_per_lane[MaxSupportedSimdLaneCount];
+    llvm::Value* index_per_lane[MaxSupportedSimdLaneCount];
+    for (int l = 0; l < m_vector_width; ++l) {
+        val_per_lane[l]   = op_extract(wide_val, l);
+        mask_per_lane[l]  = op_extract(cm, l);
+        index_per_lane[l] = op_extract(wide_index, l);
+    }
+    for (int l = 0; l < m_vector_width; ++l) {
+        llvm::BasicBlock* scatter_block = new_basic_block(
+            fmtformat("scatter narrow lane={}", l));
+        llvm::BasicBlock* next_block = new_basic_block(
+            fmtformat("after scatter narrow lane={}", l));
+        op_branch(mask_per_lane[l], scatter_block, next_block);
+        op_unmasked_store(val_per_lane[l],
+                          GEP(elem_type, cast_ptr, index_per_lane[l]));
+        op_branch(next_block);
+    }
+}
+
+
+
 void
 LLVM_Util::op_scatter(llvm::Value* wide_val, llvm::Value* ptr,
                       llvm::Value* wide_index)
@@ -4431,6 +5909,7 @@ LLVM_Util::op_scatter(llvm::Value* wide_val, llvm::Value* ptr,
                 linear_indices = op_linearize_16x_indices(wide_index);
                 break;
             case 8: linear_indices = op_linearize_8x_indices(wide_index); break;
+            case 4: linear_indices = op_linearize_4x_indices(wide_index); break;
             default: OSL_ASSERT(0 && "unsupported vector width for scatter");
             };
         } else {
@@ -5195,6 +6674,48 @@ LLVM_Util::op_masked_return()
 
 
 
+llvm::Value*
+LLVM_Util::op_load_triple_vector(llvm::Value* ptr)
+{
+    // A Vec3 is only aligned as a float, not as a <3 x float> would be.
+    // Its 12 bytes are still all a <3 x float> load reads.
+    ptr = ptr_cast(ptr, type_ptr(type_triple_vector()));
+#if OSL_LLVM_VERSION >= 100
+    return builder().CreateAlignedLoad(type_triple_vector(), ptr,
+                                       llvm::MaybeAlign(sizeof(float)));
+#else
+    return builder().CreateAlignedLoad(type_triple_vector(), ptr,
+                                       unsigned(sizeof(float)));
+#endif
+}
+
+
+
+void
+LLVM_Util::op_store_triple_vector(llvm::Value* val, llvm::Value* ptr)
+{
+    OSL_DASSERT(val->getType() == type_triple_vector());
+    ptr = ptr_cast(ptr, type_ptr(type_triple_vector()));
+#if OSL_LLVM_VERSION >= 100
+    builder().CreateAlignedStore(val, ptr, llvm::MaybeAlign(sizeof(float)));
+#else
+    builder().CreateAlignedStore(val, ptr, unsigned(sizeof(float)));
+#endif
+}
+
+
+
+llvm::Value*
+LLVM_Util::op_triple_vector(llvm::Value* x, llvm::Value* y, llvm::Value* z)
+{
+    llvm::Value* v = llvm::UndefValue::get(type_triple_vector());
+    v              = op_insert(v, x, 0);
+    v              = op_insert(v, y, 1);
+    return op_insert(v, z, 2);
+}
+
+
+
 void
 LLVM_Util::op_store(llvm::Value* val, llvm::Value* ptr)
 {
@@ -5345,7 +6866,9 @@ LLVM_Util::op_add(llvm::Value* a, llvm::Value* b)
 {
     if ((a->getType() == type_float() && b->getType() == type_float())
         || (a->getType() == type_wide_float()
-            && b->getType() == type_wide_float()))
+            && b->getType() == type_wide_float())
+        || (a->getType() == type_triple_vector()
+            && b->getType() == type_triple_vector()))
         return builder().CreateFAdd(a, b);
     if ((a->getType() == type_int() && b->getType() == type_int())
         || (a->getType() == type_wide_int() && b->getType() == type_wide_int())
@@ -5362,7 +6885,9 @@ LLVM_Util::op_sub(llvm::Value* a, llvm::Value* b)
 {
     if ((a->getType() == type_float() && b->getType() == type_float())
         || (a->getType() == type_wide_float()
-            && b->getType() == type_wide_float()))
+            && b->getType() == type_wide_float())
+        || (a->getType() == type_triple_vector()
+            && b->getType() == type_triple_vector()))
         return builder().CreateFSub(a, b);
     if ((a->getType() == type_int() && b->getType() == type_int())
         || (a->getType() == type_wide_int() && b->getType() == type_wide_int())
@@ -5377,7 +6902,8 @@ LLVM_Util::op_sub(llvm::Value* a, llvm::Value* b)
 llvm::Value*
 LLVM_Util::op_neg(llvm::Value* a)
 {
-    if ((a->getType() == type_float()) || (a->getType() == type_wide_float()))
+    if ((a->getType() == type_float()) || (a->getType() == type_wide_float())
+        || (a->getType() == type_triple_vector()))
         return builder().CreateFNeg(a);
     if ((a->getType() == type_int()) || (a->getType() == type_wide_int()))
         return builder().CreateNeg(a);
@@ -5392,7 +6918,9 @@ LLVM_Util::op_mul(llvm::Value* a, llvm::Value* b)
 {
     if ((a->getType() == type_float() && b->getType() == type_float())
         || (a->getType() == type_wide_float()
-            && b->getType() == type_wide_float()))
+            && b->getType() == type_wide_float())
+        || (a->getType() == type_triple_vector()
+            && b->getType() == type_triple_vector()))
         return builder().CreateFMul(a, b);
     if ((a->getType() == type_int() && b->getType() == type_int())
         || (a->getType() == type_wide_int() && b->getType() == type_wide_int())
@@ -5452,6 +6980,34 @@ LLVM_Util::op_float_to_int(llvm::Value* a)
 
 
 
+llvm::Value*
+LLVM_Util::op_float_to_storage(llvm::Value* a, TypeDesc::BASETYPE storage)
+{
+    bool wide = (a->getType() == type_wide_float());
+    OSL_DASSERT(wide || a->getType() == type_float());
+    if (storage == TypeDesc::HALF) {
+        llvm::Type* half = llvm::Type::getHalfTy(context());
+        llvm::Value* h   = builder().CreateFPTrunc(a, wide ? type_wide(half)
+                                                           : half);
+        return builder().CreateBitCast(h, wide ? type_wide(type_int16())
+                                               : type_int16());
+    }
+    if (storage == TypeDesc::UINT8) {
+        llvm::Value* zero = wide ? wide_constant(0.0f) : constant(0.0f);
+        llvm::Value* one  = wide ? wide_constant(1.0f) : constant(1.0f);
+        // Ordered compares, so that a NaN stores as 0
+        a = op_select(op_gt(a, zero, true), a, zero);
+        a = op_select(op_lt(a, one, true), a, one);
+        a = op_add(op_mul(a, wide ? wide_constant(255.0f) : constant(255.0f)),
+                   wide ? wide_constant(0.5f) : constant(0.5f));
+        return builder().CreateFPToUI(a, wide ? type_wide(type_int8())
+                                              : type_int8());
+    }
+    return a;
+}
+
+
+
 llvm::Value*
 LLVM_Util::op_float_to_double(llvm::Value* a)
 {
@@ -5939,6 +7495,17 @@ LLVM_Util::ptx_compile_group(llvm::Module* lib_module, const std::string& name,
 
     delete linked_module;
 
+    // Store it for ptx_cache() to find next time, unless the renderer's
+    // library is linked in, since that's not part of the key.
+    if (!m_ptx_cache_file.empty()) {
+        m_ptx_cache_stored = !lib_module
+                             && write_cache_file(m_ptx_cache_file, out);
+        m_ptx_cache_shared = m_ptx_cache_stored
+                             && share_cache_file(m_cache_backend,
+                                                 m_ptx_cache_file, out);
+        m_ptx_cache_file.clear();
+    }
+
     return true;
 #else
     return false;
@@ -5958,6 +7525,28 @@ LLVM_Util::bitcode_string(llvm::Function* func)
 
 
 
+uint64_t
+LLVM_Util::function_fingerprint(llvm::Function* func)
+{
+    for (llvm::Argument& arg : func->args())
+        arg.setName("");
+    for (llvm::BasicBlock& bb : *func) {
+        bb.setName("");
+        for (llvm::Instruction& inst : bb)
+            inst.setName("");
+    }
+    // The type and the blocks, but not the definition line that names it
+    std::string s;
+    llvm::raw_string_ostream stream(s);
+    func->getFunctionType()->print(stream);
+    for (llvm::BasicBlock& bb : *func)
+        stream << bb;
+    stream.flush();
+    return OIIO::farmhash::Fingerprint64(s.data(), s.size());
+}
+
+
+
 std::string
 LLVM_Util::bitcode_string(llvm::Module* module)
 {
@@ -5983,6 +7572,18 @@ LLVM_Util::module_string()
 
 
 
+size_t
+LLVM_Util::module_instruction_count() const
+{
+    size_t count = 0;
+    for (const llvm::Function& func : *m_llvm_module)
+        for (const llvm::BasicBlock& bb : func)
+            count += bb.size();
+    return count;
+}
+
+
+
 void
 LLVM_Util::delete_func_body(llvm::Function* func)
 {
@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>  // FIXME: used by timer.h - should be included there
 #include <cstdio>
 #include <string>
@@ -9,6 +11,7 @@
 
 #include "oslexec_pvt.h"
 #include "osoreader.h"
+#include "shaderpack.h"
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/hash.h>
@@ -38,6 +41,8 @@ public:
     virtual ~OSOReaderToMaster() {}
     virtual bool parse_file(const std::string& filename);
     virtual bool parse_memory(const std::string& oso);
+    // Parse a master from .oso text or an .osob image in memory.
+    bool parse_data(string_view data, const std::string& what);
     virtual void version(const char* specid, int major, int minor);
     virtual void shader(const char* shadertype, const char* name);
     virtual void symbol(SymType symtype, TypeSpec typespec, const char* name);
@@ -104,6 +109,21 @@ OSOReaderToMaster::parse_memory(const std::string& oso)
 
 
 
+bool
+OSOReaderToMaster::parse_data(string_view data, const std::string& what)
+{
+    m_master->m_osofilename   = what;
+    m_master->m_maincodebegin = 0;
+    m_master->m_maincodeend   = 0;
+    m_codesection.clear();
+    m_codesym = -1;
+    bool ok   = is_binary(data) ? parse_binary(data, what)
+                                : OSOReader::parse_memory(std::string(data));
+    return ok && !m_errors;
+}
+
+
+
 void
 OSOReaderToMaster::version(const char* /*specid*/, int major, int minor)
 {
@@ -395,6 +415,10 @@ OSOReaderToMaster::hint(string_view hintstring)
             m_master->m_ops.back().argwriteonly(2);
         return;
     }
+    if (Strutil::parse_prefix(h, "%pure") && m_master->m_ops.size()) {
+        m_master->m_ops.back().pure(true);
+        return;
+    }
     if (Strutil::parse_prefix(h, "%argderivs{")) {
         while (1) {
             string_view afield = Strutil::parse_until(h, ",}");
@@ -552,37 +576,225 @@ ShadingSystemImpl::loadshader(string_view cname)
 {
     if (Strutil::ends_with(cname, ".oso"))
         cname.remove_suffix(4);  // strip superfluous .oso
+    else if (Strutil::ends_with(cname, ".osob"))
+        cname.remove_suffix(5);  // ... or .osob
     if (!cname.size()) {
         error("Attempt to load shader with empty name \"\".");
         return NULL;
     }
     ++m_stat_shaders_requested;
     ustring name(cname);
-    lock_guard guard(m_mutex);  // Thread safety
-    ShaderNameMap::const_iterator found = m_shader_masters.find(name);
-    if (found != m_shader_masters.end()) {
-        // if (debug())
-        //     infofmt("Found {} in shader_masters", name);
-        // Already loaded this shader, return its reference
-        return (*found).second;
+    std::shared_future<ShaderMaster::ref> master;
+    {
+        LockWait wait(LockSite::Masters);
+        spin_rw_read_lock guard(m_shader_masters_mutex);  // Thread safety
+        wait.done();
+        ShaderNameMap::const_iterator found = m_shader_masters.find(name);
+        if (found != m_shader_masters.end())
+            master = found->second;
+    }
+    if (master.valid()) {
+        // Already loaded this shader (or another thread is loading it right
+        // now), return its reference once it's ready.
+        return master.get();
     }
 
-    // Not found in the map
+    // Not found in the map. Claim it, so that anybody else asking for the
+    // same master waits for us instead of reading it again, and then read
+    // it without holding the lock.
+    std::promise<ShaderMaster::ref> promise;
+    {
+        LockWait wait(LockSite::Masters);
+        spin_rw_write_lock guard(m_shader_masters_mutex);
+        wait.done();
+        auto inserted = m_shader_masters.emplace(name,
+                                                 promise.get_future().share());
+        if (!inserted.second)
+            master = inserted.first->second;  // Somebody beat us to it
+    }
+    if (master.valid())
+        return master.get();
+
+    ShaderMaster::ref r = read_shader_master(name);
+    promise.set_value(r);
+    if (!r) {
+        // Don't remember a failure: the next request looks again (and
+        // reports the error again), and finds a shader added since.
+        LockWait wait(LockSite::Masters);
+        spin_rw_write_lock guard(m_shader_masters_mutex);
+        wait.done();
+        m_shader_masters.erase(name);
+    }
+    return r;
+}
+
+
+
+std::string
+ShadingSystemImpl::find_shader_file(ustring name)
+{
+    std::string filename, binary_filename;
+    bool found = false;
+    if (m_searchpath_index || m_searchpath_manifest.size()) {
+        std::lock_guard<std::mutex> lock(m_shader_file_index_mutex);
+        if (!m_shader_files_indexed) {
+            index_shader_files();
+            m_shader_files_indexed = true;
+        }
+        auto m = m_shader_manifest.find(name);
+        if (m != m_shader_manifest.end())
+            return m->second;
+        // Only plain names are in the listing of the searchpath dirs
+        if (m_searchpath_index && m_searchpath_dirs.size()
+            && name.find_first_of("/\\") == ustring::npos) {
+            auto oso  = m_shader_file_index.find(name.string() + ".oso");
+            auto osob = m_shader_file_index.find(name.string() + ".osob");
+            if (oso != m_shader_file_index.end())
+                filename = oso->second;
+            if (osob != m_shader_file_index.end())
+                binary_filename = osob->second;
+            found = true;
+        }
+    }
+    if (!found) {
+        bool testcwd
+            = m_searchpath_dirs.empty();  // test "." if there's no searchpath
+        filename = OIIO::Filesystem::searchpath_find(name.string() + ".oso",
+                                                     m_searchpath_dirs,
+                                                     testcwd);
+        binary_filename
+            = OIIO::Filesystem::searchpath_find(name.string() + ".osob",
+                                                m_searchpath_dirs, testcwd);
+    }
+    // Prefer a binary .osob, which needs no parsing, unless there is an
+    // .oso that is newer (i.e., the shader was recompiled without -binary).
+    if (binary_filename.size()
+        && (filename.empty()
+            || OIIO::Filesystem::last_write_time(binary_filename)
+                   >= OIIO::Filesystem::last_write_time(filename)))
+        filename = binary_filename;
+    return filename;
+}
+
+
+
+void
+ShadingSystemImpl::index_shader_files()
+{
+    m_shader_manifest.clear();
+    m_shader_file_index.clear();
+
+    // Each line of the manifest is a shader name and the path of its
+    // .oso or .osob, relative to the manifest's directory unless absolute.
+    // Blank lines and lines starting with '#' are ignored.
+    if (m_searchpath_manifest.size()) {
+        std::string contents;
+        if (!OIIO::Filesystem::read_text_file(m_searchpath_manifest,
+                                              contents))
+            errorfmt("Could not read shader manifest \"{}\"",
+                     m_searchpath_manifest);
+        std::string dir = OIIO::Filesystem::parent_path(m_searchpath_manifest);
+        for (string_view line : Strutil::splitsv(contents, "\n")) {
+            line = Strutil::strip(line);
+            if (line.empty() || line[0] == '#')
+                continue;
+            string_view shadername = Strutil::parse_until(line, " \t");
+            string_view path       = Strutil::strip(line);
+            if (path.empty()) {
+                warningfmt("Shader manifest \"{}\" has no path for \"{}\"",
+                           m_searchpath_manifest, shadername);
+                continue;
+            }
+            std::string fullpath(path);
+            if (dir.size() && !OIIO::Filesystem::path_is_absolute(fullpath))
+                fullpath = dir + "/" + fullpath;
+            m_shader_manifest.emplace(ustring(shadername), fullpath);
+        }
+    }
+
+    // List each searchpath dir once, rather than look for every shader
+    // in each of them. The earlier dirs win, as with searchpath_find.
+    if (m_searchpath_index) {
+        for (auto& dir : m_searchpath_dirs) {
+            std::vector<std::string> entries;
+            OIIO::Filesystem::get_directory_entries(dir, entries);
+            for (auto& e : entries) {
+                std::string ext = OIIO::Filesystem::extension(e);
+                if (ext == ".oso" || ext == ".osob")
+                    m_shader_file_index.emplace(OIIO::Filesystem::filename(e),
+                                                e);
+            }
+        }
+    }
+}
+
+
+
+void
+ShadingSystemImpl::clear_shader_file_index()
+{
+    std::lock_guard<std::mutex> lock(m_shader_file_index_mutex);
+    m_shader_files_indexed = false;
+    m_shader_manifest.clear();
+    m_shader_file_index.clear();
+}
+
+
+
+ShaderMaster::ref
+ShadingSystemImpl::read_shader_master(ustring name)
+{
     OSOReaderToMaster oso(*this);
-    bool testcwd
-        = m_searchpath_dirs.empty();  // test "." if there's no searchpath
-    std::string filename
-        = OIIO::Filesystem::searchpath_find(name.string() + ".oso",
-                                            m_searchpath_dirs, testcwd);
+    // Shaders in the mounted library pack are read from its mapping,
+    // without searching for (or opening) any file.
+    std::shared_ptr<ShaderLibraryPack> pack;
+    {
+        spin_lock lock(m_shader_library_pack_mutex);
+        pack = m_shader_library_pack;
+    }
+    string_view data = pack ? pack->find(name) : string_view();
+    std::string filename, contents;
+    if (data.size())
+        filename = pack->filename() + ":" + name.string();
+    else
+        filename = find_shader_file(name);
     if (filename.empty()) {
         errorfmt("No .oso file could be found for shader \"{}\"", name);
         return NULL;
     }
     OIIO::Timer timer;
-    bool ok                = oso.parse_file(filename);
-    ShaderMaster::ref r    = ok ? oso.master() : nullptr;
-    m_shader_masters[name] = r;
-    double loadtime        = timer();
+    if (data.empty()) {
+        contents.resize(OIIO::Filesystem::file_size(filename));
+        if (OIIO::Filesystem::read_bytes(filename, &contents[0],
+                                         contents.size())
+            != contents.size()) {
+            errorfmt("Unable to read \"{}\"", filename);
+            return NULL;
+        }
+        data = contents;
+    }
+
+    // Byte-identical shaders (the same .oso in several versioned dirs, or
+    // under several names) share one master, which also lets their
+    // instances merge and their groups share optimized code.  Equal
+    // fingerprints are only candidates; the contents must match too.
+    uint64_t hash = OIIO::farmhash::Fingerprint64(data.data(), data.size());
+    {
+        spin_lock lock(m_master_contents_mutex);
+        auto range = m_master_contents.equal_range(hash);
+        for (auto found = range.first; found != range.second; ++found) {
+            if (found->second.first != data)
+                continue;
+            ++m_stat_masters_shared;
+            infofmt("\"{}\" is identical to \"{}\", sharing its master",
+                    filename, found->second.second->osofilename());
+            return found->second.second;
+        }
+    }
+
+    bool ok             = oso.parse_data(data, filename);
+    ShaderMaster::ref r = ok ? oso.master() : nullptr;
+    double loadtime     = timer();
     {
         spin_lock lock(m_stat_mutex);
         m_stat_master_load_time += loadtime;
@@ -598,6 +810,16 @@ ShadingSystemImpl::loadshader(string_view cname)
         //     if (s.length())
         //         infofmt("{}", s);
         // }
+        // Another thread may have read the same contents meanwhile
+        spin_lock lock(m_master_contents_mutex);
+        auto range = m_master_contents.equal_range(hash);
+        for (auto found = range.first; found != range.second; ++found) {
+            if (found->second.first == data) {
+                ++m_stat_masters_shared;
+                return found->second.second;
+            }
+        }
+        m_master_contents.emplace(hash, std::make_pair(std::string(data), r));
     } else {
         errorfmt("Unable to read \"{}\"", filename);
     }
@@ -607,6 +829,72 @@ ShadingSystemImpl::loadshader(string_view cname)
 
 
 
+void
+ShadingSystemImpl::push_prefetch(std::function<void()> task)
+{
+    OIIO::thread_pool* pool = m_compile_thread_pool
+                                  ? m_compile_thread_pool
+                                  : OIIO::default_thread_pool();
+    spin_lock lock(m_prefetch_mutex);
+    // Forget about prefetches that have already finished.
+    m_prefetch_tasks.erase(
+        std::remove_if(m_prefetch_tasks.begin(), m_prefetch_tasks.end(),
+                       [](const std::future<void>& f) {
+                           return f.wait_for(std::chrono::seconds(0))
+                                  == std::future_status::ready;
+                       }),
+        m_prefetch_tasks.end());
+    m_prefetch_tasks.push_back(
+        pool->push([task = std::move(task)](int) { task(); }));
+}
+
+
+
+void
+ShadingSystemImpl::prefetch_shaders(cspan<string_view> shadernames)
+{
+    for (string_view shadername : shadernames) {
+        // loadshader() does all the work; it publishes the master as
+        // pending before reading it, so a Shader() that arrives while it
+        // is loading just waits for it.
+        ustring name(shadername);
+        push_prefetch([this, name]() { loadshader(name); });
+    }
+}
+
+
+
+void
+ShadingSystemImpl::prefetch_textures(cspan<ustring> filenames)
+{
+    TextureSystem* ts = texturesys();
+    if (!ts)
+        return;
+    for (ustring filename : filenames) {
+        push_prefetch([ts, filename]() {
+            // Opening the file reads its header; one lookup with a
+            // footprint covering the whole image reads the coarsest MIP
+            // level.  Whatever goes wrong here will go wrong again, and
+            // be reported, when a shader makes the real lookups, so
+            // errors are just discarded.
+            TextureSystem::TextureHandle* handle
+                = ts->get_texture_handle(filename);
+            OIIO::ImageSpec spec;
+            if (handle && !ts->is_udim(handle)
+                && ts->get_imagespec(handle, nullptr, 0, spec)) {
+                TextureOpt opt;
+                float result[4];
+                ts->texture(handle, ts->get_perthread_info(), opt, 0.5f, 0.5f,
+                            1.0f, 0.0f, 0.0f, 1.0f,
+                            std::min(spec.nchannels, 4), result);
+            }
+            (void)ts->geterror();
+        });
+    }
+}
+
+
+
 bool
 ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
                                             string_view buffer)
@@ -622,21 +910,35 @@ ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
     }
 
     ustring name(shadername);
-    lock_guard guard(m_mutex);  // Thread safety
-    ShaderNameMap::const_iterator found = m_shader_masters.find(name);
-    if (found != m_shader_masters.end() && !allow_shader_replacement()) {
-        if (debug())
-            infofmt("Preload shader {} already exists in shader_masters", name);
-        return false;
+    {
+        LockWait wait(LockSite::Masters);
+        spin_rw_read_lock guard(m_shader_masters_mutex);  // Thread safety
+        wait.done();
+        ShaderNameMap::const_iterator found = m_shader_masters.find(name);
+        if (found != m_shader_masters.end() && !allow_shader_replacement()) {
+            if (debug())
+                infofmt("Preload shader {} already exists in shader_masters",
+                        name);
+            return false;
+        }
     }
 
     // Not found in the map
     OSOReaderToMaster reader(*this);
     OIIO::Timer timer;
-    bool ok                = reader.parse_memory(buffer);
-    ShaderMaster::ref r    = ok ? reader.master() : nullptr;
-    m_shader_masters[name] = r;
-    double loadtime        = timer();
+    bool ok             = reader.parse_memory(buffer);
+    ShaderMaster::ref r = ok ? reader.master() : nullptr;
+    if (ok)
+        r->resolve_syms();
+    {
+        std::promise<ShaderMaster::ref> loaded;
+        loaded.set_value(r);
+        LockWait wait(LockSite::Masters);
+        spin_rw_write_lock guard(m_shader_masters_mutex);
+        wait.done();
+        m_shader_masters[name] = loaded.get_future().share();
+    }
+    double loadtime = timer();
     {
         spin_lock lock(m_stat_mutex);
         m_stat_master_load_time += loadtime;
@@ -646,7 +948,6 @@ ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
         infofmt("Loaded \"{}\" (took {})", shadername,
                 Strutil::timeintervalformat(loadtime, 2));
         OSL_DASSERT(r);
-        r->resolve_syms();
         // if (debug()) {
         //     std::string s = r->print ();
         //     if (s.length())
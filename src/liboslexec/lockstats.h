@@ -0,0 +1,74 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <atomic>
+
+#include <OpenImageIO/timer.h>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+/// The shared locks whose waits may be timed, to find the one that stops
+/// shading from scaling with more threads.
+enum class LockSite {
+    Masters,      ///< The map of loaded shader masters
+    Dictionary,   ///< The documents and queries of dict_find
+    PointClouds,  ///< The map of point clouds, and each cloud's flushes
+    NSites
+};
+
+
+/// Time spent waiting for each LockSite, counted only while some
+/// ShadingSystem has the "lock_stats" option on.  The totals are of the
+/// whole process, as the dictionary and point cloud locks are not per
+/// ShadingSystem.
+struct LockStats {
+    static std::atomic<bool> enabled;
+    static std::atomic<long long> wait_ticks[int(LockSite::NSites)];
+    static std::atomic<long long> acquires[int(LockSite::NSites)];
+
+    static double wait_time(LockSite site)
+    {
+        return OIIO::Timer::seconds(wait_ticks[int(site)]);
+    }
+};
+
+
+/// Put around the acquisition of a lock of a LockSite: it times from its
+/// construction to done(), if lock stats are on, and costs a load and a
+/// branch if not.
+///
+///     LockWait wait(LockSite::Masters);
+///     spin_lock lock(mutex);
+///     wait.done();
+class LockWait {
+public:
+    explicit LockWait(LockSite site)
+        : m_site(LockStats::enabled.load(std::memory_order_relaxed) ? int(site)
+                                                                     : -1)
+        , m_timer(m_site >= 0 ? OIIO::Timer::StartNow
+                              : OIIO::Timer::DontStartNow)
+    {
+    }
+
+    void done()
+    {
+        if (m_site >= 0) {
+            LockStats::wait_ticks[m_site] += m_timer.ticks();
+            ++LockStats::acquires[m_site];
+            m_site = -1;
+        }
+    }
+
+private:
+    int m_site;
+    OIIO::Timer m_timer;
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
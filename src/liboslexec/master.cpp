@@ -53,6 +53,11 @@ ShaderMaster::~ShaderMaster()
 int
 ShaderMaster::findsymbol(ustring name) const
 {
+    if (!m_symbol_index.empty()) {
+        auto found = m_symbol_index.find(name);
+        return found != m_symbol_index.end() ? found->second : -1;
+    }
+    // Not indexed yet, we're still being loaded
     for (size_t i = 0; i < m_symbols.size(); ++i)
         if (m_symbols[i].name() == name)
             return (int)i;
@@ -102,11 +107,14 @@ ShaderMaster::resolve_syms()
 {
     SymbolPtrVec allsymptrs;
     allsymptrs.reserve(m_symbols.size());
+    m_symbol_index.clear();
+    m_symbol_index.reserve(m_symbols.size());
     m_firstparam = -1;
     m_lastparam  = -1;
     int i        = 0;
     for (auto&& s : m_symbols) {
         allsymptrs.push_back(&s);
+        m_symbol_index.emplace(s.name(), i);  // the first of a name wins
         // Fix up the size of the symbol's data (for one point, not
         // counting derivatives).
         if (s.typespec().is_closure()) {
@@ -0,0 +1,45 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+
+/////////////////////////////////////////////////////////////////////////
+/// \file
+///
+/// Shader interpreter implementation of getattribute through the free
+/// function renderer services.
+///
+/////////////////////////////////////////////////////////////////////////
+
+#include "oslexec_pvt.h"
+#include <OSL/rs_free_function.h>
+
+
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+
+
+// The getattribute of groups JITed with the renderer's rs_bitcode: unlike
+// osl_get_attribute, which goes through the context and its attribute
+// cache to the virtual RendererServices, this calls the renderer's own
+// rs_get_attribute, so that its fast paths inline into the shader.
+OSL_SHADEOP int
+osl_rs_get_attribute(void* sg_, int dest_derivs, ustring_pod obj_name,
+                     ustring_pod attr_name, int array_lookup, int index,
+                     long long attr_type, void* attr_dest)
+{
+    ShaderGlobals* sg = (ShaderGlobals*)sg_;
+    if (array_lookup)
+        return rs_get_array_attribute(sg, dest_derivs, USTR(obj_name),
+                                      TYPEDESC(attr_type), USTR(attr_name),
+                                      index, attr_dest);
+    return rs_get_attribute(sg, dest_derivs, USTR(obj_name),
+                            TYPEDESC(attr_type), USTR(attr_name), attr_dest);
+}
+
+
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
@@ -154,10 +154,18 @@ private:
     std::shared_ptr<OIIO::ColorConfig>
         m_colorconfig;  ///< OIIO/OCIO color configuration
 
-    // 1-item cache for the last requested custom color conversion processor
-    OIIO::ColorProcessorHandle m_last_colorproc;
-    ustring m_last_colorproc_fromspace;
-    ustring m_last_colorproc_tospace;
+    // Cache of the custom color conversion processors requested most
+    // recently, most recent first.  It belongs to one context, so needs no
+    // lock, and shaders that alternate between a few conversions (say,
+    // those of their textures) needn't ask the ColorConfig, and wait on
+    // its lock, for every one.
+    struct CachedColorProc {
+        ustring fromspace, tospace;
+        OIIO::ColorProcessorHandle proc;
+    };
+    static constexpr int colorproc_cache_size = 8;
+    CachedColorProc m_colorprocs[colorproc_cache_size];
+    int m_ncolorprocs = 0;
 #endif
 };
 
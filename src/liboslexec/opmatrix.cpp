@@ -27,6 +27,87 @@
 OSL_NAMESPACE_ENTER
 namespace pvt {
 
+#ifndef __CUDACC__
+// Explicit SIMD versions of the matrix math, one vfloat4 per matrix row,
+// which OIIO maps to SSE, AVX or NEON. They add up the products in the
+// same order as the scalar code, so the results are identical. Inverses
+// stay scalar to keep matching Imath's affine and Gauss-Jordan paths.
+using OIIO::simd::vfloat4;
+
+// The row vector (v,1) times M, all four columns.
+static OSL_FORCEINLINE vfloat4
+simd_transformp(const Matrix44& M, const Vec3& v)
+{
+    return vfloat4(v.x) * vfloat4(M.x[0]) + vfloat4(v.y) * vfloat4(M.x[1])
+           + vfloat4(v.z) * vfloat4(M.x[2]) + vfloat4(M.x[3]);
+}
+
+// The row vector (v,0) times M, all four columns.
+static OSL_FORCEINLINE vfloat4
+simd_transformv(const Matrix44& M, const Vec3& v)
+{
+    return vfloat4(v.x) * vfloat4(M.x[0]) + vfloat4(v.y) * vfloat4(M.x[1])
+           + vfloat4(v.z) * vfloat4(M.x[2]);
+}
+
+static OSL_FORCEINLINE void
+simd_mul(const Matrix44& a, const Matrix44& b, Matrix44& r)
+{
+    // All of b is loaded first, so r may be either operand.
+    vfloat4 b0(b.x[0]), b1(b.x[1]), b2(b.x[2]), b3(b.x[3]);
+    for (int i = 0; i < 4; ++i) {
+        vfloat4 row = vfloat4(a.x[i][0]) * b0 + vfloat4(a.x[i][1]) * b1
+                      + vfloat4(a.x[i][2]) * b2 + vfloat4(a.x[i][3]) * b3;
+        row.store(r.x[i]);
+    }
+}
+
+// Like robust_multVecMatrix: divide by w, or give 0 if it is 0.
+static OSL_FORCEINLINE void
+simd_transform_point(const Matrix44& M, const Vec3& v, Vec3& dst)
+{
+    vfloat4 p = simd_transformp(M, v);
+    float w   = p[3];
+    if (OSL_LIKELY(w != 0.0f))
+        (p / vfloat4(w)).store(&dst.x, 3);
+    else
+        dst.setValue(0.0f, 0.0f, 0.0f);
+}
+
+// The same with derivs, by the quotient rule of Dual division.
+static OSL_FORCEINLINE void
+simd_transform_point(const Matrix44& M, const Dual2<Vec3>& v,
+                     Dual2<Vec3>& dst)
+{
+    vfloat4 p  = simd_transformp(M, v.val());
+    vfloat4 dx = simd_transformv(M, v.dx());
+    vfloat4 dy = simd_transformv(M, v.dy());
+    float w    = p[3];
+    if (OSL_LIKELY(w != 0.0f)) {
+        vfloat4 winv(1.0f / w);
+        vfloat4 q   = p / vfloat4(w);
+        vfloat4 qdx = winv * (dx - q * vfloat4(dx[3]));
+        vfloat4 qdy = winv * (dy - q * vfloat4(dy[3]));
+        q.store(&dst.val().x, 3);
+        qdx.store(&dst.dx().x, 3);
+        qdy.store(&dst.dy().x, 3);
+    } else {
+        dst.set(Vec3(0.0f), Vec3(0.0f), Vec3(0.0f));
+    }
+}
+
+static OSL_FORCEINLINE void
+simd_transform_dir(const Matrix44& M, const Dual2<Vec3>& v, Dual2<Vec3>& dst)
+{
+    vfloat4 r  = simd_transformv(M, v.val());
+    vfloat4 dx = simd_transformv(M, v.dx());
+    vfloat4 dy = simd_transformv(M, v.dy());
+    r.store(&dst.val().x, 3);
+    dx.store(&dst.dx().x, 3);
+    dy.store(&dst.dy().x, 3);
+}
+#endif
+
 
 
 // Matrix ops
@@ -34,7 +115,11 @@ namespace pvt {
 OSL_SHADEOP OSL_HOSTDEVICE void
 osl_mul_mmm(void* r, void* a, void* b)
 {
+#ifndef __CUDACC__
+    simd_mul(MAT(a), MAT(b), MAT(r));
+#else
     MAT(r) = MAT(a) * MAT(b);
+#endif
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void
@@ -85,7 +170,11 @@ osl_transform_vmv(void* result, void* M_, void* v_)
 {
     const Vec3& v     = VEC(v_);
     const Matrix44& M = MAT(M_);
+#ifndef __CUDACC__
+    simd_transform_point(M, v, VEC(result));
+#else
     robust_multVecMatrix(M, v, VEC(result));
+#endif
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void
@@ -93,7 +182,11 @@ osl_transform_dvmdv(void* result, void* M_, void* v_)
 {
     const Dual2<Vec3>& v = DVEC(v_);
     const Matrix44& M    = MAT(M_);
+#ifndef __CUDACC__
+    simd_transform_point(M, v, DVEC(result));
+#else
     robust_multVecMatrix(M, v, DVEC(result));
+#endif
 }
 
 // vector = M * vector
@@ -103,7 +196,11 @@ osl_transformv_vmv(void* result, void* M_, void* v_)
     const Vec3& v     = VEC(v_);
     const Matrix44& M = MAT(M_);
     //M.multDirMatrix (v, VEC(result));
+#ifndef __CUDACC__
+    simd_transformv(M, v).store(&VEC(result).x, 3);
+#else
     multDirMatrix(M, v, VEC(result));
+#endif
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void
@@ -111,7 +208,11 @@ osl_transformv_dvmdv(void* result, void* M_, void* v_)
 {
     const Dual2<Vec3>& v = DVEC(v_);
     const Matrix44& M    = MAT(M_);
+#ifndef __CUDACC__
+    simd_transform_dir(M, v, DVEC(result));
+#else
     multDirMatrix(M, v, DVEC(result));
+#endif
 }
 
 
@@ -122,7 +223,11 @@ osl_transformn_vmv(void* result, void* M_, void* v_)
     const Vec3& v     = VEC(v_);
     const Matrix44& M = MAT(M_);
     //M.inverse().transposed().multDirMatrix (v, VEC(result));
+#ifndef __CUDACC__
+    simd_transformv(inlinedTransposed(M.inverse()), v).store(&VEC(result).x, 3);
+#else
     multDirMatrix(inlinedTransposed(M.inverse()), v, VEC(result));
+#endif
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void
@@ -131,10 +236,39 @@ osl_transformn_dvmdv(void* result, void* M_, void* v_)
     const Dual2<Vec3>& v = DVEC(v_);
     const Matrix44& M    = MAT(M_);
     //multDirMatrix (M.inverse().transposed(), v, DVEC(result));
+#ifndef __CUDACC__
+    simd_transform_dir(inlinedTransposed(M.inverse()), v, DVEC(result));
+#else
     multDirMatrix(inlinedTransposed(M.inverse()), v, DVEC(result));
+#endif
 }
 
 #ifndef __CUDACC__
+// Ask the renderer for a matrix with get(), unless it supports the
+// "transform_cache" and some layer already asked for the same one during
+// this execution.
+template<typename GetMatrix>
+static inline bool
+get_cached_matrix(ShaderGlobals* sg, Matrix44& M, uint64_t space, bool xform,
+                  bool inverse, GetMatrix&& get)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    if (!ctx->shadingsys().transform_cache())
+        return get();
+    ShadingContext::MatrixCacheKey key { space, sg->objdata, sg->time, xform,
+                                         inverse };
+    if (const ShadingContext::MatrixCacheEntry* e = ctx->find_cached_matrix(
+            key)) {
+        M = e->M;
+        return e->ok;
+    }
+    bool ok = get();
+    ctx->cache_matrix(key, ok, M);
+    return ok;
+}
+
+
+
 OSL_SHADEOP int
 osl_get_matrix(void* sg_, void* r, const char* from)
 {
@@ -146,14 +280,29 @@ osl_get_matrix(void* sg_, void* r, const char* from)
         return true;
     }
     if (HDSTR(from) == STRING_PARAMS(shader)) {
-        rs_get_matrix_xform_time(sg, MAT(r), sg->shader2common, sg->time);
+        get_cached_matrix(sg, MAT(r), uint64_t(uintptr_t(sg->shader2common)),
+                          true, false, [&]() {
+                              return rs_get_matrix_xform_time(sg, MAT(r),
+                                                              sg->shader2common,
+                                                              sg->time);
+                          });
         return true;
     }
     if (HDSTR(from) == STRING_PARAMS(object)) {
-        rs_get_matrix_xform_time(sg, MAT(r), sg->object2common, sg->time);
+        get_cached_matrix(sg, MAT(r), uint64_t(uintptr_t(sg->object2common)),
+                          true, false, [&]() {
+                              return rs_get_matrix_xform_time(sg, MAT(r),
+                                                              sg->object2common,
+                                                              sg->time);
+                          });
         return true;
     }
-    int ok = rs_get_matrix_space_time(sg, MAT(r), HDSTR(from), sg->time);
+    int ok = get_cached_matrix(sg, MAT(r), HDSTR(from).hash(), false, false,
+                               [&]() {
+                                   return rs_get_matrix_space_time(sg, MAT(r),
+                                                                   HDSTR(from),
+                                                                   sg->time);
+                               });
     if (!ok) {
         MAT(r).makeIdentity();
         ShadingContext* ctx = (ShadingContext*)((ShaderGlobals*)sg)->context;
@@ -176,16 +325,26 @@ osl_get_inverse_matrix(void* sg_, void* r, const char* to)
         return true;
     }
     if (HDSTR(to) == STRING_PARAMS(shader)) {
-        rs_get_inverse_matrix_xform_time(sg, MAT(r), sg->shader2common,
-                                         sg->time);
+        get_cached_matrix(sg, MAT(r), uint64_t(uintptr_t(sg->shader2common)),
+                          true, true, [&]() {
+                              return rs_get_inverse_matrix_xform_time(
+                                  sg, MAT(r), sg->shader2common, sg->time);
+                          });
         return true;
     }
     if (HDSTR(to) == STRING_PARAMS(object)) {
-        rs_get_inverse_matrix_xform_time(sg, MAT(r), sg->object2common,
-                                         sg->time);
+        get_cached_matrix(sg, MAT(r), uint64_t(uintptr_t(sg->object2common)),
+                          true, true, [&]() {
+                              return rs_get_inverse_matrix_xform_time(
+                                  sg, MAT(r), sg->object2common, sg->time);
+                          });
         return true;
     }
-    int ok = rs_get_inverse_matrix_space_time(sg, MAT(r), HDSTR(to), sg->time);
+    int ok = get_cached_matrix(sg, MAT(r), HDSTR(to).hash(), false, true,
+                               [&]() {
+                                   return rs_get_inverse_matrix_space_time(
+                                       sg, MAT(r), HDSTR(to), sg->time);
+                               });
     if (!ok) {
         MAT(r).makeIdentity();
         ShadingContext* ctx = (ShadingContext*)((ShaderGlobals*)sg)->context;
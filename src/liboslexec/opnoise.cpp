@@ -927,6 +927,14 @@ osl_noiseparams_set_impulses(void* opt, float i)
 
 
 
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_fast(void* opt, int f)
+{
+    ((RendererServices::NoiseOpt*)opt)->fast = f;
+}
+
+
+
 OSL_SHADEOP void
 osl_count_noise(void* sg_)
 {
@@ -30,6 +30,12 @@ osl_concat_sss(const char* s, const char* t)
     size_t sl  = USTR(s).length();
     size_t tl  = USTR(t).length();
     size_t len = sl + tl;
+    // Concatenating an empty string gives back an existing ustring, so
+    // there's nothing to intern.
+    if (tl == 0)
+        return s;
+    if (sl == 0)
+        return t;
     std::unique_ptr<char[]> heap_buf;
     char local_buf[256];
     char* buf = local_buf;
@@ -113,6 +119,8 @@ osl_substr_ssii(const char* s_, int start, int length)
     if (b < 0)
         b += slen;
     b = Imath::clamp(b, 0, slen);
+    if (b == 0 && length >= slen)
+        return s_;  // The whole string, no need to intern it again
     return ustring(s, b, Imath::clamp(length, 0, slen)).c_str();
 }
 
@@ -154,7 +162,8 @@ osl_format(const char* format_str, ...)
 {
     va_list args;
     va_start(args, format_str);
-    std::string s = Strutil::vsprintf(format_str, args);
+    StringFormatBuffer buf;
+    string_view s = buf.vsprintf(format_str, args);
     va_end(args);
     return ustring(s).c_str();
 }
@@ -163,6 +172,8 @@ osl_format(const char* format_str, ...)
 OSL_SHADEOP void
 osl_printf(ShaderGlobals* sg, const char* format_str, ...)
 {
+    if (!sg->context->printf_sampled(format_str))
+        return;
     va_list args;
     va_start(args, format_str);
 #if 0
@@ -170,7 +181,8 @@ osl_printf(ShaderGlobals* sg, const char* format_str, ...)
     std::string newfmt = std::string("llvm: ") + format_str;
     format_str = newfmt.c_str();
 #endif
-    std::string s = Strutil::vsprintf(format_str, args);
+    StringFormatBuffer buf;
+    string_view s = buf.vsprintf(format_str, args);
     va_end(args);
     sg->context->messagefmt("{}", s);
 }
@@ -181,7 +193,8 @@ osl_error(ShaderGlobals* sg, const char* format_str, ...)
 {
     va_list args;
     va_start(args, format_str);
-    std::string s = Strutil::vsprintf(format_str, args);
+    StringFormatBuffer buf;
+    string_view s = buf.vsprintf(format_str, args);
     va_end(args);
     sg->context->errorfmt("{}", s);
 }
@@ -193,7 +206,8 @@ osl_warning(ShaderGlobals* sg, const char* format_str, ...)
     if (sg->context->allow_warnings()) {
         va_list args;
         va_start(args, format_str);
-        std::string s = Strutil::vsprintf(format_str, args);
+        StringFormatBuffer buf;
+        string_view s = buf.vsprintf(format_str, args);
         va_end(args);
         sg->context->warningfmt("{}", s);
     }
@@ -207,13 +221,14 @@ osl_fprintf(ShaderGlobals* /*sg*/, const char* filename, const char* format_str,
 {
     va_list args;
     va_start(args, format_str);
-    std::string s = Strutil::vsprintf(format_str, args);
+    StringFormatBuffer buf;
+    string_view s = buf.vsprintf(format_str, args);
     va_end(args);
 
     static OIIO::mutex fprintf_mutex;
     OIIO::lock_guard lock(fprintf_mutex);
     FILE* file = OIIO::Filesystem::fopen(filename, "a");
-    fputs(s.c_str(), file);
+    fwrite(s.data(), 1, s.size(), file);
     fclose(file);
 }
 
@@ -224,9 +239,11 @@ osl_split(const char* str, ustring* results, const char* sep, int maxsplit,
           int resultslen)
 {
     maxsplit = OIIO::clamp(maxsplit, 0, resultslen);
-    std::vector<std::string> splits;
-    Strutil::split(USTR(str).string(), splits, USTR(sep).string(), maxsplit);
-    int n = std::min(maxsplit, (int)splits.size());
+    // Split into views of str, so only the pieces we return are copied
+    // (when they're interned).
+    auto splits = Strutil::splitsv(USTR(str).string(), USTR(sep).string(),
+                                   maxsplit);
+    int n       = std::min(maxsplit, (int)splits.size());
     for (int i = 0; i < n; ++i)
         results[i] = ustring(splits[i]);
     return n;
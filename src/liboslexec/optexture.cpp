@@ -11,9 +11,11 @@
 /////////////////////////////////////////////////////////////////////////
 
 #include <OpenImageIO/fmath.h>
+#include <OpenImageIO/hash.h>
 #include <OpenImageIO/simd.h>
 
 #include <cmath>
+#include <cstring>
 #include <iostream>
 
 #include "oslexec_pvt.h"
@@ -211,6 +213,71 @@ osl_texture_set_missingcolor_alpha(void* opt, int alphaindex,
 
 
 
+// Slow path of the JIT's udim tile lookup: ask the renderer which tile of
+// the table's texture (s,t) falls in, and remember it for the next time.
+OSL_SHADEOP void*
+osl_resolve_udim(void* sg_, void* table_, float s, float t)
+{
+    ShaderGlobals* sg    = (ShaderGlobals*)sg_;
+    UdimTileTable* table = (UdimTileTable*)table_;
+    TextureSystem::TextureHandle* tile
+        = sg->renderer->resolve_udim(table->udim_handle,
+                                     sg->context->texture_thread_info(), s, t);
+    // No such tile: the udim handle itself will report it.
+    if (!tile)
+        tile = table->udim_handle;
+    table->remember(s, t, tile);
+    return tile;
+}
+
+
+
+// Turn the filtered lookup of "texture_stochastic" into one fetch: at a
+// random position in the footprint, and at one level chosen of the two
+// that trilinear filtering would blend, with the probability of its
+// weight.  The footprint is first made isotropic at its minor axis, which
+// is the level anisotropic filtering would read.
+static void
+stochastic_texture(const ShaderGlobals* sg, int mode, TextureOpt& opt,
+                   float& s, float& t, float& dsdx, float& dtdx, float& dsdy,
+                   float& dtdy)
+{
+    // Random numbers from where and what is looked up, so that the
+    // samples of a pixel get different ones and renders are repeatable
+    uint32_t bits[5];
+    memcpy(bits + 0, &s, sizeof(float));
+    memcpy(bits + 1, &t, sizeof(float));
+    memcpy(bits + 2, &sg->P, 3 * sizeof(float));
+    uint32_t h0 = OIIO::bjhash::bjfinal(bits[0], bits[1], bits[2]);
+    uint32_t h1 = OIIO::bjhash::bjfinal(bits[3], bits[4], h0);
+    uint32_t h2 = OIIO::bjhash::bjfinal(h0, h1);
+    const float scale = 1.0f / 16777216.0f;  // 24 bits to [0,1)
+    float rx = float(h0 >> 8) * scale - 0.5f;
+    float ry = float(h1 >> 8) * scale - 0.5f;
+    float rl = float(h2 >> 8) * scale;
+
+    s += rx * dsdx + ry * dsdy;
+    t += rx * dtdx + ry * dtdy;
+    float lenx  = std::hypot(dsdx, dtdx);
+    float leny  = std::hypot(dsdy, dtdy);
+    float minor = std::min(lenx, leny);
+    // The one-level MIP mode reads the finer of the two levels, so
+    // growing the footprint by up to 2x reads the coarser one as often
+    // as trilinear weighs it.
+    float grow = OIIO::fast_exp2(rl);
+    float sx   = lenx > 0.0f ? grow * minor / lenx : 0.0f;
+    float sy   = leny > 0.0f ? grow * minor / leny : 0.0f;
+    dsdx *= sx;
+    dtdx *= sx;
+    dsdy *= sy;
+    dtdy *= sy;
+    opt.mipmode    = TextureOpt::MipModeOneLevel;
+    opt.interpmode = mode == 2 ? TextureOpt::InterpClosest
+                               : TextureOpt::InterpBilinear;
+}
+
+
+
 OSL_SHADEOP int
 osl_texture(void* sg_, const char* name, void* handle, void* opt_, float s,
             float t, float dsdx, float dtdx, float dsdy, float dtdy, int chans,
@@ -224,11 +291,25 @@ osl_texture(void* sg_, const char* name, void* handle, void* opt_, float s,
     // and ensure that they're being put in aligned memory.
     OIIO::simd::vfloat4 result_simd, dresultds_simd, dresultdt_simd;
     ustringhash em;
+    // The footprint looked up, which the stochastic mode changes, but the
+    // results' derivs are still taken along the shader's
+    float ls = s, lt = t;
+    float ldsdx = dsdx, ldtdx = dtdx, ldsdy = dsdy, ldtdy = dtdy;
+    int stochastic = sg->context->shadingsys().m_texture_stochastic;
+    TextureOpt stochastic_opt;
+    if (stochastic) {
+        stochastic_opt = *opt;
+        stochastic_texture(sg, stochastic, stochastic_opt, ls, lt, ldsdx,
+                           ldtdx, ldsdy, ldtdy);
+        opt = &stochastic_opt;
+    }
     bool ok = sg->renderer->texture(
         USTR(name).uhash(), (TextureSystem::TextureHandle*)handle,
-        sg->context->texture_thread_info(), *opt, sg, s, t, dsdx, dtdx, dsdy,
-        dtdy, 4, (float*)&result_simd, derivs ? (float*)&dresultds_simd : NULL,
+        sg->context->texture_thread_info(), *opt, sg, ls, lt, ldsdx, ldtdx,
+        ldsdy, ldtdy, 4, (float*)&result_simd,
+        derivs ? (float*)&dresultds_simd : NULL,
         derivs ? (float*)&dresultdt_simd : NULL, errormessage ? &em : nullptr);
+    sg->context->incr_live_counter(LiveCounters::TextureCalls);
 
     for (int i = 0; i < chans; ++i)
         ((float*)result)[i] = result_simd[i];
@@ -291,6 +372,7 @@ osl_texture3d(void* sg_, const char* name, void* handle, void* opt_, void* P_,
         derivs ? (float*)&dresultdt_simd : nullptr,
         derivs ? (float*)&dresultdr_simd : nullptr,
         errormessage ? &em : nullptr);
+    sg->context->incr_live_counter(LiveCounters::TextureCalls);
 
     for (int i = 0; i < chans; ++i)
         ((float*)result)[i] = result_simd[i];
@@ -346,6 +428,7 @@ osl_environment(void* sg_, const char* name, void* handle, void* opt_, void* R_,
                                         *opt, sg, R, dRdx, dRdy, 4,
                                         (float*)&local_result, NULL, NULL,
                                         errormessage ? &em : nullptr);
+    sg->context->incr_live_counter(LiveCounters::TextureCalls);
 
     for (int i = 0; i < chans; ++i)
         ((float*)result)[i] = local_result[i];
@@ -484,6 +567,39 @@ osl_trace(void* sg_, void* opt_, void* Pos_, void* dPosdx_, void* dPosdy_,
     const Vec3* Dir    = (Vec3*)Dir_;
     const Vec3* dDirdx = dDirdx_ ? (Vec3*)dDirdx_ : &Zero;
     const Vec3* dDirdy = dDirdy_ ? (Vec3*)dDirdy_ : &Zero;
+    sg->context->incr_live_counter(LiveCounters::TraceCalls);
+    if (DeferredTraces* deferred = sg->context->deferred_traces()) {
+        // The same ray as this call asked for last time has its result,
+        // once the renderer has traced it.
+        int i = deferred->next++;
+        if (i < int(deferred->rays.size())) {
+            const DeferredTraces::Ray& ray(deferred->rays[i]);
+            if (ray.P == *Pos && ray.R == *Dir && ray.dPdx == *dPosdx
+                && ray.dPdy == *dPosdy && ray.dRdx == *dDirdx
+                && ray.dRdy == *dDirdy && ray.options.mindist == opt->mindist
+                && ray.options.maxdist == opt->maxdist
+                && ray.options.shade == opt->shade
+                && ray.options.traceset == opt->traceset) {
+                if (ray.result < 0)
+                    return 0;
+                deferred->current = i;
+                return ray.result;
+            }
+        }
+        // A new ray. The rays after it were on a path that this shade
+        // no longer takes.
+        deferred->rays.resize(i);
+        DeferredTraces::Ray ray;
+        ray.options = *opt;
+        ray.P       = *Pos;
+        ray.dPdx    = *dPosdx;
+        ray.dPdy    = *dPosdy;
+        ray.R       = *Dir;
+        ray.dRdx    = *dDirdx;
+        ray.dRdy    = *dDirdy;
+        deferred->rays.push_back(ray);
+        return 0;
+    }
     return sg->renderer->trace(*opt, sg, *Pos, *dPosdx, *dPosdy, *Dir, *dDirdx,
                                *dDirdy);
 }
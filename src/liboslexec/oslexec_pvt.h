@@ -4,6 +4,14 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <deque>
 #include <list>
 #include <map>
 #include <memory>
@@ -11,7 +19,9 @@
 #include <set>
 #include <stack>
 #include <string>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <boost/thread/tss.hpp> /* for thread_specific_ptr */
@@ -36,6 +46,7 @@
 #include <OSL/dual.h>
 #include <OSL/dual_vec.h>
 #include <OSL/genclosure.h>
+#include <OSL/jitcache.h>
 #include <OSL/llvm_util.h>
 #include <OSL/mask.h>
 #include <OSL/oslclosure.h>
@@ -45,7 +56,10 @@
 
 #include "shading_state_uniform.h"
 #include "constantpool.h"
+#include "lockstats.h"
 #include "opcolor.h"
+#include "printfring.h"
+#include "shadingcache.h"
 
 
 using namespace OSL;
@@ -59,6 +73,9 @@ using OIIO::ParamValueList;
 using OIIO::RefCnt;
 using OIIO::spin_lock;
 using OIIO::spin_mutex;
+using OIIO::spin_rw_mutex;
+using OIIO::spin_rw_read_lock;
+using OIIO::spin_rw_write_lock;
 namespace Strutil = OIIO::Strutil;
 
 
@@ -73,6 +90,7 @@ struct PerThreadInfo {
 
     std::stack<ShadingContext*> context_pool;
     LLVM_Util::PerThreadInfo llvm_thread_info;
+    int numa_node = 0;  ///< Node of the creating thread, with numa_aware
 };
 
 
@@ -84,6 +102,8 @@ class ShadingSystemImpl;
 class ShaderInstance;
 typedef std::shared_ptr<ShaderInstance> ShaderInstanceRef;
 class Dictionary;
+class SharedDictionary;
+class ShaderLibraryPack;
 class RuntimeOptimizer;
 class BackendLLVM;
 #if OSL_USE_BATCHED
@@ -275,6 +295,34 @@ USTR(const void* s) noexcept
 
 
 
+/// printf-style formatting for the string shadeops, into a buffer on the
+/// stack unless the result won't fit, so that making a temporary string
+/// (or one that is only interned at the end) doesn't touch the heap.  The
+/// result is valid for the lifetime of the StringFormatBuffer.
+class StringFormatBuffer {
+public:
+    string_view vsprintf(const char* format, va_list args)
+    {
+        va_list args_copy;
+        va_copy(args_copy, args);
+        int len = vsnprintf(m_local, sizeof(m_local), format, args_copy);
+        va_end(args_copy);
+        if (len < 0)
+            return string_view();
+        if (size_t(len) < sizeof(m_local))
+            return string_view(m_local, size_t(len));
+        m_heap.reset(new char[len + 1]);
+        vsnprintf(m_heap.get(), len + 1, format, args);
+        return string_view(m_heap.get(), size_t(len));
+    }
+
+private:
+    char m_local[256];
+    std::unique_ptr<char[]> m_heap;
+};
+
+
+
 /// Like an int (of type T), but also internally keeps track of the
 /// maximum value is has held, and the total "requested" deltas.
 /// You really shouldn't use an unsigned type for T, for two reasons:
@@ -410,7 +458,8 @@ public:
     /// Run through the symbols and set up various things we can know
     /// with just the master: the size (including padding), and their
     /// data pointers if they are constants or params (to the defaults).
-    /// As a side effect, also set this->m_firstparam/m_lastparam.
+    /// As a side effect, also set this->m_firstparam/m_lastparam, and
+    /// index the symbols by name for findsymbol.
     void resolve_syms();
 
     /// Find the named symbol, return its index in the symbol array, or
@@ -448,6 +497,8 @@ public:
 
     int num_params() const { return m_lastparam - m_firstparam; }
 
+    int num_ops() const { return (int)m_ops.size(); }
+
     int raytype_queries() const { return m_raytype_queries; }
 
     bool range_checking() const { return m_range_checking; }
@@ -472,6 +523,8 @@ private:
     int m_maincodebegin, m_maincodeend;  ///< Main shader code range
     int m_raytype_queries;               ///< Bitmask of raytypes queried
     bool m_range_checking;  ///< Is range checking enabled for this shader?
+    // Index of the (first) symbol of each name, shared by the instances
+    std::unordered_map<ustring, int> m_symbol_index;
 
     friend class OSOReaderToMaster;
     friend class ShaderInstance;
@@ -523,6 +576,34 @@ private:
 
 
 
+/// Running totals that a ShadingContext keeps for live_stats().  Only the
+/// thread that owns the context writes them, so bumping one is a relaxed
+/// load and store rather than a locked add, while a monitoring thread may
+/// read them at any time.
+struct LiveCounters {
+    enum Counter {
+        Shades,
+        Layers,
+        TextureCalls,
+        TraceCalls,
+        Closures,
+        NCounters
+    };
+    atomic_ll counts[NCounters] = {};
+
+    void incr(Counter c, long long n = 1)
+    {
+        counts[c].store(counts[c].load(std::memory_order_relaxed) + n,
+                        std::memory_order_relaxed);
+    }
+    long long get(Counter c) const
+    {
+        return counts[c].load(std::memory_order_relaxed);
+    }
+};
+
+
+
 class ShadingSystemImpl {
 public:
     ShadingSystemImpl(RendererServices* renderer   = NULL,
@@ -551,6 +632,9 @@ public:
     bool getattribute(ShaderGroup* group, string_view name, TypeDesc type,
                       void* val);
     bool LoadMemoryCompiledShader(string_view shadername, string_view buffer);
+    void prefetch_shaders(cspan<string_view> shadernames);
+    void prefetch_textures(cspan<ustring> filenames);
+    std::vector<ustring> textures_needed() const;
     bool Parameter(ShaderGroup& group, string_view name, TypeDesc t,
                    const void* val, ParamHints props);
     bool Parameter(string_view name, TypeDesc t, const void* val,
@@ -571,6 +655,13 @@ public:
                                     string_view groupspec);
     bool ReParameter(ShaderGroup& group, string_view layername,
                      string_view paramname, TypeDesc type, const void* val);
+    bool ReParameter(ShaderGroup& group, span<ShadingSystem::ParamEdit> edits,
+                     int& changed_begin, int& changed_end);
+    bool take_interactive_changes(ShaderGroup& group, int& begin, int& end);
+    uint32_t device_string_index(ustring str);
+    uint32_t find_device_string(ustringhash hash) const;
+    size_t device_string_table(size_t first,
+                               std::vector<uint64_t>& hashes) const;
 
     // Internal error, warning, info, and message reporting routines that
     // take std::format-like arguments.
@@ -604,10 +695,70 @@ public:
 
     std::string getstats(int level = 1) const;
 
+    /// The statistics of getstats() as JSON, plus histograms of the
+    /// groups' compile times and sizes, and the topn most executed groups.
+    std::string getstats_json(int topn = 10) const;
+    ShadingSystem::LiveStats live_stats() const;
+    void register_live_counters(LiveCounters* counters);
+    void unregister_live_counters(LiveCounters* counters);
+
+    /// The "profile_instrument" results of all the groups that currently
+    /// exist, as JSON.
+    std::string profile_instrument_json() const;
+
+    /// Seconds per tick of profile_clock(), as measured since the shading
+    /// system was created.
+    double profile_clock_seconds() const;
+
     ErrorHandler& errhandler() const { return *m_err; }
 
     ShaderMaster::ref loadshader(string_view name);
 
+    /// Snapshot of all groups that currently exist.
+    std::vector<ShaderGroupRef> all_shader_groups() const;
+
+    /// Drop the census's references to groups that no longer exist.
+    void compact_shader_groups();
+
+    /// The calling thread's current group of the non-group-reference
+    /// calls (empty if it's not between ShaderGroupBegin/End).
+    /// Grab an idle context from the shared pool (from the band of the
+    /// given NUMA node, with numa_aware), or return nullptr if there are
+    /// none.
+    ShadingContext* pop_pooled_context(int numa_node);
+
+    /// Leave an idle context in the shared pool for any thread to reuse.
+    /// Returns false if the pool is full.
+    bool push_pooled_context(ShadingContext* ctx);
+
+    /// The number of slots of the shared context pool for the NUMA node,
+    /// and in first, the index of the first of them.
+    int context_pool_band(int numa_node, int& first) const;
+
+    ShaderGroupRef& curgroup() const
+    {
+        if (!m_curgroup.get())
+            m_curgroup.reset(new ShaderGroupRef);
+        return *m_curgroup;
+    }
+
+    /// Find and read the named master from the search path, with no locks
+    /// held. Used by loadshader() for the first request of each name.
+    ShaderMaster::ref read_shader_master(ustring name);
+
+    /// Find the .oso or .osob file of the named master: from the
+    /// manifest, or the searchpath (listed just once if searchpath_index
+    /// is set). Return "" if there is none.
+    std::string find_shader_file(ustring name);
+
+    /// Read the manifest and list the searchpath dirs for
+    /// find_shader_file. Call with m_shader_file_index_mutex held.
+    void index_shader_files();
+
+    /// Forget the manifest and searchpath listing, so the next
+    /// find_shader_file reads them again.
+    void clear_shader_file_index();
+
     PerThreadInfo* create_thread_info();
 
     void destroy_thread_info(PerThreadInfo* threadinfo);
@@ -621,6 +772,12 @@ public:
     bool execute(ShadingContext& ctx, ShaderGroup& group, int shadeindex,
                  ShaderGlobals& ssg, void* userdata_base_ptr,
                  void* output_base_ptr, bool run = true);
+    bool execute(ShadingContext& ctx, cspan<ShaderGroup*> groups,
+                 int shadeindex, ShaderGlobals& ssg, void* userdata_base_ptr,
+                 void* output_base_ptr);
+    bool execute(ShadingContext& ctx, ShaderGroup& group, int shadeindex,
+                 span<ShaderGlobals> globals, void* userdata_base_ptr,
+                 void* output_base_ptr);
 
     const void* get_symbol(ShadingContext& ctx, ustring layername,
                            ustring symbolname, TypeDesc& type);
@@ -640,8 +797,10 @@ public:
     TextureSystem* texturesys() const { return m_texturesys; }
 
     bool use_optix() const { return m_use_optix; }
+    bool transform_cache() const { return m_transform_cache; }
     bool debug_nan() const { return m_debugnan; }
     bool debug_uninit() const { return m_debug_uninit; }
+    int debug_sample() const { return m_debug_sample; }
     bool lockgeom_default() const { return m_lockgeom_default; }
     bool strict_messages() const { return m_strict_messages; }
     bool range_checking() const { return m_range_checking; }
@@ -662,13 +821,26 @@ public:
     int llvm_output_bitcode() const { return m_llvm_output_bitcode; }
     ustring llvm_prune_ir_strategy() const { return m_llvm_prune_ir_strategy; }
     bool fold_getattribute() const { return m_opt_fold_getattribute; }
+    bool fold_gettextureinfo() const { return m_opt_fold_gettextureinfo; }
+    bool opt_batch_getattribute() const { return m_opt_batch_getattribute; }
     bool opt_texture_handle() const { return m_opt_texture_handle; }
+    bool opt_batched_compaction() const { return m_opt_batched_compaction; }
+    bool batched_uniformity_profile() const
+    {
+        return m_batched_uniformity_profile;
+    }
+    int batched_min_ops() const { return m_batched_min_ops; }
+    int batched_max_divergence() const { return m_batched_max_divergence; }
     int opt_passes() const { return m_opt_passes; }
     int max_warnings_per_thread() const { return m_max_warnings_per_thread; }
     bool countlayerexecs() const { return m_countlayerexecs; }
     bool lazy_userdata() const { return m_lazy_userdata; }
     bool userdata_isconnected() const { return m_userdata_isconnected; }
+    bool attribute_cache() const { return m_attribute_cache; }
+    bool regex_optimize() const { return m_regex_optimize; }
+    int attribute_cache_epoch() const { return m_attribute_cache_epoch; }
     int profile() const { return m_profile; }
+    int profile_instrument() const { return m_profile_instrument; }
     bool no_noise() const { return m_no_noise; }
     bool no_pointcloud() const { return m_no_pointcloud; }
     bool force_derivs() const { return m_force_derivs; }
@@ -679,7 +851,45 @@ public:
     }
 
     bool llvm_jit_fma() const { return m_llvm_jit_fma; }
+    bool llvm_vector_triples() const { return m_llvm_vector_triples; }
+    bool llvm_jit_orc() const { return m_llvm_jit_orc; }
+    int llvm_jit_threads() const { return m_llvm_jit_threads; }
+    bool llvm_jit_lazy() const { return m_llvm_jit_lazy; }
+    bool llvm_shared_shadeops() const { return m_llvm_shared_shadeops; }
+    int llvm_inline_max_cost() const { return m_llvm_inline_max_cost; }
+    bool tiered_jit() const { return m_tiered_jit; }
+    int tiered_jit_profile() const { return m_tiered_jit_profile; }
+    int raytype_variant_threshold() const
+    {
+        return m_raytype_variant_threshold;
+    }
     ustring llvm_jit_target() const { return m_llvm_jit_target; }
+    /// Should the transcendental shadeops, and their constant folding,
+    /// use OIIO's fast_* approximations rather than the system math
+    /// library, per the math_precision option?
+    bool fast_math() const
+    {
+        return m_math_precision == "fast"
+               || (OSL_FAST_MATH && m_math_precision != "exact");
+    }
+    /// The prefix of the names of each group's OptiX init and entry
+    /// functions, which tells OptiX what kind of program they are, per the
+    /// optix_entry_points option.
+    const char* optix_entry_prefix() const
+    {
+        if (m_optix_entry_points == "continuation")
+            return "__continuation_callable__";
+        if (m_optix_entry_points == "inline")
+            return "";
+        return "__direct_callable__";
+    }
+    ustring jit_cache_dir() const { return m_jit_cache_dir; }
+    int jit_cache_wait() const { return m_jit_cache_wait; }
+    ustring jit_cache_targets() const { return m_jit_cache_targets; }
+    JITCacheBackend* jit_cache_backend() const { return m_jit_cache_backend; }
+    int jit_memory_budget_MB() const { return m_jit_memory_budget_MB; }
+    bool jit_share_layers() const { return m_jit_share_layers; }
+    ustring llvm_pass_pipeline() const { return m_llvm_pass_pipeline; }
 
     ustring debug_groupname() const { return m_debug_groupname; }
     ustring debug_layername() const { return m_debug_layername; }
@@ -705,9 +915,164 @@ public:
     /// symbol tables down to just parameters.
     void group_post_jit_cleanup(ShaderGroup& group);
 
-    int* alloc_int_constants(size_t n) { return m_int_pool.alloc(n); }
-    float* alloc_float_constants(size_t n) { return m_float_pool.alloc(n); }
-    ustring* alloc_string_constants(size_t n) { return m_string_pool.alloc(n); }
+    /// Queue a group running tier-0 JIT code for re-JIT at full
+    /// optimization, starting the background tier-up thread if needed.
+    void tierup_enqueue(ShaderGroup& group);
+
+    /// Make the group own the memory of the code ll just JITed (after
+    /// own_jit_memory), which is freed with the group, or earlier if it's
+    /// evictable under the jit_memory_budget_MB.
+    void adopt_jit_memory(ShaderGroup& group, const LLVM_Util& ll,
+                          bool evictable);
+
+    /// With a jit_memory_budget_MB, after JITing `keep`, free the code of
+    /// the groups that have gone longest without running until the
+    /// evictable code fits the budget again.
+    void enforce_jit_memory_budget(const ShaderGroup& keep);
+
+    /// Free the JITed code of a group that isn't running, keeping its
+    /// optimized form to JIT again from the next time it's executed.
+    /// Returns false if it's busy, running, or its code can't be freed.
+    bool evict_group_code(ShaderGroup& group);
+
+    /// The group to run for a point of the given raytype, executing with
+    /// the given batch width (0 for scalar): the group's matching raytype
+    /// variant if there is one, unless raytype_variant_threshold defers
+    /// its compilation, in which case it's the group itself until the
+    /// background thread has compiled the variant.
+    ShaderGroup& raytype_variant(ShaderGroup& group, int raytype, int width);
+
+    bool add_userdata_variant(ShaderGroup& group, ustring name, TypeDesc type,
+                              const void* val);
+
+    /// The group to run for a scalar point: the group's userdata variant
+    /// (see add_userdata_variant) for the point's value of the userdata,
+    /// or the group itself if the value has no variant.
+    ShaderGroup& userdata_variant(ShaderGroup& group, ShaderGlobals& sg,
+                                  void* userdata_base_ptr, int shadeindex);
+
+    ShaderGroupRef output_variant(ShaderGroup& group, cspan<ustring> outputs);
+
+    /// Give a variant built from group's source the settings of group
+    /// that are made after ShaderGroupEnd.
+    void copy_variant_settings(ShaderGroup& variant, const ShaderGroup& group);
+
+    /// Queue a raytype variant to be compiled, for the given batch width
+    /// (0 for scalar), by the background tier-up thread.
+    void variant_enqueue(ShaderGroup& variant, int width);
+
+    /// Body of the background tier-up thread.
+    void tierup_worker();
+
+    /// Stop the tier-up thread, abandoning any groups still queued.
+    void tierup_shutdown();
+
+    /// Stop the background threads, and finish the output still buffered
+    /// (printfs, point cloud writes, captures, and the statistics).
+    /// Unless `fast`, also free what the groups and dictionaries hold;
+    /// fast is for the ShadingSystem that's never destroyed, because
+    /// "fast_shutdown" leaves its memory for the process exit to reclaim.
+    void shutdown(bool fast);
+    bool fast_shutdown() const { return m_fast_shutdown; }
+
+    typedef ShadingSystem::CompileStatus CompileStatus;
+    bool optimize_group_async(ShaderGroup& group, int priority);
+    bool cancel_optimize_group(ShaderGroup& group);
+    bool wait_optimize_group(ShaderGroup& group, float timeout);
+
+    /// A shade is about to compile a group that optimize_group_async
+    /// may have queued. Return false if it should do nothing instead
+    /// ("async_placeholder").
+    bool async_compile_on_shade(ShaderGroup& group);
+
+    /// A shade has compiled a group that optimize_group_async may have
+    /// queued: mark it done.
+    void async_compile_done(ShaderGroup& group);
+
+    /// Body of the threads compiling the groups of optimize_group_async.
+    void async_compile_worker();
+
+    /// Stop the async compile threads, cancelling the groups still queued.
+    void async_compile_shutdown();
+
+    /// A new ring for a context to hand its printf output over to the
+    /// background printf thread, starting that thread if needed.
+    std::shared_ptr<PrintfRing> new_printf_ring();
+
+    /// Body of the background printf thread.
+    void printf_worker();
+
+    /// Stop the printf thread, once it has printed what the rings hold.
+    void printf_shutdown();
+
+    /// With opt_share_groups, return the already known group that is
+    /// structurally identical to this one, or register this group as the
+    /// one to share if there is none (returning an empty ref).
+    ShaderGroupRef find_shared_group(ShaderGroup& group);
+
+    /// With jit_share_layers, return the JITed code of the layer body
+    /// with the given key, and in owner what keeps it alive (if it may be
+    /// freed), or nullptr if no live code is known by that key.
+    void* find_shared_layer(const std::string& key,
+                            std::shared_ptr<void>& owner);
+
+    /// Make the JITed code of a layer body known by its key, for other
+    /// groups to call for as long as owner lives (or forever, if owner is
+    /// empty, for code in memory that's never freed).
+    void add_shared_layer(const std::string& key, void* code,
+                          const std::shared_ptr<void>& owner);
+
+    /// What ReParameter found it can do to a group, and each of its
+    /// variants, before doing any of it.
+    struct ReparamPlan {
+        std::vector<Symbol*> syms;  ///< Symbol to write for each edit, or null
+        std::string spec;           ///< The group's source, updated
+        bool respec = false;        ///< Is spec to replace the source?
+        int noops   = 0;            ///< Reoptimizable edits that didn't need it
+        ShaderGroupRef fresh;       ///< Layers rebuilt from spec, if needed
+        std::vector<ReparamPlan> variants;
+    };
+
+    /// Check the edits to the group and its variants, and do all that may
+    /// fail (finding the params, and with reparam_reoptimize, rebuilding
+    /// layers from the updated source), without changing any group.
+    bool reparameter_plan(ShaderGroup& group,
+                          span<ShadingSystem::ParamEdit> edits,
+                          ReparamPlan& plan);
+
+    /// Make the edits that reparameter_plan planned.
+    void reparameter_apply(ShaderGroup& group,
+                           span<ShadingSystem::ParamEdit> edits,
+                           ReparamPlan& plan, int& changed_begin,
+                           int& changed_end);
+
+    /// ReParameter of a param whose value the optimized group may have
+    /// baked into its code (reparam_reoptimize): put the new value in
+    /// spec, the group's source, and set affects_code if the optimized
+    /// code depends on it.  Return false if the value can't be set.
+    bool reparameter_respec(ShaderGroup& group, ShaderInstance* layer,
+                            int paramindex, TypeDesc type, const void* val,
+                            std::string& spec, bool& affects_code);
+
+    /// Replace the group's layers with fresh ones rebuilt from its source
+    /// with new values, so the group is re-optimized and re-JITed when
+    /// next used.
+    void reparameter_reoptimize(ShaderGroup& group, ShaderGroup& fresh);
+
+    /// The raytype, userdata and output variants of the group
+    static std::vector<ShaderGroup*> variant_groups(ShaderGroup& group);
+
+    /// Gather the values of the optimized group's interactive params into
+    /// its interactive block, and point their symbols there.
+    void layout_interactive_params(ShaderGroup& group);
+
+    /// Add the string constants and string param values of the optimized
+    /// group to the device string table.
+    void add_device_strings(ShaderGroup& group);
+
+    /// Make dst use src's optimized layers and compiled code. Both groups
+    /// must be locked by the caller.
+    void share_compiled_group(ShaderGroup& dst, const ShaderGroup& src);
 
     void register_closure(string_view name, int id, const ClosureParam* params,
                           PrepareClosureFunc prepare, SetupClosureFunc setup);
@@ -726,8 +1091,32 @@ public:
 
     OSLEXECPUBLIC int raytype_bit(ustring name);
 
-    void optimize_all_groups(int nthreads = 0, int mythread = 0,
-                             int totalthreads = 1, bool do_jit = true);
+    bool set_raytype_closures(ustring raytype, cspan<int> closure_ids);
+
+    bool add_raytype_variant(ShaderGroup& group, int raytypes_on,
+                             int raytypes_off);
+
+    /// Is the closure with the given id not read by the renderer for rays
+    /// with all the raytypes_on bits set (see set_raytype_closures)?
+    bool closure_unread(int raytypes_on, int closure_id) const;
+
+    bool set_raytype_noderivs(ustring raytype, float texture_width);
+
+    /// Are derivatives unneeded for rays with all the raytypes_on bits set
+    /// (see set_raytype_noderivs)?  If so, and texture_width isn't null,
+    /// store there the widest texture filter asked for by those raytypes.
+    bool raytype_noderivs(int raytypes_on,
+                          float* texture_width = nullptr) const;
+
+    void optimize_all_groups(int nthreads = 0, bool do_jit = true);
+
+    /// Run compile() on every known shader group, using nthreads workers
+    /// (0 means all hardware cores) that steal work from each other,
+    /// biggest groups first. Workers are tasks on the "compile_thread_pool"
+    /// if the renderer supplied one, otherwise threads of our own.
+    void compile_all_groups(
+        int nthreads,
+        const std::function<void(ShaderGroup&, ShadingContext*)>& compile);
 
     typedef std::unordered_map<ustring, OpDescriptor> OpDescriptorMap;
 
@@ -752,6 +1141,19 @@ public:
     /// archive.
     bool archive_shadergroup(ShaderGroup& group, string_view filename);
 
+    /// Optimize (without JIT) the group and write its optimized state to
+    /// a binary snapshot file.
+    bool save_group_snapshot(ShaderGroup& group, string_view filename);
+
+    /// Install the optimized state from a snapshot written by
+    /// save_group_snapshot into an identically built, not yet optimized
+    /// group, marking it as optimized.
+    bool load_group_snapshot(ShaderGroup& group, string_view filename);
+
+    /// The description of a group (and relevant settings) that a
+    /// snapshot must match in order to be loaded into it.
+    std::string group_snapshot_key(const ShaderGroup& group) const;
+
     void count_noise(int number = 1) { m_stat_noise_calls += number; }
 
     ColorSystem& colorsystem() { return m_shading_state_uniform.m_colorsystem; }
@@ -771,8 +1173,7 @@ public:
         /// Ensure that the group has been JITed.
         void jit_group(ShaderGroup& group, ShadingContext* ctx);
 
-        void jit_all_groups(int nthreads = 0, int mythread = 0,
-                            int totalthreads = 1);
+        void jit_all_groups(int nthreads = 0);
     };
 
     template<int WidthT> OSL_FORCEINLINE Batched<WidthT> batched()
@@ -785,6 +1186,33 @@ public:
     {
         m_symlocs.clear();
     }
+    void invalidate_attribute_cache() { ++m_attribute_cache_epoch; }
+    void flush_pointclouds();
+
+    /// Record the point about to be executed by group, if the "capture"
+    /// attribute asks for it (see capture.cpp).
+    bool capturing() const { return !m_capture.empty(); }
+    void capture_point(ShaderGroup& group, const ShaderGlobals& sg);
+#if OSL_USE_BATCHED
+    template<int WidthT>
+    void capture_batch(ShaderGroup& group, int batch_size,
+                       const BatchedShaderGlobals<WidthT>& bsg);
+#endif
+    void flush_capture();
+
+    /// The dictionary documents, compiled queries and found nodes shared
+    /// by all ShadingContexts (see dictionary.cpp).
+    SharedDictionary& shared_dictionary();
+    /// dict_find that needs no ShadingContext, so the optimizer can fold
+    /// calls with constant arguments.  Set errmessage if it fails.
+    int dict_find(ustring dictionaryname, ustring query,
+                  std::string& errmessage);
+    int dict_find(int nodeID, ustring query, std::string& errmessage);
+    void free_dict_resources();
+
+    /// The compiled regex for a pattern, shared by all contexts.  Throws
+    /// std::regex_error if the pattern is invalid.
+    const std::regex& find_regex(ustring pattern);
     void add_symlocs(cspan<SymLocationDesc> symlocs)
     {
         for (auto& s : symlocs)
@@ -836,13 +1264,46 @@ private:
     mutable std::list<std::string> m_errseen, m_warnseen;
     static const int m_errseenmax = 32;
     mutable mutex m_errmutex;
-
-    typedef std::map<ustring, ShaderMaster::ref> ShaderNameMap;
+    // Bumped whenever m_errseen and m_warnseen are cleared, so that each
+    // context knows to forget the repeats it is filtering.
+    std::atomic<int> m_errseen_epoch { 0 };
+
+    // Each master is a shared_future so that a master still being read
+    // (by a prefetch or another thread's Shader()) can be found in the
+    // map and waited on, rather than holding the lock while it loads.
+    typedef std::map<ustring, std::shared_future<ShaderMaster::ref>>
+        ShaderNameMap;
     ShaderNameMap m_shader_masters;  ///< name -> shader masters map
-
-    ConstantPool<int> m_int_pool;
-    ConstantPool<Float> m_float_pool;
-    ConstantPool<ustring> m_string_pool;
+    mutable spin_rw_mutex m_shader_masters_mutex;  ///< Guards m_shader_masters
+    // Masters read from files, with the file contents, by a fingerprint
+    // of them, so that names whose files are identical share one master.
+    std::unordered_multimap<uint64_t, std::pair<std::string, ShaderMaster::ref>>
+        m_master_contents;
+    spin_mutex m_master_contents_mutex;  ///< Guards m_master_contents
+    std::vector<std::future<void>> m_prefetch_tasks;  ///< Pending prefetches
+    spin_mutex m_prefetch_mutex;  ///< Guards m_prefetch_tasks
+
+    // Queue a prefetch task on the compile (or default) thread pool.
+    void push_prefetch(std::function<void()> task);
+    // Compiled regexes, sharded by pattern so threads seldom contend
+    struct RegexShard {
+        spin_rw_mutex mutex;
+        std::unordered_map<ustring, std::unique_ptr<std::regex>> map;
+    };
+    RegexShard m_regex_shards[16];
+    // Made by shared_dictionary() on first use
+    std::atomic<SharedDictionary*> m_shared_dictionary { nullptr };
+
+    // Files being written by the "capture" attribute, by group name
+    struct CaptureFile {
+        FILE* file       = nullptr;
+        int64_t npoints = 0;
+    };
+    std::map<ustring, CaptureFile> m_capture_files;
+    std::atomic<int64_t> m_capture_count { 0 };  ///< Points seen to capture
+    mutex m_capture_mutex;  ///< Guards m_capture_files
+    void write_captures(ShaderGroup& group,
+                        const ShadingSystem::CapturedPoint* points, int n);
 
     OpDescriptorMap m_op_descriptor;
 
@@ -855,25 +1316,32 @@ private:
 
     // Options
     int m_statslevel;             ///< Statistics level
+    bool m_fast_shutdown;         ///< Leave teardown to the process exit
     bool m_lazylayers;            ///< Evaluate layers on demand?
     bool m_lazyglobals;           ///< Run lazily even if globals write?
     bool m_lazyunconnected;       ///< Run lazily even if not connected?
     bool m_lazyerror;             ///< Run lazily even if it has error op
     bool m_lazy_userdata;         ///< Retrieve userdata lazily?
     bool m_userdata_isconnected;  ///< Userdata params isconnected()?
+    bool m_attribute_cache;       ///< Cache object attributes per context?
+    bool m_regex_optimize;        ///< Compile regexes for faster matching?
     bool m_clearmemory;           ///< Zero mem before running shader?
     bool m_debugnan;              ///< Root out NaN's?
     bool m_debug_uninit;          ///< Find use of uninitialized vars?
+    int m_debug_sample;           ///< Debug checks for 1 shade in N
     bool m_lockgeom_default;      ///< Default value of lockgeom
     bool m_strict_messages;       ///< Strict checking of message passing usage?
     bool m_error_repeats;         ///< Allow repeats of identical err/warn?
     bool m_range_checking;        ///< Range check arrays & components?
     bool m_connection_error;      ///< Error for ConnectShaders to fail?
     bool m_greedyjit;             ///< JIT as much as we can?
+    bool m_prefetch_textures;     ///< Warm up textures after optimize_all?
     bool m_countlayerexecs;       ///< Count number of layer execs?
     bool m_relaxed_param_typecheck;  ///< Allow parameters to be set from isomorphic types (same data layout)
     int m_max_warnings_per_thread;  ///< How many warnings to display per thread before giving up?
     int m_profile;                 ///< Level of profiling of shader execution
+    int m_profile_instrument;      ///< JIT probes: 1 = layers, 2 = + lines
+    bool m_lock_stats;             ///< Time waits for the shared locks?
     int m_optimize;                ///< Runtime optimization level
     bool m_opt_simplify_param;     ///< Turn instance params into const?
     bool m_opt_constant_fold;      ///< Allow constant folding?
@@ -887,17 +1355,45 @@ private:
     char m_opt_merge_instances;            ///< Merge identical instances?
     bool m_opt_merge_instances_with_userdata;  ///< Merge identical instances if they have userdata?
     bool m_opt_fold_getattribute;    ///< Constant-fold getattribute()?
+    bool m_opt_fold_gettextureinfo;  ///< Constant-fold gettextureinfo()?
+    bool m_opt_batch_getattribute;   ///< One callback for getattribute runs?
     bool m_opt_middleman;            ///< Middle-man optimization?
+    bool m_opt_alias_connections;    ///< Share array connections' data?
+    int m_opt_shared_constant_arrays;  ///< Min bytes of shared const params
+    bool m_opt_texture_reuse;        ///< Reuse repeated texture lookups?
+    int m_opt_unroll_loops;          ///< Max trips of loops to unroll
     bool m_opt_texture_handle;       ///< Use texture handles?
     bool m_opt_seed_bblock_aliases;  ///< Turn on basic block alias seeds
     bool m_opt_useparam;  ///< Perform extra useparam analysis for culling run layer calls
     bool m_opt_batched_analysis;  ///< Perform extra analysis required for batched execution?
+    bool m_opt_batched_compaction;  ///< Find where divergent batches should be compacted?
+    bool m_batched_uniformity_profile;  ///< Count runtime-uniform varyings?
+    int m_batched_min_ops;         ///< Smaller groups prefer scalar
+    int m_batched_max_divergence;  ///< More % divergent ops prefer scalar
     bool m_llvm_jit_fma;         ///< Allow fused multiply/add in JIT
     bool m_llvm_jit_aggressive;  ///< Turn on llvm "aggressive" JIT
+    bool m_llvm_vector_triples;  ///< Triple arithmetic on <3 x float>
+    bool m_llvm_jit_orc;         ///< JIT with ORC rather than MCJIT
+    bool m_jit_huge_pages;       ///< Pack JIT memory in huge pages?
+    int m_llvm_jit_threads;      ///< ORC compile threads per group
+    bool m_llvm_jit_lazy;        ///< ORC: compile functions on first call
+    bool m_llvm_shared_shadeops;  ///< Link groups to one shadeop library
+    int m_llvm_inline_max_cost;   ///< Never inline callees costlier
+    bool m_tiered_jit;           ///< Fast JIT first, optimized re-JIT later
+    int m_tiered_jit_profile;    ///< Profile this many runs before tier-up
+    int m_raytype_variant_threshold;  ///< Shades before a variant compiles
+    int m_async_compile_threads;      ///< Threads of optimize_group_async
+    bool m_async_placeholder;         ///< Don't shade groups still queued
+    bool m_opt_share_groups;     ///< Share code of identical groups?
+    bool m_reparam_reoptimize;   ///< ReParameter may re-optimize groups
+    bool m_jit_release_memory;   ///< Free all we can once a group is JITed
     bool m_optimize_nondebug;    ///< Fully optimize non-debug!
     ustring m_llvm_jit_target;   ///< ISA target for JIT
+    ustring m_math_precision;    ///< "fast", "exact", or "" for the build's
+    ustring m_optix_entry_points;  ///< "direct", "continuation", "inline"
     int m_vector_width;          ///< SIMD width maximum (8)
     int m_opt_passes;            ///< Opt passes per layer
+    int m_opt_parallel_layers;   ///< Min layers to optimize concurrently
     int m_llvm_optimize;         ///< OSL optimization strategy
     int m_debug;                 ///< Debugging output
     int m_llvm_debug;            ///< More LLVM debugging output
@@ -908,7 +1404,16 @@ private:
     int m_llvm_profiling_events;  ///< Emit Intel profiling events during JIT
     int m_llvm_output_bitcode;    ///< Output bitcode for each group
     int m_llvm_dumpasm;           ///< Output CPU asm of the JIT
+    int m_jit_cache_wait;         ///< Max ms to wait for another's JIT
+    int m_jit_memory_budget_MB;   ///< Evict cold groups' code beyond it
+    bool m_jit_free_with_group;   ///< Groups own the memory of their code
+    bool m_jit_share_layers;      ///< Call other groups' same layer code
     ustring m_llvm_prune_ir_strategy;  ///< LLVM IR pruning strategy
+    ustring m_jit_cache_dir;           ///< Dir for persistent JIT objects
+    ustring m_jit_cache_targets;       ///< Other ISAs' objects to cache
+    ustring m_jit_cache_redis;         ///< Redis server behind the cache
+    ustring m_capture;                 ///< File prefix for captured points
+    ustring m_llvm_pass_pipeline;      ///< New pass manager pipeline
     ustring m_debug_groupname;         ///< Name of sole group to debug
     ustring m_debug_layername;         ///< Name of sole layer to debug
     ustring m_opt_layername;           ///< Name of sole layer to optimize
@@ -917,21 +1422,55 @@ private:
     ustring m_archive_filename;        ///< Name of filename for group archive
     std::string m_searchpath;          ///< Shader search path
     std::vector<std::string> m_searchpath_dirs;  ///< All searchpath dirs
+    std::string m_searchpath_manifest;  ///< File of shader names -> paths
+    bool m_searchpath_index = false;    ///< List each searchpath dir once?
+    // Where to find shader files, from the manifest and from listing the
+    // searchpath dirs, built on first use (see find_shader_file).
+    std::unordered_map<ustring, std::string> m_shader_manifest;
+    std::unordered_map<std::string, std::string> m_shader_file_index;
+    bool m_shader_files_indexed = false;
+    std::mutex m_shader_file_index_mutex;
+    std::string m_shader_library_pack_name;  ///< Mounted .oslpack file
+    // The mounted pack, held by each load that reads from it, so that
+    // mounting another doesn't unmap it underneath them.
+    std::shared_ptr<ShaderLibraryPack> m_shader_library_pack;
+    spin_mutex m_shader_library_pack_mutex;
+    // Results of cacheable groups by shading point (see ShadingCache),
+    // or null if "shading_cache_size" is 0
+    std::unique_ptr<ShadingCache> m_shading_cache;
+    int m_shading_cache_size          = 0;       ///< Its budget, in MB
+    float m_shading_cache_quantize    = 0.001f;  ///< Cell size for P
+    float m_shading_cache_uv_quantize = 0.001f;  ///< Cell size for u, v
     std::string m_library_searchpath;            ///< Library search path
     std::vector<std::string>
         m_library_searchpath_dirs;            ///< All library searchpath dirs
     std::vector<ustring> m_raytypes;          ///< Names of ray types
+    std::vector<std::pair<int, std::vector<int>>>
+        m_raytype_closures;  ///< Sorted closure ids read, per raytype bit
+    std::vector<std::pair<int, float>>
+        m_raytype_noderivs;  ///< Raytype bits needing no derivs, and the
+                             ///<   texture width to use instead
     std::vector<ustring> m_renderer_outputs;  ///< Names of renderer outputs
     std::vector<SymLocationDesc> m_symlocs;
     int m_max_local_mem_KB;           ///< Local storage can a shader use
+    int m_context_pool_size;          ///< Slots in the shared context pool
+    int m_numa_aware;                 ///< Keep contexts on their NUMA node?
+    int m_numa_nodes;                 ///< NUMA nodes (1 unless numa_aware)
     int m_compile_report;             ///< Print compilation report?
     bool m_use_optix;                 ///< This is an OptiX-based renderer
+    bool m_transform_cache;           ///< Renderer lets us cache matrices
     bool m_buffer_printf;             ///< Buffer/batch printf output?
+    bool m_printf_async;              ///< Print from a background thread?
+    int m_printf_sample;              ///< Print every Nth call of a printf
+    int m_printf_rate_limit;          ///< Most prints of a printf a second
     bool m_no_noise;                  ///< Substitute trivial noise calls
     bool m_no_pointcloud;             ///< Substitute trivial pointcloud calls
+    int m_texture_stochastic = 0;     ///< Single-tap texture lookups?
     bool m_force_derivs;              ///< Force derivs on everything
     bool m_allow_shader_replacement;  ///< Allow shader masters to replace
     int m_exec_repeat;                ///< How many times to execute group
+    int m_capture_every;              ///< Capture 1 of every N points
+    int m_capture_max;                ///< Most points captured per group
     int m_opt_warnings;               ///< Warn on inability to optimize
     int m_gpu_opt_error;              ///< Error on inability to optimize
                                       ///<   away things that can't GPU.
@@ -950,6 +1489,8 @@ private:
     // Stats
     atomic_int m_stat_shaders_loaded;      ///< Stat: shaders loaded
     atomic_int m_stat_shaders_requested;   ///< Stat: shaders requested
+    atomic_int m_stat_masters_shared;      ///< Stat: names given a master
+                                           ///< of identical contents
     PeakCounter<int> m_stat_instances;     ///< Stat: instances
     PeakCounter<int> m_stat_contexts;      ///< Stat: shading contexts
     atomic_int m_stat_groups;              ///< Stat: shading groups
@@ -967,16 +1508,43 @@ private:
     atomic_int m_stat_preopt_ops;          ///< Stat: pre-optimization ops
     atomic_int m_stat_postopt_ops;         ///< Stat: post-optimization ops
     atomic_int m_stat_middlemen_eliminated;  ///< Stat: middlemen eliminated
+    atomic_int m_stat_connections_aliased;   ///< Stat: array copies skipped
+    atomic_ll m_stat_shared_constant_bytes;  ///< Stat: param bytes shared
     atomic_int m_stat_const_connections;     ///< Stat: const connections elim'd
     atomic_int m_stat_global_connections;   ///< Stat: global connections elim'd
     atomic_int m_stat_tex_calls_codegened;  ///< Stat: total texture calls
     atomic_int m_stat_tex_calls_as_handles;  ///< Stat: texture calls with handles
     atomic_int m_stat_useparam_ops;  ///< Stat: pre-optimization useparam ops
     atomic_int m_stat_call_layers_inserted;  ///< Stat: post-opt layer calls
+    atomic_int m_stat_jit_cache_hits;    ///< Stat: JIT objects from cache
+    atomic_int m_stat_jit_cache_misses;  ///< Stat: JIT objects not in cache
+    atomic_int m_stat_jit_cache_stores;  ///< Stat: JIT objects written
+    atomic_int m_stat_jit_cache_waits;   ///< Stat: hits from waiting
+    atomic_int m_stat_jit_cache_variant_hits;  ///< Stat: other ISAs' hits
+    atomic_int m_stat_jit_cache_variants_stored;  ///< Stat: other ISAs' stores
+    atomic_int m_stat_jit_cache_fetches;  ///< Stat: hits from the backend
+    atomic_int m_stat_jit_cache_shared;   ///< Stat: stores to the backend
+    atomic_int m_stat_groups_tiered_up;  ///< Stat: groups re-JITed optimized
+    atomic_int m_stat_raytype_variants_compiled;  ///< Stat: in background
+    atomic_int m_stat_groups_shared;     ///< Stat: groups sharing code
+    atomic_int m_stat_groups_evicted;    ///< Stat: JIT code freed, cold
+    atomic_int m_stat_groups_rejitted;   ///< Stat: JITed again, evicted
+    atomic_int m_stat_reparam_reopts;    ///< Stat: ReParameter re-opts
+    atomic_int m_stat_reparam_noops;     ///< Stat: ReParameter no recompile
+    atomic_int m_stat_shadeops_linked;   ///< Stat: shared shadeops called
+    atomic_int m_stat_layers_shared;     ///< Stat: layers calling shared code
+    atomic_int m_stat_inline_calls_decided;  ///< Stat: calls costed
+    atomic_int m_stat_batched_compaction_points;  ///< Stat: divergent costly ops
     double m_stat_master_load_time;          ///< Stat: time loading masters
     double m_stat_optimization_time;         ///< Stat: time spent optimizing
     double m_stat_opt_locking_time;          ///<   locking time
     double m_stat_specialization_time;       ///<   runtime specialization time
+    double m_stat_opt_prepare_time;          ///<     copying code, first merge
+    double m_stat_opt_forward_time;          ///<     first (forward) pass
+    double m_stat_opt_backward_time;         ///<     second (backward) pass
+    double m_stat_opt_postopt_time;          ///<     derivs, post-optimization
+    double m_stat_opt_collapse_time;         ///<     collapsing syms and ops
+    double m_stat_opt_inventory_time;        ///<     finding what it needs
     double m_stat_total_llvm_time;           ///<   total time spent on LLVM
     double m_stat_llvm_setup_time;           ///<     llvm setup time
     double m_stat_llvm_irgen_time;           ///<     llvm IR generation time
@@ -987,6 +1555,14 @@ private:
     double m_stat_getattribute_fail_time;  ///< Stat: time spent in getattribute
     atomic_ll m_stat_getattribute_calls;   ///< Stat: Number of getattribute
     atomic_ll m_stat_get_userdata_calls;   ///< Stat: # of get_userdata calls
+    atomic_ll m_stat_attribute_cache_hits;  ///< Stat: getattribute cache hits
+    atomic_int m_attribute_cache_epoch;     ///< Bumped to drop attr caches
+    atomic_ll m_stat_transform_cache_hits;  ///< Stat: matrices from cache
+    atomic_ll m_stat_shading_cache_hits;    ///< Stat: shades from the cache
+    atomic_ll m_stat_shading_cache_misses;  ///< Stat: shades cached
+    atomic_ll m_stat_shades_deferred;       ///< Stat: shades to run again
+    atomic_ll m_stat_llvm_preopt_insts;    ///< Stat: IR insts before opt
+    atomic_ll m_stat_llvm_postopt_insts;   ///< Stat: IR insts after opt
     atomic_ll m_stat_noise_calls;          ///< Stat: # of noise calls
     long long m_stat_pointcloud_searches;
     long long m_stat_pointcloud_searches_total_results;
@@ -1012,19 +1588,100 @@ private:
     PeakCounter<off_t> m_stat_mem_inst_connections;
 
     mutable spin_mutex m_stat_mutex;  ///< Mutex for non-atomic stats
+    // The live counters of every extant context, and the totals of
+    // those that are gone. Contexts are created rarely, so one lock will do.
+    mutable spin_mutex m_live_counters_mutex;
+    std::vector<LiveCounters*> m_live_counters;
+    LiveCounters m_live_counters_retired;
     ClosureRegistry m_closure_registry;
-    std::vector<std::weak_ptr<ShaderGroup>> m_all_shader_groups;
-    mutable spin_mutex m_all_shader_groups_mutex;
-
-    // State for entering shader groups -- this is only for the
-    // non-threadsafe calls to Parameter/etc that don't take a group
-    // reference.
-    ShaderGroupRef m_curgroup;
+    // Census of all extant groups. It's split into shards, picked by the
+    // creating thread, so that many threads can create groups at once
+    // without all contending for one lock.
+    struct GroupCensusShard {
+        spin_mutex mutex;
+        std::vector<std::weak_ptr<ShaderGroup>> groups;
+        size_t prune_at = 64;  ///< Drop expired refs when we grow past this
+    };
+    static const int m_all_shader_groups_shards = 32;
+    GroupCensusShard m_all_shader_groups[m_all_shader_groups_shards];
+    // Groups whose compiled code may be shared, by structural hash
+    std::unordered_map<uint64_t, std::weak_ptr<ShaderGroup>> m_shared_groups;
+    mutable spin_mutex m_shared_groups_mutex;
+    // JITed layer bodies other groups may call, by the key of their IR
+    struct SharedLayer {
+        void* code;
+        std::weak_ptr<void> owner;
+        bool owned;  ///< Is the code freed when the owner goes away?
+    };
+    std::unordered_map<std::string, SharedLayer> m_shared_layers;
+    mutable spin_mutex m_shared_layers_mutex;
+    // The device string table: each string once, in the order they were
+    // added, and the index of each by its hash.
+    std::vector<ustringhash> m_device_strings;
+    std::unordered_map<ustringhash, uint32_t> m_device_string_indices;
+    mutable spin_mutex m_device_strings_mutex;
+
+    // Idle contexts that any thread may pick up. Each slot is claimed and
+    // released with a single atomic exchange, so the pool is lock-free.
+    // Threads start their search at a slot picked by thread id, so that
+    // a thread usually gets back a context it released itself.
+    static const int m_context_pool_max = 1024;
+    std::unique_ptr<std::atomic<ShadingContext*>[]> m_context_pool;
+
+    // State for entering shader groups -- this is only for the calls to
+    // Parameter/etc that don't take a group reference. It's per-thread, so
+    // each thread may have its own group under construction.
+    mutable boost::thread_specific_ptr<ShaderGroupRef> m_curgroup;
+
+    // Tiered JIT: groups waiting for their optimized re-JIT, and the
+    // background thread that does it.
+    std::vector<std::weak_ptr<ShaderGroup>> m_tierup_queue;
+    // Raytype variants to compile, with their batch width (0 for scalar)
+    std::vector<std::pair<std::weak_ptr<ShaderGroup>, int>> m_variant_queue;
+    std::mutex m_tierup_mutex;
+    std::condition_variable m_tierup_cv;
+    std::unique_ptr<std::thread> m_tierup_thread;
+    bool m_tierup_stop = false;
+
+    // jit_memory_budget_MB: the bytes of code held by groups that may be
+    // evicted (shared with the code's owners, which may outlive us), and
+    // the clock by which they're last used (a count of their JITs, rather
+    // than a time, for running a group to cost no syscall); and the usage
+    // below which no eviction is tried again, after one that couldn't get
+    // under the budget.
+    std::shared_ptr<std::atomic<long long>> m_jit_evictable_memory {
+        std::make_shared<std::atomic<long long>>(0)
+    };
+    std::atomic<long long> m_jit_clock { 0 };
+    std::atomic<long long> m_jit_evict_retry { 0 };
+
+    // optimize_group_async: the queued groups, and the compile threads.
+    std::vector<std::weak_ptr<ShaderGroup>> m_async_queue;
+    std::mutex m_async_mutex;
+    std::condition_variable m_async_cv;       // Something was queued
+    std::condition_variable m_async_done_cv;  // Some compile finished
+    std::vector<std::unique_ptr<std::thread>> m_async_threads;
+    bool m_async_stop = false;
+
+    // Async printf: the rings of the contexts, and the background thread
+    // that drains them.
+    std::vector<std::shared_ptr<PrintfRing>> m_printf_rings;
+    std::mutex m_printf_mutex;
+    std::condition_variable m_printf_cv;
+    std::unique_ptr<std::thread> m_printf_thread;
+    bool m_printf_stop = false;
 
     atomic_int m_groups_to_compile_count;
     atomic_int m_threads_currently_compiling;
+    OIIO::thread_pool* m_compile_thread_pool = nullptr;  ///< Renderer's pool
+    JITCacheBackend* m_jit_cache_backend     = nullptr;  ///< Behind the dir
+    std::unique_ptr<JITCacheBackend> m_jit_cache_redis_backend;
     mutable std::map<ustring, long long> m_group_profile_times;
     // N.B. group_profile_times is protected by m_stat_mutex.
+    long long m_profile_clock_start;  ///< profile_clock() at creation
+    std::chrono::steady_clock::time_point m_profile_time_start;
+    std::map<std::string, double> m_stat_llvm_pass_times;
+    // N.B. llvm_pass_times is protected by m_stat_mutex.
 
     LLVM_Util::ScopedJitMemoryUser m_llvm_jit_memory_user;
 
@@ -1035,6 +1692,7 @@ private:
     friend class BackendLLVM;
 #if OSL_USE_BATCHED
     friend class BatchedBackendLLVM;
+    friend class BatchedAnalysis;
 #endif
 };
 
@@ -1149,6 +1807,11 @@ public:
     /// Apply pending parameters
     void parameters(const ParamValueList& params, cspan<ParamHints> hints);
 
+    /// Give the unconnected params that would bind to the named userdata
+    /// the value val instead, as ordinary instance values. Return how many
+    /// params were so set.
+    int fold_userdata(ustring name, TypeDesc type, const void* val);
+
     /// Find the named symbol, return its index in the symbol array, or
     /// -1 if not found.
     int findsymbol(ustring name) const;
@@ -1234,28 +1897,32 @@ public:
 
     /// Should this instance only be run lazily (i.e., not
     /// unconditionally)?
-    bool run_lazily() const
+    bool run_lazily() const { return !not_lazy_reason(); }
+
+    /// Why the layer can't be run lazily, or nullptr if it can.
+    const char* not_lazy_reason() const
     {
         // if lazy is turned off entirely, nobody can be lazy
         if (!shadingsys().m_lazylayers)
-            return false;
+            return "lazylayers is off";
         // Main group entry is never lazy
         if (last_layer())
-            return false;
+            return "it is the last layer";
         // Shaders that set globals are not lazy unless lazyglobals is on
         if (writes_globals() && !shadingsys().m_lazyglobals)
-            return false;
+            return "it writes globals (and lazyglobals is off)";
         // Shaders that write renderer outputs (AOVs) can't be lazy
         if (renderer_outputs())
-            return false;
+            return "it writes renderer outputs";
         // Shaders without any downstream connections are not lazy unless
         // lazyunconnected is on.
         if (!outgoing_connections() && !shadingsys().m_lazyunconnected)
-            return false;
+            return "it has no outgoing connections (and lazyunconnected "
+                   "is off)";
         // Shaders with error ops are not lazy unless lazyerror is on.
         if (!shadingsys().m_lazyerror && has_error_op())
-            return false;
-        return true;
+            return "it calls error() (and lazyerror is off)";
+        return nullptr;
     }
 
     bool last_layer() const { return m_last_layer; }
@@ -1280,6 +1947,25 @@ public:
     /// Was this instance merged away and now no longer needed?
     bool merged_unused() const { return m_merged_unused; }
 
+    /// Number of expensive ops (texture, trace, closures, ...) that batched
+    /// analysis found under varying control flow, where a batch is likely
+    /// running with few active lanes.
+    int batched_compaction_points() const
+    {
+        return m_batched_compaction_points;
+    }
+    void batched_compaction_points(int n) { m_batched_compaction_points = n; }
+
+    /// Number of ops in the main code, and how many of those batched
+    /// analysis found under varying control flow.
+    int batched_ops() const { return m_batched_ops; }
+    int batched_divergent_ops() const { return m_batched_divergent_ops; }
+    void batched_op_counts(int ops, int divergent_ops)
+    {
+        m_batched_ops           = ops;
+        m_batched_divergent_ops = divergent_ops;
+    }
+
     int maincodebegin() const { return m_maincodebegin; }
     int maincodeend() const { return m_maincodeend; }
 
@@ -1466,6 +2152,26 @@ public:
     /// equivalent, in that they may be merged into a single instance?
     bool mergeable(const ShaderInstance& b, const ShaderGroup& g) const;
 
+    /// Hash of the properties that mergeable() requires to match exactly
+    /// (master, connections, laziness, and either the instance parameter
+    /// values or the optimized code layout).  Two mergeable instances
+    /// always have the same merge_hash, so it can be used to bucket
+    /// candidates before calling mergeable().
+    uint64_t merge_hash() const;
+
+    /// Record that the runtime optimizer folded the value of param i
+    /// into constants, so changing it requires re-optimizing the group.
+    void param_folded(int i)
+    {
+        if (i >= (int)m_folded_params.size())
+            m_folded_params.resize(i + 1, 0);
+        m_folded_params[i] = 1;
+    }
+    bool param_folded(int i) const
+    {
+        return i < (int)m_folded_params.size() && m_folded_params[i];
+    }
+
 private:
     ShaderMaster::ref m_master;          ///< Reference to the master
     SymOverrideInfoVec m_instoverrides;  ///< Instance parameter info
@@ -1476,6 +2182,7 @@ private:
     std::vector<int> m_iparams;          ///< int param values
     std::vector<float> m_fparams;        ///< float param values
     std::vector<ustring> m_sparams;      ///< string param values
+    std::vector<char> m_folded_params;   ///< Params folded by the optimizer
     int m_id;                            ///< Unique ID for the instance
     bool m_writes_globals;               ///< Do I have side effects?
     bool m_userdata_params;              ///< Might I read userdata for params?
@@ -1485,6 +2192,9 @@ private:
     bool m_merged_unused;                ///< Unused because of a merge
     bool m_last_layer;                   ///< Is it the group's last layer?
     bool m_entry_layer;                  ///< Is it an entry layer?
+    int m_batched_compaction_points;     ///< Divergent costly batched ops
+    int m_batched_ops;                   ///< Main code ops (batched analysis)
+    int m_batched_divergent_ops;         ///< Main code ops, divergent
     ConnectionVec m_connections;         ///< Connected input params
     int m_firstparam, m_lastparam;       ///< Subset of symbols that are params
     int m_maincodebegin, m_maincodeend;  ///< Main shader code range
@@ -1551,6 +2261,18 @@ public:
         m_block_offset  = 0;
     }
 
+    /// Bytes handed out since the last clear(), counting what the blocks
+    /// used so far left unused at their ends.
+    size_t used() const { return m_current_block * BlockSize + m_block_offset; }
+
+    /// Make sure there are blocks for at least size bytes, so that
+    /// allocating that much never has to stop and grow the pool.
+    void reserve(size_t size)
+    {
+        while (m_blocks.size() * BlockSize < size)
+            m_blocks.emplace_back(new char[BlockSize]);
+    }
+
 private:
     static inline size_t alignment_offset_calc(void* ptr, size_t alignment)
     {
@@ -1567,6 +2289,86 @@ private:
     size_t m_block_offset;   ///< Offset from the start of the current block
 };
 
+/// The per-execution memory of a ShadingContext: closures, messages and
+/// miscellaneous scratch all come from one pool, which execute_init
+/// resets in O(1).  ShaderGroups remember the most any execution used
+/// (see "scratch_highwater") so contexts can reserve it up front.
+using ScratchArena = SimplePool<64 * 1024>;
+
+/// Open-addressing hash index of the messages set during one shade, so
+/// that getmessage and setmessage find a name in a probe or two instead
+/// of walking the whole list.  Message names are hashed strings already,
+/// so a name known when the shader is compiled costs no hashing at all.
+/// The table lives in the messages' own pool and is discarded with them.
+/// Should it outgrow half a pool block it is abandoned (valid() turns
+/// false) and the caller goes back to searching its list.
+struct MessageIndex {
+    void clear()
+    {
+        m_slots    = nullptr;
+        m_size     = 0;
+        m_count    = 0;
+        m_overflow = false;
+    }
+
+    bool valid() const { return !m_overflow; }
+
+    template<typename MessageT, typename Name>
+    MessageT* find(const Name& name) const
+    {
+        OSL_DASSERT(valid());
+        if (!m_size)
+            return nullptr;
+        size_t mask = m_size - 1;
+        for (size_t i = name.hash() & mask;; i = (i + 1) & mask) {
+            MessageT* m = static_cast<MessageT*>(m_slots[i]);
+            if (!m || m->name == name)
+                return m;
+        }
+    }
+
+    template<typename MessageT, int BlockSize>
+    void insert(MessageT* message, SimplePool<BlockSize>& pool)
+    {
+        if (m_overflow)
+            return;
+        if (2 * (m_count + 1) > m_size) {
+            // Keep the table at most half full, so probes stay short
+            size_t size = m_size ? 2 * m_size : 64;
+            if (size * sizeof(void*) > BlockSize / 2) {
+                m_overflow = true;
+                return;
+            }
+            void** old      = m_slots;
+            size_t old_size = m_size;
+
+            m_slots = (void**)pool.alloc(size * sizeof(void*), alignof(void*));
+            m_size  = size;
+            memset(m_slots, 0, size * sizeof(void*));
+            for (size_t i = 0; i < old_size; ++i)
+                if (old[i])
+                    place(static_cast<MessageT*>(old[i]));
+        }
+        place(message);
+        ++m_count;
+    }
+
+private:
+    template<typename MessageT> void place(MessageT* message)
+    {
+        size_t mask = m_size - 1;
+        size_t i    = message->name.hash() & mask;
+        while (m_slots[i])
+            i = (i + 1) & mask;
+        m_slots[i] = message;
+    }
+
+    void** m_slots  = nullptr;  ///< m_size entries, nullptr if empty
+    size_t m_size   = 0;        ///< Power of 2
+    size_t m_count  = 0;        ///< Number of messages indexed
+    bool m_overflow = false;    ///< Gave up, search the list instead
+};
+
 /// Represents a single message for use by getmessage and setmessage opcodes
 ///
 struct Message {
@@ -1600,16 +2402,21 @@ struct Message {
 /// Represents the list of messages set by a given shader using setmessage and
 /// getmessage.
 struct MessageList {
-    MessageList() : list_head(nullptr), message_data() {}
+    MessageList(ScratchArena& arena) : list_head(nullptr), message_data(arena)
+    {
+    }
 
+    // Forget the messages; their memory goes when the arena is cleared
     void clear()
     {
         list_head = nullptr;
-        message_data.clear();
+        index.clear();
     }
 
     const Message* find(ustringhash name) const
     {
+        if (index.valid())
+            return index.find<Message>(name);
         for (const Message* m = list_head; m; m = m->next)
             if (m->name == name)
                 return m;  // name matches
@@ -1625,34 +2432,144 @@ struct MessageList {
             list_head->data = message_data.alloc(type.size());
             memcpy(list_head->data, data, type.size());
         }
+        index.insert(list_head, message_data);
     }
 
 private:
     Message* list_head;
-    SimplePool<1024> message_data;
+    MessageIndex index;
+    ScratchArena& message_data;
 };
 
 
 #if OSL_USE_BATCHED
 
 struct BatchedMessageBuffer {
-    BatchedMessageBuffer() : list_head(nullptr), message_data() {}
+    BatchedMessageBuffer(ScratchArena& arena)
+        : list_head(nullptr), message_data(arena)
+    {
+    }
     BatchedMessageBuffer(const BatchedMessageBuffer&)            = delete;
     BatchedMessageBuffer& operator=(const BatchedMessageBuffer&) = delete;
 
+    // Forget the messages; their memory goes when the arena is cleared
     void clear()
     {
         list_head = NULL;
-        message_data.clear();
+        index.clear();
     }
 
     void* list_head;
-    SimplePool<16 * 1024> message_data;
+    MessageIndex index;
+    ScratchArena& message_data;
 };
 
 
 #endif
 
+
+
+/// The tiles of one udim texture that shaders have looked up so far, for
+/// the JIT to find without going through the udim handle each time.  The
+/// tile with (u,v) = (floor(s),floor(t)) is tiles[v * ncols + u]; it's
+/// null until resolved, after which it holds the tile's handle (or the
+/// udim handle itself if the texture has no such tile).  Lookups outside
+/// the first ncols by nrows tiles aren't remembered.
+struct UdimTileTable {
+    typedef RendererServices::TextureHandle TextureHandle;
+    static constexpr int ncols = 10;
+    static constexpr int nrows = 10;
+
+    explicit UdimTileTable(TextureHandle* handle) : udim_handle(handle)
+    {
+        for (auto& t : tiles)
+            t.store(nullptr, std::memory_order_relaxed);
+    }
+
+    /// Index into tiles of the tile that (s,t) falls in, or -1 if it's
+    /// not one the table holds.
+    static int index(float s, float t)
+    {
+        if (s >= 0.0f && s < float(ncols) && t >= 0.0f && t < float(nrows))
+            return int(t) * ncols + int(s);
+        return -1;
+    }
+
+    /// Remember the tile handle that (s,t) resolved to.
+    void remember(float s, float t, TextureHandle* tile)
+    {
+        int i = index(s, t);
+        if (i >= 0)
+            tiles[i].store(tile, std::memory_order_relaxed);
+    }
+
+    TextureHandle* udim_handle;  ///< The handle of the whole texture
+    std::atomic<TextureHandle*> tiles[ncols * nrows];
+};
+
+
+
+/// Where the "profile_instrument" probes of JITed code charge their time:
+/// a whole layer (no sourcefile), or one source line of it.  The JITed
+/// code updates ticks and runs in place, so sites never move once made.
+struct ProfileSite {
+    int layer = -1;
+    ustring sourcefile;
+    int sourceline = 0;
+    atomic_ll ticks { 0 };  ///< Clock ticks spent, not counting callees
+    atomic_ll runs { 0 };   ///< For a whole layer, how often it ran
+};
+
+
+
+/// The outputs of an optimized group whose values are the same at every
+/// point shaded (see the group attribute "constant_outputs"), so that a
+/// renderer may use them without running the group.
+struct ConstantOutputs {
+    std::vector<ustring> names;   ///< "layer.name" of each, or "Ci"
+    std::vector<TypeDesc> types;  ///< TypeDesc::PTR for a closure
+    /// Where each value is; for a closure, the ClosureColor* of its tree
+    /// (which is null for an empty closure)
+    std::vector<const void*> values;
+    std::vector<std::unique_ptr<char[]>> data;  ///< Holds the values
+    bool all = false;  ///< Are all outputs constant, and nothing else done?
+
+    /// Zeroed memory that stays as long as the outputs.
+    void* alloc(size_t size)
+    {
+        data.emplace_back(new char[size]());
+        return data.back().get();
+    }
+};
+
+
+
+/// Read the clock that the "profile_instrument" probes use: the cycle
+/// counter where JITed code can read it inline, a steady clock otherwise.
+inline long long
+profile_clock()
+{
+#if defined(__x86_64__)
+    return (long long)__rdtsc();
+#else
+    return (long long)std::chrono::steady_clock::now()
+        .time_since_epoch()
+        .count();
+#endif
+}
+
+/// Can the JIT convert a renderer output's values to its SymLocationDesc
+/// storage type as it stores them?  Only floats, as HALF or UINT8.
+inline bool
+stores_converted(const SymLocationDesc& symloc)
+{
+    TypeDesc::BASETYPE storage(
+        TypeDesc::BASETYPE(symloc.stored_type().basetype));
+    return symloc.arena == SymArena::Outputs
+           && symloc.type.basetype == TypeDesc::FLOAT
+           && (storage == TypeDesc::HALF || storage == TypeDesc::UINT8);
+}
+
 };  // namespace pvt
 
 
@@ -1713,30 +2630,80 @@ public:
         m_llvm_groupdata_wide_size = size;
     }
 
+    /// Bytes of JITed code and data held for this group, summed over
+    /// every time it was JITed (scalar, batched, and tiered up).
+    size_t jit_memory() const { return m_jit_memory; }
+    void add_jit_memory(size_t bytes) { m_jit_memory += bytes; }
+
+    // The compiled entry points are atomic because with tiered JIT they
+    // are swapped for the optimized versions while other threads may be
+    // executing the group.
     RunLLVMGroupFunc llvm_compiled_version() const
     {
-        return m_llvm_compiled_version;
+        return m_llvm_compiled_version.load(std::memory_order_acquire);
     }
     void llvm_compiled_version(RunLLVMGroupFunc func)
     {
-        m_llvm_compiled_version = func;
+        m_llvm_compiled_version.store(func, std::memory_order_release);
+    }
+    RunLLVMGroupFunc llvm_compiled_init() const
+    {
+        return m_llvm_compiled_init.load(std::memory_order_acquire);
     }
-    RunLLVMGroupFunc llvm_compiled_init() const { return m_llvm_compiled_init; }
     void llvm_compiled_init(RunLLVMGroupFunc func)
     {
-        m_llvm_compiled_init = func;
+        m_llvm_compiled_init.store(func, std::memory_order_release);
     }
     RunLLVMGroupFunc llvm_compiled_layer(int layer) const
     {
-        return layer < (int)m_llvm_compiled_layers.size()
-                   ? m_llvm_compiled_layers[layer]
+        return layer < m_llvm_compiled_nlayers
+                   ? m_llvm_compiled_layers[layer].load(
+                       std::memory_order_acquire)
                    : NULL;
     }
     void llvm_compiled_layer(int layer, RunLLVMGroupFunc func)
     {
-        m_llvm_compiled_layers.resize((size_t)nlayers(), NULL);
-        if (layer < nlayers())
-            m_llvm_compiled_layers[layer] = func;
+        if (!m_llvm_compiled_layers) {
+            // Sized once; only the entries are replaced by a tier-up.
+            m_llvm_compiled_layers.reset(
+                new std::atomic<RunLLVMGroupFunc>[nlayers()]);
+            for (int i = 0; i < nlayers(); ++i)
+                m_llvm_compiled_layers[i].store(nullptr,
+                                                std::memory_order_relaxed);
+            m_llvm_compiled_nlayers = nlayers();
+        }
+        if (layer < m_llvm_compiled_nlayers)
+            m_llvm_compiled_layers[layer].store(func,
+                                                std::memory_order_release);
+    }
+
+    /// Is this group running fast tier-0 JIT code that is waiting to be
+    /// replaced by a fully optimized re-JIT?
+    bool tierup_pending() const
+    {
+        return m_tierup_pending.load(std::memory_order_acquire);
+    }
+
+    /// The profile site of the layer (with no sourcefile) or of one of its
+    /// source lines, made if it doesn't exist yet.
+    pvt::ProfileSite* profile_site(int layer, ustring sourcefile = ustring(),
+                                   int sourceline = 0);
+
+    /// Call f on each profile site, in the order they were made.
+    template<typename F> void foreach_profile_site(F&& f) const
+    {
+        spin_lock lock(m_profile_sites_mutex);
+        for (const pvt::ProfileSite& site : m_profile_sites)
+            f(site);
+    }
+
+    /// How many times has the layer run, as counted by profiling tier-0
+    /// code? Returns -1 if the group has no layer profile.
+    long long layer_executions(int layer) const
+    {
+        return m_layer_exec_counts && layer < nlayers()
+                   ? (long long)m_layer_exec_counts[layer]
+                   : -1;
     }
 
 #if OSL_USE_BATCHED
@@ -1785,13 +2752,58 @@ public:
         return m_executions;
     }
 
-    void start_running()
+    /// Storage for the values of constant symbols created while
+    /// optimizing the group's layers, freed along with the group.
+    /// Identical values share storage, so it must not be modified.
+    int* int_constants(const int* values, size_t n)
+    {
+        return m_constants->ints.intern(values, n);
+    }
+    float* float_constants(const float* values, size_t n)
+    {
+        return m_constants->floats.intern(values, n);
+    }
+    ustring* string_constants(const ustring* values, size_t n)
+    {
+        return m_constants->strings.intern(values, n);
+    }
+
+    /// The most ScratchArena memory one execution of the group has used.
+    size_t scratch_highwater() const
+    {
+        return size_t(m_scratch_highwater.load(std::memory_order_relaxed));
+    }
+    void update_scratch_highwater(size_t used)
+    {
+        long long prev = m_scratch_highwater.load(std::memory_order_relaxed);
+        while (prev < (long long)used
+               && !m_scratch_highwater.compare_exchange_weak(prev, used))
+            ;
+    }
+
+    /// Count an execution, if count is true (profiling), in debug builds,
+    /// or while it matters to tiered JIT.
+    void start_running(bool count = false)
     {
 #ifndef NDEBUG
         m_executions++;
+#else
+        // Tiered JIT promotes the most-executed groups first
+        if (count || m_tierup_pending.load(std::memory_order_acquire))
+            m_executions++;
 #endif
     }
 
+    /// Total time spent optimizing and JITing the group, in seconds.
+    double compile_time() const { return m_stat_compile_time; }
+
+    /// Attributes of the shaded object that the renderer promises are
+    /// constant wherever the group runs, for getattribute to fold.
+    const ParamValueList& static_attributes() const
+    {
+        return m_static_attributes;
+    }
+
     void name(ustring name)
     {
         m_name = name;
@@ -1803,6 +2815,12 @@ public:
 
     std::string serialize() const;
 
+    /// The (layer, param) pairs that live in the group data, in the order
+    /// the backends should lay them out: hot params first, each region
+    /// sorted by decreasing alignment. Only valid after optimization.
+    std::vector<std::pair<int, Symbol*>>
+    groupdata_param_order(bool skip_unused_layers);
+
     void lock() const
     {
         m_mutex.lock();
@@ -1839,6 +2857,10 @@ public:
         mark_entry_layer(find_layer(layername));
     }
 
+    /// The table of resolved tiles for the given udim texture handle,
+    /// made on first request.  It lives as long as the group does.
+    UdimTileTable* udim_table(RendererServices::TextureHandle* udim_handle);
+
     int num_entry_layers() const
     {
         return m_num_entry_layers;
@@ -1879,6 +2901,32 @@ public:
         return m_raytypes_off;
     }
 
+    /// The raytype variant of this group (see
+    /// ShadingSystem::add_raytype_variant) that was specialized for points
+    /// with the given raytype bits, or nullptr if there is none.
+    ShaderGroup* raytype_variant(int raytype) const
+    {
+        for (auto& v : m_raytype_variants)
+            if ((raytype & v.raytypes_on) == v.raytypes_on
+                && !(raytype & v.raytypes_off))
+                return v.group.get();
+        return nullptr;
+    }
+    bool has_raytype_variants() const { return !m_raytype_variants.empty(); }
+    bool has_userdata_variants() const
+    {
+        return !m_userdata_variants.empty();
+    }
+
+    /// Is this a copy of a group computing only some of its outputs (see
+    /// ShadingSystem::output_variant), which doesn't need its closures?
+    bool closures_unused() const { return m_closures_unused; }
+
+    /// Do the group's results depend only on what a ShadingCache::Key
+    /// holds, so that they may be cached by shading point?  Known once
+    /// the group is optimized.
+    bool cacheable() const { return m_cacheable; }
+
     void clear_symlocs()
     {
         m_symlocs.clear();
@@ -1918,6 +2966,11 @@ public:
             return nullptr;
     }
 
+    // Is every param that retrieves userdata number `index` placed with a
+    // SymArena::UserData symloc, so that the JIT loads it straight from
+    // the renderer's data and it needs no slot in the groupdata?
+    bool userdata_placed(int index) const;
+
 private:
     // Put all the things that are read-only (after optimization) and
     // needed on every shade execution at the front of the struct, as much
@@ -1931,12 +2984,48 @@ private:
     size_t m_llvm_groupdata_size = 0;  ///< Heap size needed for its groupdata
     size_t m_llvm_groupdata_wide_size
         = 0;                     ///< Heap size needed for its wide groupdata
+    size_t m_jit_memory = 0;     ///< JITed code and data held for it
     int m_id;                    ///< Unique ID for the group
     int m_num_entry_layers = 0;  ///< Number of marked entry layers
-    RunLLVMGroupFunc m_llvm_compiled_version = nullptr;
-    RunLLVMGroupFunc m_llvm_compiled_init    = nullptr;
-    std::vector<RunLLVMGroupFunc> m_llvm_compiled_layers;
+    /// Awaiting optimized re-JIT?  Cleared (released) by the tier-up
+    /// worker once the optimized entry points are published.
+    std::atomic<bool> m_tierup_pending { false };
+    // What owns the memory of its JITed code, if it does (see
+    // jit_free_with_group), and of any code that replaced; and, under
+    // jit_memory_budget_MB, whether it may be evicted; whether it was,
+    // and awaits a re-JIT; how many executions are running it; whether
+    // evict_group_code is tearing it down; and the m_jit_clock when last
+    // run.
+    std::shared_ptr<void> m_jit_code;
+    std::vector<std::shared_ptr<void>> m_jit_retired;
+    // What keeps alive the code of other groups its layers call (see
+    // jit_share_layers), and the groupdata offsets of the fields those
+    // layers use, which its code passes them.
+    std::vector<std::shared_ptr<void>> m_jit_borrowed;
+    std::vector<std::unique_ptr<int[]>> m_shared_layer_offsets;
+    bool m_jit_evictable = false;
+    bool m_jit_evicted   = false;
+    std::atomic<int> m_jit_users { 0 };
+    std::atomic<bool> m_jit_evicting { false };
+    std::atomic<long long> m_jit_last_used { 0 };
+    // optimize_group_async state (a ShadingSystem::CompileStatus) and
+    // priority, guarded by the ShadingSystem's m_async_mutex
+    std::atomic<int> m_async_status { 0 };
+    int m_async_priority = 0;
+    std::atomic<RunLLVMGroupFunc> m_llvm_compiled_version { nullptr };
+    std::atomic<RunLLVMGroupFunc> m_llvm_compiled_init { nullptr };
+    std::unique_ptr<std::atomic<RunLLVMGroupFunc>[]> m_llvm_compiled_layers;
+    int m_llvm_compiled_nlayers = 0;
+    std::unique_ptr<atomic_ll[]> m_layer_exec_counts;  ///< Layer profile
+    std::deque<pvt::ProfileSite> m_profile_sites;  ///< Instrumented profile
+    std::map<std::tuple<int, const char*, int>, pvt::ProfileSite*>
+        m_profile_site_index;
+    mutable spin_mutex m_profile_sites_mutex;
 #if OSL_USE_BATCHED
+    // Batched uniformity profile: for each "layer.symbol" name, two counts
+    // (batches sampled, batches in which all active lanes agreed).
+    std::vector<ustring> m_batched_uniformity_syms;
+    std::unique_ptr<atomic_ll[]> m_batched_uniformity_counts;
     RunLLVMGroupFuncWide m_llvm_compiled_wide_version = nullptr;
     RunLLVMGroupFuncWide m_llvm_compiled_wide_init    = nullptr;
     std::vector<RunLLVMGroupFuncWide> m_llvm_compiled_wide_layers;
@@ -1963,12 +3052,21 @@ private:
     std::vector<ustring> m_attribute_scopes;
     std::vector<TypeDesc> m_attribute_types;
     std::vector<ustring> m_renderer_outputs;  ///< Names of renderer outputs
+    ParamValueList m_static_attributes;       ///< Constant object attributes
     std::vector<SymLocationDesc> m_symlocs;   ///< SORTED!!
     bool m_unknown_textures_needed;
     bool m_unknown_closures_needed;
     bool m_unknown_attributes_needed;
     atomic_ll m_executions { 0 };  ///< Number of times the group executed
+    // Values of the layers' constants, shared with the groups that use
+    // the same layers
+    std::shared_ptr<GroupConstants> m_constants {
+        std::make_shared<GroupConstants>()
+    };
+    atomic_ll m_scratch_highwater { 0 };  ///< Most arena used by an execution
     atomic_ll m_stat_total_shading_time_ticks { 0 };  // Shading time (ticks)
+    // Optimize + JIT time of all tiers; written only under m_mutex
+    std::atomic<double> m_stat_compile_time { 0.0 };
 
     // PTX assembly for compiled ShaderGroup
     std::string m_llvm_ptx_compiled_version;
@@ -1977,6 +3075,63 @@ private:
     std::vector<ParamHints> m_pending_hints;  // ParamHints of pending params
     ustring m_group_use;                      // "Usage" of group
     bool m_complete = false;                  // Successfully ShaderGroupEnd?
+    std::weak_ptr<ShaderGroup> m_self;        // Set by ShaderGroupBegin
+    uint64_t m_structure_hash = 0;  // Hash of layers/params, 0 = unshareable
+    std::shared_ptr<ShaderGroup> m_shared_from;  // Group whose code we use
+    std::vector<std::weak_ptr<ShaderGroup>> m_sharers;  // Groups using ours
+    std::string m_source_spec;  // Serialized source, for reparam_reoptimize
+    // Copies of the group specialized for raytypes, tried in order
+    struct RaytypeVariant {
+        int raytypes_on, raytypes_off;
+        std::shared_ptr<ShaderGroup> group;
+    };
+    std::vector<RaytypeVariant> m_raytype_variants;
+    // Copies of the group with one userdata folded to a hot value, all
+    // for the same userdata
+    struct UserdataVariant {
+        ustring name;
+        TypeDesc type;
+        std::vector<char> value;
+        std::shared_ptr<ShaderGroup> group;
+    };
+    std::vector<UserdataVariant> m_userdata_variants;
+    // Copies of the group computing only some outputs, by the sorted
+    // names of the outputs
+    struct OutputVariant {
+        std::vector<ustring> outputs;
+        std::shared_ptr<ShaderGroup> group;
+    };
+    std::vector<OutputVariant> m_output_variants;
+    bool m_outputs_only    = false;  // Only m_renderer_outputs are wanted
+    bool m_closures_unused = false;  // ... and Ci isn't one of them
+    bool m_cacheable       = false;  // See cacheable()
+    // Drawn anew from ShadingCache::new_epoch() by each ReParameter, so
+    // that results cached before it are never found again
+    std::atomic<int64_t> m_shading_cache_epoch { ShadingCache::new_epoch() };
+    // Values of the interactive params, laid out once the group is
+    // optimized, and shared with the groups that use the same layers
+    struct InteractiveParams {
+        std::unique_ptr<char[]> data;
+        int size = 0;                // Bytes, a multiple of 16
+        std::vector<ustring> names;  // "layer.param" of each param
+        std::vector<int> offsets;    // Where each param is in data
+        int dirty_begin = 0;         // Bytes changed by ReParameter
+        int dirty_end   = 0;
+        spin_mutex mutex;  ///< Guards the dirty range
+    };
+    std::shared_ptr<InteractiveParams> m_interactive;
+    std::shared_ptr<ConstantOutputs> m_constant_outputs;  ///< Once optimized
+    // Bytes of closures one execution allocates, or -1 if unbounded
+    int m_closure_memory_bound = -1;
+    float m_cost_estimate      = 0.0f;  // From the ops, about ns per execution
+    // Times of executions while profiling, which refine m_cost_estimate;
+    // unlike m_stat_total_shading_time_ticks, getstats doesn't drain them
+    atomic_ll m_timed_executions { 0 };
+    atomic_ll m_timed_ticks { 0 };
+    atomic_int m_variant_requests { 0 };  // Shades that wanted this variant
+    // Udim tiles resolved by our compiled code, one table per udim handle
+    std::vector<std::unique_ptr<UdimTileTable>> m_udim_tables;
+    spin_mutex m_udim_tables_mutex;  ///< Guards m_udim_tables
 
     friend class OSL::pvt::ShadingSystemImpl;
     friend class OSL::pvt::BackendLLVM;
@@ -2019,11 +3174,33 @@ public:
     /// group. (See similarly named method of ShadingSystem.)
     bool execute_cleanup();
 
+    /// Flatten the closure tree into m_flat_closure (see
+    /// ShadingSystem::flatten_closure).
+    cspan<ClosureFlatComponent> flatten_closure(const ClosureColor* closure);
+
+    /// Flatten several closure trees into m_flat_closure, one after the
+    /// other (see ShadingSystem::flatten_closures).
+    cspan<ClosureFlatComponent>
+    flatten_closures(cspan<const ClosureColor*> closures, span<int> begins);
+
     /// Execute the shader group, including init, run of single entry point
     /// layer, and cleanup. (See similarly named method of ShadingSystem.)
     bool execute(ShaderGroup& group, int shadeindex, ShaderGlobals& globals,
                  void* userdata_base_ptr, void* output_base_ptr, bool run);
 
+    /// Execute the groups one after another on the same point, sharing
+    /// one init of the context. (See similarly named method of
+    /// ShadingSystem.)
+    bool execute(cspan<ShaderGroup*> groups, int shadeindex,
+                 ShaderGlobals& globals, void* userdata_base_ptr,
+                 void* output_base_ptr);
+
+    /// Execute the group on a run of points, sharing one init of the
+    /// context. (See similarly named method of ShadingSystem.)
+    bool execute(ShaderGroup& group, int shadeindex,
+                 span<ShaderGlobals> globals, void* userdata_base_ptr,
+                 void* output_base_ptr);
+
 #if OSL_USE_BATCHED
     // Group all batched methods behind a templated interface
     // so we can support multiple widths
@@ -2077,23 +3254,23 @@ public:
                 = (int)((sizeof(ClosureComponent) + prim_size + alignment - 1)
                         / alignment)
                   * alignment;
+            m_sc.m_live_counters.incr(LiveCounters::Closures, WidthT);
             size_t needed = WidthT * stride;
             ClosureComponent* comp_mem
-                = (ClosureComponent*)m_sc.m_closure_pool.alloc(needed,
-                                                               alignment);
+                = (ClosureComponent*)m_sc.m_arena.alloc(needed, alignment);
             return comp_mem;
         }
 
         ClosureMul* closure_mul_allot()
         {
-            return (ClosureMul*)m_sc.m_closure_pool.alloc(
-                WidthT * sizeof(ClosureMul), alignof(ClosureMul));
+            return (ClosureMul*)m_sc.m_arena.alloc(WidthT * sizeof(ClosureMul),
+                                                   alignof(ClosureMul));
         }
 
         ClosureAdd* closure_add_allot()
         {
-            return (ClosureAdd*)m_sc.m_closure_pool.alloc(
-                WidthT * sizeof(ClosureAdd), alignof(ClosureAdd));
+            return (ClosureAdd*)m_sc.m_arena.alloc(WidthT * sizeof(ClosureAdd),
+                                                   alignof(ClosureAdd));
         }
 
         template<typename Str, typename... Args>
@@ -2146,10 +3323,12 @@ public:
     ClosureComponent* closure_component_allot(int id, size_t prim_size,
                                               const Color3& w)
     {
+        m_live_counters.incr(LiveCounters::Closures);
         // Allocate the component and the mul back to back
         size_t needed          = sizeof(ClosureComponent) + prim_size;
-        ClosureComponent* comp = (ClosureComponent*)m_closure_pool.alloc(
-            needed, alignof(ClosureComponent));
+        ClosureComponent* comp
+            = (ClosureComponent*)m_arena.alloc(needed,
+                                               alignof(ClosureComponent));
         comp->id = id;
         comp->w  = w;
         return comp;
@@ -2157,8 +3336,8 @@ public:
 
     ClosureMul* closure_mul_allot(const Color3& w, const ClosureColor* c)
     {
-        ClosureMul* mul = (ClosureMul*)m_closure_pool.alloc(sizeof(ClosureMul),
-                                                            alignof(ClosureMul));
+        ClosureMul* mul = (ClosureMul*)m_arena.alloc(sizeof(ClosureMul),
+                                                     alignof(ClosureMul));
         mul->id         = ClosureColor::MUL;
         mul->weight     = w;
         mul->closure    = c;
@@ -2167,8 +3346,8 @@ public:
 
     ClosureMul* closure_mul_allot(float w, const ClosureColor* c)
     {
-        ClosureMul* mul = (ClosureMul*)m_closure_pool.alloc(sizeof(ClosureMul),
-                                                            alignof(ClosureMul));
+        ClosureMul* mul = (ClosureMul*)m_arena.alloc(sizeof(ClosureMul),
+                                                     alignof(ClosureMul));
         mul->id         = ClosureColor::MUL;
         mul->weight.setValue(w, w, w);
         mul->closure = c;
@@ -2177,8 +3356,8 @@ public:
 
     ClosureAdd* closure_add_allot(const ClosureColor* a, const ClosureColor* b)
     {
-        ClosureAdd* add = (ClosureAdd*)m_closure_pool.alloc(sizeof(ClosureAdd),
-                                                            alignof(ClosureAdd));
+        ClosureAdd* add = (ClosureAdd*)m_arena.alloc(sizeof(ClosureAdd),
+                                                     alignof(ClosureAdd));
         add->id         = ClosureColor::ADD;
         add->closureA   = a;
         add->closureB   = b;
@@ -2252,6 +3431,100 @@ public:
                            int array_lookup, int index, TypeDesc attr_type,
                            void* attr_dest);
 
+    /// All of a batch of getattribute queries at once (see
+    /// opt_batch_getattribute), through the renderer's get_attributes.
+    void osl_get_attributes(ShaderGlobals* sg, void* objdata,
+                            span<RendererServices::AttributeRequest> requests);
+
+    /// What identifies a getattribute result in the attribute cache (see
+    /// the "attribute_cache" option).  index is -1 if not an array lookup.
+    struct AttributeCacheKey {
+        const void* objdata;
+        ustringhash object;
+        ustringhash name;
+        TypeDesc type;
+        int index;
+        bool operator==(const AttributeCacheKey& k) const
+        {
+            return objdata == k.objdata && object == k.object
+                   && name == k.name && type == k.type && index == k.index;
+        }
+    };
+    struct AttributeCacheEntry {
+        bool cacheable;           ///< Did the renderer allow caching it?
+        bool ok;                  ///< Did get_attribute succeed?
+        std::vector<char> value;  ///< The value (no derivs) if ok
+    };
+
+    /// Return the attribute cache entry for the key, or nullptr if this
+    /// context hasn't seen it since the cache was last invalidated.  An
+    /// entry that isn't cacheable just records that asking again is
+    /// pointless.
+    const AttributeCacheEntry*
+    find_cached_attribute(const AttributeCacheKey& key);
+
+    /// Record the result of a get_attribute call for the key, asking the
+    /// renderer whether it may be reused.
+    void cache_attribute(const AttributeCacheKey& key, bool ok,
+                         const void* value);
+
+    void incr_attribute_cache_hits() { ++m_stat_attribute_cache_hits; }
+
+    /// Key of a matrix the renderer gave us during this execution, for
+    /// renderers that supports("transform_cache"): the space (a name's
+    /// hash, or a TransformationPtr), which direction, the time and the
+    /// object.
+    struct MatrixCacheKey {
+        uint64_t space;
+        const void* objdata;
+        float time;
+        bool xform;    ///< Is space a TransformationPtr rather than a name?
+        bool inverse;  ///< Is it the matrix to space rather than from it?
+        bool operator==(const MatrixCacheKey& k) const
+        {
+            return space == k.space && objdata == k.objdata && time == k.time
+                   && xform == k.xform && inverse == k.inverse;
+        }
+    };
+    struct MatrixCacheEntry {
+        MatrixCacheKey key;
+        bool ok;     ///< Did the renderer know the space?
+        Matrix44 M;  ///< The matrix if ok
+    };
+
+    /// Return the matrix cache entry for the key, or nullptr if it wasn't
+    /// asked for yet in this execution (by any layer).
+    const MatrixCacheEntry* find_cached_matrix(const MatrixCacheKey& key)
+    {
+        for (int i = 0; i < m_matrix_cache_size; ++i) {
+            if (m_matrix_cache[i].key == key) {
+                ++m_stat_transform_cache_hits;
+                return &m_matrix_cache[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /// Remember the renderer's answer for the key until the end of this
+    /// execution, replacing the oldest entry if the cache is full.
+    void cache_matrix(const MatrixCacheKey& key, bool ok, const Matrix44& M)
+    {
+        MatrixCacheEntry& e = m_matrix_cache[m_matrix_cache_next];
+        e.key               = key;
+        e.ok                = ok;
+        e.M                 = M;
+        m_matrix_cache_next = (m_matrix_cache_next + 1) % max_cached_matrices;
+        if (m_matrix_cache_size < max_cached_matrices)
+            ++m_matrix_cache_size;
+    }
+
+    /// Forget the cached matrices, at the start of each execution.
+    void clear_matrix_cache()
+    {
+        m_matrix_cache_size = 0;
+        m_matrix_cache_next = 0;
+    }
+
     PerThreadInfo* thread_info() const
     {
         return m_threadinfo;
@@ -2270,6 +3543,10 @@ public:
         m_texture_thread_info = t;
     }
 
+    /// Hand the context over to another thread (when it's taken from the
+    /// shared pool).
+    void thread_info(PerThreadInfo* t) { m_threadinfo = t; }
+
     const LLVM_Util::PerThreadInfo& llvm_thread_info() const
     {
         return thread_info()->llvm_thread_info;
@@ -2290,18 +3567,54 @@ public:
         return &m_traceopt;
     }
 
+    /// Where trace() records its rays instead of tracing them, if anywhere
+    DeferredTraces* deferred_traces() const { return m_deferred_traces; }
+    void deferred_traces(DeferredTraces* traces)
+    {
+        m_deferred_traces = traces;
+    }
+
+    /// Mark the current execution as not final, to be run again (see
+    /// RendererServices::defer_shade).
+    void defer_shade()
+    {
+        if (!m_shade_deferred)
+            ++shadingsys().m_stat_shades_deferred;
+        m_shade_deferred = true;
+    }
+    bool shade_deferred() const { return m_shade_deferred; }
+
+    /// Let go of the groups this context has been running, which under a
+    /// jit_memory_budget_MB can't have their code evicted until then.
+    void unpin_jit_groups()
+    {
+        for (ShaderGroup* g : m_jit_pins)
+            --g->m_jit_users;
+        m_jit_pins.clear();
+    }
+
     void* alloc_scratch(size_t size, size_t align = 1)
     {
-        return m_scratch_pool.alloc(size, align);
+        return m_arena.alloc(size, align);
     }
 
     template<typename Color>
     bool ocio_transform(StringParam fromspace, StringParam tospace,
                         const Color& C, Color& Cout);
 
+    /// Is the current shade one of the 1 in "debug_sample" whose
+    /// debug_nan and debug_uninit checks run?
+    bool debug_sampled() const { return m_debug_sampled; }
+
     void incr_layers_executed()
     {
         ++m_stat_layers_executed;
+        m_live_counters.incr(LiveCounters::Layers);
+    }
+
+    void incr_live_counter(LiveCounters::Counter c, long long n = 1)
+    {
+        m_live_counters.incr(c, n);
     }
 
     void incr_get_userdata_calls()
@@ -2312,8 +3625,10 @@ public:
     // Clear the stats we record per-execution in this context (unlocked)
     void clear_runtime_stats()
     {
-        m_stat_get_userdata_calls = 0;
-        m_stat_layers_executed    = 0;
+        m_stat_get_userdata_calls   = 0;
+        m_stat_layers_executed      = 0;
+        m_stat_attribute_cache_hits = 0;
+        m_stat_transform_cache_hits = 0;
     }
 
     // Transfer the per-execution stats from this context to the shading
@@ -2322,6 +3637,10 @@ public:
     {
         shadingsys().m_stat_get_userdata_calls += m_stat_get_userdata_calls;
         shadingsys().m_stat_layers_executed += m_stat_layers_executed;
+        shadingsys().m_stat_attribute_cache_hits
+            += m_stat_attribute_cache_hits;
+        shadingsys().m_stat_transform_cache_hits
+            += m_stat_transform_cache_hits;
     }
 
     bool allow_warnings()
@@ -2350,6 +3669,16 @@ public:
     // Process all the recorded errors, warnings, printfs
     void process_errors() const;
 
+    /// Should this call of the printf with the given format, which stands
+    /// for its call site, print, per the printf_sample and
+    /// printf_rate_limit options?
+    bool printf_sampled(const char* format)
+    {
+        if (!shadingsys().m_printf_sample && !shadingsys().m_printf_rate_limit)
+            return true;
+        return printf_site_sampled(format);
+    }
+
     template<typename... Args>
     inline void errorfmt(const char* fmt, const Args&... args) const
     {
@@ -2386,6 +3715,41 @@ public:
 private:
     void free_dict_resources();
 
+    /// The group, or variant of it, to run for this point.
+    ShaderGroup& group_to_run(ShaderGroup& group, ShaderGlobals& ssg,
+                              void* userdata_base_ptr, int shadeindex);
+
+    /// Optimize and JIT the group if it isn't yet; return false if it
+    /// has nothing to run.
+    bool prepare_group(ShaderGroup& sgroup);
+
+    /// Make room on the heap, and clear the closures, messages and other
+    /// state that an execution leaves behind.
+    void reset_execution(size_t heap_size, size_t scratch_size);
+
+    /// Add the profiled time of one execution of the group to the stats.
+    void record_shading_time(ShaderGroup& sgroup, long long ticks);
+
+    /// Append the components of the closure tree to m_flat_closure.
+    void append_flat_closure(const ClosureColor* closure);
+
+    /// Fill in the shading cache key of the point, and return true; or
+    /// return false if the shading cache is off or the group to run for
+    /// the point isn't cacheable.
+    bool shading_cache_key(ShaderGroup& sgroup, int shadeindex,
+                           ShaderGlobals& ssg, void* userdata_base_ptr,
+                           void* output_base_ptr, ShadingCache::Key& key);
+
+    /// Set Ci and the placed outputs of the point from the shading cache,
+    /// as an execution would have, and return true; or return false if
+    /// the key isn't cached.
+    bool execute_from_cache(const ShadingCache::Key& key, int shadeindex,
+                            ShaderGlobals& ssg, void* output_base_ptr);
+
+    /// Add the results of the point's execution to the shading cache.
+    void cache_result(const ShadingCache::Key& key, int shadeindex,
+                      ShaderGlobals& ssg, void* output_base_ptr);
+
     ShadingSystemImpl& m_shadingsys;  ///< Backpointer to shadingsys
     RendererServices* m_renderer;     ///< Ptr to renderer services
     PerThreadInfo* m_threadinfo;      ///< Ptr to our thread's info
@@ -2397,8 +3761,26 @@ private:
         nullptr, &OIIO::aligned_free
     };
     size_t m_heapsize = 0;
-    using RegexMap = std::unordered_map<ustring, std::unique_ptr<std::regex>>;
-    RegexMap m_regex_map;    ///< Compiled regex's
+    ScratchArena m_arena;  ///< Closures, messages & scratch of one execution
+    using RegexMap = std::unordered_map<ustring, const std::regex*>;
+    RegexMap m_regex_map;  ///< Regexes found in the shadingsys, unlocked
+    struct AttributeCacheKeyHash {
+        size_t operator()(const AttributeCacheKey& k) const
+        {
+            return k.name.hash() + 17 * k.object.hash()
+                   + 79 * std::hash<const void*>()(k.objdata)
+                   + 131 * size_t(k.type.basetype + 37 * k.type.aggregate)
+                   + 257 * size_t(k.type.arraylen + 37 * k.index);
+        }
+    };
+    std::unordered_map<AttributeCacheKey, AttributeCacheEntry,
+                       AttributeCacheKeyHash>
+        m_attribute_cache;  ///< Cached getattribute results
+    int m_attribute_cache_epoch = 0;  ///< Shadingsys epoch of the cache
+    static constexpr int max_cached_matrices = 8;
+    MatrixCacheEntry m_matrix_cache[max_cached_matrices];  ///< Per execution
+    int m_matrix_cache_size = 0;  ///< Entries of m_matrix_cache in use
+    int m_matrix_cache_next = 0;  ///< Entry the next cache_matrix replaces
     MessageList m_messages;  ///< Message blackboard
 #if OSL_USE_BATCHED
     BatchedMessageBuffer
@@ -2406,15 +3788,27 @@ private:
 #endif
     int m_max_warnings;             ///< To avoid processing too many warnings
     int m_stat_get_userdata_calls;  ///< Number of calls to get_userdata
+    int m_stat_attribute_cache_hits = 0;  ///< getattribute served by cache
+    int m_stat_transform_cache_hits = 0;  ///< Matrices served by cache
     int m_stat_layers_executed;     ///< Number of layers executed
     long long m_ticks;              ///< Time executing the shader
+    LiveCounters m_live_counters;   ///< Read by ShadingSystem::live_stats
+    std::vector<ClosureFlatComponent> m_flat_closure;  ///< flatten_closure
+    std::vector<std::pair<const ClosureColor*, Color3>> m_flat_closure_todo;
+    std::vector<ShaderGroup*> m_chain;  ///< Groups run by a fused execute
+    // The multi-point execute has recorded the scratch and time per point
+    bool m_points_recorded = false;
+    // Pick whether the next shade is one checked under "debug_sample"
+    void next_debug_sample();
+    uint32_t m_debug_sample_rng;  ///< xorshift state picking checked shades
+    bool m_debug_sampled = true;  ///< Run the current shade's debug checks?
 
     TextureOpt m_textureopt;                ///< texture call options
     RendererServices::NoiseOpt m_noiseopt;  ///< noise call options
     RendererServices::TraceOpt m_traceopt;  ///< trace call options
-
-    SimplePool<20 * 1024> m_closure_pool;
-    SimplePool<64 * 1024> m_scratch_pool;
+    DeferredTraces* m_deferred_traces = nullptr;  ///< Rays being deferred
+    bool m_shade_deferred = false;  ///< Execution must be run again
+    std::vector<ShaderGroup*> m_jit_pins;  ///< See unpin_jit_groups
 
     Dictionary* m_dictionary;
 
@@ -2436,6 +3830,32 @@ private:
     };
     mutable std::vector<ErrorItem> m_buffered_errors;
 
+    // Errors and warnings this context already passed on, so that (absent
+    // "error_repeats") a shader repeating one on every point drops it here
+    // instead of contending for the shading system's lock to have it
+    // rejected there.  Forgotten when m_errseen_epoch of the shading
+    // system moves.
+    mutable std::unordered_set<std::string> m_errseen, m_warnseen;
+    mutable int m_errseen_epoch = 0;
+    static const size_t m_errseenmax = 256;
+
+    // Drop the buffered errors and warnings this context has already
+    // passed on.
+    void filter_repeated_errors() const;
+
+    // With printf_async, where this context's printf output goes to be
+    // printed by the background thread.
+    mutable std::shared_ptr<PrintfRing> m_printf_ring;
+    // Calls of each printf, by its format, for printf_sample and
+    // printf_rate_limit.
+    struct PrintfSite {
+        uint64_t calls = 0;
+        int64_t second = -1;  ///< Of steady_clock, for the rate limit
+        int printed    = 0;   ///< Prints within that second
+    };
+    std::unordered_map<const char*, PrintfSite> m_printf_sites;
+    bool printf_site_sampled(const char* format);
+
 #if OSL_USE_BATCHED
     // Buffering of fprintf's so they can be output
     // to the file one data lane at a time
@@ -2490,6 +3910,7 @@ struct NoiseParams {
     Vec3 direction;
     float bandwidth;
     float impulses;
+    int fast;
 
     NoiseParams()
         : anisotropic(0)
@@ -2497,6 +3918,7 @@ struct NoiseParams {
         , direction(1.0f, 0.0f, 0.0f)
         , bandwidth(1.0f)
         , impulses(16.0f)
+        , fast(0)
     {
     }
 };
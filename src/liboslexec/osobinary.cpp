@@ -0,0 +1,420 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+/////////////////////////////////////////////////////////////////////////
+/// \file
+///
+/// Binary .osob images of oso files.
+///
+/// Rather than a second description of the shader, an .osob is simply a
+/// recording of the OSOReader callbacks that parsing the oso text
+/// produces, in order.  So anything that reads oso through an OSOReader
+/// (the ShadingSystem, OSLQuery) reads .osob identically, just without
+/// tokenizing, and without the global lock that the flex/bison parser
+/// needs.
+///
+/// Layout: the magic "OSOB", a format version, a table of all strings
+/// (each a length and its characters), then the callback records, each a
+/// one-byte tag followed by fixed-size fields.  Strings in records are
+/// indices into the table.
+///
+/////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+
+#include "osoreader.h"
+
+
+
+OSL_NAMESPACE_ENTER
+
+namespace pvt {  // OSL::pvt
+
+
+namespace {
+
+static const char osob_magic[4]    = { 'O', 'S', 'O', 'B' };
+static const uint32_t osob_version = 1;
+
+enum OSOBinaryTag : uint8_t {
+    TagVersion = 1,
+    TagShader,
+    TagSymbol,
+    TagDefaultInt,
+    TagDefaultFloat,
+    TagDefaultString,
+    TagParameterDone,
+    TagHint,
+    TagCodemarker,
+    TagCodeend,
+    TagInstruction,
+    TagInstructionArg,
+    TagInstructionJump,
+    TagInstructionEnd,
+};
+
+}  // namespace
+
+
+
+bool
+OSOReader::is_binary(string_view data)
+{
+    return data.size() >= sizeof(osob_magic)
+           && !memcmp(data.data(), osob_magic, sizeof(osob_magic));
+}
+
+
+
+bool
+OSOReader::parse_binary(string_view data, string_view what)
+{
+    const char* p   = data.data();
+    const char* end = p + data.size();
+    bool ok         = true;
+    auto get32      = [&]() -> uint32_t {
+        uint32_t v = 0;
+        if (end - p < 4) {
+            ok = false;
+            return 0;
+        }
+        memcpy(&v, p, 4);
+        p += 4;
+        return v;
+    };
+    auto get8 = [&]() -> uint8_t {
+        if (p == end) {
+            ok = false;
+            return 0;
+        }
+        return uint8_t(*p++);
+    };
+
+    if (!is_binary(data)) {
+        m_err.errorfmt("{} is not a binary oso file", what);
+        return false;
+    }
+    p += sizeof(osob_magic);
+    if (get32() != osob_version) {
+        m_err.errorfmt("{} is from an unsupported version of .osob", what);
+        return false;
+    }
+
+    // The strings are only made into ustrings when first used, so that a
+    // reader that stops early (like OSLQuery, after the params) doesn't
+    // pay for interning all the names in the code.
+    std::vector<string_view> rawstrings;
+    std::vector<ustring> strings;
+    uint32_t nstrings = get32();
+    if (size_t(end - p) < size_t(nstrings) * 4)
+        ok = false;
+    if (ok)
+        rawstrings.reserve(nstrings);
+    for (uint32_t i = 0; ok && i < nstrings; ++i) {
+        uint32_t len = get32();
+        if (!ok || size_t(end - p) < len) {
+            ok = false;
+            break;
+        }
+        rawstrings.emplace_back(p, len);
+        p += len;
+    }
+    strings.resize(rawstrings.size());
+    auto getstr = [&]() -> const char* {
+        uint32_t i = get32();
+        if (i >= strings.size()) {
+            ok = false;
+            return "";
+        }
+        if (rawstrings[i].empty())
+            return "";
+        if (strings[i].empty())
+            strings[i] = ustring(rawstrings[i]);
+        return strings[i].c_str();
+    };
+
+    while (ok && p < end) {
+        switch (get8()) {
+        case TagVersion: {
+            const char* specid = getstr();
+            int major          = int(get32());
+            int minor          = int(get32());
+            if (ok)
+                version(specid, major, minor);
+            break;
+        }
+        case TagShader: {
+            const char* shadertype = getstr();
+            const char* name       = getstr();
+            if (ok)
+                shader(shadertype, name);
+            break;
+        }
+        case TagSymbol: {
+            SymType symtype = SymType(get8());
+            // Separate statements: argument evaluation order is unspecified
+            auto basetype     = TypeDesc::BASETYPE(get8());
+            auto aggregate    = TypeDesc::AGGREGATE(get8());
+            auto vecsemantics = TypeDesc::VECSEMANTICS(get8());
+            TypeDesc simple(basetype, aggregate, vecsemantics);
+            int arraylen           = int(get32());
+            bool closure           = get8();
+            const char* structname = getstr();
+            const char* name       = getstr();
+            if (!ok)
+                break;
+            if (symtype == SymTypeTemp && stop_parsing_at_temp_symbols())
+                return true;
+            // Build the type the same way the oso grammar does.
+            TypeSpec typespec;
+            if (structname[0])
+                typespec = TypeSpec(structname, 0);
+            else
+                typespec = TypeSpec(simple, closure);
+            if (arraylen)
+                typespec.make_array(arraylen);
+            symbol(symtype, typespec, name);
+            break;
+        }
+        case TagDefaultInt: {
+            int def = int(get32());
+            if (ok)
+                symdefault(def);
+            break;
+        }
+        case TagDefaultFloat: {
+            uint32_t bits = get32();
+            float def;
+            memcpy(&def, &bits, sizeof(float));
+            if (ok)
+                symdefault(def);
+            break;
+        }
+        case TagDefaultString: {
+            const char* def = getstr();
+            if (ok)
+                symdefault(def);
+            break;
+        }
+        case TagParameterDone: parameter_done(); break;
+        case TagHint: {
+            const char* h = getstr();
+            if (ok)
+                hint(h);
+            break;
+        }
+        case TagCodemarker: {
+            const char* name = getstr();
+            if (!ok)
+                break;
+            if (!parse_code_section())
+                return true;
+            codemarker(name);
+            break;
+        }
+        case TagCodeend: codeend(); break;
+        case TagInstruction: {
+            int label          = int(get32());
+            const char* opcode = getstr();
+            if (ok)
+                instruction(label, opcode);
+            break;
+        }
+        case TagInstructionArg: {
+            const char* name = getstr();
+            if (ok)
+                instruction_arg(name);
+            break;
+        }
+        case TagInstructionJump: {
+            int target = int(get32());
+            if (ok)
+                instruction_jump(target);
+            break;
+        }
+        case TagInstructionEnd: instruction_end(); break;
+        default: ok = false; break;
+        }
+    }
+    if (!ok)
+        m_err.errorfmt("Failed parse of {} (corrupt binary oso)", what);
+    return ok;
+}
+
+
+
+bool
+OSOBinaryWriter::convert(const std::string& oso, std::string& binary)
+{
+    m_body.clear();
+    m_strings.clear();
+    m_stringids.clear();
+    if (!parse_memory(oso))
+        return false;
+
+    binary.assign(osob_magic, sizeof(osob_magic));
+    uint32_t version  = osob_version;
+    uint32_t nstrings = uint32_t(m_strings.size());
+    binary.append((const char*)&version, sizeof(version));
+    binary.append((const char*)&nstrings, sizeof(nstrings));
+    for (ustring s : m_strings) {
+        uint32_t len = uint32_t(s.length());
+        binary.append((const char*)&len, sizeof(len));
+        binary.append(s.c_str(), len);
+    }
+    binary += m_body;
+    return true;
+}
+
+
+
+void
+OSOBinaryWriter::put_string(string_view s)
+{
+    ustring us(s);
+    auto found = m_stringids.emplace(us, uint32_t(m_strings.size()));
+    if (found.second)
+        m_strings.push_back(us);
+    put(found.first->second);
+}
+
+
+
+void
+OSOBinaryWriter::version(const char* specid, int major, int minor)
+{
+    put(uint8_t(TagVersion));
+    put_string(specid);
+    put(int32_t(major));
+    put(int32_t(minor));
+}
+
+
+
+void
+OSOBinaryWriter::shader(const char* shadertype, const char* name)
+{
+    put(uint8_t(TagShader));
+    put_string(shadertype);
+    put_string(name);
+}
+
+
+
+void
+OSOBinaryWriter::symbol(SymType symtype, TypeSpec typespec, const char* name)
+{
+    TypeDesc simple = typespec.simpletype();
+    put(uint8_t(TagSymbol));
+    put(uint8_t(symtype));
+    put(uint8_t(simple.basetype));
+    put(uint8_t(simple.aggregate));
+    put(uint8_t(simple.vecsemantics));
+    put(int32_t(simple.arraylen));
+    put(uint8_t(typespec.is_closure_based()));
+    put_string(typespec.structure() ? typespec.structspec()->name()
+                                    : ustring());
+    put_string(name);
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(int def)
+{
+    put(uint8_t(TagDefaultInt));
+    put(int32_t(def));
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(float def)
+{
+    put(uint8_t(TagDefaultFloat));
+    put(def);
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(const char* def)
+{
+    put(uint8_t(TagDefaultString));
+    put_string(def);
+}
+
+
+
+void
+OSOBinaryWriter::parameter_done()
+{
+    put(uint8_t(TagParameterDone));
+}
+
+
+
+void
+OSOBinaryWriter::hint(string_view hintstring)
+{
+    put(uint8_t(TagHint));
+    put_string(hintstring);
+}
+
+
+
+void
+OSOBinaryWriter::codemarker(const char* name)
+{
+    put(uint8_t(TagCodemarker));
+    put_string(name);
+}
+
+
+
+void
+OSOBinaryWriter::codeend()
+{
+    put(uint8_t(TagCodeend));
+}
+
+
+
+void
+OSOBinaryWriter::instruction(int label, const char* opcode)
+{
+    put(uint8_t(TagInstruction));
+    put(int32_t(label));
+    put_string(opcode);
+}
+
+
+
+void
+OSOBinaryWriter::instruction_arg(const char* name)
+{
+    put(uint8_t(TagInstructionArg));
+    put_string(name);
+}
+
+
+
+void
+OSOBinaryWriter::instruction_jump(int target)
+{
+    put(uint8_t(TagInstructionJump));
+    put(int32_t(target));
+}
+
+
+
+void
+OSOBinaryWriter::instruction_end()
+{
+    put(uint8_t(TagInstructionEnd));
+}
+
+
+};  // namespace pvt
+OSL_NAMESPACE_EXIT
@@ -4,6 +4,10 @@
 
 #pragma once
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "osl_pvt.h"
 #include <OSL/platform.h>
 
@@ -35,7 +39,8 @@ public:
 
     /// Read in the oso file, parse it, call the various callbacks.
     /// Return true if the file was correctly parsed, false if there was
-    /// an unrecoverable error reading the file.
+    /// an unrecoverable error reading the file. If the reader doesn't
+    /// parse the code section, only the lines before it are read.
     virtual bool parse_file(const std::string& filename);
 
     /// Read in OSO from memory, parse, call the various callbacks.
@@ -43,6 +48,15 @@ public:
     /// an unrecoverable error reading.
     virtual bool parse_memory(const std::string& buffer);
 
+    /// Replay the callbacks recorded in a binary .osob image (as written
+    /// by OSOBinaryWriter), without running the lexer or parser. The
+    /// `what` string names the source in error messages. parse_file and
+    /// parse_memory call this automatically for binary input.
+    bool parse_binary(string_view data, string_view what);
+
+    /// Does the buffer hold a binary .osob image (rather than oso text)?
+    static bool is_binary(string_view data);
+
     /// Declare the shader version.
     ///
     virtual void version(const char* specid, int major, int minor) {}
@@ -131,6 +145,48 @@ private:
     TypeSpec m_current_typespec;
 };
 
+
+
+/// OSOReader that records every callback from parsing oso text into a
+/// compact binary .osob image, which OSOReader::parse_binary can later
+/// replay much faster than the text can be parsed. Strings are interned
+/// into a table at the head of the image and referenced by index.
+class OSOBinaryWriter final : public OSOReader {
+public:
+    OSOBinaryWriter(ErrorHandler* errhandler = NULL) : OSOReader(errhandler)
+    {
+    }
+
+    /// Parse the oso text and return its binary image in `binary`.
+    bool convert(const std::string& oso, std::string& binary);
+
+    void version(const char* specid, int major, int minor) override;
+    void shader(const char* shadertype, const char* name) override;
+    void symbol(SymType symtype, TypeSpec typespec, const char* name) override;
+    void symdefault(int def) override;
+    void symdefault(float def) override;
+    void symdefault(const char* def) override;
+    void parameter_done() override;
+    void hint(string_view hintstring) override;
+    void codemarker(const char* name) override;
+    void codeend() override;
+    void instruction(int label, const char* opcode) override;
+    void instruction_arg(const char* name) override;
+    void instruction_jump(int target) override;
+    void instruction_end() override;
+
+private:
+    template<typename T> void put(const T& v)
+    {
+        m_body.append((const char*)&v, sizeof(T));
+    }
+    void put_string(string_view s);
+
+    std::string m_body;
+    std::vector<ustring> m_strings;
+    std::unordered_map<ustring, uint32_t> m_stringids;
+};
+
 OSL_PRAGMA_WARNING_POP
 
 
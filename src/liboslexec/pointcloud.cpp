@@ -3,6 +3,7 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 #include <cstdarg>
+#include <cstring>
 
 #include "pointcloud.h"
 
@@ -22,22 +23,54 @@ PointCloud::get(ustringhash filename, bool write)
 {
     if (filename.empty())
         return nullptr;
+    // Shaders look their cloud up on every call; remember the clouds this
+    // thread has already found rather than contend for the map's lock.
+    // Clouds live until exit, so the pointers stay valid.
+    thread_local std::unordered_map<ustringhash, PointCloud*> found_here;
+    auto here = found_here.find(filename);
+    if (here != found_here.end())
+        return here->second;
+    LockWait wait(LockSite::PointClouds);
     spin_lock lock(pointcloudmap_mutex);
+    wait.done();
     PointCloudMap::const_iterator found = pointclouds.find(filename);
     if (found != pointclouds.end())
-        return found->second.get();
+        return found_here[filename] = found->second.get();
     // Not found. Create a new one.
-    Partio::ParticlesDataMutable* partio_cloud = nullptr;
-    if (!write) {
-        partio_cloud = Partio::read(filename.c_str(), false);
-        if (!partio_cloud)
+    PointCloud* pc = nullptr;
+    if (!write && Strutil::ends_with(filename.c_str(), ".oslpc")) {
+        // Only maps the file, so holding the lock for it is cheap
+        std::string err;
+        auto mapped = MappedPointCloud::open(filename.c_str(), err);
+        if (!mapped)
             return nullptr;
+        pc = new PointCloud(filename, std::move(mapped));
     } else {
-        partio_cloud = Partio::create();
+        Partio::ParticlesDataMutable* partio_cloud = nullptr;
+        if (!write) {
+            partio_cloud = Partio::read(filename.c_str(), false);
+            if (!partio_cloud)
+                return nullptr;
+        } else {
+            partio_cloud = Partio::create();
+        }
+        pc = new PointCloud(filename, partio_cloud, write);
     }
-    PointCloud* pc = new PointCloud(filename, partio_cloud, write);
     pointclouds[filename].reset(pc);
-    return pc;
+    return found_here[filename] = pc;
+}
+
+
+
+void
+PointCloud::flush_all()
+{
+    LockWait wait(LockSite::PointClouds);
+    spin_lock lock(pointcloudmap_mutex);
+    wait.done();
+    for (auto& pc : pointclouds)
+        if (pc.second->m_write)
+            pc.second->flush();
 }
 
 
@@ -49,9 +82,6 @@ PointCloud::PointCloud(ustringhash filename,
         return;  // empty cloud
 
     if (!m_write) {
-        // partio requires this for accelerated lookups
-        m_partio_cloud->sort();
-
         // Create & stash a ParticleAttribute record for each attribute.
         // These will be automatically freed by ~PointCloud when the map
         // destructs.
@@ -60,19 +90,313 @@ PointCloud::PointCloud(ustringhash filename,
             m_partio_cloud->attributeInfo(i, *a);
             m_attributes[ustring(a->name)].reset(a);
         }
+
+        // Our own KD-tree replaces Partio's sort() and findNPoints(), so
+        // the particles keep their file order.
+        auto pos = m_attributes.find(u_position);
+        if (pos != m_attributes.end() && pos->second->type == Partio::VECTOR
+            && pos->second->count == 3) {
+            int n = m_partio_cloud->numParticles();
+            std::vector<Vec3> positions(n);
+            for (int i = 0; i < n; ++i) {
+                const float* p = m_partio_cloud->data<float>(*pos->second, i);
+                positions[i]   = Vec3(p[0], p[1], p[2]);
+            }
+            m_kdtree.build(positions.data(), positions.size());
+        }
+    }
+}
+
+
+
+PointCloud::PointCloud(ustringhash filename,
+                       std::unique_ptr<MappedPointCloud> mapped)
+    : m_filename(filename)
+    , m_partio_cloud(nullptr)
+    , m_mapped(std::move(mapped))
+    , m_write(false)
+{
+}
+
+
+
+// Save a cloud built with pointcloud_write in the mapped format.
+static bool
+write_mapped(ustringhash filename, Partio::ParticlesDataMutable& cloud,
+             const Partio::ParticleAttribute& position_attribute,
+             const PointCloud::AttributeMap& attributes)
+{
+    int npoints = cloud.numParticles();
+    std::vector<Vec3> positions(npoints);
+    for (int i = 0; i < npoints; ++i)
+        positions[i] = *(const Vec3*)cloud.data<float>(position_attribute, i);
+    // Partio stores strings as per-attribute indices, the columns want
+    // the strings themselves.
+    std::vector<MappedPointCloud::Column> columns;
+    std::vector<std::vector<char>> buffers;
+    buffers.reserve(attributes.size());
+    for (auto& a : attributes) {
+        TypeDesc type = a.second ? TypeDescOfPartioType(a.second.get())
+                                 : TypeUnknown;
+        if (type == TypeUnknown)
+            continue;
+        buffers.emplace_back(npoints * type.size());
+        char* data = buffers.back().data();
+        if (type == TypeString) {
+            const auto& strings = cloud.indexedStrs(*a.second);
+            for (int i = 0; i < npoints; ++i) {
+                int s = *cloud.data<int>(*a.second, i);
+                ((ustring*)data)[i] = (s >= 0 && s < int(strings.size()))
+                                          ? ustring(strings[s])
+                                          : ustring();
+            }
+        } else {
+            for (int i = 0; i < npoints; ++i)
+                memcpy(data + i * type.size(), cloud.data<char>(*a.second, i),
+                       type.size());
+        }
+        columns.push_back({ ustring_from(a.first), type, data });
     }
+    std::string err;
+    return MappedPointCloud::write(filename.c_str(), npoints,
+                                   positions.data(), columns, err);
 }
 
 
 
 PointCloud::~PointCloud()
 {
-    // Save the file if we wrote to it
-    if (m_write && !m_filename.empty())
-        Partio::write(m_filename.c_str(), *m_partio_cloud);
+    // Save the file if we wrote to it since the last flush
+    if (m_write)
+        flush();
     if (m_partio_cloud)
         m_partio_cloud->release();
 }
+
+
+
+// The points one thread has written to a cloud and not yet flushed.
+struct PointCloud::WriteBuffer {
+    struct Value {
+        ustring name;
+        TypeDesc type;
+        size_t offset;  ///< Of the value in values
+    };
+    OIIO::spin_mutex mutex;  ///< Only contended while flushing
+    std::vector<Vec3> positions;
+    std::vector<int> nvalues;  ///< Number of Values of each point
+    std::vector<Value> attribs;
+    std::vector<char> values;  ///< Strings as ustring
+
+    void swap(WriteBuffer& other)
+    {
+        positions.swap(other.positions);
+        nvalues.swap(other.nvalues);
+        attribs.swap(other.attribs);
+        values.swap(other.values);
+    }
+};
+
+
+
+PointCloud::WriteBuffer*
+PointCloud::thread_buffer()
+{
+    // Clouds live until exit, so their addresses are unique keys
+    thread_local std::unordered_map<const PointCloud*, WriteBuffer*> buffers;
+    WriteBuffer*& buffer = buffers[this];
+    if (!buffer) {
+        LockWait wait(LockSite::PointClouds);
+        spin_lock lock(m_mutex);
+        wait.done();
+        m_write_buffers.emplace_back(new WriteBuffer);
+        buffer = m_write_buffers.back().get();
+    }
+    return buffer;
+}
+
+
+
+bool
+PointCloud::append(const Vec3& pos, int nattribs, const ustring* names,
+                   const TypeDesc* types, const void** values)
+{
+    if (!m_write || !m_partio_cloud)
+        return false;
+    WriteBuffer& buffer(*thread_buffer());
+    LockWait wait(LockSite::PointClouds);
+    spin_lock lock(buffer.mutex);
+    wait.done();
+    bool ok = true;
+    int n   = 0;
+    for (int i = 0; i < nattribs; ++i) {
+        Partio::ParticleAttributeType pt = PartioType(types[i]);
+        if (pt == Partio::NONE) {
+            ok = false;
+            continue;
+        }
+        size_t size   = pt == Partio::VECTOR ? sizeof(Vec3) : types[i].size();
+        size_t offset = buffer.values.size();
+        buffer.values.resize(offset + size);
+        memcpy(buffer.values.data() + offset, values[i], size);
+        buffer.attribs.push_back({ names[i], types[i], offset });
+        ++n;
+    }
+    buffer.positions.push_back(pos);
+    buffer.nvalues.push_back(n);
+    return ok;
+}
+
+
+
+void
+PointCloud::merge(WriteBuffer& buffer)
+{
+    Partio::ParticlesDataMutable* cloud = m_partio_cloud;
+
+    // first time only -- add "position" attribute
+    if (cloud->numParticles() == 0 && buffer.positions.size())
+        m_position_attribute = cloud->addAttribute("position", Partio::VECTOR,
+                                                   3);
+
+    const WriteBuffer::Value* v = buffer.attribs.data();
+    for (size_t j = 0, e = buffer.positions.size(); j < e; ++j) {
+        // Make a new particle
+        Partio::ParticleIndex p = cloud->addParticle();
+        *(Vec3*)cloud->dataWrite<float>(m_position_attribute, p)
+            = buffer.positions[j];
+        for (int i = 0; i < buffer.nvalues[j]; ++i, ++v) {
+            Partio::ParticleAttributeType pt = PartioType(v->type);
+            Partio::ParticleAttribute* a     = m_attributes[v->name].get();
+            if (!a) {  // attribute needs to be added
+                a  = new Partio::ParticleAttribute();
+                *a = cloud->addAttribute(v->name.c_str(), pt,
+                                         pt == Partio::VECTOR ? 3 : 1 /*count*/);
+                m_attributes[v->name].reset(a);
+            }
+            if (pt != a->type)
+                continue;
+            const char* data = buffer.values.data() + v->offset;
+            switch (a->type) {
+            case Partio::FLOAT:
+                *(float*)cloud->dataWrite<float>(*a, p) = *(float*)data;
+                break;
+            case Partio::VECTOR:
+                *(Vec3*)cloud->dataWrite<float>(*a, p) = *(Vec3*)data;
+                break;
+            case Partio::INT:
+                *(int*)cloud->dataWrite<int>(*a, p) = *(int*)data;
+                break;
+            case Partio::INDEXEDSTR: {
+                const char* sstr = ((ustring*)data)->c_str();
+                int index        = cloud->lookupIndexedStr(*a, sstr);
+                if (index == -1)
+                    index = cloud->registerIndexedStr(*a, sstr);
+                *(int*)cloud->dataWrite<int>(*a, p) = index;
+            } break;
+            case Partio::NONE: break;
+            }
+        }
+    }
+}
+
+
+
+void
+PointCloud::flush()
+{
+    if (!m_write || !m_partio_cloud)
+        return;
+    LockWait wait(LockSite::PointClouds);
+    spin_lock lock(m_mutex);
+    wait.done();
+    for (auto& b : m_write_buffers) {
+        // Take the points and let the thread carry on writing
+        WriteBuffer points;
+        {
+            spin_lock buffer_lock(b->mutex);
+            points.swap(*b);
+        }
+        if (points.positions.size()) {
+            merge(points);
+            m_saved = false;
+        }
+    }
+    if (!m_saved)
+        save();
+}
+
+
+
+void
+PointCloud::save()
+{
+    if (m_filename.empty())
+        return;
+    if (Strutil::ends_with(m_filename.c_str(), ".oslpc"))
+        write_mapped(m_filename, *m_partio_cloud, m_position_attribute,
+                     m_attributes);
+    else
+        Partio::write(m_filename.c_str(), *m_partio_cloud);
+    m_saved = true;
+}
+
+
+
+TypeDesc
+PointCloud::attribute_type(ustringhash name) const
+{
+    if (m_mapped)
+        return m_mapped->attribute_type(name);
+    auto found = m_attributes.find(name);
+    return found != m_attributes.end() && found->second
+               ? TypeDescOfPartioType(found->second.get())
+               : TypeUnknown;
+}
+
+
+
+bool
+PointCloud::get_data(ustringhash name, const size_t* indices, int count,
+                     void* out) const
+{
+    if (m_mapped)
+        return m_mapped->get_data(name, indices, count, out);
+    auto found = m_attributes.find(name);
+    if (found == m_attributes.end() || !found->second || !m_partio_cloud)
+        return false;
+    const Partio::ParticleAttribute& attr(*found->second);
+    static_assert(sizeof(size_t) == sizeof(Partio::ParticleIndex),
+                  "Partio ParticleIndex should be the size of a size_t");
+    if (attr.type == Partio::INDEXEDSTR) {
+        // strings are special cases because they are stored as int index
+        int* strindices = OSL_ALLOCA(int, count);
+        m_partio_cloud->data(attr, count, (const Partio::ParticleIndex*)indices,
+                             /*sorted=*/false, (void*)strindices);
+        const auto& strings = m_partio_cloud->indexedStrs(attr);
+        int sicount         = int(strings.size());
+        for (int i = 0; i < count; ++i) {
+            int ind            = strindices[i];
+            ((ustring*)out)[i] = (ind >= 0 && ind < sicount)
+                                     ? ustring(strings[ind])
+                                     : ustring();
+        }
+    } else {
+        // All cases aside from strings are simple.
+        m_partio_cloud->data(attr, count, (const Partio::ParticleIndex*)indices,
+                             /*sorted=*/false, out);
+    }
+    return true;
+}
+
+
+
+bool
+PointCloud::get_positions(const size_t* indices, int count, Vec3* out) const
+{
+    return attribute_type(u_position).aggregate == TypeDesc::VEC3
+           && get_data(u_position, indices, count, out);
+}
 #endif
 
 }  // namespace pvt
@@ -96,56 +420,25 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
         return 0;
     }
 
-    const Partio::ParticlesData* cloud = pc->read_access();
-    if (cloud == NULL) {  // The file failed to load
+    if (!pc->readable()) {  // The file failed to load
         sg->context->errorfmt("pointcloud_search: could not open \"{}\"",
                               ustring_from(filename));
         return 0;
     }
 
-    // Early exit if the pointcloud contains no particles.
-    if (cloud->numParticles() == 0)
+    // Early exit if the pointcloud contains no particles (or has no
+    // "position" attribute, which leaves the search structure empty).
+    if (pc->kdtree().size() == 0)
         return 0;
 
-    // If we need derivs of the distances, we'll need access to the
-    // found point's positions.
-    Partio::ParticleAttribute* pos_attr = NULL;
-    if (derivs_offset) {
-        pos_attr = pc->m_attributes[u_position].get();
-        if (!pos_attr)
-            return 0;  // No "position" attribute -- fail
-    }
-
-    static_assert(sizeof(size_t) == sizeof(Partio::ParticleIndex),
-                  "Partio ParticleIndex should be the size of a size_t");
-    // FIXME -- if anybody cares about an architecture in which that is not
-    // the case, we can easily allocate local space to retrieve the indices,
-    // then copy them back to the caller's indices.
-
-    Partio::ParticleIndex* indices = (Partio::ParticleIndex*)out_indices;
-    float* dist2                   = out_distances;
+    float* dist2 = out_distances;
     if (!dist2)  // If not supplied, allocate our own
         dist2 = (float*)sg->context->alloc_scratch(max_points * sizeof(float),
                                                    sizeof(float));
 
-    float finalRadius;
-    int count = cloud->findNPoints(&center[0], max_points, radius, indices,
-                                   dist2, &finalRadius);
-
-    // If sorting, allocate some temp space and sort the distances and
-    // indices at the same time.
-    if (sort && count > 1) {
-        SortedPointRecord* sorted
-            = (SortedPointRecord*)sg->context->alloc_scratch(
-                count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
-        for (int i = 0; i < count; ++i)
-            sorted[i] = SortedPointRecord(dist2[i], indices[i]);
-        std::sort(sorted, sorted + count, SortedPointCompare());
-        for (int i = 0; i < count; ++i) {
-            dist2[i]   = sorted[i].first;
-            indices[i] = sorted[i].second;
-        }
-    }
+    // The KD-tree sorts the results itself when asked, nearest first
+    int count = pc->kdtree().find_nearest(center, radius, max_points,
+                                          out_indices, dist2, sort);
 
     if (out_distances) {
         // Convert the squared distances to straight distances
@@ -158,10 +451,8 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
             Vec3* positions = (Vec3*)sg->context->alloc_scratch(sizeof(Vec3)
                                                                     * count,
                                                                 sizeof(float));
-            // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
-            const_cast<Partio::ParticlesData*>(cloud)->data(*pos_attr, count,
-                                                            indices, true,
-                                                            (void*)positions);
+            if (!pc->get_positions(out_indices, count, positions))
+                return 0;  // No "position" attribute -- fail
             const Vec3& dCdx     = (&center)[1];
             const Vec3& dCdy     = (&center)[2];
             float* d_distance_dx = out_distances + derivs_offset;
@@ -211,24 +502,20 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
         return 0;
     }
 
-    const Partio::ParticlesData* cloud = pc->read_access();
-    if (cloud == NULL) {  // The file failed to load
+    if (!pc->readable()) {  // The file failed to load
         sg->context->errorfmt("pointcloud_get: could not open \"{}\"",
                               ustring_from(filename));
         return 0;
     }
 
-    // lookup the ParticleAttribute pointer needed for a query
-    Partio::ParticleAttribute* attr = pc->m_attributes[attr_name].get();
-    if (!attr) {
+    // Type the point cloud file contains:
+    TypeDesc partio_type = pc->attribute_type(attr_name);
+    if (partio_type == TypeUnknown) {
         sg->context->errorfmt(
             "Accessing unexisting attribute {} in pointcloud \"{}\"", attr_name,
             ustring_from(filename));
         return 0;
     }
-
-    // Type the partio file contains:
-    TypeDesc partio_type = TypeDescOfPartioType(attr);
     // Type the OSL shader has provided in destination array:
     TypeDesc element_type = attr_type.elementtype();
 
@@ -249,37 +536,13 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
         count = maxn;
     }
 
-    static_assert(sizeof(size_t) == sizeof(Partio::ParticleIndex),
-                  "Partio ParticleIndex should be the size of a size_t");
-    // FIXME -- if anybody cares about an architecture in which that is not
-    // the case, we can easily allocate local space to retrieve the indices,
-    // then copy them back to the caller's indices.
-
     // Actual data query
-    if (partio_type == TypeString) {
-        // strings are special cases because they are stored as int index
-        int* strindices = OSL_ALLOCA(int, count);
-        const_cast<Partio::ParticlesData*>(cloud)->data(
-            *attr, count, (const Partio::ParticleIndex*)indices,
-            /*sorted=*/false, (void*)strindices);
-        const auto& strings = cloud->indexedStrs(*attr);
-        int sicount         = int(strings.size());
-        for (int i = 0; i < count; ++i) {
-            int ind = strindices[i];
-            if (ind >= 0 && ind < sicount)
-                ((ustringrep*)out_data)[i] = ustringrep(strings[ind]);
-            else
-                ((ustringrep*)out_data)[i] = ustringrep();
-        }
-    } else {
-        // All cases aside from strings are simple.
-        const_cast<Partio::ParticlesData*>(cloud)->data(
-            *attr, count, (const Partio::ParticleIndex*)indices,
-            /*sorted=*/false, out_data);
-        // FIXME: it is regrettable that we need this const_cast (and the
-        // one a few lines above). It's to work around a bug in partio where
-        // they fail to declare this method as const, even though it could
-        // be. We should submit a patch to partio to fix this.
+    pc->get_data(attr_name, indices, count, out_data);
+    if (partio_type == TypeString
+        && !std::is_same<ustringrep, ustring>::value) {
+        // get_data yields ustrings, shaders see them as ustringrep
+        for (int i = 0; i < count; ++i)
+            ((ustringrep*)out_data)[i] = ustringrep(((ustring*)out_data)[i]);
     }
     return 1;
 #else
@@ -289,6 +552,23 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
 
 
 
+#ifdef USE_PARTIO
+// ustringrep is either of these, depending on the build
+static inline ustring
+as_ustring(ustring s)
+{
+    return s;
+}
+
+static inline ustring
+as_ustring(ustringhash s)
+{
+    return ustring_from(s);
+}
+#endif
+
+
+
 bool
 RendererServices::pointcloud_write(ShaderGlobals* /*sg*/, ustringhash filename,
                                    const Vec3& pos, int nattribs,
@@ -300,70 +580,22 @@ RendererServices::pointcloud_write(ShaderGlobals* /*sg*/, ustringhash filename,
         return false;
     PointCloud* pc = PointCloud::get(ustring_from(filename),
                                      true /* create file to write */);
-    spin_lock lock(pc->m_mutex);
-    Partio::ParticlesDataMutable* cloud = pc->write_access();
-    if (cloud == NULL)  // The file failed to load
+    if (!pc)
         return false;
 
-    // Mark the pointcloud as written, so we will save it later
-    pc->m_write = true;
-
-    // first time only -- add "position" attribute
-    if (cloud->numParticles() == 0)
-        pc->m_position_attribute = cloud->addAttribute("position",
-                                                       Partio::VECTOR, 3);
-
-    // Make sure all the attributes mentioned have been added properly
-    bool ok = true;
-    std::vector<Partio::ParticleAttribute*> partattrs;
-    partattrs.reserve(nattribs);
+    // The cloud takes names and string values as ustring
+    ustring* unames      = OSL_ALLOCA(ustring, nattribs);
+    ustring* ustrings    = OSL_ALLOCA(ustring, nattribs);
+    const void** uvalues = OSL_ALLOCA(const void*, nattribs);
     for (int i = 0; i < nattribs; ++i) {
-        Partio::ParticleAttribute* a = pc->m_attributes[names[i]].get();
-        if (!a) {  // attribute needs to be added
-            Partio::ParticleAttributeType pt = PartioType(types[i]);
-            if (pt == Partio::NONE) {
-                ok = false;
-            } else {
-                a  = new Partio::ParticleAttribute();
-                *a = cloud->addAttribute(names[i].c_str(), pt,
-                                         pt == Partio::VECTOR ? 3
-                                                              : 1 /*count*/);
-                pc->m_attributes[names[i]].reset(a);
-            }
+        unames[i]  = as_ustring(names[i]);
+        uvalues[i] = data[i];
+        if (types[i] == TypeDesc::TypeString) {
+            ustrings[i] = as_ustring(*(const ustringrep*)data[i]);
+            uvalues[i]  = &ustrings[i];
         }
-        partattrs.push_back(a);
     }
-
-    // Make a new particle
-    Partio::ParticleIndex p = cloud->addParticle();
-    *(Vec3*)cloud->dataWrite<float>(pc->m_position_attribute, p) = pos;
-    for (int i = 0; i < nattribs; ++i) {
-        Partio::ParticleAttribute* a = partattrs[i];
-        if (a && PartioType(types[i]) == a->type) {
-            switch (a->type) {
-            case Partio::FLOAT:
-                *(float*)cloud->dataWrite<float>(*a, p) = *(float*)(data[i]);
-                break;
-            case Partio::VECTOR:
-                *(Vec3*)cloud->dataWrite<float>(*a, p) = *(Vec3*)(data[i]);
-                break;
-            case Partio::INT:
-                *(int*)cloud->dataWrite<int>(*a, p) = *(int*)(data[i]);
-                break;
-            case Partio::INDEXEDSTR: {
-                ustringrep s     = *(ustringrep*)(data[i]);
-                const char* sstr = s.c_str();
-                int index        = cloud->lookupIndexedStr(*a, sstr);
-                if (index == -1)
-                    index = cloud->registerIndexedStr(*a, sstr);
-                *(int*)cloud->dataWrite<int>(*a, p) = index;
-            } break;
-            case Partio::NONE: break;
-            }
-        }
-    }
-
-    return ok;
+    return pc->append(pos, nattribs, unames, types, uvalues);
 #else
     return false;
 #endif
@@ -469,5 +701,15 @@ osl_pointcloud_write(ShaderGlobals* sg, ustring_pod filename, const Vec3* pos,
                                           names, types, values);
 }
 
+
+
+void
+ShadingSystemImpl::flush_pointclouds()
+{
+#ifdef USE_PARTIO
+    PointCloud::flush_all();
+#endif
+}
+
 }  // namespace pvt
 OSL_NAMESPACE_EXIT
@@ -6,10 +6,14 @@
 #    include <Partio.h>
 #    include <memory>
 #    include <unordered_map>
+#    include <vector>
 #endif
 
 #include <OSL/oslconfig.h>
 
+#include "pointcloud_kdtree.h"
+#include "pointcloud_mapped.h"
+
 OSL_NAMESPACE_ENTER
 namespace pvt {
 
@@ -19,49 +23,85 @@ class OSLEXECPUBLIC PointCloud {
 public:
     PointCloud(ustringhash filename, Partio::ParticlesDataMutable* partio_cloud,
                bool write);
+    PointCloud(ustringhash filename, std::unique_ptr<MappedPointCloud> mapped);
     ~PointCloud();
+
+    /// Find or open the named cloud.  Filenames ending in ".oslpc" are
+    /// memory-mapped (see MappedPointCloud), anything else goes through
+    /// Partio.
     static PointCloud* get(ustringhash filename, bool write = false);
 
     typedef std::unordered_map<ustringhash,
                                std::unique_ptr<Partio::ParticleAttribute>>
         AttributeMap;
 
-    const Partio::ParticlesData* read_access() const
-    {
-        OSL_DASSERT(!m_write);
-        return m_partio_cloud;
-    }
     Partio::ParticlesDataMutable* write_access() const
     {
         OSL_DASSERT(m_write);
         return m_partio_cloud;
     }
 
+    /// Was the cloud opened for reading?
+    bool readable() const { return !m_write && (m_partio_cloud || m_mapped); }
+
+    /// Search structure over the positions of a cloud opened for reading.
+    /// Searches return point indices for get_data() and get_positions().
+    const PointCloudKDTree& kdtree() const
+    {
+        OSL_DASSERT(!m_write);
+        return m_mapped ? m_mapped->kdtree() : m_kdtree;
+    }
+
+    /// Type of one value of the named attribute (TypeUnknown if there's
+    /// no such attribute), and its values for count points, one after
+    /// another (strings as ustring).
+    TypeDesc attribute_type(ustringhash name) const;
+    bool get_data(ustringhash name, const size_t* indices, int count,
+                  void* out) const;
+    bool get_positions(const size_t* indices, int count, Vec3* out) const;
+
+    /// Add a point to a cloud opened for writing.  Points go to a buffer
+    /// owned by the calling thread, so writers don't contend with each
+    /// other; flush() merges them into the cloud.  String values are
+    /// ustring.  Attributes of types a point cloud can't hold are
+    /// skipped, and make the return value false.
+    bool append(const Vec3& pos, int nattribs, const ustring* names,
+                const TypeDesc* types, const void** values);
+
+    /// Merge every thread's buffered points into a cloud opened for
+    /// writing, and save the file.
+    void flush();
+
+    /// flush() all the clouds opened for writing.
+    static void flush_all();
+
     ustringhash m_filename;
 
 private:
+    struct WriteBuffer;
+
+    WriteBuffer* thread_buffer();
+    void merge(WriteBuffer& buffer);
+    void save();
+
     // hide just this field, because we want to control how it is accessed
     Partio::ParticlesDataMutable* m_partio_cloud;
+    PointCloudKDTree m_kdtree;
+    std::unique_ptr<MappedPointCloud> m_mapped;
+    std::vector<std::unique_ptr<WriteBuffer>> m_write_buffers;
+    bool m_saved = false;  ///< Was the file saved since the last merge?
 
 public:
     AttributeMap m_attributes;
     bool m_write;
     Partio::ParticleAttribute m_position_attribute;
-    OIIO::spin_mutex m_mutex;
+    OIIO::spin_mutex m_mutex;  ///< Guards the written cloud and its buffers
 };
 
 namespace {  // anon
 
 static ustring u_position("position");
 
-// some helper classes to make the sort easy
-typedef std::pair<float, int> SortedPointRecord;  // dist,index
-struct SortedPointCompare {
-    bool operator()(const SortedPointRecord& a, const SortedPointRecord& b)
-    {
-        return a.first < b.first;
-    }
-};
 
 inline Partio::ParticleAttributeType
 PartioType(TypeDesc t)
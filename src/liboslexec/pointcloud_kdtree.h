@@ -0,0 +1,259 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+/// Nearest-neighbor search structure for point clouds.
+///
+/// An implicit, balanced KD-tree: each node splits its range of points at
+/// the median along the axis of largest extent, so the children of node i
+/// are 2i+1 and 2i+2 and their point ranges follow from the parent's, and
+/// only the split planes need storing.  The positions are stored SoA in
+/// tree order, so the leaves (of at most leaf_size points) are contiguous
+/// and their distance tests vectorize.  The k nearest points are kept in
+/// a bounded max-heap whose top shrinks the search radius as it fills.
+///
+/// It needs nothing from Partio and holds no attributes, only positions
+/// and the original index of each point.  The tree either owns the arrays
+/// (build()) or searches arrays that live elsewhere, such as a mapped file
+/// (attach()).
+class PointCloudKDTree {
+public:
+    static constexpr int leaf_size = 16;
+
+    struct Node {
+        float split;
+        int axis;
+    };
+
+    PointCloudKDTree() = default;
+    PointCloudKDTree(const PointCloudKDTree&) = delete;
+    PointCloudKDTree& operator=(const PointCloudKDTree&) = delete;
+
+    /// Build the tree over npoints positions, replacing any previous
+    /// contents.  Search results refer to points by their index in
+    /// positions[].
+    void build(const Vec3* positions, size_t npoints)
+    {
+        m_nodes.clear();
+        m_index.resize(npoints);
+        for (size_t i = 0; i < npoints; ++i)
+            m_index[i] = i;
+        if (npoints)
+            build_node(0, 0, npoints, positions);
+        m_x.resize(npoints);
+        m_y.resize(npoints);
+        m_z.resize(npoints);
+        for (size_t i = 0; i < npoints; ++i) {
+            const Vec3& p = positions[m_index[i]];
+            m_x[i]        = p.x;
+            m_y[i]        = p.y;
+            m_z[i]        = p.z;
+        }
+        m_view.nodes   = m_nodes.data();
+        m_view.nnodes  = m_nodes.size();
+        m_view.x       = m_x.data();
+        m_view.y       = m_y.data();
+        m_view.z       = m_z.data();
+        m_view.index   = m_index.data();
+        m_view.npoints = npoints;
+    }
+
+    /// Search arrays laid out as build() makes them (see nodes(), x(),
+    /// y(), z() and index()) without copying them.  They must outlive the
+    /// tree, or the next build() or attach().
+    void attach(const Node* nodes, size_t nnodes, const float* x,
+                const float* y, const float* z, const size_t* index,
+                size_t npoints)
+    {
+        m_nodes.clear();
+        m_x.clear();
+        m_y.clear();
+        m_z.clear();
+        m_index.clear();
+        m_view = { nodes, nnodes, x, y, z, index, npoints };
+    }
+
+    size_t size() const { return m_view.npoints; }
+    size_t nnodes() const { return m_view.nnodes; }
+    const Node* nodes() const { return m_view.nodes; }
+    const float* x() const { return m_view.x; }
+    const float* y() const { return m_view.y; }
+    const float* z() const { return m_view.z; }
+    const size_t* index() const { return m_view.index; }
+
+    /// Find up to max_points points within radius of center, storing
+    /// their indices and squared distances.  Which points are kept when
+    /// more than max_points qualify is the nearest ones.  If sort is true
+    /// the results are ordered nearest first, otherwise their order is
+    /// unspecified.  Return the number of points found.
+    int find_nearest(const Vec3& center, float radius, int max_points,
+                     size_t* indices, float* dist2, bool sort) const
+    {
+        if (max_points <= 0 || !m_view.npoints)
+            return 0;
+        Query q { center, radius * radius, max_points, 0, indices, dist2 };
+        search_node(0, 0, m_view.npoints, q);
+        if (sort) {
+            // Heap sort in place: pop the farthest to the end each time
+            for (int n = q.count - 1; n > 0; --n) {
+                std::swap(dist2[0], dist2[n]);
+                std::swap(indices[0], indices[n]);
+                sift_down(dist2, indices, 0, n);
+            }
+        }
+        return q.count;
+    }
+
+private:
+    struct View {
+        const Node* nodes;
+        size_t nnodes;
+        const float *x, *y, *z;
+        const size_t* index;
+        size_t npoints;
+    };
+
+    struct Query {
+        Vec3 center;
+        float radius2;  // Shrinks to the heap top once the heap is full
+        int max_points;
+        int count;
+        size_t* indices;  // Max-heap on dist2, paired with indices
+        float* dist2;
+    };
+
+    static float axis_value(const Vec3& p, int axis) { return p[axis]; }
+
+    void build_node(size_t node, size_t begin, size_t end,
+                    const Vec3* positions)
+    {
+        if (end - begin <= size_t(leaf_size))
+            return;
+        Vec3 lo = positions[m_index[begin]], hi = lo;
+        for (size_t i = begin + 1; i < end; ++i) {
+            const Vec3& p = positions[m_index[i]];
+            lo.x          = std::min(lo.x, p.x);
+            lo.y          = std::min(lo.y, p.y);
+            lo.z          = std::min(lo.z, p.z);
+            hi.x          = std::max(hi.x, p.x);
+            hi.y          = std::max(hi.y, p.y);
+            hi.z          = std::max(hi.z, p.z);
+        }
+        Vec3 extent = hi - lo;
+        int axis    = (extent.x >= extent.y && extent.x >= extent.z) ? 0
+                      : (extent.y >= extent.z)                       ? 1
+                                                                     : 2;
+        size_t mid  = begin + (end - begin) / 2;
+        std::nth_element(m_index.begin() + begin, m_index.begin() + mid,
+                         m_index.begin() + end, [&](size_t a, size_t b) {
+                             return axis_value(positions[a], axis)
+                                    < axis_value(positions[b], axis);
+                         });
+        if (m_nodes.size() <= node)
+            m_nodes.resize(node + 1);
+        m_nodes[node].split = axis_value(positions[m_index[mid]], axis);
+        m_nodes[node].axis  = axis;
+        build_node(2 * node + 1, begin, mid, positions);
+        build_node(2 * node + 2, mid, end, positions);
+    }
+
+    void search_node(size_t node, size_t begin, size_t end, Query& q) const
+    {
+        if (end - begin <= size_t(leaf_size)) {
+            search_leaf(begin, end, q);
+            return;
+        }
+        const Node& n = m_view.nodes[node];
+        size_t mid    = begin + (end - begin) / 2;
+        float d       = axis_value(q.center, n.axis) - n.split;
+        // Visit the side holding the center first, so the heap fills with
+        // near points early and prunes the far side more often.
+        if (d < 0.0f) {
+            search_node(2 * node + 1, begin, mid, q);
+            if (d * d <= q.radius2)
+                search_node(2 * node + 2, mid, end, q);
+        } else {
+            search_node(2 * node + 2, mid, end, q);
+            if (d * d <= q.radius2)
+                search_node(2 * node + 1, begin, mid, q);
+        }
+    }
+
+    void search_leaf(size_t begin, size_t end, Query& q) const
+    {
+        int n          = int(end - begin);
+        const float* x = m_view.x + begin;
+        const float* y = m_view.y + begin;
+        const float* z = m_view.z + begin;
+        float d2[leaf_size];
+        OSL_OMP_PRAGMA(omp simd)
+        for (int i = 0; i < n; ++i) {
+            float dx = x[i] - q.center.x;
+            float dy = y[i] - q.center.y;
+            float dz = z[i] - q.center.z;
+            d2[i]    = dx * dx + dy * dy + dz * dz;
+        }
+        for (int i = 0; i < n; ++i)
+            if (d2[i] <= q.radius2)
+                insert(q, d2[i], m_view.index[begin + i]);
+    }
+
+    static void insert(Query& q, float d2, size_t index)
+    {
+        if (q.count < q.max_points) {
+            // Sift up from the new last slot
+            int c = q.count++;
+            while (c > 0) {
+                int parent = (c - 1) / 2;
+                if (q.dist2[parent] >= d2)
+                    break;
+                q.dist2[c]   = q.dist2[parent];
+                q.indices[c] = q.indices[parent];
+                c            = parent;
+            }
+            q.dist2[c]   = d2;
+            q.indices[c] = index;
+            if (q.count == q.max_points)
+                q.radius2 = q.dist2[0];
+        } else if (d2 < q.dist2[0]) {
+            q.dist2[0]   = d2;
+            q.indices[0] = index;
+            sift_down(q.dist2, q.indices, 0, q.count);
+            q.radius2 = q.dist2[0];
+        }
+    }
+
+    static void sift_down(float* dist2, size_t* indices, int i, int n)
+    {
+        for (;;) {
+            int largest = i, l = 2 * i + 1, r = 2 * i + 2;
+            if (l < n && dist2[l] > dist2[largest])
+                largest = l;
+            if (r < n && dist2[r] > dist2[largest])
+                largest = r;
+            if (largest == i)
+                return;
+            std::swap(dist2[i], dist2[largest]);
+            std::swap(indices[i], indices[largest]);
+            i = largest;
+        }
+    }
+
+    std::vector<Node> m_nodes;         // Split planes, implicit tree order
+    std::vector<float> m_x, m_y, m_z;  // Positions (SoA), in tree order
+    std::vector<size_t> m_index;       // Original index of each point
+    View m_view {};                    // What searches read: ours or not
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
@@ -0,0 +1,146 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "pointcloud_kdtree.h"
+
+#include <OpenImageIO/benchmark.h>
+#include <OpenImageIO/unittest.h>
+
+using namespace OSL;
+using namespace OSL::pvt;
+
+
+
+static std::vector<Vec3>
+random_points(size_t n, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<Vec3> points(n);
+    for (auto& p : points)
+        p = Vec3(dist(rng), dist(rng), dist(rng));
+    return points;
+}
+
+
+
+// The squared distances of the max_points nearest points within radius,
+// nearest first, found the slow way.
+static std::vector<float>
+brute_force(const std::vector<Vec3>& points, const Vec3& center, float radius,
+            int max_points)
+{
+    std::vector<float> d2;
+    for (const Vec3& p : points) {
+        float d = (p - center).length2();
+        if (d <= radius * radius)
+            d2.push_back(d);
+    }
+    std::sort(d2.begin(), d2.end());
+    if (d2.size() > size_t(max_points))
+        d2.resize(max_points);
+    return d2;
+}
+
+
+
+static void
+test_against_brute_force()
+{
+    std::vector<Vec3> points = random_points(20000, 42);
+    PointCloudKDTree tree;
+    tree.build(points.data(), points.size());
+    OIIO_CHECK_EQUAL(tree.size(), points.size());
+
+    std::vector<Vec3> centers = random_points(500, 7);
+    const float radii[]       = { 0.01f, 0.05f, 0.2f, 2.0f };
+    const int max_points[]    = { 1, 8, 100 };
+    std::vector<size_t> indices(100);
+    std::vector<float> dist2(100);
+    for (const Vec3& c : centers) {
+        for (float radius : radii) {
+            for (int n : max_points) {
+                std::vector<float> expected = brute_force(points, c, radius,
+                                                          n);
+                int count = tree.find_nearest(c, radius, n, indices.data(),
+                                              dist2.data(), true);
+                OIIO_CHECK_EQUAL(count, int(expected.size()));
+                for (int i = 0; i < count && i < int(expected.size()); ++i) {
+                    OIIO_CHECK_EQUAL(dist2[i], expected[i]);
+                    OIIO_CHECK_EQUAL((points[indices[i]] - c).length2(),
+                                     dist2[i]);
+                }
+            }
+        }
+    }
+
+    // Unsorted results hold the same points
+    Vec3 c(0.5f, 0.5f, 0.5f);
+    int count = tree.find_nearest(c, 0.1f, 100, indices.data(), dist2.data(),
+                                  false);
+    std::vector<float> unsorted(dist2.begin(), dist2.begin() + count);
+    std::sort(unsorted.begin(), unsorted.end());
+    OIIO_CHECK_ASSERT(unsorted == brute_force(points, c, 0.1f, 100));
+}
+
+
+
+static void
+test_degenerate()
+{
+    PointCloudKDTree tree;
+    size_t index;
+    float dist2;
+    tree.build(nullptr, 0);
+    OIIO_CHECK_EQUAL(tree.find_nearest(Vec3(0.0f), 1.0f, 1, &index, &dist2,
+                                       true),
+                     0);
+
+    // Many coincident points must not break the median splits
+    std::vector<Vec3> points(1000, Vec3(1.0f, 2.0f, 3.0f));
+    tree.build(points.data(), points.size());
+    std::vector<size_t> indices(2000);
+    std::vector<float> d2(2000);
+    OIIO_CHECK_EQUAL(tree.find_nearest(Vec3(1.0f, 2.0f, 3.0f), 0.5f, 2000,
+                                       indices.data(), d2.data(), true),
+                     1000);
+    OIIO_CHECK_EQUAL(tree.find_nearest(Vec3(0.0f), 0.5f, 10, indices.data(),
+                                       d2.data(), true),
+                     0);
+}
+
+
+
+int
+main(int /*argc*/, char* /*argv*/[])
+{
+    test_against_brute_force();
+    test_degenerate();
+
+    // Some benchmarking, at the size of a production cloud
+    std::cout << "\nBenchmarks:\n";
+    using namespace OIIO;
+    std::vector<Vec3> points = random_points(1000000, 1);
+    PointCloudKDTree tree;
+    Benchmarker bench;
+    bench.iterations(1).trials(3);
+    bench("build 1M points",
+          [&]() { tree.build(points.data(), points.size()); });
+
+    std::vector<Vec3> centers = random_points(1024, 2);
+    size_t indices[16];
+    float dist2[16];
+    bench.iterations(centers.size()).trials(10);
+    size_t q = 0;
+    bench("kNN k=16 r=0.05, 1M points", [&]() {
+        const Vec3& c = centers[q++ % centers.size()];
+        DoNotOptimize(tree.find_nearest(c, 0.05f, 16, indices, dist2, true));
+    });
+
+    return unit_test_failures;
+}
@@ -0,0 +1,401 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include <OpenImageIO/filesystem.h>
+
+#include "pointcloud_mapped.h"
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+namespace {  // anon
+
+// File layout: the header, then the sections it gives the offsets of,
+// each aligned to section_alignment so the mapped arrays are aligned.
+static const char file_magic[8] = { 'O', 'S', 'L', 'P', 'C', 0, 0, 0 };
+static const uint32_t file_version      = 1;
+static const uint64_t section_alignment = 64;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nattributes;
+    uint64_t npoints;
+    uint64_t nnodes;
+    uint64_t nodes_offset;  // nnodes PointCloudKDTree::Node
+    uint64_t index_offset;  // npoints uint64, tree order -> point
+    uint64_t x_offset;      // npoints float each, in tree order
+    uint64_t y_offset;
+    uint64_t z_offset;
+    uint64_t attributes_offset;  // nattributes FileAttribute
+    uint64_t strings_offset;     // nstrings NUL-terminated, back to back
+    uint64_t strings_size;
+    uint64_t nstrings;
+};
+
+struct FileAttribute {
+    char name[64];
+    int32_t basetype;
+    int32_t aggregate;
+    int32_t arraylen;
+    int32_t reserved;
+    uint64_t offset;  // npoints values, strings as int32 string indices
+};
+
+static ustring u_position("position");
+
+
+
+inline uint64_t
+align_offset(uint64_t offset)
+{
+    return (offset + section_alignment - 1) / section_alignment
+           * section_alignment;
+}
+
+
+
+// Bytes one point's value of type takes up in a column.
+inline size_t
+column_value_size(TypeDesc type)
+{
+    return type.basetype == TypeDesc::STRING ? sizeof(int32_t) : type.size();
+}
+
+
+
+inline bool
+supported_type(TypeDesc type)
+{
+    if (type.basetype == TypeDesc::STRING)
+        return type.aggregate == TypeDesc::SCALAR && !type.arraylen;
+    if (type.basetype != TypeDesc::FLOAT && type.basetype != TypeDesc::INT)
+        return false;
+    return type.aggregate == TypeDesc::SCALAR
+           || (type.basetype == TypeDesc::FLOAT
+               && type.aggregate == TypeDesc::VEC3 && !type.arraylen);
+}
+
+
+
+// Sequential writer that pads each section to the file alignment.
+class SectionWriter {
+public:
+    explicit SectionWriter(FILE* file) : m_file(file) {}
+
+    uint64_t begin_section()
+    {
+        static const char zeros[section_alignment] = {};
+        uint64_t aligned                           = align_offset(m_offset);
+        write(zeros, aligned - m_offset);
+        return m_offset;
+    }
+
+    void write(const void* data, uint64_t size)
+    {
+        if (size && fwrite(data, 1, size, m_file) != size)
+            m_ok = false;
+        m_offset += size;
+    }
+
+    bool ok() const { return m_ok; }
+
+private:
+    FILE* m_file;
+    uint64_t m_offset = 0;
+    bool m_ok         = true;
+};
+
+}  // namespace
+
+
+
+bool
+MappedPointCloud::write(string_view filename, size_t npoints,
+                        const Vec3* positions,
+                        const std::vector<Column>& columns,
+                        std::string& errmessage)
+{
+    std::vector<Column> cols;
+    cols.push_back({ u_position, TypeVector, positions });
+    for (const Column& c : columns) {
+        if (c.name == u_position)
+            continue;  // Always written from positions
+        if (!supported_type(c.type) || c.name.length() >= 64) {
+            errmessage = fmtformat("unsupported point cloud attribute {} {}",
+                                   c.type, c.name);
+            return false;
+        }
+        cols.push_back(c);
+    }
+
+    PointCloudKDTree tree;
+    tree.build(positions, npoints);
+
+    // Gather the distinct strings of all string columns into one table
+    std::unordered_map<ustring, int32_t> string_index;
+    std::vector<ustring> strings;
+    std::vector<std::vector<int32_t>> string_columns(cols.size());
+    for (size_t c = 0; c < cols.size(); ++c) {
+        if (cols[c].type.basetype != TypeDesc::STRING)
+            continue;
+        string_columns[c].resize(npoints);
+        for (size_t i = 0; i < npoints; ++i) {
+            ustring s  = ((const ustring*)cols[c].data)[i];
+            auto found = string_index.find(s);
+            if (found == string_index.end()) {
+                found = string_index.emplace(s, int32_t(strings.size())).first;
+                strings.push_back(s);
+            }
+            string_columns[c][i] = found->second;
+        }
+    }
+
+    FILE* file = OIIO::Filesystem::fopen(filename, "wb");
+    if (!file) {
+        errmessage = fmtformat("could not open \"{}\" for writing", filename);
+        return false;
+    }
+    SectionWriter out(file);
+    FileHeader header {};
+    memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version     = file_version;
+    header.nattributes = uint32_t(cols.size());
+    header.npoints     = npoints;
+    header.nnodes      = tree.nnodes();
+    out.write(&header, sizeof(header));  // Rewritten with offsets at the end
+
+    header.nodes_offset = out.begin_section();
+    out.write(tree.nodes(), tree.nnodes() * sizeof(PointCloudKDTree::Node));
+    header.index_offset = out.begin_section();
+    for (size_t i = 0; i < npoints; ++i) {
+        uint64_t index = tree.index()[i];
+        out.write(&index, sizeof(index));
+    }
+    header.x_offset = out.begin_section();
+    out.write(tree.x(), npoints * sizeof(float));
+    header.y_offset = out.begin_section();
+    out.write(tree.y(), npoints * sizeof(float));
+    header.z_offset = out.begin_section();
+    out.write(tree.z(), npoints * sizeof(float));
+
+    std::vector<FileAttribute> attributes(cols.size());
+    for (size_t c = 0; c < cols.size(); ++c) {
+        FileAttribute& a = attributes[c];
+        memset(&a, 0, sizeof(a));
+        Strutil::safe_strcpy(a.name, cols[c].name.string(), sizeof(a.name));
+        a.basetype  = cols[c].type.basetype;
+        a.aggregate = cols[c].type.aggregate;
+        a.arraylen  = cols[c].type.arraylen;
+        a.offset    = out.begin_section();
+        if (cols[c].type.basetype == TypeDesc::STRING)
+            out.write(string_columns[c].data(), npoints * sizeof(int32_t));
+        else
+            out.write(cols[c].data, npoints * cols[c].type.size());
+    }
+    header.attributes_offset = out.begin_section();
+    out.write(attributes.data(), attributes.size() * sizeof(FileAttribute));
+
+    header.strings_offset = out.begin_section();
+    header.nstrings       = strings.size();
+    for (ustring s : strings) {
+        out.write(s.c_str(), s.length() + 1);
+        header.strings_size += s.length() + 1;
+    }
+
+    bool ok = out.ok() && fseek(file, 0, SEEK_SET) == 0
+              && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok &= (fclose(file) == 0);
+    if (!ok)
+        errmessage = fmtformat("error writing \"{}\"", filename);
+    return ok;
+}
+
+
+
+std::unique_ptr<MappedPointCloud>
+MappedPointCloud::open(string_view filename, std::string& errmessage)
+{
+    std::unique_ptr<MappedPointCloud> pc(new MappedPointCloud);
+    static_assert(sizeof(PointCloudKDTree::Node) == 8,
+                  "KD-tree nodes are stored as they are in memory");
+    if (sizeof(size_t) != sizeof(uint64_t)) {
+        errmessage = "mapped point clouds need a 64 bit platform";
+        return nullptr;
+    }
+
+    // Map the whole file read-only.  Once mapped, the file handles
+    // aren't needed any more.
+#ifdef _WIN32
+    HANDLE file = CreateFileA(std::string(filename).c_str(), GENERIC_READ,
+                              FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY,
+                                                0, 0, nullptr);
+            if (mapping) {
+                pc->m_map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (pc->m_map)
+                    pc->m_map_size = size_t(size.QuadPart);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+    }
+#else
+    int fd = ::open(std::string(filename).c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* map = mmap(nullptr, size_t(st.st_size), PROT_READ,
+                             MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                pc->m_map      = map;
+                pc->m_map_size = size_t(st.st_size);
+            }
+        }
+        close(fd);
+    }
+#endif
+    if (!pc->m_map) {
+        errmessage = fmtformat("could not map \"{}\"", filename);
+        return nullptr;
+    }
+
+    const char* base = (const char*)pc->m_map;
+    uint64_t size    = pc->m_map_size;
+    // Is the section of count elements of elemsize at offset in the file?
+    auto in_file = [&](uint64_t offset, uint64_t count, uint64_t elemsize) {
+        return offset <= size && offset % section_alignment == 0
+               && count <= (size - offset) / std::max(elemsize, uint64_t(1));
+    };
+    const FileHeader& header = *(const FileHeader*)base;
+    if (size < sizeof(FileHeader)
+        || memcmp(header.magic, file_magic, sizeof(file_magic))
+        || header.version != file_version
+        || !in_file(header.nodes_offset, header.nnodes,
+                    sizeof(PointCloudKDTree::Node))
+        || !in_file(header.index_offset, header.npoints, sizeof(uint64_t))
+        || !in_file(header.x_offset, header.npoints, sizeof(float))
+        || !in_file(header.y_offset, header.npoints, sizeof(float))
+        || !in_file(header.z_offset, header.npoints, sizeof(float))
+        || !in_file(header.attributes_offset, header.nattributes,
+                    sizeof(FileAttribute))
+        || !in_file(header.strings_offset, header.strings_size, 1)) {
+        errmessage = fmtformat("\"{}\" is not a valid point cloud", filename);
+        return nullptr;
+    }
+
+    const FileAttribute* attributes
+        = (const FileAttribute*)(base + header.attributes_offset);
+    for (uint32_t i = 0; i < header.nattributes; ++i) {
+        const FileAttribute& a = attributes[i];
+        TypeDesc type(TypeDesc::BASETYPE(a.basetype),
+                      TypeDesc::AGGREGATE(a.aggregate), a.arraylen);
+        std::string name(a.name, strnlen(a.name, sizeof(a.name)));
+        if (!supported_type(type)
+            || !in_file(a.offset, header.npoints, column_value_size(type))) {
+            errmessage = fmtformat("\"{}\" has an invalid attribute \"{}\"",
+                                   filename, name);
+            return nullptr;
+        }
+        pc->m_attributes[ustringhash(ustring(name))] = { type,
+                                                         base + a.offset };
+    }
+    if (!pc->m_attributes.count(ustringhash(u_position))) {
+        errmessage = fmtformat("\"{}\" has no \"position\"", filename);
+        return nullptr;
+    }
+
+    // The string table is small next to the columns: read it now
+    const char* s   = base + header.strings_offset;
+    const char* end = s + header.strings_size;
+    pc->m_strings.reserve(header.nstrings);
+    while (s < end && pc->m_strings.size() < header.nstrings) {
+        size_t len = strnlen(s, end - s);
+        pc->m_strings.emplace_back(string_view(s, len));
+        s += len + 1;
+    }
+
+    using Node = PointCloudKDTree::Node;
+    pc->m_kdtree.attach((const Node*)(base + header.nodes_offset),
+                        header.nnodes, (const float*)(base + header.x_offset),
+                        (const float*)(base + header.y_offset),
+                        (const float*)(base + header.z_offset),
+                        (const size_t*)(base + header.index_offset),
+                        header.npoints);
+    return pc;
+}
+
+
+
+MappedPointCloud::~MappedPointCloud()
+{
+    if (!m_map)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(m_map);
+#else
+    munmap(m_map, m_map_size);
+#endif
+}
+
+
+
+TypeDesc
+MappedPointCloud::attribute_type(ustringhash name) const
+{
+    auto found = m_attributes.find(name);
+    return found != m_attributes.end() ? found->second.type : TypeUnknown;
+}
+
+
+
+bool
+MappedPointCloud::get_data(ustringhash name, const size_t* indices,
+                           int count, void* out) const
+{
+    auto found = m_attributes.find(name);
+    if (found == m_attributes.end())
+        return false;
+    const Attribute& a = found->second;
+    if (a.type.basetype == TypeDesc::STRING) {
+        const int32_t* column = (const int32_t*)a.data;
+        int nstrings          = int(m_strings.size());
+        for (int i = 0; i < count; ++i) {
+            int32_t s          = column[indices[i]];
+            ((ustring*)out)[i] = (s >= 0 && s < nstrings) ? m_strings[s]
+                                                          : ustring();
+        }
+    } else {
+        size_t size = a.type.size();
+        for (int i = 0; i < count; ++i)
+            memcpy((char*)out + i * size, a.data + indices[i] * size, size);
+    }
+    return true;
+}
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
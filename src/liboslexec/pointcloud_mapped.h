@@ -0,0 +1,85 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+#include "pointcloud_kdtree.h"
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+/// A point cloud in OSL's own read-only ".oslpc" format, which stores the
+/// KD-tree (see PointCloudKDTree) next to the attribute columns so that
+/// opening a cloud only maps the file: nothing is read, parsed or copied
+/// up front, pages are brought in by the searches that touch them, and
+/// render processes on the same machine share them through the page
+/// cache.  Files are written by write(), e.g. by pointcloud_write() to a
+/// filename ending in ".oslpc".
+///
+/// Attributes are columns of one value per point, in the original point
+/// order, so search results index them directly.  They may be float, int,
+/// string, float triples, or arrays of float and int.  The "position"
+/// attribute is always present.  Files use the byte order of the machine
+/// that wrote them.
+class MappedPointCloud {
+public:
+    /// One attribute column, for write().
+    struct Column {
+        ustring name;
+        TypeDesc type;
+        const void* data;  ///< npoints values of type; strings as ustring
+    };
+
+    /// Map an existing ".oslpc" file.  Return nullptr, and set errmessage,
+    /// if it can't be mapped or isn't a valid point cloud.
+    static std::unique_ptr<MappedPointCloud> open(string_view filename,
+                                                  std::string& errmessage);
+
+    /// Build the KD-tree over positions and write it, along with a
+    /// "position" column and the given columns, as an ".oslpc" file.
+    static bool write(string_view filename, size_t npoints,
+                      const Vec3* positions, const std::vector<Column>& columns,
+                      std::string& errmessage);
+
+    ~MappedPointCloud();
+
+    size_t size() const { return m_kdtree.size(); }
+
+    /// Search structure, reading straight from the mapped file.
+    const PointCloudKDTree& kdtree() const { return m_kdtree; }
+
+    /// Type of one value of the named attribute, or TypeUnknown if the
+    /// cloud has no such attribute.
+    TypeDesc attribute_type(ustringhash name) const;
+
+    /// Copy the values of the named attribute for count points into out,
+    /// one after another (strings as ustring).  Return false if the cloud
+    /// has no such attribute.
+    bool get_data(ustringhash name, const size_t* indices, int count,
+                  void* out) const;
+
+private:
+    MappedPointCloud() = default;
+
+    struct Attribute {
+        TypeDesc type;
+        const char* data;
+    };
+
+    void* m_map       = nullptr;
+    size_t m_map_size = 0;
+    PointCloudKDTree m_kdtree;
+    std::unordered_map<ustringhash, Attribute> m_attributes;
+    std::vector<ustring> m_strings;  ///< Values of the string attributes
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
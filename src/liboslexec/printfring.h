@@ -0,0 +1,78 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+/// The messages one ShadingContext hands over to the background thread
+/// that prints them (see the "printf_async" option).  The context is the
+/// only producer and that thread the only consumer, so pushing and
+/// draining take no lock: each side writes only its own index.  When the
+/// ring is full a message is dropped and counted, rather than making the
+/// shading thread wait.
+class PrintfRing {
+public:
+    explicit PrintfRing(size_t capacity) : m_slots(capacity) {}
+
+    /// Add a message (producer only), or return false if the ring is full.
+    bool push(ErrorHandler::ErrCode code, std::string&& text)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) >= m_slots.size()) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Slot& slot = m_slots[head % m_slots.size()];
+        slot.code  = code;
+        slot.text  = std::move(text);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Call f(code, text) for each message pushed so far, in the order
+    /// they were pushed (consumer only), and return how many there were.
+    template<typename F> size_t drain(F&& f)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        for (size_t i = tail; i != head; ++i) {
+            Slot& slot = m_slots[i % m_slots.size()];
+            f(slot.code, slot.text);
+            slot.text.clear();
+        }
+        m_tail.store(head, std::memory_order_release);
+        return head - tail;
+    }
+
+    /// The context is done with the ring and will push no more.
+    void close() { m_closed.store(true, std::memory_order_release); }
+    bool closed() const { return m_closed.load(std::memory_order_acquire); }
+
+    /// Messages dropped since the last call
+    uint64_t take_dropped() { return m_dropped.exchange(0); }
+
+private:
+    struct Slot {
+        ErrorHandler::ErrCode code;
+        std::string text;
+    };
+    std::vector<Slot> m_slots;
+    // Each index on its own cache line, as the two sides write one each
+    alignas(64) std::atomic<size_t> m_head { 0 };  ///< Next slot to push
+    alignas(64) std::atomic<size_t> m_tail { 0 };  ///< Next slot to drain
+    std::atomic<uint64_t> m_dropped { 0 };
+    std::atomic<bool> m_closed { false };
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
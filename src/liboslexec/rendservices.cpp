@@ -146,6 +146,31 @@ RendererServices::get_array_attribute(ShaderGlobals* sg, bool derivatives,
 
 
 
+void
+RendererServices::get_attributes(ShaderGlobals* sg,
+                                 span<AttributeRequest> requests)
+{
+    for (AttributeRequest& r : requests) {
+        if (r.index >= 0)
+            r.ok = get_array_attribute(sg, r.derivatives, r.object, r.type,
+                                       r.name, r.index, r.val);
+        else
+            r.ok = get_attribute(sg, r.derivatives, r.object, r.type, r.name,
+                                 r.val);
+    }
+}
+
+
+
+bool
+RendererServices::attribute_is_cacheable(ustringhash object, TypeDesc type,
+                                         ustringhash name)
+{
+    return false;
+}
+
+
+
 bool
 RendererServices::get_userdata(bool derivatives, ustringhash name,
                                TypeDesc type, ShaderGlobals* sg, void* val)
@@ -156,6 +181,14 @@ RendererServices::get_userdata(bool derivatives, ustringhash name,
 
 
 
+void
+RendererServices::bind_userdata(ShaderGroup* group, cspan<ustring> names,
+                                cspan<TypeDesc> types, cspan<char> derivs)
+{
+}
+
+
+
 RendererServices::TextureHandle*
 RendererServices::get_texture_handle(ustringhash filename,
                                      ShadingContext* context,
@@ -188,6 +221,30 @@ RendererServices::is_udim(TextureHandle* texture_handle)
 
 
 
+RendererServices::TextureHandle*
+RendererServices::resolve_udim(TextureHandle* texture_handle,
+                               TexturePerthread* texture_thread_info, float s,
+                               float t)
+{
+#if OIIO_VERSION >= 20307
+    return texturesys()->resolve_udim(texture_handle, texture_thread_info, s,
+                                      t);
+#else
+    return nullptr;
+#endif
+}
+
+
+
+void
+RendererServices::defer_shade(ShaderGlobals* sg)
+{
+    if (sg && sg->context)
+        sg->context->defer_shade();
+}
+
+
+
 bool
 RendererServices::texture(ustringhash filename, TextureHandle* texture_handle,
                           TexturePerthread* texture_thread_info,
@@ -421,4 +478,11 @@ RendererServices::batched(WidthOf<8>)
     return nullptr;
 }
 
+BatchedRendererServices<4>*
+RendererServices::batched(WidthOf<4>)
+{
+    // No default implementation for batched services
+    return nullptr;
+}
+
 OSL_NAMESPACE_EXIT
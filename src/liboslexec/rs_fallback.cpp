@@ -74,3 +74,21 @@ rs_transform_points(OSL::ShaderGlobals* sg, OSL::StringParam from,
     return sg->renderer->transform_points(sg, from, to, time, Pin, Pout,
                                           npoints, vectype);
 }
+
+OSL_RSOP bool
+rs_get_attribute(OSL::ShaderGlobals* sg, bool derivatives,
+                 OSL::StringParam object, OSL::TypeDesc type,
+                 OSL::StringParam name, void* val)
+{
+    return sg->renderer->get_attribute(sg, derivatives, object, type, name,
+                                       val);
+}
+
+OSL_RSOP bool
+rs_get_array_attribute(OSL::ShaderGlobals* sg, bool derivatives,
+                       OSL::StringParam object, OSL::TypeDesc type,
+                       OSL::StringParam name, int index, void* val)
+{
+    return sg->renderer->get_array_attribute(sg, derivatives, object, type,
+                                             name, index, val);
+}
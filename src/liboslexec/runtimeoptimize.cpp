@@ -4,8 +4,10 @@
 
 #include <cmath>
 #include <cstdio>
+#include <limits>
 #include <vector>
 
+#include <OpenImageIO/parallel.h>
 #include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/thread.h>
 #include <OpenImageIO/timer.h>
@@ -24,6 +26,12 @@ static ustring u_exit("exit");
 static ustring u_assign("assign");
 static ustring u_add("add");
 static ustring u_sub("sub");
+static ustring u_eq("eq");
+static ustring u_neq("neq");
+static ustring u_lt("lt");
+static ustring u_le("le");
+static ustring u_gt("gt");
+static ustring u_ge("ge");
 static ustring u_mul("mul");
 static ustring u_if("if");
 static ustring u_for("for");
@@ -35,14 +43,21 @@ static ustring u_break("break");
 static ustring u_continue("continue");
 static ustring u_return("return");
 static ustring u_useparam("useparam");
+static ustring u_end("end");
 static ustring u_closure("closure");
 static ustring u_pointcloud_write("pointcloud_write");
 static ustring u_isconnected("isconnected");
 static ustring u_setmessage("setmessage");
+static ustring u_texture("texture");
+static ustring u_texture3d("texture3d");
+static ustring u_environment("environment");
 static ustring u_getmessage("getmessage");
 static ustring u_getattribute("getattribute");
+static ustring u_trace("trace");
 static ustring u_backfacing("backfacing");
 static ustring u_N("N");
+static ustring u_getmatrix("getmatrix");
+static ustring u_matrix("matrix");
 static ustring u_I("I");
 
 
@@ -101,9 +116,12 @@ RuntimeOptimizer::RuntimeOptimizer(ShadingSystemImpl& shadingsys,
     , m_opt_assign(shadingsys.m_opt_assign)
     , m_opt_mix(shadingsys.m_opt_mix)
     , m_opt_middleman(shadingsys.m_opt_middleman)
+    , m_opt_texture_reuse(shadingsys.m_opt_texture_reuse)
+    , m_opt_unroll_loops(shadingsys.m_opt_unroll_loops)
     , m_opt_batched_analysis(shadingsys.m_opt_batched_analysis)
     , m_keep_no_return_function_calls(shadingsys.m_llvm_debugging_symbols)
     , m_pass(0)
+    , m_unrolled_ops(0)
     , m_next_newconst(0)
     , m_next_newtemp(0)
     , m_stat_opt_locking_time(0)
@@ -204,6 +222,7 @@ RuntimeOptimizer::set_debug()
             m_opt_assign                    = true;
             m_opt_mix                       = true;
             m_opt_middleman                 = true;
+            m_opt_texture_reuse             = true;
         }
     }
 }
@@ -271,36 +290,24 @@ RuntimeOptimizer::add_constant(const TypeSpec& type, const void* data,
         size_t datan = datatype.aggregate * datatype.numelements();
         if (t.basetype == TypeDesc::INT && datatype.basetype == TypeDesc::INT
             && n == datan) {
-            newdata = inst()->shadingsys().alloc_int_constants(n);
-            memcpy(newdata, data, t.size());
+            newdata = group().int_constants((const int*)data, n);
         } else if (t.basetype == TypeDesc::FLOAT
-                   && datatype.basetype == TypeDesc::FLOAT) {
-            newdata = inst()->shadingsys().alloc_float_constants(n);
-            if (n == datan)
-                for (size_t i = 0; i < n; ++i)
-                    ((float*)newdata)[i] = ((const float*)data)[i];
-            else if (datan == 1)
-                for (size_t i = 0; i < n; ++i)
-                    ((float*)newdata)[i] = ((const float*)data)[0];
-            else {
+                   && (datatype.basetype == TypeDesc::FLOAT
+                       || datatype.basetype == TypeDesc::INT)) {
+            std::vector<float> converted(n);
+            if (n != datan && datan != 1) {
                 OSL_ASSERT(0 && "unsupported type for add_constant");
-            }
-        } else if (t.basetype == TypeDesc::FLOAT
-                   && datatype.basetype == TypeDesc::INT) {
-            newdata = inst()->shadingsys().alloc_float_constants(n);
-            if (n == datan)
+            } else if (datatype.basetype == TypeDesc::FLOAT) {
                 for (size_t i = 0; i < n; ++i)
-                    ((float*)newdata)[i] = ((const int*)data)[i];
-            else if (datan == 1)
+                    converted[i] = ((const float*)data)[n == datan ? i : 0];
+            } else {
                 for (size_t i = 0; i < n; ++i)
-                    ((float*)newdata)[i] = ((const int*)data)[0];
-            else {
-                OSL_ASSERT(0 && "unsupported type for add_constant");
+                    converted[i] = ((const int*)data)[n == datan ? i : 0];
             }
+            newdata = group().float_constants(converted.data(), n);
         } else if (t.basetype == TypeDesc::STRING
                    && datatype.basetype == TypeDesc::STRING && n == datan) {
-            newdata = inst()->shadingsys().alloc_string_constants(n);
-            memcpy(newdata, data, t.size());
+            newdata = group().string_constants((const ustring*)data, n);
         } else {
             OSL_ASSERT(0 && "unsupported type for add_constant");
         }
@@ -902,6 +909,7 @@ RuntimeOptimizer::simplify_params()
             global_alias(i, cind);  // Alias this symbol to the new const
             turn_into_nop(s->initbegin(), s->initend(),
                           "instance value doesn't need init ops");
+            inst()->param_folded(i);
         } else if (s->valuesource() == Symbol::DefaultVal
                    && !s->has_init_ops()) {
             // Plain default value without init ops -- turn it into a constant
@@ -1922,6 +1930,447 @@ RuntimeOptimizer::catalog_symbol_writes(int opbegin, int opend,
 
 
 
+// Do two ops read the same value for arg i? Either the very same symbol,
+// or constants that are equal.
+static bool
+same_texture_arg(ShaderInstance* inst, const Opcode& a, const Opcode& b, int i)
+{
+    const Symbol* A = inst->argsymbol(a.firstarg() + i);
+    const Symbol* B = inst->argsymbol(b.firstarg() + i);
+    if (A == B)
+        return true;
+    return A->is_constant() && B->is_constant()
+           && A->typespec() == B->typespec()
+           && !memcmp(A->data(), B->data(), A->size());
+}
+
+
+
+/// Find texture lookups that repeat an earlier one in the same basic
+/// block -- same file, coordinates, derivatives and options, none of them
+/// changed in between -- and turn them into copies of the earlier result.
+int
+RuntimeOptimizer::share_texture_lookups()
+{
+    // Ops may have been inserted since the pass started
+    find_basic_blocks();
+    int changed = 0;
+    for (int opnum = 0, e = (int)inst()->ops().size(); opnum < e; ++opnum) {
+        Opcode& op(inst()->ops()[opnum]);
+        if (op.opname() != u_texture && op.opname() != u_texture3d
+            && op.opname() != u_environment)
+            continue;
+        // Only lookups whose sole output is the result, which none of the
+        // inputs alias, can stand in for a later one.
+        bool shareable = true;
+        for (int i = 1; i < op.nargs(); ++i)
+            if (op.argwrite(i) || oparg(op, i) == oparg(op, 0))
+                shareable = false;
+        if (!shareable)
+            continue;
+        for (int op2num = next_block_instruction(opnum); op2num;
+             op2num = next_block_instruction(op2num)) {
+            Opcode& op2(inst()->ops()[op2num]);
+            bool same = op2.opname() == op.opname()
+                        && op2.nargs() == op.nargs()
+                        && opargsym(op2, 0)->typespec()
+                               == opargsym(op, 0)->typespec();
+            for (int i = 1; same && i < op.nargs(); ++i)
+                same = !op2.argwrite(i)
+                       && same_texture_arg(inst(), op, op2, i);
+            if (same) {
+                if (oparg(op2, 0) == oparg(op, 0))
+                    turn_into_nop(op2, "repeats an earlier texture lookup");
+                else
+                    turn_into_assign(op2, oparg(op, 0),
+                                     "repeats an earlier texture lookup");
+                ++changed;
+            }
+            // Stop looking once anything op read or wrote is changed.
+            bool clobbered = false;
+            for (int a = 0; a < op2.nargs() && !clobbered; ++a)
+                if (op2.argwrite(a))
+                    for (int i = 0; i < op.nargs() && !clobbered; ++i)
+                        clobbered = oparg(op2, a) == oparg(op, i);
+            if (clobbered)
+                break;
+        }
+    }
+    return changed;
+}
+
+
+
+/// Turn the closure ops making closures that the renderer said it never
+/// reads for the raytypes we know are on (ShadingSystem::
+/// set_raytype_closures), or all of them in an output variant that
+/// doesn't want Ci, into assignments of an empty closure, leaving
+/// whatever only fed them -- weights, textures -- to be removed as dead.
+int
+RuntimeOptimizer::prune_unread_closures()
+{
+    bool all = group().closures_unused();
+    if (!all && (shadingsys().m_raytype_closures.empty() || !raytypes_on()))
+        return 0;
+    int changed = 0;
+    for (auto& op : inst()->ops()) {
+        if (op.opname() != u_closure)
+            continue;
+        // It's either 'closure result weight name' or 'closure result name'
+        Symbol* sym = opargsym(op, 1);
+        if (sym && !sym->typespec().is_string())
+            sym = opargsym(op, 2);
+        if (!sym || !sym->is_constant())
+            continue;
+        const ClosureRegistry::ClosureEntry* clentry
+            = shadingsys().find_closure(sym->get_string());
+        if (!all
+            && (!clentry
+                || !shadingsys().closure_unread(raytypes_on(), clentry->id)))
+            continue;
+        const char* why = all ? "closures unused by the output variant"
+                              : "closure unread by the raytype";
+        turn_into_assign(op, add_constant(0),
+                         debug() > 1 ? fmtformat("closure {}: {}",
+                                                 sym->get_string(), why)
+                                           .c_str()
+                                     : why);
+        ++changed;
+    }
+    return changed;
+}
+
+
+
+// Ops with no side effects whose result depends on their inputs alone,
+// worth not computing twice.
+static bool
+pure_expensive_op(ustring opname)
+{
+    static const ustring ops[]
+        = { ustring("transform"), ustring("transformv"),
+            ustring("transformn"), ustring("noise"),
+            ustring("snoise"),     ustring("pnoise"),
+            ustring("psnoise"),    ustring("cellnoise"),
+            ustring("hashnoise"),  u_texture,
+            u_texture3d,           u_environment };
+    for (ustring o : ops)
+        if (o == opname)
+            return true;
+    return false;
+}
+
+
+
+// Is op opnum of code run whenever the layer is, not skipped by control
+// flow or by an earlier exit?
+static bool
+runs_unconditionally(const OpcodeVec& code, int begin, int opnum)
+{
+    for (int i = begin; i < opnum; ++i)
+        if ((code[i].jump(0) >= 0 && code[i].farthest_jump() > opnum)
+            || code[i].opname() == u_exit || code[i].opname() == u_return)
+            return false;
+    return true;
+}
+
+
+
+// The index of the only op of inst's main code that writes sym, or -1.
+static int
+sole_writer(ShaderInstance* inst, int sym)
+{
+    int writer = -1;
+    for (int i = inst->maincodebegin(); i < inst->maincodeend(); ++i) {
+        const Opcode& op(inst->ops()[i]);
+        for (int a = 0; a < op.nargs(); ++a) {
+            if (op.argwrite(a) && inst->arg(op.firstarg() + a) == sym) {
+                if (writer >= 0 && writer != i)
+                    return -1;
+                writer = i;
+            }
+        }
+    }
+    return writer;
+}
+
+
+
+int
+RuntimeOptimizer::share_upstream_results()
+{
+    // Is a global of this name written by any layer?
+    auto global_written = [&](ustring name) {
+        for (int lay = 0; lay < group().nlayers(); ++lay)
+            for (auto&& s : group()[lay]->symbols())
+                if (s.symtype() == SymTypeGlobal && s.name() == name
+                    && s.everwritten())
+                    return true;
+        return false;
+    };
+    // Are these the same value wherever in the group they're read?
+    auto same_value = [&](const Symbol* a, const Symbol* b) {
+        if (a->is_constant() && b->is_constant())
+            return a->typespec() == b->typespec()
+                   && !memcmp(a->data(), b->data(), a->size());
+        return a->symtype() == SymTypeGlobal && b->symtype() == SymTypeGlobal
+               && a->name() == b->name() && !global_written(a->name());
+    };
+
+    int changed = 0;
+    for (auto&& c : inst()->connections()) {
+        ShaderInstance* up = group()[c.srclayer];
+        Symbol* in         = inst()->symbol(c.dst.param);
+        if (!c.is_complete() || up->unused() || in->everwritten())
+            continue;
+
+        // Find the op computing the upstream output, if it's always
+        // computed -- directly, or into a temp the output is copied from.
+        int w = sole_writer(up, c.src.param);
+        if (w < 0 || !runs_unconditionally(up->ops(), up->maincodebegin(), w))
+            continue;
+        const Opcode* def = &up->ops()[w];
+        if (def->opname() == u_assign) {
+            int src = up->arg(def->firstarg() + 1);
+            int d   = sole_writer(up, src);
+            if (d < 0 || d > w
+                || !runs_unconditionally(up->ops(), up->maincodebegin(), d))
+                continue;
+            def = &up->ops()[d];
+        }
+        if (!pure_expensive_op(def->opname()))
+            continue;
+        bool inputs_ok = true;
+        for (int a = 1; a < def->nargs() && inputs_ok; ++a) {
+            const Symbol* s = up->argsymbol(def->firstarg() + a);
+            inputs_ok       = !def->argwrite(a)
+                        && (s->is_constant() || s->symtype() == SymTypeGlobal);
+        }
+        const Symbol* result = up->argsymbol(def->firstarg());
+        if (!inputs_ok || !equivalent(result->typespec(), in->typespec()))
+            continue;
+
+        // Our ops recomputing just that can copy the param instead.
+        for (int opnum = inst()->maincodebegin();
+             opnum < inst()->maincodeend(); ++opnum) {
+            Opcode& op(inst()->ops()[opnum]);
+            if (op.opname() != def->opname() || op.nargs() != def->nargs()
+                || !equivalent(opargsym(op, 0)->typespec(), in->typespec()))
+                continue;
+            bool same = true;
+            for (int a = 1; a < op.nargs() && same; ++a)
+                same = !op.argwrite(a)
+                       && same_value(opargsym(op, a),
+                                     up->argsymbol(def->firstarg() + a));
+            if (!same)
+                continue;
+            turn_into_assign(op, c.dst.param,
+                             "recomputes a connected upstream result");
+            ++changed;
+        }
+    }
+    return changed;
+}
+
+
+
+int
+RuntimeOptimizer::unroll_loops()
+{
+    int changed = 0;
+    // Unrolling a loop copies any loops nested in it, which the scan
+    // then reaches and unrolls in turn.
+    for (int opnum = inst()->maincodebegin();
+         opnum < (int)inst()->ops().size(); ++opnum)
+        if (inst()->ops()[opnum].opname() == u_for && unroll_loop(opnum))
+            ++changed;
+    return changed;
+}
+
+
+
+/// The number of trips of the "for" loop at opnum, if its condition
+/// compares an int index to a constant, the index starts at a constant
+/// and only its step changes it, by a constant; or -1 if it can't be
+/// known or is more than maxtrips.  Control leaving the loop early makes
+/// it no more than a bound.
+int
+RuntimeOptimizer::loop_trips(int opnum, int maxtrips)
+{
+    OpcodeVec& code(inst()->ops());
+    const Opcode& forop(code[opnum]);
+    int condbegin = forop.jump(0), bodybegin = forop.jump(1);
+    int stepbegin = forop.jump(2), end = forop.jump(3);
+    Symbol* cond = opargsym(forop, 0);
+
+    // The condition must be a single comparison of the index with a
+    // constant.
+    int condop = -1;
+    for (int i = condbegin; i < bodybegin; ++i) {
+        if (code[i].opname() == u_nop)
+            continue;
+        if (condop >= 0)
+            return -1;
+        condop = i;
+    }
+    if (condop < 0 || code[condop].nargs() != 3
+        || opargsym(code[condop], 0) != cond)
+        return -1;
+    ustring cmp = code[condop].opname();
+    if (cmp != u_lt && cmp != u_le && cmp != u_gt && cmp != u_ge
+        && cmp != u_eq && cmp != u_neq)
+        return -1;
+    Symbol* A           = opargsym(code[condop], 1);
+    Symbol* B           = opargsym(code[condop], 2);
+    bool index_first    = B->is_constant();
+    Symbol* index       = index_first ? A : B;
+    const Symbol* bound = index_first ? B : A;
+    if (index->is_constant() || !bound->is_constant()
+        || !index->typespec().is_int() || !bound->typespec().is_int())
+        return -1;
+
+    // The index must be set to a constant by the init code and changed by
+    // nothing but a constant add or sub in the step.
+    bool have_start = false, have_step = false;
+    int start = 0, step = 0;
+    for (int i = opnum + 1; i < end; ++i) {
+        const Opcode& op(code[i]);
+        for (int a = 0; a < op.nargs(); ++a) {
+            if (opargsym(op, a) != index || !op.argwrite(a))
+                continue;
+            if (i < condbegin && !have_start && op.opname() == u_assign
+                && opargsym(op, 1)->is_constant()
+                && opargsym(op, 1)->typespec().is_int()) {
+                start      = opargsym(op, 1)->get_int();
+                have_start = true;
+            } else if (i >= stepbegin && !have_step
+                       && (op.opname() == u_add || op.opname() == u_sub)
+                       && opargsym(op, 1) == index
+                       && opargsym(op, 2)->is_constant()
+                       && opargsym(op, 2)->typespec().is_int()) {
+                step      = opargsym(op, 2)->get_int();
+                step      = op.opname() == u_add ? step : -step;
+                have_step = true;
+            } else {
+                return -1;
+            }
+        }
+    }
+    if (!have_start || !have_step)
+        return -1;
+
+    // Count the trips
+    int limit = bound->get_int();
+    auto test = [&](int v) {
+        int a = index_first ? v : limit, b = index_first ? limit : v;
+        return cmp == u_lt   ? a < b
+               : cmp == u_le ? a <= b
+               : cmp == u_gt ? a > b
+               : cmp == u_ge ? a >= b
+               : cmp == u_eq ? a == b
+                             : a != b;
+    };
+    int trips = 0;
+    for (int v = start; test(v); v += step)
+        if (++trips > maxtrips)
+            return -1;
+    return trips;
+}
+
+
+
+/// Fully unroll the "for" loop at opnum, if loop_trips knows its trip
+/// count and control never leaves the body but by running off its end.
+/// The loop op becomes a nop, its init code stays, and its condition,
+/// body and step are replaced by one copy of body and step per trip.
+bool
+RuntimeOptimizer::unroll_loop(int opnum)
+{
+    // Bounds on the code that unrolling may add: per loop, and to the
+    // layer in all.
+    const int max_loop_ops  = 256;
+    const int max_layer_ops = 4096;
+
+    OpcodeVec& code(inst()->ops());
+    const Opcode& forop(code[opnum]);
+    int condbegin = forop.jump(0), bodybegin = forop.jump(1);
+    int end = forop.jump(3);
+
+    // A break or continue must belong to a loop nested in the body, and a
+    // return to a function call inlined there.
+    for (int i = bodybegin; i < end; ++i) {
+        ustring name = code[i].opname();
+        if (name == u_exit)
+            return false;
+        if (name != u_break && name != u_continue && name != u_return)
+            continue;
+        bool enclosed = false;
+        for (int j = bodybegin; j < i && !enclosed; ++j) {
+            ustring outer = code[j].opname();
+            bool owner    = name == u_return ? (outer == u_functioncall
+                                             || outer == u_functioncall_nr)
+                                             : (outer == u_for
+                                             || outer == u_while
+                                             || outer == u_dowhile);
+            enclosed      = owner && code[j].farthest_jump() > i;
+        }
+        if (!enclosed)
+            return false;
+    }
+
+    int trips = loop_trips(opnum, m_opt_unroll_loops);
+    if (trips < 0)
+        return false;
+    int len    = end - bodybegin;
+    int newlen = trips * len;
+    if (newlen > max_loop_ops || m_unrolled_ops + newlen > max_layer_ops)
+        return false;
+    m_unrolled_ops += newlen;
+
+    // Each copy gets args of its own, since later rewrites of an op
+    // change its args in place, and jumps into its own range.
+    std::vector<int>& opargs(inst()->args());
+    OpcodeVec unrolled;
+    unrolled.reserve(newlen);
+    for (int k = 0; k < trips; ++k) {
+        int base = condbegin + k * len;
+        for (int i = bodybegin; i < end; ++i) {
+            Opcode op(code[i]);
+            int firstarg = (int)opargs.size();
+            for (int a = 0; a < op.nargs(); ++a) {
+                int arg = opargs[op.firstarg() + a];
+                opargs.push_back(arg);
+            }
+            op.set_args(firstarg, op.nargs());
+            for (int j = 0; j < (int)Opcode::max_jumps && op.jump(j) >= 0; ++j)
+                op.jump(j) = base + op.jump(j) - bodybegin;
+            unrolled.push_back(op);
+        }
+    }
+    turn_into_nop(code[opnum], debug() > 1
+                                   ? fmtformat("unroll loop of {} trips",
+                                               trips)
+                                         .c_str()
+                                   : "unroll loop");
+    code.erase(code.begin() + condbegin, code.begin() + end);
+    code.insert(code.begin() + condbegin, unrolled.begin(), unrolled.end());
+
+    // Everything that jumped past the loop now jumps past the copies.
+    int delta = newlen - (end - condbegin);
+    for (int i = 0, e = (int)code.size(); i < e; ++i) {
+        if (i >= condbegin && i < condbegin + newlen)
+            continue;
+        Opcode& op(code[i]);
+        for (int j = 0; j < (int)Opcode::max_jumps && op.jump(j) >= 0; ++j)
+            if (op.jump(j) > condbegin)
+                op.jump(j) += delta;
+    }
+    inst()->m_maincodeend += delta;
+    return true;
+}
+
+
+
 /// Find situations where an output is simply a copy of a connected
 /// input, and eliminate the middleman.
 int
@@ -2372,6 +2821,7 @@ RuntimeOptimizer::optimize_instance()
     // end up inadvertently transforming A => B => A => etc.
     int reallydone = 0;  // Force a few passes after we think we're done
     int npasses    = shadingsys().opt_passes();
+    m_unrolled_ops = 0;
     for (m_pass = 0; m_pass < npasses; ++m_pass) {
         // Once we've made one pass (and therefore called
         // mark_outgoing_connections), we may notice that the layer is
@@ -2386,9 +2836,17 @@ RuntimeOptimizer::optimize_instance()
             debug_optfmt("layer {} \"{}\", pass {}:\n", layer(),
                          inst()->layername(), m_pass);
 
+        // Loops whose bounds have folded to constants are unrolled before
+        // the blocks are found, so the copies fold like any other code.
+        int unrolled = 0;
+        if (optimize() >= 2 && m_opt_unroll_loops > 0)
+            unrolled = unroll_loops();
+
         // Track basic blocks and conditional states
         find_conditionals();
         find_basic_blocks();
+        if (unrolled)
+            track_variable_lifetimes();
 
         // Clear local messages for this instance
         m_local_unknown_message_sent = false;
@@ -2399,9 +2857,13 @@ RuntimeOptimizer::optimize_instance()
         if (m_pass == 0 && optimize() >= 2)
             find_params_holding_globals();
 
+        // Closures the renderer won't read need not be built at all.
+        if (m_pass == 0 && optimize() >= 1 && prune_unread_closures())
+            track_variable_lifetimes();
+
         // Here is the meat of the optimization, where we pass over the
         // code for this instance and make various transformations.
-        int changed = optimize_ops(0, (int)inst()->ops().size());
+        int changed = unrolled + optimize_ops(0, (int)inst()->ops().size());
 
         // Now that we've rewritten the code, we need to re-track the
         // variable lifetimes.
@@ -2419,6 +2881,10 @@ RuntimeOptimizer::optimize_instance()
             changed += c;
         }
 
+        // Reuse the results of repeated texture lookups.
+        if (optimize() >= 2 && m_opt_texture_reuse)
+            changed += share_texture_lookups();
+
         // Elide unconnected parameters that are never read.
         if (optimize() >= 1)
             changed += remove_unused_params();
@@ -2635,6 +3101,10 @@ RuntimeOptimizer::track_variable_dependencies()
 
     std::vector<int> read, written;
     bool forcederivs = shadingsys().force_derivs();
+    // The renderer may have said that the raytypes we know are on need
+    // no derivatives, in which case no op's wish for them counts.
+    bool noderivs = !forcederivs && raytypes_on()
+                    && shadingsys().raytype_noderivs(raytypes_on());
     // Loop over all ops...
     for (auto&& op : inst()->ops()) {
         // Gather the list of syms read and written by the op.  Reuse the
@@ -2655,7 +3125,7 @@ RuntimeOptimizer::track_variable_dependencies()
                     add_dependency(symdeps, w, r);
             // If the op takes derivs, make the pseudo-symbol DerivSym
             // depend on those arguments.
-            if (op.argtakesderivs_all() || forcederivs) {
+            if ((op.argtakesderivs_all() && !noderivs) || forcederivs) {
                 for (int a = 0; a < op.nargs(); ++a)
                     if (op.argtakesderivs(a) || forcederivs) {
                         Symbol& s(*opargsym(op, a));
@@ -3112,6 +3582,46 @@ RuntimeOptimizer::printinst(std::ostream& out) const
 
 
 
+void
+RuntimeOptimizer::for_each_layer(
+    const std::function<void(RuntimeOptimizer&)>& func)
+{
+    int nlayers   = (int)group().nlayers();
+    int minlayers = shadingsys().m_opt_parallel_layers;
+    bool debugging = shadingsys().debug()
+                     || !shadingsys().debug_groupname().empty()
+                     || !shadingsys().debug_layername().empty();
+    if (minlayers <= 0 || nlayers < minlayers || debugging) {
+        for (int layer = 0; layer < nlayers; ++layer) {
+            set_inst(layer);
+            func(*this);
+        }
+        return;
+    }
+
+    // Each layer gets its own optimizer, so the per-instance scratch
+    // state (aliases, basic blocks, etc.) is never shared. New const and
+    // temp names start where ours left off, so they can't collide with
+    // names already added to the instance.
+    spin_mutex counter_mutex;
+    int next_newconst = m_next_newconst;
+    int next_newtemp  = m_next_newtemp;
+    OIIO::parallel_for(0, nlayers, [&](int64_t layer) {
+        RuntimeOptimizer rop(shadingsys(), group(), shadingcontext());
+        rop.m_next_newconst = m_next_newconst;
+        rop.m_next_newtemp  = m_next_newtemp;
+        rop.set_inst(int(layer));
+        func(rop);
+        spin_lock lock(counter_mutex);
+        next_newconst = std::max(next_newconst, rop.m_next_newconst);
+        next_newtemp  = std::max(next_newtemp, rop.m_next_newtemp);
+    });
+    m_next_newconst = next_newconst;
+    m_next_newtemp  = next_newtemp;
+}
+
+
+
 void
 RuntimeOptimizer::run()
 {
@@ -3125,12 +3635,13 @@ RuntimeOptimizer::run()
         std::cout << "About to optimize shader group " << group().name()
                   << "\n";
 
-    for (int layer = 0; layer < nlayers; ++layer) {
-        set_inst(layer);
-        // These need to happen before merge_instances
-        inst()->copy_code_from_master(group());
-        mark_outgoing_connections();
-    }
+    // These need to happen before merge_instances. Marking outgoing
+    // connections only reads the (not yet altered) downstream connection
+    // lists, so the layers are independent here.
+    for_each_layer([&](RuntimeOptimizer& rop) {
+        rop.inst()->copy_code_from_master(group());
+        rop.mark_outgoing_connections();
+    });
 
     // Inventory the network and print pre-optimized debug info
     size_t old_nsyms = 0, old_nops = 0;
@@ -3162,6 +3673,7 @@ RuntimeOptimizer::run()
     // Inventory for error calls so that if lazyerror=0 we don't incorrectly
     // assume the layer is unused.
     check_for_error_calls(false);
+    double prepare_time = rop_timer.lap();
 
     // Optimize each layer, from first to last
     for (int layer = 0; layer < nlayers; ++layer) {
@@ -3176,6 +3688,18 @@ RuntimeOptimizer::run()
     }
     check_for_error_calls(false);  // re-check
 
+    // With every layer simplified once, look for values they recompute
+    // that an upstream layer already connects to them; the pass below
+    // removes whatever fed only the recomputation.
+    if (optimize() >= 2) {
+        for (int layer = 0; layer < nlayers; ++layer) {
+            set_inst(layer);
+            if (!inst()->unused() && share_upstream_results())
+                track_variable_lifetimes();
+        }
+    }
+    double forward_time = rop_timer.lap();
+
     // Optimize each layer again, from last to first (because some
     // optimizations are only apparent when the subsequent shaders have
     // been simplified).
@@ -3187,6 +3711,7 @@ RuntimeOptimizer::run()
 
     // Try merging instances again, now that we've optimized
     shadingsys().merge_instances(group(), true);
+    double backward_time = rop_timer.lap();
 
     for (int layer = nlayers - 1; layer >= 0; --layer) {
         set_inst(layer);
@@ -3206,10 +3731,17 @@ RuntimeOptimizer::run()
         }
     }
 
-    // Post-opt cleanup: add useparam, coalesce temporaries, etc.
-    for (int layer = 0; layer < nlayers; ++layer) {
-        set_inst(layer);
-        post_optimize_instance();
+    // Post-opt cleanup: add useparam, coalesce temporaries, etc.  Every
+    // layer is independent here, except that batched analysis propagates
+    // uniformity from upstream layers and so must go in layer order.
+    if (m_opt_batched_analysis) {
+        for (int layer = 0; layer < nlayers; ++layer) {
+            set_inst(layer);
+            post_optimize_instance();
+        }
+    } else {
+        for_each_layer(
+            [&](RuntimeOptimizer& rop) { rop.post_optimize_instance(); });
     }
 
     // Last chance to eliminate duplicate instances
@@ -3217,17 +3749,25 @@ RuntimeOptimizer::run()
 
     // Last inventory of error() calls, issue warnings if needed.
     check_for_error_calls(true);
-
-    // Get rid of nop instructions and unused symbols.
+    double postopt_time = rop_timer.lap();
+
+    // Get rid of nop instructions and unused symbols. A layer only
+    // rewrites its own symbols and ops, plus the src.param of downstream
+    // connections that read from it (which no other layer touches).
+    if (optimize() >= 1) {
+        for_each_layer([&](RuntimeOptimizer& rop) {
+            if (!rop.inst()->unused()) {
+                rop.collapse_syms();
+                rop.collapse_ops();
+            }
+        });
+    }
+    double collapse_time = rop_timer.lap();
     size_t new_nsyms = 0, new_nops = 0, new_deriv_syms = 0;
     for (int layer = 0; layer < nlayers; ++layer) {
         set_inst(layer);
         if (inst()->unused())
             continue;  // no need to print or gather stats for unused layers
-        if (optimize() >= 1) {
-            collapse_syms();
-            collapse_ops();
-        }
         if (debug() && !inst()->unused()) {
             track_variable_lifetimes();
             std::cout << "After optimizing layer " << layer << " \""
@@ -3250,6 +3790,7 @@ RuntimeOptimizer::run()
     m_globals_needed.clear();
     m_userdata_needed.clear();
     m_attributes_needed.clear();
+    m_cacheable       = true;
     bool does_nothing = true;
     for (int layer = 0; layer < nlayers; ++layer) {
         set_inst(layer);
@@ -3283,8 +3824,19 @@ RuntimeOptimizer::run()
                 if (s.everwritten())
                     m_globals_write |= bit;
             }
-            if (s.has_derivs())
+            if (s.has_derivs()) {
                 ++new_deriv_syms;
+                m_cacheable = false;  // Derivs aren't in the cache key
+            }
+            // The renderer finds the unplaced outputs on the heap, which
+            // a result from the cache doesn't fill in
+            if (s.renderer_output()
+                && !group().find_symloc(
+                    ustring::fmtformat("{}.{}", inst()->layername(),
+                                       s.name()),
+                    SymArena::Outputs)
+                && !group().find_symloc(s.name(), SymArena::Outputs))
+                m_cacheable = false;
         }
         for (auto&& op : inst()->ops()) {
             const OpDescriptor* opd = shadingsys().op_descriptor(op.opname());
@@ -3301,6 +3853,8 @@ RuntimeOptimizer::run()
                         does_nothing = false;
                 }
             }
+            if (!op_is_cacheable(op, opd))
+                m_cacheable = false;
             if (opd->flags & OpDescriptor::Tex) {
                 // for all the texture ops, arg 1 is the texture name
                 Symbol* sym = opargsym(op, 1);
@@ -3377,12 +3931,29 @@ RuntimeOptimizer::run()
         }
     }
     group().does_nothing(does_nothing);
+    // Of the globals, only P, u and v are in the cache key (the ray type,
+    // backfacing and objdata always are); reading N, Ng or the tangents,
+    // which vary apart from P, would find another point's results
+    const int cacheable_globals = int(SGBits::P) | int(SGBits::u)
+                                  | int(SGBits::v) | int(SGBits::Ci);
+    if ((m_globals_read & ~cacheable_globals) || m_userdata_needed.size())
+        m_cacheable = false;
+    find_constant_outputs();
+    find_closure_memory_bound();
+    find_cost_estimate();
 
     m_stat_specialization_time = rop_timer();
+    double inventory_time      = rop_timer.lap();
     {
         // adjust memory stats
         ShadingSystemImpl& ss(shadingsys());
         spin_lock lock(ss.m_stat_mutex);
+        ss.m_stat_opt_prepare_time += prepare_time;
+        ss.m_stat_opt_forward_time += forward_time;
+        ss.m_stat_opt_backward_time += backward_time;
+        ss.m_stat_opt_postopt_time += postopt_time;
+        ss.m_stat_opt_collapse_time += collapse_time;
+        ss.m_stat_opt_inventory_time += inventory_time;
         ss.m_stat_preopt_syms += old_nsyms;
         ss.m_stat_preopt_ops += old_nops;
         ss.m_stat_postopt_syms += new_nsyms;
@@ -3405,6 +3976,15 @@ RuntimeOptimizer::run()
     if (shadingsys().m_compile_report > 1) {
         if (does_nothing)
             shadingcontext()->infofmt("Group does nothing");
+        if (m_closure_memory_bound >= 0)
+            shadingcontext()->infofmt("Group allocates at most {} closure "
+                                      "bytes",
+                                      m_closure_memory_bound);
+        else
+            shadingcontext()->infofmt(
+                "Group's closure memory can't be bounded");
+        shadingcontext()->infofmt("Group's estimated cost is {:g}",
+                                  m_cost_estimate);
         if (m_textures_needed.size()) {
             shadingcontext()->infofmt("Group needs textures:");
             for (auto&& f : m_textures_needed)
@@ -3429,6 +4009,528 @@ RuntimeOptimizer::run()
                     "    Also may construct attribute names on the fly.");
         }
     }
+    if (shadingsys().m_compile_report > 2)
+        report_unoptimized();
+}
+
+
+
+void
+RuntimeOptimizer::find_closure_memory_bound()
+{
+    // Each allocation is padded as the context's arena and the GPU
+    // allotters pad it.  The most trips of a loop worth bounding is
+    // arbitrary, as is reporting a larger total as unbounded.
+    const size_t align        = alignof(ClosureComponent);
+    const int max_trips       = 1 << 16;
+    const long long max_bytes = std::numeric_limits<int>::max();
+    auto padded = [=](size_t size) {
+        return (long long)((size + align - 1) / align * align);
+    };
+    m_closure_memory_bound = -1;
+    long long total        = 0;
+    for (int layer = 0, nlayers = group().nlayers(); layer < nlayers;
+         ++layer) {
+        set_inst(layer);
+        if (inst()->unused())
+            continue;
+        const OpcodeVec& code(inst()->ops());
+        // How many times each op may run, from the trips of the loops
+        // around it, or -1 if that's unbounded.  The outer loops come
+        // first and set the counts that the inner ones multiply.
+        std::vector<long long> runs(code.size(), 1);
+        for (int opnum = 0, nops = (int)code.size(); opnum < nops; ++opnum) {
+            const Opcode& op(code[opnum]);
+            ustring opname  = op.opname();
+            long long bytes = 0;
+            if (opname == u_for || opname == u_while || opname == u_dowhile) {
+                int trips = opname == u_for ? loop_trips(opnum, max_trips)
+                                            : -1;
+                // The condition runs once more than the body
+                long long n = trips < 0 || runs[opnum] < 0
+                                  ? -1
+                                  : runs[opnum] * (trips + 1);
+                for (int i = op.jump(0); i < op.jump(3); ++i)
+                    runs[i] = n;
+                continue;
+            }
+            if (opname == u_closure) {
+                // 'closure result weight name ...' or 'closure result name'
+                Symbol* sym = opargsym(op, 1);
+                if (!sym->typespec().is_string())
+                    sym = opargsym(op, 2);
+                const ClosureRegistry::ClosureEntry* clentry
+                    = sym->is_constant()
+                          ? shadingsys().find_closure(sym->get_string())
+                          : nullptr;
+                if (!clentry)
+                    return;
+                bytes = padded(sizeof(ClosureComponent) + clentry->struct_size);
+            } else if (op.nargs() && opargsym(op, 0)->typespec().is_closure()) {
+                if (opname == u_add)
+                    bytes = padded(sizeof(ClosureAdd));
+                else if (opname == u_mul)
+                    bytes = padded(sizeof(ClosureMul));
+            }
+            if (!bytes)
+                continue;
+            if (runs[opnum] < 0)
+                return;
+            total += bytes * runs[opnum];
+            if (total > max_bytes)
+                return;
+        }
+    }
+    m_closure_memory_bound = int(total);
+}
+
+
+
+void
+RuntimeOptimizer::find_cost_estimate()
+{
+    // Rough costs, in nanoseconds on a current CPU, of the kinds of ops
+    // that dominate shading; any other op costs a simple op's 1.  They
+    // only need to rank groups, not to predict their times.  A loop
+    // whose trips aren't known is taken to run guessed_trips times.
+    const float tex_cost = 200.0f, trace_cost = 1000.0f, noise_cost = 25.0f;
+    const float closure_cost = 10.0f, attribute_cost = 20.0f;
+    const int guessed_trips = 8, max_trips = 1 << 16;
+    static const ustring noise_ops[] = { ustring("noise"),
+                                         ustring("snoise"),
+                                         ustring("pnoise"),
+                                         ustring("psnoise"),
+                                         ustring("cellnoise"),
+                                         ustring("hashnoise") };
+    double total = 0.0;
+    for (int layer = 0, nlayers = group().nlayers(); layer < nlayers;
+         ++layer) {
+        set_inst(layer);
+        if (inst()->unused())
+            continue;
+        const OpcodeVec& code(inst()->ops());
+        // How many times each op runs, as in find_closure_memory_bound()
+        std::vector<double> runs(code.size(), 1.0);
+        for (int opnum = 0, nops = (int)code.size(); opnum < nops; ++opnum) {
+            const Opcode& op(code[opnum]);
+            ustring opname = op.opname();
+            if (opname == u_for || opname == u_while || opname == u_dowhile) {
+                int trips = opname == u_for ? loop_trips(opnum, max_trips)
+                                            : -1;
+                if (trips < 0)
+                    trips = guessed_trips;
+                // The condition runs once more than the body
+                double n = runs[opnum] * (trips + 1);
+                for (int i = op.jump(0); i < op.jump(3); ++i)
+                    runs[i] = n;
+                continue;
+            }
+            if (opname == u_nop || opname == u_useparam || opname == u_end)
+                continue;
+            const OpDescriptor* opd = shadingsys().op_descriptor(opname);
+            float cost              = 1.0f;
+            if (opname == u_trace)
+                cost = trace_cost;
+            else if (opd && (opd->flags & OpDescriptor::Tex))
+                cost = tex_cost;
+            else if (std::find(std::begin(noise_ops), std::end(noise_ops),
+                               opname)
+                     != std::end(noise_ops))
+                cost = noise_cost;
+            else if (opname == u_closure)
+                cost = closure_cost;
+            else if (opname == u_getattribute)
+                cost = attribute_cost;
+            total += cost * runs[opnum];
+        }
+    }
+    m_cost_estimate = float(
+        std::min(total, double(std::numeric_limits<float>::max())));
+}
+
+
+
+void
+RuntimeOptimizer::find_constant_outputs()
+{
+    // After optimization, what's left of a constant output is a straight
+    // run of assigns of constants, and of closures with constant params
+    // scaled and summed.  Follow the values through those ops, one layer
+    // at a time; anything else written, or any control flow, and what it
+    // wrote isn't known.
+    auto co = std::make_shared<ConstantOutputs>();
+    co->all = !(m_globals_write & ~int(SGBits::Ci));
+    const ClosureColor* ci = nullptr;
+    bool ci_known          = true;
+    int ci_writers         = 0;
+    for (int layer = 0, nlayers = group().nlayers(); layer < nlayers;
+         ++layer) {
+        set_inst(layer);
+        if (inst()->unused())
+            continue;
+        KnownValues known;
+        auto value = [&](const Symbol* s, const void*& v) {
+            return known_value(known, s, v);
+        };
+
+        bool straight = true;
+        for (int o = inst()->maincodebegin(), e = inst()->maincodeend();
+             o < e; ++o) {
+            const Opcode& op(inst()->ops()[o]);
+            if (op.jump(0) >= 0 || op.opname() == u_exit
+                || op.opname() == u_return)
+                straight = false;
+            const OpDescriptor* opd = shadingsys().op_descriptor(op.opname());
+            if (opd && (opd->flags & OpDescriptor::SideEffects)
+                && op.opname() != u_setmessage)
+                co->all = false;
+        }
+        FOREACH_SYM(Symbol & s, inst())
+        {
+            // Params start at their values, unless computed or connected;
+            // closures start empty
+            bool param = s.symtype() == SymTypeParam
+                         || s.symtype() == SymTypeOutputParam;
+            if (!straight && s.everwritten())
+                continue;
+            if (param && !s.connected() && s.typespec().is_closure())
+                known[&s] = nullptr;
+            else if (param && !s.connected() && !s.has_init_ops()
+                     && s.lockgeom() && !s.interactive()
+                     && !s.typespec().is_closure_based())
+                known[&s] = s.data();
+            else if (s.symtype() == SymTypeGlobal && s.name() == Strings::Ci)
+                known[&s] = nullptr;
+        }
+
+        for (int o = inst()->maincodebegin(), e = inst()->maincodeend();
+             straight && o < e; ++o) {
+            const Opcode& op(inst()->ops()[o]);
+            ustring opname = op.opname();
+            if (opname == u_useparam || opname == Strings::end
+                || opname == u_nop)
+                continue;
+            Symbol* R = op.nargs() ? opargsym(op, 0) : nullptr;
+            const void* result = nullptr;
+            bool ok            = false;
+            if (opname == u_assign) {
+                const Symbol* A = opargsym(op, 1);
+                ok = R->typespec() == A->typespec() && value(A, result);
+            } else if (opname == u_closure) {
+                result = constant_closure(op, *co, known, ok);
+            } else if ((opname == u_mul || opname == u_add)
+                       && R->typespec().is_closure()) {
+                // A closure scaled by a weight, or two closures summed
+                const Symbol* A = opargsym(op, 1);
+                const Symbol* B = opargsym(op, 2);
+                const void *a, *b;
+                ok = value(A, a) && value(B, b);
+                if (ok && opname == u_add && a && b) {
+                    ClosureAdd* add = (ClosureAdd*)co->alloc(
+                        sizeof(ClosureAdd));
+                    add->id       = ClosureColor::ADD;
+                    add->closureA = (const ClosureColor*)a;
+                    add->closureB = (const ClosureColor*)b;
+                    result        = add;
+                } else if (ok && opname == u_add) {
+                    result = a ? a : b;  // Adding an empty closure
+                } else if (ok) {
+                    if (!A->typespec().is_closure()) {
+                        std::swap(A, B);
+                        std::swap(a, b);
+                    }
+                    Color3 w = B->typespec().is_float()
+                                   ? Color3(*(const float*)b)
+                                   : *(const Color3*)b;
+                    if (a && (w.x || w.y || w.z)) {
+                        ClosureMul* mul = (ClosureMul*)co->alloc(
+                            sizeof(ClosureMul));
+                        mul->id      = ClosureColor::MUL;
+                        mul->weight  = w;
+                        mul->closure = (const ClosureColor*)a;
+                        result       = mul;
+                    }
+                }
+            }
+            if (ok) {
+                known[R] = result;
+                continue;
+            }
+            for (int i = 0, n = op.nargs(); i < n; ++i)
+                if (op.argwrite(i))
+                    known.erase(opargsym(op, i));
+        }
+
+        FOREACH_SYM(Symbol & s, inst())
+        {
+            const void* v;
+            if (s.symtype() == SymTypeGlobal && s.name() == Strings::Ci) {
+                if (s.everwritten()) {
+                    ++ci_writers;
+                    ci_known &= value(&s, v);
+                    if (ci_known)
+                        ci = (const ClosureColor*)v;
+                }
+                continue;
+            }
+            if (!s.renderer_output())
+                continue;
+            if (!value(&s, v)) {
+                co->all = false;
+                continue;
+            }
+            co->names.push_back(
+                ustring::fmtformat("{}.{}", inst()->layername(), s.name()));
+            if (s.typespec().is_closure()) {
+                co->types.push_back(TypeDesc::PTR);
+                co->values.push_back(v);
+            } else {
+                // Copied, as the symbols may not outlive the optimizer
+                TypeDesc t = s.typespec().simpletype();
+                void* copy = co->alloc(t.size());
+                memcpy(copy, v, t.size());
+                co->types.push_back(t);
+                co->values.push_back(copy);
+            }
+        }
+    }
+    // Which of several layers writing Ci wrote it last depends on the
+    // order the layers run in
+    if (ci_known && ci_writers <= 1) {
+        co->names.emplace_back(Strings::Ci);
+        co->types.push_back(TypeDesc::PTR);
+        co->values.push_back(ci);
+    } else {
+        co->all = false;
+    }
+    m_constant_outputs = std::move(co);
+}
+
+
+
+bool
+RuntimeOptimizer::known_value(const KnownValues& known, const Symbol* s,
+                              const void*& v)
+{
+    if (s->is_constant() && !s->typespec().is_closure_based()) {
+        v = s->data();
+        return true;
+    }
+    auto found = known.find(s);
+    if (found == known.end())
+        return false;
+    v = found->second;
+    return true;
+}
+
+
+
+const ClosureColor*
+RuntimeOptimizer::constant_closure(const Opcode& op, ConstantOutputs& co,
+                                   const KnownValues& known, bool& ok)
+{
+    ok               = false;
+    int weighted     = opargsym(op, 1)->typespec().is_string() ? 0 : 1;
+    const Symbol* Id = opargsym(op, 1 + weighted);
+    if (!Id->is_constant())
+        return nullptr;
+    const ClosureRegistry::ClosureEntry* clentry = shadingsys().find_closure(
+        Id->get_string());
+    // Keyword params aren't followed
+    if (!clentry || op.nargs() != 2 + weighted + clentry->nformal)
+        return nullptr;
+    Color3 w(1.0f);
+    if (weighted) {
+        const void* v;
+        if (!known_value(known, opargsym(op, 1), v))
+            return nullptr;
+        w = *(const Color3*)v;
+    }
+    std::vector<const void*> args(clentry->nformal);
+    for (int carg = 0; carg < clentry->nformal; ++carg) {
+        const ClosureParam& p = clentry->params[carg];
+        const Symbol* sym     = opargsym(op, carg + 2 + weighted);
+        if (p.key || sym->typespec().is_closure_based()
+            || sym->typespec().is_structure()
+            || !equivalent(sym->typespec().simpletype(), p.type)
+            || !known_value(known, sym, args[carg]))
+            return nullptr;
+    }
+    ok = true;
+    if (!w.x && !w.y && !w.z)
+        return nullptr;  // As osl_allocate_weighted_closure_component
+
+    // Made as the JITed code makes it (see llvm_gen_closure)
+    ClosureComponent* comp = (ClosureComponent*)co.alloc(
+        sizeof(ClosureComponent) + clentry->struct_size);
+    comp->id  = clentry->id;
+    comp->w   = w;
+    char* mem = (char*)comp->data();
+    RendererServices* renderer = shadingsys().renderer();
+    if (clentry->prepare)
+        clentry->prepare(renderer, clentry->id, mem);
+    for (int carg = 0; carg < clentry->nformal; ++carg) {
+        const ClosureParam& p = clentry->params[carg];
+        memcpy(mem + p.offset, args[carg], p.type.size());
+    }
+    if (clentry->setup)
+        clentry->setup(renderer, clentry->id, mem);
+    return comp;
+}
+
+
+
+// Does the op's result depend only on its args, and leave no trace but
+// its results, so that it may be skipped by a result from the shading
+// cache?  Messages set within the group are fine; what the renderer
+// answers (attributes, matrices at the shading time, traces, point
+// clouds) and what shaders print are not.
+bool
+RuntimeOptimizer::op_is_cacheable(const Opcode& op, const OpDescriptor* opd)
+{
+    ustring opname = op.opname();
+    if ((opd->flags & OpDescriptor::SideEffects) && opname != u_setmessage)
+        return false;
+    if (opname == u_getmessage || opname == u_getattribute
+        || opname == u_getmatrix || Strutil::starts_with(opname, "transform")
+        || Strutil::starts_with(opname, "pointcloud"))
+        return false;
+    if (opname == u_matrix)
+        for (int i = 1, e = op.nargs(); i < e; ++i)
+            if (opargsym(op, i)->typespec().is_string())
+                return false;  // A matrix from named spaces
+    return true;
+}
+
+
+
+// A rough relative cost of running an op, just enough to rank what the
+// optimizer left behind: a texture or trace call dwarfs arithmetic.
+static int
+op_cost_estimate(const OpDescriptor* opd, ustring opname)
+{
+    if (opname == u_trace)
+        return 200;
+    if ((opd && (opd->flags & OpDescriptor::Tex))
+        || Strutil::starts_with(opname, "pointcloud"))
+        return 100;
+    if (opname == u_getattribute || opname == u_getmessage
+        || Strutil::ends_with(opname, "noise") || opname == "gabor")
+        return 20;
+    if (opname == u_closure)
+        return 5;
+    return 1;
+}
+
+
+
+void
+RuntimeOptimizer::report_unoptimized()
+{
+    struct Item {
+        long long cost;
+        std::string text;
+    };
+    std::vector<Item> items;
+    int nlayers = group().nlayers();
+
+    // The estimated cost of one run of each layer, which is what a
+    // connection that wasn't folded or a layer that can't be lazy costs.
+    std::vector<long long> layer_cost(nlayers, 0);
+    for (int layer = 0; layer < nlayers; ++layer) {
+        set_inst(layer);
+        if (inst()->unused())
+            continue;
+        for (auto&& op : inst()->ops())
+            layer_cost[layer] += op_cost_estimate(
+                shadingsys().op_descriptor(op.opname()), op.opname());
+    }
+
+    for (int layer = 0; layer < nlayers; ++layer) {
+        set_inst(layer);
+        if (inst()->unused())
+            continue;
+        ustring layername = inst()->layername();
+        if (const char* why = inst()->not_lazy_reason())
+            items.push_back({ layer_cost[layer],
+                              fmtformat("layer {} always runs: {}", layername,
+                                        why) });
+
+        // Connections still standing were not folded into constants
+        for (auto&& con : inst()->connections()) {
+            const ShaderInstance* src = group()[con.srclayer];
+            const Symbol* srcsym      = src->symbol(con.src.param);
+            const Symbol* dstsym      = inst()->symbol(con.dst.param);
+            if (!srcsym || !dstsym)
+                continue;
+            const char* why = "the upstream layer computes it";
+            if (!srcsym->lockgeom())
+                why = "the upstream value may come from userdata (lockgeom=0)";
+            else if (srcsym->symtype() == SymTypeParam && srcsym->connected())
+                why = "the upstream layer passes on its own connection";
+            items.push_back(
+                { layer_cost[con.srclayer],
+                  fmtformat("{}.{} is not folded from {}.{}: {}", layername,
+                            dstsym->name(), src->layername(), srcsym->name(),
+                            why) });
+        }
+
+        // Costly ops that survived, with what kept them
+        for (auto&& op : inst()->ops()) {
+            const OpDescriptor* opd = shadingsys().op_descriptor(op.opname());
+            int cost                = op_cost_estimate(opd, op.opname());
+            if (cost < 20)
+                continue;  // cheap ops aren't worth explaining
+            std::string why;
+            if (op.opname() == u_getattribute) {
+                // Retrace the checks of constfold_getattribute
+                int nargs           = op.nargs();
+                const Symbol* index = opargsym(op, nargs - 2);
+                const Symbol* dest  = opargsym(op, nargs - 1);
+                bool array_lookup   = index->typespec().is_int();
+                bool object_lookup  = nargs >= 4
+                                     && opargsym(op, 2)->typespec().is_string();
+                const Symbol* obj   = opargsym(op, 1);
+                const Symbol* attr  = opargsym(op, 1 + object_lookup);
+                if (!shadingsys().fold_getattribute())
+                    why = "opt_fold_getattribute is off";
+                else if (!attr->is_constant())
+                    why = "the attribute name is not constant";
+                else if (object_lookup && !obj->is_constant())
+                    why = "the object name is not constant";
+                else if (array_lookup && !index->is_constant())
+                    why = "the array index is not constant";
+                else if (dest->typespec().is_array())
+                    why = "array attributes are not folded";
+                else if (!object_lookup || obj->get_string().empty())
+                    why = "without an object name it must query the shaded "
+                          "object, and it is not a static_attribute";
+                else
+                    why = "the renderer did not supply it while optimizing";
+            } else {
+                for (int a = 0; a < op.nargs() && why.empty(); ++a) {
+                    const Symbol* sym = opargsym(op, a);
+                    if (op.argread(a) && !sym->is_constant())
+                        why = fmtformat("its argument {} varies", sym->name());
+                }
+                if (why.empty())
+                    why = "it is never folded";
+            }
+            items.push_back({ cost, fmtformat("{} at {}:{} in layer {}: {}",
+                                              op.opname(), op.sourcefile(),
+                                              op.sourceline(), layername,
+                                              why) });
+        }
+    }
+
+    std::stable_sort(items.begin(), items.end(),
+                     [](const Item& a, const Item& b) {
+                         return a.cost > b.cost;
+                     });
+    shadingcontext()->infofmt("Left unoptimized in group {} (costliest first):",
+                              group().name());
+    for (auto&& item : items)
+        shadingcontext()->infofmt("    [{}] {}", item.cost, item.text);
 }
 
 
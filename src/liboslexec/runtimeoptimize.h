@@ -4,8 +4,10 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/container/flat_map.hpp>
@@ -69,6 +71,14 @@ public:
     /// track variable lifetimes, coalesce temporaries.
     void post_optimize_instance();
 
+    /// Call func(rop) once per layer of the group, where rop is an
+    /// optimizer whose current instance is that layer.  When the group
+    /// has at least "opt_parallel_layers" layers (and debugging output is
+    /// off), the layers are processed concurrently, each with its own
+    /// RuntimeOptimizer, so func must only modify its own instance.
+    /// Otherwise, this optimizer visits the layers in order.
+    void for_each_layer(const std::function<void(RuntimeOptimizer&)>& func);
+
     /// What's our current optimization level?
     int optimize() const { return m_optimize; }
 
@@ -349,6 +359,29 @@ public:
 
     int eliminate_middleman();
 
+    /// Turn texture lookups that repeat an earlier one into copies of
+    /// its result.
+    int share_texture_lookups();
+
+    /// Remove the construction of closures that the renderer declared it
+    /// won't read for the raytypes known to be on.
+    int prune_unread_closures();
+
+    /// Fully unroll the "for" loops with a small constant trip count into
+    /// straight-line copies of their body and step.  Return the number
+    /// of loops unrolled.
+    int unroll_loops();
+    bool unroll_loop(int opnum);
+
+    /// The number of trips of the "for" loop at opnum, or -1 if it isn't
+    /// known to be at most maxtrips.
+    int loop_trips(int opnum, int maxtrips);
+
+    /// Turn the ops that recompute, from the same constants and globals,
+    /// a value that an upstream layer already passes us through a
+    /// connection into copies of the connected param.
+    int share_upstream_results();
+
     /// Squeeze out unused symbols from an instance that has been
     /// optimized.
     void collapse_syms();
@@ -440,6 +473,42 @@ public:
     /// After optimization, check for things that should not be left
     /// unoptimized.
     bool police_failed_optimizations();
+
+    /// Explain, costliest first, what the optimizer could not remove from
+    /// the group: connections it didn't fold, expensive ops that survived,
+    /// and layers that must run even if nothing asks for their outputs.
+    void report_unoptimized();
+
+    /// Find the outputs of the optimized group that are constant, for
+    /// m_constant_outputs.
+    void find_constant_outputs();
+
+    /// The values of symbols that find_constant_outputs knows so far:
+    /// their data, or their ClosureColor*.
+    typedef std::unordered_map<const Symbol*, const void*> KnownValues;
+
+    /// Set v to the value of s, if it's constant or known, and return
+    /// true; or return false.
+    static bool known_value(const KnownValues& known, const Symbol* s,
+                            const void*& v);
+
+    /// The closure made by a closure op whose params are all known, or
+    /// null if its weight is zero; ok is false if it can't be known.
+    const ClosureColor* constant_closure(const Opcode& op,
+                                         ConstantOutputs& co,
+                                         const KnownValues& known, bool& ok);
+
+    /// Bound the closure memory one execution of the group allocates, for
+    /// m_closure_memory_bound.
+    void find_closure_memory_bound();
+
+    /// Estimate the cost of one execution of the group from its ops, for
+    /// m_cost_estimate.
+    void find_cost_estimate();
+
+    /// May the op be skipped by a result from the shading cache?
+    bool op_is_cacheable(const Opcode& op, const OpDescriptor* opd);
+
     enum {  // bit field
         police_opt_warn           = 1,
         police_gpu_err_only       = 2,
@@ -476,6 +545,8 @@ private:
     bool m_opt_assign;                     ///< Do various assign optimizations?
     bool m_opt_mix;                        ///< Do mix optimizations?
     bool m_opt_middleman;                  ///< Do middleman optimizations?
+    bool m_opt_texture_reuse;              ///< Reuse repeated texture lookups?
+    int m_opt_unroll_loops;                ///< Max trips of loops to unroll
     bool m_opt_batched_analysis;  ///< Perform extra analysis required for batched execution?
     bool m_keep_no_return_function_calls;  ///< To generate debug info, keep no return function calls
     ShaderGlobals m_shaderglobals;  ///< Dummy ShaderGlobals
@@ -487,6 +558,7 @@ private:
 
     // All below is just for the one inst we're optimizing at the moment:
     int m_pass;                     ///< Optimization pass we're on now
+    int m_unrolled_ops;             ///< Ops added to the layer by unrolling
     std::vector<int> m_all_consts;  ///< All const symbol indices for inst
     int m_next_newconst;            ///< Unique ID for next new const we add
     int m_next_newtemp;             ///< Unique ID for next new temp we add
@@ -507,6 +579,10 @@ private:
     bool m_unknown_textures_needed;
     bool m_unknown_closures_needed;
     bool m_unknown_attributes_needed;
+    bool m_cacheable = true;  ///< May the group's results be cached?
+    std::shared_ptr<ConstantOutputs> m_constant_outputs;
+    int m_closure_memory_bound = -1;    ///< Bytes, or -1 if unbounded
+    float m_cost_estimate      = 0.0f;  ///< About ns per execution
     std::set<UserDataNeeded> m_userdata_needed;
     double m_stat_opt_locking_time;     ///<   locking time
     double m_stat_specialization_time;  ///<   specialization time
@@ -0,0 +1,349 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+
+// Memory footprint of a ShadingSystem holding many groups, as a scene
+// with many instances would.  A library of masters is generated and
+// loaded, then N groups are built from randomly chosen masters with
+// randomized parameter values and connections between their layers, and
+// optimized, JITed and executed once each.  After each of those stages
+// the process RSS, the shading system's master and instance memory, and
+// the sums over the groups of their JIT code, constant pools, symbol
+// tables, parameter values and groupdata are reported, as a table and
+// optionally as JSON.
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <OpenImageIO/argparse.h>
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/sysutil.h>
+#include <OpenImageIO/timer.h>
+
+#include <OSL/oslcomp.h>
+#include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+
+using namespace OSL;
+using namespace OIIO;
+
+
+static int ngroups        = 10000;
+static int nmasters       = 16;
+static int nlayers        = 4;
+static int seed           = 42;
+static float unlocked     = 0.1f;
+static float duplicates   = 0.0f;
+static std::string jsonfile;
+
+
+
+// What was held after one stage
+struct Stage {
+    std::string name;
+    double seconds;
+    long long rss;
+    long long shadingsys;  ///< stat:memory_current
+    long long masters;     ///< stat:mem_master_current
+    long long instances;   ///< stat:mem_inst_current
+    // Sums over the groups of their "memory:*" attributes
+    long long jit = 0, constants = 0, symbols = 0, params = 0, ops = 0;
+    long long connections = 0, groupdata = 0;
+};
+
+
+static const char* group_categories[] = { "jit",    "constants", "symbols",
+                                          "params", "ops",       "connections",
+                                          "groupdata" };
+
+
+
+// The source of master m.  Masters vary in size and in what they compute,
+// and each has its own constant so that no two are merged as identical.
+static std::string
+master_source(int m)
+{
+    static const char* bodies[] = {
+        // Pattern
+        "    float x = in0 * a + b;\n"
+        "    for (int i = 0; i < {iters}; ++i)\n"
+        "        x += float(noise(\"perlin\", P * (a + i))) * b;\n"
+        "    out = x * tint[0];\n",
+        // Math
+        "    float x = in0;\n"
+        "    for (int i = 0; i < {iters}; ++i)\n"
+        "        x = sin(x * a + i) * b + pow(abs(x), 0.5);\n"
+        "    out = x + tint[1];\n",
+        // Strings and branches
+        "    float x = in0 + u * a;\n"
+        "    if (label == \"wood\")\n"
+        "        x *= b;\n"
+        "    else if (label == \"metal\")\n"
+        "        x = mix(x, b, a);\n"
+        "    for (int i = 0; i < {iters}; ++i)\n"
+        "        x += float(cellnoise(P * i)) * tint[2];\n"
+        "    out = x;\n",
+    };
+    std::string body = Strutil::replace(bodies[m % 3], "{iters}",
+                                        Strutil::to_string(1 + m % 5), true);
+    return Strutil::fmt::format(
+        "shader scale_{} (float in0 = 0, float a = 0.5, float b = 1,\n"
+        "    color tint = 1, string label = \"\", output float out = 0)\n"
+        "{{\n"
+        "    float k = {};\n"
+        "{}"
+        "    out += k;\n"
+        "}}\n",
+        m, m * 0.001f, body);
+}
+
+
+
+static long long
+stat_ll(ShadingSystem& ss, const char* name)
+{
+    long long val = 0;
+    ss.getattribute(name, TypeDesc::INT64, &val);
+    return val;
+}
+
+
+
+static Stage
+measure(ShadingSystem& ss, string_view name, double seconds,
+        const std::vector<ShaderGroupRef>& groups)
+{
+    Stage s;
+    s.name       = name;
+    s.seconds    = seconds;
+    s.rss        = (long long)Sysutil::memory_used(true);
+    s.shadingsys = stat_ll(ss, "stat:memory_current");
+    s.masters    = stat_ll(ss, "stat:mem_master_current");
+    s.instances  = stat_ll(ss, "stat:mem_inst_current");
+    long long* sums[] = { &s.jit, &s.constants,   &s.symbols,  &s.params,
+                          &s.ops, &s.connections, &s.groupdata };
+    for (const ShaderGroupRef& g : groups) {
+        for (int c = 0; c < 7; ++c) {
+            long long bytes = 0;
+            ss.getattribute(g.get(),
+                            Strutil::fmt::format("memory:{}",
+                                                 group_categories[c]),
+                            TypeDesc::INT64, &bytes);
+            *sums[c] += bytes;
+        }
+    }
+    return s;
+}
+
+
+
+static void
+print_stages(const std::vector<Stage>& stages)
+{
+    std::cout << Strutil::fmt::format(
+        "{:<10} {:>8} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} "
+        "{:>10}\n",
+        "stage", "time", "rss", "masters", "instances", "jit", "constants",
+        "symbols", "params", "groupdata");
+    for (const Stage& s : stages)
+        std::cout << Strutil::fmt::format(
+            "{:<10} {:>7.2f}s {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} "
+            "{:>10} {:>10}\n",
+            s.name, s.seconds, Strutil::memformat(s.rss),
+            Strutil::memformat(s.masters), Strutil::memformat(s.instances),
+            Strutil::memformat(s.jit), Strutil::memformat(s.constants),
+            Strutil::memformat(s.symbols), Strutil::memformat(s.params),
+            Strutil::memformat(s.groupdata));
+}
+
+
+
+static void
+write_json(std::ostream& out, const std::vector<Stage>& stages)
+{
+    out << "{\n";
+    out << Strutil::fmt::format("  \"osl_version\": \"{}\",\n",
+                                OSL_LIBRARY_VERSION_STRING);
+    out << Strutil::fmt::format("  \"groups\": {},\n", ngroups);
+    out << Strutil::fmt::format("  \"masters\": {},\n", nmasters);
+    out << Strutil::fmt::format("  \"layers\": {},\n", nlayers);
+    out << Strutil::fmt::format("  \"unlocked\": {},\n", unlocked);
+    out << Strutil::fmt::format("  \"duplicates\": {},\n", duplicates);
+    out << "  \"stages\": [\n";
+    for (size_t i = 0; i < stages.size(); ++i) {
+        const Stage& s(stages[i]);
+        out << Strutil::fmt::format(
+            "    {{ \"stage\": \"{}\", \"seconds\": {:.4f}, \"rss\": {}, "
+            "\"shadingsys\": {}, \"masters\": {}, \"instances\": {}, "
+            "\"jit\": {}, \"constants\": {}, \"symbols\": {}, "
+            "\"params\": {}, \"ops\": {}, \"connections\": {}, "
+            "\"groupdata\": {} }}{}\n",
+            s.name, s.seconds, s.rss, s.shadingsys, s.masters, s.instances,
+            s.jit, s.constants, s.symbols, s.params, s.ops, s.connections,
+            s.groupdata, i + 1 < stages.size() ? "," : "");
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+
+
+// Declare group g: nlayers layers of random masters, each but the first
+// reading "in0" from the "out" of a random earlier layer, with random
+// parameter values, some of them interpolated.  Groups made from the same
+// seed are identical, and so share their optimized code.
+static ShaderGroupRef
+build_group(ShadingSystem& ss, int g, unsigned int group_seed)
+{
+    static const char* labels[] = { "", "wood", "metal", "plastic" };
+    std::mt19937 rng(group_seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_int_distribution<int> pick(0, nmasters - 1);
+    ShaderGroupRef group = ss.ShaderGroupBegin(
+        Strutil::fmt::format("group_{}", g));
+    for (int l = 0; l < nlayers; ++l) {
+        auto hints = [&]() {
+            return unit(rng) < unlocked ? ParamHints::interpolated
+                                        : ParamHints::none;
+        };
+        float a       = unit(rng);
+        float b       = unit(rng) * 2.0f;
+        Color3 tint   = Color3(unit(rng), unit(rng), unit(rng));
+        ustring label = ustring(labels[pick(rng) % 4]);
+        ss.Parameter(*group, "a", TypeDesc::TypeFloat, &a, hints());
+        ss.Parameter(*group, "b", TypeDesc::TypeFloat, &b, hints());
+        ss.Parameter(*group, "tint", TypeDesc::TypeColor, &tint, hints());
+        ss.Parameter(*group, "label", TypeDesc::TypeString, &label, hints());
+        int master = pick(rng);
+        ss.Shader(*group, "surface", Strutil::fmt::format("scale_{}", master),
+                  Strutil::fmt::format("layer{}", l));
+        if (l > 0) {
+            int src = std::uniform_int_distribution<int>(0, l - 1)(rng);
+            ss.ConnectShaders(*group, Strutil::fmt::format("layer{}", src),
+                              "out", Strutil::fmt::format("layer{}", l),
+                              "in0");
+        }
+    }
+    ss.ShaderGroupEnd(*group);
+    ustring outputs[] = { ustring("out") };
+    ss.attribute(group.get(), "renderer_outputs",
+                 TypeDesc(TypeDesc::STRING, 1), &outputs);
+    return group;
+}
+
+
+
+static void
+getargs(int argc, const char* argv[])
+{
+    OIIO::ArgParse ap;
+    // clang-format off
+    ap.intro("scale_bench -- memory of a ShadingSystem with many groups\n"
+             OSL_INTRO_STRING);
+    ap.usage("scale_bench [options]");
+    ap.arg("--groups %d:N", &ngroups)
+      .help("Number of groups (default: 10000)");
+    ap.arg("--masters %d:N", &nmasters)
+      .help("Number of masters in the library (default: 16)");
+    ap.arg("--layers %d:N", &nlayers)
+      .help("Layers in each group (default: 4)");
+    ap.arg("--unlocked %f:FRAC", &unlocked)
+      .help("Fraction of the params that are interpolated (default: 0.1)");
+    ap.arg("--duplicates %f:FRAC", &duplicates)
+      .help("Fraction of the groups that repeat an earlier one (default: 0)");
+    ap.arg("--seed %d:N", &seed)
+      .help("Seed of the random masters, params and connections");
+    ap.arg("--json %s:FILENAME", &jsonfile)
+      .help("Also write the results as JSON");
+    // clang-format on
+
+    if (ap.parse(argc, (const char**)argv) < 0) {
+        std::cerr << ap.geterror() << std::endl;
+        ap.usage();
+        exit(EXIT_FAILURE);
+    }
+    nmasters = std::max(nmasters, 1);
+    nlayers  = std::max(nlayers, 1);
+}
+
+
+
+int
+main(int argc, char const* argv[])
+{
+    getargs(argc, argv);
+
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    std::vector<ShaderGroupRef> groups;
+    std::vector<Stage> stages;
+    stages.push_back(measure(ss, "start", 0.0, groups));
+
+    Timer timer;
+    for (int m = 0; m < nmasters; ++m) {
+        std::string name = Strutil::fmt::format("scale_{}", m);
+        std::string oso;
+        OSLCompiler compiler;
+        if (!compiler.compile_buffer(master_source(m), oso, {})
+            || !ss.LoadMemoryCompiledShader(name, oso)) {
+            std::cerr << "Could not compile " << name << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    stages.push_back(measure(ss, "masters", timer.lap(), groups));
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<unsigned int> seeds;
+    groups.reserve(ngroups);
+    for (int g = 0; g < ngroups; ++g) {
+        unsigned int s = rng();
+        if (g > 0 && unit(rng) < duplicates)
+            s = seeds[std::uniform_int_distribution<int>(0, g - 1)(rng)];
+        seeds.push_back(s);
+        groups.push_back(build_group(ss, g, s));
+    }
+    stages.push_back(measure(ss, "groups", timer.lap(), groups));
+
+    PerThreadInfo* thread_info = ss.create_thread_info();
+    ShadingContext* ctx        = ss.get_context(thread_info);
+    for (const ShaderGroupRef& g : groups)
+        ss.optimize_group(g.get(), ctx, false);
+    stages.push_back(measure(ss, "optimized", timer.lap(), groups));
+
+    for (const ShaderGroupRef& g : groups)
+        ss.optimize_group(g.get(), ctx, true);
+    stages.push_back(measure(ss, "jitted", timer.lap(), groups));
+
+    ShaderGlobals sg;
+    memset((char*)&sg, 0, sizeof(ShaderGlobals));
+    sg.u = sg.v = 0.5f;
+    sg.P        = Vec3(0.5f, 0.5f, 0.5f);
+    sg.raytype  = 1;  // camera
+    for (const ShaderGroupRef& g : groups) {
+        ShaderGlobals sg_copy = sg;
+        ss.execute(*ctx, *g, 0, sg_copy, nullptr, nullptr);
+    }
+    stages.push_back(measure(ss, "executed", timer.lap(), groups));
+    ss.release_context(ctx);
+    ss.destroy_thread_info(thread_info);
+
+    print_stages(stages);
+    if (jsonfile.size()) {
+        std::ofstream out;
+        Filesystem::open(out, jsonfile);
+        if (!out) {
+            std::cerr << "Could not open " << jsonfile << "\n";
+            return EXIT_FAILURE;
+        }
+        write_json(out, stages);
+    }
+    return EXIT_SUCCESS;
+}
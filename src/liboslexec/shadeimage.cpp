@@ -9,6 +9,11 @@
 #include <OpenImageIO/thread.h>
 
 #include <OSL/oslexec.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_shaderglobals.h>
+#endif
+
+#include "oslexec_pvt.h"
 
 using namespace OSL;
 using namespace OSL::pvt;
@@ -22,6 +27,203 @@ OSL_NAMESPACE_ENTER
 
 
 
+// The type of the named output ("layername.symbolname" or just
+// "symbolname"), searching the layers last-to-first like find_symbol().
+// Unlike find_symbol(), this also works before the group is optimized, by
+// looking at the masters' symbols.
+static TypeDesc
+output_typedesc(const ShaderGroup& group, ustring name)
+{
+    ustring layername;
+    size_t dot = name.find('.');
+    if (dot != ustring::npos) {
+        layername = ustring(name, 0, dot);
+        name      = ustring(name, dot + 1);
+    }
+    for (int layer = group.nlayers() - 1; layer >= 0; --layer) {
+        const ShaderInstance* inst = group[layer];
+        if (layername.size() && layername != inst->layername())
+            continue;
+        int symidx = inst->findsymbol(name);
+        if (symidx < 0)
+            continue;
+        const Symbol* sym = inst->symbol(symidx) ? inst->symbol(symidx)
+                                                 : inst->mastersymbol(symidx);
+        return sym->typespec().simpletype();
+    }
+    return TypeDesc();
+}
+
+
+
+// Try to have the shader write the outputs straight into the pixels of
+// buf, concatenated channel by channel, by placing them in the Outputs
+// arena with the pixel as the base and the pixel stride as the stride.
+// This needs local float pixels and only float-based outputs that all
+// fit. A group that is not yet optimized has the symlocs added (unless
+// the caller already placed those outputs elsewhere); an optimized group
+// can only be shaded this way if it was placed exactly so earlier.
+// Return true if the outputs are placed in buf, false if they must be
+// copied from the context after each shade.
+static bool
+place_outputs(ShadingSystem& shadingsys, ShaderGroup& group,
+              OIIO::ImageBuf& buf, cspan<ustring> outputs)
+{
+    if (!buf.localpixels() || outputs.empty())
+        return false;
+    std::vector<SymLocationDesc> symlocs;
+    int chan = 0;
+    for (ustring name : outputs) {
+        TypeDesc t = output_typedesc(group, name);
+        int nchans = int(t.numelements()) * t.aggregate;
+        if (t.basetype != TypeDesc::FLOAT || chan + nchans > buf.nchannels())
+            return false;
+        symlocs.emplace_back(name, t, /*derivs=*/false, SymArena::Outputs,
+                             chan * sizeof(float), buf.pixel_stride());
+        chan += nchans;
+    }
+
+    if (group.optimized()) {
+        for (auto& s : symlocs) {
+            auto found = group.find_symloc(s.name, SymArena::Outputs);
+            if (!found || found->type != s.type || found->offset != s.offset
+                || found->stride != s.stride)
+                return false;
+        }
+        return true;
+    }
+    for (auto& s : symlocs)
+        if (group.find_symloc(s.name))
+            return false;
+    shadingsys.add_symlocs(&group, symlocs);
+    return true;
+}
+
+
+
+// Set u and v for pixel (x,y) of an image whose full window is roi_full.
+static void
+pixel_uv(ShadeImageLocations shadelocations, const OIIO::ROI& roi_full, int x,
+         int y, float& u, float& v)
+{
+    int xres = roi_full.width();
+    int yres = roi_full.height();
+    if (shadelocations == ShadePixelCenters) {
+        u = float(x - roi_full.xbegin + 0.5f) / xres;
+        v = float(y - roi_full.ybegin + 0.5f) / yres;
+        // float w = float(z-roi_full.zbegin+0.5f) / zres;
+    } else {
+        u = (xres == 1) ? 0.5f : float(x - roi_full.xbegin) / (xres - 1);
+        v = (yres == 1) ? 0.5f : float(y - roi_full.ybegin) / (yres - 1);
+        // float w = (zres == 1) ? 0.5f : float(z-roi_full.zbegin) / (zres - 1);
+    }
+}
+
+
+
+#if OSL_USE_BATCHED
+// The batch width to shade the image with, or 0 to shade point by point.
+// Batching is used if the shading system is set up for it: the renderer
+// supplies batched services and the batched analysis is on (its default
+// in that case), and the machine supports the width.
+static int
+shade_image_batch_width(ShadingSystem& shadingsys)
+{
+    int batched_analysis = 0;
+    shadingsys.getattribute("opt_batched_analysis", batched_analysis);
+    if (!batched_analysis)
+        return 0;
+    RendererServices* rs = shadingsys.renderer();
+    if (rs->batched(WidthOf<16>())
+        && shadingsys.configure_batch_execution_at(16))
+        return 16;
+    if (rs->batched(WidthOf<8>())
+        && shadingsys.configure_batch_execution_at(8))
+        return 8;
+    return 0;
+}
+
+
+
+// Shade the roi in runs of up to WidthT pixels along x, each written by
+// the shader straight into buf through the outputs placed by
+// place_outputs(): the run's first pixel is the output base and the lane
+// is the shade index.
+template<int WidthT>
+static void
+shade_roi_batched(ShadingSystem& shadingsys, ShadingContext& ctx,
+                  ShaderGroup& group, const ShaderGlobals& sg,
+                  OIIO::ImageBuf& buf, OIIO::ROI roi,
+                  ShadeImageLocations shadelocations)
+{
+    auto executor = shadingsys.batched<WidthT>();
+    executor.jit_group(&group, &ctx);
+
+    // Everything but P, u, and v is the same for every pixel, so fill the
+    // batch from the template sg just once.
+    BatchedShaderGlobals<WidthT> bsg;
+    memset(&bsg.uniform, 0, sizeof(UniformShaderGlobals));
+    bsg.uniform.renderstate = sg.renderstate;
+    bsg.uniform.tracedata   = sg.tracedata;
+    bsg.uniform.objdata     = sg.objdata;
+    bsg.uniform.raytype     = sg.raytype;
+    auto& vsg               = bsg.varying;
+    Block<int, WidthT> wide_shadeindex;
+    for (int lane = 0; lane < WidthT; ++lane) {
+        wide_shadeindex[lane]    = lane;
+        vsg.P[lane]              = sg.P;
+        vsg.dPdx[lane]           = sg.dPdx;
+        vsg.dPdy[lane]           = sg.dPdy;
+        vsg.dPdz[lane]           = sg.dPdz;
+        vsg.I[lane]              = sg.I;
+        vsg.dIdx[lane]           = sg.dIdx;
+        vsg.dIdy[lane]           = sg.dIdy;
+        vsg.N[lane]              = sg.N;
+        vsg.Ng[lane]             = sg.Ng;
+        vsg.u[lane]              = sg.u;
+        vsg.dudx[lane]           = sg.dudx;
+        vsg.dudy[lane]           = sg.dudy;
+        vsg.v[lane]              = sg.v;
+        vsg.dvdx[lane]           = sg.dvdx;
+        vsg.dvdy[lane]           = sg.dvdy;
+        vsg.dPdu[lane]           = sg.dPdu;
+        vsg.dPdv[lane]           = sg.dPdv;
+        vsg.time[lane]           = sg.time;
+        vsg.dtime[lane]          = sg.dtime;
+        vsg.dPdtime[lane]        = sg.dPdtime;
+        vsg.Ps[lane]             = sg.Ps;
+        vsg.dPsdx[lane]          = sg.dPsdx;
+        vsg.dPsdy[lane]          = sg.dPsdy;
+        vsg.object2common[lane]  = sg.object2common;
+        vsg.shader2common[lane]  = sg.shader2common;
+        vsg.Ci[lane]             = sg.Ci;
+        vsg.surfacearea[lane]    = sg.surfacearea;
+        vsg.flipHandedness[lane] = sg.flipHandedness;
+        vsg.backfacing[lane]     = sg.backfacing;
+    }
+
+    OIIO::ROI roi_full = buf.roi_full();
+    for (int z = roi.zbegin; z < roi.zend; ++z) {
+        for (int y = roi.ybegin; y < roi.yend; ++y) {
+            for (int x = roi.xbegin; x < roi.xend; x += WidthT) {
+                int batch_size = std::min(WidthT, roi.xend - x);
+                for (int lane = 0; lane < batch_size; ++lane) {
+                    float u, v;
+                    pixel_uv(shadelocations, roi_full, x + lane, y, u, v);
+                    vsg.P[lane] = Vec3(x + lane, y, z);
+                    vsg.u[lane] = u;
+                    vsg.v[lane] = v;
+                }
+                executor.execute(ctx, group, batch_size, wide_shadeindex, bsg,
+                                 nullptr, buf.pixeladdr(x, y, z));
+            }
+        }
+    }
+}
+#endif
+
+
+
 bool
 shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
             const ShaderGlobals* defaultsg, OIIO::ImageBuf& buf,
@@ -45,6 +247,16 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
         return false;
     }
 
+    // Decide once, before any thread optimizes the group, whether the
+    // shader writes the outputs into the pixels itself, and if so whether
+    // it does so in batches.
+    bool placed     = place_outputs(shadingsys, group, buf, outputs);
+    int batch_width = 0;
+#if OSL_USE_BATCHED
+    if (placed)
+        batch_width = shade_image_batch_width(shadingsys);
+#endif
+
     parallel_image(roi, popt, [&](OIIO::ROI roi) {
         // Request an OSL::PerThreadInfo for this thread.
         OSL::PerThreadInfo* thread_info = shadingsys.create_thread_info();
@@ -56,7 +268,8 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
         ShadingContext* ctx = shadingsys.get_context(thread_info);
 
         // Ensure the group has already been optimized
-        shadingsys.optimize_group(&group, ctx);
+        if (!batch_width)
+            shadingsys.optimize_group(&group, ctx);
 
         Matrix44 Mshad, Mobj;  // just let these be identity for now
         OIIO::ROI roi_full = buf.roi_full();
@@ -64,13 +277,14 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
         int yres           = roi_full.height();
         int zres           = roi_full.depth();
 
-        // Gather some information about the outputs once, rather than for
-        // each pixel.
+        // Unless the outputs are placed in the pixels, gather some
+        // information about them once, rather than for each pixel.
+        int noutputs                    = placed ? 0 : int(outputs.size());
         const ShaderSymbol** output_sym = OSL_ALLOCA(const ShaderSymbol*,
                                                      outputs.size());
         TypeDesc* output_type           = OSL_ALLOCA(TypeDesc, outputs.size());
         int* output_nchans              = OSL_ALLOCA(int, outputs.size());
-        for (int i = 0; i < int(outputs.size()); ++i) {
+        for (int i = 0; i < noutputs; ++i) {
             output_sym[i]    = shadingsys.find_symbol(group, outputs[i]);
             output_type[i]   = shadingsys.symbol_typedesc(output_sym[i]);
             output_nchans[i] = output_type[i].numelements()
@@ -127,46 +341,52 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
             // sg.renderstate = &sg;
         }
 
-        // Loop over all pixels in the image (in x and y)...
-        for (OIIO::ImageBuf::Iterator<float> p(buf, roi); !p.done(); ++p) {
-            // Set the shader globals that vary from point to pixel to pixel
-            sg.P = Vec3(p.x(), p.y(), p.z());
-            if (shadelocations == ShadePixelCenters) {
-                sg.u = float(p.x() - roi_full.xbegin + 0.5f) / xres;
-                sg.v = float(p.y() - roi_full.ybegin + 0.5f) / yres;
-                // float w = float(p.z()-roi_full.zbegin+0.5f) / zres;
-            } else {
-                sg.u = (xres == 1)
-                           ? 0.5f
-                           : float(p.x() - roi_full.xbegin) / (xres - 1);
-                sg.v = (yres == 1)
-                           ? 0.5f
-                           : float(p.y() - roi_full.ybegin) / (yres - 1);
-                // float w = (zres == 1) ? 0.5f : float(p.z()-roi_full.zbegin) / (zres - 1);
-            }
+#if OSL_USE_BATCHED
+        if (batch_width == 16) {
+            shade_roi_batched<16>(shadingsys, *ctx, group, sg, buf, roi,
+                                  shadelocations);
+        } else if (batch_width == 8) {
+            shade_roi_batched<8>(shadingsys, *ctx, group, sg, buf, roi,
+                                 shadelocations);
+        } else
+#endif
+        {
+            // Loop over all pixels in the image (in x and y)...
+            for (OIIO::ImageBuf::Iterator<float> p(buf, roi); !p.done(); ++p) {
+                // Set the shader globals that vary from point to pixel to
+                // pixel
+                sg.P = Vec3(p.x(), p.y(), p.z());
+                pixel_uv(shadelocations, roi_full, p.x(), p.y(), sg.u, sg.v);
+
+                // Actually run the shader for this point, writing the
+                // placed outputs straight into the pixel.
+                if (placed) {
+                    shadingsys.execute(*ctx, group, 0, sg, nullptr,
+                                       buf.pixeladdr(p.x(), p.y(), p.z()));
+                    continue;
+                }
+                shadingsys.execute(*ctx, group, sg);
 
-            // Actually run the shader for this point
-            shadingsys.execute(*ctx, group, sg);
-
-            // Save all the designated outputs.
-            int chan = 0;
-            for (int i = 0; i < int(outputs.size()); ++i) {
-                const void* data = shadingsys.symbol_address(*ctx,
-                                                             output_sym[i]);
-                if (!data)
-                    continue;  // Skip if symbol isn't found
-                TypeDesc t = output_type[i];
-                int tvals  = output_nchans[i];
-                if (chan + tvals > buf.nchannels())
-                    break;
-                if (t.basetype == TypeDesc::FLOAT) {
-                    for (int c = 0; c < tvals; ++c)
-                        p[chan++] = ((const float*)data)[c];
-                } else if (t.basetype == TypeDesc::INT) {
-                    for (int c = 0; c < int(t.numelements()) * t.aggregate; ++c)
-                        p[chan++] = ((const int*)data)[c];
+                // Save all the designated outputs.
+                int chan = 0;
+                for (int i = 0; i < noutputs; ++i) {
+                    const void* data
+                        = shadingsys.symbol_address(*ctx, output_sym[i]);
+                    if (!data)
+                        continue;  // Skip if symbol isn't found
+                    TypeDesc t = output_type[i];
+                    int tvals  = output_nchans[i];
+                    if (chan + tvals > buf.nchannels())
+                        break;
+                    if (t.basetype == TypeDesc::FLOAT) {
+                        for (int c = 0; c < tvals; ++c)
+                            p[chan++] = ((const float*)data)[c];
+                    } else if (t.basetype == TypeDesc::INT) {
+                        for (int c = 0; c < tvals; ++c)
+                            p[chan++] = ((const int*)data)[c];
+                    }
+                    // N.B. Drop any outputs that aren't float- or int-based
                 }
-                // N.B. Drop any outputs that aren't float- or int-based
             }
         }
 
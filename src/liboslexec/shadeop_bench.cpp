@@ -0,0 +1,509 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+
+// Timing of individual shadeops, on randomized inputs, with warm caches
+// and with caches that were just evicted.  The single point shadeops of
+// llvm_ops.cpp and op*.cpp are hidden in liboslexec (or only exist as its
+// bitcode), so they are timed the way a renderer reaches them: a one op
+// shader, JITed, executed point by point, and compared with a shader that
+// does nothing, which is the fixed cost of execute().  The batched
+// shadeops (wide/*) are looked up by name in each lib_b<width>_<isa>_oslexec
+// library and called directly.  The results are written as JSON.
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <OpenImageIO/argparse.h>
+#include <OpenImageIO/benchmark.h>
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/plugin.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/sysutil.h>
+#include <OpenImageIO/timer.h>
+
+#include <OSL/llvm_util.h>
+#include <OSL/oslcomp.h>
+#include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+#include <OSL/wide.h>
+
+using namespace OSL;
+using namespace OIIO;
+
+
+static int iterations   = 100000;
+static int ntrials      = 5;
+static int flush_mb     = 64;
+static bool verbose     = false;
+static bool scalar_only = false;
+static std::string jsonfile;
+static std::string libdirs;
+static std::string only_op;
+static std::string texturename;
+
+// Points (or batches) of randomized inputs.  Warm timings cycle through
+// the first warm_points of them, cold ones through cold_calls spread over
+// all of them.
+static const int npoints     = 4096;
+static const int warm_points = 64;
+static const int cold_calls  = 64;
+
+
+
+struct Record {
+    std::string op;
+    std::string isa;  ///< "jit" for the single point shadeops
+    int width;
+    bool cold;
+    double ns_per_call;
+    double ns_over_empty;  ///< Less the cost of an empty shader (jit only)
+};
+
+
+
+class ShadeopBench {
+public:
+    ShadeopBench()
+    {
+        m_bench.iterations(iterations);
+        m_bench.trials(ntrials);
+        m_bench.verbose(verbose);
+        m_bench.units(Benchmarker::Unit::ns);
+    }
+
+    bool wanted(string_view op) const
+    {
+        return only_op.empty() || op == only_op || op == "empty";
+    }
+
+    // Time func(i), which runs one call of the shadeop on input set i of
+    // npoints, with warm and cold caches, and return the warm ns per call.
+    template<typename F>
+    double run(string_view op, int width, string_view isa, F&& func,
+               double empty_ns = 0.0)
+    {
+        std::string name = Strutil::fmt::format("  {} [{} x{}]", op, isa,
+                                                width);
+        int i = 0;
+        m_bench.work(width);
+        m_bench(name, [&]() {
+            func(i);
+            i = (i + 1) % warm_points;
+        });
+        double warm = m_bench.median() * 1.0e9;
+        double cold = cold_ns_per_call(func);
+        if (verbose)
+            std::cout << Strutil::fmt::format("{:<40} cold {:8.1f} ns/call\n",
+                                              name, cold);
+        m_records.push_back({ op, isa, width, false, warm, warm - empty_ns });
+        m_records.push_back({ op, isa, width, true, cold, cold - empty_ns });
+        return warm;
+    }
+
+    void write_json(std::ostream& out) const
+    {
+        out << "{\n";
+        out << Strutil::fmt::format("  \"osl_version\": \"{}\",\n",
+                                    OSL_LIBRARY_VERSION_STRING);
+        out << Strutil::fmt::format("  \"hw_simd\": \"{}\",\n",
+                                    OIIO::get_string_attribute("hw:simd"));
+        out << Strutil::fmt::format("  \"iterations\": {},\n", iterations);
+        out << Strutil::fmt::format("  \"trials\": {},\n", ntrials);
+        out << Strutil::fmt::format("  \"flush_mb\": {},\n", flush_mb);
+        out << "  \"results\": [\n";
+        for (size_t i = 0; i < m_records.size(); ++i) {
+            const Record& r(m_records[i]);
+            out << Strutil::fmt::format(
+                "    {{ \"op\": \"{}\", \"isa\": \"{}\", \"width\": {}, "
+                "\"cache\": \"{}\", \"ns_per_call\": {:.3f}, "
+                "\"ns_per_lane\": {:.3f}, \"ns_over_empty\": {:.3f} }}{}\n",
+                r.op, r.isa, r.width, r.cold ? "cold" : "warm",
+                r.ns_per_call, r.ns_per_call / r.width, r.ns_over_empty,
+                i + 1 < m_records.size() ? "," : "");
+        }
+        out << "  ]\n";
+        out << "}\n";
+    }
+
+private:
+    // Evict the caches by writing a buffer larger than them, then time
+    // cold_calls calls on inputs spread over all the points; the median
+    // over the trials.
+    template<typename F> double cold_ns_per_call(F&& func)
+    {
+        m_flush.resize(size_t(flush_mb) << 20);
+        std::vector<double> times;
+        for (int t = 0; t < ntrials; ++t) {
+            for (size_t b = 0; b < m_flush.size(); b += 64)
+                m_flush[b] += 1;
+            clobber_all_memory();
+            Timer timer;
+            for (int c = 0; c < cold_calls; ++c)
+                func((c * 61) % npoints);
+            times.push_back(timer() * 1.0e9 / cold_calls);
+        }
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    }
+
+    Benchmarker m_bench;
+    std::vector<Record> m_records;
+    std::vector<char> m_flush;
+};
+
+
+
+// The single point shadeops, each as the op a one line shader runs on the
+// globals of a point.  "empty" runs no shadeop, and is the fixed cost the
+// others are compared with.
+static const struct {
+    const char* op;
+    const char* type;
+    const char* expr;
+} scalar_ops[] = {
+    { "empty", "float", "u" },
+    { "sin", "float", "sin(u * 6.0)" },
+    { "pow", "float", "pow(u, v * 4.0)" },
+    { "transform", "point",
+      "transform(matrix(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, u, v, 0, 1), P)" },
+    { "inverse", "matrix",
+      "inverse(matrix(1 + u, v, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, u, v, 0, 1))" },
+    { "spline", "float", "spline(\"catmull-rom\", u, 0, 0.2, 0.5, 0.7, 1, 1)" },
+    { "spline_color", "color",
+      "spline(\"bspline\", u, color(0), color(1, 0, 0), color(0, 1, 0), "
+      "color(0, 0, 1), color(1))" },
+    { "splineinverse", "float",
+      "splineinverse(\"linear\", u, 0, 0.2, 0.5, 1)" },
+    { "noise_perlin", "float", "noise(\"perlin\", P)" },
+    { "noise_uperlin", "color", "noise(\"uperlin\", P)" },
+    { "noise_simplex", "float", "noise(\"simplex\", P)" },
+    { "noise_cell", "float", "noise(\"cell\", P)" },
+    { "noise_gabor", "float", "noise(\"gabor\", P)" },
+    { "transformc", "color", "transformc(\"hsv\", color(u, v, 0.5))" },
+    { "blackbody", "color", "blackbody(1000 + 9000 * u)" },
+    { "format", "string", "format(\"%g %g\", u, v)" },
+    { "strlen", "int", "strlen(format(\"%g\", u))" },
+    { "hash", "int", "hash(format(\"%g\", u))" },
+    { "concat", "string", "concat(\"p_\", format(\"%d\", int(u * 100)))" },
+    { "substr", "string", "substr(format(\"%g\", u), 1, 3)" },
+    { "regex_search", "int", "regex_search(format(\"%g\", u), \"[0-9]+5\")" },
+    { "texture", "color", "texture(texname, u, v)" },
+};
+
+
+
+static void
+random_globals(std::vector<ShaderGlobals>& sgs)
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    sgs.resize(npoints);
+    for (ShaderGlobals& sg : sgs) {
+        memset((char*)&sg, 0, sizeof(ShaderGlobals));
+        sg.u    = unit(rng);
+        sg.v    = unit(rng);
+        sg.P    = Vec3(unit(rng), unit(rng), unit(rng)) * 20.0f - Vec3(10.0f);
+        sg.dPdx = Vec3(0.01f, 0.0f, 0.0f);
+        sg.dPdy = Vec3(0.0f, 0.01f, 0.0f);
+        sg.dudx    = 0.01f;
+        sg.dvdy    = 0.01f;
+        sg.N       = Vec3(0.0f, 0.0f, 1.0f);
+        sg.Ng      = sg.N;
+        sg.I       = Vec3(0.0f, 0.0f, -1.0f);
+        sg.dPdu    = Vec3(1.0f, 0.0f, 0.0f);
+        sg.dPdv    = Vec3(0.0f, 1.0f, 0.0f);
+        sg.raytype = 1;  // camera
+    }
+}
+
+
+
+static void
+bench_scalar_ops(ShadeopBench& bench)
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    std::vector<ShaderGlobals> sgs;
+    random_globals(sgs);
+    std::vector<ShaderGlobals> sg_copy(sgs);  // execute writes into them
+    PerThreadInfo* thread_info = ss.create_thread_info();
+    ShadingContext* ctx        = ss.get_context(thread_info);
+    ustring outputs[]          = { ustring("r") };
+    const char* texname        = ustring(texturename).c_str();
+
+    double empty_ns = 0.0;
+    for (const auto& s : scalar_ops) {
+        if (!bench.wanted(s.op)
+            || (texturename.empty() && !strcmp(s.op, "texture")))
+            continue;
+        std::string shadername = Strutil::fmt::format("bench_{}", s.op);
+        std::string source     = Strutil::fmt::format(
+            "shader {} (string texname = \"\", output {} r = {})\n"
+            "{{ r = {}; }}\n",
+            shadername, s.type, strcmp(s.type, "string") ? "0" : "\"\"",
+            s.expr);
+        std::string oso;
+        OSLCompiler compiler;
+        if (!compiler.compile_buffer(source, oso, {})
+            || !ss.LoadMemoryCompiledShader(shadername, oso)) {
+            std::cerr << "Could not compile " << shadername << "\n";
+            continue;
+        }
+        ShaderGroupRef group = ss.ShaderGroupBegin(shadername);
+        ss.Parameter(*group, "texname", TypeDesc::TypeString, &texname);
+        ss.Shader(*group, "surface", shadername, "layer");
+        ss.ShaderGroupEnd(*group);
+        ss.attribute(group.get(), "renderer_outputs",
+                     TypeDesc(TypeDesc::STRING, 1), &outputs);
+        // The first execution optimizes and JITs the group
+        ss.execute(*ctx, *group, 0, sg_copy[0], nullptr, nullptr);
+
+        double ns = bench.run(
+            s.op, 1, "jit",
+            [&](int i) {
+                sg_copy[i] = sgs[i];
+                ss.execute(*ctx, *group, i, sg_copy[i], nullptr, nullptr);
+            },
+            empty_ns);
+        if (!strcmp(s.op, "empty"))
+            empty_ns = ns;
+    }
+
+    ss.release_context(ctx);
+    ss.destroy_thread_info(thread_info);
+}
+
+
+
+// Batched shadeops: those of one width and ISA, looked up by name in its
+// library.  Ops the library doesn't have are skipped.
+template<int WidthT> class WideOpBench {
+public:
+    WideOpBench(ShadeopBench& bench, Plugin::Handle lib, string_view isa)
+        : m_bench(bench)
+        , m_lib(lib)
+        , m_isa(isa)
+        , m_selector(Strutil::fmt::format("osl_b{}_{}_", WidthT, isa))
+        , m_x(npoints)
+        , m_y(npoints)
+        , m_P(npoints)
+        , m_M(npoints)
+        , m_s(npoints)
+    {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (int i = 0; i < npoints; ++i) {
+            for (int lane = 0; lane < WidthT; ++lane) {
+                float x = unit(rng), y = unit(rng);
+                m_x[i].set(lane, x);
+                m_y[i].set(lane, y * 4.0f);
+                m_P[i].set(lane, Vec3(x, y, unit(rng)) * 20.0f - Vec3(10.0f));
+                Matrix44 M;
+                M.setTranslation(Vec3(x, y, 0.0f));
+                m_M[i].set(lane, M);
+                m_s[i].set(lane, ustring(Strutil::fmt::format("{}", x)));
+            }
+        }
+    }
+
+    void run()
+    {
+        typedef void (*Func2)(void*, void*, unsigned int);
+        typedef void (*Func3)(void*, void*, void*, unsigned int);
+        Block<float, WidthT> rf;
+        Block<int, WidthT> ri;
+        Block<Vec3, WidthT> rv;
+        Block<ustring, WidthT> rs;
+        Block<ustring, WidthT> prefix;
+        for (int lane = 0; lane < WidthT; ++lane)
+            prefix.set(lane, ustring("p_"));
+
+        if (auto f = (Func2)symbol("sin", "WfWf"))
+            run("sin", [&](int i) { f(&rf, &m_x[i], all_lanes); });
+        if (auto f = (Func3)symbol("pow", "WfWfWf"))
+            run("pow", [&](int i) { f(&rf, &m_x[i], &m_y[i], all_lanes); });
+
+        typedef void (*TransformFunc)(void*, void*, void*, unsigned int,
+                                      unsigned int);
+        if (auto f = (TransformFunc)symbol("transform_point", "WvWvWm"))
+            run("transform", [&](int i) {
+                f(&m_P[i], &rv, &m_M[i], all_lanes, all_lanes);
+            });
+
+        typedef void (*SplineFunc)(void*, const char*, void*, float*, int,
+                                   int, unsigned int);
+        if (auto f = (SplineFunc)symbol("spline", "WfWff")) {
+            const char* basis = bitcast<const char*>(
+                ustringrep_from("catmull-rom"));
+            float knots[] = { 0.0f, 0.2f, 0.5f, 0.7f, 1.0f, 1.0f };
+            run("spline", [&](int i) {
+                f(&rf, basis, &m_x[i], knots, 6, 6, all_lanes);
+            });
+        }
+
+        if (auto f = (Func2)symbol("snoise", "WfWv"))
+            run("noise_perlin", [&](int i) { f(&rf, &m_P[i], all_lanes); });
+
+        if (auto f = (Func2)symbol("strlen", "WiWs"))
+            run("strlen", [&](int i) { f(&ri, &m_s[i], all_lanes); });
+        if (auto f = (Func2)symbol("hash", "WiWs"))
+            run("hash", [&](int i) { f(&ri, &m_s[i], all_lanes); });
+        if (auto f = (Func3)symbol("concat", "WsWsWs"))
+            run("concat",
+                [&](int i) { f(&rs, &prefix, &m_s[i], all_lanes); });
+    }
+
+private:
+    static constexpr unsigned int all_lanes = (1u << WidthT) - 1;
+
+    template<typename F> void run(string_view op, F&& func)
+    {
+        if (!m_bench.wanted(op))
+            return;
+        m_bench.run(op, WidthT, m_isa, [&](int i) {
+            func(i);
+            clobber_all_memory();
+        });
+    }
+
+    // Look up the masked shadeop opname_<args>
+    void* symbol(string_view opname, string_view args)
+    {
+        std::string name = Strutil::fmt::format("{}{}_{}_masked", m_selector,
+                                                opname, args);
+        return Plugin::getsym(m_lib, name, /*report_error=*/false);
+    }
+
+    ShadeopBench& m_bench;
+    Plugin::Handle m_lib;
+    std::string m_isa;
+    std::string m_selector;
+    std::vector<Block<float, WidthT>> m_x, m_y;
+    std::vector<Block<Vec3, WidthT>> m_P;
+    std::vector<Block<Matrix44, WidthT>> m_M;
+    std::vector<Block<ustring, WidthT>> m_s;
+};
+
+
+
+// The ISAs the batched libraries may be built for, by the name the
+// libraries use
+static const struct {
+    TargetISA isa;
+    const char* name;
+} wide_isas[] = { { TargetISA::AVX512, "AVX512" },
+                  { TargetISA::AVX512_noFMA, "AVX512_noFMA" },
+                  { TargetISA::AVX2, "AVX2" },
+                  { TargetISA::AVX2_noFMA, "AVX2_noFMA" },
+                  { TargetISA::AVX, "AVX" },
+                  { TargetISA::SSE4_2, "SSE4_2" } };
+
+
+
+template<int WidthT>
+static void
+bench_wide_ops(ShadeopBench& bench, const std::vector<std::string>& dirs)
+{
+    for (const auto& wide_isa : wide_isas) {
+        std::string libname = Strutil::fmt::format("lib_b{}_{}_oslexec.{}",
+                                                   WidthT, wide_isa.name,
+                                                   Plugin::plugin_extension());
+        std::string filename = Filesystem::searchpath_find(libname, dirs);
+        if (filename.empty())
+            continue;
+        if (!LLVM_Util::supports_isa(wide_isa.isa)) {
+            if (verbose)
+                std::cerr << "Skipping " << libname
+                          << ", this machine doesn't support its ISA\n";
+            continue;
+        }
+        Plugin::Handle lib = Plugin::open(filename, /*global=*/false);
+        if (!lib) {
+            std::cerr << "Could not load " << filename << ": "
+                      << Plugin::geterror() << "\n";
+            continue;
+        }
+        WideOpBench<WidthT>(bench, lib, wide_isa.name).run();
+    }
+}
+
+
+
+static void
+getargs(int argc, const char* argv[])
+{
+    OIIO::ArgParse ap;
+    // clang-format off
+    ap.intro("shadeop_bench -- time individual shadeops\n" OSL_INTRO_STRING);
+    ap.usage("shadeop_bench [options]");
+    ap.arg("-v", &verbose)
+      .help("Verbose output");
+    ap.arg("--json %s:FILENAME", &jsonfile)
+      .help("Write the results to a file (default: stdout)");
+    ap.arg("--libdir %s:DIRS", &libdirs)
+      .help("Colon-separated directories to search for the batched libraries");
+    ap.arg("--op %s:NAME", &only_op)
+      .help("Only time this op (and the empty shader)");
+    ap.arg("--texture %s:FILENAME", &texturename)
+      .help("Also time texture lookups of this file");
+    ap.arg("--scalar", &scalar_only)
+      .help("Only time the single point shadeops");
+    ap.arg("--iterations %d:N", &iterations)
+      .help("Number of iterations of the warm timings");
+    ap.arg("--trials %d:N", &ntrials)
+      .help("Number of trials");
+    ap.arg("--flush %d:MB", &flush_mb)
+      .help("Size of the buffer written to evict the caches (default: 64)");
+    // clang-format on
+
+    if (ap.parse(argc, (const char**)argv) < 0) {
+        std::cerr << ap.geterror() << std::endl;
+        ap.usage();
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+
+int
+main(int argc, char const* argv[])
+{
+    getargs(argc, argv);
+
+    ShadeopBench bench;
+    bench_scalar_ops(bench);
+
+    if (!scalar_only) {
+        // Look for the batched libraries next to the program, in the usual
+        // install locations relative to it, and wherever we're told
+        std::string bindir = Filesystem::parent_path(
+            Sysutil::this_program_path());
+        std::vector<std::string> dirs;
+        Filesystem::searchpath_split(libdirs, dirs, true);
+        dirs.push_back(bindir);
+        dirs.push_back(bindir + "/../lib");
+        dirs.push_back(bindir + "/../lib64");
+        bench_wide_ops<8>(bench, dirs);
+        bench_wide_ops<16>(bench, dirs);
+    }
+
+    if (jsonfile.size()) {
+        std::ofstream out;
+        Filesystem::open(out, jsonfile);
+        if (!out) {
+            std::cerr << "Could not open " << jsonfile << "\n";
+            return EXIT_FAILURE;
+        }
+        bench.write_json(out);
+    } else {
+        bench.write_json(std::cout);
+    }
+    return EXIT_SUCCESS;
+}
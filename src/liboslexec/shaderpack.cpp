@@ -0,0 +1,228 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include <OpenImageIO/filesystem.h>
+
+#include "shaderpack.h"
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+namespace {  // anon
+
+// File layout: the header, then the index of nshaders FileEntry, the
+// names back to back, and the masters, each aligned to data_alignment.
+static const char file_magic[8] = { 'O', 'S', 'L', 'P', 'A', 'C', 'K', 0 };
+static const uint32_t file_version   = 1;
+static const uint64_t data_alignment = 64;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nshaders;
+    uint64_t index_offset;  // nshaders FileEntry
+    uint64_t names_offset;
+    uint64_t names_size;
+};
+
+struct FileEntry {
+    uint64_t name_offset;  // From the start of the names
+    uint64_t name_size;
+    uint64_t data_offset;  // From the start of the file
+    uint64_t data_size;
+};
+
+
+
+inline uint64_t
+align_offset(uint64_t offset)
+{
+    return (offset + data_alignment - 1) / data_alignment * data_alignment;
+}
+
+}  // namespace
+
+
+
+bool
+ShaderLibraryPack::write(string_view filename,
+                         const std::vector<Entry>& shaders,
+                         std::string& errmessage)
+{
+    // Everything but the masters is small, so lay it all out up front
+    FileHeader header {};
+    memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version      = file_version;
+    header.nshaders     = uint32_t(shaders.size());
+    header.index_offset = sizeof(FileHeader);
+    header.names_offset = header.index_offset
+                          + shaders.size() * sizeof(FileEntry);
+    std::vector<FileEntry> index(shaders.size());
+    std::string names;
+    for (size_t i = 0; i < shaders.size(); ++i) {
+        index[i].name_offset = names.size();
+        index[i].name_size   = shaders[i].name.size();
+        names += shaders[i].name;
+    }
+    header.names_size = names.size();
+    uint64_t offset   = header.names_offset + header.names_size;
+    for (size_t i = 0; i < shaders.size(); ++i) {
+        index[i].data_offset = align_offset(offset);
+        index[i].data_size   = shaders[i].data.size();
+        offset               = index[i].data_offset + index[i].data_size;
+    }
+
+    FILE* file = OIIO::Filesystem::fopen(filename, "wb");
+    if (!file) {
+        errmessage = fmtformat("could not open \"{}\" for writing", filename);
+        return false;
+    }
+    static const char zeros[data_alignment] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(index.data(), sizeof(FileEntry), index.size(), file)
+                     == index.size()
+              && fwrite(names.data(), 1, names.size(), file) == names.size();
+    offset = header.names_offset + header.names_size;
+    for (size_t i = 0; ok && i < shaders.size(); ++i) {
+        size_t pad = size_t(index[i].data_offset - offset);
+        const std::string& data = shaders[i].data;
+        ok = fwrite(zeros, 1, pad, file) == pad
+             && fwrite(data.data(), 1, data.size(), file) == data.size();
+        offset = index[i].data_offset + index[i].data_size;
+    }
+    ok &= (fclose(file) == 0);
+    if (!ok)
+        errmessage = fmtformat("error writing \"{}\"", filename);
+    return ok;
+}
+
+
+
+std::unique_ptr<ShaderLibraryPack>
+ShaderLibraryPack::open(string_view filename, std::string& errmessage)
+{
+    std::unique_ptr<ShaderLibraryPack> pack(new ShaderLibraryPack);
+    pack->m_filename = filename;
+
+    // Map the whole file read-only.  Once mapped, the file handles
+    // aren't needed any more.
+#ifdef _WIN32
+    HANDLE file = CreateFileA(std::string(filename).c_str(), GENERIC_READ,
+                              FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY,
+                                                0, 0, nullptr);
+            if (mapping) {
+                pack->m_map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (pack->m_map)
+                    pack->m_map_size = size_t(size.QuadPart);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+    }
+#else
+    int fd = ::open(std::string(filename).c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* map = mmap(nullptr, size_t(st.st_size), PROT_READ,
+                             MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                pack->m_map      = map;
+                pack->m_map_size = size_t(st.st_size);
+            }
+        }
+        close(fd);
+    }
+#endif
+    if (!pack->m_map) {
+        errmessage = fmtformat("could not map \"{}\"", filename);
+        return nullptr;
+    }
+
+    const char* base = (const char*)pack->m_map;
+    uint64_t size    = pack->m_map_size;
+    // Are the count bytes at offset in the file?
+    auto in_file = [&](uint64_t offset, uint64_t count) {
+        return offset <= size && count <= size - offset;
+    };
+    const FileHeader& header = *(const FileHeader*)base;
+    if (size < sizeof(FileHeader)
+        || memcmp(header.magic, file_magic, sizeof(file_magic))
+        || header.version != file_version
+        || header.index_offset % alignof(FileEntry)
+        || !in_file(header.index_offset,
+                    uint64_t(header.nshaders) * sizeof(FileEntry))
+        || !in_file(header.names_offset, header.names_size)) {
+        errmessage = fmtformat("\"{}\" is not a valid shader library pack",
+                               filename);
+        return nullptr;
+    }
+
+    const FileEntry* index = (const FileEntry*)(base + header.index_offset);
+    const char* names      = base + header.names_offset;
+    pack->m_index.reserve(header.nshaders);
+    for (uint32_t i = 0; i < header.nshaders; ++i) {
+        const FileEntry& e = index[i];
+        if (e.name_offset > header.names_size
+            || e.name_size > header.names_size - e.name_offset
+            || !in_file(e.data_offset, e.data_size)) {
+            errmessage = fmtformat("\"{}\" has an invalid entry {}", filename,
+                                   i);
+            return nullptr;
+        }
+        ustring name(string_view(names + e.name_offset, e.name_size));
+        pack->m_index.emplace(name, string_view(base + e.data_offset,
+                                                e.data_size));
+    }
+    return pack;
+}
+
+
+
+ShaderLibraryPack::~ShaderLibraryPack()
+{
+    if (!m_map)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(m_map);
+#else
+    munmap(m_map, m_map_size);
+#endif
+}
+
+
+
+string_view
+ShaderLibraryPack::find(ustring name) const
+{
+    auto found = m_index.find(name);
+    return found != m_index.end() ? found->second : string_view();
+}
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
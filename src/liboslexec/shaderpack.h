@@ -0,0 +1,60 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+/// A shader library pack: one read-only ".oslpack" file holding many
+/// compiled masters, each the contents of a .oso or of a binary .osob,
+/// and an index of them by shader name.  Opening a pack maps the file and
+/// reads only the index; a master's bytes are paged in when it is loaded,
+/// so a renderer that ships its whole library as one pack pays one open
+/// and one mapping instead of a search and an open per shader.  Packs
+/// are written by write(), e.g. by "oslc -pack".
+class ShaderLibraryPack {
+public:
+    /// One shader, for write().
+    struct Entry {
+        std::string name;  ///< Name it is loaded by, as in LoadShader
+        std::string data;  ///< Contents of its .oso or .osob
+    };
+
+    /// Map an existing ".oslpack" file.  Return nullptr, and set
+    /// errmessage, if it can't be mapped or isn't a valid pack.
+    static std::unique_ptr<ShaderLibraryPack> open(string_view filename,
+                                                   std::string& errmessage);
+
+    /// Write the shaders as an ".oslpack" file.
+    static bool write(string_view filename, const std::vector<Entry>& shaders,
+                      std::string& errmessage);
+
+    ~ShaderLibraryPack();
+
+    const std::string& filename() const { return m_filename; }
+    size_t size() const { return m_index.size(); }
+
+    /// The compiled master of the named shader, straight from the mapped
+    /// file, or an empty string_view if the pack has no such shader.
+    string_view find(ustring name) const;
+
+private:
+    ShaderLibraryPack() = default;
+
+    void* m_map       = nullptr;
+    size_t m_map_size = 0;
+    std::string m_filename;
+    std::unordered_map<ustring, string_view> m_index;
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
@@ -0,0 +1,205 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#include "oslexec_pvt.h"
+#include "shadingcache.h"
+
+OSL_NAMESPACE_ENTER
+namespace pvt {
+
+
+
+ShadingCache::ShadingCache(size_t budget)
+    : m_shard_budget(std::max(budget / nshards, size_t(1)))
+{
+}
+
+
+
+void
+ShadingCache::insert(const Key& key, Entry&& entry)
+{
+    Shard& shard = m_shards[KeyHash()(key) % nshards];
+    size_t bytes = entry.bytes();
+    if (bytes > m_shard_budget)
+        return;  // Would evict everything else
+    OIIO::spin_lock lock(shard.mutex);
+    if (shard.index.count(key))
+        return;  // Another thread shaded the same point
+    shard.lru.emplace_front(key, std::move(entry));
+    shard.index.emplace(key, shard.lru.begin());
+    shard.bytes += bytes;
+    while (shard.bytes > m_shard_budget) {
+        auto& last = shard.lru.back();
+        shard.bytes -= last.second.bytes();
+        shard.index.erase(last.first);
+        shard.lru.pop_back();
+    }
+}
+
+
+
+size_t
+ShadingCache::bytes() const
+{
+    size_t total = 0;
+    for (const Shard& shard : m_shards) {
+        OIIO::spin_lock lock(shard.mutex);
+        total += shard.bytes;
+    }
+    return total;
+}
+
+
+
+int64_t
+ShadingCache::new_epoch()
+{
+    static std::atomic<int64_t> next_epoch { 0 };
+    return ++next_epoch;
+}
+
+
+
+// The cell of the quantization step q that x falls in, or the bits of x
+// if q isn't positive.
+static inline int32_t
+quantize(float x, float q)
+{
+    if (q > 0.0f) {
+        float cell = std::floor(x / q);
+        return int32_t(OIIO::clamp(cell, -2147483520.0f, 2147483520.0f));
+    }
+    int32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+}  // namespace pvt
+
+
+
+bool
+ShadingContext::shading_cache_key(ShaderGroup& sgroup, int shadeindex,
+                                  ShaderGlobals& ssg, void* userdata_base_ptr,
+                                  void* output_base_ptr,
+                                  ShadingCache::Key& key)
+{
+    ShadingSystemImpl& ss(shadingsys());
+    if (!ss.m_shading_cache || sgroup.has_userdata_variants())
+        return false;
+    ShaderGroup& g(group_to_run(sgroup, ssg, userdata_base_ptr, shadeindex));
+    // The first execution optimizes the group and finds out whether it's
+    // cacheable at all
+    if (!g.jitted() || !g.cacheable())
+        return false;
+    if (!output_base_ptr)
+        for (const auto& s : g.m_symlocs)
+            if (s.arena == SymArena::Outputs && s.offset != -1)
+                return false;  // Nowhere to read its outputs from
+
+    memset(&key, 0, sizeof(key));
+    key.group      = &g;
+    key.epoch      = g.m_shading_cache_epoch;
+    key.raytype    = ssg.raytype;
+    key.backfacing = ssg.backfacing;
+    key.objdata    = ssg.objdata;
+    float q        = ss.m_shading_cache_quantize;
+    float uvq      = ss.m_shading_cache_uv_quantize;
+    key.P[0]       = quantize(ssg.P.x, q);
+    key.P[1]       = quantize(ssg.P.y, q);
+    key.P[2]       = quantize(ssg.P.z, q);
+    key.uv[0]      = quantize(ssg.u, uvq);
+    key.uv[1]      = quantize(ssg.v, uvq);
+    return true;
+}
+
+
+
+bool
+ShadingContext::execute_from_cache(const ShadingCache::Key& key,
+                                   int shadeindex, ShaderGlobals& ssg,
+                                   void* output_base_ptr)
+{
+    ShaderGroup& g(*const_cast<ShaderGroup*>(key.group));
+    bool hit = shadingsys().m_shading_cache->find(
+        key, [&](const ShadingCache::Entry& e) {
+            if (m_group)
+                execute_cleanup();
+            batch_size_executed = 0;
+            m_group             = &g;
+            m_ticks             = 0;
+            reset_execution(0, g.scratch_highwater());
+            ssg.context             = this;
+            ssg.shadingStateUniform = &(shadingsys().m_shading_state_uniform);
+            ssg.renderer            = renderer();
+
+            // Ci as a sum of its components, which flattens to them in the
+            // order they were cached
+            ClosureColor* ci = nullptr;
+            for (const ShadingCache::Closure& c : e.closures) {
+                ClosureComponent* comp = closure_component_allot(c.id, c.size,
+                                                                 c.weight);
+                memcpy(comp->data(), e.params.data() + c.offset, c.size);
+                ci = ci ? (ClosureColor*)closure_add_allot(ci, comp)
+                        : (ClosureColor*)comp;
+            }
+            ssg.Ci = ci;
+
+            const char* out = e.outputs.data();
+            for (const auto& s : g.m_symlocs) {
+                if (s.arena != SymArena::Outputs || s.offset == -1)
+                    continue;
+                size_t size = s.stored_type().size() * (s.derivs ? 3 : 1);
+                memcpy((char*)output_base_ptr + s.offset
+                           + s.stride * shadeindex,
+                       out, size);
+                out += size;
+            }
+        });
+    if (hit)
+        ++shadingsys().m_stat_shading_cache_hits;
+    return hit;
+}
+
+
+
+void
+ShadingContext::cache_result(const ShadingCache::Key& key, int shadeindex,
+                             ShaderGlobals& ssg, void* output_base_ptr)
+{
+    // Results that wait on deferred traces or textures aren't final
+    if (m_shade_deferred
+        || (m_deferred_traces && m_deferred_traces->pending()))
+        return;
+    ShadingSystemImpl& ss(shadingsys());
+    ++ss.m_stat_shading_cache_misses;
+    ShadingCache::Entry e;
+    for (const ClosureFlatComponent& c : flatten_closure(ssg.Ci)) {
+        const ClosureRegistry::ClosureEntry* clentry = ss.find_closure(c.id);
+        if (!clentry)
+            return;  // Not a closure we know the size of
+        uint32_t size   = uint32_t(clentry->struct_size);
+        uint32_t offset = uint32_t(e.params.size());
+        e.closures.push_back({ c.id, c.weight, offset, size });
+        e.params.insert(e.params.end(), (const char*)c.data,
+                        (const char*)c.data + size);
+    }
+    const ShaderGroup& g(*key.group);
+    for (const auto& s : g.m_symlocs) {
+        if (s.arena != SymArena::Outputs || s.offset == -1)
+            continue;
+        size_t size = s.stored_type().size() * (s.derivs ? 3 : 1);
+        const char* data = (const char*)output_base_ptr + s.offset
+                           + s.stride * shadeindex;
+        e.outputs.insert(e.outputs.end(), data, data + size);
+    }
+    ss.m_shading_cache->insert(key, std::move(e));
+}
+
+OSL_NAMESPACE_EXIT
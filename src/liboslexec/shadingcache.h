@@ -0,0 +1,122 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <cstring>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include <OpenImageIO/hash.h>
+#include <OpenImageIO/thread.h>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_ENTER
+
+class ShaderGroup;
+
+namespace pvt {
+
+/// The results of executing cacheable groups (see the "shading_cache_size"
+/// option), by the inputs that are all such a group's results depend on,
+/// so that the many nearly identical points that motion blur and depth
+/// of field shade again are answered without running the group.  Each
+/// entry holds the flattened closures and the placed outputs of one
+/// point.  The least recently used entries are evicted to keep the cache
+/// within its budget.  The cache is split into shards, each with its own
+/// lock, so that threads seldom wait on each other.
+class ShadingCache {
+public:
+    /// What a cacheable group's results depend on.  P and u, v are
+    /// quantized to the cells of the "shading_cache_quantize" and
+    /// "shading_cache_uv_quantize" options.  Keys are compared and hashed
+    /// as bytes, so they must be zeroed, padding and all, before they're
+    /// filled in.
+    struct Key {
+        const ShaderGroup* group;
+        /// The group's new_epoch(), drawn anew by each ReParameter, so a
+        /// group made where a deleted one was never finds its results
+        int64_t epoch;
+        int raytype;
+        int backfacing;
+        void* objdata;
+        int32_t P[3];
+        int32_t uv[2];
+
+        bool operator==(const Key& k) const
+        {
+            return !memcmp(this, &k, sizeof(Key));
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const
+        {
+            return size_t(OIIO::farmhash::Hash64((const char*)&k, sizeof(k)));
+        }
+    };
+
+    /// One component of the cached Ci, its params at offset in params.
+    struct Closure {
+        int id;
+        Color3 weight;
+        uint32_t offset, size;
+    };
+
+    struct Entry {
+        std::vector<Closure> closures;
+        std::vector<char> params;   ///< Params of all the closures
+        std::vector<char> outputs;  ///< The group's placed outputs
+        size_t bytes() const
+        {
+            return sizeof(Entry) + sizeof(Key)
+                   + closures.size() * sizeof(Closure) + params.size()
+                   + outputs.size();
+        }
+    };
+
+    explicit ShadingCache(size_t budget);
+
+    /// Call f(entry) with the cached entry for the key, under the lock of
+    /// its shard, and return true; or return false if there is none.
+    template<typename F> bool find(const Key& key, F&& f)
+    {
+        Shard& shard = m_shards[KeyHash()(key) % nshards];
+        OIIO::spin_lock lock(shard.mutex);
+        auto found = shard.index.find(key);
+        if (found == shard.index.end())
+            return false;
+        // Move it to the front, as the most recently used
+        shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+        f(found->second->second);
+        return true;
+    }
+
+    /// Add the entry for the key, evicting the least recently used.
+    void insert(const Key& key, Entry&& entry);
+
+    /// Bytes held by the entries
+    size_t bytes() const;
+
+    /// An epoch that no group has had before, in any shading system.
+    static int64_t new_epoch();
+
+private:
+    static const int nshards = 16;
+    struct Shard {
+        mutable OIIO::spin_mutex mutex;
+        std::list<std::pair<Key, Entry>> lru;  ///< Most recently used first
+        std::unordered_map<Key, std::list<std::pair<Key, Entry>>::iterator,
+                           KeyHash>
+            index;
+        size_t bytes = 0;
+    };
+    Shard m_shards[nshards];
+    size_t m_shard_budget;
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_EXIT
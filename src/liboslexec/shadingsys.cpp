@@ -2,11 +2,16 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <deque>
 #include <fstream>
 #include <mutex>
+#include <numeric>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "oslexec_pvt.h"
@@ -20,6 +25,7 @@
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/fmath.h>
+#include <OpenImageIO/hash.h>
 #include <OpenImageIO/optparser.h>
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
@@ -27,12 +33,18 @@
 #include <OpenImageIO/timer.h>
 
 #include "opcolor.h"
+#include "shaderpack.h"
 
 using namespace OSL;
 using namespace OSL::pvt;
 
 #include <OpenEXR/ImfChannelList.h>  // Just for OPENEXR_VERSION_STRING
 
+#ifdef __linux__
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
 // avoid naming conflicts with MSVC macros
 #ifdef _MSC_VER
 #    undef RGB
@@ -52,6 +64,35 @@ OSL_NAMESPACE_ENTER
 
 
 
+// The NUMA node of the CPU the calling thread runs on (0 if unknown).
+static int
+current_numa_node()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+        return int(node);
+#endif
+    return 0;
+}
+
+
+
+// The number of NUMA nodes of the machine (1 if unknown).
+static int
+numa_node_count()
+{
+    int n = 0;
+#ifdef __linux__
+    while (OIIO::Filesystem::is_directory(
+        fmtformat("/sys/devices/system/node/node{}", n)))
+        ++n;
+#endif
+    return std::max(n, 1);
+}
+
+
+
 ShadingSystem::ShadingSystem(RendererServices* renderer,
                              TextureSystem* texturesystem, ErrorHandler* err)
     : m_impl(NULL)
@@ -69,6 +110,11 @@ ShadingSystem::ShadingSystem(RendererServices* renderer,
 
 ShadingSystem::~ShadingSystem()
 {
+    if (m_impl->fast_shutdown()) {
+        // Finish all output, but leave the memory to the process exit
+        m_impl->shutdown(true);
+        return;
+    }
     delete m_impl;
 }
 
@@ -117,6 +163,30 @@ ShadingSystem::LoadMemoryCompiledShader(string_view shadername,
 
 
 
+void
+ShadingSystem::prefetch_shaders(cspan<string_view> shadernames)
+{
+    m_impl->prefetch_shaders(shadernames);
+}
+
+
+
+void
+ShadingSystem::prefetch_textures(cspan<ustring> filenames)
+{
+    m_impl->prefetch_textures(filenames);
+}
+
+
+
+std::vector<ustring>
+ShadingSystem::textures_needed() const
+{
+    return m_impl->textures_needed();
+}
+
+
+
 ShaderGroupRef
 ShadingSystem::ShaderGroupBegin(string_view groupname)
 {
@@ -215,6 +285,57 @@ ShadingSystem::ReParameter(ShaderGroup& group, string_view layername,
 
 
 
+bool
+ShadingSystem::ReParameter(ShaderGroup& group, span<ParamEdit> edits,
+                           int* changed_begin, int* changed_end)
+{
+    int begin = 0, end = 0;
+    bool ok = m_impl->ReParameter(group, edits, begin, end);
+    if (changed_begin)
+        *changed_begin = begin;
+    if (changed_end)
+        *changed_end = end;
+    return ok;
+}
+
+
+
+bool
+ShadingSystem::take_interactive_changes(ShaderGroup* group, int& begin,
+                                        int& end)
+{
+    begin = end = 0;
+    return group ? m_impl->take_interactive_changes(*group, begin, end)
+                 : false;
+}
+
+
+
+uint32_t
+ShadingSystem::device_string_index(ustring str)
+{
+    return m_impl->device_string_index(str);
+}
+
+
+
+uint32_t
+ShadingSystem::find_device_string(ustringhash hash) const
+{
+    return m_impl->find_device_string(hash);
+}
+
+
+
+size_t
+ShadingSystem::device_string_table(size_t first,
+                                   std::vector<uint64_t>& hashes) const
+{
+    return m_impl->device_string_table(first, hashes);
+}
+
+
+
 PerThreadInfo*
 ShadingSystem::create_thread_info()
 {
@@ -259,11 +380,36 @@ ShadingSystem::execute(ShadingContext& ctx, ShaderGroup& group, int index,
 
 
 
+bool
+ShadingSystem::execute(ShadingContext& ctx, cspan<ShaderGroup*> groups,
+                       int index, ShaderGlobals& globals,
+                       void* userdata_base_ptr, void* output_base_ptr)
+{
+    return m_impl->execute(ctx, groups, index, globals, userdata_base_ptr,
+                           output_base_ptr);
+}
+
+
+
+bool
+ShadingSystem::execute(ShadingContext& ctx, ShaderGroup& group, int index,
+                       span<ShaderGlobals> globals, void* userdata_base_ptr,
+                       void* output_base_ptr)
+{
+    return m_impl->execute(ctx, group, index, globals, userdata_base_ptr,
+                           output_base_ptr);
+}
+
+
+
 bool
 ShadingSystem::execute_init(ShadingContext& ctx, ShaderGroup& group, int index,
                             ShaderGlobals& globals, void* userdata_base_ptr,
                             void* output_base_ptr, bool run)
 {
+    // Callers running layers one by one start here rather than execute()
+    if (run && ctx.shadingsys().capturing())
+        ctx.shadingsys().capture_point(group, globals);
     return ctx.execute_init(group, index, globals, userdata_base_ptr,
                             output_base_ptr, run);
 }
@@ -319,6 +465,8 @@ ShadingSystem::BatchedExecutor<WidthT>::execute(
     BatchedShaderGlobals<WidthT>& globals_batch, void* userdata_base_ptr,
     void* output_base_ptr, bool run)
 {
+    if (run && ctx.shadingsys().capturing())
+        ctx.shadingsys().capture_batch(group, batch_size, globals_batch);
     return ctx.batched<WidthT>().execute(group, batch_size, wide_shadeindex,
                                          globals_batch, userdata_base_ptr,
                                          output_base_ptr, run);
@@ -383,6 +531,116 @@ ShadingSystem::BatchedExecutor<WidthT>::execute_layer(
                output_base_ptr, layernumber)
                               : false;
 }
+
+
+
+template<int WidthT>
+cspan<ClosureFlatComponent>
+ShadingSystem::BatchedExecutor<WidthT>::flatten_closures(
+    ShadingContext& ctx, int batch_size,
+    const BatchedShaderGlobals<WidthT>& globals_batch, span<int> lane_begins)
+{
+    const ClosureColor* closures[WidthT];
+    batch_size = std::min(std::max(batch_size, 0), WidthT);
+    for (int lane = 0; lane < batch_size; ++lane)
+        closures[lane] = globals_batch.varying.Ci.get(lane);
+    return ctx.flatten_closures(cspan<const ClosureColor*>(closures,
+                                                           batch_size),
+                                lane_begins);
+}
+
+template<int WidthT>
+bool
+ShadingSystem::BatchedExecutor<WidthT>::execute_points(
+    ShadingContext& ctx, cspan<ShadePoint> points, void* userdata_base_ptr,
+    void* output_base_ptr)
+{
+    // Points may only share a batch if everything that is uniform within
+    // a batch matches.
+    auto same_bin = [](const ShadePoint& a, const ShadePoint& b) {
+        return a.group == b.group && a.sg->raytype == b.sg->raytype
+               && a.sg->renderstate == b.sg->renderstate
+               && a.sg->tracedata == b.sg->tracedata
+               && a.sg->objdata == b.sg->objdata;
+    };
+    auto bin_less = [&](int ia, int ib) {
+        const ShadePoint& a = points[ia];
+        const ShadePoint& b = points[ib];
+        std::less<const void*> ptr_less;
+        if (a.group != b.group)
+            return ptr_less(a.group, b.group);
+        if (a.sg->raytype != b.sg->raytype)
+            return a.sg->raytype < b.sg->raytype;
+        if (a.sg->renderstate != b.sg->renderstate)
+            return ptr_less(a.sg->renderstate, b.sg->renderstate);
+        if (a.sg->tracedata != b.sg->tracedata)
+            return ptr_less(a.sg->tracedata, b.sg->tracedata);
+        if (a.sg->objdata != b.sg->objdata)
+            return ptr_less(a.sg->objdata, b.sg->objdata);
+        return a.sortkey < b.sortkey;
+    };
+    // Stable, so that points with equal keys keep the caller's order
+    std::vector<int> order(points.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), bin_less);
+
+    BatchedShaderGlobals<WidthT> bsg;
+    memset(&bsg.uniform, 0, sizeof(UniformShaderGlobals));
+    Block<int, WidthT> wide_shadeindex;
+    bool ok  = true;
+    size_t n = order.size();
+    for (size_t begin = 0; begin < n;) {
+        const ShadePoint& first = points[order[begin]];
+        int batch_size          = 1;
+        while (batch_size < WidthT && begin + batch_size < n
+               && same_bin(first, points[order[begin + batch_size]]))
+            ++batch_size;
+
+        bsg.uniform.renderstate = first.sg->renderstate;
+        bsg.uniform.tracedata   = first.sg->tracedata;
+        bsg.uniform.objdata     = first.sg->objdata;
+        bsg.uniform.raytype     = first.sg->raytype;
+        auto& vsg               = bsg.varying;
+        for (int lane = 0; lane < batch_size; ++lane) {
+            const ShadePoint& point = points[order[begin + lane]];
+            const ShaderGlobals& sg = *point.sg;
+            wide_shadeindex[lane]   = point.shadeindex;
+            vsg.P[lane]             = sg.P;
+            vsg.dPdx[lane]          = sg.dPdx;
+            vsg.dPdy[lane]          = sg.dPdy;
+            vsg.dPdz[lane]          = sg.dPdz;
+            vsg.I[lane]             = sg.I;
+            vsg.dIdx[lane]          = sg.dIdx;
+            vsg.dIdy[lane]          = sg.dIdy;
+            vsg.N[lane]             = sg.N;
+            vsg.Ng[lane]            = sg.Ng;
+            vsg.u[lane]             = sg.u;
+            vsg.dudx[lane]          = sg.dudx;
+            vsg.dudy[lane]          = sg.dudy;
+            vsg.v[lane]             = sg.v;
+            vsg.dvdx[lane]          = sg.dvdx;
+            vsg.dvdy[lane]          = sg.dvdy;
+            vsg.dPdu[lane]          = sg.dPdu;
+            vsg.dPdv[lane]          = sg.dPdv;
+            vsg.time[lane]          = sg.time;
+            vsg.dtime[lane]         = sg.dtime;
+            vsg.dPdtime[lane]       = sg.dPdtime;
+            vsg.Ps[lane]            = sg.Ps;
+            vsg.dPsdx[lane]         = sg.dPsdx;
+            vsg.dPsdy[lane]         = sg.dPsdy;
+            vsg.object2common[lane] = sg.object2common;
+            vsg.shader2common[lane] = sg.shader2common;
+            vsg.Ci[lane]            = sg.Ci;
+            vsg.surfacearea[lane]   = sg.surfacearea;
+            vsg.flipHandedness[lane] = sg.flipHandedness;
+            vsg.backfacing[lane]     = sg.backfacing;
+        }
+        ok &= execute(ctx, *first.group, batch_size, wide_shadeindex, bsg,
+                      userdata_base_ptr, output_base_ptr);
+        begin += batch_size;
+    }
+    return ok;
+}
 #endif
 
 bool
@@ -393,6 +651,40 @@ ShadingSystem::execute_cleanup(ShadingContext& ctx)
 
 
 
+void
+ShadingSystem::deferred_traces(ShadingContext& ctx, DeferredTraces* traces)
+{
+    ctx.deferred_traces(traces);
+}
+
+
+
+bool
+ShadingSystem::shade_deferred(const ShadingContext& ctx) const
+{
+    return ctx.shade_deferred();
+}
+
+
+
+cspan<ClosureFlatComponent>
+ShadingSystem::flatten_closure(ShadingContext& ctx, const ClosureColor* closure)
+{
+    return ctx.flatten_closure(closure);
+}
+
+
+
+cspan<ClosureFlatComponent>
+ShadingSystem::flatten_closures(ShadingContext& ctx,
+                                cspan<const ClosureColor*> closures,
+                                span<int> begins)
+{
+    return ctx.flatten_closures(closures, begins);
+}
+
+
+
 int
 ShadingSystem::find_layer(const ShaderGroup& group, ustring layername) const
 {
@@ -605,6 +897,29 @@ ShadingSystem::configure_batch_execution_at(int width)
                 m_impl->attribute("llvm_jit_fma", 0);
                 return true;
             }
+#    endif
+            if (target_requested) {
+                break;
+            }
+            // fallthrough
+        default: return false;
+        };
+        return false;
+    case 4:
+        switch (requestedISA) {
+        case TargetISA::UNKNOWN:
+            // fallthrough
+        case TargetISA::SSE4_2:
+#    ifdef __OSL_SUPPORTS_b4_SSE4_2
+            if (LLVM_Util::supports_isa(TargetISA::SSE4_2)) {
+                if (!target_requested)
+                    m_impl->attribute("llvm_jit_target",
+                                      LLVM_Util::target_isa_name(
+                                          TargetISA::SSE4_2));
+                // SSE4.2 doesn't support FMA
+                m_impl->attribute("llvm_jit_fma", 0);
+                return true;
+            }
 #    endif
             if (target_requested) {
                 break;
@@ -626,6 +941,14 @@ ShadingSystem::getstats(int level) const
 
 
 
+ShadingSystem::LiveStats
+ShadingSystem::live_stats() const
+{
+    return m_impl->live_stats();
+}
+
+
+
 void
 ShadingSystem::register_closure(string_view name, int id,
                                 const ClosureParam* params,
@@ -706,8 +1029,40 @@ ShadingSystem::raytype_bit(ustring name)
 void
 ShadingSystem::optimize_all_groups(int nthreads, bool do_jit)
 {
-    return m_impl->optimize_all_groups(nthreads, 0 /*mythread*/,
-                                       1 /*totalthreads*/, do_jit);
+    return m_impl->optimize_all_groups(nthreads, do_jit);
+}
+
+
+
+bool
+ShadingSystem::optimize_group_async(ShaderGroup* group, int priority)
+{
+    return group ? m_impl->optimize_group_async(*group, priority) : false;
+}
+
+
+
+bool
+ShadingSystem::cancel_optimize_group(ShaderGroup* group)
+{
+    return group ? m_impl->cancel_optimize_group(*group) : false;
+}
+
+
+
+ShadingSystem::CompileStatus
+ShadingSystem::compile_status(ShaderGroup* group) const
+{
+    return group ? CompileStatus(group->m_async_status.load())
+                 : CompileStatus::None;
+}
+
+
+
+bool
+ShadingSystem::wait_optimize_group(ShaderGroup* group, float timeout)
+{
+    return group ? m_impl->wait_optimize_group(*group, timeout) : false;
 }
 
 
@@ -746,6 +1101,22 @@ ShadingSystem::archive_shadergroup(ShaderGroup& group, string_view filename)
 }
 
 
+
+bool
+ShadingSystem::save_group_snapshot(ShaderGroup& group, string_view filename)
+{
+    return m_impl->save_group_snapshot(group, filename);
+}
+
+
+
+bool
+ShadingSystem::load_group_snapshot(ShaderGroup& group, string_view filename)
+{
+    return m_impl->load_group_snapshot(group, filename);
+}
+
+
 void
 ShadingSystem::set_raytypes(ShaderGroup* group, int raytypes_on,
                             int raytypes_off)
@@ -755,6 +1126,49 @@ ShadingSystem::set_raytypes(ShaderGroup* group, int raytypes_on,
 }
 
 
+bool
+ShadingSystem::add_raytype_variant(ShaderGroup* group, int raytypes_on,
+                                   int raytypes_off)
+{
+    return group ? m_impl->add_raytype_variant(*group, raytypes_on,
+                                               raytypes_off)
+                 : false;
+}
+
+
+
+bool
+ShadingSystem::add_userdata_variant(ShaderGroup* group, string_view name,
+                                    TypeDesc type, const void* val)
+{
+    return group ? m_impl->add_userdata_variant(*group, ustring(name), type,
+                                                val)
+                 : false;
+}
+
+
+
+ShaderGroupRef
+ShadingSystem::output_variant(ShaderGroup* group, cspan<ustring> outputs)
+{
+    return group ? m_impl->output_variant(*group, outputs) : ShaderGroupRef();
+}
+
+
+bool
+ShadingSystem::set_raytype_closures(ustring raytype, cspan<int> closure_ids)
+{
+    return m_impl->set_raytype_closures(raytype, closure_ids);
+}
+
+
+bool
+ShadingSystem::set_raytype_noderivs(ustring raytype, float texture_width)
+{
+    return m_impl->set_raytype_noderivs(raytype, texture_width);
+}
+
+
 void
 ShadingSystem::clear_symlocs()
 {
@@ -763,6 +1177,30 @@ ShadingSystem::clear_symlocs()
 
 
 
+void
+ShadingSystem::invalidate_attribute_cache()
+{
+    m_impl->invalidate_attribute_cache();
+}
+
+
+
+void
+ShadingSystem::flush_pointclouds()
+{
+    m_impl->flush_pointclouds();
+}
+
+
+
+void
+ShadingSystem::flush_capture()
+{
+    m_impl->flush_capture();
+}
+
+
+
 void
 ShadingSystem::clear_symlocs(ShaderGroup* group)
 {
@@ -827,12 +1265,13 @@ template<int WidthT>
 void
 ShadingSystem::BatchedExecutor<WidthT>::jit_all_groups(int nthreads)
 {
-    OSL_ASSERT(0 && "To Be Implemented");
+    m_shading_system.m_impl->batched<WidthT>().jit_all_groups(nthreads);
 }
 
 // Explicitly instantiate
 template class ShadingSystem::BatchedExecutor<16>;
 template class ShadingSystem::BatchedExecutor<8>;
+template class ShadingSystem::BatchedExecutor<4>;
 #endif
 
 
@@ -982,6 +1421,12 @@ namespace Strings {
 namespace pvt {  // OSL::pvt
 
 
+std::atomic<bool> LockStats::enabled { false };
+std::atomic<long long> LockStats::wait_ticks[int(LockSite::NSites)];
+std::atomic<long long> LockStats::acquires[int(LockSite::NSites)];
+
+
+
 ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
                                      TextureSystem* texturesystem,
                                      ErrorHandler* err)
@@ -989,25 +1434,32 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_texturesys(texturesystem)
     , m_err(err)
     , m_statslevel(0)
+    , m_fast_shutdown(false)
     , m_lazylayers(true)
     , m_lazyglobals(true)
     , m_lazyunconnected(true)
     , m_lazyerror(true)
     , m_lazy_userdata(false)
     , m_userdata_isconnected(false)
+    , m_attribute_cache(false)
+    , m_regex_optimize(true)
     , m_clearmemory(false)
     , m_debugnan(false)
     , m_debug_uninit(false)
+    , m_debug_sample(1)
     , m_lockgeom_default(true)
     , m_strict_messages(true)
     , m_error_repeats(false)
     , m_range_checking(true)
     , m_connection_error(true)
     , m_greedyjit(false)
+    , m_prefetch_textures(false)
     , m_countlayerexecs(false)
     , m_relaxed_param_typecheck(false)
     , m_max_warnings_per_thread(100)
     , m_profile(0)
+    , m_profile_instrument(0)
+    , m_lock_stats(false)
     , m_optimize(2)
     , m_opt_simplify_param(true)
     , m_opt_constant_fold(true)
@@ -1021,24 +1473,51 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_opt_merge_instances(1)
     , m_opt_merge_instances_with_userdata(true)
     , m_opt_fold_getattribute(true)
+    , m_opt_fold_gettextureinfo(true)
+    , m_opt_batch_getattribute(true)
     , m_opt_middleman(true)
+    , m_opt_alias_connections(true)
+    , m_opt_shared_constant_arrays(64)
+    , m_opt_texture_reuse(true)
+    , m_opt_unroll_loops(8)
     , m_opt_texture_handle(true)
     , m_opt_seed_bblock_aliases(true)
     , m_opt_useparam(false)
     ,
 #if OSL_USE_BATCHED
     m_opt_batched_analysis((renderer->batched(WidthOf<16>()) != nullptr)
-                           || (renderer->batched(WidthOf<8>()) != nullptr))
+                           || (renderer->batched(WidthOf<8>()) != nullptr)
+                           || (renderer->batched(WidthOf<4>()) != nullptr))
     ,
 #else
     m_opt_batched_analysis(false)
     ,
 #endif
-    m_llvm_jit_fma(false)
+    m_opt_batched_compaction(false)
+    , m_batched_uniformity_profile(false)
+    , m_batched_min_ops(16)
+    , m_batched_max_divergence(50)
+    , m_llvm_jit_fma(false)
     , m_llvm_jit_aggressive(false)
+    , m_llvm_vector_triples(false)
+    , m_llvm_jit_orc(false)
+    , m_jit_huge_pages(false)
+    , m_llvm_jit_threads(0)
+    , m_llvm_jit_lazy(false)
+    , m_llvm_shared_shadeops(false)
+    , m_llvm_inline_max_cost(0)
+    , m_tiered_jit(false)
+    , m_tiered_jit_profile(0)
+    , m_raytype_variant_threshold(0)
+    , m_async_compile_threads(1)
+    , m_async_placeholder(false)
+    , m_opt_share_groups(false)
+    , m_reparam_reoptimize(false)
+    , m_jit_release_memory(false)
     , m_optimize_nondebug(false)
     , m_vector_width(4)
     , m_opt_passes(10)
+    , m_opt_parallel_layers(8)
     , m_llvm_optimize(1)
     , m_debug(0)
     , m_llvm_debug(0)
@@ -1049,20 +1528,39 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_llvm_profiling_events(0)
     , m_llvm_output_bitcode(0)
     , m_llvm_dumpasm(0)
+    , m_jit_cache_wait(0)
+    , m_jit_memory_budget_MB(0)
+    , m_jit_free_with_group(false)
+    , m_jit_share_layers(false)
     , m_max_local_mem_KB(2048)
+    , m_context_pool_size(64)
+    , m_numa_aware(0)
+    , m_numa_nodes(1)
     , m_compile_report(0)
     , m_use_optix(renderer->supports("OptiX"))
+    , m_transform_cache(renderer->supports("transform_cache"))
     , m_buffer_printf(true)
+    , m_printf_async(false)
+    , m_printf_sample(0)
+    , m_printf_rate_limit(0)
     , m_no_noise(false)
     , m_no_pointcloud(false)
     , m_force_derivs(false)
     , m_allow_shader_replacement(false)
     , m_exec_repeat(1)
+    , m_capture_every(1)
+    , m_capture_max(1000000)
     , m_opt_warnings(0)
     , m_gpu_opt_error(0)
     , m_colorspace("Rec709")
     , m_stat_opt_locking_time(0)
     , m_stat_specialization_time(0)
+    , m_stat_opt_prepare_time(0)
+    , m_stat_opt_forward_time(0)
+    , m_stat_opt_backward_time(0)
+    , m_stat_opt_postopt_time(0)
+    , m_stat_opt_collapse_time(0)
+    , m_stat_opt_inventory_time(0)
     , m_stat_total_llvm_time(0)
     , m_stat_llvm_setup_time(0)
     , m_stat_llvm_irgen_time(0)
@@ -1076,6 +1574,7 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
 
     m_stat_shaders_loaded                    = 0;
     m_stat_shaders_requested                 = 0;
+    m_stat_masters_shared                    = 0;
     m_stat_groups                            = 0;
     m_stat_groupinstances                    = 0;
     m_stat_instances_compiled                = 0;
@@ -1091,18 +1590,47 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_stat_preopt_ops                        = 0;
     m_stat_postopt_ops                       = 0;
     m_stat_middlemen_eliminated              = 0;
+    m_stat_connections_aliased               = 0;
+    m_stat_shared_constant_bytes             = 0;
     m_stat_const_connections                 = 0;
     m_stat_global_connections                = 0;
     m_stat_tex_calls_codegened               = 0;
     m_stat_tex_calls_as_handles              = 0;
     m_stat_useparam_ops                      = 0;
     m_stat_call_layers_inserted              = 0;
+    m_stat_jit_cache_hits                    = 0;
+    m_stat_jit_cache_misses                  = 0;
+    m_stat_jit_cache_stores                  = 0;
+    m_stat_jit_cache_waits                   = 0;
+    m_stat_jit_cache_variant_hits            = 0;
+    m_stat_jit_cache_variants_stored         = 0;
+    m_stat_jit_cache_fetches                 = 0;
+    m_stat_jit_cache_shared                  = 0;
+    m_stat_groups_tiered_up                  = 0;
+    m_stat_raytype_variants_compiled         = 0;
+    m_stat_groups_shared                     = 0;
+    m_stat_groups_evicted                    = 0;
+    m_stat_groups_rejitted                   = 0;
+    m_stat_reparam_reopts                    = 0;
+    m_stat_reparam_noops                     = 0;
+    m_stat_shadeops_linked                   = 0;
+    m_stat_layers_shared                     = 0;
+    m_stat_inline_calls_decided              = 0;
+    m_stat_batched_compaction_points         = 0;
     m_stat_master_load_time                  = 0;
     m_stat_optimization_time                 = 0;
     m_stat_getattribute_time                 = 0;
     m_stat_getattribute_fail_time            = 0;
     m_stat_getattribute_calls                = 0;
     m_stat_get_userdata_calls                = 0;
+    m_stat_attribute_cache_hits              = 0;
+    m_attribute_cache_epoch                  = 0;
+    m_stat_transform_cache_hits              = 0;
+    m_stat_shading_cache_hits                = 0;
+    m_stat_shading_cache_misses              = 0;
+    m_stat_shades_deferred                   = 0;
+    m_stat_llvm_preopt_insts                 = 0;
+    m_stat_llvm_postopt_insts                = 0;
     m_stat_noise_calls                       = 0;
     m_stat_pointcloud_searches               = 0;
     m_stat_pointcloud_searches_total_results = 0;
@@ -1116,6 +1644,16 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_groups_to_compile_count     = 0;
     m_threads_currently_compiling = 0;
 
+    // Both clocks start now, to measure the rate of profile_clock()
+    m_profile_clock_start = profile_clock();
+    m_profile_time_start  = std::chrono::steady_clock::now();
+
+    // The standard strings start the device string table, in order, so
+    // that their indices are the same in every ShadingSystem.
+#define STRDECL(str, var_name) device_string_index(Strings::var_name);
+#include <OSL/strdecls.h>
+#undef STRDECL
+
     // If client didn't supply an error handler, just use the default
     // one that echoes to the terminal.
     if (!m_err) {
@@ -1149,6 +1687,10 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     if (llvm_debug_env && *llvm_debug_env)
         m_llvm_debug = atoi(llvm_debug_env);
 
+    m_context_pool.reset(new std::atomic<ShadingContext*>[m_context_pool_max]);
+    for (int i = 0; i < m_context_pool_max; ++i)
+        m_context_pool[i] = nullptr;
+
     // Initialize a default set of raytype names.  A particular renderer
     // can override this, add custom names, or change the bits around,
     // if this default ordering is not to its liking.
@@ -1235,7 +1777,7 @@ shading_system_setup_op_descriptors(
     OP (cross,       generic,             none,          true,      0);
     OP (degrees,     generic,             degrees,       true,      0);
     OP (determinant, generic,             none,          true,      0);
-    OP (dict_find,   dict_find,           none,          false,     0);
+    OP (dict_find,   dict_find,           dict_find,     false,     0);
     OP (dict_next,   dict_next,           none,          false,     0);
     OP (dict_value,  dict_value,          none,          false,     0);
     OP (distance,    generic,             none,          true,      0);
@@ -1315,7 +1857,7 @@ shading_system_setup_op_descriptors(
     OP (psnoise,     noise,               noise,         true,      0);
     OP (radians,     generic,             radians,       true,      0);
     OP (raytype,     raytype,             raytype,       true,      0);
-    OP (regex_match, regex,               none,          false,     STRCHARS);
+    OP (regex_match, regex,               regex_match,   false,     STRCHARS);
     OP (regex_search, regex,              regex_search,  false,     STRCHARS);
     OP (return,      return,              none,          false,     0);
     OP (round,       generic,             none,          true,      0);
@@ -1427,29 +1969,57 @@ ShadingSystemImpl::query_closure(const char** name, int* id,
 
 ShadingSystemImpl::~ShadingSystemImpl()
 {
-    size_t ngroups = m_all_shader_groups.size();
-    for (size_t i = 0; i < ngroups; ++i) {
-        if (ShaderGroupRef g = m_all_shader_groups[i].lock()) {
+    shutdown(false);
+
+    // FIXME(boulos): According to the docs, we should also call
+    // llvm_shutdown once we're done. However, ~ShadingSystemImpl
+    // seems like the wrong place for this since in a multi-threaded
+    // implementation we might destroy this impl while having others
+    // outstanding. I'll leave this as a fixme for now.
+
+    //llvm::llvm_shutdown();
+}
+
+
+
+void
+ShadingSystemImpl::shutdown(bool fast)
+{
+    async_compile_shutdown();
+    tierup_shutdown();
+    // Background prefetches refer to us, so let them finish.
+    std::vector<std::future<void>> prefetches;
+    {
+        spin_lock lock(m_prefetch_mutex);
+        prefetches.swap(m_prefetch_tasks);
+    }
+    for (auto& f : prefetches)
+        f.wait();
+
+    for (int i = 0; i < m_context_pool_max; ++i)
+        delete m_context_pool[i].exchange(nullptr);
+    // After the contexts, whose last output it still has to print
+    printf_shutdown();
+
+    // Past here, a fast shutdown only writes what's still buffered.
+    if (!fast) {
+        for (const ShaderGroupRef& g : all_shader_groups()) {
             if (!g->jitted() || !g->batch_jitted()) {
-                // As we are now lazier in jitting and need to keep the OSL IR
-                // around in case we want to create a batched JIT or vice versa
-                // we may have OSL IR to cleanup
+                // As we are now lazier in jitting and need to keep the OSL
+                // IR around in case we want to create a batched JIT or vice
+                // versa we may have OSL IR to cleanup
                 group_post_jit_cleanup(*g);
             }
         }
     }
 
+    flush_pointclouds();
+    flush_capture();
+    if (!fast)
+        free_dict_resources();
     printstats();
     // N.B. just let m_texsys go -- if we asked for one to be created,
     // we asked for a shared one.
-
-    // FIXME(boulos): According to the docs, we should also call
-    // llvm_shutdown once we're done. However, ~ShadingSystemImpl
-    // seems like the wrong place for this since in a multi-threaded
-    // implementation we might destroy this impl while having others
-    // outstanding. I'll leave this as a fixme for now.
-
-    //llvm::llvm_shutdown();
 }
 
 
@@ -1506,6 +2076,7 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
 
     lock_guard guard(m_mutex);  // Thread safety
     ATTR_SET("statistics:level", int, m_statslevel);
+    ATTR_SET("fast_shutdown", int, m_fast_shutdown);
     ATTR_SET("debug", int, m_debug);
     ATTR_SET("lazylayers", int, m_lazylayers);
     ATTR_SET("lazyglobals", int, m_lazyglobals);
@@ -1513,12 +2084,22 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("lazyerror", int, m_lazyerror);
     ATTR_SET("lazy_userdata", int, m_lazy_userdata);
     ATTR_SET("userdata_isconnected", int, m_userdata_isconnected);
+    ATTR_SET("attribute_cache", int, m_attribute_cache);
+    ATTR_SET("regex_optimize", int, m_regex_optimize);
     ATTR_SET("clearmemory", int, m_clearmemory);
     ATTR_SET("debug_nan", int, m_debugnan);
     ATTR_SET("debugnan", int, m_debugnan);  // back-compatible alias
     ATTR_SET("debug_uninit", int, m_debug_uninit);
+    ATTR_SET("debug_sample", int, m_debug_sample);
     ATTR_SET("lockgeom", int, m_lockgeom_default);
     ATTR_SET("profile", int, m_profile);
+    ATTR_SET("profile_instrument", int, m_profile_instrument);
+    if (name == "lock_stats" && type == TypeDesc::INT) {
+        m_lock_stats = *(const int*)val;
+        if (m_lock_stats)
+            LockStats::enabled = true;
+        return true;
+    }
     ATTR_SET("optimize", int, m_optimize);
     ATTR_SET("opt_simplify_param", int, m_opt_simplify_param);
     ATTR_SET("opt_constant_fold", int, m_opt_constant_fold);
@@ -1534,16 +2115,46 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("opt_merge_instances_with_userdata", int,
              m_opt_merge_instances_with_userdata);
     ATTR_SET("opt_fold_getattribute", int, m_opt_fold_getattribute);
+    ATTR_SET("opt_fold_gettextureinfo", int, m_opt_fold_gettextureinfo);
+    ATTR_SET("opt_batch_getattribute", int, m_opt_batch_getattribute);
     ATTR_SET("opt_middleman", int, m_opt_middleman);
+    ATTR_SET("opt_alias_connections", int, m_opt_alias_connections);
+    ATTR_SET("opt_shared_constant_arrays", int, m_opt_shared_constant_arrays);
+    ATTR_SET("opt_texture_reuse", int, m_opt_texture_reuse);
+    ATTR_SET("opt_unroll_loops", int, m_opt_unroll_loops);
     ATTR_SET("opt_texture_handle", int, m_opt_texture_handle);
     ATTR_SET("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
     ATTR_SET("opt_useparam", int, m_opt_useparam);
     ATTR_SET("opt_batched_analysis", int, m_opt_batched_analysis);
+    ATTR_SET("opt_batched_compaction", int, m_opt_batched_compaction);
+    ATTR_SET("batched_uniformity_profile", int, m_batched_uniformity_profile);
+    ATTR_SET("batched_min_ops", int, m_batched_min_ops);
+    ATTR_SET("batched_max_divergence", int, m_batched_max_divergence);
     ATTR_SET("llvm_jit_fma", int, m_llvm_jit_fma);
     ATTR_SET("llvm_jit_aggressive", int, m_llvm_jit_aggressive);
+    ATTR_SET("llvm_vector_triples", int, m_llvm_vector_triples);
+    ATTR_SET("llvm_jit_orc", int, m_llvm_jit_orc);
+    if (name == "jit_huge_pages" && type == TypeDesc::INT) {
+        m_jit_huge_pages = *(const int*)val;
+        LLVM_Util::use_jit_huge_pages(m_jit_huge_pages);
+        return true;
+    }
+    ATTR_SET("llvm_jit_threads", int, m_llvm_jit_threads);
+    ATTR_SET("llvm_jit_lazy", int, m_llvm_jit_lazy);
+    ATTR_SET("llvm_shared_shadeops", int, m_llvm_shared_shadeops);
+    ATTR_SET("llvm_inline_max_cost", int, m_llvm_inline_max_cost);
+    ATTR_SET("tiered_jit", int, m_tiered_jit);
+    ATTR_SET("tiered_jit_profile", int, m_tiered_jit_profile);
+    ATTR_SET("raytype_variant_threshold", int, m_raytype_variant_threshold);
+    ATTR_SET("async_compile_threads", int, m_async_compile_threads);
+    ATTR_SET("async_placeholder", int, m_async_placeholder);
+    ATTR_SET("opt_share_groups", int, m_opt_share_groups);
+    ATTR_SET("reparam_reoptimize", int, m_reparam_reoptimize);
+    ATTR_SET("jit_release_memory", int, m_jit_release_memory);
     ATTR_SET_STRING("llvm_jit_target", m_llvm_jit_target);
     ATTR_SET("vector_width", int, m_vector_width);
     ATTR_SET("opt_passes", int, m_opt_passes);
+    ATTR_SET("opt_parallel_layers", int, m_opt_parallel_layers);
     ATTR_SET("optimize_nondebug", int, m_optimize_nondebug);
     ATTR_SET("llvm_optimize", int, m_llvm_optimize);
     ATTR_SET("llvm_debug", int, m_llvm_debug);
@@ -1555,23 +2166,47 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("llvm_output_bitcode", int, m_llvm_output_bitcode);
     ATTR_SET("llvm_dumpasm", int, m_llvm_dumpasm);
     ATTR_SET_STRING("llvm_prune_ir_strategy", m_llvm_prune_ir_strategy);
+    ATTR_SET_STRING("llvm_pass_pipeline", m_llvm_pass_pipeline);
+    ATTR_SET_STRING("jit_cache_dir", m_jit_cache_dir);
+    ATTR_SET("jit_cache_wait", int, m_jit_cache_wait);
+    ATTR_SET_STRING("jit_cache_targets", m_jit_cache_targets);
+    ATTR_SET("jit_memory_budget_MB", int, m_jit_memory_budget_MB);
+    ATTR_SET("jit_free_with_group", int, m_jit_free_with_group);
+    ATTR_SET("jit_share_layers", int, m_jit_share_layers);
     ATTR_SET("strict_messages", int, m_strict_messages);
     ATTR_SET("range_checking", int, m_range_checking);
     ATTR_SET("unknown_coordsys_error", int,
              m_shading_state_uniform.m_unknown_coordsys_error);
     ATTR_SET("connection_error", int, m_connection_error);
     ATTR_SET("greedyjit", int, m_greedyjit);
+    ATTR_SET("prefetch_textures", int, m_prefetch_textures);
     ATTR_SET("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_SET("countlayerexecs", int, m_countlayerexecs);
     ATTR_SET("max_warnings_per_thread", int, m_max_warnings_per_thread);
     ATTR_SET("max_local_mem_KB", int, m_max_local_mem_KB);
-    ATTR_SET("compile_report", int, m_compile_report);
-    ATTR_SET("buffer_printf", int, m_buffer_printf);
+    if (name == "context_pool_size" && type == TypeDesc::INT) {
+        m_context_pool_size = OIIO::clamp(*(const int*)val, 0,
+                                          int(m_context_pool_max));
+        return true;
+    }
+    if (name == "numa_aware" && type == TypeDesc::INT) {
+        m_numa_aware = *(const int*)val;
+        m_numa_nodes = m_numa_aware ? numa_node_count() : 1;
+        return true;
+    }
+    ATTR_SET("compile_report", int, m_compile_report);
+    ATTR_SET("buffer_printf", int, m_buffer_printf);
+    ATTR_SET("printf_async", int, m_printf_async);
+    ATTR_SET("printf_sample", int, m_printf_sample);
+    ATTR_SET("printf_rate_limit", int, m_printf_rate_limit);
     ATTR_SET("no_noise", int, m_no_noise);
     ATTR_SET("no_pointcloud", int, m_no_pointcloud);
+    ATTR_SET("texture_stochastic", int, m_texture_stochastic);
     ATTR_SET("force_derivs", int, m_force_derivs);
     ATTR_SET("allow_shader_replacement", int, m_allow_shader_replacement);
     ATTR_SET("exec_repeat", int, m_exec_repeat);
+    ATTR_SET("capture_every", int, m_capture_every);
+    ATTR_SET("capture_max", int, m_capture_max);
     ATTR_SET("opt_warnings", int, m_opt_warnings);
     ATTR_SET("gpu_opt_error", int, m_gpu_opt_error);
     ATTR_SET_STRING("commonspace",
@@ -1587,6 +2222,50 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     if (name == "searchpath:shader" && type == TypeDesc::STRING) {
         m_searchpath = std::string(*(const char**)val);
         OIIO::Filesystem::searchpath_split(m_searchpath, m_searchpath_dirs);
+        clear_shader_file_index();
+        return true;
+    }
+    if (name == "searchpath:manifest" && type == TypeDesc::STRING) {
+        m_searchpath_manifest = std::string(*(const char**)val);
+        clear_shader_file_index();
+        return true;
+    }
+    if (name == "searchpath_index" && type == TypeDesc::INT) {
+        m_searchpath_index = *(const int*)val;
+        clear_shader_file_index();
+        return true;
+    }
+    if (name == "shader_library_pack" && type == TypeDesc::STRING) {
+        std::string filename(*(const char**)val);
+        std::shared_ptr<ShaderLibraryPack> pack;
+        if (filename.size()) {
+            std::string err;
+            pack = ShaderLibraryPack::open(filename, err);
+            if (!pack) {
+                errorfmt("Could not mount shader library pack: {}", err);
+                return false;
+            }
+        }
+        spin_lock lock(m_shader_library_pack_mutex);
+        m_shader_library_pack_name = filename;
+        m_shader_library_pack      = std::move(pack);
+        return true;
+    }
+    if (name == "shading_cache_size" && type == TypeDesc::INT) {
+        m_shading_cache_size = std::max(*(const int*)val, 0);
+        // Drop what was cached, which also drops any budget it was over
+        m_shading_cache.reset(
+            m_shading_cache_size
+                ? new ShadingCache(size_t(m_shading_cache_size) << 20)
+                : nullptr);
+        return true;
+    }
+    ATTR_SET("shading_cache_quantize", float, m_shading_cache_quantize);
+    ATTR_SET("shading_cache_uv_quantize", float, m_shading_cache_uv_quantize);
+    if (name == "capture" && type == TypeDesc::STRING) {
+        // Finish the files of any earlier capture, rather than append
+        flush_capture();
+        m_capture = ustring(*(const char**)val);
         return true;
     }
     if (name == "searchpath:library" && type == TypeDesc::STRING) {
@@ -1595,6 +2274,23 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
                                            m_library_searchpath_dirs);
         return true;
     }
+    if (name == "math_precision" && type == TypeDesc::STRING) {
+        ustring p = ustring(*(const char**)val);
+        if (p.empty() || p == "fast" || p == "exact")
+            m_math_precision = p;
+        else
+            errorfmt("Unknown math_precision \"{}\"", p);
+        return true;
+    }
+    if (name == "optix_entry_points" && type == TypeDesc::STRING) {
+        ustring p = ustring(*(const char**)val);
+        if (p.empty() || p == "direct" || p == "continuation"
+            || p == "inline")
+            m_optix_entry_points = p;
+        else
+            errorfmt("Unknown optix_entry_points \"{}\"", p);
+        return true;
+    }
     if (name == "colorspace" && type == TypeDesc::STRING) {
         ustring c = ustring(*(const char**)val);
         if (colorsystem().set_colorspace(c))
@@ -1644,11 +2340,35 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
         return true;
     }
 
+    if (name == "compile_thread_pool" && type.basetype == TypeDesc::PTR) {
+        m_compile_thread_pool = *(OIIO::thread_pool* const*)val;
+        return true;
+    }
+    if (name == "jit_cache_backend" && type.basetype == TypeDesc::PTR) {
+        m_jit_cache_backend = *(JITCacheBackend* const*)val;
+        return true;
+    }
+    if (name == "jit_cache_redis" && type == TypeDesc::STRING) {
+        // "host[:port]", or "" for none
+        m_jit_cache_redis = ustring(*(const char**)val);
+        auto hostport     = Strutil::splitsv(m_jit_cache_redis, ":", 2);
+        int port = hostport.size() > 1 ? Strutil::stoi(hostport[1]) : 6379;
+        m_jit_cache_redis_backend.reset(
+            m_jit_cache_redis.size() ? new RedisJITCache(hostport[0], port)
+                                     : nullptr);
+        m_jit_cache_backend = m_jit_cache_redis_backend.get();
+        return true;
+    }
+
     if (name == "error_repeats") {
         // Special case: setting error_repeats also clears the "previously
         // seen" error and warning lists.
-        m_errseen.clear();
-        m_warnseen.clear();
+        {
+            lock_guard guard(m_errmutex);
+            m_errseen.clear();
+            m_warnseen.clear();
+            ++m_errseen_epoch;
+        }
         ATTR_SET("error_repeats", int, m_error_repeats);
     }
 
@@ -1676,19 +2396,28 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     lock_guard guard(m_mutex);  // Thread safety
 
     ATTR_DECODE_STRING("searchpath:shader", m_searchpath);
+    ATTR_DECODE_STRING("searchpath:manifest", m_searchpath_manifest);
+    ATTR_DECODE("searchpath_index", int, m_searchpath_index);
+    ATTR_DECODE_STRING("shader_library_pack", m_shader_library_pack_name);
     ATTR_DECODE_STRING("searchpath:library", m_library_searchpath);
     ATTR_DECODE("statistics:level", int, m_statslevel);
+    ATTR_DECODE("fast_shutdown", int, m_fast_shutdown);
     ATTR_DECODE("lazylayers", int, m_lazylayers);
     ATTR_DECODE("lazyglobals", int, m_lazyglobals);
     ATTR_DECODE("lazyunconnected", int, m_lazyunconnected);
     ATTR_DECODE("lazy_userdata", int, m_lazy_userdata);
     ATTR_DECODE("userdata_isconnected", int, m_userdata_isconnected);
+    ATTR_DECODE("attribute_cache", int, m_attribute_cache);
+    ATTR_DECODE("regex_optimize", int, m_regex_optimize);
     ATTR_DECODE("clearmemory", int, m_clearmemory);
     ATTR_DECODE("debug_nan", int, m_debugnan);
     ATTR_DECODE("debugnan", int, m_debugnan);  // back-compatible alias
     ATTR_DECODE("debug_uninit", int, m_debug_uninit);
+    ATTR_DECODE("debug_sample", int, m_debug_sample);
     ATTR_DECODE("lockgeom", int, m_lockgeom_default);
     ATTR_DECODE("profile", int, m_profile);
+    ATTR_DECODE("profile_instrument", int, m_profile_instrument);
+    ATTR_DECODE("lock_stats", int, m_lock_stats);
     ATTR_DECODE("optimize", int, m_optimize);
     ATTR_DECODE("opt_simplify_param", int, m_opt_simplify_param);
     ATTR_DECODE("opt_constant_fold", int, m_opt_constant_fold);
@@ -1704,15 +2433,44 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("opt_merge_instances_with_userdata", int,
                 m_opt_merge_instances_with_userdata);
     ATTR_DECODE("opt_fold_getattribute", int, m_opt_fold_getattribute);
+    ATTR_DECODE("opt_fold_gettextureinfo", int, m_opt_fold_gettextureinfo);
+    ATTR_DECODE("opt_batch_getattribute", int, m_opt_batch_getattribute);
     ATTR_DECODE("opt_middleman", int, m_opt_middleman);
+    ATTR_DECODE("opt_alias_connections", int, m_opt_alias_connections);
+    ATTR_DECODE("opt_shared_constant_arrays", int,
+                m_opt_shared_constant_arrays);
+    ATTR_DECODE("opt_texture_reuse", int, m_opt_texture_reuse);
+    ATTR_DECODE("opt_unroll_loops", int, m_opt_unroll_loops);
     ATTR_DECODE("opt_texture_handle", int, m_opt_texture_handle);
     ATTR_DECODE("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
     ATTR_DECODE("opt_useparam", int, m_opt_useparam);
+    ATTR_DECODE("batched_uniformity_profile", int,
+                m_batched_uniformity_profile);
+    ATTR_DECODE("batched_min_ops", int, m_batched_min_ops);
+    ATTR_DECODE("batched_max_divergence", int, m_batched_max_divergence);
     ATTR_DECODE("llvm_jit_fma", int, m_llvm_jit_fma);
     ATTR_DECODE("llvm_jit_aggressive", int, m_llvm_jit_aggressive);
+    ATTR_DECODE("llvm_vector_triples", int, m_llvm_vector_triples);
+    ATTR_DECODE("llvm_jit_orc", int, m_llvm_jit_orc);
+    ATTR_DECODE("jit_huge_pages", int, m_jit_huge_pages);
+    ATTR_DECODE("llvm_jit_threads", int, m_llvm_jit_threads);
+    ATTR_DECODE("llvm_jit_lazy", int, m_llvm_jit_lazy);
+    ATTR_DECODE("llvm_shared_shadeops", int, m_llvm_shared_shadeops);
+    ATTR_DECODE("llvm_inline_max_cost", int, m_llvm_inline_max_cost);
+    ATTR_DECODE("tiered_jit", int, m_tiered_jit);
+    ATTR_DECODE("tiered_jit_profile", int, m_tiered_jit_profile);
+    ATTR_DECODE("raytype_variant_threshold", int, m_raytype_variant_threshold);
+    ATTR_DECODE("async_compile_threads", int, m_async_compile_threads);
+    ATTR_DECODE("async_placeholder", int, m_async_placeholder);
+    ATTR_DECODE("opt_share_groups", int, m_opt_share_groups);
+    ATTR_DECODE("reparam_reoptimize", int, m_reparam_reoptimize);
+    ATTR_DECODE("jit_release_memory", int, m_jit_release_memory);
     ATTR_DECODE_STRING("llvm_jit_target", m_llvm_jit_target);
+    ATTR_DECODE_STRING("math_precision", m_math_precision);
+    ATTR_DECODE_STRING("optix_entry_points", m_optix_entry_points);
     ATTR_DECODE("vector_width", int, m_vector_width);
     ATTR_DECODE("opt_passes", int, m_opt_passes);
+    ATTR_DECODE("opt_parallel_layers", int, m_opt_parallel_layers);
     ATTR_DECODE("optimize_nondebug", int, m_optimize_nondebug);
     ATTR_DECODE("llvm_optimize", int, m_llvm_optimize);
     ATTR_DECODE("debug", int, m_debug);
@@ -1724,6 +2482,15 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("llvm_profiling_events", int, m_llvm_profiling_events);
     ATTR_DECODE("llvm_output_bitcode", int, m_llvm_output_bitcode);
     ATTR_DECODE("llvm_dumpasm", int, m_llvm_dumpasm);
+    ATTR_DECODE_STRING("jit_cache_dir", m_jit_cache_dir);
+    ATTR_DECODE("jit_cache_wait", int, m_jit_cache_wait);
+    ATTR_DECODE_STRING("jit_cache_targets", m_jit_cache_targets);
+    ATTR_DECODE_STRING("jit_cache_redis", m_jit_cache_redis);
+    ATTR_DECODE("jit_memory_budget_MB", int, m_jit_memory_budget_MB);
+    ATTR_DECODE("jit_free_with_group", int, m_jit_free_with_group);
+    ATTR_DECODE("jit_share_layers", int, m_jit_share_layers);
+    ATTR_DECODE_STRING("capture", m_capture);
+    ATTR_DECODE_STRING("llvm_pass_pipeline", m_llvm_pass_pipeline);
     ATTR_DECODE("strict_messages", int, m_strict_messages);
     ATTR_DECODE("error_repeats", int, m_error_repeats);
     ATTR_DECODE("range_checking", int, m_range_checking);
@@ -1731,6 +2498,7 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
                 m_shading_state_uniform.m_unknown_coordsys_error);
     ATTR_DECODE("connection_error", int, m_connection_error);
     ATTR_DECODE("greedyjit", int, m_greedyjit);
+    ATTR_DECODE("prefetch_textures", int, m_prefetch_textures);
     ATTR_DECODE("countlayerexecs", int, m_countlayerexecs);
     ATTR_DECODE("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_DECODE("max_warnings_per_thread", int, m_max_warnings_per_thread);
@@ -1744,17 +2512,31 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE_STRING("archive_groupname", m_archive_groupname);
     ATTR_DECODE_STRING("archive_filename", m_archive_filename);
     ATTR_DECODE("max_local_mem_KB", int, m_max_local_mem_KB);
+    ATTR_DECODE("context_pool_size", int, m_context_pool_size);
+    ATTR_DECODE("numa_aware", int, m_numa_aware);
+    ATTR_DECODE("numa_nodes", int, m_numa_nodes);
     ATTR_DECODE("compile_report", int, m_compile_report);
     ATTR_DECODE("buffer_printf", int, m_buffer_printf);
+    ATTR_DECODE("printf_async", int, m_printf_async);
+    ATTR_DECODE("printf_sample", int, m_printf_sample);
+    ATTR_DECODE("printf_rate_limit", int, m_printf_rate_limit);
     ATTR_DECODE("no_noise", int, m_no_noise);
     ATTR_DECODE("no_pointcloud", int, m_no_pointcloud);
+    ATTR_DECODE("texture_stochastic", int, m_texture_stochastic);
     ATTR_DECODE("force_derivs", int, m_force_derivs);
     ATTR_DECODE("allow_shader_replacement", int, m_allow_shader_replacement);
     ATTR_DECODE("exec_repeat", int, m_exec_repeat);
+    ATTR_DECODE("shading_cache_size", int, m_shading_cache_size);
+    ATTR_DECODE("shading_cache_quantize", float, m_shading_cache_quantize);
+    ATTR_DECODE("shading_cache_uv_quantize", float,
+                m_shading_cache_uv_quantize);
+    ATTR_DECODE("capture_every", int, m_capture_every);
+    ATTR_DECODE("capture_max", int, m_capture_max);
     ATTR_DECODE("opt_warnings", int, m_opt_warnings);
     ATTR_DECODE("gpu_opt_error", int, m_gpu_opt_error);
 
     ATTR_DECODE("stat:masters", int, m_stat_shaders_loaded);
+    ATTR_DECODE("stat:masters_shared", int, m_stat_masters_shared);
     ATTR_DECODE("stat:groups", int, m_stat_groups);
     ATTR_DECODE("stat:instances_compiled", int, m_stat_instances_compiled);
     ATTR_DECODE("stat:groups_compiled", int, m_stat_groups_compiled);
@@ -1770,26 +2552,76 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("stat:preopt_ops", int, m_stat_preopt_ops);
     ATTR_DECODE("stat:postopt_ops", int, m_stat_postopt_ops);
     ATTR_DECODE("stat:middlemen_eliminated", int, m_stat_middlemen_eliminated);
+    ATTR_DECODE("stat:connections_aliased", int, m_stat_connections_aliased);
+    ATTR_DECODE("stat:shared_constant_bytes", long long,
+                m_stat_shared_constant_bytes);
     ATTR_DECODE("stat:const_connections", int, m_stat_const_connections);
     ATTR_DECODE("stat:global_connections", int, m_stat_global_connections);
     ATTR_DECODE("stat:tex_calls_codegened", int, m_stat_tex_calls_codegened);
     ATTR_DECODE("stat:tex_calls_as_handles", int, m_stat_tex_calls_as_handles);
     ATTR_DECODE("stat:useparam_ops", int, m_stat_useparam_ops);
     ATTR_DECODE("stat:call_layers_inserted", int, m_stat_call_layers_inserted);
+    ATTR_DECODE("stat:jit_cache_hits", int, m_stat_jit_cache_hits);
+    ATTR_DECODE("stat:jit_cache_misses", int, m_stat_jit_cache_misses);
+    ATTR_DECODE("stat:jit_cache_stores", int, m_stat_jit_cache_stores);
+    ATTR_DECODE("stat:jit_cache_waits", int, m_stat_jit_cache_waits);
+    ATTR_DECODE("stat:jit_cache_variant_hits", int,
+                m_stat_jit_cache_variant_hits);
+    ATTR_DECODE("stat:jit_cache_variants_stored", int,
+                m_stat_jit_cache_variants_stored);
+    ATTR_DECODE("stat:jit_cache_fetches", int, m_stat_jit_cache_fetches);
+    ATTR_DECODE("stat:jit_cache_shared", int, m_stat_jit_cache_shared);
+    ATTR_DECODE("stat:groups_tiered_up", int, m_stat_groups_tiered_up);
+    ATTR_DECODE("stat:raytype_variants_compiled", int,
+                m_stat_raytype_variants_compiled);
+    ATTR_DECODE("stat:groups_shared", int, m_stat_groups_shared);
+    ATTR_DECODE("stat:groups_evicted", int, m_stat_groups_evicted);
+    ATTR_DECODE("stat:groups_rejitted", int, m_stat_groups_rejitted);
+    ATTR_DECODE("stat:shadeops_linked", int, m_stat_shadeops_linked);
+    ATTR_DECODE("stat:layers_shared", int, m_stat_layers_shared);
+    ATTR_DECODE("stat:inline_calls_decided", int, m_stat_inline_calls_decided);
+    ATTR_DECODE("stat:batched_compaction_points", int,
+                m_stat_batched_compaction_points);
+    ATTR_DECODE("stat:reparam_reopts", int, m_stat_reparam_reopts);
+    ATTR_DECODE("stat:reparam_noops", int, m_stat_reparam_noops);
     ATTR_DECODE("stat:master_load_time", float, m_stat_master_load_time);
     ATTR_DECODE("stat:optimization_time", float, m_stat_optimization_time);
     ATTR_DECODE("stat:opt_locking_time", float, m_stat_opt_locking_time);
+    ATTR_DECODE("stat:masters_lock_time", float,
+                LockStats::wait_time(LockSite::Masters));
+    ATTR_DECODE("stat:dictionary_lock_time", float,
+                LockStats::wait_time(LockSite::Dictionary));
+    ATTR_DECODE("stat:pointcloud_lock_time", float,
+                LockStats::wait_time(LockSite::PointClouds));
     ATTR_DECODE("stat:specialization_time", float, m_stat_specialization_time);
+    ATTR_DECODE("stat:opt_prepare_time", float, m_stat_opt_prepare_time);
+    ATTR_DECODE("stat:opt_forward_time", float, m_stat_opt_forward_time);
+    ATTR_DECODE("stat:opt_backward_time", float, m_stat_opt_backward_time);
+    ATTR_DECODE("stat:opt_postopt_time", float, m_stat_opt_postopt_time);
+    ATTR_DECODE("stat:opt_collapse_time", float, m_stat_opt_collapse_time);
+    ATTR_DECODE("stat:opt_inventory_time", float, m_stat_opt_inventory_time);
     ATTR_DECODE("stat:total_llvm_time", float, m_stat_total_llvm_time);
     ATTR_DECODE("stat:llvm_setup_time", float, m_stat_llvm_setup_time);
     ATTR_DECODE("stat:llvm_irgen_time", float, m_stat_llvm_irgen_time);
     ATTR_DECODE("stat:llvm_opt_time", float, m_stat_llvm_opt_time);
     ATTR_DECODE("stat:llvm_jit_time", float, m_stat_llvm_jit_time);
+    ATTR_DECODE("stat:llvm_preopt_insts", long long, m_stat_llvm_preopt_insts);
+    ATTR_DECODE("stat:llvm_postopt_insts", long long,
+                m_stat_llvm_postopt_insts);
     ATTR_DECODE("stat:inst_merge_time", float, m_stat_inst_merge_time);
     ATTR_DECODE("stat:getattribute_calls", long long,
                 m_stat_getattribute_calls);
     ATTR_DECODE("stat:get_userdata_calls", long long,
                 m_stat_get_userdata_calls);
+    ATTR_DECODE("stat:attribute_cache_hits", long long,
+                m_stat_attribute_cache_hits);
+    ATTR_DECODE("stat:transform_cache_hits", long long,
+                m_stat_transform_cache_hits);
+    ATTR_DECODE("stat:shading_cache_hits", long long,
+                m_stat_shading_cache_hits);
+    ATTR_DECODE("stat:shading_cache_misses", long long,
+                m_stat_shading_cache_misses);
+    ATTR_DECODE("stat:shades_deferred", long long, m_stat_shades_deferred);
     ATTR_DECODE("stat:noise_calls", long long, m_stat_noise_calls);
     ATTR_DECODE("stat:pointcloud_searches", long long,
                 m_stat_pointcloud_searches);
@@ -1800,6 +2632,9 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("stat:pointcloud_max_results", int,
                 m_stat_pointcloud_max_results);
     ATTR_DECODE("stat:pointcloud_failures", int, m_stat_pointcloud_failures);
+    ATTR_DECODE_STRING("stat:profile_instrument",
+                       ustring(profile_instrument_json()));
+    ATTR_DECODE_STRING("stat:json", ustring(getstats_json()));
     ATTR_DECODE("stat:memory_current", long long, m_stat_memory.current());
     ATTR_DECODE("stat:memory_peak", long long, m_stat_memory.peak());
     ATTR_DECODE("stat:mem_master_current", long long,
@@ -1840,6 +2675,14 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("stat:mem_inst_connections_peak", long long,
                 m_stat_mem_inst_connections.peak());
 
+    if (name == "compile_thread_pool" && type.basetype == TypeDesc::PTR) {
+        *(OIIO::thread_pool**)val = m_compile_thread_pool;
+        return true;
+    }
+    if (name == "jit_cache_backend" && type.basetype == TypeDesc::PTR) {
+        *(JITCacheBackend**)val = m_jit_cache_backend;
+        return true;
+    }
     if (name == "colorsystem" && type.basetype == TypeDesc::PTR) {
         *(void**)val = &colorsystem();
         return true;
@@ -1926,11 +2769,89 @@ ShadingSystemImpl::attribute(ShaderGroup* group, string_view name,
         group->name(ustring(((const char**)val)[0]));
         return true;
     }
+    if (Strutil::starts_with(name, "static_attribute:")) {
+        string_view attr = name.substr(17);
+        if (attr.empty())
+            return false;
+        group->m_static_attributes.attribute(attr, type, val);
+        return true;
+    }
     return false;
 }
 
 
 
+// Summarize what the functions of a group's PTX declare: their virtual
+// registers, in 32-bit units, their predicates, and their local memory,
+// which is where their stack frames and spills live.  The registers are
+// before ptxas allocates them, so they show the pressure that leads to
+// spills rather than the final count.
+static std::string
+ptx_resource_stats(string_view ptx)
+{
+    int functions = 0, depth = 0;
+    long long regs = 0, preds = 0, local = 0;
+    long long max_regs = 0, max_local = 0;
+    long long func_regs = 0, func_local = 0;
+    while (ptx.size()) {
+        size_t eol       = ptx.find('\n');
+        string_view line = Strutil::strip(ptx.substr(0, eol));
+        ptx = eol == string_view::npos ? string_view() : ptx.substr(eol + 1);
+        // Blocks within a function start with "{" too, e.g. call
+        // sequences, and may be followed by comments.
+        if (Strutil::starts_with(line, "{")) {
+            if (depth++ == 0)
+                func_regs = func_local = 0;
+        } else if (Strutil::starts_with(line, "}")) {
+            if (depth && --depth == 0) {
+                ++functions;
+                max_regs  = std::max(max_regs, func_regs);
+                max_local = std::max(max_local, func_local);
+            }
+        } else if (depth && Strutil::parse_prefix(line, ".reg")) {
+            // .reg .f32 %f<12>;  or  .reg .b64 %rd1;
+            Strutil::skip_whitespace(line);
+            string_view regtype = Strutil::parse_until(line, " \t");
+            Strutil::skip_whitespace(line);
+            size_t lt = line.find('<');
+            int count = 1;
+            if (lt != string_view::npos) {
+                string_view n = line.substr(lt + 1);
+                if (!Strutil::parse_int(n, count))
+                    continue;
+            }
+            if (regtype == ".pred") {
+                preds += count;
+                continue;
+            }
+            int width = Strutil::ends_with(regtype, "64")    ? 2
+                        : Strutil::ends_with(regtype, "128") ? 4
+                                                             : 1;
+            regs += count * width;
+            func_regs += count * width;
+        } else if (depth && Strutil::parse_prefix(line, ".local")) {
+            // .local .align 16 .b8 __local_depot0[96];
+            size_t lb  = line.find('[');
+            int nbytes = 0;
+            string_view n = lb == string_view::npos ? string_view()
+                                                    : line.substr(lb + 1);
+            if (Strutil::parse_int(n, nbytes)) {
+                int elem = Strutil::contains(line, ".b64")   ? 8
+                           : Strutil::contains(line, ".b32") ? 4
+                           : Strutil::contains(line, ".b16") ? 2
+                                                             : 1;
+                local += (long long)nbytes * elem;
+                func_local += (long long)nbytes * elem;
+            }
+        }
+    }
+    return fmtformat("functions={} registers={} max_registers={} "
+                     "predicates={} local_bytes={} max_local_bytes={}",
+                     functions, regs, max_regs, preds, local, max_local);
+}
+
+
+
 bool
 ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
                                 TypeDesc type, void* val)
@@ -1969,6 +2890,11 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         *(int*)val = group->raytype_queries();
         return true;
     }
+    if (name == "scratch_highwater" && type == TypeDesc::TypeInt) {
+        *(int*)val = (int)std::min(group->scratch_highwater(),
+                                   (size_t)std::numeric_limits<int>::max());
+        return true;
+    }
     if (name == "num_entry_layers" && type.basetype == TypeDesc::INT) {
         int n = 0;
         for (int i = 0; i < group->nlayers(); ++i)
@@ -1986,8 +2912,69 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
             ((ustring*)val)[i] = ustring();
         return true;
     }
+    if (name == "num_batched_compaction_layers"
+        && type.basetype == TypeDesc::INT) {
+        int n = 0;
+        for (int i = 0; i < group->nlayers(); ++i)
+            n += (group->layer(i)->batched_compaction_points() > 0);
+        *(int*)val = n;
+        return true;
+    }
+    if (name == "batched_compaction_layers"
+        && type.basetype == TypeDesc::STRING) {
+        size_t n = 0;
+        for (size_t i = 0;
+             i < (size_t)group->nlayers() && n < type.numelements(); ++i)
+            if (group->layer(i)->batched_compaction_points() > 0)
+                ((ustring*)val)[n++] = (*group)[i]->layername();
+        for (size_t i = n; i < type.numelements(); ++i)
+            ((ustring*)val)[i] = ustring();
+        return true;
+    }
+#if OSL_USE_BATCHED
+    if (name == "num_batched_uniformity_syms"
+        && type.basetype == TypeDesc::INT) {
+        *(int*)val = (int)group->m_batched_uniformity_syms.size();
+        return true;
+    }
+    if (name == "batched_uniformity_syms"
+        && type.basetype == TypeDesc::STRING) {
+        size_t n = std::min(type.numelements(),
+                            group->m_batched_uniformity_syms.size());
+        for (size_t i = 0; i < n; ++i)
+            ((ustring*)val)[i] = group->m_batched_uniformity_syms[i];
+        for (size_t i = n; i < type.numelements(); ++i)
+            ((ustring*)val)[i] = ustring();
+        return true;
+    }
+    if (name == "batched_uniformity_rates"
+        && type.basetype == TypeDesc::FLOAT) {
+        size_t n = std::min(type.numelements(),
+                            group->m_batched_uniformity_syms.size());
+        for (size_t i = 0; i < n; ++i) {
+            long long samples = group->m_batched_uniformity_counts[2 * i];
+            long long uniform = group->m_batched_uniformity_counts[2 * i + 1];
+            ((float*)val)[i]  = samples ? float(uniform) / float(samples)
+                                        : 0.0f;
+        }
+        for (size_t i = n; i < type.numelements(); ++i)
+            ((float*)val)[i] = 0.0f;
+        return true;
+    }
+    if (name == "batched_uniformity_samples"
+        && type.basetype == TypeDesc::INT) {
+        size_t n = std::min(type.numelements(),
+                            group->m_batched_uniformity_syms.size());
+        for (size_t i = 0; i < n; ++i)
+            ((int*)val)[i] = (int)group->m_batched_uniformity_counts[2 * i];
+        for (size_t i = n; i < type.numelements(); ++i)
+            ((int*)val)[i] = 0;
+        return true;
+    }
+#endif
     if (name == "group_init_name" && type.basetype == TypeDesc::STRING) {
-        *(ustring*)val = ustring::fmtformat("__direct_callable__group_{}_init",
+        *(ustring*)val = ustring::fmtformat("{}group_{}_init",
+                                            optix_entry_prefix(),
                                             group->name());
         return true;
     }
@@ -1995,7 +2982,7 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         int nlayers          = group->nlayers();
         ShaderInstance* inst = (*group)[nlayers - 1];
         // This formulation mirrors OSOProcessorBase::layer_function_name()
-        *(ustring*)val = ustring::fmtformat("__direct_callable__{}_{}",
+        *(ustring*)val = ustring::fmtformat("{}{}_{}", optix_entry_prefix(),
                                             group->name(), inst->layername());
         return true;
     }
@@ -2018,6 +3005,12 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         *(std::string*)val = exists ? group->m_llvm_ptx_compiled_version : "";
         return true;
     }
+    if (name == "gpu_stats" && type == TypeDesc::TypeString) {
+        const std::string& ptx(group->m_llvm_ptx_compiled_version);
+        *(ustring*)val = ptx.empty() ? ustring()
+                                     : ustring(ptx_resource_stats(ptx));
+        return true;
+    }
 
     // All the remaining attributes require the group to already be
     // optimized.
@@ -2029,6 +3022,66 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         destroy_thread_info(threadinfo);
     }
 
+    if (name == "preferred_execution" && type == TypeDesc::TypeString) {
+        // Batching pays off when there's enough work per batch to amortize
+        // its overhead, and when most of it runs with all lanes active.
+        // Groups that batched analysis never saw can only run scalar.
+        ustring pref("scalar");
+#if OSL_USE_BATCHED
+        if (m_opt_batched_analysis && !group->does_nothing()) {
+            long long ops = 0, divergent = 0;
+            for (int i = 0; i < group->nlayers(); ++i) {
+                const ShaderInstance* inst = group->layer(i);
+                if (!inst->unused()) {
+                    ops += inst->batched_ops();
+                    divergent += inst->batched_divergent_ops();
+                }
+            }
+            if (ops >= m_batched_min_ops
+                && divergent * 100 <= ops * m_batched_max_divergence)
+                pref = ustring("batched");
+        }
+#endif
+        *(ustring*)val = pref;
+        return true;
+    }
+    if (name == "interactive_params" && type.basetype == TypeDesc::PTR) {
+        auto block   = group->m_interactive.get();
+        *(void**)val = block ? block->data.get() : nullptr;
+        return true;
+    }
+    if (name == "interactive_params_size" && type == TypeDesc::TypeInt) {
+        auto block = group->m_interactive.get();
+        *(int*)val = block ? block->size : 0;
+        return true;
+    }
+    if (name == "num_interactive_params" && type == TypeDesc::TypeInt) {
+        auto block = group->m_interactive.get();
+        *(int*)val = block ? (int)block->names.size() : 0;
+        return true;
+    }
+    if (name == "interactive_param_names"
+        && type.basetype == TypeDesc::STRING) {
+        auto block = group->m_interactive.get();
+        size_t n   = block ? std::min(type.numelements(), block->names.size())
+                           : 0;
+        for (size_t i = 0; i < n; ++i)
+            ((ustring*)val)[i] = block->names[i];
+        for (size_t i = n; i < type.numelements(); ++i)
+            ((ustring*)val)[i] = ustring();
+        return true;
+    }
+    if (name == "interactive_param_offsets" && type.basetype == TypeDesc::INT) {
+        auto block = group->m_interactive.get();
+        size_t n   = block ? std::min(type.numelements(),
+                                      block->offsets.size())
+                           : 0;
+        for (size_t i = 0; i < n; ++i)
+            ((int*)val)[i] = block->offsets[i];
+        for (size_t i = n; i < type.numelements(); ++i)
+            ((int*)val)[i] = -1;
+        return true;
+    }
     if (name == "num_textures_needed" && type == TypeDesc::TypeInt) {
         *(int*)val = (int)group->m_textures_needed.size();
         return true;
@@ -2126,6 +3179,32 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         *(int*)val = (int)group->id();
         return true;
     }
+    if (name == "num_constant_outputs" && type == TypeDesc::TypeInt) {
+        auto co    = group->m_constant_outputs.get();
+        *(int*)val = co ? (int)co->names.size() : 0;
+        return true;
+    }
+    if (name == "constant_outputs" && type.basetype == TypeDesc::PTR) {
+        auto co         = group->m_constant_outputs.get();
+        *(ustring**)val = co && co->names.size() ? &co->names[0] : NULL;
+        return true;
+    }
+    if (name == "constant_output_types" && type.basetype == TypeDesc::PTR) {
+        auto co          = group->m_constant_outputs.get();
+        *(TypeDesc**)val = co && co->types.size() ? &co->types[0] : NULL;
+        return true;
+    }
+    if (name == "constant_output_values" && type.basetype == TypeDesc::PTR) {
+        auto co             = group->m_constant_outputs.get();
+        *(const void***)val = co && co->values.size() ? &co->values[0]
+                                                      : NULL;
+        return true;
+    }
+    if (name == "all_outputs_constant" && type == TypeDesc::TypeInt) {
+        auto co    = group->m_constant_outputs.get();
+        *(int*)val = co && co->all;
+        return true;
+    }
 
     // Additional attributes useful to OptiX-based renderers
     if (name == "userdata_layers" && type.basetype == TypeDesc::PTR) {
@@ -2142,6 +3221,66 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         *(int*)val = (int)group->llvm_groupdata_size();
         return true;
     }
+    if (name == "closure_memory_bound" && type == TypeDesc::TypeInt) {
+        *(int*)val = group->m_closure_memory_bound;
+        return true;
+    }
+    if (name == "cost_estimate" && type == TypeDesc::TypeFloat) {
+        // Once profiling has timed enough executions, their mean is a
+        // better estimate than the ops
+        const long long min_timed = 256;
+        long long n               = group->m_timed_executions;
+        if (n >= min_timed)
+            *(float*)val = float(OIIO::Timer::seconds(group->m_timed_ticks)
+                                 * 1.0e9 / double(n));
+        else
+            *(float*)val = group->m_cost_estimate;
+        return true;
+    }
+    if (Strutil::starts_with(name, "memory:")
+        && (type == TypeDesc::INT64 || type == TypeDesc::TypeInt)) {
+        string_view category = name.substr(7);
+        long long symbols = 0, params = 0, ops = 0, connections = 0;
+        for (int i = 0; i < group->nlayers(); ++i) {
+            const ShaderInstance* inst = group->layer(i);
+            symbols += vectorbytes(inst->m_instsymbols)
+                       + vectorbytes(inst->m_instoverrides);
+            params += vectorbytes(inst->m_iparams)
+                      + vectorbytes(inst->m_fparams)
+                      + vectorbytes(inst->m_sparams);
+            ops += vectorbytes(inst->m_instops) + vectorbytes(inst->m_instargs);
+            connections += vectorbytes(inst->m_connections);
+        }
+        long long jit = (long long)group->jit_memory();
+        long long bytes;
+        if (category == "jit")
+            bytes = jit;
+        else if (category == "symbols")
+            bytes = symbols;
+        else if (category == "params")
+            bytes = params;
+        else if (category == "ops")
+            bytes = ops;
+        else if (category == "connections")
+            bytes = connections;
+        else if (category == "total")
+            bytes = jit + symbols + params + ops + connections;
+        else if (category == "groupdata")
+            bytes = (long long)(group->llvm_groupdata_size()
+                                + group->llvm_groupdata_wide_size());
+        else if (category == "constants")
+            bytes = (long long)(group->m_constants->ints.total()
+                                + group->m_constants->floats.total()
+                                + group->m_constants->strings.total());
+        else
+            return false;
+        if (type == TypeDesc::INT64)
+            *(long long*)val = bytes;
+        else
+            *(int*)val = (int)std::min(
+                bytes, (long long)std::numeric_limits<int>::max());
+        return true;
+    }
 
     return false;
 }
@@ -2227,10 +3366,424 @@ struct group_time_compare {  // So looking forward to C++11 lambdas!
         return a.second > b.second;
     }
 };
+
+
+
+// One layer's "profile_instrument" results, with those of its source
+// lines.  The layer's ticks include its lines'.
+struct LayerProfile {
+    ustring group;
+    int layer = -1;
+    ustring layername, shadername;
+    long long ticks = 0;
+    long long runs  = 0;
+    struct Line {
+        ustring sourcefile;
+        int sourceline;
+        long long ticks;
+    };
+    std::vector<Line> lines;
+};
+
+
+
+std::vector<LayerProfile>
+gather_layer_profiles(const std::vector<ShaderGroupRef>& groups)
+{
+    std::vector<LayerProfile> layers;
+    for (const ShaderGroupRef& g : groups) {
+        std::map<int, LayerProfile> grouplayers;
+        g->foreach_profile_site([&](const ProfileSite& site) {
+            LayerProfile& lp(grouplayers[site.layer]);
+            long long ticks = site.ticks;
+            lp.ticks += ticks;
+            if (site.sourcefile.empty())
+                lp.runs = site.runs;
+            else if (ticks)
+                lp.lines.push_back({ site.sourcefile, site.sourceline, ticks });
+        });
+        for (auto& gl : grouplayers) {
+            LayerProfile& lp(gl.second);
+            if (!lp.runs && !lp.ticks)
+                continue;
+            lp.group = g->name();
+            lp.layer = gl.first;
+            if (lp.layer < g->nlayers()) {
+                lp.layername  = (*g)[lp.layer]->layername();
+                lp.shadername = (*g)[lp.layer]->shadername();
+            }
+            std::sort(lp.lines.begin(), lp.lines.end(),
+                      [](const LayerProfile::Line& a,
+                         const LayerProfile::Line& b) {
+                          return a.ticks > b.ticks;
+                      });
+            layers.push_back(std::move(lp));
+        }
+    }
+    std::sort(layers.begin(), layers.end(),
+              [](const LayerProfile& a, const LayerProfile& b) {
+                  return a.ticks > b.ticks;
+              });
+    return layers;
+}
+
 }  // namespace
 
 
 
+double
+ShadingSystemImpl::profile_clock_seconds() const
+{
+    long long ticks = profile_clock() - m_profile_clock_start;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now()
+                                            - m_profile_time_start;
+    return ticks > 0 ? elapsed.count() / double(ticks) : 0.0;
+}
+
+
+
+std::string
+ShadingSystemImpl::profile_instrument_json() const
+{
+    std::vector<LayerProfile> layers = gather_layer_profiles(
+        all_shader_groups());
+    double secs = profile_clock_seconds();
+    std::ostringstream out;
+    out.imbue(std::locale::classic());  // force C locale
+    out << "{\n";
+    out << fmtformat("  \"seconds_per_tick\": {:g},\n", secs);
+    out << "  \"layers\": [";
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const LayerProfile& lp(layers[i]);
+        out << (i ? ",\n" : "\n");
+        out << fmtformat("    {{ \"group\": \"{}\", \"layer\": {}, "
+                         "\"layername\": \"{}\", \"shader\": \"{}\",\n"
+                         "      \"runs\": {}, \"ticks\": {}, "
+                         "\"seconds\": {:g},\n",
+                         Strutil::escape_chars(lp.group), lp.layer,
+                         Strutil::escape_chars(lp.layername),
+                         Strutil::escape_chars(lp.shadername), lp.runs,
+                         lp.ticks, lp.ticks * secs);
+        out << "      \"lines\": [";
+        for (size_t j = 0; j < lp.lines.size(); ++j) {
+            const LayerProfile::Line& line(lp.lines[j]);
+            out << (j ? ",\n" : "\n");
+            out << fmtformat("        {{ \"sourcefile\": \"{}\", "
+                             "\"line\": {}, \"ticks\": {}, "
+                             "\"seconds\": {:g} }}",
+                             Strutil::escape_chars(line.sourcefile),
+                             line.sourceline, line.ticks, line.ticks * secs);
+        }
+        out << (lp.lines.size() ? "\n      ] }" : "] }");
+    }
+    out << (layers.size() ? "\n  ]\n" : "]\n");
+    out << "}\n";
+    return out.str();
+}
+
+
+
+void
+ShadingSystemImpl::register_live_counters(LiveCounters* counters)
+{
+    spin_lock lock(m_live_counters_mutex);
+    m_live_counters.push_back(counters);
+}
+
+
+
+void
+ShadingSystemImpl::unregister_live_counters(LiveCounters* counters)
+{
+    spin_lock lock(m_live_counters_mutex);
+    auto found = std::find(m_live_counters.begin(), m_live_counters.end(),
+                           counters);
+    if (found != m_live_counters.end())
+        m_live_counters.erase(found);
+    // Keep the counts of the departed context in the totals
+    for (int c = 0; c < LiveCounters::NCounters; ++c)
+        m_live_counters_retired.incr(LiveCounters::Counter(c),
+                                     counters->get(LiveCounters::Counter(c)));
+}
+
+
+
+ShadingSystem::LiveStats
+ShadingSystemImpl::live_stats() const
+{
+    long long totals[LiveCounters::NCounters];
+    {
+        spin_lock lock(m_live_counters_mutex);
+        for (int c = 0; c < LiveCounters::NCounters; ++c) {
+            auto counter = LiveCounters::Counter(c);
+            totals[c]    = m_live_counters_retired.get(counter);
+            for (const LiveCounters* counters : m_live_counters)
+                totals[c] += counters->get(counter);
+        }
+    }
+    ShadingSystem::LiveStats stats;
+    stats.elapsed = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - m_profile_time_start)
+                        .count();
+    stats.shades        = totals[LiveCounters::Shades];
+    stats.layers        = totals[LiveCounters::Layers];
+    stats.texture_calls = totals[LiveCounters::TextureCalls];
+    stats.trace_calls   = totals[LiveCounters::TraceCalls];
+    stats.closures      = totals[LiveCounters::Closures];
+    return stats;
+}
+
+
+
+std::string
+ShadingSystemImpl::getstats_json(int topn) const
+{
+    // Each section of counters is a list of names and formatted values
+    typedef std::vector<std::pair<const char*, std::string>> Section;
+    auto val = [](double v) { return fmtformat("{}", v); };
+    auto ival = [](long long v) { return fmtformat("{}", v); };
+    std::vector<std::pair<const char*, Section>> sections;
+    sections.emplace_back(
+        "shaders",
+        Section {
+            { "masters_requested", ival(m_stat_shaders_requested) },
+            { "masters_loaded", ival(m_stat_shaders_loaded) },
+            { "masters_shared", ival(m_stat_masters_shared) },
+            { "master_load_time", val(m_stat_master_load_time) },
+            { "instances_current", ival(m_stat_instances.current()) },
+            { "instances_peak", ival(m_stat_instances.peak()) },
+            { "groups", ival(m_stat_groups) },
+            { "group_instances", ival(m_stat_groupinstances) },
+            { "contexts_peak", ival(m_stat_contexts.peak()) },
+        });
+    sections.emplace_back(
+        "optimization",
+        Section {
+            { "optimization_time", val(m_stat_optimization_time) },
+            { "opt_locking_time", val(m_stat_opt_locking_time) },
+            { "specialization_time", val(m_stat_specialization_time) },
+            { "opt_prepare_time", val(m_stat_opt_prepare_time) },
+            { "opt_forward_time", val(m_stat_opt_forward_time) },
+            { "opt_backward_time", val(m_stat_opt_backward_time) },
+            { "opt_postopt_time", val(m_stat_opt_postopt_time) },
+            { "opt_collapse_time", val(m_stat_opt_collapse_time) },
+            { "opt_inventory_time", val(m_stat_opt_inventory_time) },
+            { "inst_merge_time", val(m_stat_inst_merge_time) },
+            { "instances_compiled", ival(m_stat_instances_compiled) },
+            { "groups_compiled", ival(m_stat_groups_compiled) },
+            { "groups_shared", ival(m_stat_groups_shared) },
+            { "groups_tiered_up", ival(m_stat_groups_tiered_up) },
+            { "raytype_variants_compiled",
+              ival(m_stat_raytype_variants_compiled) },
+            { "empty_instances", ival(m_stat_empty_instances) },
+            { "empty_groups", ival(m_stat_empty_groups) },
+            { "merged_inst", ival(m_stat_merged_inst) },
+            { "merged_inst_opt", ival(m_stat_merged_inst_opt) },
+            { "preopt_syms", ival(m_stat_preopt_syms) },
+            { "postopt_syms", ival(m_stat_postopt_syms) },
+            { "syms_with_derivs", ival(m_stat_syms_with_derivs) },
+            { "preopt_ops", ival(m_stat_preopt_ops) },
+            { "postopt_ops", ival(m_stat_postopt_ops) },
+            { "useparam_ops", ival(m_stat_useparam_ops) },
+            { "middlemen_eliminated", ival(m_stat_middlemen_eliminated) },
+            { "connections_aliased", ival(m_stat_connections_aliased) },
+            { "shared_constant_bytes", ival(m_stat_shared_constant_bytes) },
+            { "const_connections", ival(m_stat_const_connections) },
+            { "global_connections", ival(m_stat_global_connections) },
+            { "call_layers_inserted", ival(m_stat_call_layers_inserted) },
+            { "tex_calls_codegened", ival(m_stat_tex_calls_codegened) },
+            { "tex_calls_as_handles", ival(m_stat_tex_calls_as_handles) },
+            { "regexes", ival(m_stat_regexes) },
+            { "reparam_reopts", ival(m_stat_reparam_reopts) },
+            { "reparam_noops", ival(m_stat_reparam_noops) },
+            { "batched_compaction_points",
+              ival(m_stat_batched_compaction_points) },
+        });
+    sections.emplace_back(
+        "llvm",
+        Section {
+            { "total_llvm_time", val(m_stat_total_llvm_time) },
+            { "llvm_setup_time", val(m_stat_llvm_setup_time) },
+            { "llvm_irgen_time", val(m_stat_llvm_irgen_time) },
+            { "llvm_opt_time", val(m_stat_llvm_opt_time) },
+            { "llvm_jit_time", val(m_stat_llvm_jit_time) },
+            { "llvm_preopt_insts", ival(m_stat_llvm_preopt_insts) },
+            { "llvm_postopt_insts", ival(m_stat_llvm_postopt_insts) },
+            { "max_llvm_local_mem", ival(m_stat_max_llvm_local_mem) },
+            { "jit_memory", ival(LLVM_Util::total_jit_memory_held()) },
+            { "jit_memory_freed", ival(LLVM_Util::total_jit_memory_freed()) },
+            { "jit_cache_hits", ival(m_stat_jit_cache_hits) },
+            { "jit_cache_misses", ival(m_stat_jit_cache_misses) },
+            { "jit_cache_stores", ival(m_stat_jit_cache_stores) },
+            { "jit_cache_waits", ival(m_stat_jit_cache_waits) },
+            { "jit_cache_variant_hits", ival(m_stat_jit_cache_variant_hits) },
+            { "jit_cache_variants_stored",
+              ival(m_stat_jit_cache_variants_stored) },
+            { "jit_cache_fetches", ival(m_stat_jit_cache_fetches) },
+            { "jit_cache_shared", ival(m_stat_jit_cache_shared) },
+            { "groups_evicted", ival(m_stat_groups_evicted) },
+            { "groups_rejitted", ival(m_stat_groups_rejitted) },
+            { "shadeops_linked", ival(m_stat_shadeops_linked) },
+            { "layers_shared", ival(m_stat_layers_shared) },
+            { "inline_calls_decided", ival(m_stat_inline_calls_decided) },
+        });
+    sections.emplace_back(
+        "execution",
+        Section {
+            { "total_shading_time",
+              val(OIIO::Timer::seconds(m_stat_total_shading_time_ticks)) },
+            { "layers_executed", ival(m_stat_layers_executed) },
+            { "getattribute_calls", ival(m_stat_getattribute_calls) },
+            { "getattribute_time", val(m_stat_getattribute_time) },
+            { "getattribute_fail_time", val(m_stat_getattribute_fail_time) },
+            { "get_userdata_calls", ival(m_stat_get_userdata_calls) },
+            { "attribute_cache_hits", ival(m_stat_attribute_cache_hits) },
+            { "transform_cache_hits", ival(m_stat_transform_cache_hits) },
+            { "shading_cache_hits", ival(m_stat_shading_cache_hits) },
+            { "shading_cache_misses", ival(m_stat_shading_cache_misses) },
+            { "shades_deferred", ival(m_stat_shades_deferred) },
+            { "noise_calls", ival(m_stat_noise_calls) },
+        });
+    sections.emplace_back(
+        "pointcloud",
+        Section {
+            { "searches", ival(m_stat_pointcloud_searches) },
+            { "searches_total_results",
+              ival(m_stat_pointcloud_searches_total_results) },
+            { "max_results", ival(m_stat_pointcloud_max_results) },
+            { "failures", ival(m_stat_pointcloud_failures) },
+            { "gets", ival(m_stat_pointcloud_gets) },
+            { "writes", ival(m_stat_pointcloud_writes) },
+        });
+    sections.emplace_back(
+        "locks",
+        Section {
+            { "opt_locking_time", val(m_stat_opt_locking_time) },
+            { "masters_time", val(LockStats::wait_time(LockSite::Masters)) },
+            { "masters_acquires",
+              ival(LockStats::acquires[int(LockSite::Masters)]) },
+            { "dictionary_time",
+              val(LockStats::wait_time(LockSite::Dictionary)) },
+            { "dictionary_acquires",
+              ival(LockStats::acquires[int(LockSite::Dictionary)]) },
+            { "pointcloud_time",
+              val(LockStats::wait_time(LockSite::PointClouds)) },
+            { "pointcloud_acquires",
+              ival(LockStats::acquires[int(LockSite::PointClouds)]) },
+        });
+    sections.emplace_back(
+        "memory",
+        Section {
+            { "total_current", ival(m_stat_memory.current()) },
+            { "total_peak", ival(m_stat_memory.peak()) },
+            { "master_current", ival(m_stat_mem_master.current()) },
+            { "master_peak", ival(m_stat_mem_master.peak()) },
+            { "master_ops_current", ival(m_stat_mem_master_ops.current()) },
+            { "master_args_current", ival(m_stat_mem_master_args.current()) },
+            { "master_syms_current", ival(m_stat_mem_master_syms.current()) },
+            { "master_defaults_current",
+              ival(m_stat_mem_master_defaults.current()) },
+            { "master_consts_current",
+              ival(m_stat_mem_master_consts.current()) },
+            { "inst_current", ival(m_stat_mem_inst.current()) },
+            { "inst_peak", ival(m_stat_mem_inst.peak()) },
+            { "inst_syms_current", ival(m_stat_mem_inst_syms.current()) },
+            { "inst_paramvals_current",
+              ival(m_stat_mem_inst_paramvals.current()) },
+            { "inst_connections_current",
+              ival(m_stat_mem_inst_connections.current()) },
+        });
+
+    // Histograms of the groups that currently exist: counts[i] is the
+    // number of groups below edges[i], and the last count is of the rest.
+    struct Histogram {
+        const char* name;
+        std::vector<double> edges;
+        std::vector<long long> counts;
+        void add(double v)
+        {
+            counts.resize(edges.size() + 1);
+            size_t i = 0;
+            while (i < edges.size() && v >= edges[i])
+                ++i;
+            ++counts[i];
+        }
+    };
+    Histogram compile_times { "compile_time",
+                              { 0.001, 0.01, 0.1, 1.0, 10.0 },
+                              {} };
+    Histogram layers { "layers", { 2, 4, 8, 16, 32, 64 }, {} };
+    compile_times.counts.resize(compile_times.edges.size() + 1);
+    layers.counts.resize(layers.edges.size() + 1);
+
+    struct GroupStats {
+        ustring name;
+        long long executions;
+        int layers;
+        double compile_time;
+        double shading_time;
+    };
+    std::vector<GroupStats> groups;
+    {
+        spin_lock lock(m_stat_mutex);  // for m_group_profile_times
+        for (const ShaderGroupRef& g : all_shader_groups()) {
+            if (g->optimized())
+                compile_times.add(g->compile_time());
+            layers.add(g->nlayers());
+            long long ticks = g->m_stat_total_shading_time_ticks;
+            auto found      = m_group_profile_times.find(g->name());
+            if (found != m_group_profile_times.end())
+                ticks += found->second;
+            groups.push_back({ g->name(), g->executions(), g->nlayers(),
+                               g->compile_time(),
+                               OIIO::Timer::seconds(ticks) });
+        }
+    }
+    std::sort(groups.begin(), groups.end(),
+              [](const GroupStats& a, const GroupStats& b) {
+                  return a.executions > b.executions;
+              });
+    if (groups.size() > size_t(std::max(topn, 0)))
+        groups.resize(std::max(topn, 0));
+
+    std::ostringstream out;
+    out.imbue(std::locale::classic());  // force C locale
+    out << "{\n";
+    out << fmtformat("  \"osl_version\": \"{}\",\n", OSL_LIBRARY_VERSION_STRING);
+    for (const auto& section : sections) {
+        out << fmtformat("  \"{}\": {{\n", section.first);
+        for (size_t i = 0; i < section.second.size(); ++i)
+            out << fmtformat("    \"{}\": {}{}\n", section.second[i].first,
+                             section.second[i].second,
+                             i + 1 < section.second.size() ? "," : "");
+        out << "  },\n";
+    }
+    out << "  \"histograms\": {\n";
+    for (const Histogram* h : { &compile_times, &layers }) {
+        out << fmtformat("    \"{}\": {{ \"edges\": [{}], \"counts\": [{}] }}"
+                         "{}\n",
+                         h->name, Strutil::join(h->edges, ", "),
+                         Strutil::join(h->counts, ", "),
+                         h == &layers ? "" : ",");
+    }
+    out << "  },\n";
+    out << "  \"top_groups\": [";
+    for (size_t i = 0; i < groups.size(); ++i) {
+        const GroupStats& g(groups[i]);
+        out << (i ? ",\n" : "\n");
+        out << fmtformat("    {{ \"name\": \"{}\", \"executions\": {}, "
+                         "\"layers\": {}, \"compile_time\": {}, "
+                         "\"shading_time\": {} }}",
+                         Strutil::escape_chars(g.name), g.executions,
+                         g.layers, g.compile_time, g.shading_time);
+    }
+    out << (groups.size() ? "\n  ]\n" : "]\n");
+    out << "}\n";
+    return out.str();
+}
+
+
+
 std::string
 ShadingSystemImpl::getstats(int level) const
 {
@@ -2261,6 +3814,8 @@ ShadingSystemImpl::getstats(int level) const
     INTOPT(llvm_optimize);
     INTOPT(debug);
     INTOPT(profile);
+    INTOPT(profile_instrument);
+    BOOLOPT(lock_stats);
     INTOPT(llvm_debug);
     BOOLOPT(llvm_debug_layers);
     BOOLOPT(llvm_debug_ops);
@@ -2268,20 +3823,25 @@ ShadingSystemImpl::getstats(int level) const
     BOOLOPT(llvm_output_bitcode);
     BOOLOPT(llvm_dumpasm);
     BOOLOPT(llvm_prune_ir_strategy);
+    BOOLOPT(fast_shutdown);
     BOOLOPT(lazylayers);
     BOOLOPT(lazyglobals);
     BOOLOPT(lazyunconnected);
     BOOLOPT(lazyerror);
     BOOLOPT(lazy_userdata);
     BOOLOPT(userdata_isconnected);
+    BOOLOPT(attribute_cache);
+    BOOLOPT(regex_optimize);
     BOOLOPT(clearmemory);
     BOOLOPT(debugnan);
     BOOLOPT(debug_uninit);
+    INTOPT(debug_sample);
     BOOLOPT(lockgeom_default);
     BOOLOPT(strict_messages);
     BOOLOPT(error_repeats);
     BOOLOPT(range_checking);
     BOOLOPT(greedyjit);
+    BOOLOPT(prefetch_textures);
     BOOLOPT(countlayerexecs);
     BOOLOPT(opt_simplify_param);
     BOOLOPT(opt_constant_fold);
@@ -2295,15 +3855,51 @@ ShadingSystemImpl::getstats(int level) const
     INTOPT(opt_merge_instances);
     BOOLOPT(opt_merge_instances_with_userdata);
     BOOLOPT(opt_fold_getattribute);
+    BOOLOPT(opt_fold_gettextureinfo);
+    BOOLOPT(opt_batch_getattribute);
     BOOLOPT(opt_middleman);
+    BOOLOPT(opt_alias_connections);
+    INTOPT(opt_shared_constant_arrays);
+    BOOLOPT(opt_texture_reuse);
+    INTOPT(opt_unroll_loops);
     BOOLOPT(opt_texture_handle);
     BOOLOPT(opt_seed_bblock_aliases);
     BOOLOPT(opt_batched_analysis);
+    BOOLOPT(opt_batched_compaction);
+    BOOLOPT(batched_uniformity_profile);
+    INTOPT(batched_min_ops);
+    INTOPT(batched_max_divergence);
     BOOLOPT(llvm_jit_fma);
     BOOLOPT(llvm_jit_aggressive);
+    BOOLOPT(llvm_vector_triples);
+    BOOLOPT(llvm_jit_orc);
+    BOOLOPT(jit_huge_pages);
+    INTOPT(llvm_jit_threads);
+    BOOLOPT(llvm_jit_lazy);
+    BOOLOPT(llvm_shared_shadeops);
+    INTOPT(llvm_inline_max_cost);
+    BOOLOPT(tiered_jit);
+    INTOPT(tiered_jit_profile);
+    INTOPT(async_compile_threads);
+    BOOLOPT(async_placeholder);
+    INTOPT(raytype_variant_threshold);
+    BOOLOPT(opt_share_groups);
+    BOOLOPT(reparam_reoptimize);
+    BOOLOPT(jit_release_memory);
     INTOPT(vector_width);
     STROPT(llvm_jit_target);
+    STROPT(math_precision);
+    STROPT(optix_entry_points);
+    STROPT(jit_cache_dir);
+    INTOPT(jit_cache_wait);
+    STROPT(jit_cache_targets);
+    STROPT(jit_cache_redis);
+    INTOPT(jit_memory_budget_MB);
+    BOOLOPT(jit_free_with_group);
+    BOOLOPT(jit_share_layers);
+    STROPT(llvm_pass_pipeline);
     INTOPT(opt_passes);
+    INTOPT(opt_parallel_layers);
     INTOPT(no_noise);
     INTOPT(no_pointcloud);
     INTOPT(force_derivs);
@@ -2311,6 +3907,8 @@ ShadingSystemImpl::getstats(int level) const
     INTOPT(exec_repeat);
     INTOPT(opt_warnings);
     INTOPT(gpu_opt_error);
+    INTOPT(context_pool_size);
+    BOOLOPT(numa_aware);
     STROPT(debug_groupname);
     STROPT(debug_layername);
     STROPT(archive_groupname);
@@ -2354,6 +3952,9 @@ ShadingSystemImpl::getstats(int level) const
     out << "    Requested: " << m_stat_shaders_requested << "\n";
     out << "    Loaded:    " << m_stat_shaders_loaded << "\n";
     out << "    Masters:   " << m_stat_shaders_loaded << "\n";
+    if (m_stat_masters_shared)
+        out << "    Shared:    " << m_stat_masters_shared
+            << " (identical to a loaded master)\n";
     out << "    Instances: " << m_stat_instances << "\n";
     out << "  Time loading masters: "
         << Strutil::timeintervalformat(m_stat_master_load_time, 2) << "\n";
@@ -2387,6 +3988,17 @@ ShadingSystemImpl::getstats(int level) const
 
     out << "  Compiled " << m_stat_groups_compiled << " groups, "
         << m_stat_instances_compiled << " instances\n";
+    if (m_opt_share_groups)
+        print(out, "  Shared compiled code of identical groups: {}\n",
+              (int)m_stat_groups_shared);
+    if (m_opt_batched_compaction)
+        print(out, "  Batched compaction points (costly divergent ops): {}\n",
+              (int)m_stat_batched_compaction_points);
+    if (m_reparam_reoptimize)
+        print(out,
+              "  ReParameter of optimized groups: {} re-optimized, "
+              "{} needed no recompile\n",
+              (int)m_stat_reparam_reopts, (int)m_stat_reparam_noops);
     out << "  Merged " << (m_stat_merged_inst + m_stat_merged_inst_opt)
         << " instances (" << m_stat_merged_inst << " initial, "
         << m_stat_merged_inst_opt << " after opt) in "
@@ -2424,6 +4036,12 @@ ShadingSystemImpl::getstats(int level) const
           (int)m_stat_global_connections);
     print(out, "  Middlemen eliminated: {}\n",
           (int)m_stat_middlemen_eliminated);
+    if (m_stat_connections_aliased)
+        print(out, "  Array connections aliased instead of copied: {}\n",
+              (int)m_stat_connections_aliased);
+    if (m_stat_shared_constant_bytes)
+        print(out, "  Constant array params read in place: {}\n",
+              Strutil::memformat(m_stat_shared_constant_bytes));
     print(out, "  Derivatives needed on {} / {} symbols ({:.1f}%)\n",
           (int)m_stat_syms_with_derivs, (int)m_stat_postopt_syms,
           (100.0 * (int)m_stat_syms_with_derivs)
@@ -2434,6 +4052,15 @@ ShadingSystemImpl::getstats(int level) const
         << Strutil::timeintervalformat(m_stat_opt_locking_time, 2) << "\n";
     out << "    runtime specialization:    "
         << Strutil::timeintervalformat(m_stat_specialization_time, 2) << "\n";
+    print(out,
+          "      prepare {}, forward {}, backward {}, post-opt {}, "
+          "collapse {}, inventory {}\n",
+          Strutil::timeintervalformat(m_stat_opt_prepare_time, 2),
+          Strutil::timeintervalformat(m_stat_opt_forward_time, 2),
+          Strutil::timeintervalformat(m_stat_opt_backward_time, 2),
+          Strutil::timeintervalformat(m_stat_opt_postopt_time, 2),
+          Strutil::timeintervalformat(m_stat_opt_collapse_time, 2),
+          Strutil::timeintervalformat(m_stat_opt_inventory_time, 2));
     if (m_stat_total_llvm_time > 0.0) {
         out << "    LLVM setup:                "
             << Strutil::timeintervalformat(m_stat_llvm_setup_time, 2) << "\n";
@@ -2443,7 +4070,61 @@ ShadingSystemImpl::getstats(int level) const
             << Strutil::timeintervalformat(m_stat_llvm_opt_time, 2) << "\n";
         out << "    LLVM JIT:                  "
             << Strutil::timeintervalformat(m_stat_llvm_jit_time, 2) << "\n";
-    }
+        if (m_stat_llvm_preopt_insts)
+            print(out,
+                  "    LLVM IR instructions:      {} before opt, {} after\n",
+                  (long long)m_stat_llvm_preopt_insts,
+                  (long long)m_stat_llvm_postopt_insts);
+    }
+    if (!m_stat_llvm_pass_times.empty()) {
+        // The costliest passes of the new pass manager pipelines
+        std::vector<std::pair<double, std::string>> passes;
+        for (auto& pass : m_stat_llvm_pass_times)
+            passes.emplace_back(pass.second, pass.first);
+        std::sort(passes.begin(), passes.end(), std::greater<>());
+        print(out, "  LLVM passes (top {} of {}):\n",
+              std::min(passes.size(), size_t(12)), passes.size());
+        for (size_t i = 0; i < passes.size() && i < 12; ++i)
+            print(out, "    {:<26} {}\n", passes[i].second,
+                  Strutil::timeintervalformat(passes[i].first, 2));
+    }
+    if (m_stat_jit_cache_hits || m_stat_jit_cache_misses)
+        print(out,
+              "  JIT object cache: {} hits ({} after waiting), {} misses, "
+              "{} stored\n",
+              (int)m_stat_jit_cache_hits, (int)m_stat_jit_cache_waits,
+              (int)m_stat_jit_cache_misses, (int)m_stat_jit_cache_stores);
+    if (m_stat_jit_cache_variant_hits || m_stat_jit_cache_variants_stored)
+        print(out,
+              "  JIT object cache, other ISAs: {} hits, {} stored\n",
+              (int)m_stat_jit_cache_variant_hits,
+              (int)m_stat_jit_cache_variants_stored);
+    if (m_jit_cache_backend)
+        print(out, "  JIT cache backend: {} fetched, {} stored\n",
+              (int)m_stat_jit_cache_fetches, (int)m_stat_jit_cache_shared);
+    if (m_jit_memory_budget_MB)
+        print(out,
+              "  JIT memory budget {} MB: {} groups evicted, {} re-JITed\n",
+              m_jit_memory_budget_MB, (int)m_stat_groups_evicted,
+              (int)m_stat_groups_rejitted);
+    if (m_jit_memory_budget_MB || m_jit_free_with_group)
+        print(out, "  JIT memory freed: {}\n",
+              Strutil::memformat(LLVM_Util::total_jit_memory_freed()));
+    if (m_tiered_jit)
+        print(out, "  Groups re-JITed at full optimization: {}\n",
+              (int)m_stat_groups_tiered_up);
+    if (m_raytype_variant_threshold)
+        print(out, "  Raytype variants compiled in the background: {}\n",
+              (int)m_stat_raytype_variants_compiled);
+    if (m_llvm_shared_shadeops)
+        print(out, "  Shared shadeop library functions linked: {}\n",
+              (int)m_stat_shadeops_linked);
+    if (m_jit_share_layers)
+        print(out, "  Layers calling the code of an identical layer: {}\n",
+              (int)m_stat_layers_shared);
+    if (m_llvm_inline_max_cost)
+        print(out, "  Calls inlined or kept by estimated cost: {}\n",
+              (int)m_stat_inline_calls_decided);
 
     out << "  Texture calls compiled: " << (int)m_stat_tex_calls_codegened
         << " (" << (int)m_stat_tex_calls_as_handles << " used handles)\n";
@@ -2460,6 +4141,19 @@ ShadingSystemImpl::getstats(int level) const
     }
     out << "  Number of get_userdata calls: " << m_stat_get_userdata_calls
         << "\n";
+    if (m_attribute_cache)
+        out << "  getattribute calls served by the attribute cache: "
+            << m_stat_attribute_cache_hits << "\n";
+    if (m_transform_cache)
+        out << "  Matrices served by the transform cache: "
+            << m_stat_transform_cache_hits << "\n";
+    if (m_shading_cache)
+        out << "  Shading cache: " << m_stat_shading_cache_hits
+            << " hits, " << m_stat_shading_cache_misses << " misses, "
+            << Strutil::memformat(m_shading_cache->bytes()) << "\n";
+    if (m_stat_shades_deferred)
+        out << "  Shades deferred by texture lookups: "
+            << m_stat_shades_deferred << "\n";
     if (profile() > 1)
         out << "  Number of noise calls: " << m_stat_noise_calls << "\n";
     if (m_stat_pointcloud_searches || m_stat_pointcloud_writes) {
@@ -2479,6 +4173,16 @@ ShadingSystemImpl::getstats(int level) const
         out << "    pointcloud_write calls: " << m_stat_pointcloud_writes
             << "\n";
     }
+    if (m_lock_stats) {
+        out << "  Lock waits (all threads, whole process):\n";
+        static const char* sites[] = { "shader masters", "dictionaries",
+                                       "point clouds" };
+        for (int s = 0; s < int(LockSite::NSites); ++s)
+            print(out, "    {:<16} {} in {} acquisitions\n", sites[s],
+                  Strutil::timeintervalformat(
+                      LockStats::wait_time(LockSite(s)), 2),
+                  LockStats::acquires[s].load());
+    }
     out << "  Memory total: " << m_stat_memory.memstat() << '\n';
     out << "    Master memory: " << m_stat_mem_master.memstat() << '\n';
     out << "        Master ops:            " << m_stat_mem_master_ops.memstat()
@@ -2510,15 +4214,11 @@ ShadingSystemImpl::getstats(int level) const
                                            2)
             << " (sum of all threads)\n";
         // Account for times of any groups that haven't yet been destroyed
-        {
-            spin_lock lock(m_all_shader_groups_mutex);
-            for (auto&& grp : m_all_shader_groups) {
-                if (ShaderGroupRef g = grp.lock()) {
-                    long long ticks = g->m_stat_total_shading_time_ticks;
-                    m_group_profile_times[g->name()] += ticks;
-                    g->m_stat_total_shading_time_ticks -= ticks;
-                }
-            }
+        for (const ShaderGroupRef& g : all_shader_groups()) {
+            long long ticks = g->m_stat_total_shading_time_ticks;
+            spin_lock lock(m_stat_mutex);
+            m_group_profile_times[g->name()] += ticks;
+            g->m_stat_total_shading_time_ticks -= ticks;
         }
         {
             spin_lock lock(m_stat_mutex);
@@ -2548,6 +4248,58 @@ ShadingSystemImpl::getstats(int level) const
         }
     }
 
+    if (m_profile_instrument) {
+        std::vector<LayerProfile> layers = gather_layer_profiles(
+            all_shader_groups());
+        double secs     = profile_clock_seconds();
+        long long total = 0;
+        for (const LayerProfile& lp : layers)
+            total += lp.ticks;
+        auto percent = [=](long long ticks) {
+            return total ? 100.0 * double(ticks) / double(total) : 0.0;
+        };
+        out << "  Instrumented profile (sum of all threads):\n";
+        out << "    Total time in layers: "
+            << Strutil::timeintervalformat(total * secs, 2) << "\n";
+        if (layers.size())
+            out << "    Most expensive layers:\n";
+        for (size_t i = 0; i < layers.size() && i < 10; ++i) {
+            const LayerProfile& lp(layers[i]);
+            out << fmtformat("      {} {:5.1f}%  {}.{} ({}), {} runs\n",
+                             Strutil::timeintervalformat(lp.ticks * secs, 2),
+                             percent(lp.ticks),
+                             lp.group.size() ? lp.group.c_str()
+                                             : "<unnamed group>",
+                             lp.layername, lp.shadername, lp.runs);
+        }
+        if (m_profile_instrument >= 2) {
+            std::vector<std::pair<const LayerProfile*, LayerProfile::Line>>
+                lines;
+            for (const LayerProfile& lp : layers)
+                for (const LayerProfile::Line& line : lp.lines)
+                    lines.emplace_back(&lp, line);
+            std::sort(lines.begin(), lines.end(),
+                      [](const std::pair<const LayerProfile*,
+                                         LayerProfile::Line>& a,
+                         const std::pair<const LayerProfile*,
+                                         LayerProfile::Line>& b) {
+                          return a.second.ticks > b.second.ticks;
+                      });
+            if (lines.size())
+                out << "    Most expensive source lines:\n";
+            for (size_t i = 0; i < lines.size() && i < 20; ++i) {
+                const LayerProfile& lp(*lines[i].first);
+                const LayerProfile::Line& line(lines[i].second);
+                out << fmtformat(
+                    "      {} {:5.1f}%  {}:{} ({}.{})\n",
+                    Strutil::timeintervalformat(line.ticks * secs, 2),
+                    percent(line.ticks), line.sourcefile, line.sourceline,
+                    lp.group.size() ? lp.group.c_str() : "<unnamed group>",
+                    lp.layername);
+            }
+        }
+    }
+
     return out.str();
 }
 
@@ -2567,7 +4319,12 @@ bool
 ShadingSystemImpl::Parameter(string_view name, TypeDesc t, const void* val,
                              ParamHints hints)
 {
-    return Parameter(*m_curgroup, name, t, val, hints);
+    ShaderGroupRef& group(curgroup());
+    if (!group) {
+        error("Parameter can only be called within ShaderGroupBegin/End");
+        return false;
+    }
+    return Parameter(*group, name, t, val, hints);
 }
 
 
@@ -2583,35 +4340,95 @@ ShadingSystemImpl::Parameter(ShaderGroup& group, string_view name, TypeDesc t,
 
 
 
+// Drop the references to groups that are gone
+static void
+prune_expired(std::vector<std::weak_ptr<ShaderGroup>>& refs)
+{
+    refs.erase(std::remove_if(refs.begin(), refs.end(),
+                              [](const auto& r) { return r.expired(); }),
+               refs.end());
+}
+
+
+
+void
+ShadingSystemImpl::compact_shader_groups()
+{
+    for (auto& shard : m_all_shader_groups) {
+        spin_lock lock(shard.mutex);
+        prune_expired(shard.groups);
+        shard.prune_at = std::max(size_t(64), 2 * shard.groups.size());
+    }
+    spin_lock lock(m_shared_groups_mutex);
+    for (auto i = m_shared_groups.begin(); i != m_shared_groups.end();) {
+        if (i->second.expired())
+            i = m_shared_groups.erase(i);
+        else
+            ++i;
+    }
+}
+
+
+
 ShaderGroupRef
 ShadingSystemImpl::ShaderGroupBegin(string_view groupname)
 {
     ShaderGroupRef group(new ShaderGroup(groupname));
     group->m_exec_repeat = m_exec_repeat;
+    // Group inherits global symbol location information that was
+    // active at the time the group was created.
+    group->add_symlocs(m_symlocs);
+    group->m_self = group;
     {
         // Record the group in the SS's census of all extant groups
-        spin_lock lock(m_all_shader_groups_mutex);
-        // Group inherits global symbol location information that was
-        // active at the time the group was created.
-        group->add_symlocs(m_symlocs);
-        m_all_shader_groups.push_back(group);
-        ++m_groups_to_compile_count;
-        m_curgroup = group;
-    }
+        GroupCensusShard& shard(
+            m_all_shader_groups[std::hash<std::thread::id>()(
+                                    std::this_thread::get_id())
+                                % m_all_shader_groups_shards]);
+        spin_lock lock(shard.mutex);
+        if (shard.groups.size() >= shard.prune_at) {
+            prune_expired(shard.groups);
+            shard.prune_at = std::max(size_t(64), 2 * shard.groups.size());
+        }
+        shard.groups.push_back(group);
+    }
+    // Every so often, also compact the shards of the threads that have
+    // stopped making groups, and the table of shareable groups, which
+    // would otherwise only grow as a long session churns through groups.
+    if (group->id() % 1024 == 0)
+        compact_shader_groups();
+    ++m_groups_to_compile_count;
+    curgroup() = group;
     return group;
 }
 
 
 
+std::vector<ShaderGroupRef>
+ShadingSystemImpl::all_shader_groups() const
+{
+    std::vector<ShaderGroupRef> groups;
+    for (auto& shard : m_all_shader_groups) {
+        spin_lock lock(shard.mutex);
+        for (auto& g : shard.groups)
+            if (ShaderGroupRef group = g.lock())
+                groups.push_back(std::move(group));
+    }
+    return groups;
+}
+
+
+
 bool
 ShadingSystemImpl::ShaderGroupEnd(void)
 {
-    if (!m_curgroup) {
+    ShaderGroupRef& group(curgroup());
+    if (!group) {
         error("ShaderGroupEnd() was called without ShaderGroupBegin()");
         return false;
     }
-    bool ok = ShaderGroupEnd(*m_curgroup);
-    m_curgroup.reset();  // no currently active group
+    bool ok = ShaderGroupEnd(*group);
+    group.reset();  // no currently active group
     return ok;
 }
 
@@ -2620,10 +4437,9 @@ ShadingSystemImpl::ShaderGroupEnd(void)
 bool
 ShadingSystemImpl::ShaderGroupEnd(ShaderGroup& group)
 {
-    // Lock just in case we do something not thread-safe within
-    // ShaderGroupEnd. This may be overly cautious, but unless it shows
-    // up as a major bottleneck, I'm inclined to play it safe.
-    lock_guard lock(m_mutex);
+    // Everything here only touches this group, which is still private to
+    // the thread building it, so no lock is needed and different groups
+    // may be ended concurrently. (Only archiving takes the global lock.)
 
     // Mark the layers that can be run lazily
     if (!group.m_group_use.empty()) {
@@ -2663,9 +4479,44 @@ ShadingSystemImpl::ShaderGroupEnd(ShaderGroup& group)
             if (OIIO::Strutil::contains(filename, "|"))
                 filename = OIIO::Strutil::replace(filename, "|", "_");
         }
+        lock_guard guard(m_mutex);
         archive_shadergroup(group, filename);
     }
 
+    // Remember the group's structure, so that identical groups can share
+    // one optimized and compiled copy. Groups with interactive params are
+    // left alone, since a ReParameter of one must not change the others.
+    group.m_structure_hash = 0;
+    if (m_opt_share_groups && group.nlayers()) {
+        bool shareable = true;
+        std::string structure;
+        for (int layer = 0, n = group.nlayers(); layer < n && shareable;
+             ++layer) {
+            const ShaderInstance* inst = group[layer];
+            if (!inst) {
+                shareable = false;
+                break;
+            }
+            for (int p = 0; p < inst->lastparam(); ++p)
+                if (inst->instoverride(p)->interactive())
+                    shareable = false;
+            // The same shader name could refer to a replaced master
+            structure += fmtformat("{} ", (const void*)inst->master());
+        }
+        if (shareable) {
+            structure += group.serialize();
+            group.m_structure_hash = std::max(
+                uint64_t(1), OIIO::farmhash::Fingerprint64(structure.data(),
+                                                           structure.size()));
+        }
+    }
+
+    // Keep the group's source, so that ReParameter can rebuild it once
+    // it's been optimized.
+    group.m_source_spec.clear();
+    if (m_reparam_reoptimize)
+        group.m_source_spec = group.serialize();
+
     group.m_complete = true;
     return true;
 }
@@ -2677,11 +4528,11 @@ ShadingSystemImpl::Shader(string_view shaderusage, string_view shadername,
                           string_view layername)
 {
     // Make sure we have a current attrib state
-    bool singleton = (!m_curgroup);
+    bool singleton = (!curgroup());
     if (singleton)
         ShaderGroupBegin("");
 
-    return Shader(*m_curgroup, shaderusage, shadername, layername);
+    return Shader(*curgroup(), shaderusage, shadername, layername);
 }
 
 
@@ -2746,11 +4597,12 @@ bool
 ShadingSystemImpl::ConnectShaders(string_view srclayer, string_view srcparam,
                                   string_view dstlayer, string_view dstparam)
 {
-    if (!m_curgroup) {
+    ShaderGroupRef& group(curgroup());
+    if (!group) {
         error("ConnectShaders can only be called within ShaderGroupBegin/End");
         return false;
     }
-    return ConnectShaders(*m_curgroup, srclayer, srcparam, dstlayer, dstparam);
+    return ConnectShaders(*group, srclayer, srcparam, dstlayer, dstparam);
 }
 
 
@@ -3187,57 +5039,473 @@ ShadingSystemImpl::ShaderGroupBegin(string_view groupname, string_view usage,
 
 
 bool
-ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
+ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername,
                                string_view paramname, TypeDesc type,
                                const void* val)
 {
-    // Find the named layer
-    ustring layername(layername_);
-    ShaderInstance* layer = NULL;
-    for (int i = 0, e = group.nlayers(); i < e; ++i) {
-        if (group[i]->layername() == layername) {
-            layer = group[i];
-            break;
-        }
-    }
-    if (!layer)
-        return false;  // could not find the named layer
+    ShadingSystem::ParamEdit edit;
+    edit.layername = layername;
+    edit.paramname = paramname;
+    edit.type      = type;
+    edit.val       = val;
+    int begin, end;
+    return ReParameter(group, span<ShadingSystem::ParamEdit>(&edit, 1), begin,
+                       end);
+}
 
-    // Find the named parameter within the layer
-    int paramindex = layer->findparam(ustring(paramname));
-    if (paramindex < 0)
-        return false;  // could not find the named parameter
 
-    Symbol* sym = layer->symbol(paramindex);
-    if (!sym) {
-        // Can have a paramindex >= 0, but no symbol when it's a master-symbol
-        OSL_DASSERT(layer->mastersymbol(paramindex)
-                    && "No symbol for paramindex");
-        return false;
-    }
 
-    // Check for mismatch versus previously-declared type
-    if ((relaxed_param_typecheck() && !relaxed_equivalent(sym->typespec(), type))
-        || (!relaxed_param_typecheck()
-            && !relaxed_equivalent(sym->typespec(), type)))
+bool
+ShadingSystemImpl::ReParameter(ShaderGroup& group,
+                               span<ShadingSystem::ParamEdit> edits,
+                               int& changed_begin, int& changed_end)
+{
+    changed_begin = changed_end = 0;
+    // Do everything that may fail, for the group and all its variants,
+    // before making any of the edits.
+    ReparamPlan plan;
+    if (!reparameter_plan(group, edits, plan))
         return false;
+    reparameter_apply(group, edits, plan, changed_begin, changed_end);
+    return true;
+}
 
-    // Can't change param value if the group has already been optimized,
-    // unless that parameter is marked lockgeom=0.
-    if (group.optimized() && sym->lockgeom())
+
+
+std::vector<ShaderGroup*>
+ShadingSystemImpl::variant_groups(ShaderGroup& group)
+{
+    std::vector<ShaderGroup*> variants;
+    for (auto& v : group.m_raytype_variants)
+        variants.push_back(v.group.get());
+    for (auto& v : group.m_userdata_variants)
+        variants.push_back(v.group.get());
+    for (auto& v : group.m_output_variants)
+        variants.push_back(v.group.get());
+    return variants;
+}
+
+
+
+bool
+ShadingSystemImpl::reparameter_plan(ShaderGroup& group,
+                                    span<ShadingSystem::ParamEdit> edits,
+                                    ReparamPlan& plan)
+{
+    // Each edit needs its symbol written, or (with a null symbol here)
+    // the group's source updated, and perhaps the group re-optimized.
+    std::vector<ShaderInstance*> layers(edits.size());
+    std::vector<Symbol*>& syms(plan.syms);
+    syms.assign(edits.size(), nullptr);
+    for (size_t i = 0; i < edits.size(); ++i) {
+        ShadingSystem::ParamEdit& e = edits[i];
+        // Indices kept from an earlier call are used if their names still
+        // match, which needs no ustring of the names.
+        ShaderInstance* layer = nullptr;
+        if (e.layerindex >= 0 && e.layerindex < group.nlayers()
+            && group[e.layerindex]->layername() == e.layername)
+            layer = group[e.layerindex];
+        Symbol* sym = layer ? layer->symbol(e.paramindex) : nullptr;
+        if (!sym || sym->name() != e.paramname) {
+            // Find the named layer, and the named parameter within it
+            ustring layername(e.layername);
+            layer = nullptr;
+            for (int l = 0, n = group.nlayers(); l < n; ++l) {
+                if (group[l]->layername() == layername) {
+                    layer        = group[l];
+                    e.layerindex = l;
+                    break;
+                }
+            }
+            if (!layer)
+                return false;  // could not find the named layer
+            e.paramindex = layer->findparam(ustring(e.paramname));
+            if (e.paramindex < 0)
+                return false;  // could not find the named parameter
+            sym = layer->symbol(e.paramindex);
+        }
+        layers[i] = layer;
+
+        if (!sym) {
+            // An optimized layer that would never run has had its symbols
+            // pruned; with reparam_reoptimize we can still take the value.
+            const Symbol* msym = layer->mastersymbol(e.paramindex);
+            if (group.optimized() && m_reparam_reoptimize && layer->unused()
+                && msym && relaxed_equivalent(msym->typespec(), e.type))
+                continue;
+            // Can have a paramindex >= 0, but no symbol when it's a
+            // master-symbol
+            OSL_DASSERT(msym && "No symbol for paramindex");
+            return false;
+        }
+
+        // Check for mismatch versus previously-declared type
+        if (!relaxed_equivalent(sym->typespec(), e.type))
+            return false;
+
+        // Can't change param value if the group has already been
+        // optimized, unless that parameter is marked lockgeom=0 (or we
+        // may re-optimize).
+        if (group.optimized() && sym->lockgeom()) {
+            if (m_reparam_reoptimize)
+                continue;
+            return false;
+        }
+        syms[i] = sym;
+    }
+
+    // The values the optimized code may depend on go into a copy of the
+    // group's source, rebuilt into fresh layers if the code does depend
+    // on them.
+    bool rebuild = false;
+    for (size_t i = 0; i < edits.size(); ++i) {
+        if (syms[i])
+            continue;
+        if (!plan.respec) {
+            plan.spec   = group.m_source_spec;
+            plan.respec = true;
+        }
+        bool affects_code = false;
+        if (!reparameter_respec(group, layers[i], edits[i].paramindex,
+                                edits[i].type, edits[i].val, plan.spec,
+                                affects_code))
+            return false;
+        if (affects_code) {
+            rebuild = true;
+        } else {
+            syms[i] = layers[i]->symbol(edits[i].paramindex);
+            plan.noops += 1;
+        }
+    }
+    if (rebuild) {
+        // Build them without disturbing the state of the non-threadsafe
+        // group API.
+        ShaderGroupRef prevgroup = curgroup();
+        plan.fresh = ShaderGroupBegin(group.name(), group.m_group_use,
+                                      plan.spec);
+        if (plan.fresh)
+            ShaderGroupEnd(*plan.fresh);
+        curgroup() = prevgroup;
+        if (!plan.fresh || plan.fresh->nlayers() != group.nlayers())
+            return false;
+    }
+
+    // Keep the variants of the group in step with it
+    std::vector<ShaderGroup*> variants = variant_groups(group);
+    plan.variants.resize(variants.size());
+    for (size_t v = 0; v < variants.size(); ++v)
+        if (!reparameter_plan(*variants[v], edits, plan.variants[v]))
+            return false;
+    return true;
+}
+
+
+
+void
+ShadingSystemImpl::reparameter_apply(ShaderGroup& group,
+                                     span<ShadingSystem::ParamEdit> edits,
+                                     ReparamPlan& plan, int& changed_begin,
+                                     int& changed_end)
+{
+    std::vector<ShaderGroup*> variants = variant_groups(group);
+    for (size_t v = 0; v < variants.size(); ++v) {
+        int b = 0, e = 0;
+        reparameter_apply(*variants[v], edits, plan.variants[v], b, e);
+    }
+
+    // Do the deed, for all the params in the interactive block under its
+    // lock, so the renderer sees the edits (and their bytes) all at once.
+    const std::vector<Symbol*>& syms(plan.syms);
+    auto block = group.m_interactive.get();
+    std::unique_lock<spin_mutex> lock;
+    if (block)
+        lock = std::unique_lock<spin_mutex>(block->mutex);
+    for (size_t i = 0; i < edits.size(); ++i) {
+        const ShadingSystem::ParamEdit& e = edits[i];
+        if (!syms[i])
+            continue;
+        memcpy(syms[i]->data(), e.val, e.type.size());
+        if (group.optimized() && e.type.basetype == TypeDesc::STRING)
+            for (int s = 0, n = e.type.numelements(); s < n; ++s)
+                device_string_index(((const ustring*)e.val)[s]);
+        // Note the change if the param lives in the interactive block
+        ptrdiff_t offset = block ? (char*)syms[i]->data() - block->data.get()
+                                 : -1;
+        if (offset >= 0 && offset < block->size) {
+            int end = int(offset + e.type.size());
+            if (changed_begin == changed_end) {
+                changed_begin = int(offset);
+                changed_end   = end;
+            } else {
+                changed_begin = std::min(changed_begin, int(offset));
+                changed_end   = std::max(changed_end, end);
+            }
+        }
+    }
+    if (block && changed_begin != changed_end) {
+        if (block->dirty_begin == block->dirty_end) {
+            block->dirty_begin = changed_begin;
+            block->dirty_end   = changed_end;
+        } else {
+            block->dirty_begin = std::min(block->dirty_begin, changed_begin);
+            block->dirty_end   = std::max(block->dirty_end, changed_end);
+        }
+    }
+    if (lock.owns_lock())
+        lock.unlock();
+    // Results cached with the old values are never found again
+    group.m_shading_cache_epoch = ShadingCache::new_epoch();
+
+    if (plan.respec)
+        group.m_source_spec = std::move(plan.spec);
+    m_stat_reparam_noops += plan.noops;
+    if (plan.fresh)
+        reparameter_reoptimize(group, *plan.fresh);
+}
+
+
+
+bool
+ShadingSystemImpl::take_interactive_changes(ShaderGroup& group, int& begin,
+                                            int& end)
+{
+    auto block = group.m_interactive.get();
+    if (!block)
+        return false;
+    spin_lock lock(block->mutex);
+    begin              = block->dirty_begin;
+    end                = block->dirty_end;
+    block->dirty_begin = block->dirty_end = 0;
+    return begin != end;
+}
+
+
+
+uint32_t
+ShadingSystemImpl::device_string_index(ustring str)
+{
+    ustringhash hash(str);
+    spin_lock lock(m_device_strings_mutex);
+    auto found = m_device_string_indices.find(hash);
+    if (found != m_device_string_indices.end())
+        return found->second;
+    uint32_t index = uint32_t(m_device_strings.size());
+    m_device_strings.push_back(hash);
+    m_device_string_indices.emplace(hash, index);
+    return index;
+}
+
+
+
+uint32_t
+ShadingSystemImpl::find_device_string(ustringhash hash) const
+{
+    spin_lock lock(m_device_strings_mutex);
+    auto found = m_device_string_indices.find(hash);
+    return found != m_device_string_indices.end() ? found->second : ~0u;
+}
+
+
+
+size_t
+ShadingSystemImpl::device_string_table(size_t first,
+                                       std::vector<uint64_t>& hashes) const
+{
+    spin_lock lock(m_device_strings_mutex);
+    for (size_t i = first, e = m_device_strings.size(); i < e; ++i)
+        hashes.push_back(m_device_strings[i].hash());
+    return m_device_strings.size();
+}
+
+
+
+void
+ShadingSystemImpl::add_device_strings(ShaderGroup& group)
+{
+    for (int layer = 0; layer < group.nlayers(); ++layer) {
+        ShaderInstance* inst = group[layer];
+        if (inst->unused())
+            continue;
+        FOREACH_SYM(Symbol & s, inst)
+        {
+            if (!s.typespec().is_string_based() || !s.dataptr()
+                || (s.symtype() != SymTypeConst && s.symtype() != SymTypeParam
+                    && s.symtype() != SymTypeOutputParam))
+                continue;
+            const ustring* strs = (const ustring*)s.dataptr();
+            int n               = s.typespec().simpletype().numelements();
+            for (int i = 0; i < n; ++i)
+                device_string_index(strs[i]);
+        }
+    }
+}
+
+
+
+// Format a "param" statement of a serialized group the same way that
+// ShaderGroup::serialize() does.
+static std::string
+serialize_param(TypeDesc type, ustring name, const void* val)
+{
+    std::ostringstream out;
+    out.imbue(std::locale::classic());  // force C locale
+    out.precision(9);
+    out << "param " << type << ' ' << name;
+    int nvals = type.numelements() * type.aggregate;
+    for (int i = 0; i < nvals; ++i) {
+        if (type.basetype == TypeDesc::INT)
+            out << ' ' << ((const int*)val)[i];
+        else if (type.basetype == TypeDesc::FLOAT)
+            out << ' ' << ((const float*)val)[i];
+        else if (type.basetype == TypeDesc::STRING)
+            out << ' ' << '\"'
+                << Strutil::escape_chars(((const ustring*)val)[i]) << '\"';
+    }
+    out << " ;\n";
+    return out.str();
+}
+
+
+
+bool
+ShadingSystemImpl::reparameter_respec(ShaderGroup& group,
+                                      ShaderInstance* layer, int paramindex,
+                                      TypeDesc type, const void* val,
+                                      std::string& spec, bool& affects_code)
+{
+    if (group.m_source_spec.empty())
+        return false;  // reparam_reoptimize was off at ShaderGroupEnd
+    Symbol* sym        = layer->symbol(paramindex);
+    const Symbol* psym = sym ? sym : layer->mastersymbol(paramindex);
+    TypeDesc ptype     = psym->typespec().simpletype();
+    if (psym->typespec().is_closure_based() || psym->typespec().is_structure()
+        || ptype.is_unsized_array() || ptype.size() != type.size())
+        return false;
+    if (sym && !memcmp(sym->data(), val, type.size()))
+        return true;  // Same value as before, nothing to do
+
+    // Update the source the group is rebuilt from: drop any old value of
+    // the param from this layer's statements, and put the new value right
+    // before the layer's "shader" statement.
+    size_t layerend   = spec.find(fmtformat("shader {} {} ;\n",
+                                            layer->shadername(),
+                                            layer->layername()));
+    if (layerend == std::string::npos)
         return false;
+    size_t layerbegin = 0;
+    if (layerend > 0) {
+        size_t prev = spec.rfind("shader ", layerend - 1);
+        if (prev != std::string::npos)
+            layerbegin = spec.find('\n', prev) + 1;
+    }
+    for (size_t pos = layerbegin; pos < layerend;) {
+        size_t eol = spec.find('\n', pos) + 1;
+        std::vector<string_view> words;
+        Strutil::split(string_view(spec).substr(pos, eol - pos), words, " ",
+                       4);
+        if (words.size() > 2 && words[0] == "param"
+            && words[2] == string_view(psym->name())) {
+            spec.erase(pos, eol - pos);
+            layerend -= eol - pos;
+        } else {
+            pos = eol;
+        }
+    }
+    spec.insert(layerend, serialize_param(ptype, psym->name(), val));
 
-    // Do the deed
-    memcpy(sym->data(), val, type.size());
+    // Only re-optimize if the optimized code could depend on the value:
+    // it was folded into constants by the runtime optimizer, or it's still
+    // read by the code or passed to downstream layers. A layer that never
+    // runs doesn't matter at all.
+    affects_code = sym && !layer->unused()
+                   && (layer->param_folded(paramindex) || sym->everused()
+                       || sym->connected_down());
     return true;
 }
 
 
 
+void
+ShadingSystemImpl::reparameter_reoptimize(ShaderGroup& group,
+                                          ShaderGroup& fresh)
+{
+    lock_guard lock(group.m_mutex);
+    std::vector<ustring> entry_layers;
+    for (int i = 0, n = group.nlayers(); i < n; ++i)
+        if (group[i]->entry_layer())
+            entry_layers.push_back(group[i]->layername());
+    group.m_layers           = fresh.m_layers;
+    group.m_num_entry_layers = 0;
+    for (auto&& e : entry_layers)
+        group.mark_entry_layer(e);
+    group.m_raytype_queries = fresh.m_raytype_queries;
+
+    // Forget everything that optimization and JIT produced
+    group.m_optimized      = 0;
+    group.m_jitted         = 0;
+    group.m_batch_jitted   = 0;
+    group.m_does_nothing   = false;
+    group.m_tierup_pending = false;
+    group.m_layer_exec_counts.reset();
+    group.llvm_compiled_init(nullptr);
+    group.llvm_compiled_version(nullptr);
+    group.m_llvm_compiled_layers.reset();
+    group.m_llvm_compiled_nlayers = 0;
+#if OSL_USE_BATCHED
+    group.llvm_compiled_wide_init(nullptr);
+    group.llvm_compiled_wide_version(nullptr);
+    group.m_llvm_compiled_wide_layers.clear();
+    group.m_batched_uniformity_syms.clear();
+    group.m_batched_uniformity_counts.reset();
+#endif
+    group.m_llvm_groupdata_size      = 0;
+    group.m_llvm_groupdata_wide_size = 0;
+    group.m_llvm_ptx_compiled_version.clear();
+    group.m_unknown_textures_needed   = false;
+    group.m_unknown_closures_needed   = false;
+    group.m_unknown_attributes_needed = false;
+    group.m_globals_read              = 0;
+    group.m_globals_write             = 0;
+    group.m_cacheable                 = false;
+    group.m_constant_outputs.reset();
+    group.m_closure_memory_bound      = -1;
+    group.m_cost_estimate             = 0.0f;
+    group.m_textures_needed.clear();
+    group.m_closures_needed.clear();
+    group.m_globals_needed.clear();
+    group.m_userdata_names.clear();
+    group.m_userdata_types.clear();
+    group.m_userdata_offsets.clear();
+    group.m_userdata_derivs.clear();
+    group.m_userdata_layers.clear();
+    group.m_userdata_init_vals.clear();
+    group.m_attributes_needed.clear();
+    group.m_attribute_scopes.clear();
+    group.m_attribute_types.clear();
+
+    // The group no longer matches whatever it shared code with
+    group.m_structure_hash = 0;
+    group.m_shared_from.reset();
+    group.m_sharers.clear();
+    {
+        spin_lock shared_lock(m_shared_groups_mutex);
+        for (auto& entry : m_shared_groups)
+            if (entry.second.lock().get() == &group)
+                entry.second.reset();
+    }
+
+    m_stat_reparam_reopts += 1;
+}
+
+
+
 PerThreadInfo*
 ShadingSystemImpl::create_thread_info()
 {
-    return new PerThreadInfo;
+    PerThreadInfo* threadinfo = new PerThreadInfo;
+    if (m_numa_nodes > 1)
+        threadinfo->numa_node = current_numa_node() % m_numa_nodes;
+    return threadinfo;
 }
 
 
@@ -3263,22 +5531,88 @@ ShadingSystemImpl::get_context(PerThreadInfo* threadinfo,
         return nullptr;
 #endif
     }
-    ShadingContext* ctx = threadinfo->context_pool.empty()
-                              ? new ShadingContext(*this, threadinfo)
-                              : threadinfo->pop_context();
+    ShadingContext* ctx = nullptr;
+    if (!threadinfo->context_pool.empty())
+        ctx = threadinfo->pop_context();
+    else if ((ctx = pop_pooled_context(threadinfo->numa_node)))
+        ctx->thread_info(threadinfo);  // May have come from another thread
+    else
+        ctx = new ShadingContext(*this, threadinfo);
     ctx->texture_thread_info(texture_threadinfo);
     return ctx;
 }
 
 
 
+int
+ShadingSystemImpl::context_pool_band(int numa_node, int& first) const
+{
+    // With numa_aware, each node has its own band of the pool, so that a
+    // context (whose heap and scratch its first thread touched) stays on
+    // the node where its memory is.
+    int n = m_context_pool_size;
+    first = 0;
+    if (m_numa_nodes > 1 && n >= m_numa_nodes) {
+        n /= m_numa_nodes;
+        first = (numa_node % m_numa_nodes) * n;
+    }
+    return n;
+}
+
+
+
+ShadingContext*
+ShadingSystemImpl::pop_pooled_context(int numa_node)
+{
+    int first = 0, n = context_pool_band(numa_node, first);
+    if (!n)
+        return nullptr;
+    int start = int(std::hash<std::thread::id>()(std::this_thread::get_id())
+                    % size_t(n));
+    for (int i = 0; i < n; ++i) {
+        auto& slot = m_context_pool[first + (start + i) % n];
+        if (slot.load(std::memory_order_relaxed))
+            if (ShadingContext* ctx = slot.exchange(nullptr,
+                                                    std::memory_order_acquire))
+                return ctx;
+    }
+    return nullptr;
+}
+
+
+
+bool
+ShadingSystemImpl::push_pooled_context(ShadingContext* ctx)
+{
+    int first = 0, n = context_pool_band(ctx->thread_info()->numa_node, first);
+    if (!n)
+        return false;
+    int start = int(std::hash<std::thread::id>()(std::this_thread::get_id())
+                    % size_t(n));
+    for (int i = 0; i < n; ++i) {
+        auto& slot               = m_context_pool[first + (start + i) % n];
+        ShadingContext* expected = nullptr;
+        if (!slot.load(std::memory_order_relaxed)
+            && slot.compare_exchange_strong(expected, ctx,
+                                            std::memory_order_release))
+            return true;
+    }
+    return false;
+}
+
+
+
 void
 ShadingSystemImpl::release_context(ShadingContext* ctx)
 {
     if (!ctx)
         return;
     ctx->process_errors();
-    ctx->thread_info()->context_pool.push(ctx);
+    ctx->unpin_jit_groups();
+    // Prefer the shared pool, where whichever thread next needs a context
+    // can reuse this one; only when it's full keep it with this thread.
+    if (!push_pooled_context(ctx))
+        ctx->thread_info()->context_pool.push(ctx);
 }
 
 
@@ -3288,12 +5622,42 @@ ShadingSystemImpl::execute(ShadingContext& ctx, ShaderGroup& group, int index,
                            ShaderGlobals& ssg, void* userdata_base_ptr,
                            void* output_base_ptr, bool run)
 {
+    if (run && capturing())
+        capture_point(group, ssg);
     return ctx.execute(group, index, ssg, userdata_base_ptr, output_base_ptr,
                        run);
 }
 
 
 
+bool
+ShadingSystemImpl::execute(ShadingContext& ctx, cspan<ShaderGroup*> groups,
+                           int index, ShaderGlobals& ssg,
+                           void* userdata_base_ptr, void* output_base_ptr)
+{
+    if (capturing())
+        for (ShaderGroup* g : groups)
+            if (g)
+                capture_point(*g, ssg);
+    return ctx.execute(groups, index, ssg, userdata_base_ptr, output_base_ptr);
+}
+
+
+
+bool
+ShadingSystemImpl::execute(ShadingContext& ctx, ShaderGroup& group, int index,
+                           span<ShaderGlobals> globals,
+                           void* userdata_base_ptr, void* output_base_ptr)
+{
+    if (capturing())
+        for (ShaderGlobals& ssg : globals)
+            capture_point(group, ssg);
+    return ctx.execute(group, index, globals, userdata_base_ptr,
+                       output_base_ptr);
+}
+
+
+
 const void*
 ShadingSystemImpl::get_symbol(ShadingContext& ctx, ustring layername,
                               ustring symbolname, TypeDesc& type)
@@ -3441,211 +5805,1340 @@ ShadingSystemImpl::raytype_bit(ustring name)
 
 
 bool
-ShadingSystemImpl::is_renderer_output(ustring layername, ustring paramname,
-                                      ShaderGroup* group) const
+ShadingSystemImpl::set_raytype_closures(ustring raytype,
+                                        cspan<int> closure_ids)
 {
-    ustring name2 = ustring::fmtformat("{}.{}", layername, paramname);
-    if (group) {
-        for (auto&& sl : group->m_symlocs) {
-            if (sl.arena == SymArena::Outputs
-                && (sl == paramname || sl == name2))
-                return true;
-        }
-        const std::vector<ustring>& aovs(group->m_renderer_outputs);
-        if (aovs.size() > 0) {
-            if (std::find(aovs.begin(), aovs.end(), paramname) != aovs.end())
-                return true;
-            // Try "layer.name"
-            if (std::find(aovs.begin(), aovs.end(), name2) != aovs.end())
-                return true;
-        }
+    int bit = raytype_bit(raytype);
+    if (!bit) {
+        errorfmt("set_raytype_closures: unknown raytype \"{}\"", raytype);
+        return false;
     }
-    const std::vector<ustring>& aovs(m_renderer_outputs);
-    if (aovs.size() > 0) {
-        if (std::find(aovs.begin(), aovs.end(), paramname) != aovs.end())
+    std::vector<int> ids(closure_ids.begin(), closure_ids.end());
+    std::sort(ids.begin(), ids.end());
+    for (auto& rc : m_raytype_closures) {
+        if (rc.first == bit) {
+            rc.second = std::move(ids);
             return true;
-        // Try "layer.name"
-        if (std::find(aovs.begin(), aovs.end(), name2) != aovs.end())
+        }
+    }
+    m_raytype_closures.emplace_back(bit, std::move(ids));
+    return true;
+}
+
+
+
+bool
+ShadingSystemImpl::set_raytype_noderivs(ustring raytype, float texture_width)
+{
+    int bit = raytype_bit(raytype);
+    if (!bit) {
+        errorfmt("set_raytype_noderivs: unknown raytype \"{}\"", raytype);
+        return false;
+    }
+    for (auto& rd : m_raytype_noderivs) {
+        if (rd.first == bit) {
+            rd.second = texture_width;
             return true;
+        }
     }
-    return false;
+    m_raytype_noderivs.emplace_back(bit, texture_width);
+    return true;
+}
+
+
+
+bool
+ShadingSystemImpl::add_raytype_variant(ShaderGroup& group, int raytypes_on,
+                                       int raytypes_off)
+{
+    if (!group.m_complete) {
+        errorfmt("add_raytype_variant: group \"{}\" is not complete",
+                 group.name());
+        return false;
+    }
+    // The variant is rebuilt from the group's source, which only survives
+    // optimization if reparam_reoptimize kept it.
+    std::string spec = group.m_source_spec;
+    if (spec.empty()) {
+        if (group.optimized()) {
+            errorfmt("add_raytype_variant: group \"{}\" is already optimized",
+                     group.name());
+            return false;
+        }
+        spec = group.serialize();
+    }
+    raytypes_on |= group.raytypes_on();
+    raytypes_off |= group.raytypes_off();
+    if (raytypes_on & raytypes_off) {
+        errorfmt("add_raytype_variant: raytypes both on and off for group "
+                 "\"{}\"",
+                 group.name());
+        return false;
+    }
+
+    ustring name = ustring::fmtformat("{}:raytypes{:x}/{:x}", group.name(),
+                                      raytypes_on, raytypes_off);
+
+    // Build the copy without disturbing the state of the non-threadsafe
+    // group API.
+    ShaderGroupRef prevgroup = curgroup();
+    ShaderGroupRef variant   = ShaderGroupBegin(name, group.m_group_use, spec);
+    if (variant)
+        ShaderGroupEnd(*variant);
+    curgroup() = prevgroup;
+    if (!variant || variant->nlayers() != group.nlayers())
+        return false;
+
+    lock_guard lock(group.m_mutex);
+    copy_variant_settings(*variant, group);
+    variant->set_raytypes(raytypes_on, raytypes_off);
+    group.m_raytype_variants.push_back({ raytypes_on, raytypes_off, variant });
+    return true;
 }
 
 
 
 void
-ShadingSystemImpl::group_post_jit_cleanup(ShaderGroup& group)
+ShadingSystemImpl::copy_variant_settings(ShaderGroup& variant,
+                                         const ShaderGroup& group)
 {
-    // Once we're generated the IR, we really don't need the ops and args,
-    // and we only need the syms that include the params.
-    off_t symmem         = 0;
-    size_t connectionmem = 0;
-    for (int layer = 0; layer < group.nlayers(); ++layer) {
-        ShaderInstance* inst = group[layer];
-        // We no longer needs ops and args -- create empty vectors and
-        // swap with the ones in the instance.
-        OpcodeVec emptyops;
-        inst->ops().swap(emptyops);
-        std::vector<int> emptyargs;
-        inst->args().swap(emptyargs);
-        if (inst->unused()) {
-            // If we'll never use the layer, we don't need the syms at all
-            SymbolVec nosyms;
-            std::swap(inst->symbols(), nosyms);
-            symmem += vectorbytes(nosyms);
-            // also don't need the connection info any more
-            connectionmem += (off_t)inst->clear_connections();
+    variant.m_exec_repeat       = group.m_exec_repeat;
+    variant.m_renderer_outputs  = group.m_renderer_outputs;
+    variant.m_static_attributes = group.m_static_attributes;
+    variant.add_symlocs(group.m_symlocs);
+    variant.clear_entry_layers();
+    for (int i = 0, n = group.nlayers(); i < n; ++i)
+        if (group[i]->entry_layer())
+            variant.mark_entry_layer(group[i]->layername());
+}
+
+
+
+bool
+ShadingSystemImpl::add_userdata_variant(ShaderGroup& group, ustring name,
+                                        TypeDesc type, const void* val)
+{
+    if (!group.m_complete) {
+        errorfmt("add_userdata_variant: group \"{}\" is not complete",
+                 group.name());
+        return false;
+    }
+    if (type.is_unsized_array() || type.size() > 1024
+        || (type.basetype != TypeDesc::INT && type.basetype != TypeDesc::FLOAT
+            && type.basetype != TypeDesc::STRING)) {
+        errorfmt("add_userdata_variant: can't specialize on {} userdata",
+                 type);
+        return false;
+    }
+    auto& variants = group.m_userdata_variants;
+    if (variants.size()
+        && (variants[0].name != name || variants[0].type != type)) {
+        errorfmt("add_userdata_variant: group \"{}\" already specializes on "
+                 "userdata \"{}\"",
+                 group.name(), variants[0].name);
+        return false;
+    }
+    // As for raytype variants, the copy is rebuilt from the source.
+    std::string spec = group.m_source_spec;
+    if (spec.empty()) {
+        if (group.optimized()) {
+            errorfmt("add_userdata_variant: group \"{}\" is already optimized",
+                     group.name());
+            return false;
+        }
+        spec = group.serialize();
+    }
+    ustring vname = ustring::fmtformat("{}:{}#{}", group.name(), name,
+                                       variants.size());
+
+    ShaderGroupRef prevgroup = curgroup();
+    ShaderGroupRef variant   = ShaderGroupBegin(vname, group.m_group_use, spec);
+    if (variant)
+        ShaderGroupEnd(*variant);
+    curgroup() = prevgroup;
+    if (!variant || variant->nlayers() != group.nlayers())
+        return false;
+    int folded = 0;
+    for (int i = 0, n = variant->nlayers(); i < n; ++i)
+        folded += (*variant)[i]->fold_userdata(name, type, val);
+    if (!folded) {
+        errorfmt("add_userdata_variant: no parameter of group \"{}\" binds "
+                 "to userdata \"{}\"",
+                 group.name(), name);
+        return false;
+    }
+    // Its params no longer match the group's, so it can't share its code
+    variant->m_structure_hash = 0;
+
+    lock_guard lock(group.m_mutex);
+    copy_variant_settings(*variant, group);
+    variant->set_raytypes(group.raytypes_on(), group.raytypes_off());
+    std::vector<char> value((const char*)val, (const char*)val + type.size());
+    variants.push_back({ name, type, std::move(value), variant });
+    return true;
+}
+
+
+
+ShaderGroupRef
+ShadingSystemImpl::output_variant(ShaderGroup& group, cspan<ustring> outputs)
+{
+    std::vector<ustring> names(outputs.begin(), outputs.end());
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    if (names.empty()) {
+        errorfmt("output_variant: no outputs requested of group \"{}\"",
+                 group.name());
+        return ShaderGroupRef();
+    }
+    {
+        lock_guard lock(group.m_mutex);
+        for (auto& v : group.m_output_variants)
+            if (v.outputs == names)
+                return v.group;
+    }
+    if (!group.m_complete) {
+        errorfmt("output_variant: group \"{}\" is not complete",
+                 group.name());
+        return ShaderGroupRef();
+    }
+    // As for raytype variants, the copy is rebuilt from the source.
+    std::string spec = group.m_source_spec;
+    if (spec.empty()) {
+        if (group.optimized()) {
+            errorfmt("output_variant: group \"{}\" is already optimized",
+                     group.name());
+            return ShaderGroupRef();
+        }
+        spec = group.serialize();
+    }
+    ustring vname = ustring::fmtformat("{}:outputs({})", group.name(),
+                                       Strutil::join(names, ","));
+
+    ShaderGroupRef prevgroup = curgroup();
+    ShaderGroupRef variant   = ShaderGroupBegin(vname, group.m_group_use, spec);
+    if (variant)
+        ShaderGroupEnd(*variant);
+    curgroup() = prevgroup;
+    if (!variant || variant->nlayers() != group.nlayers())
+        return ShaderGroupRef();
+    // Its outputs differ from the group's, so it can't share its code
+    variant->m_structure_hash = 0;
+
+    lock_guard lock(group.m_mutex);
+    for (auto& v : group.m_output_variants)
+        if (v.outputs == names)
+            return v.group;  // Another thread made it meanwhile
+    copy_variant_settings(*variant, group);
+    variant->set_raytypes(group.raytypes_on(), group.raytypes_off());
+    variant->m_renderer_outputs = names;
+    variant->m_outputs_only     = true;
+    variant->m_closures_unused  = std::find(names.begin(), names.end(),
+                                           Strings::Ci)
+                                 == names.end();
+    group.m_output_variants.push_back({ names, variant });
+    return variant;
+}
+
+
+
+ShaderGroup&
+ShadingSystemImpl::userdata_variant(ShaderGroup& group, ShaderGlobals& sg,
+                                    void* userdata_base_ptr, int shadeindex)
+{
+    const auto& variants = group.m_userdata_variants;
+    ustring name         = variants[0].name;
+    TypeDesc type        = variants[0].type;
+    // Placed userdata is read where the renderer put it, anything else is
+    // asked of the renderer just as the shader would.
+    const void* value             = nullptr;
+    const SymLocationDesc* symloc = userdata_base_ptr
+                                        ? group.find_symloc(name,
+                                                            SymArena::UserData)
+                                        : nullptr;
+    char buf[1024];
+    if (symloc && symloc->type == type)
+        value = (const char*)userdata_base_ptr + symloc->offset
+                + symloc->stride * shadeindex;
+    else if (renderer()->get_userdata(false, name, type, &sg, buf))
+        value = buf;
+    if (value)
+        for (auto& v : variants)
+            if (!memcmp(v.value.data(), value, v.value.size()))
+                return *v.group;
+    return group;
+}
+
+
+
+bool
+ShadingSystemImpl::closure_unread(int raytypes_on, int closure_id) const
+{
+    for (auto& rc : m_raytype_closures)
+        if ((rc.first & raytypes_on)
+            && !std::binary_search(rc.second.begin(), rc.second.end(),
+                                   closure_id))
+            return true;
+    return false;
+}
+
+
+
+bool
+ShadingSystemImpl::raytype_noderivs(int raytypes_on,
+                                    float* texture_width) const
+{
+    bool noderivs = false;
+    float width   = 0.0f;
+    for (auto& rd : m_raytype_noderivs) {
+        if (rd.first & raytypes_on) {
+            noderivs = true;
+            width    = std::max(width, rd.second);
+        }
+    }
+    if (texture_width)
+        *texture_width = width;
+    return noderivs;
+}
+
+
+
+bool
+ShadingSystemImpl::is_renderer_output(ustring layername, ustring paramname,
+                                      ShaderGroup* group) const
+{
+    ustring name2 = ustring::fmtformat("{}.{}", layername, paramname);
+    if (group && group->m_outputs_only) {
+        // Only the outputs asked of an output variant
+        const std::vector<ustring>& aovs(group->m_renderer_outputs);
+        return std::find(aovs.begin(), aovs.end(), paramname) != aovs.end()
+               || std::find(aovs.begin(), aovs.end(), name2) != aovs.end();
+    }
+    if (group) {
+        for (auto&& sl : group->m_symlocs) {
+            if (sl.arena == SymArena::Outputs
+                && (sl == paramname || sl == name2))
+                return true;
+        }
+        const std::vector<ustring>& aovs(group->m_renderer_outputs);
+        if (aovs.size() > 0) {
+            if (std::find(aovs.begin(), aovs.end(), paramname) != aovs.end())
+                return true;
+            // Try "layer.name"
+            if (std::find(aovs.begin(), aovs.end(), name2) != aovs.end())
+                return true;
+        }
+    }
+    const std::vector<ustring>& aovs(m_renderer_outputs);
+    if (aovs.size() > 0) {
+        if (std::find(aovs.begin(), aovs.end(), paramname) != aovs.end())
+            return true;
+        // Try "layer.name"
+        if (std::find(aovs.begin(), aovs.end(), name2) != aovs.end())
+            return true;
+    }
+    return false;
+}
+
+
+
+void
+ShadingSystemImpl::group_post_jit_cleanup(ShaderGroup& group)
+{
+    // Once we're generated the IR, we really don't need the ops and args,
+    // and we only need the syms that include the params.
+    off_t symmem         = 0;
+    size_t connectionmem = 0;
+    for (int layer = 0; layer < group.nlayers(); ++layer) {
+        ShaderInstance* inst = group[layer];
+        // We no longer needs ops and args -- create empty vectors and
+        // swap with the ones in the instance.
+        OpcodeVec emptyops;
+        inst->ops().swap(emptyops);
+        std::vector<int> emptyargs;
+        inst->args().swap(emptyargs);
+        if (inst->unused()) {
+            // If we'll never use the layer, we don't need the syms at all
+            SymbolVec nosyms;
+            std::swap(inst->symbols(), nosyms);
+            symmem += vectorbytes(nosyms);
+            // also don't need the connection info any more
+            connectionmem += (off_t)inst->clear_connections();
+        } else if (m_jit_release_memory) {
+            // The connections were only needed by the optimizer. Of the
+            // symbols, only the params are still used (by ReParameter, and
+            // find_symbol of outputs); the locals, temps and constants
+            // after them were only for the code, and their values live on
+            // the JIT's stack where get_symbol can't reach them anyway.
+            connectionmem += (off_t)inst->clear_connections();
+            off_t before = vectorbytes(inst->symbols());
+            SymbolVec params(inst->symbols().begin(),
+                             inst->symbols().begin() + inst->lastparam());
+            std::swap(inst->symbols(), params);
+            if (inst->m_Psym >= inst->lastparam())
+                inst->m_Psym = -1;
+            if (inst->m_Nsym >= inst->lastparam())
+                inst->m_Nsym = -1;
+            symmem += before - vectorbytes(inst->symbols());
+        }
+    }
+    {
+        // adjust memory stats
+        spin_lock lock(m_stat_mutex);
+        m_stat_mem_inst_syms -= symmem;
+        m_stat_mem_inst_connections -= connectionmem;
+        m_stat_mem_inst -= symmem + connectionmem;
+        m_stat_memory -= symmem + connectionmem;
+    }
+}
+
+
+
+void
+ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
+                                  bool do_jit)
+{
+    if (ctx) {
+        // Always have ShadingContext remember the group we just optimized
+        // to allow calls to find_symbol and get_symbol to be valid after
+        // optimization without needed to execute or jit
+        ctx->group(&group);
+    }
+    if (group.optimized() && (!do_jit || group.jitted()))
+        return;  // already optimized and optionally jitted
+
+    OIIO::Timer timer;
+    lock_guard lock(group.m_mutex);
+    bool need_jit = do_jit && !group.jitted();
+    if (group.optimized() && !need_jit) {
+        // The group was somehow optimized by another thread between the
+        // time we checked group.optimized() and now that we have the lock.
+        // Nothing to do but record how long we waited for the lock.
+        spin_lock stat_lock(m_stat_mutex);
+        double t = timer();
+        m_stat_optimization_time += t;
+        m_stat_opt_locking_time += t;
+        return;
+    }
+
+    if (!m_only_groupname.empty() && m_only_groupname != group.name()) {
+        // For debugging purposes, we are requested to compile only one
+        // shader group, and this is not it.  Mark it as does_nothing,
+        // and also as optimized so nobody locks on it again, and record
+        // how long we waited for the lock.
+        group.does_nothing(true);
+        group.m_optimized = true;
+        group.m_jitted    = true;
+        spin_lock stat_lock(m_stat_mutex);
+        double t = timer();
+        m_stat_optimization_time += t;
+        m_stat_opt_locking_time += t;
+        return;
+    }
+
+    double locking_time = timer();
+
+    // With opt_share_groups, a group identical to one seen before uses
+    // that group's optimized layers and JITed code rather than its own.
+    ShaderGroupRef shared = group.m_shared_from;
+    if (!shared && !group.optimized() && group.m_structure_hash)
+        shared = find_shared_group(group);
+    if (shared) {
+        optimize_group(*shared, ctx, do_jit);
+        if (ctx)
+            ctx->group(&group);
+        {
+            lock_guard shared_lock(shared->m_mutex);
+            share_compiled_group(group, *shared);
+            if (!group.m_shared_from) {
+                if (shared->m_sharers.size() >= 64)
+                    prune_expired(shared->m_sharers);
+                shared->m_sharers.push_back(group.m_self);
+            }
+        }
+        if (!group.m_shared_from) {
+            group.m_shared_from = shared;
+            m_stat_groups_shared += 1;
+            m_groups_to_compile_count -= 1;
+        }
+        spin_lock stat_lock(m_stat_mutex);
+        m_stat_opt_locking_time += locking_time;
+        m_stat_optimization_time += timer();
+        return;
+    }
+
+    bool ctx_allocated         = false;
+    PerThreadInfo* thread_info = nullptr;
+    if (!ctx) {
+        thread_info   = create_thread_info();
+        ctx           = get_context(thread_info);
+        ctx_allocated = true;
+    }
+    if (!group.optimized()) {
+        RuntimeOptimizer rop(*this, group, ctx);
+        rop.run();
+        rop.police_failed_optimizations();
+
+        // Copy some info recorded by the RuntimeOptimizer into the group
+        group.m_unknown_textures_needed = rop.m_unknown_textures_needed;
+        for (auto&& f : rop.m_textures_needed)
+            group.m_textures_needed.push_back(f);
+        group.m_unknown_closures_needed = rop.m_unknown_closures_needed;
+        for (auto&& f : rop.m_closures_needed)
+            group.m_closures_needed.push_back(f);
+        for (auto&& f : rop.m_globals_needed)
+            group.m_globals_needed.push_back(f);
+        group.m_globals_read  = rop.m_globals_read;
+        group.m_globals_write = rop.m_globals_write;
+        size_t num_userdata   = rop.m_userdata_needed.size();
+        group.m_userdata_names.reserve(num_userdata);
+        group.m_userdata_types.reserve(num_userdata);
+        group.m_userdata_offsets.resize(num_userdata, 0);
+        group.m_userdata_derivs.reserve(num_userdata);
+        group.m_userdata_layers.reserve(num_userdata);
+        group.m_userdata_init_vals.reserve(num_userdata);
+        for (auto&& n : rop.m_userdata_needed) {
+            group.m_userdata_names.push_back(n.name);
+            group.m_userdata_types.push_back(n.type);
+            group.m_userdata_derivs.push_back(n.derivs);
+            group.m_userdata_layers.push_back(n.layer_num);
+            group.m_userdata_init_vals.push_back(n.data);
+        }
+        // Give the renderer the chance to bind the userdata to the slots
+        // of its own tables before the JIT decides how to retrieve them.
+        if (num_userdata)
+            renderer()->bind_userdata(&group, group.m_userdata_names,
+                                      group.m_userdata_types,
+                                      group.m_userdata_derivs);
+        group.m_unknown_attributes_needed = rop.m_unknown_attributes_needed;
+        for (auto&& f : rop.m_attributes_needed) {
+            group.m_attributes_needed.push_back(f.name);
+            group.m_attribute_scopes.push_back(f.scope);
+            group.m_attribute_types.push_back(f.type);
+        }
+        layout_interactive_params(group);
+        // The interactive params may change between shades without a
+        // ReParameter, so they're not in the cache key either
+        group.m_cacheable            = rop.m_cacheable && !group.m_interactive;
+        group.m_constant_outputs     = std::move(rop.m_constant_outputs);
+        group.m_closure_memory_bound = rop.m_closure_memory_bound;
+        group.m_cost_estimate        = rop.m_cost_estimate;
+        add_device_strings(group);
+        group.m_optimized = true;
+
+        spin_lock stat_lock(m_stat_mutex);
+        if (!need_jit) {
+            m_stat_opt_locking_time += locking_time;
+            m_stat_optimization_time += timer();
+        }
+        m_stat_opt_locking_time += rop.m_stat_opt_locking_time;
+        m_stat_opt_locking_time += locking_time + rop.m_stat_opt_locking_time;
+        m_stat_specialization_time += rop.m_stat_specialization_time;
+    }
+
+    // With tiered JIT, get the group running quickly on cheaply optimized
+    // code and queue it for a fully optimized re-JIT. Only the LLVM stage
+    // is tiered: the runtime optimization above happens once, so both
+    // tiers share one groupdata layout and their functions are
+    // interchangeable.
+    bool tier0 = need_jit && tiered_jit() && !use_optix()
+                 && !group.does_nothing() && !group.m_self.expired();
+    // The group may own the memory of its scalar code, which is then
+    // freed along with the group. Under a JIT memory budget, the code may
+    // also be freed when it's gone cold, and JITed again from its ops
+    // (which so are kept) if it runs again; tiered code stays put.
+    bool own_memory = need_jit
+                      && (m_jit_free_with_group || m_jit_memory_budget_MB > 0)
+                      && !use_optix() && !group.does_nothing()
+                      && !group.m_self.expired()
+                      && renderer()->batched(WidthOf<16>()) == nullptr
+                      && renderer()->batched(WidthOf<8>()) == nullptr
+                      && renderer()->batched(WidthOf<4>()) == nullptr;
+    bool evictable = own_memory && m_jit_memory_budget_MB > 0 && !tier0
+                     && !tiered_jit();
+    bool rejit     = need_jit && group.m_jit_evicted;
+    if (need_jit) {
+        BackendLLVM lljitter(*this, group, ctx);
+        lljitter.tier0(tier0);
+        if (own_memory)
+            lljitter.ll.own_jit_memory();
+        if (tier0 && tiered_jit_profile() > 0) {
+            // Count layer executions to guide the optimized re-JIT
+            group.m_layer_exec_counts.reset(new atomic_ll[group.nlayers()]);
+            for (int i = 0; i < group.nlayers(); ++i)
+                group.m_layer_exec_counts[i] = 0;
+            lljitter.profile_layers(true);
+        }
+        lljitter.run();
+        group.m_tierup_pending.store(tier0, std::memory_order_release);
+        if (own_memory)
+            adopt_jit_memory(group, lljitter.ll, evictable);
+        group.m_jit_evicted = false;
+
+        // NOTE: it is now possible to optimize and not JIT
+        // which would leave the cleanup to happen
+        // when the ShadingSystem is destroyed
+
+        // Only cleanup when are not batching or if
+        // the batch jit has already happened,
+        // as it requires the ops so we can't delete them yet!
+        // A pending tier-up needs them too.
+        if (!tier0 && !group.m_jit_evictable
+            && (((renderer()->batched(WidthOf<16>()) == nullptr)
+                 && (renderer()->batched(WidthOf<8>()) == nullptr)
+                 && (renderer()->batched(WidthOf<4>()) == nullptr))
+                || group.batch_jitted())) {
+            group_post_jit_cleanup(group);
+        }
+
+        group.m_jitted = true;
+        spin_lock stat_lock(m_stat_mutex);
+        m_stat_opt_locking_time += locking_time;
+        m_stat_optimization_time += timer();
+        m_stat_total_llvm_time += lljitter.m_stat_total_llvm_time;
+        m_stat_llvm_setup_time += lljitter.m_stat_llvm_setup_time;
+        m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+        m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+        m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+        m_stat_max_llvm_local_mem = std::max(m_stat_max_llvm_local_mem,
+                                             lljitter.m_llvm_local_mem);
+        for (auto& pass : lljitter.ll.pass_times())
+            m_stat_llvm_pass_times[pass.first] += pass.second;
+    }
+
+    if (ctx_allocated) {
+        release_context(ctx);
+        destroy_thread_info(thread_info);
+    }
+
+    group.m_stat_compile_time = group.m_stat_compile_time + timer()
+                                - locking_time;
+    if (rejit) {
+        m_stat_groups_rejitted += 1;
+    } else {
+        m_stat_groups_compiled += 1;
+        m_stat_instances_compiled += group.nlayers();
+        m_groups_to_compile_count -= 1;
+    }
+
+    if (tier0)
+        tierup_enqueue(group);
+    if (group.m_jit_evictable)
+        enforce_jit_memory_budget(group);
+}
+
+
+
+ShaderGroupRef
+ShadingSystemImpl::find_shared_group(ShaderGroup& group)
+{
+    // Some things that change the generated code can still be set after
+    // ShaderGroupEnd, so they are folded into the key only now.
+    std::string key = fmtformat("{:x} {} {} {}", group.m_structure_hash,
+                                group.raytypes_on(), group.raytypes_off(),
+                                group.m_exec_repeat);
+    for (int layer = 0, n = group.nlayers(); layer < n; ++layer)
+        key += group[layer]->entry_layer() ? " E" : " -";
+    for (auto&& r : group.m_renderer_outputs)
+        key += fmtformat(" out {}", r);
+    for (auto&& a : group.m_static_attributes)
+        key += fmtformat(" attr {} {} {}", a.name(), a.type().c_str(),
+                         a.get_string());
+    for (auto&& s : group.m_symlocs)
+        key += fmtformat(" loc {} {} {} {} {} {} {}", s.name, s.type.c_str(),
+                         s.stored_type().c_str(), s.offset, s.stride,
+                         int(s.arena), s.derivs);
+    uint64_t hash = OIIO::farmhash::Fingerprint64(key.data(), key.size());
+
+    spin_lock lock(m_shared_groups_mutex);
+    std::weak_ptr<ShaderGroup>& entry = m_shared_groups[hash];
+    ShaderGroupRef shared             = entry.lock();
+    if (shared && shared.get() != &group
+        && shared->nlayers() == group.nlayers())
+        return shared;
+    if (!shared)
+        entry = group.m_self;
+    return ShaderGroupRef();
+}
+
+
+
+void*
+ShadingSystemImpl::find_shared_layer(const std::string& key,
+                                     std::shared_ptr<void>& owner)
+{
+    spin_lock lock(m_shared_layers_mutex);
+    auto found = m_shared_layers.find(key);
+    if (found == m_shared_layers.end())
+        return nullptr;
+    owner = found->second.owner.lock();
+    if (found->second.owned && !owner) {
+        m_shared_layers.erase(found);  // freed along with its group
+        return nullptr;
+    }
+    return found->second.code;
+}
+
+
+
+void
+ShadingSystemImpl::add_shared_layer(const std::string& key, void* code,
+                                    const std::shared_ptr<void>& owner)
+{
+    if (!code)
+        return;
+    spin_lock lock(m_shared_layers_mutex);
+    SharedLayer& entry = m_shared_layers[key];
+    // Keep a live entry some other group made in the meantime
+    if (entry.code && (!entry.owned || !entry.owner.expired()))
+        return;
+    entry.code  = code;
+    entry.owner = owner;
+    entry.owned = bool(owner);
+}
+
+
+
+void
+ShadingSystemImpl::layout_interactive_params(ShaderGroup& group)
+{
+    // The interactive params that the JITed code initializes from their
+    // values (rather than from init ops, or an upstream layer).
+    struct Param {
+        ShaderInstance* inst;
+        Symbol* sym;
+    };
+    std::vector<Param> params;
+    for (int layer = 0; layer < group.nlayers(); ++layer) {
+        ShaderInstance* inst = group[layer];
+        if (inst->unused())
+            continue;
+        FOREACH_PARAM(Symbol & s, inst)
+        {
+            if (s.symtype() == SymTypeParam && s.interactive() && !s.lockgeom()
+                && s.data() && !s.connected()
+                && !s.typespec().is_closure_based()
+                && !s.typespec().is_structure()
+                && !s.typespec().is_unsized_array()
+                && !(s.has_init_ops() && s.valuesource() == Symbol::DefaultVal))
+                params.push_back({ inst, &s });
+        }
+    }
+    if (params.empty())
+        return;
+
+    // Widest first, so that each value is aligned with no padding
+    std::stable_sort(params.begin(), params.end(),
+                     [](const Param& a, const Param& b) {
+                         return a.sym->typespec().simpletype().basesize()
+                                > b.sym->typespec().simpletype().basesize();
+                     });
+    auto block = std::make_shared<ShaderGroup::InteractiveParams>();
+    int size   = 0;
+    for (auto& p : params) {
+        block->names.push_back(ustring::fmtformat("{}.{}",
+                                                  p.inst->layername(),
+                                                  p.sym->name()));
+        block->offsets.push_back(size);
+        size += int(p.sym->typespec().simpletype().size());
+    }
+    block->size = OIIO::round_to_multiple(size, 16);
+    block->data.reset(new char[block->size]());
+
+    // Move the values into the block, and point their symbols there, so
+    // the JIT initializes the params from it and ReParameter writes it.
+    for (size_t i = 0; i < params.size(); ++i) {
+        Symbol* sym = params[i].sym;
+        char* dst   = block->data.get() + block->offsets[i];
+        memcpy(dst, sym->data(), sym->typespec().simpletype().size());
+        sym->set_dataptr(SymArena::Absolute, dst);
+    }
+    block->dirty_end    = block->size;  // Renderers start with all of it
+    group.m_interactive = block;
+}
+
+
+
+void
+ShadingSystemImpl::share_compiled_group(ShaderGroup& dst,
+                                        const ShaderGroup& src)
+{
+    dst.m_layers                    = src.m_layers;
+    dst.m_constants                 = src.m_constants;
+    dst.m_num_entry_layers          = src.m_num_entry_layers;
+    dst.m_does_nothing              = src.m_does_nothing;
+    dst.m_unknown_textures_needed   = src.m_unknown_textures_needed;
+    dst.m_textures_needed           = src.m_textures_needed;
+    dst.m_unknown_closures_needed   = src.m_unknown_closures_needed;
+    dst.m_closures_needed           = src.m_closures_needed;
+    dst.m_globals_needed            = src.m_globals_needed;
+    dst.m_globals_read              = src.m_globals_read;
+    dst.m_cacheable                 = src.m_cacheable;
+    dst.m_constant_outputs          = src.m_constant_outputs;
+    dst.m_closure_memory_bound      = src.m_closure_memory_bound;
+    dst.m_cost_estimate             = src.m_cost_estimate;
+    dst.m_globals_write             = src.m_globals_write;
+    dst.m_userdata_names            = src.m_userdata_names;
+    dst.m_userdata_types            = src.m_userdata_types;
+    dst.m_userdata_offsets          = src.m_userdata_offsets;
+    dst.m_userdata_derivs           = src.m_userdata_derivs;
+    dst.m_userdata_layers           = src.m_userdata_layers;
+    dst.m_userdata_init_vals        = src.m_userdata_init_vals;
+    dst.m_unknown_attributes_needed = src.m_unknown_attributes_needed;
+    dst.m_attributes_needed         = src.m_attributes_needed;
+    dst.m_attribute_scopes          = src.m_attribute_scopes;
+    dst.m_attribute_types           = src.m_attribute_types;
+    dst.m_interactive               = src.m_interactive;
+    dst.m_optimized                 = src.m_optimized;
+    if (src.jitted()) {
+        dst.m_llvm_groupdata_size = src.m_llvm_groupdata_size;
+        dst.llvm_compiled_init(src.llvm_compiled_init());
+        dst.llvm_compiled_version(src.llvm_compiled_version());
+        for (int layer = 0; layer < src.nlayers(); ++layer)
+            dst.llvm_compiled_layer(layer, src.llvm_compiled_layer(layer));
+        dst.m_llvm_ptx_compiled_version = src.m_llvm_ptx_compiled_version;
+        dst.m_jitted                    = true;
+    }
+#if OSL_USE_BATCHED
+    if (src.batch_jitted()) {
+        dst.m_llvm_groupdata_wide_size = src.m_llvm_groupdata_wide_size;
+        dst.llvm_compiled_wide_init(src.llvm_compiled_wide_init());
+        dst.llvm_compiled_wide_version(src.llvm_compiled_wide_version());
+        for (int layer = 0; layer < src.nlayers(); ++layer)
+            dst.llvm_compiled_wide_layer(layer,
+                                         src.llvm_compiled_wide_layer(layer));
+        dst.m_batch_jitted = true;
+    }
+#endif
+}
+
+
+
+void
+ShadingSystemImpl::tierup_enqueue(ShaderGroup& group)
+{
+    std::lock_guard<std::mutex> lock(m_tierup_mutex);
+    if (m_tierup_stop)
+        return;
+    m_tierup_queue.push_back(group.m_self);
+    if (!m_tierup_thread)
+        m_tierup_thread.reset(
+            new std::thread(&ShadingSystemImpl::tierup_worker, this));
+    m_tierup_cv.notify_one();
+}
+
+
+
+void
+ShadingSystemImpl::adopt_jit_memory(ShaderGroup& group, const LLVM_Util& ll,
+                                    bool evictable)
+{
+    std::shared_ptr<void> owner = ll.jit_memory_owner();
+    if (!owner)
+        return;
+    // Other threads may still be running the code it replaces (as for a
+    // tier-up), so that's only freed along with the group.
+    if (group.m_jit_code)
+        group.m_jit_retired.push_back(std::move(group.m_jit_code));
+    if (evictable) {
+        // Counted in the budget for as long as it's held
+        long long bytes = (long long)ll.jit_memory();
+        std::shared_ptr<std::atomic<long long>> tally = m_jit_evictable_memory;
+        *tally += bytes;
+        auto release     = [owner, tally, bytes](void*) { *tally -= bytes; };
+        group.m_jit_code = std::shared_ptr<void>(owner.get(), release);
+        group.m_jit_last_used = ++m_jit_clock;
+    } else {
+        group.m_jit_code = std::move(owner);
+    }
+    group.m_jit_evictable = evictable;
+}
+
+
+
+void
+ShadingSystemImpl::enforce_jit_memory_budget(const ShaderGroup& keep)
+{
+    long long budget = (long long)m_jit_memory_budget_MB << 20;
+    long long used   = *m_jit_evictable_memory;
+    if (budget <= 0 || used <= budget || used < m_jit_evict_retry.load())
+        return;
+    // Evict down to a low-water mark, so that the next few JITs don't
+    // each take a census of the groups again. If what's left is pinned or
+    // shared, don't try again until usage grows by another eighth of the
+    // budget.
+    long long low_water = budget - budget / 4;
+    std::vector<std::pair<long long, ShaderGroupRef>> cold;
+    for (ShaderGroupRef& g : all_shader_groups())
+        if (g.get() != &keep && g->jitted() && !g->does_nothing())
+            cold.emplace_back(g->m_jit_last_used.load(), std::move(g));
+    std::sort(cold.begin(), cold.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (auto& c : cold) {
+        if (*m_jit_evictable_memory <= low_water)
+            break;
+        evict_group_code(*c.second);
+    }
+    used = *m_jit_evictable_memory;
+    m_jit_evict_retry = used > budget ? used + budget / 8 : 0;
+}
+
+
+
+bool
+ShadingSystemImpl::evict_group_code(ShaderGroup& group)
+{
+    // Never wait for a group being compiled (or evicted), and don't
+    // bother with one that's running now.
+    std::unique_lock<mutex> lock(group.m_mutex, std::try_to_lock);
+    if (!lock.owns_lock() || !group.m_jit_evictable || !group.m_jit_code
+        || !group.jitted() || group.batch_jitted() || group.m_jit_users.load())
+        return false;
+    prune_expired(group.m_sharers);
+    if (!group.m_sharers.empty())
+        return false;
+
+    // Announce the eviction, then check again that no execution began in
+    // the meantime. An execution counts itself in m_jit_users before it
+    // looks at m_jit_evicting (see ShadingContext::prepare_group), so
+    // either it's seen here and the eviction is off, or it sees the flag
+    // and waits on the lock we hold, to JIT the group again. Either way,
+    // no execution that may read the entry points sees them cleared.
+    group.m_jit_evicting = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (group.m_jit_users.load()) {
+        group.m_jit_evicting = false;
+        return false;
+    }
+
+    group.m_jitted = 0;
+    group.llvm_compiled_init(nullptr);
+    group.llvm_compiled_version(nullptr);
+    for (int i = 0, n = group.nlayers(); i < n; ++i)
+        if (group.llvm_compiled_layer(i))
+            group.llvm_compiled_layer(i, nullptr);
+    group.m_jit_evicted = true;
+    group.m_jit_code.reset();
+    group.m_jit_evicting = false;
+    m_stat_groups_evicted += 1;
+    return true;
+}
+
+
+
+ShaderGroup&
+ShadingSystemImpl::raytype_variant(ShaderGroup& group, int raytype, int width)
+{
+    ShaderGroup* variant = group.raytype_variant(raytype);
+    if (!variant)
+        return group;
+    int threshold = raytype_variant_threshold();
+    if (threshold <= 0)
+        return *variant;  // Compiled by execute_init, on this first use
+    if (width ? variant->batch_jitted() : variant->jitted())
+        return *variant;
+    // Until the variant is compiled, the general group stands in for it.
+    // Exactly one shade gets to queue it, and chasing a variant that never
+    // gets used that often costs no JIT at all.
+    if (variant->m_variant_requests.fetch_add(1) == threshold - 1)
+        variant_enqueue(*variant, width);
+    return group;
+}
+
+
+
+void
+ShadingSystemImpl::variant_enqueue(ShaderGroup& variant, int width)
+{
+    std::lock_guard<std::mutex> lock(m_tierup_mutex);
+    if (m_tierup_stop)
+        return;
+    m_variant_queue.emplace_back(variant.m_self, width);
+    if (!m_tierup_thread)
+        m_tierup_thread.reset(
+            new std::thread(&ShadingSystemImpl::tierup_worker, this));
+    m_tierup_cv.notify_one();
+}
+
+
+
+void
+ShadingSystemImpl::tierup_worker()
+{
+    PerThreadInfo* thread_info = create_thread_info();
+    for (;;) {
+        ShaderGroupRef group;
+        {
+            std::unique_lock<std::mutex> lock(m_tierup_mutex);
+            m_tierup_cv.wait(lock, [&]() {
+                return m_tierup_stop || !m_tierup_queue.empty()
+                       || !m_variant_queue.empty();
+            });
+            if (m_tierup_stop)
+                break;
+            // Raytype variants go first: shades are running the general
+            // group while they wait.
+            if (!m_variant_queue.empty()) {
+                ShaderGroupRef variant = m_variant_queue.front().first.lock();
+                int width              = m_variant_queue.front().second;
+                m_variant_queue.erase(m_variant_queue.begin());
+                lock.unlock();
+                if (!variant)
+                    continue;
+                ShadingContext* ctx = get_context(thread_info);
+#if OSL_USE_BATCHED
+                if (width == 16)
+                    batched<16>().jit_group(*variant, ctx);
+                else if (width == 8)
+                    batched<8>().jit_group(*variant, ctx);
+                else if (width == 4)
+                    batched<4>().jit_group(*variant, ctx);
+                else
+#endif
+                    optimize_group(*variant, ctx, true /*do_jit*/);
+                release_context(ctx);
+                m_stat_raytype_variants_compiled += 1;
+                continue;
+            }
+            // Promote the group that has been executed the most while it
+            // waited, and forget any that were destroyed in the meantime.
+            size_t best = 0;
+            for (size_t i = 0; i < m_tierup_queue.size();) {
+                ShaderGroupRef g = m_tierup_queue[i].lock();
+                if (!g) {
+                    m_tierup_queue[i] = std::move(m_tierup_queue.back());
+                    m_tierup_queue.pop_back();
+                    continue;
+                }
+                if (!group || g->executions() > group->executions()) {
+                    group = g;
+                    best  = i;
+                }
+                ++i;
+            }
+            if (!group)
+                continue;
+            if (group->executions() < tiered_jit_profile()) {
+                // Not enough profile yet, even for the busiest group.
+                // Check back in a little while.
+                group.reset();
+                m_tierup_cv.wait_for(lock, std::chrono::milliseconds(100),
+                                     [&]() { return m_tierup_stop; });
+                continue;
+            }
+            m_tierup_queue.erase(m_tierup_queue.begin() + best);
+        }
+
+        lock_guard glock(group->m_mutex);
+        if (!group->m_tierup_pending)
+            continue;
+        ShadingContext* ctx = get_context(thread_info);
+        BackendLLVM lljitter(*this, *group, ctx);
+        if (group->m_jit_code)
+            lljitter.ll.own_jit_memory();  // as its tier-0 code did
+        lljitter.run();  // publishes the new functions as it goes
+        if (group->m_jit_code)
+            adopt_jit_memory(*group, lljitter.ll, false);
+        group->m_tierup_pending.store(false, std::memory_order_release);
+        group->m_stat_compile_time = group->m_stat_compile_time
+                                     + lljitter.m_stat_total_llvm_time;
+        // Groups sharing this one's code get the new functions too. Only
+        // the (atomic) entry points change, so their locks aren't needed.
+        for (auto&& w : group->m_sharers) {
+            if (ShaderGroupRef sharer = w.lock()) {
+                sharer->llvm_compiled_init(group->llvm_compiled_init());
+                sharer->llvm_compiled_version(group->llvm_compiled_version());
+                for (int layer = 0; layer < group->nlayers(); ++layer)
+                    sharer->llvm_compiled_layer(
+                        layer, group->llvm_compiled_layer(layer));
+            }
+        }
+        if (((renderer()->batched(WidthOf<16>()) == nullptr)
+             && (renderer()->batched(WidthOf<8>()) == nullptr)
+             && (renderer()->batched(WidthOf<4>()) == nullptr))
+            || group->batch_jitted()) {
+            group_post_jit_cleanup(*group);
+        }
+        release_context(ctx);
+
+        m_stat_groups_tiered_up += 1;
+        spin_lock stat_lock(m_stat_mutex);
+        m_stat_total_llvm_time += lljitter.m_stat_total_llvm_time;
+        m_stat_llvm_setup_time += lljitter.m_stat_llvm_setup_time;
+        m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+        m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+        m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+        m_stat_max_llvm_local_mem = std::max(m_stat_max_llvm_local_mem,
+                                             lljitter.m_llvm_local_mem);
+        for (auto& pass : lljitter.ll.pass_times())
+            m_stat_llvm_pass_times[pass.first] += pass.second;
+    }
+    destroy_thread_info(thread_info);
+}
+
+
+
+void
+ShadingSystemImpl::tierup_shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_tierup_mutex);
+        m_tierup_stop = true;
+        m_tierup_queue.clear();
+    }
+    m_tierup_cv.notify_all();
+    if (m_tierup_thread) {
+        m_tierup_thread->join();
+        m_tierup_thread.reset();
+    }
+}
+
+
+
+bool
+ShadingSystemImpl::optimize_group_async(ShaderGroup& group, int priority)
+{
+    std::lock_guard<std::mutex> lock(m_async_mutex);
+    if (m_async_stop || group.jitted() || group.m_self.expired())
+        return false;
+    group.m_async_priority = priority;
+    int status             = group.m_async_status.load();
+    if (status == int(CompileStatus::Queued)
+        || status == int(CompileStatus::Compiling))
+        return true;
+    group.m_async_status = int(CompileStatus::Queued);
+    m_async_queue.push_back(group.m_self);
+    while (int(m_async_threads.size()) < std::max(1, m_async_compile_threads))
+        m_async_threads.emplace_back(
+            new std::thread(&ShadingSystemImpl::async_compile_worker, this));
+    m_async_cv.notify_one();
+    return true;
+}
+
+
+
+bool
+ShadingSystemImpl::cancel_optimize_group(ShaderGroup& group)
+{
+    std::lock_guard<std::mutex> lock(m_async_mutex);
+    if (group.m_async_status.load() != int(CompileStatus::Queued))
+        return false;
+    for (size_t i = 0; i < m_async_queue.size(); ++i) {
+        if (m_async_queue[i].lock().get() == &group) {
+            m_async_queue.erase(m_async_queue.begin() + i);
+            break;
+        }
+    }
+    group.m_async_status = int(CompileStatus::Cancelled);
+    m_async_done_cv.notify_all();
+    return true;
+}
+
+
+
+bool
+ShadingSystemImpl::wait_optimize_group(ShaderGroup& group, float timeout)
+{
+    auto pending = [&]() {
+        int status = group.m_async_status.load();
+        return status == int(CompileStatus::Queued)
+               || status == int(CompileStatus::Compiling);
+    };
+    std::unique_lock<std::mutex> lock(m_async_mutex);
+    if (timeout < 0.0f)
+        m_async_done_cv.wait(lock, [&]() { return !pending(); });
+    else
+        m_async_done_cv.wait_for(lock,
+                                 std::chrono::duration<float>(timeout),
+                                 [&]() { return !pending(); });
+    return group.m_async_status.load() == int(CompileStatus::Done);
+}
+
+
+
+bool
+ShadingSystemImpl::async_compile_on_shade(ShaderGroup& group)
+{
+    if (group.m_async_status.load() == int(CompileStatus::None))
+        return true;
+    std::lock_guard<std::mutex> lock(m_async_mutex);
+    if (group.m_async_status.load() != int(CompileStatus::Queued)
+        && group.m_async_status.load() != int(CompileStatus::Compiling))
+        return true;
+    if (m_async_placeholder) {
+        // Have it compile next, since it's being shaded
+        group.m_async_priority = std::numeric_limits<int>::max();
+        return false;
+    }
+    // Compiling is up to this shade now; a compile thread that comes to
+    // it after finds it compiled already.
+    if (group.m_async_status.load() == int(CompileStatus::Queued)) {
+        for (size_t i = 0; i < m_async_queue.size(); ++i) {
+            if (m_async_queue[i].lock().get() == &group) {
+                m_async_queue.erase(m_async_queue.begin() + i);
+                group.m_async_status = int(CompileStatus::Compiling);
+                break;
+            }
         }
     }
+    return true;
+}
+
+
+
+void
+ShadingSystemImpl::async_compile_done(ShaderGroup& group)
+{
+    if (group.m_async_status.load() != int(CompileStatus::Compiling))
+        return;
     {
-        // adjust memory stats
-        spin_lock lock(m_stat_mutex);
-        m_stat_mem_inst_syms -= symmem;
-        m_stat_mem_inst_connections -= connectionmem;
-        m_stat_mem_inst -= symmem + connectionmem;
-        m_stat_memory -= symmem + connectionmem;
+        std::lock_guard<std::mutex> lock(m_async_mutex);
+        group.m_async_status = int(CompileStatus::Done);
     }
+    m_async_done_cv.notify_all();
 }
 
 
 
 void
-ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
-                                  bool do_jit)
+ShadingSystemImpl::async_compile_worker()
 {
-    if (ctx) {
-        // Always have ShadingContext remember the group we just optimized
-        // to allow calls to find_symbol and get_symbol to be valid after
-        // optimization without needed to execute or jit
-        ctx->group(&group);
+    PerThreadInfo* thread_info = create_thread_info();
+    for (;;) {
+        ShaderGroupRef group;
+        {
+            std::unique_lock<std::mutex> lock(m_async_mutex);
+            m_async_cv.wait(lock, [&]() {
+                return m_async_stop || !m_async_queue.empty();
+            });
+            if (m_async_stop)
+                break;
+            // Highest priority first, forgetting destroyed groups
+            size_t best = 0;
+            for (size_t i = 0; i < m_async_queue.size();) {
+                ShaderGroupRef g = m_async_queue[i].lock();
+                if (!g) {
+                    m_async_queue[i] = std::move(m_async_queue.back());
+                    m_async_queue.pop_back();
+                    continue;
+                }
+                if (!group || g->m_async_priority > group->m_async_priority) {
+                    group = g;
+                    best  = i;
+                }
+                ++i;
+            }
+            if (!group)
+                continue;
+            m_async_queue.erase(m_async_queue.begin() + best);
+            group->m_async_status = int(CompileStatus::Compiling);
+        }
+        ShadingContext* ctx = get_context(thread_info);
+        optimize_group(*group, ctx, true /*do_jit*/);
+        release_context(ctx);
+        {
+            std::lock_guard<std::mutex> lock(m_async_mutex);
+            group->m_async_status = int(CompileStatus::Done);
+        }
+        m_async_done_cv.notify_all();
     }
-    if (group.optimized() && (!do_jit || group.jitted()))
-        return;  // already optimized and optionally jitted
+    destroy_thread_info(thread_info);
+}
 
-    OIIO::Timer timer;
-    lock_guard lock(group.m_mutex);
-    bool need_jit = do_jit && !group.jitted();
-    if (group.optimized() && !need_jit) {
-        // The group was somehow optimized by another thread between the
-        // time we checked group.optimized() and now that we have the lock.
-        // Nothing to do but record how long we waited for the lock.
-        spin_lock stat_lock(m_stat_mutex);
-        double t = timer();
-        m_stat_optimization_time += t;
-        m_stat_opt_locking_time += t;
-        return;
-    }
 
-    if (!m_only_groupname.empty() && m_only_groupname != group.name()) {
-        // For debugging purposes, we are requested to compile only one
-        // shader group, and this is not it.  Mark it as does_nothing,
-        // and also as optimized so nobody locks on it again, and record
-        // how long we waited for the lock.
-        group.does_nothing(true);
-        group.m_optimized = true;
-        group.m_jitted    = true;
-        spin_lock stat_lock(m_stat_mutex);
-        double t = timer();
-        m_stat_optimization_time += t;
-        m_stat_opt_locking_time += t;
-        return;
+
+void
+ShadingSystemImpl::async_compile_shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_async_mutex);
+        m_async_stop = true;
+        for (auto& w : m_async_queue)
+            if (ShaderGroupRef g = w.lock())
+                g->m_async_status = int(CompileStatus::Cancelled);
+        m_async_queue.clear();
     }
+    m_async_cv.notify_all();
+    m_async_done_cv.notify_all();
+    for (auto& thread : m_async_threads)
+        thread->join();
+    m_async_threads.clear();
+}
 
-    double locking_time = timer();
 
-    bool ctx_allocated         = false;
-    PerThreadInfo* thread_info = nullptr;
-    if (!ctx) {
-        thread_info   = create_thread_info();
-        ctx           = get_context(thread_info);
-        ctx_allocated = true;
-    }
-    if (!group.optimized()) {
-        RuntimeOptimizer rop(*this, group, ctx);
-        rop.run();
-        rop.police_failed_optimizations();
 
-        // Copy some info recorded by the RuntimeOptimizer into the group
-        group.m_unknown_textures_needed = rop.m_unknown_textures_needed;
-        for (auto&& f : rop.m_textures_needed)
-            group.m_textures_needed.push_back(f);
-        group.m_unknown_closures_needed = rop.m_unknown_closures_needed;
-        for (auto&& f : rop.m_closures_needed)
-            group.m_closures_needed.push_back(f);
-        for (auto&& f : rop.m_globals_needed)
-            group.m_globals_needed.push_back(f);
-        group.m_globals_read  = rop.m_globals_read;
-        group.m_globals_write = rop.m_globals_write;
-        size_t num_userdata   = rop.m_userdata_needed.size();
-        group.m_userdata_names.reserve(num_userdata);
-        group.m_userdata_types.reserve(num_userdata);
-        group.m_userdata_offsets.resize(num_userdata, 0);
-        group.m_userdata_derivs.reserve(num_userdata);
-        group.m_userdata_layers.reserve(num_userdata);
-        group.m_userdata_init_vals.reserve(num_userdata);
-        for (auto&& n : rop.m_userdata_needed) {
-            group.m_userdata_names.push_back(n.name);
-            group.m_userdata_types.push_back(n.type);
-            group.m_userdata_derivs.push_back(n.derivs);
-            group.m_userdata_layers.push_back(n.layer_num);
-            group.m_userdata_init_vals.push_back(n.data);
+std::shared_ptr<PrintfRing>
+ShadingSystemImpl::new_printf_ring()
+{
+    auto ring = std::make_shared<PrintfRing>(4096);
+    std::lock_guard<std::mutex> lock(m_printf_mutex);
+    m_printf_rings.push_back(ring);
+    if (!m_printf_thread && !m_printf_stop)
+        m_printf_thread.reset(
+            new std::thread(&ShadingSystemImpl::printf_worker, this));
+    return ring;
+}
+
+
+
+void
+ShadingSystemImpl::printf_worker()
+{
+    auto print = [&](ErrorHandler::ErrCode code, const std::string& text) {
+        if (code == ErrorHandler::EH_INFO)
+            info(text);
+        else
+            message(text);
+    };
+    for (bool stop = false; !stop;) {
+        std::vector<std::shared_ptr<PrintfRing>> rings;
+        {
+            std::unique_lock<std::mutex> lock(m_printf_mutex);
+            m_printf_cv.wait_for(lock, std::chrono::milliseconds(10),
+                                 [&]() { return m_printf_stop; });
+            stop  = m_printf_stop;
+            rings = m_printf_rings;
         }
-        group.m_unknown_attributes_needed = rop.m_unknown_attributes_needed;
-        for (auto&& f : rop.m_attributes_needed) {
-            group.m_attributes_needed.push_back(f.name);
-            group.m_attribute_scopes.push_back(f.scope);
-            group.m_attribute_types.push_back(f.type);
+        std::vector<PrintfRing*> done;
+        for (auto& ring : rings) {
+            // Closed before the drain, so nothing more is coming
+            bool closed = ring->closed();
+            ring->drain(print);
+            if (uint64_t dropped = ring->take_dropped())
+                warningfmt("{} shader messages were dropped, more than "
+                           "printf_async could hold",
+                           dropped);
+            if (closed)
+                done.push_back(ring.get());
         }
-        group.m_optimized = true;
-
-        spin_lock stat_lock(m_stat_mutex);
-        if (!need_jit) {
-            m_stat_opt_locking_time += locking_time;
-            m_stat_optimization_time += timer();
+        if (!done.empty()) {
+            std::lock_guard<std::mutex> lock(m_printf_mutex);
+            m_printf_rings.erase(
+                std::remove_if(m_printf_rings.begin(), m_printf_rings.end(),
+                               [&](const std::shared_ptr<PrintfRing>& r) {
+                                   return std::find(done.begin(), done.end(),
+                                                    r.get())
+                                          != done.end();
+                               }),
+                m_printf_rings.end());
         }
-        m_stat_opt_locking_time += rop.m_stat_opt_locking_time;
-        m_stat_opt_locking_time += locking_time + rop.m_stat_opt_locking_time;
-        m_stat_specialization_time += rop.m_stat_specialization_time;
     }
+}
 
-    if (need_jit) {
-        BackendLLVM lljitter(*this, group, ctx);
-        lljitter.run();
-
-        // NOTE: it is now possible to optimize and not JIT
-        // which would leave the cleanup to happen
-        // when the ShadingSystem is destroyed
 
-        // Only cleanup when are not batching or if
-        // the batch jit has already happened,
-        // as it requires the ops so we can't delete them yet!
-        if (((renderer()->batched(WidthOf<16>()) == nullptr)
-             && (renderer()->batched(WidthOf<8>()) == nullptr))
-            || group.batch_jitted()) {
-            group_post_jit_cleanup(group);
-        }
 
-        group.m_jitted = true;
-        spin_lock stat_lock(m_stat_mutex);
-        m_stat_opt_locking_time += locking_time;
-        m_stat_optimization_time += timer();
-        m_stat_total_llvm_time += lljitter.m_stat_total_llvm_time;
-        m_stat_llvm_setup_time += lljitter.m_stat_llvm_setup_time;
-        m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
-        m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
-        m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
-        m_stat_max_llvm_local_mem = std::max(m_stat_max_llvm_local_mem,
-                                             lljitter.m_llvm_local_mem);
+void
+ShadingSystemImpl::printf_shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_printf_mutex);
+        m_printf_stop = true;
     }
-
-    if (ctx_allocated) {
-        release_context(ctx);
-        destroy_thread_info(thread_info);
+    m_printf_cv.notify_all();
+    if (m_printf_thread) {
+        m_printf_thread->join();
+        m_printf_thread.reset();
     }
-
-    m_stat_groups_compiled += 1;
-    m_stat_instances_compiled += group.nlayers();
-    m_groups_to_compile_count -= 1;
 }
 
 #if OSL_USE_BATCHED
@@ -3668,6 +7161,21 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     if (!group.optimized())
         m_ssi.optimize_group(group, ctx, false /*do_jit*/);
 
+    if (ShaderGroupRef shared = group.m_shared_from) {
+        // Identical to another group: batch JIT that one and share it
+        jit_group(*shared, ctx);
+        {
+            lock_guard lock(group.m_mutex);
+            lock_guard shared_lock(shared->m_mutex);
+            m_ssi.share_compiled_group(group, *shared);
+        }
+        if (ctx_allocated) {
+            m_ssi.release_context(ctx);
+            m_ssi.destroy_thread_info(thread_info);
+        }
+        return;
+    }
+
     OIIO::Timer timer;
     // TODO: we could have separate mutexes for jit vs. batched_jit
     // choose to keep it simple to start with
@@ -3695,8 +7203,8 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     lljitter.run();
 
     // Keep OSL instructions around in case someone
-    // wants the scalar version jitted
-    if (group.jitted()) {
+    // wants the scalar version jitted (or tiered up)
+    if (group.jitted() && !group.tierup_pending()) {
         m_ssi.group_post_jit_cleanup(group);
     }
 
@@ -3705,7 +7213,9 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
         m_ssi.destroy_thread_info(thread_info);
     }
 
-    group.m_batch_jitted = true;
+    group.m_batch_jitted      = true;
+    group.m_stat_compile_time = group.m_stat_compile_time + timer()
+                                - locking_time;
     spin_lock stat_lock(m_ssi.m_stat_mutex);
     m_ssi.m_stat_opt_locking_time += locking_time;
     m_ssi.m_stat_optimization_time += timer();
@@ -3716,6 +7226,8 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     m_ssi.m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
     m_ssi.m_stat_max_llvm_local_mem = std::max(m_ssi.m_stat_max_llvm_local_mem,
                                                lljitter.m_llvm_local_mem);
+    for (auto& pass : lljitter.ll.pass_times())
+        m_ssi.m_stat_llvm_pass_times[pass.first] += pass.second;
 
     // TODO: not sure how to count these given batched vs. not
     m_ssi.m_stat_groups_compiled += 1;
@@ -3724,123 +7236,169 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
 }
 #endif
 
-static void
-optimize_all_groups_wrapper(ShadingSystemImpl* ss, int mythread,
-                            int totalthreads, bool do_jit)
-{
-    ss->optimize_all_groups(1, mythread, totalthreads, do_jit);
-}
-
-
-#if OSL_USE_BATCHED
-template<int WidthT>
-static void
-batched_jit_all_groups_wrapper(ShadingSystemImpl* ss, int mythread,
-                               int totalthreads)
-{
-    ss->batched<WidthT>().jit_all_groups(1, mythread, totalthreads);
-}
-#endif
+namespace {
 
-void
-ShadingSystemImpl::optimize_all_groups(int nthreads, int mythread,
-                                       int totalthreads, bool do_jit)
-{
-    // Spawn a bunch of threads to do this in parallel -- just call this
-    // routine again (with threads=1) for each thread.
-    if (nthreads < 1)  // threads <= 0 means use all hardware available
-        nthreads = std::min((int)std::thread::hardware_concurrency(),
-                            (int)m_groups_to_compile_count);
-    if (nthreads > 1) {
-        if (m_threads_currently_compiling)
-            return;  // never mind, somebody else spawned the JIT threads
-        OIIO::thread_group threads;
-        m_threads_currently_compiling += nthreads;
-        for (int t = 0; t < nthreads; ++t)
-            threads.add_thread(new std::thread(optimize_all_groups_wrapper,
-                                               this, t, nthreads, do_jit));
-        threads.join_all();
-        m_threads_currently_compiling -= nthreads;
-        return;
+// Work-stealing queue of shader groups waiting to be compiled. The groups
+// are sorted by estimated cost (total op count of their masters) and dealt
+// round-robin into one deque per worker, so every worker starts on its
+// biggest group. A worker pops from the front of its own deque and, when
+// that runs dry, steals from the back (smallest end) of the others. One
+// massive group can thus no longer leave the rest of the workers idle.
+class GroupCompileQueue {
+public:
+    GroupCompileQueue(std::vector<ShaderGroupRef>&& groups, int nworkers)
+        : m_nqueues(std::max(nworkers, 1))
+        , m_queues(new Queue[m_nqueues])
+    {
+        std::vector<std::pair<size_t, ShaderGroupRef>> costed;
+        costed.reserve(groups.size());
+        for (auto& g : groups) {
+            size_t cost = 0;
+            for (int i = 0, e = g->nlayers(); i < e; ++i)
+                cost += (*g)[i]->master()->num_ops();
+            costed.emplace_back(cost, std::move(g));
+        }
+        std::stable_sort(costed.begin(), costed.end(),
+                         [](const auto& a, const auto& b) {
+                             return a.first > b.first;
+                         });
+        for (size_t i = 0, e = costed.size(); i < e; ++i)
+            m_queues[i % m_nqueues].items.push_back(
+                std::move(costed[i].second));
     }
 
-    // And here's the single thread case
-    size_t ngroups = 0;
+    // Next group for this worker, or an empty ref when all work is gone.
+    ShaderGroupRef pop(int worker)
     {
-        spin_lock lock(m_all_shader_groups_mutex);
-        ngroups = m_all_shader_groups.size();
-    }
-    PerThreadInfo* threadinfo = create_thread_info();
-    ShadingContext* ctx       = get_context(threadinfo);
-    for (size_t i = 0; i < ngroups; ++i) {
-        // Assign to threads based on mod of totalthreads
-        if ((i % totalthreads) == (unsigned)mythread) {
-            ShaderGroupRef group;
-            {
-                spin_lock lock(m_all_shader_groups_mutex);
-                group = m_all_shader_groups[i].lock();
+        ShaderGroupRef group;
+        {
+            Queue& q = m_queues[worker];
+            spin_lock lock(q.mutex);
+            if (!q.items.empty()) {
+                group = std::move(q.items.front());
+                q.items.pop_front();
+                return group;
+            }
+        }
+        for (int i = 1; i < m_nqueues; ++i) {
+            Queue& q = m_queues[(worker + i) % m_nqueues];
+            spin_lock lock(q.mutex);
+            if (!q.items.empty()) {
+                group = std::move(q.items.back());
+                q.items.pop_back();
+                return group;
             }
-            if (group && group->m_complete)
-                optimize_group(*group, ctx, do_jit);
         }
+        return group;
     }
-    release_context(ctx);
-    destroy_thread_info(threadinfo);
-}
 
-#if OSL_USE_BATCHED
-template<int WidthT>
+private:
+    struct Queue {
+        spin_mutex mutex;
+        std::deque<ShaderGroupRef> items;
+    };
+    int m_nqueues;
+    std::unique_ptr<Queue[]> m_queues;
+};
+
+}  // namespace
+
+
+
 void
-ShadingSystemImpl::Batched<WidthT>::jit_all_groups(int nthreads, int mythread,
-                                                   int totalthreads)
-{
-    // Spawn a bunch of threads to do this in parallel -- just call this
-    // routine again (with threads=1) for each thread.
-    if (nthreads < 1)  // threads <= 0 means use all hardware available
-        nthreads = std::min((int)std::thread::hardware_concurrency(),
-                            (int)m_ssi.m_groups_to_compile_count);
-    if (nthreads > 1) {
-        if (m_ssi.m_threads_currently_compiling)
-            return;  // never mind, somebody else spawned the JIT threads
+ShadingSystemImpl::compile_all_groups(
+    int nthreads,
+    const std::function<void(ShaderGroup&, ShadingContext*)>& compile)
+{
+    if (nthreads < 1) {  // threads <= 0 means use all hardware available
+        int hw = (int)std::thread::hardware_concurrency();
+        if (m_compile_thread_pool)
+            hw = m_compile_thread_pool->size() + 1;
+        nthreads = std::min(hw, (int)m_groups_to_compile_count);
+    }
+    nthreads = std::max(nthreads, 1);
+    if (nthreads > 1 && m_threads_currently_compiling)
+        return;  // never mind, somebody else spawned the JIT threads
+
+    std::vector<ShaderGroupRef> groups = all_shader_groups();
+    GroupCompileQueue queue(std::move(groups), nthreads);
+
+    auto worker = [&](int w) {
+        PerThreadInfo* threadinfo = create_thread_info();
+        ShadingContext* ctx       = get_context(threadinfo);
+        while (ShaderGroupRef group = queue.pop(w))
+            compile(*group, ctx);
+        release_context(ctx);
+        destroy_thread_info(threadinfo);
+    };
+
+    if (nthreads == 1) {
+        worker(0);
+        return;
+    }
+    m_threads_currently_compiling += nthreads;
+    if (m_compile_thread_pool) {
+        // The waiting thread helps run tasks from the pool's queue.
+        OIIO::task_set tasks(m_compile_thread_pool);
+        for (int t = 0; t < nthreads; ++t)
+            tasks.push(m_compile_thread_pool->push([&, t](int) { worker(t); }));
+        tasks.wait();
+    } else {
         OIIO::thread_group threads;
-        m_ssi.m_threads_currently_compiling += nthreads;
         for (int t = 0; t < nthreads; ++t)
-            threads.add_thread(
-                new std::thread(batched_jit_all_groups_wrapper<WidthT>, &m_ssi,
-                                t, nthreads));
+            threads.add_thread(new std::thread(worker, t));
         threads.join_all();
-        m_ssi.m_threads_currently_compiling -= nthreads;
-        return;
     }
+    m_threads_currently_compiling -= nthreads;
+}
 
-    // And here's the single thread case
-    size_t ngroups = 0;
-    {
-        spin_lock lock(m_ssi.m_all_shader_groups_mutex);
-        ngroups = m_ssi.m_all_shader_groups.size();
-    }
-    PerThreadInfo* threadinfo = m_ssi.create_thread_info();
-    ShadingContext* ctx       = m_ssi.get_context(threadinfo);
-    for (size_t i = 0; i < ngroups; ++i) {
-        // Assign to threads based on mod of totalthreads
-        if ((i % totalthreads) == (unsigned)mythread) {
-            ShaderGroupRef group;
-            {
-                spin_lock lock(m_ssi.m_all_shader_groups_mutex);
-                group = m_ssi.m_all_shader_groups[i].lock();
-            }
-            if (group)
-                jit_group(*group, ctx);
-        }
+
+
+void
+ShadingSystemImpl::optimize_all_groups(int nthreads, bool do_jit)
+{
+    compile_all_groups(nthreads, [&](ShaderGroup& group, ShadingContext* ctx) {
+        if (group.m_complete)
+            optimize_group(group, ctx, do_jit);
+    });
+    if (m_prefetch_textures) {
+        std::vector<ustring> filenames = textures_needed();
+        prefetch_textures(filenames);
     }
-    m_ssi.release_context(ctx);
-    m_ssi.destroy_thread_info(threadinfo);
+}
+
+
+
+std::vector<ustring>
+ShadingSystemImpl::textures_needed() const
+{
+    std::vector<ustring> filenames;
+    for (const ShaderGroupRef& g : all_shader_groups())
+        if (g->optimized())
+            filenames.insert(filenames.end(), g->m_textures_needed.begin(),
+                             g->m_textures_needed.end());
+    std::sort(filenames.begin(), filenames.end());
+    filenames.erase(std::unique(filenames.begin(), filenames.end()),
+                    filenames.end());
+    return filenames;
+}
+
+#if OSL_USE_BATCHED
+template<int WidthT>
+void
+ShadingSystemImpl::Batched<WidthT>::jit_all_groups(int nthreads)
+{
+    m_ssi.compile_all_groups(nthreads,
+                             [&](ShaderGroup& group, ShadingContext* ctx) {
+                                 jit_group(group, ctx);
+                             });
 }
 
 // Explicitly instantiate, although might need to specialize on target
 // machine as well, start with just the batch size
 template class pvt::ShadingSystemImpl::Batched<16>;
 template class pvt::ShadingSystemImpl::Batched<8>;
+template class pvt::ShadingSystemImpl::Batched<4>;
 #endif
 
 int
@@ -3865,13 +7423,11 @@ ShadingSystemImpl::merge_instances(ShaderGroup& group, bool post_opt)
     // general shading and lookdev approach of the studio.  But it was
     // very helpful for us in many cases.
     //
-    // The basic loop below looks very inefficient, O(n^2) in number of
-    // instances in the group. But it's really not -- a few seconds (sum
-    // of all threads) for even our very complex scenes. This is because
-    // most potential pairs have a very fast rejection case if they are
-    // not using the same master.  Since there's no appreciable cost to
-    // the brute force approach, it seems silly to have a complex scheme
-    // to try to reduce the number of pairings.
+    // Comparing every pair of layers is O(n^2), which gets slow for
+    // layered material libraries with hundreds of layers per group.  So
+    // we bucket the layers by ShaderInstance::merge_hash(), which is
+    // equal for any two mergeable instances, and only run the full
+    // mergeable() test against earlier layers in the same bucket.
 
     if (!m_opt_merge_instances || optimize() < 1)
         return 0;
@@ -3887,65 +7443,81 @@ ShadingSystemImpl::merge_instances(ShaderGroup& group, bool post_opt)
         if (!group[layer]->unused())
             group[layer]->evaluate_writes_globals_and_userdata_params();
 
-    // Loop over all layers...
-    for (int a = 0; a < nlayers - 1; ++a) {
-        if (group[a]->unused()
-            || group[a]->entry_layer())  // Don't merge a layer that's not used
-            continue;                    // or if it's an entry layer
-        // Check all later layers...
-        for (int b = a + 1; b < nlayers; ++b) {
-            if (group[b]->unused())  // Don't merge a layer that's not used
-                continue;
-            if (b == nlayers - 1)  // Don't merge the last layer -- causes
-                continue;          // many tears because it's the group entry
+    // Visit the layers in order, keeping a bucket of the earlier layers
+    // that survived as potential merge targets.  Merging B into A rewrites
+    // the connections of later layers to refer to A, which may make those
+    // later layers mergeable in turn.  Since connections only ever come
+    // from earlier layers, by the time we reach a layer its upstream
+    // connections are final, so its hash is current and one pass in
+    // layer order reaches the fixed point.
+    std::unordered_map<uint64_t, std::vector<int>> buckets;
+    for (int b = 0; b < nlayers; ++b) {
+        if (group[b]->unused())  // Don't merge a layer that's not used
+            continue;
+        ShaderInstance* B = group[b];
+        uint64_t hash     = B->merge_hash();
+        auto& bucket      = buckets[hash];
+
+        // Don't merge the last layer -- causes many tears because it's
+        // the group entry.  Otherwise, look for the earliest layer A
+        // that does exactly the same thing.  All the heavy lifting is
+        // done by ShaderInstance::mergeable().
+        int a = -1;
+        if (b != nlayers - 1) {
+            for (int candidate : bucket) {
+                if (group[candidate]->mergeable(*B, group)) {
+                    a = candidate;
+                    break;
+                }
+            }
+        }
+        if (a < 0) {
+            // B stays.  It may be a merge target for later layers, unless
+            // it's an entry layer (which we never merge into) or the last.
+            if (!B->entry_layer() && b != nlayers - 1)
+                bucket.push_back(b);
+            continue;
+        }
 
-            // Now we have two used layers, a and b, to examine.
-            // See if they are mergeable (identical).  All the heavy
-            // lifting is done by ShaderInstance::mergeable().
-            if (!group[a]->mergeable(*group[b], group))
-                continue;
+        // The two nodes a and b are mergeable, so merge them.
+        ShaderInstance* A = group[a];
+        ++merges;
 
-            // The two nodes a and b are mergeable, so merge them.
-            ShaderInstance* A = group[a];
-            ShaderInstance* B = group[b];
-            ++merges;
-
-            // We'll keep A, get rid of B.  For all layers later than B,
-            // check its incoming connections and replace all references
-            // to B with references to A.
-            for (int j = b + 1; j < nlayers; ++j) {
-                ShaderInstance* inst = group[j];
-                if (inst->unused())  // don't bother if it's unused
-                    continue;
-                for (int c = 0, ce = inst->nconnections(); c < ce; ++c) {
-                    Connection& con = inst->connection(c);
-                    if (con.srclayer == b) {
-                        con.srclayer = a;
-                        A->outgoing_connections(true);
-                        if (A->symbols().size() && B->symbols().size()) {
-                            OSL_DASSERT(A->symbol(con.src.param)->name()
-                                        == B->symbol(con.src.param)->name());
-                        }
+        // We'll keep A, get rid of B.  For all layers later than B,
+        // check its incoming connections and replace all references
+        // to B with references to A.
+        for (int j = b + 1; j < nlayers; ++j) {
+            ShaderInstance* inst = group[j];
+            if (inst->unused())  // don't bother if it's unused
+                continue;
+            for (int c = 0, ce = inst->nconnections(); c < ce; ++c) {
+                Connection& con = inst->connection(c);
+                if (con.srclayer == b) {
+                    con.srclayer = a;
+                    A->outgoing_connections(true);
+                    if (A->symbols().size() && B->symbols().size()) {
+                        OSL_DASSERT(A->symbol(con.src.param)->name()
+                                    == B->symbol(con.src.param)->name());
                     }
                 }
             }
+        }
 
-            // Mark parameters of B as no longer connected
-            for (int p = B->firstparam(); p < B->lastparam(); ++p) {
-                if (B->symbols().size())
-                    B->symbol(p)->connected_down(false);
-                if (B->m_instoverrides.size())
-                    B->instoverride(p)->connected_down(false);
-            }
-            // B won't be used, so mark it as having no outgoing
-            // connections and clear its incoming connections (which are
-            // no longer used).
-            OSL_DASSERT(B->merged_unused() == false);
-            B->outgoing_connections(false);
-            connectionmem += B->clear_connections();
-            B->m_merged_unused = true;
-            OSL_DASSERT(B->unused());
+        // Mark parameters of B as no longer connected
+        for (int p = B->firstparam(); p < B->lastparam(); ++p) {
+            if (B->symbols().size())
+                B->symbol(p)->connected_down(false);
+            if (B->m_instoverrides.size())
+                B->instoverride(p)->connected_down(false);
         }
+        // B won't be used, so mark it as having no outgoing
+        // connections and clear its incoming connections (which are
+        // no longer used).
+        OSL_DASSERT(B->merged_unused() == false);
+        B->outgoing_connections(false);
+        connectionmem += B->clear_connections();
+        B->m_merged_unused = true;
+        OSL_DASSERT(B->unused());
     }
 
     {
@@ -3972,14 +7544,24 @@ OIIO::ColorProcessorHandle
 OCIOColorSystem::load_transform(StringParam fromspace, StringParam tospace,
                                 ShadingSystemImpl* ss)
 {
-    if (fromspace != m_last_colorproc_fromspace
-        || tospace != m_last_colorproc_tospace) {
-        m_last_colorproc = colorconfig(ss).createColorProcessor(fromspace,
-                                                                tospace);
-        m_last_colorproc_fromspace = fromspace;
-        m_last_colorproc_tospace   = tospace;
+    for (int i = 0; i < m_ncolorprocs; ++i) {
+        if (m_colorprocs[i].fromspace == fromspace
+            && m_colorprocs[i].tospace == tospace) {
+            // Keep the busiest conversions at the front
+            std::rotate(m_colorprocs, m_colorprocs + i, m_colorprocs + i + 1);
+            return m_colorprocs[0].proc;
+        }
     }
-    return m_last_colorproc;
+    // Not cached: the least recently used falls off the end
+    if (m_ncolorprocs < colorproc_cache_size)
+        ++m_ncolorprocs;
+    std::rotate(m_colorprocs, m_colorprocs + m_ncolorprocs - 1,
+                m_colorprocs + m_ncolorprocs);
+    CachedColorProc& c(m_colorprocs[0]);
+    c.proc      = colorconfig(ss).createColorProcessor(fromspace, tospace);
+    c.fromspace = fromspace;
+    c.tospace   = tospace;
+    return c.proc;
 }
 
 
@@ -4480,6 +8062,39 @@ osl_get_attribute(void* sg_, int dest_derivs, ustring_pod obj_name,
 
 
 
+// A getattribute query as the JIT lays out a batch of them for
+// osl_get_attributes.
+struct AttributeQuery {
+    ustring_pod object;
+    ustring_pod name;
+    long long type;
+    void* dest;
+    int index;  // or -1 if not an array lookup
+    int derivs;
+};
+
+
+
+OSL_SHADEOP void
+osl_get_attributes(void* sg_, void* queries_, int n, void* results_)
+{
+    ShaderGlobals* sg             = (ShaderGlobals*)sg_;
+    const AttributeQuery* queries = (const AttributeQuery*)queries_;
+    auto requests = OSL_ALLOCA(RendererServices::AttributeRequest, n);
+    for (int i = 0; i < n; ++i) {
+        const AttributeQuery& q = queries[i];
+        requests[i] = { USTR(q.object), USTR(q.name), TYPEDESC(q.type),
+                        q.dest,         q.index,      q.derivs != 0,
+                        false };
+    }
+    sg->context->osl_get_attributes(sg, sg->objdata, { requests, size_t(n) });
+    int* results = (int*)results_;
+    for (int i = 0; i < n; ++i)
+        results[i] = requests[i].ok;
+}
+
+
+
 OSL_SHADEOP int
 osl_bind_interpolated_param(void* sg_, ustring_pod name, long long type,
                             int userdata_has_derivs, void* userdata_data,
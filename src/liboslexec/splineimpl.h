@@ -274,18 +274,33 @@ struct SplineInterp {
         // Because of the nature of spline interpolation, monotonic knots
         // can still lead to a non-monotonic curve.  To deal with this,
         // search separately on each spline segment and hope for the best.
+        // Adjacent intervals share an end point, so find the first one
+        // that brackets y with one spline evaluation per interval, and only
+        // solve on that one (or, if none does, on the last, which yields
+        // the same edge it always did).  NOTE: keep in synch with the
+        // batched splineinverse_search.
         int nsegs     = (knot_count - 4) / spline.basis_step + 1;
         float nseginv = 1.0f / nsegs;
         YTYPE r0      = 0.0;
-        x             = 0;
-        for (int s = 0; s < nsegs; ++s) {  // Search each interval
-            YTYPE r1 = nseginv * (s + 1);
-            bool brack;
-            x = OIIO::invert(S, y, r0, r1, 32, YTYPE(1.0e-6), &brack);
-            if (brack)
-                return;
+        YTYPE r1      = nseginv;
+        YTYPE v0      = S(r0);
+        YTYPE v1      = S(r1);
+        for (int s = 1; !brackets(v0, v1, y) && s < nsegs; ++s) {
             r0 = r1;  // Start of next interval is end of this one
+            v0 = v1;
+            r1 = nseginv * (s + 1);
+            v1 = S(r1);
         }
+        x = OIIO::invert(S, y, r0, r1, 32, YTYPE(1.0e-6));
+    }
+
+    // Does the interval with end values v0 and v1 bracket y, by the same
+    // test OIIO::invert uses?
+    template<class YTYPE>
+    OSL_HOSTDEVICE static bool brackets(const YTYPE& v0, const YTYPE& v1,
+                                        const YTYPE& y)
+    {
+        return v0 < v1 ? (y >= v0 && y <= v1) : (y >= v1 && y <= v0);
     }
 };
 
@@ -47,6 +47,10 @@ OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 
 #include "define_opname_macros.h"
 
+// The lanes of a batch often look up the same dictionary and query, so
+// each distinct (node or dictionary, query) pair of the active lanes is
+// resolved once and its result broadcast to all of the lanes with it.
+
 OSL_BATCHOP int
 __OSL_OP(dict_find_iis)(void* bsg_, int nodeID, void* query)
 {
@@ -68,10 +72,15 @@ __OSL_MASKED_OP3(dict_find, Wi, Wi, Ws)(void* bsg_, void* wout, void* wnodeID,
     Wide<const ustring> wQ(wquery);
     Masked<int> wOut(wout, Mask(mask_value));
 
-    mask.foreach ([=](ActiveLane lane) -> void {
-        int nodeID    = wNID[lane];
-        ustring query = wQ[lane];
-        wOut[lane]    = bsg->uniform.context->dict_find(nodeID, query);
+    foreach_unique(wNID, mask, [=](int nodeID, Mask node_lanes) -> void {
+        foreach_unique(wQ, node_lanes,
+                       [=](ustring query, Mask lanes) -> void {
+                           int result = bsg->uniform.context->dict_find(nodeID,
+                                                                        query);
+                           lanes.foreach ([=](ActiveLane lane) -> void {
+                               wOut[lane] = result;
+                           });
+                       });
     });
 }
 
@@ -99,10 +108,12 @@ __OSL_MASKED_OP3(dict_find, Wi, Ws, Ws)(void* bsg_, void* wout,
     Wide<const ustring> wQ(wquery);
     Masked<int> wOut(wout, Mask(mask_value));
 
-    mask.foreach ([=](ActiveLane lane) -> void {
-        ustring dictionary = wD[lane];
-        ustring query      = wQ[lane];
-        wOut[lane]         = bsg->uniform.context->dict_find(dictionary, query);
+    foreach_unique(wD, mask, [=](ustring dictionary, Mask dict_lanes) -> void {
+        foreach_unique(wQ, dict_lanes, [=](ustring query, Mask lanes) -> void {
+            int result = bsg->uniform.context->dict_find(dictionary, query);
+            lanes.foreach (
+                [=](ActiveLane lane) -> void { wOut[lane] = result; });
+        });
     });
 }
 
@@ -128,9 +139,9 @@ __OSL_MASKED_OP(dict_next)(void* bsg_, void* wout, void* wNodeID,
     Masked<int> wR(wout, Mask(mask_value));
 
 
-    mask.foreach ([=](ActiveLane lane) -> void {
-        int nodeID = wNID[lane];
-        wR[lane]   = bsg->uniform.context->dict_next(nodeID);
+    foreach_unique(wNID, mask, [=](int nodeID, Mask lanes) -> void {
+        int result = bsg->uniform.context->dict_next(nodeID);
+        lanes.foreach ([=](ActiveLane lane) -> void { wR[lane] = result; });
     });
 }
 
@@ -155,17 +166,22 @@ template<typename ValueT> struct DictValueGetter<ValueT, false> {
                     Masked<int> wout)
     {
         Masked<ValueT> dest(wdest);
-        wdest.mask().foreach ([=](ActiveLane lane) -> void {
-            int nodeID         = wNID[lane];
-            ustring attribname = wAttribName[lane];
-
-            ValueT value;
-            int result = context->dict_value(nodeID, attribname, wdest.type(),
-                                             &value);
-            wout[lane] = result;
-            if (result) {
-                dest[lane] = value;
-            }
+        foreach_unique(wNID, wdest.mask(), [=](int nodeID,
+                                               Mask node_lanes) -> void {
+            foreach_unique(wAttribName, node_lanes,
+                           [=](ustring attribname, Mask lanes) -> void {
+                               ValueT value;
+                               int result = context->dict_value(nodeID,
+                                                                attribname,
+                                                                wdest.type(),
+                                                                &value);
+                               lanes.foreach ([=](ActiveLane lane) -> void {
+                                   wout[lane] = result;
+                                   if (result) {
+                                       dest[lane] = value;
+                                   }
+                               });
+                           });
         });
     }
 };
@@ -178,17 +194,23 @@ template<typename ValueT> struct DictValueGetter<ValueT, true> {
                     Masked<int> wout)
     {
         Masked<ElementType[]> dest_array(wdest);
-        wdest.mask().foreach ([=](ActiveLane lane) -> void {
-            int nodeID         = wNID[lane];
-            ustring attribname = wAttribName[lane];
-            ElementType value[dest_array.length()];
-            int result = context->dict_value(nodeID, attribname, wdest.type(),
-                                             &value[0]);
-            auto dest  = dest_array[lane];
-            for (int element = 0; element < dest.length(); ++element) {
-                dest[element] = value[element];
-            }
-            wout[lane] = result;
+        foreach_unique(wNID, wdest.mask(), [=](int nodeID,
+                                               Mask node_lanes) -> void {
+            foreach_unique(
+                wAttribName, node_lanes,
+                [=](ustring attribname, Mask lanes) -> void {
+                    std::vector<ElementType> value(dest_array.length());
+                    int result = context->dict_value(nodeID, attribname,
+                                                     wdest.type(), &value[0]);
+                    lanes.foreach ([&](ActiveLane lane) -> void {
+                        auto dest = dest_array[lane];
+                        for (int element = 0; element < dest.length();
+                             ++element) {
+                            dest[element] = value[element];
+                        }
+                        wout[lane] = result;
+                    });
+                });
         });
     }
 };
@@ -532,6 +532,46 @@ makeIdentity(Masked<Matrix44> wrm)
     }
 }
 
+// Ask the renderer for the lanes' matrices of a named space with get(),
+// unless it supports the "transform_cache" and some layer already asked
+// for the same ones during this execution.  Only the lanes that miss the
+// cache are passed to get().
+template<typename GetMatrix>
+static OSL_FORCEINLINE Mask
+get_cached_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> wrm,
+                  ustringrep space, bool inverse, GetMatrix&& get)
+{
+    ShadingContext* ctx = bsg->uniform.context;
+    if (!ctx->shadingsys().transform_cache())
+        return get(wrm);
+    Wide<const float> wtime(bsg->varying.time);
+    Mask hits(false);
+    Mask succeeded(false);
+    wrm.mask().foreach ([&](ActiveLane lane) -> void {
+        ShadingContext::MatrixCacheKey key { space.hash(), bsg->uniform.objdata,
+                                             wtime[lane], false, inverse };
+        if (const ShadingContext::MatrixCacheEntry* e
+            = ctx->find_cached_matrix(key)) {
+            wrm[lane] = e->M;
+            hits.set_on(lane);
+            succeeded.set_on_if(lane, e->ok);
+        }
+    });
+    Mask misses = wrm.mask() & hits.invert();
+    if (misses.any_on()) {
+        Mask got = get(Masked<Matrix44>(wrm, misses));
+        Wide<const Matrix44> wresult(wrm);
+        misses.foreach ([&](ActiveLane lane) -> void {
+            ShadingContext::MatrixCacheKey key { space.hash(),
+                                                 bsg->uniform.objdata,
+                                                 wtime[lane], false, inverse };
+            ctx->cache_matrix(key, got.is_on(lane), wresult[lane]);
+        });
+        succeeded |= got;
+    }
+    return succeeded;
+}
+
 OSL_FORCEINLINE Mask
 impl_get_uniform_from_matrix_masked(void* bsg_, Masked<Matrix44> wrm,
                                     const char* from)
@@ -559,8 +599,11 @@ impl_get_uniform_from_matrix_masked(void* bsg_, Masked<Matrix44> wrm,
         return wrm.mask();
     }
 
-    Mask succeeded = ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(
-        bsg, wrm, USTR(from), bsg->varying.time);
+    Mask succeeded = get_cached_matrix(
+        bsg, wrm, USTR(from), false, [&](Masked<Matrix44> wmiss) {
+            return ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(
+                bsg, wmiss, USTR(from), bsg->varying.time);
+        });
     auto failedResults = wrm & succeeded.invert();
     if (failedResults.mask().any_on()) {
         makeIdentity(failedResults);
@@ -602,9 +645,12 @@ impl_get_uniform_to_inverse_matrix_masked(void* bsg_, Masked<Matrix44> wrm,
     // Based on the 1 function that calls this function
     // the results of the failed data lanes will get overwritten
     // so no need to make sure that the values are valid (assuming FP exceptions are disabled)
-    Mask succeeded
-        = dispatch_get_inverse_matrix(ctx->batched<__OSL_WIDTH>().renderer(),
-                                      bsg, wrm, USTR(to), bsg->varying.time);
+    Mask succeeded = get_cached_matrix(
+        bsg, wrm, USTR(to), true, [&](Masked<Matrix44> wmiss) {
+            return dispatch_get_inverse_matrix(
+                ctx->batched<__OSL_WIDTH>().renderer(), bsg, wmiss, USTR(to),
+                bsg->varying.time);
+        });
 
     auto failedResults = wrm & succeeded.invert();
     if (failedResults.mask().any_on()) {
@@ -109,6 +109,8 @@ public:
 
     MessageBlock* find(ustring name) const
     {
+        if (m_buffer.index.valid())
+            return m_buffer.index.find<MessageBlock>(name);
         for (MessageBlock* m = list_head(); m != nullptr; m = m->next)
             if (m->name == name)
                 return m;  // name matches
@@ -129,6 +131,7 @@ public:
                                           alignment);
         list_head()->import_data(wsrcval, lanes_to_populate, layeridx,
                                  sourcefile, sourceline);
+        m_buffer.index.insert(list_head(), m_buffer.message_data);
     }
 };
 
@@ -445,6 +448,8 @@ __OSL_MASKED_OP(trace)(void* bsg_, void* result, void* opt_, void* Pos_,
     Wide<const Vec3> wDdx(dDirdx_ ? dDirdx_ : &zero_block);
     Wide<const Vec3> wDdy(dDirdy_ ? dDirdy_ : &zero_block);
 
+    bsg->uniform.context->incr_live_counter(LiveCounters::TraceCalls,
+                                            wR.mask().count());
     bsg->uniform.renderer->batched(WidthTag())
         ->trace(*opt, bsg, wR, wP, wPdx, wPdy, wD, wDdx, wDdy);
 }
@@ -56,8 +56,7 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
         return;
     }
 
-    const Partio::ParticlesData* cloud = pc->read_access();
-    if (cloud == NULL) {  // The file failed to load
+    if (!pc->readable()) {  // The file failed to load
         ctx->batched<__OSL_WIDTH>().errorfmt(
             results.mask(), "pointcloud_search: could not open \"{}\"",
             filename);
@@ -65,68 +64,45 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
         return;
     }
 
-    // Early exit if the pointcloud contains no particles.
-    if (cloud->numParticles() == 0) {
+    // Early exit if the pointcloud contains no particles (or has no
+    // "position" attribute, which leaves the search structure empty).
+    if (pc->kdtree().size() == 0) {
         assign_all(results.wnum_points(), 0);
         return;
     }
 
     // If we need derivs of the distances, we'll need access to the
     // found point's positions.
-    Partio::ParticleAttribute* pos_attr = NULL;
-    if (results.distances_have_derivs()) {
-        pos_attr = pc->m_attributes[u_position].get();
-        if (!pos_attr) {
-            // No "position" attribute -- fail
-            assign_all(results.wnum_points(), 0);
-            return;
-        }
+    if (results.distances_have_derivs()
+        && pc->attribute_type(u_position).aggregate != TypeDesc::VEC3) {
+        // No "position" attribute -- fail
+        assign_all(results.wnum_points(), 0);
+        return;
     }
 
-    static_assert(sizeof(size_t) == sizeof(Partio::ParticleIndex),
-                  "Partio ParticleIndex should be the size of a size_t");
-    // FIXME -- if anybody cares about an architecture in which that is not
-    // the case, we can easily allocate local space to retrieve the indices,
-    // then copy them back to the caller's indices.
-
-    // Partio needs size_t indices, and our batched representation is
+    // The KD-tree returns size_t indices, and our batched representation is
     // structure of arrays (wide) so we need a scalar temporary
     // indices array
     // TODO: evaluate if sg->context->alloc_scratch should be used instead?
-    Partio::ParticleIndex* indices
-        = (Partio::ParticleIndex*)OSL_ALLOCA(size_t, max_points);
+    size_t* indices = OSL_ALLOCA(size_t, max_points);
 
     Wide<const OSL::Vec3> wcenter(wcenter_);
 
-    // Partio uses array of structure data layout for distances,
+    // The KD-tree returns distances as an array per query,
     // and our batched representation is
     // structure of arrays (wide) so we need a scalar temporary
     // distances array
-    float* dist2              = OSL_ALLOCA(float, max_points);
-    SortedPointRecord* sorted = OSL_ALLOCA(SortedPointRecord, max_points);
-    auto windices             = results.windices();
-    auto wnum_points          = results.wnum_points();
+    float* dist2                   = OSL_ALLOCA(float, max_points);
+    const PointCloudKDTree* kdtree = &pc->kdtree();
+    auto windices                  = results.windices();
+    auto wnum_points               = results.wnum_points();
     results.mask().foreach ([=](ActiveLane lane) -> void {
         const OSL::Vec3 center = wcenter[lane];
 
         const float radius = wradius[lane];
-        float finalRadius;
-        int count = cloud->findNPoints(&center[0], max_points, radius, indices,
-                                       dist2, &finalRadius);
-
-        // If sorting, allocate some temp space and sort the distances and
-        // indices at the same time.
-        if (sort && count > 1) {
-            //SortedPointRecord *sorted = (SortedPointRecord *) sg->context->alloc_scratch (count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
-            //SortedPointRecord *sorted = OSL_ALLOCA(SortedPointRecord, count);
-            for (int i = 0; i < count; ++i)
-                sorted[i] = SortedPointRecord(dist2[i], indices[i]);
-            std::sort(sorted, sorted + count, SortedPointCompare());
-            for (int i = 0; i < count; ++i) {
-                dist2[i]   = sorted[i].first;
-                indices[i] = sorted[i].second;
-            }
-        }
+        // The KD-tree sorts the results itself when asked, nearest first
+        int count = kdtree->find_nearest(center, radius, max_points, indices,
+                                         dist2, sort);
 
         // copy scalar indices out to wide results
         auto out_indices = windices[lane];
@@ -155,9 +131,7 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
                 // distance derivs
                 //OSL::Vec3 *positions = (OSL::Vec3 *) sg->context->alloc_scratch (sizeof(OSL::Vec3) * count, sizeof(float));
                 OSL::Vec3* positions = OSL_ALLOCA(OSL::Vec3, count);
-                // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
-                const_cast<Partio::ParticlesData*>(cloud)->data(
-                    *pos_attr, count, indices, true, (void*)positions);
+                pc->get_positions(indices, count, positions);
 
                 Wide<const Dual2<OSL::Vec3>> wdcenter(wcenter_);
                 const Dual2<OSL::Vec3> dcenter = wdcenter[lane];
@@ -228,41 +202,28 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
     PointCloud* pc = PointCloud::get(filename);
     // defer reporting errors as only lanes with non zero num_points
     // should report errors
-    const Partio::ParticlesData* cloud = nullptr;
-    if (pc != nullptr) {
-        cloud = pc->read_access();
-    }
-    Partio::ParticleAttribute* attr = nullptr;
-    if (cloud != nullptr) {
-        attr = pc->m_attributes[attr_name].get();
-    }
+    bool readable = pc != nullptr && pc->readable();
 
     TypeDesc attr_type = wout_data.type();
     // Type the OSL shader has provided in destination array:
     TypeDesc element_type = attr_type.elementtype();
 
-    // Type the partio file contains:
+    // Type the point cloud file contains:
     TypeDesc partio_type;
-    int* strindices                = nullptr;
     void* aos_buffer               = nullptr;
     bool is_compatible_with_partio = false;
     int maxn                       = 0;
-    if (attr != nullptr) {
-        partio_type               = TypeDescOfPartioType(attr);
+    if (readable)
+        partio_type = pc->attribute_type(attr_name);
+    if (partio_type != TypeUnknown) {
         is_compatible_with_partio = compatiblePartioType(partio_type,
                                                          element_type);
-        maxn                      = basevals(attr_type) / basevals(partio_type);
-        if (partio_type == OIIO::TypeString) {
-            // strings are special cases because they are stored as int index
-            // Ensure alloca's happen outside loops
-            strindices = OSL_ALLOCA(int, attr_type.numelements());
-        } else {
-            aos_buffer = OSL_ALLOCA(char, attr_type.size());
-        }
+        maxn = basevals(attr_type) / basevals(partio_type);
+        // Ensure alloca's happen outside loops
+        aos_buffer = OSL_ALLOCA(char, attr_type.size());
     }
 
-    Partio::ParticleIndex* indices
-        = (Partio::ParticleIndex*)OSL_ALLOCA(size_t, windices.length());
+    size_t* indices = OSL_ALLOCA(size_t, windices.length());
 
     wout_data.mask().foreach ([=, &success](ActiveLane lane) -> void {
         int count = wnum_points[lane];
@@ -278,15 +239,14 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
             return;
         }
 
-        if (cloud == nullptr) {  // The file failed to load
+        if (!readable) {  // The file failed to load
             ctx->batched<__OSL_WIDTH>().errorfmt(
                 Mask { lane }, "pointcloud_get: could not open \"{}\"",
                 filename);
             return;
         }
 
-        // lookup the ParticleAttribute pointer needed for a query
-        if (attr == nullptr) {
+        if (partio_type == TypeUnknown) {
             ctx->batched<__OSL_WIDTH>().errorfmt(
                 Mask { lane },
                 "Accessing unexisting attribute {} in pointcloud \"{}\"",
@@ -318,39 +278,16 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
             indices[i] = int_indices[i];
         }
 
-        static_assert(sizeof(size_t) == sizeof(Partio::ParticleIndex),
-                      "Partio ParticleIndex should be the size of a size_t");
-        // FIXME -- if anybody cares about an architecture in which that is not
-        // the case, we can easily allocate local space to retrieve the indices,
-        // then copy them back to the caller's indices.
-
         // Actual data query
+        pc->get_data(attr_name, indices, count, aos_buffer);
         if (partio_type == OIIO::TypeString) {
-            // strings are special cases because they are stored as int index
-            const_cast<Partio::ParticlesData*>(cloud)->data(
-                *attr, count, (const Partio::ParticleIndex*)indices,
-                /*sorted*/ /*true*/ false, (void*)strindices);
-            const auto& strings = cloud->indexedStrs(*attr);
-            int sicount         = int(strings.size());
+            // Only count of the strings were retrieved
             OSL_DASSERT(Masked<ustring[]>::is(wout_data));
             Masked<ustring[]> wout_strings(wout_data);
             auto out_strings = wout_strings[lane];
-            for (int i = 0; i < count; ++i) {
-                int ind = strindices[i];
-                if (ind >= 0 && ind < sicount)
-                    out_strings[i] = ustring(strings[ind]);
-                else
-                    out_strings[i] = ustring();
-            }
+            for (int i = 0; i < count; ++i)
+                out_strings[i] = ((const ustring*)aos_buffer)[i];
         } else {
-            // All cases aside from strings are simple.
-            const_cast<Partio::ParticlesData*>(cloud)->data(
-                *attr, count, (const Partio::ParticleIndex*)indices,
-                /*sorted*/ /*true*/ false, aos_buffer);
-            // FIXME: it is regrettable that we need this const_cast (and the
-            // one a few lines above). It's to work around a bug in partio where
-            // they fail to declare this method as const, even though it could
-            // be. We should submit a patch to partio to fix this.
             wout_data.assign_val_lane_from_scalar(lane, aos_buffer);
         }
         success.set_on(lane);
@@ -391,76 +328,36 @@ default_pointcloud_write(BatchedShaderGlobals* bsg, ustringhash filename,
         return Mask { false };
 
     PointCloud* pc = PointCloud::get(filename, true /* create file to write */);
-    spin_lock lock(pc->m_mutex);
-    Partio::ParticlesDataMutable* cloud = pc->write_access();
-    if (cloud == NULL)  // The file failed to load
+    if (!pc)
         return Mask { false };
 
-    // Mark the pointcloud as written, so we will save it later
-    pc->m_write = true;
-
-    // first time only -- add "position" attribute
-    if (cloud->numParticles() == 0)
-        pc->m_position_attribute = cloud->addAttribute("position",
-                                                       Partio::VECTOR, 3);
-
-    // Make sure all the attributes mentioned have been added properly
-    bool ok = true;
-    std::vector<Partio::ParticleAttribute*> partattrs;
-    partattrs.reserve(nattribs);
-    for (int i = 0; i < nattribs; ++i) {
-        const ustring attr_name      = attr_names[i];
-        Partio::ParticleAttribute* a = pc->m_attributes[attr_name].get();
-        if (!a) {  // attribute needs to be added
-            Partio::ParticleAttributeType pt = PartioType(attr_types[i]);
-            if (pt == Partio::NONE) {
-                ok = false;
-            } else {
-                a  = new Partio::ParticleAttribute();
-                *a = cloud->addAttribute(attr_name.c_str(), pt,
-                                         pt == Partio::VECTOR ? 3
-                                                              : 1 /*count*/);
-                pc->m_attributes[attr_name].reset(a);
-            }
-        }
-        partattrs.push_back(a);
-    }
+    // The cloud buffers one point at a time, so pull out each lane's values
+    using LaneValue = std::aligned_union<0, float, int, Vec3, ustring>::type;
 
-    mask.foreach ([=](ActiveLane lane) -> void {
-        // Make a new particle
-        Partio::ParticleIndex p = cloud->addParticle();
-        const Vec3 pos          = wpos[lane];
-        *(Vec3*)cloud->dataWrite<float>(pc->m_position_attribute, p) = pos;
+    LaneValue* lane_values = OSL_ALLOCA(LaneValue, nattribs);
+    const void** pvalues   = OSL_ALLOCA(const void*, nattribs);
+    bool ok                = true;
+    mask.foreach ([&](ActiveLane lane) -> void {
         for (int i = 0; i < nattribs; ++i) {
-            Partio::ParticleAttribute* a       = partattrs[i];
-            const void* ptr_to_wide_attr_value = ptrs_to_wide_attr_value[i];
-            if (a && PartioType(attr_types[i]) == a->type) {
-                switch (a->type) {
-                case Partio::FLOAT: {
-                    Wide<const float> wdata(ptr_to_wide_attr_value);
-                    *(float*)cloud->dataWrite<float>(*a, p) = wdata[lane];
-                } break;
-                case Partio::VECTOR: {
-                    Wide<const Vec3> wdata(ptr_to_wide_attr_value);
-                    *(Vec3*)cloud->dataWrite<float>(*a, p) = wdata[lane];
-                } break;
-                case Partio::INT: {
-                    Wide<const int> wdata(ptr_to_wide_attr_value);
-                    *(int*)cloud->dataWrite<int>(*a, p) = wdata[lane];
-                } break;
-                case Partio::INDEXEDSTR: {
-                    Wide<const ustring> wdata(ptr_to_wide_attr_value);
-                    ustring ustr  = wdata[lane];
-                    const char* s = ustr.c_str();
-                    int index     = cloud->lookupIndexedStr(*a, s);
-                    if (index == -1)
-                        index = cloud->registerIndexedStr(*a, s);
-                    *(int*)cloud->dataWrite<int>(*a, p) = index;
-                } break;
-                case Partio::NONE: break;
-                }
+            const void* wide = ptrs_to_wide_attr_value[i];
+            void* value      = &lane_values[i];
+            switch (PartioType(attr_types[i])) {
+            case Partio::FLOAT:
+                *(float*)value = Wide<const float>(wide)[lane];
+                break;
+            case Partio::VECTOR:
+                *(Vec3*)value = Wide<const Vec3>(wide)[lane];
+                break;
+            case Partio::INT: *(int*)value = Wide<const int>(wide)[lane]; break;
+            case Partio::INDEXEDSTR:
+                *(ustring*)value = Wide<const ustring>(wide)[lane];
+                break;
+            case Partio::NONE: break;
             }
+            pvalues[i] = value;
         }
+        ok &= pc->append(wpos[lane], nattribs, attr_names, attr_types,
+                         pvalues);
     });
 
     return ok ? mask : Mask { false };
@@ -135,39 +135,20 @@ public:
         // hasn't converged after 3/4 of the maximum number of iterations.
         // See, e.g., Numerical Recipes for the basic ideas behind both
         // methods.
-        m_v0         = m_func(xmin);
-        m_v1         = m_func(xmax);
-        m_increasing = (m_v0 < m_v1);
-#if 0
-        // ternary was using pointer to m_v0 or m_v1 which disallows privatization
-        // of their data layouts, causing lots of strided memory stores
-        T vmin = m_increasing ? m_v0 : m_v1;
-        T vmax = m_increasing ? m_v1 : m_v0;
-#else
-        // Instead make sure only values are used, no pointers which
-        // enables Scalar Replacement of Aggregates avoiding memory stores
-        T vmin = sfm::select_val(m_increasing, m_v0, m_v1);
-        T vmax = sfm::select_val(m_increasing, m_v1, m_v0);
-#endif
-        // To simply control flow for vectorizor, changed logical &&
-        // to bitwise &.  This is also preferable to minimize extra
-        // masking and potential branching
-        bool brack = ((m_y >= vmin) & (m_y <= vmax));
-        if (!brack) {
-            // If our bounds don't bracket the zero, just give up, and
-            // return the appropriate "edge" of the interval
-#if 0
-            // ternary was using pointer to m_v0 or m_v1 which disallows privatization
-            // of their data layouts, causing lots of strided memory stores
-            m_result = ((m_y < vmin) == m_increasing) ? xmin : xmax;
-#else
-            // Instead make sure only values are used, no pointers which
-            // enables Scalar Replacement of Aggregates avoiding memory stores
-            m_result = sfm::select_val(((m_y < vmin) == m_increasing), xmin,
-                                       xmax);
-#endif
-        }
-        return brack;
+        m_v0 = m_func(xmin);
+        m_v1 = m_func(xmax);
+        return test_bracket(xmin, xmax);
+    }
+
+    /// Same as is_bracketed_by(xmin, xmax), where xmin is the xmax of the
+    /// previous call: its function value is reused rather than recomputed,
+    /// which halves the evaluations of a search walking adjacent intervals.
+    OSL_FORCEINLINE
+    bool is_bracketed_by_next(const T& xmin, const T& xmax)
+    {
+        m_v0 = m_v1;
+        m_v1 = m_func(xmax);
+        return test_bracket(xmin, xmax);
     }
 
     OSL_FORCEINLINE
@@ -212,6 +193,45 @@ public:
                 return;  // converged
         }
     }
+
+private:
+    // Given m_v0 = func(xmin) and m_v1 = func(xmax), does [xmin,xmax]
+    // bracket y?  If not, set the result to the nearer edge.
+    OSL_FORCEINLINE
+    bool test_bracket(const T& xmin, const T& xmax)
+    {
+        m_increasing = (m_v0 < m_v1);
+#if 0
+        // ternary was using pointer to m_v0 or m_v1 which disallows privatization
+        // of their data layouts, causing lots of strided memory stores
+        T vmin = m_increasing ? m_v0 : m_v1;
+        T vmax = m_increasing ? m_v1 : m_v0;
+#else
+        // Instead make sure only values are used, no pointers which
+        // enables Scalar Replacement of Aggregates avoiding memory stores
+        T vmin = sfm::select_val(m_increasing, m_v0, m_v1);
+        T vmax = sfm::select_val(m_increasing, m_v1, m_v0);
+#endif
+        // To simply control flow for vectorizor, changed logical &&
+        // to bitwise &.  This is also preferable to minimize extra
+        // masking and potential branching
+        bool brack = ((m_y >= vmin) & (m_y <= vmax));
+        if (!brack) {
+            // If our bounds don't bracket the zero, just give up, and
+            // return the appropriate "edge" of the interval
+#if 0
+            // ternary was using pointer to m_v0 or m_v1 which disallows privatization
+            // of their data layouts, causing lots of strided memory stores
+            m_result = ((m_y < vmin) == m_increasing) ? xmin : xmax;
+#else
+            // Instead make sure only values are used, no pointers which
+            // enables Scalar Replacement of Aggregates avoiding memory stores
+            m_result = sfm::select_val(((m_y < vmin) == m_increasing), xmin,
+                                       xmax);
+#endif
+        }
+        return brack;
+    }
 };
 
 
@@ -339,14 +359,14 @@ splineinverse_search(const MatrixT& M, R_T& result, X_T& xval, KArrayT knots,
     int nsegs     = (knot_count - 4) / BasisStepT + 1;
     float nseginv = 1.0f / nsegs;
     X_T r0        = 0.0;
-    X_T r1;
-    bool bracket_found = false;
-    for (int s = 0; s < nsegs; ++s) {  // Search each interval
+    X_T r1        = nseginv;
+    // Adjacent intervals share an end point, so after the first interval
+    // each step costs one spline evaluation rather than two.
+    bool bracket_found = inverter.is_bracketed_by(r0, r1);
+    for (int s = 1; !bracket_found && s < nsegs; ++s) {
+        r0            = r1;  // Start of next interval is end of this one
         r1            = nseginv * (s + 1);
-        bracket_found = inverter.is_bracketed_by(r0, r1);
-        if (bracket_found)
-            break;
-        r0 = r1;  // Start of next interval is end of this one
+        bracket_found = inverter.is_bracketed_by_next(r0, r1);
     }
 
     if (bracket_found) {
@@ -29,6 +29,16 @@ OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 
 #include "define_opname_macros.h"
 
+// The batched analysis already runs an op whose args are all uniform as
+// a scalar op; these are left for varying lanes, or uniform inputs to a
+// varying result (under varying control flow).  Lanes very often share
+// their strings even so, so the ops that intern strings or match them
+// evaluate each distinct set of inputs once, with foreach_unique, and
+// assign the result to all the lanes with those inputs, rather than
+// interning the same new string once per lane.  (foreach_unique only
+// hands its functor the strings of active lanes, so the strings of the
+// masked off lanes, which are undefined, are never read.)
+
 
 OSL_BATCHOP void
 __OSL_MASKED_OP3(concat, Ws, Ws, Ws)(void* wr_, void* ws_, void* wt_,
@@ -42,27 +52,32 @@ __OSL_MASKED_OP3(concat, Ws, Ws, Ws)(void* wr_, void* ws_, void* wt_,
     std::unique_ptr<char[]> heap_buf;
     size_t heap_buf_len = 0;
 
-    // Must check mask before dereferencing s or t
-    // as they are undefined when masked off
-    wR.mask().foreach (
-        [=, &local_buf, &heap_buf, &heap_buf_len](ActiveLane lane) -> void {
-            ustring s  = wS[lane];
-            ustring t  = wT[lane];
-            size_t sl  = s.length();
-            size_t tl  = t.length();
-            size_t len = sl + tl;
-            char* buf  = local_buf;
-            if (len > sizeof(local_buf)) {
-                if (len > heap_buf_len) {
-                    heap_buf.reset(new char[len]);
-                    heap_buf_len = len;
-                }
-                buf = heap_buf.get();
+    // Only lanes the mask has on are dereferenced, as the strings of the
+    // others are undefined
+    auto concat = [&](ustring s, ustring t) -> ustring {
+        size_t sl  = s.length();
+        size_t tl  = t.length();
+        size_t len = sl + tl;
+        if (tl == 0 || sl == 0)
+            return tl ? t : s;  // Nothing new to intern
+        char* buf = local_buf;
+        if (len > sizeof(local_buf)) {
+            if (len > heap_buf_len) {
+                heap_buf.reset(new char[len]);
+                heap_buf_len = len;
             }
-            memcpy(buf, s.c_str(), sl);
-            memcpy(buf + sl, t.c_str(), tl);
-            wR[lane] = ustring(buf, len);
+            buf = heap_buf.get();
+        }
+        memcpy(buf, s.c_str(), sl);
+        memcpy(buf + sl, t.c_str(), tl);
+        return ustring(buf, len);
+    };
+    foreach_unique(wS, wR.mask(), [&](ustring s, Mask s_lanes) -> void {
+        foreach_unique(wT, s_lanes, [&](ustring t, Mask lanes) -> void {
+            ustring r = concat(s, t);
+            lanes.foreach ([=](ActiveLane lane) -> void { wR[lane] = r; });
         });
+    });
 }
 
 
@@ -172,10 +187,11 @@ __OSL_MASKED_OP3(startswith, Wi, Ws, Ws)(void* wr_, void* ws_, void* wsubs_,
     Wide<const ustring> wSubs(wsubs_);
     Masked<int> wR(wr_, Mask(mask_value));
 
-    wR.mask().foreach ([=](ActiveLane lane) -> void {
-        ustring substr = wSubs[lane];
-        ustring s      = wS[lane];
-        wR[lane]       = startswith_iss_impl(s, substr);
+    foreach_unique(wS, wR.mask(), [=](ustring s, Mask s_lanes) -> void {
+        foreach_unique(wSubs, s_lanes, [=](ustring substr, Mask lanes) -> void {
+            int r = startswith_iss_impl(s, substr);
+            lanes.foreach ([=](ActiveLane lane) -> void { wR[lane] = r; });
+        });
     });
 }
 
@@ -204,10 +220,11 @@ __OSL_MASKED_OP3(endswith, Wi, Ws, Ws)(void* wr_, void* ws_, void* wsubs_,
     Wide<const ustring> wSubs(wsubs_);
     Masked<int> wR(wr_, Mask(mask_value));
 
-    wR.mask().foreach ([=](ActiveLane lane) -> void {
-        ustring substr = wSubs[lane];
-        ustring s      = wS[lane];
-        wR[lane]       = endswith_iss_impl(s, substr);
+    foreach_unique(wS, wR.mask(), [=](ustring s, Mask s_lanes) -> void {
+        foreach_unique(wSubs, s_lanes, [=](ustring substr, Mask lanes) -> void {
+            int r = endswith_iss_impl(s, substr);
+            lanes.foreach ([=](ActiveLane lane) -> void { wR[lane] = r; });
+        });
     });
 }
 
@@ -264,6 +281,8 @@ substr_ssii_impl(ustring s, int start, int length)
     if (b < 0)
         b += slen;
     b = Imath::clamp(b, 0, slen);
+    if (b == 0 && length >= slen)
+        return s;  // The whole string, no need to intern it again
     return ustring(s, b, Imath::clamp(length, 0, slen));
 }
 
@@ -279,11 +298,16 @@ __OSL_MASKED_OP4(substr, Ws, Ws, Wi, Wi)(void* wr_, void* ws_, void* wstart_,
     Wide<const int> wSt(wstart_);
     Masked<ustring> wR(wr_, Mask(mask_value));
 
-    wR.mask().foreach ([=](ActiveLane lane) -> void {
-        ustring s  = wS[lane];
-        int start  = wSt[lane];
-        int length = wL[lane];
-        wR[lane]   = substr_ssii_impl(s, start, length);
+    foreach_unique(wS, wR.mask(), [=](ustring s, Mask s_lanes) -> void {
+        foreach_unique(wSt, s_lanes, [=](int start, Mask start_lanes) -> void {
+            foreach_unique(wL, start_lanes,
+                           [=](int length, Mask lanes) -> void {
+                               ustring r = substr_ssii_impl(s, start, length);
+                               lanes.foreach ([=](ActiveLane lane) -> void {
+                                   wR[lane] = r;
+                               });
+                           });
+        });
     });
 }
 
@@ -344,14 +368,11 @@ __OSL_MASKED_OP(regex_impl)(void* bsg_, void* wsuccess_ptr, void* wsubject_ptr,
     Wide<const ustring> wsubject(wsubject_ptr);
     Wide<const ustring> wpattern(wpattern_ptr);
 
-    mask.foreach ([=](ActiveLane lane) -> void {
-        ustring usubject = wsubject[lane];
-        ustring pattern  = wpattern[lane];
+    std::vector<int> results(std::max(nresults, 0));
+    auto match = [&](ustring usubject, ustring pattern) -> int {
         OSL_ASSERT(ustring::is_unique(usubject.c_str()));
         OSL_ASSERT(ustring::is_unique(pattern.c_str()));
 
-        auto results = wresults[lane];
-
         const std::string& subject = usubject.string();
         std::match_results<std::string::const_iterator> mresults;
         const std::regex& regex(ctx->find_regex(pattern));
@@ -369,11 +390,23 @@ __OSL_MASKED_OP(regex_impl)(void* bsg_, void* wsuccess_ptr, void* wsubject_ptr,
                     results[r] = pattern.length();
                 }
             }
-            wsuccess[lane] = res;
+            return res;
         } else {
-            wsuccess[lane] = fullmatch ? regex_match(subject, regex)
-                                       : regex_search(subject, regex);
+            return fullmatch ? regex_match(subject, regex)
+                             : regex_search(subject, regex);
         }
+    };
+    foreach_unique(wsubject, mask, [&](ustring subject, Mask s_lanes) -> void {
+        foreach_unique(wpattern, s_lanes,
+                       [&](ustring pattern, Mask lanes) -> void {
+                           int res = match(subject, pattern);
+                           lanes.foreach ([&](ActiveLane lane) -> void {
+                               auto lane_results = wresults[lane];
+                               for (int r = 0; r < nresults; ++r)
+                                   lane_results[r] = results[r];
+                               wsuccess[lane] = res;
+                           });
+                       });
     });
 }
 
@@ -385,10 +418,10 @@ __OSL_OP(format)(void* wide_output, unsigned int mask_value,
 {
     va_list args;
     va_start(args, format_str);
-    std::string s = Strutil::vsprintf(format_str, args);
+    StringFormatBuffer buf;
+    ustring result(buf.vsprintf(format_str, args));
     va_end(args);
 
-    ustring result = ustring(s);
     Masked<ustring> wOut(wide_output, Mask(mask_value));
 
     OSL::assign_all(wOut, result);
@@ -508,11 +541,11 @@ __OSL_MASKED_OP(split)(void* wresults,
         ustring sep        = wSep[lane];
         auto resultStrings = wRString[lane];
 
-        maxsplit = OIIO::clamp(maxsplit, 0, resultslen);
-        std::vector<std::string> splits;
-        OIIO::Strutil::split(str.string(), splits, sep.string(), maxsplit);
-        int n    = std::min(maxsplit, (int)splits.size());
-        wR[lane] = n;  //Length of split array
+        maxsplit    = OIIO::clamp(maxsplit, 0, resultslen);
+        auto splits = OIIO::Strutil::splitsv(str.string(), sep.string(),
+                                             maxsplit);
+        int n       = std::min(maxsplit, (int)splits.size());
+        wR[lane]    = n;  //Length of split array
         for (int i = 0; i < n; ++i) {
             resultStrings[i] = ustring(splits[i]);
         }
@@ -32,6 +32,136 @@ using WidthTag                = OSL::WidthOf<__OSL_WIDTH>;
 namespace {
 
 
+#if defined(OIIO_TEXTURE_SIMD_BATCH_WIDTH) \
+    && __OSL_WIDTH <= OIIO_TEXTURE_SIMD_BATCH_WIDTH
+#    define OSL_BATCHED_OIIO_TEXTURE 1
+// Submit the whole batch through OIIO's batched texture() entry point, one
+// call for every active lane, so the texture system resolves the handle,
+// its per-thread state and the tiles its lanes share once rather than per
+// lane.  Returns false without touching the outputs if any lane failed,
+// leaving the caller to redo the lookup lane by lane for per-lane status
+// and error messages.
+bool
+batched_oiio_texture(BatchedRendererServices* bsr,
+                     TextureSystem::TextureHandle* texture_handle,
+                     TextureSystem::Perthread* texture_thread_info,
+                     const BatchedTextureOptions& options, Wide<const float> ws,
+                     Wide<const float> wt, Wide<const float> wdsdx,
+                     Wide<const float> wdtdx, Wide<const float> wdsdy,
+                     Wide<const float> wdtdy, BatchedTextureOutputs& outputs)
+{
+    constexpr int BW = OIIO::Tex::BatchWidth;
+
+    Mask mask            = outputs.mask();
+    MaskedData resultRef = outputs.result();
+    MaskedData alphaRef  = outputs.alpha();
+    bool has_derivs      = resultRef.has_derivs() || alphaRef.has_derivs();
+
+    // BatchedTextureOptions<BatchWidth> is laid out as TextureOptBatch
+    // (see batched_texture.h), but narrower batches must be widened.
+    const auto& uniform_opt = options.uniform;
+    const auto& vary_opt    = options.varying;
+    OIIO::TextureOptBatch opt;
+    opt.firstchannel = uniform_opt.firstchannel;
+    opt.subimage     = uniform_opt.subimage;
+    opt.subimagename = uniform_opt.subimagename;
+    opt.swrap        = (OIIO::Tex::Wrap)uniform_opt.swrap;
+    opt.twrap        = (OIIO::Tex::Wrap)uniform_opt.twrap;
+    opt.rwrap        = (OIIO::Tex::Wrap)uniform_opt.rwrap;
+    opt.mipmode      = (OIIO::Tex::MipMode)uniform_opt.mipmode;
+    opt.interpmode   = (OIIO::Tex::InterpMode)uniform_opt.interpmode;
+    opt.anisotropic  = uniform_opt.anisotropic;
+    opt.conservative_filter = uniform_opt.conservative_filter;
+    opt.fill                = uniform_opt.fill;
+    opt.missingcolor        = uniform_opt.missingcolor;
+
+    OSL_ALIGNAS(64) float s[BW], t[BW], dsdx[BW], dtdx[BW], dsdy[BW], dtdy[BW];
+    for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+        opt.sblur[lane]  = vary_opt.sblur[lane];
+        opt.tblur[lane]  = vary_opt.tblur[lane];
+        opt.swidth[lane] = vary_opt.swidth[lane];
+        opt.twidth[lane] = vary_opt.twidth[lane];
+#    if OIIO_VERSION_GREATER_EQUAL(2, 4, 0)
+        opt.rnd[lane] = vary_opt.rnd[lane];
+#    endif
+        s[lane]    = ws[lane];
+        t[lane]    = wt[lane];
+        dsdx[lane] = wdsdx[lane];
+        dtdx[lane] = wdtdx[lane];
+        dsdy[lane] = wdsdy[lane];
+        dtdy[lane] = wdtdy[lane];
+    }
+
+    // As in the lane-by-lane path, always ask for 4 channels.  The results
+    // come back channel-major: result[channel * BatchWidth + lane].
+    OSL_ALIGNAS(64) float result[4 * BW];
+    OSL_ALIGNAS(64) float dresultds[4 * BW];
+    OSL_ALIGNAS(64) float dresultdt[4 * BW];
+    if (!bsr->texturesys()->texture(texture_handle, texture_thread_info, opt,
+                                    OIIO::Tex::RunMask(mask.value()), s, t,
+                                    dsdx, dtdx, dsdy, dtdy, 4, result,
+                                    has_derivs ? dresultds : nullptr,
+                                    has_derivs ? dresultdt : nullptr))
+        return false;
+
+    auto value = [&](int c, ActiveLane lane) { return result[c * BW + lane]; };
+    auto dx    = [&](int c, ActiveLane lane) {
+        return dresultds[c * BW + lane] * dsdx[lane]
+               + dresultdt[c * BW + lane] * dtdx[lane];
+    };
+    auto dy = [&](int c, ActiveLane lane) {
+        return dresultds[c * BW + lane] * dsdy[lane]
+               + dresultdt[c * BW + lane] * dtdy[lane];
+    };
+
+    int alphaChannelIndex = 0;
+    if (Masked<Color3>::is(resultRef)) {
+        alphaChannelIndex = 3;
+        Masked<Color3> r(resultRef);
+        mask.foreach ([&](ActiveLane lane) {
+            r[lane] = Color3(value(0, lane), value(1, lane), value(2, lane));
+        });
+        if (resultRef.has_derivs()) {
+            MaskedDx<Color3> rDx(resultRef);
+            MaskedDy<Color3> rDy(resultRef);
+            mask.foreach ([&](ActiveLane lane) {
+                rDx[lane] = Color3(dx(0, lane), dx(1, lane), dx(2, lane));
+                rDy[lane] = Color3(dy(0, lane), dy(1, lane), dy(2, lane));
+            });
+        }
+    } else if (Masked<float>::is(resultRef)) {
+        alphaChannelIndex = 1;
+        Masked<float> r(resultRef);
+        mask.foreach ([&](ActiveLane lane) { r[lane] = value(0, lane); });
+        if (resultRef.has_derivs()) {
+            MaskedDx<float> rDx(resultRef);
+            MaskedDy<float> rDy(resultRef);
+            mask.foreach ([&](ActiveLane lane) {
+                rDx[lane] = dx(0, lane);
+                rDy[lane] = dy(0, lane);
+            });
+        }
+    }
+    if (alphaRef.valid()) {
+        Masked<float> alpha(alphaRef);
+        mask.foreach ([&](ActiveLane lane) {
+            alpha[lane] = value(alphaChannelIndex, lane);
+        });
+        if (alphaRef.has_derivs()) {
+            MaskedDx<float> alphaDx(alphaRef);
+            MaskedDy<float> alphaDy(alphaRef);
+            mask.foreach ([&](ActiveLane lane) {
+                alphaDx[lane] = dx(alphaChannelIndex, lane);
+                alphaDy[lane] = dy(alphaChannelIndex, lane);
+            });
+        }
+    }
+    return true;
+}
+#endif
+
+
+
 Mask
 default_texture(BatchedRendererServices* bsr, ustring filename,
                 TextureSystem::TextureHandle* texture_handle,
@@ -52,6 +182,12 @@ default_texture(BatchedRendererServices* bsr, ustring filename,
             = bsr->texturesys()->get_texture_handle(filename,
                                                     texture_thread_info);
 
+#ifdef OSL_BATCHED_OIIO_TEXTURE
+    if (batched_oiio_texture(bsr, texture_handle, texture_thread_info, options,
+                             ws, wt, wdsdx, wdtdx, wdsdy, wdtdy, outputs))
+        return outputs.mask();
+#endif
+
     Mask mask = outputs.mask();
 
     MaskedData resultRef = outputs.result();
@@ -61,10 +197,9 @@ default_texture(BatchedRendererServices* bsr, ustring filename,
     OSL_ASSERT(resultRef.valid());
 
     // Convert our BatchedTextureOptions to a single TextureOpt
-    // and submit them 1 at a time through existing non-batched interface
-    // Renderers could implement their own batched texturing,
-    // although expected a future version of OIIO will support
-    // this exact batched interface
+    // and submit them 1 at a time through existing non-batched interface.
+    // This is the path when OIIO's batch is narrower than ours, or when
+    // the batched lookup failed and we need per-lane status and errors.
     const auto& uniform_opt = options.uniform;
     TextureOpt opt;
     // opt.time = ignoring (deprecated?)
@@ -578,6 +713,8 @@ __OSL_MASKED_OP(texture)(void* bsg_, void* name, void* handle, const void* opt_,
 
     auto* bsg = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
     auto& opt = *reinterpret_cast<const BatchedTextureOptions*>(opt_);
+    bsg->uniform.context->incr_live_counter(LiveCounters::TextureCalls,
+                                            mask.count());
 
     // NOTE:  If overridden, BatchedRendererServiced::texture is responsible
     // for correcting our st texture space gradients into xy-space gradients
@@ -621,6 +758,8 @@ __OSL_MASKED_OP(texture3d)(void* bsg_, void* name, void* handle,
 
     auto* bsg = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
     auto& opt = *reinterpret_cast<const BatchedTextureOptions*>(opt_);
+    bsg->uniform.context->incr_live_counter(LiveCounters::TextureCalls,
+                                            mask.count());
 
     BatchedTextureOutputs outputs(result, (bool)resultHasDerivs, chans, alpha,
                                   (bool)alphaHasDerivs, errormessage, mask);
@@ -667,6 +806,8 @@ __OSL_MASKED_OP(environment)(void* bsg_, void* name, void* handle,
 
     auto* bsg = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
     auto& opt = *reinterpret_cast<const BatchedTextureOptions*>(opt_);
+    bsg->uniform.context->incr_live_counter(LiveCounters::TextureCalls,
+                                            mask.count());
 
     BatchedTextureOutputs outputs(result, (bool)resultHasDerivs, chans, alpha,
                                   (bool)alphaHasDerivs, errormessage, mask);
@@ -740,6 +881,27 @@ __OSL_OP(resolve_udim_uniform)(void* bsg_, const char* name, void* handle,
 
 
 
+OSL_BATCHOP TextureSystem::TextureHandle*
+__OSL_OP(resolve_udim_table)(void* bsg_, const char* name, void* table_,
+                             float S, float T)
+{
+    auto* bsg            = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
+    UdimTileTable* table = reinterpret_cast<UdimTileTable*>(table_);
+
+    int i = UdimTileTable::index(S, T);
+    if (i >= 0)
+        if (auto* tile = table->tiles[i].load(std::memory_order_relaxed))
+            return tile;
+    TextureSystem::TextureHandle* tile
+        = bsg->uniform.renderer->batched(WidthTag())->resolve_udim_uniform(
+            bsg, bsg->uniform.context->texture_thread_info(), USTR(name),
+            table->udim_handle, S, T);
+    table->remember(S, T, tile);
+    return tile;
+}
+
+
+
 OSL_BATCHOP void
 __OSL_MASKED_OP(resolve_udim)(void* bsg_, const char* name, void* handle,
                               void* wS_, void* wT_, void* wResult_,
@@ -438,6 +438,71 @@ __OSL_MASKED_OP(range_check)(void* wide_indexvalue, unsigned int mask_value,
 
 
 
+namespace {
+
+// Retrieve an attribute into the lanes of dest, going through the context's
+// attribute cache (see the "attribute_cache" option) when it is enabled.
+// A cacheable attribute is constant over an object, and objdata is uniform
+// across a batch, so a single cached value serves every lane.
+Mask
+get_attribute_cached(BatchedShaderGlobals* bsg, ustringrep obj_name,
+                     ustringrep attr_name, int array_lookup, int index,
+                     MaskedData dest)
+{
+    ShadingContext* ctx = bsg->uniform.context;
+    auto* renderer      = ctx->batched<__OSL_WIDTH>().renderer();
+    auto lookup         = [&]() -> Mask {
+        if (array_lookup)
+            return renderer->get_array_attribute(bsg, obj_name, attr_name,
+                                                 index, dest);
+        return renderer->get_attribute(bsg, obj_name, attr_name, dest);
+    };
+    if (!ctx->shadingsys().attribute_cache())
+        return lookup();
+
+    ShadingContext::AttributeCacheKey key { bsg->uniform.objdata, obj_name,
+                                            attr_name, dest.type(),
+                                            array_lookup ? index : -1 };
+    if (const auto* e = ctx->find_cached_attribute(key)) {
+        if (!e->cacheable)
+            return lookup();
+        ctx->incr_attribute_cache_hits();
+        if (!e->ok)
+            return Mask(false);
+        dest.assign_all_from_scalar(e->value.data());
+        return dest.mask();
+    }
+
+    Mask success = lookup();
+    if (success.all_off()) {
+        ctx->cache_attribute(key, false, nullptr);
+    } else if (success == dest.mask()) {
+        // Wide data is SOA: a block of lanes per scalar component.
+        const TypeDesc type = dest.type();
+        const size_t size   = type.basesize();
+        const int ncomps    = int(type.aggregate * type.numelements());
+        const int lane      = success.first_on();
+        char scalar[sizeof(Matrix44)];
+        std::vector<char> big;
+        char* value = scalar;
+        if (type.size() > sizeof(scalar)) {
+            big.resize(type.size());
+            value = big.data();
+        }
+        for (int c = 0; c < ncomps; ++c)
+            memcpy(value + c * size,
+                   (const char*)dest.ptr() + (c * __OSL_WIDTH + lane) * size,
+                   size);
+        ctx->cache_attribute(key, true, value);
+    }
+    // Partial success can't be an object-constant value; don't cache it.
+    return success;
+}
+
+}  // namespace
+
+
+
 OSL_BATCHOP int
 __OSL_OP1(get_attribute, s)(void* bsg_, int dest_derivs, ustring_pod obj_name_,
                             ustring_pod attr_name_, int array_lookup, int index,
@@ -451,20 +516,11 @@ __OSL_OP1(get_attribute, s)(void* bsg_, int dest_derivs, ustring_pod obj_name_,
     ustringrep obj_name  = USTR(obj_name_);
     ustringrep attr_name = USTR(attr_name_);
 
-    // Ignoring m_next_failed_attrib cache for now,
-    // might be faster
-    auto* renderer = bsg->uniform.context->batched<__OSL_WIDTH>().renderer();
-
     MaskedData dest(*(const TypeDesc*)attr_type, dest_derivs, mask,
                     wide_attr_dest);
-    Mask success;
-    if (array_lookup) {
-        success = renderer->get_array_attribute(bsg, obj_name, attr_name, index,
-                                                dest);
-    } else {
-        success = renderer->get_attribute(bsg, obj_name, attr_name, dest);
-    }
-    return success.value();
+    return get_attribute_cached(bsg, obj_name, attr_name, array_lookup, index,
+                                dest)
+        .value();
 }
 
 
@@ -481,7 +537,6 @@ __OSL_MASKED_OP1(get_attribute,
     auto* bsg           = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
     ustringrep obj_name = USTR(obj_name_);
     Wide<const ustringrep> wAttrName(wattr_name_);
-    auto* renderer = bsg->uniform.context->batched<__OSL_WIDTH>().renderer();
 
     Mask retVal(false);
 
@@ -496,20 +551,10 @@ __OSL_MASKED_OP1(get_attribute,
             //                                                           array_lookup, index,
             //                                                           *(const TypeDesc *)attr_type,
             //                                                           wide_attr_dest, matching_lanes);
-            // Ignoring m_next_failed_attrib cache for now,
-            // might be faster
             MaskedData dest(*(const TypeDesc*)attr_type, dest_derivs,
                             matching_lanes, wide_attr_dest);
-            Mask lanesPopulated;
-            if (array_lookup) {
-                lanesPopulated = renderer->get_array_attribute(bsg, obj_name,
-                                                               attr_name, index,
-                                                               dest);
-            } else {
-                lanesPopulated = renderer->get_attribute(bsg, obj_name,
-                                                         attr_name, dest);
-            }
-            retVal |= lanesPopulated;
+            retVal |= get_attribute_cached(bsg, obj_name, attr_name,
+                                           array_lookup, index, dest);
         });
 
     return retVal.value();
@@ -527,9 +572,31 @@ __OSL_OP(get_attribute_uniform)(void* bsg_, int dest_derivs,
     ustringrep obj_name  = USTR(obj_name_);
     ustringrep attr_name = USTR(attr_name_);
 
-    auto* renderer = bsg->uniform.context->batched<__OSL_WIDTH>().renderer();
+    ShadingContext* ctx = bsg->uniform.context;
+    auto* renderer      = ctx->batched<__OSL_WIDTH>().renderer();
+    const TypeDesc type = *(const TypeDesc*)attr_type;
+
+    bool use_cache = ctx->shadingsys().attribute_cache();
+    ShadingContext::AttributeCacheKey key { bsg->uniform.objdata, obj_name,
+                                            attr_name, type,
+                                            array_lookup ? index : -1 };
+    if (use_cache) {
+        if (const auto* e = ctx->find_cached_attribute(key)) {
+            if (e->cacheable) {
+                if (e->ok) {
+                    memcpy(attr_dest, e->value.data(), e->value.size());
+                    if (dest_derivs)
+                        memset((char*)attr_dest + e->value.size(), 0,
+                               2 * e->value.size());
+                }
+                ctx->incr_attribute_cache_hits();
+                return e->ok;
+            }
+            use_cache = false;
+        }
+    }
 
-    RefData dest(*(const TypeDesc*)attr_type, dest_derivs, attr_dest);
+    RefData dest(type, dest_derivs, attr_dest);
 
     bool success;
     if (array_lookup) {
@@ -540,6 +607,8 @@ __OSL_OP(get_attribute_uniform)(void* bsg_, int dest_derivs,
                                                   dest);
     }
 
+    if (use_cache)
+        ctx->cache_attribute(key, success, attr_dest);
     return success;
 }
 
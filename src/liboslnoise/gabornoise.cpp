@@ -31,6 +31,14 @@ struct GaborParams {
     float lambda;
     float sqrt_lambda_inv;
     float radius, radius2, radius3, radius_inv;
+    bool fast;
+    // The parts of the kernel filtering that don't depend on the impulse,
+    // computed once per lookup by the fast mode (see gabor_fast_filter)
+    float filter_scale;
+    Matrix22 filter_Sigma_inv;
+    Matrix22 filter_mu;
+    float filter_a;
+    bool filtered_out = false;  ///< Filtering leaves nothing to evaluate
 
     OSL_HOSTDEVICE
     GaborParams(const NoiseParams& opt)
@@ -41,6 +49,11 @@ struct GaborParams {
         , weight(Gabor_Impulse_Weight)
         , bandwidth(hostdevice::clamp(opt.bandwidth, 0.01f, 100.0f))
         , periodic(false)
+#ifndef __CUDA_ARCH__
+        , fast(opt.fast != 0)
+#else
+        , fast(false)  // no kernel tables on the device
+#endif
     {
 #if OSL_FAST_MATH
         float TWO_to_bandwidth = OIIO::fast_exp2(bandwidth);
@@ -213,16 +226,282 @@ gabor_grid(GaborParams& gp, const Dual2<Vec3>& x_g, int seed = 0)
 }
 
 
+#ifndef __CUDA_ARCH__
+// Fast mode: every impulse that reaches the point being evaluated is
+// reduced to w * exp(-u) * cos(2 pi t), with exp and cos read from tables
+// rather than computed, and the impulses are summed a batch at a time in
+// a loop the compiler can vectorize.
+
+// Linearly interpolated exp(-u) and cos(2 pi t).  The envelopes of the
+// impulses stay above exp(-max_u) of their peak to within the truncation
+// radius, anything beyond that is read as 0.
+struct GaborTables {
+    static constexpr int exp_size = 512;
+    static constexpr float max_u  = 8.0f;
+    static constexpr int cos_size = 1024;
+    float exp_neg[exp_size + 1];
+    float cos_2pi[cos_size + 1];
+
+    GaborTables()
+    {
+        for (int i = 0; i < exp_size; ++i)
+            exp_neg[i] = expf(-max_u * float(i) / float(exp_size));
+        exp_neg[exp_size] = 0.0f;
+        for (int i = 0; i <= cos_size; ++i)
+            cos_2pi[i] = cosf(float(M_TWO_PI) * float(i) / float(cos_size));
+    }
+
+    static const GaborTables& get()
+    {
+        static GaborTables tables;
+        return tables;
+    }
+
+    // exp(-u) for u >= 0
+    float expneg(float u) const
+    {
+        // Written so that negative or NaN u don't index out of the table
+        float x = (u < max_u) ? std::max(u, 0.0f) * (exp_size / max_u)
+                              : float(exp_size);
+        int i   = std::min(int(x), exp_size - 1);
+        return OIIO::lerp(exp_neg[i], exp_neg[i + 1], x - float(i));
+    }
+
+    // sin(2 pi t) and cos(2 pi t)
+    void sincos2pi(float t, float& s, float& c) const
+    {
+        float f = t - floorf(t);
+        f       = (f >= 0.0f && f < 1.0f) ? f * cos_size : 0.0f;
+        int i   = std::min(int(f), cos_size - 1);
+        f -= float(i);
+        c = OIIO::lerp(cos_2pi[i], cos_2pi[i + 1], f);
+        // sin(2 pi t) = cos(2 pi (t - 1/4))
+        int j = (i + 3 * cos_size / 4) & (cos_size - 1);
+        s     = OIIO::lerp(cos_2pi[j], cos_2pi[j + 1], f);
+    }
+
+    Dual2<float> expneg(const Dual2<float>& u) const
+    {
+        float e = expneg(u.val());
+        return Dual2<float>(e, -e * u.dx(), -e * u.dy());
+    }
+};
+
+
+
+// Sums the reduced impulses, a batch at a time.
+class GaborImpulseBatch {
+public:
+    GaborImpulseBatch() : m_tables(GaborTables::get()) {}
+
+    void add(const Dual2<float>& w, const Dual2<float>& u,
+             const Dual2<float>& t)
+    {
+        m_w[m_n]    = w.val();
+        m_wdx[m_n]  = w.dx();
+        m_wdy[m_n]  = w.dy();
+        m_u[m_n]    = u.val();
+        m_udx[m_n]  = u.dx();
+        m_udy[m_n]  = u.dy();
+        m_t[m_n]    = t.val();
+        m_tdx[m_n]  = t.dx();
+        m_tdy[m_n]  = t.dy();
+        if (++m_n == size)
+            flush();
+    }
+
+    Dual2<float> sum()
+    {
+        flush();
+        return Dual2<float>(m_sum, m_sumdx, m_sumdy);
+    }
+
+    const GaborTables& tables() const { return m_tables; }
+
+private:
+    static constexpr int size = 8;
+
+    void flush()
+    {
+        float sum = 0.0f, sumdx = 0.0f, sumdy = 0.0f;
+        OSL_OMP_SIMD_LOOP(reduction(+ : sum, sumdx, sumdy))
+        for (int i = 0; i < m_n; ++i) {
+            float e = m_tables.expneg(m_u[i]);
+            float s, c;
+            m_tables.sincos2pi(m_t[i], s, c);
+            // d(w e c) = e c dw - w e c du - 2 pi w e s dt
+            float ec  = e * c;
+            float wec = m_w[i] * ec;
+            float wes = float(M_TWO_PI) * m_w[i] * e * s;
+            sum += wec;
+            sumdx += ec * m_wdx[i] - wec * m_udx[i] - wes * m_tdx[i];
+            sumdy += ec * m_wdy[i] - wec * m_udy[i] - wes * m_tdy[i];
+        }
+        m_sum += sum;
+        m_sumdx += sumdx;
+        m_sumdy += sumdy;
+        m_n = 0;
+    }
+
+    const GaborTables& m_tables;
+    float m_w[size], m_wdx[size], m_wdy[size];
+    float m_u[size], m_udx[size], m_udy[size];
+    float m_t[size], m_tdx[size], m_tdy[size];
+    int m_n       = 0;
+    float m_sum   = 0.0f;
+    float m_sumdx = 0.0f;
+    float m_sumdy = 0.0f;
+};
+
+
+
+// Add the impulses of the cell whose corner is c_i to batch, as
+// gabor_cell() would sum them.
+static void
+gabor_fast_cell(GaborParams& gp, const Vec3& c_i, const Dual2<Vec3>& x_c_i,
+                int seed, GaborImpulseBatch& batch)
+{
+    fast_rng rng(gp.periodic ? Vec3(wrap(c_i, gp.period)) : c_i, seed);
+    int n_impulses = rng.poisson(gp.lambda * gp.radius3);
+    const float inv_two_pi = float(1.0 / M_TWO_PI);
+
+    for (int i = 0; i < n_impulses; i++) {
+        // Same order of rng() calls as gabor_cell
+        float z_rng = rng(), y_rng = rng(), x_rng = rng();
+        Vec3 x_i_c(x_rng, y_rng, z_rng);
+        Dual2<Vec3> x_k_i = gp.radius * (x_c_i - x_i_c);
+        float phi_i;
+        Vec3 omega_i;
+        gabor_sample(gp, c_i, rng, omega_i, phi_i);
+        if (x_k_i.val().length2() >= gp.radius2)
+            continue;
+        if (!gp.do_filter) {
+            batch.add(Dual2<float>(gp.weight),
+                      float(M_PI) * (gp.a * gp.a) * dot(x_k_i, x_k_i),
+                      dot(omega_i, x_k_i) + phi_i * inv_two_pi);
+            continue;
+        }
+        // Slice to get a 2D kernel in tangent space, see
+        // slice_gabor_kernel_3d
+        Vec3 omega_i_t;
+        multMatrix(gp.local, omega_i, omega_i_t);
+        Dual2<float> d_i = -dot(gp.N, x_k_i);
+        Dual2<float> w_s = gp.weight
+                           * batch.tables().expneg(
+                               float(M_PI) * (gp.a * gp.a) * (d_i * d_i));
+        Vec2 omega_s(omega_i_t.x, omega_i_t.y);
+        Dual2<float> phi_s = phi_i - float(M_TWO_PI) * d_i * omega_i_t.z;
+
+        // Filter it, see filter_gabor_kernel_2d
+        Dual2<float> w_f
+            = gp.filter_scale * w_s
+              * batch.tables().expneg(
+                  0.5f
+                  * dot(gabor_mul_m22_v2(gp.filter_Sigma_inv, omega_s),
+                        omega_s));
+        Vec2 omega_f = gabor_mul_m22_v2(gp.filter_mu, omega_s);
+
+        Dual2<Vec3> xkit;
+        multMatrix(gp.local, x_k_i, xkit);
+        Dual2<Vec2> x_k_i_t = make_Vec2(comp_x(xkit), comp_y(xkit));
+        batch.add(w_f,
+                  float(M_PI) * (gp.filter_a * gp.filter_a)
+                      * dot(x_k_i_t, x_k_i_t),
+                  dot(omega_f, x_k_i_t) + phi_s * inv_two_pi);
+    }
+}
+
+
+
+// gabor_grid() for the fast mode
+static Dual2<float>
+gabor_fast_grid(GaborParams& gp, const Dual2<Vec3>& x_g, int seed)
+{
+    Vec3 floor_x_g(floor(x_g));  // Vec3 because floor has no derivs
+    Dual2<Vec3> x_c = x_g - floor_x_g;
+    GaborImpulseBatch batch;
+
+    for (int k = -1; k <= 1; k++) {
+        for (int j = -1; j <= 1; j++) {
+            for (int i = -1; i <= 1; i++) {
+                Vec3 c(i, j, k);
+                Dual2<Vec3> x_c_i = x_c - c;
+                // The impulses of a cell lie within [0,1) of its corner,
+                // and only reach x from less than 1 away (the kernel
+                // radius in grid units): skip the cells farther than that.
+                const Vec3& v(x_c_i.val());
+                Vec3 d(v.x - OIIO::clamp(v.x, 0.0f, 1.0f),
+                       v.y - OIIO::clamp(v.y, 0.0f, 1.0f),
+                       v.z - OIIO::clamp(v.z, 0.0f, 1.0f));
+                if (d.length2() >= 1.0f)
+                    continue;
+                gabor_fast_cell(gp, floor_x_g + c, x_c_i, seed, batch);
+            }
+        }
+    }
+    return batch.sum() * gp.sqrt_lambda_inv;
+}
+#endif
+
+
 
 inline OSL_HOSTDEVICE Dual2<float>
 gabor_evaluate(GaborParams& gp, const Dual2<Vec3>& x, int seed = 0)
 {
     Dual2<Vec3> x_g = x * gp.radius_inv;
+#ifndef __CUDA_ARCH__
+    if (gp.fast) {
+        // Filtering wide footprints averages the noise out: the filtered
+        // impulses are then all too small to matter.
+        if (gp.filtered_out)
+            return Dual2<float>(0.0f);
+        return gabor_fast_grid(gp, x_g, seed);
+    }
+#endif
     return gabor_grid(gp, x_g, seed);
 }
 
 
 
+#ifndef __CUDA_ARCH__
+// For the fast mode, compute the parts of filter_gabor_kernel_2d that are
+// the same for all the impulses of a lookup.
+static void
+gabor_fast_filter(GaborParams& gp)
+{
+    //  Equation 10
+    Matrix22 Sigma_G = (gp.a * gp.a / float(M_TWO_PI)) * Matrix22();
+    float c_F = 1.0f / (float(M_TWO_PI) * sqrtf(determinant(gp.filter)));
+    Matrix22 Sigma_F = float(1.0 / (4.0 * M_PI * M_PI)) * gp.filter.inverse();
+    Matrix22 Sigma_G_Sigma_F = Sigma_G + Sigma_F;
+    Matrix22 Sigma_G_i       = Sigma_G.inverse();
+    Matrix22 Sigma_GF        = (Sigma_F.inverse() + Sigma_G_i).inverse();
+    gp.filter_scale          = c_F
+                      / (float(M_TWO_PI) * sqrtf(determinant(Sigma_G_Sigma_F)));
+    gp.filter_Sigma_inv = Sigma_G_Sigma_F.inverse();
+    gp.filter_mu        = Sigma_GF * Sigma_G_i;
+    gp.filter_a         = sqrtf(M_TWO_PI * sqrtf(determinant(Sigma_GF)));
+    if (!OIIO::isfinite(gp.filter_scale) || !OIIO::isfinite(gp.filter_a)) {
+        // Numeric failure, don't filter (gabor_cell falls back on the
+        // unfiltered kernels in that case too)
+        gp.do_filter = false;
+        return;
+    }
+
+    // No filtered impulse is bigger than filter_scale * weight.  If even
+    // four times the average number of impulses in reach of a lookup
+    // can't add up to a visible result, there is no need to sum them.
+    float impulses       = 4.0f * float(1.33333 * M_PI) * gp.lambda * gp.radius3;
+    float gabor_variance = 1.0f / (4.0f * sqrtf(2.0) * (gp.a * gp.a * gp.a));
+    float scale          = 0.5f / (3.0f * sqrtf(gabor_variance));
+    float bound = gp.filter_scale * gp.weight * impulses * gp.sqrt_lambda_inv
+                  * scale;
+    gp.filtered_out = bound < 1.0e-3f;
+}
+#endif
+
+
+
 // set up the filter matrix
 static OSL_HOSTDEVICE void
 gabor_setup_filter(const Dual2<Vec3>& P, GaborParams& gp)
@@ -260,6 +539,10 @@ gabor_setup_filter(const Dual2<Vec3>& P, GaborParams& gp)
         // Turn off filtering when tiny values will lead to numerical
         // errors later if we filter.  Yes, it's kind of arbitrary.
     }
+#ifndef __CUDA_ARCH__
+    if (gp.fast && gp.do_filter)
+        gabor_fast_filter(gp);
+#endif
 }
 
 
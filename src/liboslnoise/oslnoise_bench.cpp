@@ -0,0 +1,581 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+
+// Timing of every noise variant: the single point implementations of
+// oslnoise.h, and the batched shadeops (wide_opnoise_*) of each width and
+// ISA that lib_b<width>_<isa>_oslexec libraries were built for.  The
+// results are written as JSON, to compare releases and machines.
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <OpenImageIO/argparse.h>
+#include <OpenImageIO/benchmark.h>
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/plugin.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/sysutil.h>
+
+#include <OSL/llvm_util.h>
+#include <OSL/oslnoise.h>
+#include <OSL/rendererservices.h>
+#include <OSL/wide.h>
+
+#include "null_noise.h"
+
+using namespace OSL;
+using namespace OSL::pvt;
+using namespace OIIO;
+
+
+static int iterations = 100000;
+static int ntrials    = 5;
+static bool verbose   = false;
+static std::string jsonfile;
+static std::string libdirs;
+static std::string only_noise;
+static bool scalar_only = false;
+
+
+
+// Description of the argument and result types
+template<typename T> struct TypeInfo;
+template<> struct TypeInfo<float> {
+    static const char* name() { return "float"; }
+    static const char* code() { return "f"; }
+    static constexpr bool derivs = false;
+    typedef float Val;
+};
+template<> struct TypeInfo<Vec3> {
+    static const char* name() { return "Vec3"; }
+    static const char* code() { return "v"; }
+    static constexpr bool derivs = false;
+    typedef Vec3 Val;
+};
+template<> struct TypeInfo<Dual2<float>> {
+    static const char* name() { return "float"; }
+    static const char* code() { return "df"; }
+    static constexpr bool derivs = true;
+    typedef float Val;
+};
+template<> struct TypeInfo<Dual2<Vec3>> {
+    static const char* name() { return "Vec3"; }
+    static const char* code() { return "dv"; }
+    static constexpr bool derivs = true;
+    typedef Vec3 Val;
+};
+
+
+
+// Input values, different for each lane of a batch
+template<typename T> T input(int lane);
+template<>
+float
+input<float>(int lane)
+{
+    return 0.5f + 0.37f * lane;
+}
+template<>
+Vec3
+input<Vec3>(int lane)
+{
+    float x = input<float>(lane);
+    return Vec3(x, 1.5f - 0.5f * x, 0.25f + x);
+}
+template<>
+Dual2<float>
+input<Dual2<float>>(int lane)
+{
+    return Dual2<float>(input<float>(lane), 0.01f, 0.02f);
+}
+template<>
+Dual2<Vec3>
+input<Dual2<Vec3>>(int lane)
+{
+    return Dual2<Vec3>(input<Vec3>(lane), Vec3(0.01f, 0.0f, 0.0f),
+                       Vec3(0.0f, 0.01f, 0.0f));
+}
+
+// Periods of the periodic noises
+template<typename T> T period();
+template<>
+float
+period<float>()
+{
+    return 4.0f;
+}
+template<>
+Vec3
+period<Vec3>()
+{
+    return Vec3(4.0f, 4.0f, 4.0f);
+}
+
+
+
+struct Record {
+    std::string noise;
+    bool periodic;
+    std::string result;
+    std::string input;
+    bool derivs;
+    int width;
+    std::string isa;
+    double ns_per_call;
+    double ns_stddev;
+};
+
+
+
+class NoiseBench {
+public:
+    NoiseBench()
+    {
+        m_bench.iterations(iterations);
+        m_bench.trials(ntrials);
+        m_bench.verbose(verbose);
+        m_bench.units(Benchmarker::Unit::ns);
+    }
+
+    // Time func, which evaluates width points of a noise with result R
+    // and input X.
+    template<typename R, typename X, typename F>
+    void run(string_view noise, bool periodic, int width, string_view isa,
+             F&& func)
+    {
+        if (only_noise.size() && noise != only_noise)
+            return;
+        bool derivs      = TypeInfo<R>::derivs || TypeInfo<X>::derivs;
+        std::string name = Strutil::fmt::format(
+            "  {}{}({}{}) -> {} [{} x{}]", periodic ? "periodic " : "",
+            noise, TypeInfo<X>::name(), derivs ? " derivs" : "",
+            TypeInfo<R>::name(), isa, width);
+        // The slow noises get fewer iterations
+        size_t iters = (noise == "gabor") ? std::max(1, iterations / 20)
+                                          : iterations;
+        m_bench.iterations(iters);
+        m_bench.work(width);
+        m_bench(name, func);
+        m_records.push_back({ noise, periodic, TypeInfo<R>::name(),
+                              TypeInfo<X>::name(), derivs, width, isa,
+                              m_bench.median() * 1.0e9,
+                              m_bench.stddev() * 1.0e9 });
+    }
+
+    void write_json(std::ostream& out) const
+    {
+        out << "{\n";
+        out << Strutil::fmt::format("  \"osl_version\": \"{}\",\n",
+                                    OSL_LIBRARY_VERSION_STRING);
+        out << Strutil::fmt::format("  \"hw_simd\": \"{}\",\n",
+                                    OIIO::get_string_attribute("hw:simd"));
+        out << Strutil::fmt::format("  \"iterations\": {},\n", iterations);
+        out << Strutil::fmt::format("  \"trials\": {},\n", ntrials);
+        out << "  \"results\": [\n";
+        for (size_t i = 0; i < m_records.size(); ++i) {
+            const Record& r(m_records[i]);
+            out << Strutil::fmt::format(
+                "    {{ \"noise\": \"{}\", \"periodic\": {}, "
+                "\"result\": \"{}\", \"input\": \"{}\", \"derivs\": {}, "
+                "\"width\": {}, \"isa\": \"{}\", \"ns_per_call\": {:.3f}, "
+                "\"ns_per_point\": {:.3f}, \"ns_stddev\": {:.3f} }}{}\n",
+                r.noise, r.periodic ? "true" : "false", r.result, r.input,
+                r.derivs ? "true" : "false", r.width, r.isa, r.ns_per_call,
+                r.ns_per_call / r.width, r.ns_stddev,
+                i + 1 < m_records.size() ? "," : "");
+        }
+        out << "  ]\n";
+        out << "}\n";
+    }
+
+private:
+    Benchmarker m_bench;
+    std::vector<Record> m_records;
+};
+
+
+
+// Single point noise: time Impl with every result and input type
+template<typename Impl, typename R, typename X>
+static void
+bench_scalar(NoiseBench& bench, string_view noise)
+{
+    X x = input<X>(0);
+    clobber(x);
+    bench.run<R, X>(noise, false, 1, "scalar", [&]() {
+        Impl impl;
+        R r;
+        impl(r, x);
+        DoNotOptimize(r);
+    });
+}
+
+template<typename Impl, typename R, typename X>
+static void
+bench_scalar_periodic(NoiseBench& bench, string_view noise)
+{
+    X x = input<X>(0);
+    auto p = period<typename TypeInfo<X>::Val>();
+    clobber(x);
+    clobber(p);
+    bench.run<R, X>(noise, true, 1, "scalar", [&]() {
+        Impl impl;
+        R r;
+        impl(r, x, p);
+        DoNotOptimize(r);
+    });
+}
+
+template<typename Impl>
+static void
+bench_scalar_all(NoiseBench& bench, string_view noise, bool derivs)
+{
+    bench_scalar<Impl, float, float>(bench, noise);
+    bench_scalar<Impl, float, Vec3>(bench, noise);
+    bench_scalar<Impl, Vec3, float>(bench, noise);
+    bench_scalar<Impl, Vec3, Vec3>(bench, noise);
+    if (derivs) {
+        bench_scalar<Impl, Dual2<float>, Dual2<float>>(bench, noise);
+        bench_scalar<Impl, Dual2<float>, Dual2<Vec3>>(bench, noise);
+        bench_scalar<Impl, Dual2<Vec3>, Dual2<float>>(bench, noise);
+        bench_scalar<Impl, Dual2<Vec3>, Dual2<Vec3>>(bench, noise);
+    }
+}
+
+template<typename Impl>
+static void
+bench_scalar_periodic_all(NoiseBench& bench, string_view noise, bool derivs)
+{
+    bench_scalar_periodic<Impl, float, float>(bench, noise);
+    bench_scalar_periodic<Impl, float, Vec3>(bench, noise);
+    bench_scalar_periodic<Impl, Vec3, float>(bench, noise);
+    bench_scalar_periodic<Impl, Vec3, Vec3>(bench, noise);
+    if (derivs) {
+        bench_scalar_periodic<Impl, Dual2<float>, Dual2<float>>(bench, noise);
+        bench_scalar_periodic<Impl, Dual2<float>, Dual2<Vec3>>(bench, noise);
+        bench_scalar_periodic<Impl, Dual2<Vec3>, Dual2<float>>(bench, noise);
+        bench_scalar_periodic<Impl, Dual2<Vec3>, Dual2<Vec3>>(bench, noise);
+    }
+}
+
+
+
+// Gabor noise only comes with derivatives
+template<typename X>
+static void
+bench_scalar_gabor(NoiseBench& bench, const NoiseParams* opt)
+{
+    X x = input<X>(0);
+    auto p = period<typename TypeInfo<X>::Val>();
+    clobber(x);
+    clobber(p);
+    bench.run<Dual2<float>, X>("gabor", false, 1, "scalar",
+                               [&]() { DoNotOptimize(gabor(x, opt)); });
+    bench.run<Dual2<Vec3>, X>("gabor", false, 1, "scalar",
+                              [&]() { DoNotOptimize(gabor3(x, opt)); });
+    bench.run<Dual2<float>, X>("gabor", true, 1, "scalar",
+                               [&]() { DoNotOptimize(pgabor(x, p, opt)); });
+    bench.run<Dual2<Vec3>, X>("gabor", true, 1, "scalar",
+                              [&]() { DoNotOptimize(pgabor3(x, p, opt)); });
+}
+
+
+
+static void
+bench_scalar_noises(NoiseBench& bench, const NoiseParams* gabor_opt)
+{
+    bench_scalar_all<SNoise>(bench, "perlin", true);
+    bench_scalar_all<Noise>(bench, "uperlin", true);
+    bench_scalar_all<SimplexNoise>(bench, "simplex", true);
+    bench_scalar_all<USimplexNoise>(bench, "usimplex", true);
+    bench_scalar_all<CellNoise>(bench, "cell", false);
+    bench_scalar_all<HashNoise>(bench, "hash", false);
+    bench_scalar_all<NullNoise>(bench, "null", true);
+    bench_scalar_all<UNullNoise>(bench, "unull", true);
+    bench_scalar_gabor<Dual2<float>>(bench, gabor_opt);
+    bench_scalar_gabor<Dual2<Vec3>>(bench, gabor_opt);
+
+    bench_scalar_periodic_all<PeriodicSNoise>(bench, "perlin", true);
+    bench_scalar_periodic_all<PeriodicNoise>(bench, "uperlin", true);
+    bench_scalar_periodic_all<PeriodicCellNoise>(bench, "cell", false);
+    bench_scalar_periodic_all<PeriodicHashNoise>(bench, "hash", false);
+}
+
+
+
+// Batched noise: the shadeops of one width and ISA, looked up by name in
+// its library.  Variants the library doesn't have are skipped.
+template<int WidthT> class WideNoiseBench {
+public:
+    WideNoiseBench(NoiseBench& bench, Plugin::Handle lib, string_view isa,
+                   const NoiseParams* gabor_opt)
+        : m_bench(bench)
+        , m_lib(lib)
+        , m_isa(isa)
+        , m_selector(Strutil::fmt::format("osl_b{}_{}_", WidthT, isa))
+        , m_gabor_opt(gabor_opt)
+    {
+    }
+
+    template<typename R, typename X>
+    void noise(string_view noise, string_view opname)
+    {
+        typedef void (*FuncPtr)(void*, void*, unsigned int);
+        auto func = (FuncPtr)symbol<R, X>(opname, {});
+        if (!func)
+            return;
+        Block<R, WidthT> r;
+        Block<X, WidthT> x;
+        for (int lane = 0; lane < WidthT; ++lane)
+            x.set(lane, input<X>(lane));
+        m_bench.run<R, X>(noise, false, WidthT, m_isa, [&]() {
+            func(&r, &x, all_lanes);
+            clobber_all_memory();
+        });
+    }
+
+    template<typename R, typename X>
+    void periodic_noise(string_view noise, string_view opname)
+    {
+        typedef typename TypeInfo<X>::Val P;
+        typedef void (*FuncPtr)(void*, void*, void*, unsigned int);
+        auto func = (FuncPtr)symbol<R, X>(opname, TypeInfo<P>::code());
+        if (!func)
+            return;
+        Block<R, WidthT> r;
+        Block<X, WidthT> x;
+        Block<P, WidthT> p;
+        for (int lane = 0; lane < WidthT; ++lane) {
+            x.set(lane, input<X>(lane));
+            p.set(lane, period<P>());
+        }
+        m_bench.run<R, X>(noise, true, WidthT, m_isa, [&]() {
+            func(&r, &x, &p, all_lanes);
+            clobber_all_memory();
+        });
+    }
+
+    template<typename R, typename X> void gabor(bool periodic)
+    {
+        // Both take the noise name, the shader globals and a varying
+        // direction, which gabor doesn't need
+        typedef void (*FuncPtr)(void*, void*, void*, void*, void*, void*,
+                                unsigned int);
+        typedef void (*PFuncPtr)(void*, void*, void*, void*, void*, void*,
+                                 void*, unsigned int);
+        typedef typename TypeInfo<X>::Val P;
+        Block<R, WidthT> r;
+        Block<X, WidthT> x;
+        Block<P, WidthT> p;
+        for (int lane = 0; lane < WidthT; ++lane) {
+            x.set(lane, input<X>(lane));
+            p.set(lane, period<P>());
+        }
+        void* opt = (void*)m_gabor_opt;
+        if (periodic) {
+            auto func = (PFuncPtr)symbol<R, X>("gaborpnoise",
+                                               TypeInfo<P>::code());
+            if (func)
+                m_bench.run<R, X>("gabor", true, WidthT, m_isa, [&]() {
+                    func(nullptr, &r, &x, &p, nullptr, opt, nullptr,
+                         all_lanes);
+                    clobber_all_memory();
+                });
+        } else {
+            auto func = (FuncPtr)symbol<R, X>("gabornoise", {});
+            if (func)
+                m_bench.run<R, X>("gabor", false, WidthT, m_isa, [&]() {
+                    func(nullptr, &r, &x, nullptr, opt, nullptr, all_lanes);
+                    clobber_all_memory();
+                });
+        }
+    }
+
+    void all(string_view name, string_view opname, string_view popname,
+             bool derivs)
+    {
+        noise<float, float>(name, opname);
+        noise<float, Vec3>(name, opname);
+        noise<Vec3, float>(name, opname);
+        noise<Vec3, Vec3>(name, opname);
+        if (derivs) {
+            noise<Dual2<float>, Dual2<float>>(name, opname);
+            noise<Dual2<float>, Dual2<Vec3>>(name, opname);
+            noise<Dual2<Vec3>, Dual2<float>>(name, opname);
+            noise<Dual2<Vec3>, Dual2<Vec3>>(name, opname);
+        }
+        if (popname.empty())
+            return;
+        periodic_noise<float, float>(name, popname);
+        periodic_noise<float, Vec3>(name, popname);
+        periodic_noise<Vec3, float>(name, popname);
+        periodic_noise<Vec3, Vec3>(name, popname);
+        if (derivs) {
+            periodic_noise<Dual2<float>, Dual2<float>>(name, popname);
+            periodic_noise<Dual2<float>, Dual2<Vec3>>(name, popname);
+            periodic_noise<Dual2<Vec3>, Dual2<float>>(name, popname);
+            periodic_noise<Dual2<Vec3>, Dual2<Vec3>>(name, popname);
+        }
+    }
+
+    void run()
+    {
+        all("perlin", "snoise", "psnoise", true);
+        all("uperlin", "noise", "pnoise", true);
+        all("simplex", "simplexnoise", {}, true);
+        all("usimplex", "usimplexnoise", {}, true);
+        all("cell", "cellnoise", "pcellnoise", false);
+        all("hash", "hashnoise", "phashnoise", false);
+        all("null", "nullnoise", {}, true);
+        all("unull", "unullnoise", {}, true);
+        for (bool periodic : { false, true }) {
+            gabor<Dual2<float>, Dual2<float>>(periodic);
+            gabor<Dual2<float>, Dual2<Vec3>>(periodic);
+            gabor<Dual2<Vec3>, Dual2<float>>(periodic);
+            gabor<Dual2<Vec3>, Dual2<Vec3>>(periodic);
+        }
+    }
+
+private:
+    static constexpr unsigned int all_lanes = (1u << WidthT) - 1;
+
+    // Look up the masked shadeop opname_W<R>W<X>[W<period>]
+    template<typename R, typename X>
+    void* symbol(string_view opname, string_view period_code)
+    {
+        std::string name = Strutil::fmt::format("{}{}_W{}W{}{}{}_masked",
+                                                m_selector, opname,
+                                                TypeInfo<R>::code(),
+                                                TypeInfo<X>::code(),
+                                                period_code.size() ? "W" : "",
+                                                period_code);
+        return Plugin::getsym(m_lib, name, /*report_error=*/false);
+    }
+
+    NoiseBench& m_bench;
+    Plugin::Handle m_lib;
+    std::string m_isa;
+    std::string m_selector;
+    const NoiseParams* m_gabor_opt;
+};
+
+
+
+// The ISAs the batched libraries may be built for, by the name the
+// libraries use
+static const struct {
+    TargetISA isa;
+    const char* name;
+} wide_isas[] = { { TargetISA::AVX512, "AVX512" },
+                  { TargetISA::AVX512_noFMA, "AVX512_noFMA" },
+                  { TargetISA::AVX2, "AVX2" },
+                  { TargetISA::AVX2_noFMA, "AVX2_noFMA" },
+                  { TargetISA::AVX, "AVX" },
+                  { TargetISA::SSE4_2, "SSE4_2" } };
+
+
+
+template<int WidthT>
+static void
+bench_wide_noises(NoiseBench& bench, const std::vector<std::string>& dirs,
+                  const NoiseParams* gabor_opt)
+{
+    for (const auto& wide_isa : wide_isas) {
+        std::string libname = Strutil::fmt::format("lib_b{}_{}_oslexec.{}",
+                                                   WidthT, wide_isa.name,
+                                                   Plugin::plugin_extension());
+        std::string filename = Filesystem::searchpath_find(libname, dirs);
+        if (filename.empty())
+            continue;
+        if (!LLVM_Util::supports_isa(wide_isa.isa)) {
+            if (verbose)
+                std::cerr << "Skipping " << libname
+                          << ", this machine doesn't support its ISA\n";
+            continue;
+        }
+        Plugin::Handle lib = Plugin::open(filename, /*global=*/false);
+        if (!lib) {
+            std::cerr << "Could not load " << filename << ": "
+                      << Plugin::geterror() << "\n";
+            continue;
+        }
+        WideNoiseBench<WidthT>(bench, lib, wide_isa.name, gabor_opt).run();
+    }
+}
+
+
+
+static void
+getargs(int argc, const char* argv[])
+{
+    OIIO::ArgParse ap;
+    // clang-format off
+    ap.intro("oslnoise_bench -- time all the noise varieties\n" OSL_INTRO_STRING);
+    ap.usage("oslnoise_bench [options]");
+    ap.arg("-v", &verbose)
+      .help("Verbose output");
+    ap.arg("--json %s:FILENAME", &jsonfile)
+      .help("Write the results to a file (default: stdout)");
+    ap.arg("--libdir %s:DIRS", &libdirs)
+      .help("Colon-separated directories to search for the batched libraries");
+    ap.arg("--noise %s:NAME", &only_noise)
+      .help("Only time this noise (perlin, uperlin, simplex, usimplex, cell, hash, gabor, null, unull)");
+    ap.arg("--scalar", &scalar_only)
+      .help("Only time the single point noises");
+    ap.arg("--iterations %d:N", &iterations)
+      .help("Number of iterations");
+    ap.arg("--trials %d:N", &ntrials)
+      .help("Number of trials");
+    // clang-format on
+
+    if (ap.parse(argc, (const char**)argv) < 0) {
+        std::cerr << ap.geterror() << std::endl;
+        ap.usage();
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+
+int
+main(int argc, char const* argv[])
+{
+    getargs(argc, argv);
+
+    RendererServices::NoiseOpt gabor_opt;  // same layout as NoiseParams
+    const NoiseParams* opt = reinterpret_cast<const NoiseParams*>(&gabor_opt);
+
+    NoiseBench bench;
+    bench_scalar_noises(bench, opt);
+
+    if (!scalar_only) {
+        // Look for the batched libraries next to the program, in the usual
+        // install locations relative to it, and wherever we're told
+        std::string bindir = Filesystem::parent_path(
+            Sysutil::this_program_path());
+        std::vector<std::string> dirs;
+        Filesystem::searchpath_split(libdirs, dirs, true);
+        dirs.push_back(bindir);
+        dirs.push_back(bindir + "/../lib");
+        dirs.push_back(bindir + "/../lib64");
+        bench_wide_noises<8>(bench, dirs, opt);
+        bench_wide_noises<16>(bench, dirs, opt);
+    }
+
+    if (jsonfile.size()) {
+        std::ofstream out;
+        Filesystem::open(out, jsonfile);
+        if (!out) {
+            std::cerr << "Could not open " << jsonfile << "\n";
+            return EXIT_FAILURE;
+        }
+        bench.write_json(out);
+    } else {
+        bench.write_json(std::cout);
+    }
+    return EXIT_SUCCESS;
+}
@@ -13,6 +13,7 @@
 #include <OpenImageIO/unittest.h>
 
 #include <OSL/oslnoise.h>
+#include <OSL/rendererservices.h>
 
 using namespace OSL;
 using namespace OSL::oslnoise;
@@ -366,6 +367,62 @@ test_hash()
 
 
 
+void
+test_gabor()
+{
+    // NoiseParams has the layout of RendererServices::NoiseOpt
+    RendererServices::NoiseOpt opt, fastopt;
+    fastopt.fast = 1;
+    auto params  = [](const RendererServices::NoiseOpt& o) {
+        return reinterpret_cast<const NoiseParams*>(&o);
+    };
+
+    // Compare the fast mode to the full evaluation, unfiltered and with
+    // small and large filter footprints.
+    for (float footprint : { 0.0f, 0.05f, 2.0f }) {
+        opt.do_filter = fastopt.do_filter = (footprint > 0.0f);
+        float maxerr = 0.0f, sumerr2 = 0.0f, sum2 = 0.0f;
+        const int n  = 16;
+        for (int k = 0; k < n; ++k) {
+            for (int j = 0; j < n; ++j) {
+                for (int i = 0; i < n; ++i) {
+                    Vec3 p(0.37f * i - 2.1f, 0.41f * j + 0.3f, 0.29f * k);
+                    Dual2<Vec3> P(p, Vec3(footprint, 0.0f, 0.0f),
+                                  Vec3(0.0f, footprint, 0.0f));
+                    float g  = pvt::gabor(P, params(opt)).val();
+                    float gf = pvt::gabor(P, params(fastopt)).val();
+                    maxerr   = std::max(maxerr, std::abs(g - gf));
+                    sumerr2 += (g - gf) * (g - gf);
+                    sum2 += g * g;
+                }
+            }
+        }
+        Strutil::print("gabor footprint {}: fast mode max err {}, rms err {}"
+                       " (rms value {})\n",
+                       footprint, maxerr, sqrtf(sumerr2 / (n * n * n)),
+                       sqrtf(sum2 / (n * n * n)));
+        OIIO_CHECK_LT(maxerr, 0.01f);
+    }
+
+    // Time trials
+    Benchmarker bench;
+    Dual2<Vec3> P(Vec3(0.5f, 0.25f, 0.75f), Vec3(0.05f, 0.0f, 0.0f),
+                  Vec3(0.0f, 0.05f, 0.0f));
+    clobber(P);
+    opt.do_filter = fastopt.do_filter = 0;
+    bench("  gabor(v) unfiltered",
+          [&]() { DoNotOptimize(pvt::gabor(P, params(opt))); });
+    bench("  gabor(v) unfiltered fast",
+          [&]() { DoNotOptimize(pvt::gabor(P, params(fastopt))); });
+    opt.do_filter = fastopt.do_filter = 1;
+    bench("  gabor(v) filtered",
+          [&]() { DoNotOptimize(pvt::gabor(P, params(opt))); });
+    bench("  gabor(v) filtered fast",
+          [&]() { DoNotOptimize(pvt::gabor(P, params(fastopt))); });
+}
+
+
+
 static void
 getargs(int argc, const char* argv[])
 {
@@ -413,6 +470,7 @@ main(int argc, char const* argv[])
     test_perlin();
     test_cell();
     test_hash();
+    test_gabor();
 
     return unit_test_failures;
 }
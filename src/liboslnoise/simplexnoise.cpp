@@ -515,6 +515,143 @@ simplexnoise3(float x, float y, float z, int seed, float* dnoise_dx,
 
 
 
+#ifndef __CUDA_ARCH__
+// The gradients grad3() would give for seeds 0, 1, 2 and 3, one per lane.
+inline void
+grad3x4(int i, int j, int k, vfloat4& gx, vfloat4& gy, vfloat4& gz)
+{
+    static const OIIO_SIMD4_ALIGN int seeds[4] = { 0, 1, 2, 3 };
+    const vint4 deadbeef(int(0xdeadbeef));
+    // scramble(i, j, scramble(k, seed)), for all four seeds
+    vint4 h = bjfinal(vint4(i), vint4(j),
+                      bjfinal(vint4(k), *(vint4*)seeds, deadbeef) ^ deadbeef);
+    OIIO_SIMD4_ALIGN int hash[4];
+    h.store(hash);
+    const float* g[4] = { grad3lut[hash[0] & 15], grad3lut[hash[1] & 15],
+                          grad3lut[hash[2] & 15], grad3lut[hash[3] & 15] };
+    gx = vfloat4(g[0][0], g[1][0], g[2][0], g[3][0]);
+    gy = vfloat4(g[0][1], g[1][1], g[2][1], g[3][1]);
+    gz = vfloat4(g[0][2], g[1][2], g[2][2], g[3][2]);
+}
+
+
+
+// 3D simplex noise for seeds 0, 1 and 2 (and 3) at once, one per lane.
+// Apart from the gradients, all of simplexnoise3()'s work depends only
+// on the point, so it's done just once for all of them, and the rest is
+// done 4-wide.  Each lane gets the result (and derivatives, if the last
+// three arguments are not null) of simplexnoise3() with its seed, up to
+// the rounding differences of fused multiply-adds.
+vfloat4
+simplexnoise3x4(float x, float y, float z, vfloat4* dnoise_dx,
+                vfloat4* dnoise_dy, vfloat4* dnoise_dz)
+{
+    // Skewing factors for 3D simplex grid:
+    const float F3 = 0.333333333;  // = 1/3
+    const float G3 = 0.166666667;  // = 1/6
+
+    // Skew the input space to determine which simplex cell we're in
+    float s  = (x + y + z) * F3;
+    float xs = x + s;
+    float ys = y + s;
+    float zs = z + s;
+    int i    = OIIO::ifloor(xs);
+    int j    = OIIO::ifloor(ys);
+    int k    = OIIO::ifloor(zs);
+
+    float t  = (float)(i + j + k) * G3;
+    float X0 = i - t;  // Unskew the cell origin back to (x,y,z) space
+    float Y0 = j - t;
+    float Z0 = k - t;
+
+    // Offsets of the four corners of the simplex in (i,j,k) coords, and
+    // of the point from each of them in (x,y,z) coords
+    int ci[4], cj[4], ck[4];
+    float cx[4], cy[4], cz[4];
+    cx[0] = x - X0;
+    cy[0] = y - Y0;
+    cz[0] = z - Z0;
+    float x0 = cx[0], y0 = cy[0], z0 = cz[0];
+    ci[0] = cj[0] = ck[0] = 0;
+    ci[3] = cj[3] = ck[3] = 1;
+    // clang-format off
+    if (x0>=y0) {
+        if (y0>=z0) {
+            ci[1]=1; cj[1]=0; ck[1]=0; ci[2]=1; cj[2]=1; ck[2]=0;  /* X Y Z order */
+        } else if (x0>=z0) {
+            ci[1]=1; cj[1]=0; ck[1]=0; ci[2]=1; cj[2]=0; ck[2]=1;  /* X Z Y order */
+        } else {
+            ci[1]=0; cj[1]=0; ck[1]=1; ci[2]=1; cj[2]=0; ck[2]=1;  /* Z X Y order */
+        }
+    } else { // x0<y0
+        if (y0<z0) {
+            ci[1]=0; cj[1]=0; ck[1]=1; ci[2]=0; cj[2]=1; ck[2]=1;  /* Z Y X order */
+        } else if (x0<z0) {
+            ci[1]=0; cj[1]=1; ck[1]=0; ci[2]=0; cj[2]=1; ck[2]=1;  /* Y Z X order */
+        } else {
+            ci[1]=0; cj[1]=1; ck[1]=0; ci[2]=1; cj[2]=1; ck[2]=0;  /* Y X Z order */
+        }
+    }
+    // clang-format on
+    cx[1] = x0 - ci[1] + G3;
+    cy[1] = y0 - cj[1] + G3;
+    cz[1] = z0 - ck[1] + G3;
+    cx[2] = x0 - ci[2] + 2.0f * G3;
+    cy[2] = y0 - cj[2] + 2.0f * G3;
+    cz[2] = z0 - ck[2] + 2.0f * G3;
+    cx[3] = x0 - 1.0f + 3.0f * G3;
+    cy[3] = y0 - 1.0f + 3.0f * G3;
+    cz[3] = z0 - 1.0f + 3.0f * G3;
+
+    // Contributions of the four corners, and what the derivatives need
+    vfloat4 n[4], temp[4], gx[4], gy[4], gz[4];
+    float t4[4];
+    for (int c = 0; c < 4; ++c) {
+        float tc = 0.5f - cx[c] * cx[c] - cy[c] * cy[c] - cz[c] * cz[c];
+        float t2 = 0.0f;
+        t4[c]    = 0.0f;
+        gx[c] = gy[c] = gz[c] = vfloat4::Zero();
+        if (tc >= 0.0f) {
+            grad3x4(i + ci[c], j + cj[c], k + ck[c], gx[c], gy[c], gz[c]);
+            t2    = tc * tc;
+            t4[c] = t2 * t2;
+        }
+        vfloat4 dot = gx[c] * cx[c] + gy[c] * cy[c] + gz[c] * cz[c];
+        n[c]        = t4[c] * dot;
+        temp[c]     = (t2 * tc) * dot;
+    }
+
+    // Sum up and scale the result, as simplexnoise3() does.
+    const float scale = 68.0f;
+    vfloat4 noise     = scale * (n[0] + n[1] + n[2] + n[3]);
+
+    if (dnoise_dx) {
+        OSL_DASSERT(dnoise_dy && dnoise_dz);
+        vfloat4 dx = temp[0] * cx[0];
+        vfloat4 dy = temp[0] * cy[0];
+        vfloat4 dz = temp[0] * cz[0];
+        for (int c = 1; c < 4; ++c) {
+            dx += temp[c] * cx[c];
+            dy += temp[c] * cy[c];
+            dz += temp[c] * cz[c];
+        }
+        dx *= -8.0f;
+        dy *= -8.0f;
+        dz *= -8.0f;
+        dx += t4[0] * gx[0] + t4[1] * gx[1] + t4[2] * gx[2] + t4[3] * gx[3];
+        dy += t4[0] * gy[0] + t4[1] * gy[1] + t4[2] * gy[2] + t4[3] * gy[3];
+        dz += t4[0] * gz[0] + t4[1] * gz[1] + t4[2] * gz[2] + t4[3] * gz[3];
+        *dnoise_dx = dx * scale;
+        *dnoise_dy = dy * scale;
+        *dnoise_dz = dz * scale;
+    }
+
+    return noise;
+}
+#endif
+
+
+
 // 4D simplex noise with derivatives.
 // If the last four arguments are not null, the analytic derivative
 // (the 4D gradient of the scalar noise field) is also calculated.
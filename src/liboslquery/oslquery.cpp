@@ -365,8 +365,9 @@ OSLQuery::open(string_view shadername, string_view searchpath)
     OSOReaderQuery oso(*this);
     std::string filename = shadername;
 
-    // Add file extension if not already there
-    if (Filesystem::extension(filename) != std::string(".oso"))
+    // Add file extension if not already there (or a binary .osob)
+    std::string ext = Filesystem::extension(filename);
+    if (ext != ".oso" && ext != ".osob")
         filename += ".oso";
 
     // Apply search paths
@@ -6,12 +6,33 @@
 
 #include <pybind11/embed.h>
 
+#include <OpenImageIO/parallel.h>
+
 namespace PyOSL {
 
 using namespace OSL;
 
 
 
+// A read-only numpy array viewing the numeric default values of the
+// Parameter held by the python object `self`, which the array keeps alive.
+// Aggregates get a second dimension, so a color[4] is 4x3.
+template<typename T>
+static py::object
+default_array(py::object self, const std::vector<T>& values, TypeDesc type)
+{
+    using namespace pybind11::literals;
+    py::ssize_t aggregate = type.aggregate;
+    std::vector<py::ssize_t> shape { py::ssize_t(values.size()) / aggregate };
+    if (aggregate > 1)
+        shape.push_back(aggregate);
+    py::array_t<T> result(shape, values.data(), self);
+    result.attr("setflags")("write"_a = false);
+    return std::move(result);
+}
+
+
+
 void
 declare_oslqueryparam(py::module& m)
 {
@@ -47,6 +68,16 @@ declare_oslqueryparam(py::module& m)
                     result = py::none();
                 return result;
             })
+        .def_property_readonly(
+            "value_array",
+            [](py::object self) -> py::object {
+                const Parameter& p = self.cast<const Parameter&>();
+                if (p.type.basetype == TypeDesc::INT)
+                    return default_array(self, p.idefault, p.type);
+                if (p.type.basetype == TypeDesc::FLOAT)
+                    return default_array(self, p.fdefault, p.type);
+                return py::none();
+            })
         .def_property_readonly(
             "spacename",
             [](const Parameter& p) {
@@ -166,6 +197,28 @@ declare_oslquery(py::module& m)
                 return self.geterror(clear_error);
             },
             "clear_error"_a = true);
+
+    // Query many shaders at once, in parallel and without holding the GIL,
+    // returning an OSLQuery for each (check geterror() for the ones that
+    // failed to open).
+    m.def(
+        "query_shaders",
+        [](const std::vector<std::string>& shadernames,
+           const std::string& searchpath, int nthreads) {
+            std::vector<OSLQuery> queries(shadernames.size());
+            {
+                py::gil_scoped_release gil;
+                OIIO::parallel_options popt(nthreads);
+                OIIO::parallel_for(
+                    size_t(0), shadernames.size(),
+                    [&](size_t i) {
+                        queries[i].open(shadernames[i], searchpath);
+                    },
+                    popt);
+            }
+            return queries;
+        },
+        "shadernames"_a, "searchpath"_a = "", "nthreads"_a = 0);
 }
 
 
@@ -194,6 +247,7 @@ OSL_DECLARE_PYMODULE(PYMODULE_NAME)
     // Main OSL classes
     declare_oslqueryparam(m);
     declare_oslquery(m);
+    declare_shadingsystem(m);
 }
 
 }  // namespace PyOSL
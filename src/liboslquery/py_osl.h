@@ -55,6 +55,7 @@ using namespace OSL;
 // clang-format off
 
 void declare_oslquery (py::module& m);
+void declare_shadingsystem (py::module& m);
 
 
 // bool PyProgressCallback(void*, float);
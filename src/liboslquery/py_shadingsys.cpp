@@ -0,0 +1,331 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include "py_osl.h"
+
+#include <OpenImageIO/parallel.h>
+
+#include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+
+namespace PyOSL {
+
+using namespace OSL;
+
+typedef py::array_t<float, py::array::c_style | py::array::forcecast>
+    FloatArray;
+
+
+
+// A ShadingSystem of its own, with the default RendererServices, for
+// shading arrays of points from python.
+class PyShadingSystem {
+public:
+    PyShadingSystem(const std::string& searchpath)
+        : m_ss(new ShadingSystem(&m_renderer))
+    {
+        if (searchpath.size())
+            m_ss->attribute("searchpath:shader", searchpath);
+        // Lets python sequences of floats set colors, points and matrices
+        m_ss->attribute("relaxed_param_typecheck", 1);
+    }
+
+    ShadingSystem& ss() { return *m_ss; }
+
+private:
+    RendererServices m_renderer;
+    std::unique_ptr<ShadingSystem> m_ss;
+};
+
+
+
+// A group, and where shade() puts its outputs: each point's outputs are
+// one record in a buffer, and each output is a strided numpy view of it.
+struct PyShaderGroup {
+    ShaderGroupRef group;
+    std::vector<std::string> outputs;
+    std::vector<TypeDesc> output_types;
+    std::vector<size_t> output_offsets;  ///< In the record of a point
+    size_t record_size = 0;
+};
+
+
+
+// Set the next layer's parameter from a python int, float, string or
+// sequence of them (a sequence of floats may set any float aggregate or
+// array of the same size).
+static void
+set_param(ShadingSystem& ss, ShaderGroup& group, const std::string& name,
+          py::handle value)
+{
+    bool ok = false;
+    if (py::isinstance<py::bool_>(value) || py::isinstance<py::int_>(value)) {
+        ok = ss.Parameter(group, name, value.cast<int>());
+    } else if (py::isinstance<py::float_>(value)) {
+        ok = ss.Parameter(group, name, value.cast<float>());
+    } else if (py::isinstance<py::str>(value)) {
+        ok = ss.Parameter(group, name, ustring(value.cast<std::string>()));
+    } else if (py::isinstance<py::sequence>(value)) {
+        auto seq = value.cast<py::sequence>();
+        int n    = int(seq.size());
+        if (n && py::isinstance<py::str>(seq[0])) {
+            std::vector<ustring> vals;
+            for (auto v : seq)
+                vals.emplace_back(v.cast<std::string>());
+            ok = ss.Parameter(group, name, TypeDesc(TypeDesc::STRING, n),
+                              vals.data());
+        } else if (n && py::isinstance<py::int_>(seq[0])) {
+            std::vector<int> vals;
+            for (auto v : seq)
+                vals.push_back(v.cast<int>());
+            ok = ss.Parameter(group, name, TypeDesc(TypeDesc::INT, n),
+                              vals.data());
+        } else if (n) {
+            std::vector<float> vals;
+            for (auto v : seq)
+                vals.push_back(v.cast<float>());
+            ok = ss.Parameter(group, name, TypeDesc(TypeDesc::FLOAT, n),
+                              vals.data());
+        }
+    }
+    if (!ok)
+        throw py::value_error("could not set parameter '" + name + "'");
+}
+
+
+
+// The type of an output named "param" or "layer.param", searching the
+// layers from the last, or an unknown type if there is none.
+static TypeDesc
+output_type(ShadingSystem& ss, ShaderGroup& group, const std::string& output)
+{
+    auto pieces = Strutil::splitsv(output, ".", 2);
+    string_view layer(pieces.size() > 1 ? pieces.front() : string_view());
+    string_view var(pieces.back());
+    int nlayers = 0;
+    ss.getattribute(&group, "num_layers", nlayers);
+    std::vector<ustring> layernames(nlayers);
+    if (nlayers)
+        ss.getattribute(&group, "layer_names",
+                        TypeDesc(TypeDesc::STRING, nlayers), layernames.data());
+    for (int i = nlayers - 1; i >= 0; --i) {
+        if (layer.size() && layer != layernames[i])
+            continue;
+        OSLQuery query = ss.oslquery(group, i);
+        for (const auto& param : query)
+            if (param.isoutput && param.name == var)
+                return param.type;
+    }
+    return TypeUnknown;
+}
+
+
+
+static PyShaderGroup
+shader_group(PyShadingSystem& pss, const std::string& name,
+             const py::list& layers, const py::list& connections,
+             const std::vector<std::string>& outputs)
+{
+    ShadingSystem& ss(pss.ss());
+    PyShaderGroup g;
+    g.group = ss.ShaderGroupBegin(name);
+    if (!g.group)
+        throw std::runtime_error("could not begin shader group " + name);
+    for (auto layer : layers) {
+        // (shadername, layername[, {param: value}])
+        auto l = layer.cast<py::tuple>();
+        if (l.size() < 2)
+            throw py::value_error("layers are (shader, layer[, params])");
+        if (l.size() > 2)
+            for (auto p : l[2].cast<py::dict>())
+                set_param(ss, *g.group, p.first.cast<std::string>(),
+                          p.second);
+        std::string shader = l[0].cast<std::string>();
+        if (!ss.Shader(*g.group, "surface", shader,
+                       l[1].cast<std::string>()))
+            throw std::runtime_error("could not add shader " + shader);
+    }
+    for (auto connection : connections) {
+        // (srclayer, srcparam, dstlayer, dstparam)
+        auto c = connection.cast<std::vector<std::string>>();
+        if (c.size() != 4
+            || !ss.ConnectShaders(*g.group, c[0], c[1], c[2], c[3]))
+            throw std::runtime_error("could not make connection");
+    }
+    if (!ss.ShaderGroupEnd(*g.group))
+        throw std::runtime_error("could not end shader group " + name);
+
+    // Lay out one record per point of the outputs, and have the shaders
+    // write them in place
+    std::vector<SymLocationDesc> symlocs;
+    for (const std::string& output : outputs) {
+        TypeDesc type = output_type(ss, *g.group, output);
+        if (type.basetype != TypeDesc::FLOAT && type.basetype != TypeDesc::INT)
+            throw py::value_error("no float or int output named " + output);
+        g.outputs.push_back(output);
+        g.output_types.push_back(type);
+        g.output_offsets.push_back(g.record_size);
+        g.record_size += type.size();
+    }
+    for (size_t i = 0; i < g.outputs.size(); ++i)
+        symlocs.emplace_back(g.outputs[i], g.output_types[i], false,
+                             SymArena::Outputs, g.output_offsets[i],
+                             g.record_size);
+    if (symlocs.size())
+        ss.add_symlocs(g.group.get(), symlocs);
+    return g;
+}
+
+
+
+// A float array of npoints x channels (or just npoints, for 1 channel),
+// or an empty one if array is None.
+static FloatArray
+input_array(py::object array, const char* name, size_t npoints, int channels)
+{
+    if (array.is_none())
+        return FloatArray();
+    FloatArray a = FloatArray::ensure(array);
+    if (!a || size_t(a.size()) != npoints * channels)
+        throw py::value_error(Strutil::fmt::format(
+            "{} must have {} x {} floats", name, npoints, channels));
+    return a;
+}
+
+
+
+// Shade the points given by the P, N, u and v arrays (any may be None,
+// but one must give the number of points), with nthreads threads (0 for
+// all cores), and return a dict of numpy arrays of the group's outputs.
+// The shaders write the outputs straight into the memory of the arrays.
+static py::dict
+shade(PyShadingSystem& pss, PyShaderGroup& g, py::object P, py::object N,
+      py::object u, py::object v, int nthreads)
+{
+    ShadingSystem& ss(pss.ss());
+    size_t npoints = 0;
+    for (py::object a : { P, N, u, v }) {
+        py::array array = py::array::ensure(a);
+        if (array && array.ndim())
+            npoints = std::max(npoints, size_t(array.shape(0)));
+    }
+    auto Pa = input_array(P, "P", npoints, 3);
+    auto Na = input_array(N, "N", npoints, 3);
+    auto ua = input_array(u, "u", npoints, 1);
+    auto va = input_array(v, "v", npoints, 1);
+    const float* Pp = Pa.size() ? Pa.data() : nullptr;
+    const float* Np = Na.size() ? Na.data() : nullptr;
+    const float* up = ua.size() ? ua.data() : nullptr;
+    const float* vp = va.size() ? va.data() : nullptr;
+
+    py::array_t<uint8_t> records(
+        std::vector<py::ssize_t> { py::ssize_t(npoints),
+                                   py::ssize_t(std::max(g.record_size,
+                                                        size_t(1))) });
+    char* base  = (char*)records.mutable_data();
+    int raytype = ss.raytype_bit(ustring("camera"));
+    {
+        // In chunks of points, each with a context of its own
+        const size_t chunk = 4096;
+        py::gil_scoped_release gil;
+        OIIO::parallel_options popt(nthreads);
+        OIIO::parallel_for(
+            size_t(0), (npoints + chunk - 1) / chunk,
+            [&](size_t c) {
+                PerThreadInfo* thread_info = ss.create_thread_info();
+                ShadingContext* ctx        = ss.get_context(thread_info);
+                size_t begin = c * chunk;
+                size_t end   = std::min(npoints, begin + chunk);
+                std::vector<ShaderGlobals> sgs(end - begin);
+                for (size_t i = begin; i < end; ++i) {
+                    ShaderGlobals& sg(sgs[i - begin]);
+                    memset((char*)&sg, 0, sizeof(ShaderGlobals));
+                    if (Pp)
+                        sg.P = Vec3(Pp[3 * i], Pp[3 * i + 1], Pp[3 * i + 2]);
+                    if (Np)
+                        sg.N = Vec3(Np[3 * i], Np[3 * i + 1], Np[3 * i + 2]);
+                    sg.Ng      = sg.N;
+                    sg.u       = up ? up[i] : 0.0f;
+                    sg.v       = vp ? vp[i] : 0.0f;
+                    sg.dPdu    = Vec3(1.0f, 0.0f, 0.0f);
+                    sg.dPdv    = Vec3(0.0f, 1.0f, 0.0f);
+                    sg.raytype = raytype;
+                }
+                ss.execute(*ctx, *g.group, int(begin), span<ShaderGlobals>(sgs),
+                           nullptr, base);
+                ss.release_context(ctx);
+                ss.destroy_thread_info(thread_info);
+            },
+            popt);
+    }
+
+    py::dict result;
+    for (size_t o = 0; o < g.outputs.size(); ++o) {
+        TypeDesc type = g.output_types[o];
+        py::ssize_t nchans(type.basevalues());
+        py::ssize_t stride(g.record_size);
+        char* data = base + g.output_offsets[o];
+        py::array view;
+        if (type.basetype == TypeDesc::FLOAT)
+            view = py::array_t<float>({ py::ssize_t(npoints), nchans },
+                                      { stride, py::ssize_t(sizeof(float)) },
+                                      (float*)data, records);
+        else
+            view = py::array_t<int>({ py::ssize_t(npoints), nchans },
+                                    { stride, py::ssize_t(sizeof(int)) },
+                                    (int*)data, records);
+        if (nchans == 1)
+            view = view.attr("reshape")(py::ssize_t(npoints))
+                       .cast<py::array>();
+        result[PY_STR(g.outputs[o])] = view;
+    }
+    return result;
+}
+
+
+
+void
+declare_shadingsystem(py::module& m)
+{
+    using namespace pybind11::literals;
+
+    py::class_<PyShaderGroup>(m, "ShaderGroup")
+        .def_property_readonly("outputs", [](const PyShaderGroup& g) {
+            return g.outputs;
+        });
+
+    py::class_<PyShadingSystem>(m, "ShadingSystem")
+        .def(py::init<const std::string&>(), "searchpath"_a = "")
+        .def(
+            "attribute",
+            [](PyShadingSystem& self, const std::string& name,
+               py::object value) {
+                if (py::isinstance<py::int_>(value))
+                    return self.ss().attribute(name, value.cast<int>());
+                if (py::isinstance<py::float_>(value))
+                    return self.ss().attribute(name, value.cast<float>());
+                return self.ss().attribute(name, value.cast<std::string>());
+            },
+            "name"_a, "value"_a)
+        .def(
+            "load_memory_compiled_shader",
+            [](PyShadingSystem& self, const std::string& shadername,
+               const std::string& buffer) {
+                return self.ss().LoadMemoryCompiledShader(shadername, buffer);
+            },
+            "shadername"_a, "buffer"_a)
+        .def("shader_group", &shader_group, "name"_a, "layers"_a,
+             "connections"_a = py::list(),
+             "outputs"_a     = std::vector<std::string>())
+        .def("shade", &shade, "group"_a, "P"_a = py::none(),
+             "N"_a = py::none(), "u"_a = py::none(), "v"_a = py::none(),
+             "nthreads"_a = 0)
+        .def("getstats",
+             [](PyShadingSystem& self, int level) {
+                 return self.ss().getstats(level);
+             },
+             "level"_a = 1);
+}
+
+}  // namespace PyOSL
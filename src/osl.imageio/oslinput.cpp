@@ -6,6 +6,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/imagebufalgo.h>
@@ -42,11 +43,18 @@ OSL_NAMESPACE_ENTER
 ///
 /// Special options in the options list include:
 ///    RES=%dx%d        Set the resolution of the image (default: 1024x1024)
-///    TILE=%dx%d       Set the tile size
+///    TILE=%dx%d       Set the tile size (default: untiled, or 64x64 if
+///                         MIP levels are generated)
 ///    MIP=%d           Should it generate all MIP levels (default: 0)
 ///    OUTPUT=%s        Name of output variable to use in the image
 ///                         (default: "result")
 ///
+/// Nothing is shaded until it is read: each scanline or tile request (of
+/// one MIP level) shades just those pixels, so an ImageCache or
+/// TextureSystem reading the procedural only shades the tiles that are
+/// actually looked up. The group is built once when the file is opened
+/// and compiled on the first read.
+///
 /// All other options are interpreted as setting shader parameters. The
 /// format is "type name=value". If the type is omitted, it will be inferred
 /// from the value (you get what you deserve if it's wrong). For aggregates
@@ -91,6 +99,10 @@ private:
     int m_subimage, m_miplevel;
     ImageSpec m_topspec;  // spec of highest-res MIPmap
 
+    // Shade the roi of the current MIP level into data, which holds the
+    // pixels described by spec (a window of m_spec).
+    bool shade(const ImageSpec& spec, void* data, ROI roi);
+
     // Reset everything to initial state
     void init()
     {
@@ -469,6 +481,13 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
         m_outputs.emplace_back("result");
         m_outputs.emplace_back("alpha");
     }
+    if (m_mip && !m_topspec.tile_width) {
+        // A MIP-mapped procedural is a texture, so let it be read (and
+        // shaded) a tile at a time.
+        m_topspec.tile_width  = 64;
+        m_topspec.tile_height = 64;
+        m_topspec.tile_depth  = 1;
+    }
 
     m_topspec.full_x      = m_topspec.x;
     m_topspec.full_y      = m_topspec.y;
@@ -613,23 +632,28 @@ OSLInput::read_native_scanlines(int subimage, int miplevel, int ybegin,
     if (!seek_subimage(subimage, miplevel))
         return false;
 
-    if (!m_group.get()) {
-        errorfmt("read_native_scanlines called with missing shading group");
-        return false;
-    }
-
-    // Create an ImageBuf wrapper of the user's data
     ImageSpec spec = m_spec;  // Make a spec that describes just this scanline
     spec.y         = ybegin;
     spec.z         = z;
     spec.height    = yend - ybegin;
     spec.depth     = 1;
-    ImageBuf ibwrapper(spec, data);
+    return shade(spec, data, get_roi(spec));
+}
+
+
 
-    // Now run the shader on the ImageBuf pixels, which really point to
-    // the caller's data buffer.
-    ROI roi(spec.x, spec.x + spec.width, spec.y, spec.y + spec.height, spec.z,
-            spec.z + spec.depth);
+bool
+OSLInput::shade(const ImageSpec& spec, void* data, ROI roi)
+{
+    if (!m_group.get()) {
+        errorfmt("OSL: image read with missing shading group");
+        return false;
+    }
+
+    // Run the shader on the pixels of an ImageBuf wrapper of the user's
+    // data buffer. The reads of an ImageInput are serialized, so use just
+    // this thread.
+    ImageBuf ibwrapper(spec, data);
     return shade_image(*shadingsys, *m_group, NULL, ibwrapper, m_outputs,
                        ShadePixelCenters, roi, 1);
 }
@@ -657,27 +681,15 @@ OSLInput::read_native_tiles(int subimage, int miplevel, int xbegin, int xend,
 #endif
     if (!seek_subimage(subimage, miplevel))
         return false;
-    if (!m_group.get()) {
-        errorfmt("read_native_scanlines called with missing shading group");
-        return false;
-    }
 
-    // Create an ImageBuf wrapper of the user's data
-    ImageSpec spec = m_spec;  // Make a spec that describes just this scanline
+    ImageSpec spec = m_spec;  // Make a spec that describes just these tiles
     spec.x         = xbegin;
     spec.y         = ybegin;
     spec.z         = zbegin;
     spec.width     = xend - xbegin;
     spec.height    = yend - ybegin;
     spec.depth     = zend - zbegin;
-    ImageBuf ibwrapper(spec, data);
-
-    // Now run the shader on the ImageBuf pixels, which really point to
-    // the caller's data buffer.
-    ROI roi(spec.x, spec.x + spec.width, spec.y, spec.y + spec.height, spec.z,
-            spec.z + spec.depth);
-    return shade_image(*shadingsys, *m_group, NULL, ibwrapper, m_outputs,
-                       ShadePixelCenters, roi, 1);
+    return shade(spec, data, get_roi(spec));
 }
 
 
@@ -694,11 +706,20 @@ OSLInput::read_native_tile(int subimage, int miplevel, int x, int y, int z,
     if (!seek_subimage(subimage, miplevel))
         return false;
 
-    return read_native_tiles(
-        subimage, miplevel, x,
-        std::min(x + m_spec.tile_width, m_spec.x + m_spec.width), y,
-        std::min(y + m_spec.tile_height, m_spec.y + m_spec.height), z,
-        std::min(z + m_spec.tile_depth, m_spec.z + m_spec.depth), data);
+    // The data always holds a whole tile, even where the tile hangs over
+    // the edge of the image. Only the pixels inside the image are shaded,
+    // the rest are cleared.
+    ImageSpec spec = m_spec;  // Make a spec that describes just this tile
+    spec.x         = x;
+    spec.y         = y;
+    spec.z         = z;
+    spec.width     = m_spec.tile_width;
+    spec.height    = m_spec.tile_height;
+    spec.depth     = std::max(1, m_spec.tile_depth);
+    ROI roi        = roi_intersection(get_roi(spec), get_roi(m_spec));
+    if (roi.npixels() < spec.image_pixels())
+        memset(data, 0, spec.image_bytes());
+    return shade(spec, data, roi);
 }
 
 
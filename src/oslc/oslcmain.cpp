@@ -3,10 +3,15 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <iostream>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <OpenImageIO/filesystem.h>
@@ -15,6 +20,9 @@
 
 #include <OSL/oslcomp.h>
 #include <OSL/oslexec.h>
+
+#include "osoreader.h"
+#include "shaderpack.h"
 using namespace OSL;
 
 
@@ -25,7 +33,7 @@ usage()
     std::cout
         << "oslc -- Open Shading Language compiler " OSL_LIBRARY_VERSION_STRING
            "\n" OSL_COPYRIGHT_STRING "\n"
-           "Usage:  oslc [options] file\n"
+           "Usage:  oslc [options] file [file...]\n"
            "  Options:\n"
            "\t--help         Print this usage message\n"
            "\t-o filename    Specify output filename\n"
@@ -34,12 +42,23 @@ usage()
            "\t-Ipath         Add path to the #include search path\n"
            "\t-Dsym[=val]    Define preprocessor symbol\n"
            "\t-Usym          Undefine preprocessor symbol\n"
+           "\t-include file  Include the header ahead of the source (its\n"
+           "\t                 preprocessing is shared by later files)\n"
            "\t-O0, -O1, -O2  Set optimization level (default=1)\n"
            "\t-d             Debug mode\n"
            "\t-E             Only preprocess the input and output to stdout\n"
            "\t-Werror        Treat all warnings as errors\n"
+           "\t-time          Report the time spent in each compile phase\n"
            "\t-embed-source  Embed preprocessed source in the oso file\n"
            "\t-buffer        (debugging) Force compile from buffer\n"
+           "\t-binary        Also write a binary .osob, which loads faster\n"
+           "\t-pack file     Instead of compiling, pack the given .oso/.osob\n"
+           "\t                 files into one shader library pack (with\n"
+           "\t                 -binary, .oso files are packed as .osob)\n"
+           "\t-j N           Compile several files with N processes at a time\n"
+           "\t                 (0 means one per core; default=1)\n"
+           "\t-incremental   Skip files whose depfile (from -MD, -MMD) shows\n"
+           "\t                 their output is newer than all their sources\n"
            "\t-MD, -MMD      Write a depfile containing headers used, to a file\n"
            "\t-M, -MM        Like -MD, but write depfile to stdout\n"
            "\t-MF filename   Specify the name of the depfile to output (for -MD, -MMD)\n"
@@ -87,6 +106,190 @@ static OSLC_ErrorHandler default_oslc_error_handler;
 
 
 
+// Is the output named by the depfile that -MD/-MMD left next to
+// filename newer than filename and every header the depfile lists?
+static bool
+up_to_date(const std::string& filename)
+{
+    std::string deps;
+    if (!OIIO::Filesystem::read_text_file(
+            OIIO::Filesystem::replace_extension(filename, ".d"), deps))
+        return false;
+    // It reads "target: file \ <newline> header \ <newline> header"
+    size_t colon = deps.find(": ");
+    if (colon == std::string::npos)
+        return false;
+    std::string target = deps.substr(0, colon);
+    if (!OIIO::Filesystem::exists(target))
+        return false;
+    std::time_t built = OIIO::Filesystem::last_write_time(target);
+    std::string sources = deps.substr(colon + 1);
+    for (auto dep : OIIO::Strutil::splitsv(sources)) {
+        if (dep == "\\")
+            continue;
+        if (!OIIO::Filesystem::exists(dep)
+            || OIIO::Filesystem::last_write_time(dep) > built)
+            return false;
+    }
+    return true;
+}
+
+
+
+static std::string
+shell_quote(const std::string& s)
+{
+#ifdef _WIN32
+    return "\"" + s + "\"";
+#else
+    return "'" + OIIO::Strutil::replace(s, "'", "'\\''", true) + "'";
+#endif
+}
+
+
+
+static bool
+compile_one(const std::string& shader_path,
+            const std::vector<std::string>& args, bool compile_from_buffer,
+            bool write_binary, bool quiet)
+{
+    OSLCompiler compiler(&default_oslc_error_handler);
+    bool ok = true;
+    if (compile_from_buffer) {
+        // Force a compile-from-buffer for debugging purposes
+        std::string sourcecode;
+        ok = OIIO::Filesystem::read_text_file(shader_path, sourcecode);
+        std::string osobuffer;
+        if (ok)
+            ok = compiler.compile_buffer(sourcecode, osobuffer, args, "",
+                                         shader_path);
+        if (ok) {
+            OIIO::ofstream file;
+            OIIO::Filesystem::open(file, compiler.output_filename());
+            if (file)
+                file << osobuffer;
+            ok = file.good();
+        }
+    } else {
+        // Ordinary compile from file
+        ok = compiler.compile(shader_path, args);
+    }
+
+    if (ok && write_binary
+        && OIIO::Filesystem::exists(compiler.output_filename())) {
+        // Record the oso we just wrote as a binary .osob alongside it.
+        std::string oso, osob;
+        std::string binary_filename
+            = OIIO::Filesystem::replace_extension(compiler.output_filename(),
+                                                  ".osob");
+        pvt::OSOBinaryWriter writer(&default_oslc_error_handler);
+        ok = OIIO::Filesystem::read_text_file(compiler.output_filename(), oso)
+             && writer.convert(oso, osob);
+        if (ok) {
+            OIIO::ofstream file;
+            OIIO::Filesystem::open(file, binary_filename,
+                                   std::ios::out | std::ios::binary);
+            if (file)
+                file.write(osob.data(), osob.size());
+            ok = file.good();
+        }
+        if (ok && !quiet)
+            std::cout << "Wrote " << binary_filename << "\n";
+    }
+
+    if (ok) {
+        if (!quiet)
+            std::cout << "Compiled " << shader_path << " -> "
+                      << compiler.output_filename() << "\n";
+    } else {
+        std::cout << "FAILED " << shader_path << "\n";
+    }
+    return ok;
+}
+
+
+
+// Write the compiled shaders (.oso or .osob files) as one shader library
+// pack, each under the name it is loaded by: its filename without the
+// extension.
+static bool
+write_pack(const std::string& pack_filename,
+           const std::vector<std::string>& files, bool write_binary,
+           bool quiet)
+{
+    std::vector<pvt::ShaderLibraryPack::Entry> shaders;
+    std::set<std::string> names;
+    pvt::OSOBinaryWriter writer(&default_oslc_error_handler);
+    for (auto&& f : files) {
+        pvt::ShaderLibraryPack::Entry e;
+        e.name = OIIO::Filesystem::filename(f);
+        e.name = e.name.substr(0, e.name.rfind('.'));
+        if (!names.insert(e.name).second) {
+            std::cout << "ERROR: " << f << " is a second \"" << e.name
+                      << "\" shader\n";
+            return false;
+        }
+        e.data.resize(OIIO::Filesystem::file_size(f));
+        if (OIIO::Filesystem::read_bytes(f, &e.data[0], e.data.size())
+            != e.data.size()) {
+            std::cout << "ERROR: Could not read " << f << "\n";
+            return false;
+        }
+        if (write_binary && !pvt::OSOReader::is_binary(e.data)) {
+            std::string osob;
+            if (!writer.convert(e.data, osob)) {
+                std::cout << "FAILED " << f << "\n";
+                return false;
+            }
+            e.data.swap(osob);
+        }
+        shaders.push_back(std::move(e));
+    }
+    std::string err;
+    if (!pvt::ShaderLibraryPack::write(pack_filename, shaders, err)) {
+        std::cout << "ERROR: " << err << "\n";
+        return false;
+    }
+    if (!quiet)
+        std::cout << "Packed " << shaders.size() << " shaders -> "
+                  << pack_filename << "\n";
+    return true;
+}
+
+
+
+// Compile every file in shader_paths with its own oslc process, running
+// up to jobs of them at once. (Separate processes rather than threads,
+// because the compiler keeps its struct types in a process-wide table.)
+static bool
+compile_in_parallel(const std::vector<std::string>& shader_paths,
+                    const std::vector<std::string>& child_args, int jobs)
+{
+    std::string command = shell_quote(OIIO::Sysutil::this_program_path());
+    for (auto&& a : child_args)
+        command += " " + shell_quote(a);
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < shader_paths.size();) {
+            std::string cmd = command + " " + shell_quote(shader_paths[i]);
+#ifdef _WIN32
+            cmd = "\"" + cmd + "\"";  // cmd.exe strips the outer quotes
+#endif
+            if (std::system(cmd.c_str()) != 0)
+                ok = false;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < jobs; ++t)
+        threads.emplace_back(worker);
+    for (auto&& t : threads)
+        t.join();
+    return ok;
+}
+
+
+
 int
 main(int argc, const char* argv[])
 {
@@ -110,7 +313,14 @@ main(int argc, const char* argv[])
     std::vector<std::string> args;
     bool quiet               = false;
     bool compile_from_buffer = false;
-    std::string shader_path;
+    bool write_binary        = false;
+    bool incremental         = false;
+    bool single_output       = false;  // -o, -MF or -MT name one file
+    std::string pack_filename;
+    int jobs                 = 1;
+    std::vector<std::string> shader_paths;
+    // The arguments to hand on to a child oslc for each file
+    std::vector<std::string> child_args;
 
     // Parse arguments from command line
     for (int a = 1; a < argc; ++a) {
@@ -130,6 +340,7 @@ main(int argc, const char* argv[])
                    || !strcmp(argv[a], "-O") || !strcmp(argv[a], "-O0")
                    || !strcmp(argv[a], "-O1") || !strcmp(argv[a], "-O2")
                    || !strcmp(argv[a], "-Werror")
+                   || !strcmp(argv[a], "-time") || !strcmp(argv[a], "--time")
                    || !strcmp(argv[a], "-embed-source")
                    || !strcmp(argv[a], "--embed-source")
                    || !strcmp(argv[a], "-MD")
@@ -140,65 +351,98 @@ main(int argc, const char* argv[])
                    || OIIO::Strutil::starts_with(argv[a], "-MT")) {
             // Valid command-line argument
             args.emplace_back(argv[a]);
+            if (OIIO::Strutil::starts_with(argv[a], "-MF")
+                || OIIO::Strutil::starts_with(argv[a], "-MT"))
+                single_output = true;
             if (a < argc - 1
                 && (!strcmp(argv[a], "-MF") || !strcmp(argv[a], "-MT"))) {
+                child_args.emplace_back(argv[a]);
                 ++a;
                 args.emplace_back(argv[a]);
             }
+        } else if (!strcmp(argv[a], "-include") && a < argc - 1) {
+            // Header to include ahead of the source
+            args.emplace_back(argv[a]);
+            child_args.emplace_back(argv[a]);
+            ++a;
+            args.emplace_back(argv[a]);
         } else if (!strcmp(argv[a], "-o") && a < argc - 1) {
             // Output filepath
             args.emplace_back(argv[a]);
+            child_args.emplace_back(argv[a]);
             ++a;
             args.emplace_back(argv[a]);
+            single_output = true;
         } else if (argv[a][0] == '-'
                    && (argv[a][1] == 'D' || argv[a][1] == 'U'
                        || argv[a][1] == 'I')) {
             args.emplace_back(argv[a]);
         } else if (!strcmp(argv[a], "-buffer")) {
             compile_from_buffer = true;
+        } else if (!strcmp(argv[a], "-binary")) {
+            write_binary = true;
+        } else if (!strcmp(argv[a], "-pack") && a < argc - 1) {
+            pack_filename = argv[++a];
+            continue;
+        } else if (!strcmp(argv[a], "-j") && a < argc - 1) {
+            jobs = OIIO::Strutil::stoi(argv[++a]);
+            continue;
+        } else if (OIIO::Strutil::starts_with(argv[a], "-j")) {
+            jobs = OIIO::Strutil::stoi(argv[a] + 2);
+            continue;
+        } else if (!strcmp(argv[a], "-incremental")) {
+            incremental = true;
+            continue;
         } else {
             // Shader to compile
-            shader_path = argv[a];
+            shader_paths.emplace_back(argv[a]);
+            continue;
         }
+        child_args.emplace_back(argv[a]);
     }
 
-    if (shader_path.empty()) {
+    if (shader_paths.empty()) {
         std::cout << "ERROR: Missing shader path"
                   << "\n\n";
         usage();
         return EXIT_FAILURE;
     }
 
-    OSLCompiler compiler(&default_oslc_error_handler);
-    bool ok = true;
-    if (compile_from_buffer) {
-        // Force a compile-from-buffer for debugging purposes
-        std::string sourcecode;
-        ok = OIIO::Filesystem::read_text_file(shader_path, sourcecode);
-        std::string osobuffer;
-        if (ok)
-            ok = compiler.compile_buffer(sourcecode, osobuffer, args, "",
-                                         shader_path);
-        if (ok) {
-            OIIO::ofstream file;
-            OIIO::Filesystem::open(file, compiler.output_filename());
-            if (file)
-                file << osobuffer;
-            ok = file.good();
-        }
-    } else {
-        // Ordinary compile from file
-        ok = compiler.compile(shader_path, args);
+    if (shader_paths.size() > 1 && single_output) {
+        std::cout << "ERROR: -o, -MF and -MT need a single shader path"
+                  << "\n\n";
+        usage();
+        return EXIT_FAILURE;
     }
 
-    if (ok) {
-        if (!quiet)
-            std::cout << "Compiled " << shader_path << " -> "
-                      << compiler.output_filename() << "\n";
-    } else {
-        std::cout << "FAILED " << shader_path << "\n";
-        return EXIT_FAILURE;
+    if (pack_filename.size())
+        return write_pack(pack_filename, shader_paths, write_binary, quiet)
+                   ? EXIT_SUCCESS
+                   : EXIT_FAILURE;
+
+    if (incremental) {
+        std::vector<std::string> stale;
+        for (auto&& path : shader_paths) {
+            if (!up_to_date(path))
+                stale.push_back(path);
+            else if (!quiet)
+                std::cout << "Up to date " << path << "\n";
+        }
+        shader_paths.swap(stale);
     }
 
-    return EXIT_SUCCESS;
+    if (jobs <= 0)
+        jobs = (int)OIIO::Sysutil::hardware_concurrency();
+    jobs = std::min(jobs, (int)shader_paths.size());
+    if (jobs > 1)
+        return compile_in_parallel(shader_paths, child_args, jobs)
+                   ? EXIT_SUCCESS
+                   : EXIT_FAILURE;
+
+    // One after another, without paying to start oslc again for each
+    bool ok = true;
+    for (auto&& path : shader_paths)
+        ok &= compile_one(path, args, compile_from_buffer, write_binary,
+                          quiet);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -24,12 +24,15 @@ SPDX-License-Identifier: BSD-3-Clause
 ///
 /// ~~~~
 /// <script type="preformatted">
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <OpenImageIO/argparse.h>
 #include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/parallel.h>
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/timer.h>
@@ -41,6 +44,8 @@ using namespace OSL;
 static std::string searchpath;
 static bool verbose  = false;
 static bool runstats = false;
+static bool json     = false;
+static int nthreads  = 0;  // 0 = all cores
 static std::string oneparam;
 static std::vector<std::string> filenames;
 
@@ -140,20 +145,30 @@ print_metadata(const OSLQuery::Parameter& m)
 
 
 
+// One shader named on the command line, opened (in parallel with the
+// others) before anything is printed.
+struct Shader {
+    std::string name;
+    OSLQuery query;
+    std::string error;
+    double seconds = 0.0;  ///< To open it
+};
+
+
+
 static void
-oslinfo(const std::string& name)
+oslinfo(const Shader& shader)
 {
-    OIIO::Timer t(runstats ? OIIO::Timer::StartNow : OIIO::Timer::DontStartNow);
-    OSLQuery g;
-    g.open(name, searchpath);
-    std::string e = g.geterror();
-    if (!e.empty()) {
-        std::cout << "ERROR opening shader \"" << name << "\" (" << e << ")\n";
+    const std::string& name(shader.name);
+    const OSLQuery& g(shader.query);
+    if (!shader.error.empty()) {
+        std::cout << "ERROR opening shader \"" << name << "\" ("
+                  << shader.error << ")\n";
         return;
     }
     if (runstats) {
         // display timings in an easy to sort form
-        std::cout << t.stop() << " sec for " << name << "\n";
+        std::cout << shader.seconds << " sec for " << name << "\n";
         return;  // don't show anything else, we are just benchmarking
     }
 
@@ -219,6 +234,121 @@ oslinfo(const std::string& name)
 
 
 
+// A string as a quoted JSON string
+static std::string
+json_string(string_view s)
+{
+    std::string r = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            (r += '\\') += c;
+        else if ((unsigned char)c < 0x20)
+            r += OIIO::Strutil::fmt::format("\\u{:04x}", int(c));
+        else
+            r += c;
+    }
+    return r + "\"";
+}
+
+
+
+// The default values (or metadata value) of a parameter, as a JSON array
+static std::string
+json_values(const OSLQuery::Parameter& p)
+{
+    std::vector<std::string> vals;
+    for (int v : p.idefault)
+        vals.push_back(OIIO::Strutil::fmt::format("{}", v));
+    for (float v : p.fdefault)
+        vals.push_back(OIIO::Strutil::fmt::format("{}", v));
+    for (ustring v : p.sdefault)
+        vals.push_back(json_string(v));
+    return "[" + OIIO::Strutil::join(vals, ", ") + "]";
+}
+
+
+
+static std::string
+json_metadata(const std::vector<OSLQuery::Parameter>& metadata)
+{
+    std::vector<std::string> items;
+    for (const OSLQuery::Parameter& m : metadata)
+        items.push_back(OIIO::Strutil::fmt::format(
+            "{{ \"name\": {}, \"type\": {}, \"value\": {} }}",
+            json_string(m.name), json_string(m.type.c_str()),
+            json_values(m)));
+    return "[" + OIIO::Strutil::join(items, ", ") + "]";
+}
+
+
+
+// One shader as a JSON object, indented for an array of them
+static std::string
+oslinfo_json(const Shader& shader)
+{
+    const OSLQuery& g(shader.query);
+    std::string r = "  {\n    \"file\": " + json_string(shader.name);
+    if (!shader.error.empty())
+        return r + ",\n    \"error\": " + json_string(shader.error)
+               + "\n  }";
+    r += ",\n    \"shadertype\": " + json_string(g.shadertype());
+    r += ",\n    \"shadername\": " + json_string(g.shadername());
+    r += ",\n    \"metadata\": " + json_metadata(g.metadata());
+    r += ",\n    \"params\": [";
+    bool first = true;
+    for (const OSLQuery::Parameter& p : g.parameters()) {
+        if (oneparam.size() && oneparam != p.name)
+            continue;
+        r += first ? "\n" : ",\n";
+        first = false;
+        r += OIIO::Strutil::fmt::format(
+            "      {{ \"name\": {}, \"type\": {}, \"output\": {}",
+            json_string(p.name),
+            json_string(p.isstruct ? "struct " + p.structname.string()
+                                   : std::string(p.type.c_str())),
+            p.isoutput ? "true" : "false");
+        if (p.isstruct) {
+            std::vector<std::string> fields;
+            for (ustring f : p.fields)
+                fields.push_back(json_string(f));
+            r += ", \"fields\": [" + OIIO::Strutil::join(fields, ", ") + "]";
+        } else {
+            r += ", \"default\": "
+                 + (p.validdefault ? json_values(p) : std::string("null"));
+        }
+        if (p.spacename.size()) {
+            std::vector<std::string> spaces;
+            for (ustring s : p.spacename)
+                spaces.push_back(json_string(s));
+            r += ", \"spacename\": [" + OIIO::Strutil::join(spaces, ", ")
+                 + "]";
+        }
+        r += ", \"metadata\": " + json_metadata(p.metadata) + " }";
+    }
+    return r + (first ? "]\n  }" : "\n    ]\n  }");
+}
+
+
+
+// Add the files to query for a command line argument: a shader, or all
+// the .oso files under a directory.
+static void
+add_filenames(const std::string& arg)
+{
+    if (!OIIO::Filesystem::is_directory(arg)) {
+        filenames.push_back(arg);
+        return;
+    }
+    std::vector<std::string> files;
+    OIIO::Filesystem::get_directory_entries(arg, files, true);
+    std::sort(files.begin(), files.end());
+    for (const std::string& f : files)
+        if (OIIO::Strutil::iends_with(f, ".oso"))
+            filenames.push_back(f);
+}
+
+
+
 int
 main(int argc, char* argv[])
 {
@@ -237,10 +367,10 @@ main(int argc, char* argv[])
     OIIO::ArgParse ap;
     // clang-format off
     ap.intro("oslinfo -- list parameters of a compiled OSL shader\n" OSL_INTRO_STRING);
-    ap.usage("oslinfo [options] file0 [file1 ...]");
+    ap.usage("oslinfo [options] file0|dir0 [file1|dir1 ...]");
     ap.arg("filename")
       .hidden()
-      .action([&](cspan<const char*> argv){ filenames.emplace_back(argv[0]); });
+      .action([&](cspan<const char*> argv){ add_filenames(argv[0]); });
     ap.arg("-v", &verbose)
       .help("Verbose output");
     ap.arg("--runstats", &runstats)
@@ -249,6 +379,10 @@ main(int argc, char* argv[])
       .help("Set searchpath for shaders");
     ap.arg("--param %s:NAME", &oneparam)
       .help("Output information about just this parameter");
+    ap.arg("--json", &json)
+      .help("Output one JSON document describing all the shaders");
+    ap.arg("-j %d:NTHREADS", &nthreads)
+      .help("Threads to open the shaders with (default: 0 = all cores)");
     // clang-format on
 
     if (ap.parse(argc, (const char**)argv) < 0) {
@@ -260,8 +394,30 @@ main(int argc, char* argv[])
         return EXIT_SUCCESS;
     }
 
-    for (auto filename : filenames) {
-        oslinfo(filename);
+    // Open all the shaders in parallel, then print them in order
+    std::vector<Shader> shaders(filenames.size());
+    OIIO::parallel_options popt(runstats ? 1 : nthreads);
+    OIIO::parallel_for(
+        size_t(0), shaders.size(),
+        [&](size_t i) {
+            Shader& s(shaders[i]);
+            OIIO::Timer t;
+            s.name = filenames[i];
+            s.query.open(s.name, searchpath);
+            s.error   = s.query.geterror();
+            s.seconds = t();
+        },
+        popt);
+
+    if (json) {
+        std::cout << "[\n";
+        for (size_t i = 0; i < shaders.size(); ++i)
+            std::cout << oslinfo_json(shaders[i])
+                      << (i + 1 < shaders.size() ? ",\n" : "\n");
+        std::cout << "]\n";
+    } else {
+        for (const Shader& shader : shaders)
+            oslinfo(shader);
     }
     return EXIT_SUCCESS;
 }
@@ -395,6 +395,25 @@ Magnifier::mouseMoveEvent(QMouseEvent* event)
 //
 //
 
+// A background build of the shader group: what the GUI thread snapshotted
+// when it was requested, and what it produced.
+struct OSLToyMainWindow::GroupBuild {
+    bool compile = false;  // Compile the shader source, it may have changed
+    bool rebuild = false;  // Rebuild the group even if the shader didn't
+    int tab      = -1;     // Editor tab of the shader
+    std::string briefname, shadername, source;
+    OIIO::ParamValueList instvalues;
+    std::unordered_map<std::string, bool> diddlers;
+
+    bool ok         = true;
+    bool new_shader = false;  // A changed shader was loaded
+    std::string errors;
+    ShaderGroupRef group;  // Optimized and JITed, or null if none was built
+    bool uses_time = false;
+};
+
+
+
 OSLToyMainWindow::OSLToyMainWindow(OSLToyRenderer* rend, int xr, int yr)
     : QMainWindow(nullptr), xres(xr), yres(yr), m_renderer(rend)
 {
@@ -437,6 +456,12 @@ OSLToyMainWindow::OSLToyMainWindow(OSLToyRenderer* rend, int xr, int yr)
     OIIO::ImageBufAlgo::checker(checks, 16, 16, 1, white, black);
     renderView->update(checks);
 
+    compiletimer = new QTimer(this);
+    compiletimer->setSingleShot(true);
+    compiletimer->setInterval(500);
+    connect(compiletimer, &QTimer::timeout, this,
+            &OSLToyMainWindow::recompile_shaders);
+
     textTabs = new QTabWidget;
     action_newfile();  // Start with one tab
 
@@ -490,6 +515,14 @@ OSLToyMainWindow::OSLToyMainWindow(OSLToyRenderer* rend, int xr, int yr)
 
 OSLToyMainWindow::~OSLToyMainWindow()
 {
+    // Let a build in progress finish, but don't start any other
+    {
+        OIIO::spin_lock lock(m_job_mutex);
+        m_pending_build.reset();
+    }
+    if (m_build_future.valid())
+        m_build_future.wait();
+
     // Make sure the shadingsys is destroyed before the renderer
     std::cout << shadingsys()->getstats(5) << "\n";
 }
@@ -588,6 +621,15 @@ OSLToyMainWindow::shadingsys() const
 
 
 
+void
+OSLToyMainWindow::rerender_needed()
+{
+    m_rerender_needed = 1;
+    renderer()->restart_refinement();
+}
+
+
+
 int
 OSLToyMainWindow::ntabs() const
 {
@@ -645,6 +687,10 @@ OSLToyMainWindow::add_new_editor_window(const std::string& filename)
     ed_err_layout->addWidget(texteditor);
     ed_err_layout->addWidget(errdisplay);
 
+    // Recompile by itself once the typing pauses
+    connect(texteditor, &QPlainTextEdit::textChanged, this,
+            [this]() { compiletimer->start(); });
+
     // Add the combo editor and error display as the contents of the tab
     int n = ntabs();
     if (filename.size()) {
@@ -763,10 +809,14 @@ OSLToyMainWindow::action_save()
 // the default pool for the workers.
 static OIIO::thread_pool trigger_pool;
 
+// And one for the group builds, which mustn't hold up either.
+static OIIO::thread_pool build_pool;
+
 
 void
 OSLToyMainWindow::timed_rerender_trigger(void)
 {
+    install_finished_build();
     if (paused)
         return;
     float now = timer();
@@ -774,7 +824,7 @@ OSLToyMainWindow::timed_rerender_trigger(void)
         last_frame_update_time = now;
         update_statusbar_fps(now, fps);
     }
-    if (!m_rerender_needed && !m_shader_uses_time)
+    if (!m_rerender_needed && !m_shader_uses_time && !renderer()->refining())
         return;
     {
         OIIO::spin_lock lock(m_job_mutex);
@@ -797,10 +847,15 @@ OSLToyMainWindow::osl_do_rerender(float /*frametime*/)
     if (renderer()->shadergroup()) {
         float start = timer();
         renderer()->set_time(start);
-        renderer()->render_image();
+        // A shader that animates never gets to refine; each frame starts
+        // over at the resolution that keeps up.
+        if (m_shader_uses_time)
+            renderer()->restart_refinement();
+        bool complete = renderer()->render_image();
         OIIO_UNUSED_OK float rendertime = timer() - start;
 
-        renderView->update(renderer()->framebuffer());
+        if (complete)
+            renderView->update(renderer()->framebuffer());
 
         float now = timer();
         // std::cout <<"render only " << (1.0f/rendertime) << "  with coco " << 1.0f/(now-start)
@@ -841,63 +896,179 @@ private:
 void
 OSLToyMainWindow::recompile_shaders()
 {
-    m_groupspec.clear();
-    m_firstshadername.clear();
-    m_groupname.clear();
+    compiletimer->stop();
+    request_build(true /*compile*/, false /*rebuild*/);
+}
+
+
+
+void
+OSLToyMainWindow::build_shader_group()
+{
+    request_build(false /*compile*/, true /*rebuild*/);
+}
+
 
-    QtUtils::clear_layout(paramLayout);
-    bool ok = true;
+
+void
+OSLToyMainWindow::request_build(bool compile, bool rebuild)
+{
+    std::unique_ptr<GroupBuild> build(new GroupBuild);
+    build->compile = compile;
+    build->rebuild = rebuild;
     for (int tab = 0; tab < ntabs(); ++tab) {
-        auto editor            = editors[tab];
-        std::string briefname  = editor->brief_filename();
-        std::string shadername = OIIO::Filesystem::filename(briefname);
-        std::string source     = editor->text_string();
-        if (OIIO::Strutil::ends_with(briefname, ".oslgroup")) {
-            continue;
-            // FIXME!  No current support for shader group specs
-
-            m_groupname = shadername;
-            m_groupspec = source;
-            // This is the group!
-        } else if (OIIO::Strutil::ends_with(briefname, ".osl")) {
-            // This is a shader
-            MyOSLCErrorHandler errhandler(this);
-            OSLCompiler oslcomp(&errhandler);
-            std::string osooutput;
-            std::vector<std::string> options;
-            ok = oslcomp.compile_buffer(source, osooutput, options, "",
-                                        briefname);
-            set_error_message(tab,
-                              OIIO::Strutil::join(errhandler.errors, "\n"));
-            if (ok) {
-                // std::cout << osooutput << "\n";
-                ok = shadingsys()->LoadMemoryCompiledShader(briefname,
-                                                            osooutput);
-                if (!ok) {
-                    // FIXME -- handle .oso error. What can happen?
-                }
-            } else {
-                // Force tab display to the error
-                textTabs->setCurrentIndex(tab);
-                break;
+        // FIXME!  Only one shader currently, and no support for shader
+        // group specs (.oslgroup).
+        std::string briefname = editors[tab]->brief_filename();
+        if (OIIO::Strutil::ends_with(briefname, ".osl")) {
+            build->tab        = tab;
+            build->briefname  = briefname;
+            build->shadername = OIIO::Filesystem::filename(briefname);
+            build->source     = editors[tab]->text_string();
+            break;
+        }
+    }
+    build->instvalues = m_shaderparam_instvalues;
+    build->diddlers   = m_diddlers;
+
+    OIIO::spin_lock lock(m_job_mutex);
+    if (m_pending_build) {
+        // It never started, so this one takes its place, but must also do
+        // what it would have done.
+        build->compile |= m_pending_build->compile;
+        build->rebuild |= m_pending_build->rebuild;
+    }
+    m_pending_build = std::move(build);
+    if (!m_building) {
+        m_building     = true;
+        m_build_future = build_pool.push([this](int) { build_worker(); });
+    }
+}
+
+
+
+void
+OSLToyMainWindow::build_worker()
+{
+    for (;;) {
+        std::unique_ptr<GroupBuild> build;
+        {
+            OIIO::spin_lock lock(m_job_mutex);
+            build = std::move(m_pending_build);
+            if (!build) {
+                m_building = false;
+                return;
+            }
+        }
+        run_build(*build);
+        OIIO::spin_lock lock(m_job_mutex);
+        if (m_finished_build) {
+            // The GUI never installed the one before, so don't lose what
+            // it learned about the shader.
+            if (!build->compile) {
+                build->compile = m_finished_build->compile;
+                build->tab     = m_finished_build->tab;
+                build->errors  = m_finished_build->errors;
             }
-            if (m_firstshadername.empty())
-                m_firstshadername = shadername;
+            build->new_shader |= m_finished_build->new_shader;
+        }
+        m_finished_build = std::move(build);
+    }
+}
 
-            // FIXME!  Only one shader currently!
-            break;
+
+
+void
+OSLToyMainWindow::run_build(GroupBuild& build)
+{
+    ShadingSystem* ss = shadingsys();
+    if (build.compile && build.briefname.size()) {
+        MyOSLCErrorHandler errhandler(this);
+        OSLCompiler oslcomp(&errhandler);
+        std::string osooutput;
+        std::vector<std::string> options;
+        build.ok     = oslcomp.compile_buffer(build.source, osooutput, options,
+                                              "", build.briefname);
+        build.errors = OIIO::Strutil::join(errhandler.errors, "\n");
+        if (!build.ok)
+            return;
+        std::string& loaded = m_loaded_oso[build.briefname];
+        if (osooutput != loaded) {
+            if (!ss->LoadMemoryCompiledShader(build.briefname, osooutput)) {
+                build.ok     = false;
+                build.errors = "Could not load the compiled shader";
+                return;
+            }
+            loaded           = osooutput;
+            build.new_shader = true;
         }
+        // Edits that compile to the same shader (comments, spacing) don't
+        // need a new group.
+        if (!build.new_shader && !build.rebuild && renderer()->shadergroup())
+            return;
     }
 
-    if (ok) {
-        // If everything went ok so far, make a shader group
-        build_shader_group();
+    auto loaded = m_loaded_oso.find(build.briefname);
+    if (loaded == m_loaded_oso.end() || loaded->second.empty())
+        return;  // Nothing successfully compiled yet
+    ShaderGroupRef group = ss->ShaderGroupBegin();
+    for (auto&& instparam : build.instvalues) {
+        ss->Parameter(instparam.name(), instparam.type(), instparam.data(),
+                      !build.diddlers[instparam.name().string()]);
+    }
+    ss->Shader("surface", build.shadername, "layer1");
+    ss->ShaderGroupEnd();
+    if (!group) {
+        build.ok = false;
+        return;
+    }
+
+    // Do the optimization and JIT here rather than in the next render
+    renderer()->prepare_shadergroup(group.get());
+
+    int num_globals_needed        = 0;
+    const ustring* globals_needed = nullptr;
+    ss->getattribute(group.get(), "num_globals_needed", num_globals_needed);
+    ss->getattribute(group.get(), "globals_needed", TypeDesc::PTR,
+                     &globals_needed);
+    for (int i = 0; i < num_globals_needed; ++i)
+        if (globals_needed[i] == "time")
+            build.uses_time = true;
+    build.group = group;
+}
+
+
+
+void
+OSLToyMainWindow::install_finished_build()
+{
+    std::unique_ptr<GroupBuild> build;
+    {
+        OIIO::spin_lock lock(m_job_mutex);
+        build = std::move(m_finished_build);
+    }
+    if (!build)
+        return;
+    if (build->compile && build->tab >= 0 && build->tab < ntabs()) {
+        set_error_message(build->tab, build->errors);
+        if (!build->ok) {
+            // Force tab display to the error
+            textTabs->setCurrentIndex(build->tab);
+        }
+    }
+    if (!build->group)
+        return;
+
+    renderer()->set_shadergroup(build->group);
+    m_shader_uses_time = build->uses_time;
+    if (build->new_shader) {
+        QtUtils::clear_layout(paramLayout);
         inventory_params();
         rebuild_param_area();
         if (paused && fps == 0 /* never started */)
             toggle_pause();
-        rerender_needed();
     }
+    rerender_needed();
 }
 
 
@@ -934,41 +1105,6 @@ OSLToyMainWindow::restart_time()
 
 
 
-void
-OSLToyMainWindow::build_shader_group()
-{
-    // std::cout << "Rebuilding group\n";
-    ShadingSystem* ss = renderer()->shadingsys();
-    ShaderGroupRef group;
-    if (m_groupspec.size()) {
-        group = ss->ShaderGroupBegin(m_groupname, "surface", m_groupspec);
-        ss->ShaderGroupEnd();
-    } else if (m_firstshadername.size()) {
-        group = ss->ShaderGroupBegin();
-        for (auto&& instparam : m_shaderparam_instvalues) {
-            ss->Parameter(instparam.name(), instparam.type(), instparam.data(),
-                          !m_diddlers[instparam.name().string()]);
-        }
-        ss->Shader("surface", m_firstshadername, "layer1");
-        ss->ShaderGroupEnd();
-    }
-    renderer()->set_shadergroup(group);
-
-    m_shader_uses_time            = false;
-    int num_globals_needed        = 0;
-    const ustring* globals_needed = nullptr;
-    ss->getattribute(group.get(), "num_globals_needed", num_globals_needed);
-    ss->getattribute(group.get(), "globals_needed", TypeDesc::PTR,
-                     &globals_needed);
-    for (int i = 0; i < num_globals_needed; ++i)
-        if (globals_needed[i] == "time")
-            m_shader_uses_time = true;
-
-    rerender_needed();
-}
-
-
-
 void
 OSLToyMainWindow::inventory_params()
 {
@@ -5,6 +5,8 @@
 #pragma once
 
 #include <atomic>
+#include <future>
+#include <memory>
 #include <unordered_map>
 
 #include <OpenImageIO/imagebuf.h>
@@ -68,6 +70,10 @@ public:
 
     void update_statusbar_fps(float time, float fps);
 
+    // Compile the shaders in the editors and rebuild the group from them
+    // (recompile_shaders), or just rebuild it with the current parameter
+    // values (build_shader_group). Either happens in the background; the
+    // old group keeps rendering until the new one is optimized and JITed.
     void recompile_shaders();
     void build_shader_group();
     void toggle_pause();
@@ -91,7 +97,8 @@ public:
 
     bool open_file(const std::string& filename);
 
-    void rerender_needed() { m_rerender_needed = 1; }
+    // The image is out of date: render it again, from the coarsest pass.
+    void rerender_needed();
 
 private slots:
 
@@ -113,6 +120,7 @@ private:
     std::vector<CodeEditor*> editors;
     std::vector<QTextEdit*> error_displays;
     QTimer* maintimer;
+    QTimer* compiletimer;  // Recompiles once the typing pauses
 
     // Add an action, with optional label (if different than the name),
     // hotkey shortcut and the method of lambda to call when the action is
@@ -176,6 +184,15 @@ private:
 
     void osl_do_rerender(float frametime);
 
+    // Background group builds. A request replaces any build still waiting
+    // to start, the worker runs them one at a time and only the last
+    // finished one is installed, by the GUI thread.
+    struct GroupBuild;
+    void request_build(bool compile, bool rebuild);
+    void build_worker();
+    void run_build(GroupBuild& build);
+    void install_finished_build();
+
     // Clear the param area. After this call, add things to paramLayout.
     // When you are done, call: paramScroll->setWidget (paramWidget)
     void clear_param_area();
@@ -192,10 +209,8 @@ private:
     std::vector<std::shared_ptr<ParamRec>> m_shaderparams;
     OIIO::ParamValueList m_shaderparam_instvalues;
     std::unordered_map<std::string, bool> m_diddlers;
-    std::string m_groupspec;
-    std::string m_firstshadername;
-    std::string m_groupname;
     bool m_shader_uses_time = false;
+    std::future<void> m_build_future;  // The running build worker
 
     // Access control mutex for handing things off between the GUI thread
     // and the shading thread.
@@ -204,6 +219,11 @@ private:
     std::atomic<int> m_working { 0 };
     std::atomic<int> m_shaders_recompiled { 0 };
     std::atomic<int> m_rerender_needed { 0 };
+    std::unique_ptr<GroupBuild> m_pending_build;
+    std::unique_ptr<GroupBuild> m_finished_build;
+    bool m_building = false;
+    //vvv--- access only by the build worker
+    std::unordered_map<std::string, std::string> m_loaded_oso;
     //vvv--- access by the GUI thread only if m_working == 0, and by the
     //       shading thread only if m_working == 1.
     OIIO::Timer timer { false /*don't start*/ };
@@ -2,12 +2,15 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <cstring>
 
 #include <OpenImageIO/imagebuf.h>
 #include <OpenImageIO/imagebufalgo.h>
+#include <OpenImageIO/imagebufalgo_util.h>
 #include <OpenImageIO/timer.h>
 
 #include <OSL/oslexec.h>
+#include <OSL/oslquery.h>
 
 #include "osltoyrenderer.h"
 
@@ -22,6 +25,7 @@ static ustring u_NDC("NDC"), u_raster("raster");
 static ustring u_perspective("perspective");
 static ustring u_s("s"), u_t("t");
 static ustring u_mouse("mouse");
+static ustring u_Cout("Cout");
 static constexpr TypeDesc TypeFloatArray2(TypeDesc::FLOAT, 2);
 static constexpr TypeDesc TypeFloatArray4(TypeDesc::FLOAT, 4);
 static constexpr TypeDesc TypeIntArray2(TypeDesc::INT, 2);
@@ -106,21 +110,142 @@ OSLToyRenderer::OSLToyRenderer()
 
 
 void
+OSLToyRenderer::prepare_shadergroup(ShaderGroup* group)
+{
+    // Place Cout in the 3 channel framebuffer pixel that render_image()
+    // passes as the output base, the same placement shade_image() would
+    // give it.
+    int nlayers = 0;
+    m_shadingsys->getattribute(group, "num_layers", nlayers);
+    if (nlayers > 0) {
+        OSLQuery q       = m_shadingsys->oslquery(*group, nlayers - 1);
+        const auto* Cout = q.getparam(u_Cout);
+        if (Cout && Cout->isoutput && Cout->type == TypeDesc::TypeColor) {
+            SymLocationDesc symloc(u_Cout, TypeDesc::TypeColor, false,
+                                   SymArena::Outputs, 0, 3 * sizeof(float));
+            m_shadingsys->add_symlocs(group, symloc);
+        }
+    }
+    m_shadingsys->optimize_group(group, nullptr);
+}
+
+
+
+// The coarsest refinement level, shading every 8th pixel, and the time we
+// would like a pass to take to keep the display interactive.
+static constexpr int max_level       = 3;
+static constexpr double frame_budget = 1.0 / 30.0;
+
+
+
+int
+OSLToyRenderer::start_level() const
+{
+    // Before we know what the shader costs, start at the coarsest level.
+    if (m_point_cost <= 0.0)
+        return max_level;
+    for (int level = 0; level < max_level; ++level) {
+        int step = 1 << level;
+        double npoints = double((m_xres + step - 1) / step)
+                         * double((m_yres + step - 1) / step);
+        if (npoints * m_point_cost <= frame_budget)
+            return level;
+    }
+    return max_level;
+}
+
+
+
+bool
+OSLToyRenderer::shade_level(int level, int64_t& npoints)
+{
+    ShaderGroupRef group = shadergroup();
+    int step             = 1 << level;
+    // The points of the previous, coarser pass of the same refinement are
+    // the ones on even coordinates of this pass, and are already shaded.
+    bool reuse = level < m_start_level;
+
+    // The derivatives follow the spacing of the points we shade, so that
+    // the coarse passes are filtered like a smaller image would be.
+    ShaderGlobals sgt = m_shaderglobals_template;
+    sgt.dudx          = float(step) / m_xres;
+    sgt.dvdy          = float(step) / m_yres;
+    sgt.dPdx          = Vec3(step, 0.0f, 0.0f);
+    sgt.dPdy          = Vec3(0.0f, step, 0.0f);
+    sgt.dPdu          = Vec3(m_xres, 0.0f, 0.0f);
+    sgt.dPdv          = Vec3(0.0f, m_yres, 0.0f);
+
+    std::atomic<int64_t> shaded { 0 };
+    OIIO::ROI points(0, (m_xres + step - 1) / step, 0,
+                     (m_yres + step - 1) / step);
+    OIIO::parallel_options popt;
+    popt.minitems  = std::max(64, 4096 >> (2 * level));
+    popt.splitdir  = OIIO::Split_Tile;
+    popt.recursive = true;
+    OIIO::ImageBufAlgo::parallel_image(points, popt, [&](OIIO::ROI roi) {
+        PerThreadInfo* thread_info = m_shadingsys->create_thread_info();
+        ShadingContext* ctx        = m_shadingsys->get_context(thread_info);
+        ShaderGlobals sg;
+        int64_t n = 0;
+        for (int py = roi.ybegin; py < roi.yend && !m_restart; ++py) {
+            for (int px = roi.xbegin; px < roi.xend; ++px) {
+                int x           = px * step;
+                int y           = py * step;
+                float* pixel    = (float*)m_framebuffer.pixeladdr(x, y);
+                bool have_point = reuse && !(px & 1) && !(py & 1);
+                if (!have_point) {
+                    sg   = sgt;
+                    sg.P = Vec3(x + 0.5f, y + 0.5f, 0.0f);
+                    sg.u = (x + 0.5f) / m_xres;
+                    sg.v = (y + 0.5f) / m_yres;
+                    // prepare_shadergroup() placed Cout in the pixel
+                    m_shadingsys->execute(*ctx, *group, 0, sg, nullptr,
+                                          pixel);
+                    ++n;
+                }
+                // Fill in the block of pixels this point stands for
+                int xend = std::min(x + step, m_xres);
+                int yend = std::min(y + step, m_yres);
+                for (int yy = y; yy < yend; ++yy)
+                    for (int xx = x; xx < xend; ++xx)
+                        if (xx != x || yy != y)
+                            memcpy(m_framebuffer.pixeladdr(xx, yy), pixel,
+                                   3 * sizeof(float));
+            }
+        }
+        shaded += n;
+        m_shadingsys->release_context(ctx);
+        m_shadingsys->destroy_thread_info(thread_info);
+    });
+    npoints = shaded;
+    return !m_restart;
+}
+
+
+
+bool
 OSLToyRenderer::render_image()
 {
     if (!m_framebuffer.initialized())
         m_framebuffer.reset(
             OIIO::ImageSpec(m_xres, m_yres, 3, TypeDesc::FLOAT));
 
-    static ustring outputs[] = { ustring("Cout") };
-    //    OIIO::Timer timer;
-    OIIO::parallel_options popt;
-    popt.minitems  = 4096;
-    popt.splitdir  = OIIO::Split_Tile;
-    popt.recursive = true;
-    shade_image(*shadingsys(), *shadergroup(), &m_shaderglobals_template,
-                m_framebuffer, outputs, ShadePixelCenters, OIIO::ROI(), popt);
-    //    std::cout << timer() << "\n";
+    if (m_restart.exchange(false)) {
+        m_start_level = start_level();
+        m_level       = m_start_level;
+    }
+    int level = m_level;
+    if (level < 0)
+        return false;  // Nothing changed since the full resolution pass
+
+    OIIO::Timer timer;
+    int64_t npoints = 0;
+    if (!shade_level(level, npoints))
+        return false;  // Stale, a restart is waiting
+    if (npoints)
+        m_point_cost = timer() / double(npoints);
+    m_level = level - 1;
+    return true;
 }
 
 
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <unordered_map>
@@ -62,7 +63,29 @@ public:
 
     OIIO::ImageBuf& framebuffer() { return m_framebuffer; }
 
-    void render_image();
+    // Get a new group ready to be handed to set_shadergroup(): place its
+    // output in the framebuffer as render_image() expects, then optimize
+    // and JIT it, so the first render with it doesn't have to.
+    void prepare_shadergroup(ShaderGroup* group);
+
+    // Render the next pass of the progressive refinement into the
+    // framebuffer.  The first pass after restart_refinement() shades
+    // every 2^level pixels and fills in the blocks between them, at the
+    // coarsest level (down to 1/8 resolution) that fits the frame budget
+    // given what earlier passes cost; each later pass halves the spacing,
+    // reusing the points already shaded, until the full resolution is
+    // done.  The group must have been through prepare_shadergroup(),
+    // which places its Cout in the pixel.  Return false if the pass was
+    // canceled by a restart and the framebuffer is not worth displaying.
+    bool render_image();
+
+    // Start the refinement over, canceling the pass in progress (if any),
+    // because the group, its parameters or the time changed.  Safe to call
+    // from another thread than the one rendering.
+    void restart_refinement() { m_restart = true; }
+
+    // Are there more passes to render before the image is full resolution?
+    bool refining() const { return m_restart || m_level >= 0; }
 
     // vvv Methods necessary to be a RendererServices
     virtual int supports(string_view feature) const;
@@ -94,6 +117,18 @@ private:
     ShaderGlobals m_shaderglobals_template;
     OIIO::ImageBuf m_framebuffer;
 
+    // Progressive refinement state. m_level is the level of the next pass
+    // to render (-1 when the image is complete), m_start_level the one the
+    // current refinement started at, and m_point_cost the measured time of
+    // shading one point in earlier passes (0 before there are any).
+    std::atomic<bool> m_restart { false };
+    std::atomic<int> m_level { -1 };
+    int m_start_level   = -1;
+    double m_point_cost = 0.0;
+
+    int start_level() const;
+    bool shade_level(int level, int64_t& npoints);
+
     // Camera parameters
     Matrix44 m_world_to_camera;
     ustring m_projection;
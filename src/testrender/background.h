@@ -20,20 +20,52 @@ struct Background {
     }
 
     template<typename F, typename T> void prepare(int resolution, F cb, T* data)
+    {
+        init(resolution);
+        for (int y = 0; y < res; y++)
+            for (int x = 0; x < res; x++)
+                set_value(x, y, cb(direction(x, y), data));
+        build();
+    }
+
+    /// Allocate the tables for a grid of resolution x resolution
+    /// directions, whose values the caller sets, from any number of
+    /// threads, before build().
+    void init(int resolution)
     {
         res = resolution;
         if (res < 32)
             res = 32;  // validate
         invres      = 1.0f / res;
         invjacobian = res * res / float(4 * M_PI);
-        values      = new Vec3[res * res];
-        rows        = new float[res];
-        cols        = new float[res * res];
+        delete[] values;
+        delete[] rows;
+        delete[] cols;
+        values = new Vec3[res * res];
+        rows   = new float[res];
+        cols   = new float[res * res];
+    }
+
+    int resolution() const { return res; }
+
+    /// The direction of the center of entry (x,y) of the grid
+    Dual2<Vec3> direction(int x, int y) const
+    {
+        return map(x + 0.5f, y + 0.5f);
+    }
+
+    void set_value(int x, int y, const Vec3& value)
+    {
+        values[y * res + x] = value;
+    }
+
+    /// Build the importance tables from the values of the grid.
+    void build()
+    {
         for (int y = 0, i = 0; y < res; y++) {
             for (int x = 0; x < res; x++, i++) {
-                values[i] = cb(map(x + 0.5f, y + 0.5f), data);
-                cols[i]   = std::max(std::max(values[i].x, values[i].y),
-                                     values[i].z)
+                cols[i] = std::max(std::max(values[i].x, values[i].y),
+                                   values[i].z)
                           + ((x > 0) ? cols[i - 1] : 0.0f);
             }
             rows[y] = cols[i - 1] + ((y > 0) ? rows[y - 1] : 0.0f);
@@ -0,0 +1,195 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstring>
+#include <vector>
+
+#include "batched_simpleraytracer.h"
+#include "simpleraytracer.h"
+
+OSL_NAMESPACE_ENTER
+
+static ustring u_s("s"), u_t("t");
+
+
+
+template<int WidthT>
+BatchedSimpleRaytracer<WidthT>::BatchedSimpleRaytracer(SimpleRaytracer& sr)
+    : BatchedRendererServices<WidthT>(sr.texturesys()), m_sr(sr)
+{
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           Wide<const TransformationPtr> xform,
+                                           Wide<const float> /*time*/)
+{
+    // Transformations are just simple 4x4 matrices, but each lane may be
+    // on a different object.
+    result.mask().template foreach<1 /*MinOccupancyT*/>(
+        [&](ActiveLane lane) -> void {
+            result[lane] = *reinterpret_cast<const Matrix44*>(xform[lane]);
+        });
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           ustringhash from,
+                                           Wide<const float> /*time*/)
+{
+    Matrix44 M;
+    if (!m_sr.get_matrix(nullptr, M, from))
+        return Mask(false);
+    OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+    for (int lane = 0; lane < WidthT; ++lane)
+        result[lane] = M;
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_inverse_matrix(
+    BatchedShaderGlobals* /*bsg*/, Masked<Matrix44> result, ustringhash to,
+    Wide<const float> /*time*/)
+{
+    // SimpleRaytracer doesn't understand motion blur, so the time of the
+    // lanes doesn't matter.
+    Matrix44 M;
+    if (!m_sr.get_inverse_matrix(nullptr, M, to, 0.0f))
+        return Mask(false);
+    OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+    for (int lane = 0; lane < WidthT; ++lane)
+        result[lane] = M;
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+bool
+BatchedSimpleRaytracer<WidthT>::is_attribute_uniform(ustring /*object*/,
+                                                     ustring name)
+{
+    // Everything but the userdata is about the renderer, not the point
+    return m_sr.m_attr_getters.count(name) != 0;
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_array_attribute(BatchedShaderGlobals* bsg,
+                                                    ustringhash object,
+                                                    ustringhash name,
+                                                    int index, MaskedData val)
+{
+    if (m_sr.m_attr_getters.count(name)) {
+        // Attributes of the renderer are the same for every lane
+        std::vector<char> scalar(val.type().size());
+        if (!m_sr.get_array_attribute(nullptr, false, object, val.type(),
+                                      name, index, scalar.data()))
+            return Mask(false);
+        val.assign_all_from_scalar(scalar.data());
+        return val.mask();
+    }
+
+    // If no named attribute was found, allow userdata to bind to the
+    // attribute request.
+    if (object.empty() && index == -1)
+        return get_userdata(name, bsg, val);
+
+    return Mask(false);
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_attribute(BatchedShaderGlobals* bsg,
+                                              ustringhash object,
+                                              ustringhash name, MaskedData val)
+{
+    return get_array_attribute(bsg, object, name, -1, val);
+}
+
+
+
+template<int WidthT>
+bool
+BatchedSimpleRaytracer<WidthT>::get_array_attribute_uniform(
+    BatchedShaderGlobals* /*bsg*/, ustringhash object, ustringhash name,
+    int index, RefData val)
+{
+    // Only the renderer's own attributes are uniform (see
+    // is_attribute_uniform), and those never look at the shader globals.
+    if (!m_sr.m_attr_getters.count(name)
+        || !m_sr.get_array_attribute(nullptr, false, object, val.type(), name,
+                                     index, val.ptr()))
+        return false;
+    if (val.has_derivs()) {
+        size_t size = val.type().size();
+        memset((char*)val.ptr() + size, 0, 2 * size);
+    }
+    return true;
+}
+
+
+
+template<int WidthT>
+bool
+BatchedSimpleRaytracer<WidthT>::get_attribute_uniform(BatchedShaderGlobals* bsg,
+                                                      ustringhash object,
+                                                      ustringhash name,
+                                                      RefData val)
+{
+    return get_array_attribute_uniform(bsg, object, name, -1, val);
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_userdata(ustringhash name,
+                                             BatchedShaderGlobals* bsg,
+                                             MaskedData val)
+{
+    // Like the scalar SimpleRaytracer, respect s and t userdata, filled in
+    // with the uv coordinates.
+    if ((name == u_s || name == u_t) && Masked<float>::is(val)) {
+        const auto& vsg = bsg->varying;
+        bool is_s       = name == u_s;
+        Masked<float> out(val);
+        for (int i = 0; i < WidthT; ++i)
+            out[i] = is_s ? vsg.u[i] : vsg.v[i];
+        if (val.has_derivs()) {
+            MaskedDx<float> out_dx(val);
+            MaskedDy<float> out_dy(val);
+            for (int i = 0; i < WidthT; ++i) {
+                out_dx[i] = is_s ? vsg.dudx[i] : vsg.dvdx[i];
+                out_dy[i] = is_s ? vsg.dudy[i] : vsg.dvdy[i];
+            }
+        }
+        return val.mask();
+    }
+    return Mask(false);
+}
+
+
+
+// Explicitly instantiate BatchedSimpleRaytracer template
+template class BatchedSimpleRaytracer<16>;
+template class BatchedSimpleRaytracer<8>;
+
+OSL_NAMESPACE_EXIT
@@ -44,7 +44,8 @@ __raygen__setglobals()
     // Set global variables
     OSL::pvt::osl_printf_buffer_start = render_params.osl_printf_buffer_start;
     OSL::pvt::osl_printf_buffer_end   = render_params.osl_printf_buffer_end;
-    OSL::pvt::s_color_system          = render_params.color_system;
+    OSL::pvt::s_color_system          = reinterpret_cast<CUdeviceptr>(
+        render_params.color_system);
     OSL::pvt::test_str_1              = render_params.test_str_1;
     OSL::pvt::test_str_2              = render_params.test_str_2;
 }
@@ -88,8 +89,11 @@ __raygen__()
 // Because clang++ 9.0 seems to have trouble with some of the texturing "intrinsics"
 // let's do the texture look-ups in this file.
 extern "C" __device__ float4
-osl_tex2DLookup(void* handle, float s, float t)
+osl_tex2DLookup(void* handle, float s, float t, float dsdx, float dtdx,
+                float dsdy, float dtdy)
 {
+    // The derivatives pick and blend the MIP levels
     cudaTextureObject_t texID = cudaTextureObject_t(handle);
-    return tex2D<float4>(texID, s, t);
+    return tex2DGrad<float4>(texID, s, t, make_float2(dsdx, dtdx),
+                             make_float2(dsdy, dtdy));
 }
@@ -311,6 +311,54 @@ osl_getchar_isi(const char* str, int index)
 
 
 
+// Reserve record_size bytes of the print buffer.  Rather than each thread
+// contending for the buffer with an atomic of its own, the threads of a
+// warp printing the same format (and so the same size of record) make a
+// single atomicAdd for all of them.  Returns 0 if the buffer is full.
+__device__ static CUdeviceptr
+printf_buffer_alloc(uint64_t fmt_str_hash, uint64_t record_size)
+{
+    // Once the buffer has filled up, this launch prints no more, so don't
+    // keep contending for it.
+    if (*(volatile CUdeviceptr*)&OSL::pvt::osl_printf_buffer_start
+        >= OSL::pvt::osl_printf_buffer_end)
+        return 0;
+
+    unsigned int active = __activemask();
+#if __CUDA_ARCH__ >= 700
+    unsigned int peers = __match_any_sync(active, fmt_str_hash)
+                         & __match_any_sync(active, record_size);
+#else
+    // Without __match_any_sync, share with those printing what the lowest
+    // thread prints, which is all of them in the common case.
+    int first              = __ffs(active) - 1;
+    uint64_t first_hash    = __shfl_sync(active, fmt_str_hash, first);
+    uint64_t first_size    = __shfl_sync(active, record_size, first);
+    unsigned int same      = __ballot_sync(active, fmt_str_hash == first_hash
+                                                  && record_size == first_size);
+    unsigned int lane_mask = 0;
+    asm("mov.u32 %0, %%lanemask_eq;" : "=r"(lane_mask));
+    unsigned int peers = (lane_mask & same) ? same : lane_mask;
+#endif
+    unsigned int lanes_below = 0;
+    asm("mov.u32 %0, %%lanemask_lt;" : "=r"(lanes_below));
+    int leader = __ffs(peers) - 1;
+    int rank   = __popc(peers & lanes_below);
+
+    CUdeviceptr base = 0;
+    if (rank == 0)
+        base = atomicAdd(&OSL::pvt::osl_printf_buffer_start,
+                         __popc(peers) * record_size);
+    base = __shfl_sync(peers, base, leader);
+
+    CUdeviceptr copy_start = base + rank * record_size;
+    if (copy_start + record_size >= OSL::pvt::osl_printf_buffer_end)
+        return 0;
+    return copy_start;
+}
+
+
+
 // Printing is handled by the host.  Copy format string's hash and
 // all the arguments to our print buffer.
 // Note:  the first element of 'args' is the size of the argument list
@@ -323,13 +371,12 @@ osl_printf(void* sg_, char* fmt_str, void* args)
     // This can be used to limit printing to one Cuda thread for debugging
     // if (launch_index.x == 0 && launch_index.y == 0)
 
-    CUdeviceptr copy_start = atomicAdd(&OSL::pvt::osl_printf_buffer_start,
-                                       args_size + sizeof(args_size)
-                                           + sizeof(fmt_str_hash));
+    CUdeviceptr copy_start
+        = printf_buffer_alloc(fmt_str_hash, args_size + sizeof(args_size)
+                                                + sizeof(fmt_str_hash));
 
     // Only perform copy if there's enough space
-    if (copy_start + args_size + sizeof(args_size) + sizeof(fmt_str_hash)
-        < OSL::pvt::osl_printf_buffer_end) {
+    if (copy_start) {
         memcpy(reinterpret_cast<void*>(copy_start), &fmt_str_hash,
                sizeof(fmt_str_hash));
         memcpy(reinterpret_cast<void*>(copy_start + sizeof(fmt_str_hash)),
@@ -342,6 +389,25 @@ osl_printf(void* sg_, char* fmt_str, void* args)
 
 
 
+// Errors and warnings go through the print buffer as well.  Their format
+// strings start with "Shader error" or "Shader warning", from which the
+// host tells them apart (and drops repeats, as the ShadingSystem does).
+__device__ void
+osl_error(void* sg_, char* fmt_str, void* args)
+{
+    osl_printf(sg_, fmt_str, args);
+}
+
+
+
+__device__ void
+osl_warning(void* sg_, char* fmt_str, void* args)
+{
+    osl_printf(sg_, fmt_str, args);
+}
+
+
+
 __device__ void*
 osl_get_noise_options(void* sg_)
 {
@@ -389,7 +455,8 @@ make_float3(const float4& a)
 // optix_raytrace.cu).
 // (clang++ 9.0 error 'undefined __nv_tex_surf_handler')
 extern __device__ float4
-osl_tex2DLookup(void* handle, float s, float t);
+osl_tex2DLookup(void* handle, float s, float t, float dsdx, float dtdx,
+                float dsdy, float dtdy);
 
 __device__ int
 osl_texture(void* sg_, const char* name, void* handle, void* opt_, float s,
@@ -400,7 +467,8 @@ osl_texture(void* sg_, const char* name, void* handle, void* opt_, float s,
     if (!handle)
         return 0;
     // cudaTextureObject_t texID = cudaTextureObject_t(handle);
-    float4 fromTexture = osl_tex2DLookup(handle, s, t);
+    float4 fromTexture = osl_tex2DLookup(handle, s, t, dsdx, dtdx, dsdy,
+                                         dtdy);
     // see note above
     // float4 fromTexture = tex2D<float4>(texID, s, t);
     *((float3*)result) = make_float3(fromTexture.x, fromTexture.y,
@@ -462,8 +530,10 @@ osl_get_matrix(void* sg_, void* r, const char* from)
     // Find the index of the named transform in the transform list
     int match_idx = -1;
     for (size_t idx = 0; idx < OSL::pvt::num_named_xforms; ++idx) {
-        if (HDSTR(from)
-            == HDSTR(((uint64_t*)OSL::pvt::xform_name_buffer)[idx])) {
+        // The names are read-only, so read them through the read-only cache
+        uint64_t name = __ldg(
+            &((const unsigned long long*)OSL::pvt::xform_name_buffer)[idx]);
+        if (HDSTR(from) == HDSTR(name)) {
             match_idx = static_cast<int>(idx);
             break;
         }
@@ -508,7 +578,9 @@ osl_get_inverse_matrix(void* sg_, void* r, const char* to)
     // Find the index of the named transform in the transform list
     int match_idx = -1;
     for (size_t idx = 0; idx < OSL::pvt::num_named_xforms; ++idx) {
-        if (HDSTR(to) == HDSTR(((uint64_t*)OSL::pvt::xform_name_buffer)[idx])) {
+        uint64_t name = __ldg(
+            &((const unsigned long long*)OSL::pvt::xform_name_buffer)[idx]);
+        if (HDSTR(to) == HDSTR(name)) {
             match_idx = static_cast<int>(idx);
             break;
         }
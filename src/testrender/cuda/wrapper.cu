@@ -185,12 +185,21 @@ __closesthit__closest_hit_osl()
     // Run the OSL group and init functions
     const unsigned int shaderInitOpIdx = 2u + 2u * sg.shaderID + 0u;
     const unsigned int shaderGroupIdx  = 2u + 2u * sg.shaderID + 1u;
-    optixDirectCall<void, ShaderGlobals*, void*, void*, void*, int>(
-        shaderInitOpIdx, &sg, params, nullptr, nullptr,
-        0);  // call osl_init_func
-    optixDirectCall<void, ShaderGlobals*, void*, void*, void*, int>(
-        shaderGroupIdx, &sg, params, nullptr, nullptr,
-        0);  // call osl_group_func
+    if (render_params.continuation_callables) {
+        optixContinuationCall<void, ShaderGlobals*, void*, void*, void*, int>(
+            shaderInitOpIdx, &sg, params, nullptr, nullptr,
+            0);  // call osl_init_func
+        optixContinuationCall<void, ShaderGlobals*, void*, void*, void*, int>(
+            shaderGroupIdx, &sg, params, nullptr, nullptr,
+            0);  // call osl_group_func
+    } else {
+        optixDirectCall<void, ShaderGlobals*, void*, void*, void*, int>(
+            shaderInitOpIdx, &sg, params, nullptr, nullptr,
+            0);  // call osl_init_func
+        optixDirectCall<void, ShaderGlobals*, void*, void*, void*, int>(
+            shaderGroupIdx, &sg, params, nullptr, nullptr,
+            0);  // call osl_group_func
+    }
 
     float3 result      = process_closure((OSL::ClosureColor*)sg.Ci);
     uint3 launch_dims  = optixGetLaunchDimensions();
@@ -2,9 +2,12 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <mutex>
 #include <vector>
 
 #include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/parallel.h>
 #include <OpenImageIO/sysutil.h>
 
 #include <OSL/oslconfig.h>
@@ -96,6 +99,10 @@ OptixRaytracer::OptixRaytracer()
 
     OPTIX_CHECK(optixInit());
     OPTIX_CHECK(optixDeviceContextCreate(cuCtx, &ctx_options, &m_optix_ctx));
+    // OptiX keeps the modules it creates in a disk cache of its own, keyed
+    // by their PTX and compile options, unless OPTIX_CACHE_MAXSIZE=0 turns
+    // it off (OPTIX_CACHE_PATH moves it).  With the "jit_cache_dir" option
+    // also caching the groups' PTX, a warm start compiles nothing at all.
 
     CUDA_CHECK(cudaSetDevice(0));
     CUDA_CHECK(cudaStreamCreate(&m_cuda_stream));
@@ -178,6 +185,20 @@ OptixRaytracer::synch_attributes()
     test_str_1 = userdata_str1.hash();
     test_str_2 = userdata_str2.hash();
 
+    // The closest hit program calls each group through the SBT, so the
+    // groups must be callables of one kind or the other.  Linking a group
+    // into a hit program of its own is left to renderers that compile
+    // one per material.
+    std::string entry_points;
+    shadingsys->getattribute("optix_entry_points", entry_points);
+    if (entry_points == "inline") {
+        errhandler().warningfmt(
+            "testrender can't inline groups into its hit programs, calling "
+            "them as direct callables instead");
+        shadingsys->attribute("optix_entry_points", "direct");
+    }
+    m_continuation_callables = (entry_points == "continuation");
+
     {
         char* colorSys            = nullptr;
         long long cpuDataSizes[2] = { 0, 0 };
@@ -198,33 +219,101 @@ OptixRaytracer::synch_attributes()
         const size_t podDataSize = cpuDataSize
                                    - sizeof(StringParam) * numStrings;
 
-        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_color_system),
-                              podDataSize + sizeof(DeviceString) * numStrings));
-        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_color_system), colorSys,
-                              podDataSize, cudaMemcpyHostToDevice));
+        // Keep a copy laid out for the device, with the strings hashed,
+        // to copy into the launch parameters.
+        m_color_system.assign(colorSys, colorSys + podDataSize);
+        const ustring* cpuString = (const ustring*)(colorSys + podDataSize);
+        for (const ustring* end = cpuString + numStrings; cpuString < end;
+             ++cpuString) {
+            // convert the ustring to a device string
+            uint64_t devStr = cpuString->hash();
+            m_color_system.insert(m_color_system.end(), (const char*)&devStr,
+                                  (const char*)&devStr + sizeof(devStr));
+        }
+        if (m_color_system.size() > RENDER_PARAMS_COLOR_SYSTEM_SIZE) {
+            errhandler().errorfmt(
+                "The colorsystem ({} bytes) doesn't fit in RenderParams",
+                m_color_system.size());
+            return false;
+        }
 
         CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_osl_printf_buffer),
                               OSL_PRINTF_BUFFER_SIZE));
         CUDA_CHECK(cudaMemset(reinterpret_cast<void*>(d_osl_printf_buffer), 0,
                               OSL_PRINTF_BUFFER_SIZE));
+    }
+    return true;
+}
 
-        // then copy the device string to the end, first strings starting at dataPtr - (numStrings)
-        // FIXME -- Should probably handle alignment better.
-        const ustring* cpuString
-            = (const ustring*)(colorSys
-                               + (cpuDataSize
-                                  - sizeof(StringParam) * numStrings));
-        CUdeviceptr gpuStrings = d_color_system + podDataSize;
-        for (const ustring* end = cpuString + numStrings; cpuString < end;
-             ++cpuString) {
-            // convert the ustring to a device string
-            uint64_t devStr = cpuString->hash();
-            CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(gpuStrings), &devStr,
-                                  sizeof(devStr), cudaMemcpyHostToDevice));
-            gpuStrings += sizeof(DeviceString);
+
+
+// Create an OptiX module from each of the PTX strings.  With the task API,
+// the compile of every module is split into tasks, and the tasks of all
+// the modules (with the subtasks they spawn) run across the cores of the
+// thread pool, rather than one module being compiled after another.
+static std::vector<OptixModule>
+create_optix_modules(OptixDeviceContext optix_ctx,
+                     const OptixModuleCompileOptions* module_options,
+                     const OptixPipelineCompileOptions* pipeline_options,
+                     const std::vector<std::string>& ptx,
+                     const std::vector<std::string>& names)
+{
+    std::vector<OptixModule> modules(ptx.size());
+    char msg_log[8192];
+    size_t sizeof_msg_log;
+#if OPTIX_VERSION >= 70400
+    std::vector<OptixTask> tasks(ptx.size());
+    for (size_t i = 0; i < ptx.size(); ++i) {
+        sizeof_msg_log = sizeof(msg_log);
+        OPTIX_CHECK_MSG(optixModuleCreateFromPTXWithTasks(
+                            optix_ctx, module_options, pipeline_options,
+                            ptx[i].c_str(), ptx[i].size(), msg_log,
+                            &sizeof_msg_log, &modules[i], &tasks[i]),
+                        fmtformat("Creating module for PTX group {}: {}",
+                                  names[i], msg_log));
+    }
+
+    // A task's subtasks may only run once it has, so run the tasks a
+    // generation at a time, each generation in parallel.
+    const unsigned int max_subtasks = std::max(
+        OIIO::Sysutil::hardware_concurrency(), 1u);
+    std::mutex spawned_mutex;
+    while (!tasks.empty()) {
+        std::vector<OptixTask> spawned;
+        OIIO::parallel_for(size_t(0), tasks.size(), [&](size_t t) {
+            std::vector<OptixTask> subtasks(max_subtasks);
+            unsigned int nsubtasks = 0;
+            OPTIX_CHECK(optixTaskExecute(tasks[t], subtasks.data(),
+                                         max_subtasks, &nsubtasks));
+            std::lock_guard<std::mutex> lock(spawned_mutex);
+            spawned.insert(spawned.end(), subtasks.begin(),
+                           subtasks.begin() + nsubtasks);
+        });
+        tasks.swap(spawned);
+    }
+
+    for (size_t i = 0; i < modules.size(); ++i) {
+        OptixModuleCompileState state;
+        OPTIX_CHECK(optixModuleGetCompilationState(modules[i], &state));
+        if (state != OPTIX_MODULE_COMPILE_STATE_COMPLETED) {
+            print(stderr, "[OPTIX ERROR] Compiling module for PTX group {}"
+                  " failed\n", names[i]);
+            exit(1);
         }
     }
-    return true;
+#else
+    for (size_t i = 0; i < ptx.size(); ++i) {
+        sizeof_msg_log = sizeof(msg_log);
+        OPTIX_CHECK_MSG(optixModuleCreateFromPTX(optix_ctx, module_options,
+                                                 pipeline_options,
+                                                 ptx[i].c_str(), ptx[i].size(),
+                                                 msg_log, &sizeof_msg_log,
+                                                 &modules[i]),
+                        fmtformat("Creating module for PTX group {}: {}",
+                                  names[i], msg_log));
+    }
+#endif
+    return modules;
 }
 
 
@@ -447,19 +536,19 @@ OptixRaytracer::make_optix_materials()
     create_optix_pg(&sphere_fillSG_desc, 1, &program_options,
                     &sphere_fillSG_dc);
 
-    // Create materials
-    int mtl_id = 0;
-    for (const auto& groupref : shaders()) {
-        std::string group_name, init_name, entry_name;
-        shadingsys->getattribute(groupref.get(), "groupname", group_name);
-        shadingsys->getattribute(groupref.get(), "group_init_name", init_name);
-        shadingsys->getattribute(groupref.get(), "group_entry_name",
-                                 entry_name);
-
+    // Optimize all the groups, generating their PTX, in parallel
+    for (const auto& groupref : shaders())
         shadingsys->attribute(groupref.get(), "renderer_outputs",
                               TypeDesc(TypeDesc::STRING, outputs.size()),
                               outputs.data());
-        shadingsys->optimize_group(groupref.get(), nullptr);
+    shadingsys->optimize_all_groups();
+
+    // Retrieve the compiled ShaderGroup PTX
+    int mtl_id = 0;
+    std::vector<std::string> group_ptx, group_names;
+    for (const auto& groupref : shaders()) {
+        std::string group_name;
+        shadingsys->getattribute(groupref.get(), "groupname", group_name);
 
         if (!shadingsys->find_symbol(*groupref.get(), ustring(outputs[0]))) {
             // FIXME: This is for cases where testshade is run with 1x1 resolution
@@ -470,7 +559,6 @@ OptixRaytracer::make_optix_materials()
             }
         }
 
-        // Retrieve the compiled ShaderGroup PTX
         std::string osl_ptx;
         shadingsys->getattribute(groupref.get(), "ptx_compiled_version",
                                  OSL::TypeDesc::PTR, &osl_ptx);
@@ -486,33 +574,41 @@ OptixRaytracer::make_optix_materials()
             OIIO::Filesystem::write_text_file(filename, osl_ptx);
         }
 
-        OptixModule optix_module;
+        group_ptx.push_back(std::move(osl_ptx));
+        group_names.push_back(std::move(group_name));
+    }
+    std::vector<OptixModule> group_modules
+        = create_optix_modules(m_optix_ctx, &module_compile_options,
+                               &pipeline_compile_options, group_ptx,
+                               group_names);
 
-        // Create Programs from the init and group_entry functions,
-        // and set the OSL functions as Callable Programs so that they
-        // can be executed by the closest hit program in the wrapper
-        sizeof_msg_log = sizeof(msg_log);
-        OPTIX_CHECK_MSG(
-            optixModuleCreateFromPTX(m_optix_ctx, &module_compile_options,
-                                     &pipeline_compile_options, osl_ptx.c_str(),
-                                     osl_ptx.size(), msg_log, &sizeof_msg_log,
-                                     &optix_module),
-            fmtformat("Creating module for PTX group {}: {}", group_name,
-                      msg_log));
+    // Create materials
+    for (size_t g = 0; g < group_modules.size(); ++g) {
+        const auto& groupref          = shaders()[g];
+        const std::string& group_name = group_names[g];
+        OptixModule optix_module      = group_modules[g];
+        std::string init_name, entry_name;
+        shadingsys->getattribute(groupref.get(), "group_init_name", init_name);
+        shadingsys->getattribute(groupref.get(), "group_entry_name",
+                                 entry_name);
         modules.push_back(optix_module);
 
-        // Create 2x program groups (for direct callables)
+        // Create 2x program groups (for direct or continuation callables)
+        // from the init and group_entry functions, so that they can be
+        // executed by the closest hit program in the wrapper
         OptixProgramGroupDesc pgDesc[2] = {};
-        pgDesc[0].kind                  = OPTIX_PROGRAM_GROUP_KIND_CALLABLES;
-        pgDesc[0].callables.moduleDC    = optix_module;
-        pgDesc[0].callables.entryFunctionNameDC = init_name.c_str();
-        pgDesc[0].callables.moduleCC            = 0;
-        pgDesc[0].callables.entryFunctionNameCC = nullptr;
-        pgDesc[1].kind               = OPTIX_PROGRAM_GROUP_KIND_CALLABLES;
-        pgDesc[1].callables.moduleDC = optix_module;
-        pgDesc[1].callables.entryFunctionNameDC = entry_name.c_str();
-        pgDesc[1].callables.moduleCC            = 0;
-        pgDesc[1].callables.entryFunctionNameCC = nullptr;
+        const char* names[2]            = { init_name.c_str(),
+                                            entry_name.c_str() };
+        for (int i = 0; i < 2; ++i) {
+            pgDesc[i].kind = OPTIX_PROGRAM_GROUP_KIND_CALLABLES;
+            if (m_continuation_callables) {
+                pgDesc[i].callables.moduleCC            = optix_module;
+                pgDesc[i].callables.entryFunctionNameCC = names[i];
+            } else {
+                pgDesc[i].callables.moduleDC            = optix_module;
+                pgDesc[i].callables.entryFunctionNameDC = names[i];
+            }
+        }
 
         shader_groups.resize(shader_groups.size() + 2);
         sizeof_msg_log = sizeof(msg_log);
@@ -697,6 +793,11 @@ OptixRaytracer::make_optix_materials()
 bool
 OptixRaytracer::finalize_scene()
 {
+    if (scene.triangles.size())
+        errhandler().warningfmt("Triangles are not supported with OptiX, "
+                                "ignoring {} of them",
+                                scene.triangles.size());
+
     // Build acceleration structures
     OptixAccelBuildOptions accelOptions;
     OptixBuildInput buildInputs[2];
@@ -868,6 +969,64 @@ OptixRaytracer::finalize_scene()
 
 
 
+// The MIP levels of the texture in image, 4 float channels per texel, down
+// to 1x1 as CUDA mipmapped arrays have them.  Levels the file has (e.g.
+// made by maketx) are read if they're the expected size; the others are
+// box filtered down from the level above.
+static std::vector<std::vector<float>>
+texture_mip_levels(OIIO::ImageBuf& image, int& width, int& height)
+{
+    OIIO::ROI roi = OIIO::get_roi_full(image.spec());
+    width         = roi.width();
+    height        = roi.height();
+    std::vector<std::vector<float>> levels;
+    for (int m = 0, w = width, h = height;; ++m) {
+        std::vector<float> pixels(size_t(w) * h * 4, 0.0f);
+        OIIO::ImageBuf file_level;
+        OIIO::ImageBuf* level = m == 0 ? &image : nullptr;
+        if (m && m < image.nmiplevels()
+            && file_level.init_spec(image.name(), 0, m)
+            && file_level.spec().full_width == w
+            && file_level.spec().full_height == h)
+            level = &file_level;
+        if (level) {
+            OIIO::ROI lroi = OIIO::get_roi_full(level->spec());
+            for (int j = 0; j < h; j++)
+                for (int i = 0; i < w; i++)
+                    level->getpixel(lroi.xbegin + i, lroi.ybegin + j, 0,
+                                    &pixels[(size_t(j) * w + i) * 4], 4);
+        } else {
+            // Average the 2x2 texels above, or fewer at an odd edge
+            const std::vector<float>& above(levels.back());
+            int aw = std::max(width >> (m - 1), 1);
+            int ah = std::max(height >> (m - 1), 1);
+            for (int j = 0; j < h; j++) {
+                for (int i = 0; i < w; i++) {
+                    float* out = &pixels[(size_t(j) * w + i) * 4];
+                    int n      = 0;
+                    for (int y = 2 * j; y < std::min(2 * j + 2, ah); y++)
+                        for (int x = 2 * i; x < std::min(2 * i + 2, aw); x++) {
+                            const float* in = &above[(size_t(y) * aw + x) * 4];
+                            for (int c = 0; c < 4; c++)
+                                out[c] += in[c];
+                            ++n;
+                        }
+                    for (int c = 0; c < 4; c++)
+                        out[c] /= float(n);
+                }
+            }
+        }
+        levels.push_back(std::move(pixels));
+        if (w == 1 && h == 1)
+            break;
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+    }
+    return levels;
+}
+
+
+
 /// Return true if the texture handle (previously returned by
 /// get_texture_handle()) is a valid texture that can be subsequently
 /// read or sampled.
@@ -896,30 +1055,33 @@ OptixRaytracer::get_texture_handle(ustringhash filename,
             return (TextureHandle*)nullptr;
         }
 
-        OIIO::ROI roi = OIIO::get_roi_full(image.spec());
-        int32_t width = roi.width(), height = roi.height();
-        std::vector<float> pixels(width * height * 4);
-
-        for (int j = 0; j < height; j++) {
-            for (int i = 0; i < width; i++) {
-                image.getpixel(i, j, 0, &pixels[((j * width) + i) * 4 + 0]);
-            }
-        }
-        cudaResourceDesc res_desc = {};
+        int width, height;
+        std::vector<std::vector<float>> levels
+            = texture_mip_levels(image, width, height);
+        int nlevels = int(levels.size());
 
         // hard-code textures to 4 channels
-        int32_t pitch = width * 4 * sizeof(float);
         cudaChannelFormatDesc channel_desc
             = cudaCreateChannelDesc(32, 32, 32, 32, cudaChannelFormatKindFloat);
 
-        cudaArray_t pixelArray;
-        CUDA_CHECK(cudaMallocArray(&pixelArray, &channel_desc, width, height));
-
-        CUDA_CHECK(cudaMemcpy2DToArray(pixelArray, 0, 0, pixels.data(), pitch,
-                                       pitch, height, cudaMemcpyHostToDevice));
+        cudaMipmappedArray_t mipmapped;
+        CUDA_CHECK(cudaMallocMipmappedArray(&mipmapped, &channel_desc,
+                                            make_cudaExtent(width, height, 0),
+                                            nlevels));
+        for (int m = 0; m < nlevels; ++m) {
+            int w        = std::max(width >> m, 1);
+            int h        = std::max(height >> m, 1);
+            size_t pitch = size_t(w) * 4 * sizeof(float);
+            cudaArray_t level;
+            CUDA_CHECK(cudaGetMipmappedArrayLevel(&level, mipmapped, m));
+            CUDA_CHECK(cudaMemcpy2DToArray(level, /* offset */ 0, 0,
+                                           levels[m].data(), pitch, pitch, h,
+                                           cudaMemcpyHostToDevice));
+        }
 
-        res_desc.resType         = cudaResourceTypeArray;
-        res_desc.res.array.array = pixelArray;
+        cudaResourceDesc res_desc  = {};
+        res_desc.resType           = cudaResourceTypeMipmappedArray;
+        res_desc.res.mipmap.mipmap = mipmapped;
 
         cudaTextureDesc tex_desc = {};
         tex_desc.addressMode[0]  = cudaAddressModeWrap;
@@ -929,9 +1091,9 @@ OptixRaytracer::get_texture_handle(ustringhash filename,
             = cudaReadModeElementType;  //cudaReadModeNormalizedFloat;
         tex_desc.normalizedCoords    = 1;
         tex_desc.maxAnisotropy       = 1;
-        tex_desc.maxMipmapLevelClamp = 99;
+        tex_desc.maxMipmapLevelClamp = float(nlevels - 1);
         tex_desc.minMipmapLevelClamp = 0;
-        tex_desc.mipmapFilterMode    = cudaFilterModePoint;
+        tex_desc.mipmapFilterMode    = cudaFilterModeLinear;
         tex_desc.borderColor[0]      = 1.0f;
         tex_desc.sRGB                = 0;
 
@@ -999,10 +1161,12 @@ OptixRaytracer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
     params.traversal_handle        = m_travHandle;
     params.osl_printf_buffer_start = d_osl_printf_buffer;
     // maybe send buffer size to CUDA instead of the buffer 'end'
-    params.osl_printf_buffer_end = d_osl_printf_buffer + OSL_PRINTF_BUFFER_SIZE;
-    params.color_system          = d_color_system;
-    params.test_str_1            = test_str_1;
-    params.test_str_2            = test_str_2;
+    params.osl_printf_buffer_end  = d_osl_printf_buffer
+                                   + OSL_PRINTF_BUFFER_SIZE;
+    params.test_str_1             = test_str_1;
+    params.test_str_2             = test_str_2;
+    params.continuation_callables = m_continuation_callables;
+    memcpy(params.color_system, m_color_system.data(), m_color_system.size());
 
     CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_launch_params), &params,
                           sizeof(RenderParams), cudaMemcpyHostToDevice));
@@ -1035,6 +1199,8 @@ void
 OptixRaytracer::processPrintfBuffer(void* buffer_data, size_t buffer_size)
 {
     const uint8_t* ptr = reinterpret_cast<uint8_t*>(buffer_data);
+    int error_repeats  = 0;
+    shadingsys->getattribute("error_repeats", error_repeats);
     // process until
     std::string fmt_string;
     size_t total_read = 0;
@@ -1129,6 +1295,19 @@ OptixRaytracer::processPrintfBuffer(void* buffer_data, size_t buffer_size)
         total_read += next_args;
 
         buffer[dst++] = '\0';
+        // Like the ShadingSystem, don't repeat a recent error or warning
+        // unless "error_repeats" asks for it.
+        string_view msg(buffer);
+        if (OIIO::Strutil::starts_with(msg, "Shader error")
+            || OIIO::Strutil::starts_with(msg, "Shader warning")) {
+            bool seen = std::find(m_errseen.begin(), m_errseen.end(), msg)
+                        != m_errseen.end();
+            if (seen && !error_repeats)
+                continue;
+            if (m_errseen.size() >= 32)
+                m_errseen.pop_front();
+            m_errseen.emplace_back(msg);
+        }
         printf("%s", buffer);
     }
 }
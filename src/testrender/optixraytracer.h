@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <list>
+#include <string>
+
 #include <OpenImageIO/ustring.h>
 
 #include <OSL/oslexec.h>
@@ -79,7 +82,9 @@ private:
     CUdeviceptr d_spheres_list  = 0;
     int m_xres, m_yres;
     CUdeviceptr d_osl_printf_buffer;
-    CUdeviceptr d_color_system;
+    std::list<std::string> m_errseen;  ///< Recent errors & warnings printed
+    std::vector<char> m_color_system;  ///< ColorSystem, as on the device
+    bool m_continuation_callables = false;  ///< Groups as continuation CCs
     uint64_t test_str_1;
     uint64_t test_str_2;
     const unsigned long OSL_PRINTF_BUFFER_SIZE = 8 * 1024 * 1024;
@@ -5,9 +5,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <numeric>
 #include <vector>
 
 #include <OpenImageIO/fmath.h>
+#include <OpenImageIO/simd.h>
 
 #include "optix_compat.h"
 #include "render_params.h"
@@ -399,96 +402,397 @@ private:
 
 
 
+// Note: Triangles are only supported for CPU rendering so far.
+struct Triangle final : public Primitive {
+    Triangle(const Vec3& p0, const Vec3& p1, const Vec3& p2, int shaderID,
+             bool isLight)
+        : Primitive(shaderID, isLight), p(p0), e1(p1 - p0), e2(p2 - p0)
+    {
+        n           = e1.cross(e2);
+        a           = 0.5f * n.length();
+        n           = n.normalize();
+        float d00   = e1.length2();
+        float d01   = e1.dot(e2);
+        float d11   = e2.length2();
+        float denom = d00 * d11 - d01 * d01;
+        // Dual basis of (e1, e2), to get barycentrics with two dots
+        b1 = denom != 0 ? (e1 * d11 - e2 * d01) / denom : Vec3(0, 0, 0);
+        b2 = denom != 0 ? (e2 * d00 - e1 * d01) / denom : Vec3(0, 0, 0);
+    }
+
+    void getBounds(float& minx, float& miny, float& minz, float& maxx,
+                   float& maxy, float& maxz) const
+    {
+        const Vec3 p0 = p;
+        const Vec3 p1 = p + e1;
+        const Vec3 p2 = p + e2;
+        minx          = std::min(p0.x, std::min(p1.x, p2.x));
+        miny          = std::min(p0.y, std::min(p1.y, p2.y));
+        minz          = std::min(p0.z, std::min(p1.z, p2.z));
+        maxx          = std::max(p0.x, std::max(p1.x, p2.x));
+        maxy          = std::max(p0.y, std::max(p1.y, p2.y));
+        maxz          = std::max(p0.z, std::max(p1.z, p2.z));
+    }
+
+    // returns distance to nearest hit or 0
+    Dual2<float> intersect(const Ray& r, bool self) const
+    {
+        if (self)
+            return 0;
+        Dual2<float> dn = dot(r.direction, n);
+        Dual2<float> en = dot(p - r.origin, n);
+        if (dn.val() * en.val() > 0) {
+            Dual2<float> t = en / dn;
+            Vec3 h         = r.point(t.val()) - p;
+            float u        = h.dot(b1);
+            float v        = h.dot(b2);
+            if (u >= 0 && v >= 0 && u + v <= 1)
+                return t;
+        }
+        return 0;  // no hit
+    }
+
+    float surfacearea() const { return a; }
+
+    Dual2<Vec3> normal(const Dual2<Vec3>& /*p*/) const
+    {
+        return Dual2<Vec3>(n, Vec3(0, 0, 0), Vec3(0, 0, 0));
+    }
+
+    // u and v are the barycentric weights of the second and third corner
+    Dual2<Vec2> uv(const Dual2<Vec3>& p, const Dual2<Vec3>& /*n*/, Vec3& dPdu,
+                   Vec3& dPdv) const
+    {
+        Dual2<Vec3> h  = p - this->p;
+        Dual2<float> u = dot(h, b1);
+        Dual2<float> v = dot(h, b2);
+        dPdu           = e1;
+        dPdv           = e2;
+        return make_Vec2(u, v);
+    }
+
+    // return a direction towards a point on the triangle
+    Vec3 sample(const Vec3& x, float xi, float yi, float& pdf) const
+    {
+        float su = sqrtf(xi);
+        Vec3 l   = (p + e1 * (su * (1 - yi)) + e2 * (su * yi)) - x;
+        float d2 = l.length2();
+        Vec3 dir = l.normalize();
+        pdf      = d2 / (a * fabsf(dir.dot(n)));
+        return dir;
+    }
+
+    float shapepdf(const Vec3& x, const Vec3& p) const
+    {
+        Vec3 l   = p - x;
+        float d2 = l.length2();
+        Vec3 dir = l.normalize();
+        return d2 / (a * fabsf(dir.dot(n)));
+    }
+
+#if OSL_USE_OPTIX
+    virtual void setOptixVariables(void* /*data*/) const {}
+#endif
+
+private:
+    Vec3 p, e1, e2, n, b1, b2;
+    float a;
+};
+
+
+
+// A node of the Scene's bounding volume hierarchy. Interior nodes have
+// their first child right after them and the second at index first;
+// leaves list count primitives starting at bvh_prims[first].
+struct BVHNode {
+    float lo[4], hi[4];  // bounds (the 4th lane is padding, for SIMD)
+    int first;
+    int count;  // 0 for an interior node
+    int axis;   // the axis an interior node was split along
+};
+
+
+
 struct Scene {
     void add_sphere(const Sphere& s) { spheres.push_back(s); }
 
     void add_quad(const Quad& q) { quads.push_back(q); }
 
-    int num_prims() const { return spheres.size() + quads.size(); }
+    void add_triangle(const Triangle& t) { triangles.push_back(t); }
+
+    int num_prims() const
+    {
+        return spheres.size() + quads.size() + triangles.size();
+    }
+
+    // Call f with the primitive primID refers to: the spheres come first,
+    // then the quads, then the triangles.
+    template<typename F> auto visit(int primID, F f) const
+    {
+        if (primID < int(spheres.size()))
+            return f(spheres[primID]);
+        primID -= spheres.size();
+        if (primID < int(quads.size()))
+            return f(quads[primID]);
+        primID -= quads.size();
+        return f(triangles[primID]);
+    }
+
+    // Build the acceleration structure and the list of lights, once all
+    // the primitives have been added.
+    void prepare()
+    {
+        const int n = num_prims();
+        lights.clear();
+        for (int i = 0; i < n; ++i)
+            if (islight(i))
+                lights.push_back(i);
+
+        std::vector<Box> boxes(n);
+        for (int i = 0; i < n; ++i)
+            visit(i, [&](const auto& prim) {
+                Box& b = boxes[i];
+                prim.getBounds(b.lo.x, b.lo.y, b.lo.z, b.hi.x, b.hi.y, b.hi.z);
+                return 0;
+            });
+        bvh_prims.resize(n);
+        std::iota(bvh_prims.begin(), bvh_prims.end(), 0);
+        bvh_nodes.clear();
+        bvh_nodes.reserve(2 * n);
+        if (n)
+            build_bvh(boxes, 0, n, 0);
+    }
 
     bool intersect(const Ray& r, Dual2<float>& t, int& primID) const
     {
-        const int ns   = spheres.size();
-        const int nq   = quads.size();
+        using OIIO::simd::vfloat4;
         const int self = primID;  // remember which object we started from
         t              = std::numeric_limits<float>::infinity();
         primID         = -1;  // reset ID
-        for (int i = 0; i < ns; i++) {
-            Dual2<float> d = spheres[i].intersect(r, self == i);
-            if (d.val() > 0 && d.val() < t.val()) {  // found valid hit?
-                t      = d;
-                primID = i;
-            }
-        }
-        for (int i = 0; i < nq; i++) {
-            Dual2<float> d = quads[i].intersect(r, self == (i + ns));
-            if (d.val() > 0 && d.val() < t.val()) {  // found valid hit?
-                t      = d;
-                primID = i + ns;
+        if (bvh_nodes.empty())
+            return false;
+        auto inverse = [](float d) {
+            return fabsf(d) > 1e-20f ? 1 / d : (d < 0 ? -1e20f : 1e20f);
+        };
+        const vfloat4 org(r.origin.x, r.origin.y, r.origin.z, 0.0f);
+        const vfloat4 inv(inverse(r.direction.x), inverse(r.direction.y),
+                          inverse(r.direction.z), 1.0f);
+        const float* dir = &r.direction.x;
+        int stack[max_bvh_depth + 1];
+        int top  = 0;
+        int node = 0;
+        for (;;) {
+            const BVHNode& nd = bvh_nodes[node];
+            // Slab test of all three axes at once
+            vfloat4 t0    = (vfloat4(nd.lo) - org) * inv;
+            vfloat4 t1    = (vfloat4(nd.hi) - org) * inv;
+            vfloat4 tnear = OIIO::simd::min(t0, t1);
+            vfloat4 tfar  = OIIO::simd::max(t0, t1);
+            float enter   = std::max(std::max(tnear[0], tnear[1]),
+                                     std::max(tnear[2], 0.0f));
+            float leave   = std::min(std::min(tfar[0], tfar[1]),
+                                     std::min(tfar[2], t.val()));
+            if (enter <= leave) {
+                if (nd.count) {
+                    for (int i = nd.first, e = nd.first + nd.count; i < e;
+                         ++i) {
+                        int id         = bvh_prims[i];
+                        Dual2<float> d = visit(id, [&](const auto& prim) {
+                            return prim.intersect(r, self == id);
+                        });
+                        if (d.val() > 0 && d.val() < t.val()) {  // valid hit?
+                            t      = d;
+                            primID = id;
+                        }
+                    }
+                } else {
+                    // Visit the nearer child first
+                    if (dir[nd.axis] < 0) {
+                        stack[top++] = node + 1;
+                        node         = nd.first;
+                    } else {
+                        stack[top++] = nd.first;
+                        node         = node + 1;
+                    }
+                    continue;
+                }
             }
+            if (!top)
+                break;
+            node = stack[--top];
         }
         return primID >= 0;
     }
 
     Vec3 sample(int primID, const Vec3& x, float xi, float yi, float& pdf) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].sample(x, xi, yi, pdf);
-        primID -= spheres.size();
-        return quads[primID].sample(x, xi, yi, pdf);
+        return visit(primID, [&](const auto& prim) {
+            return prim.sample(x, xi, yi, pdf);
+        });
     }
 
     float shapepdf(int primID, const Vec3& x, const Vec3& p) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].shapepdf(x, p);
-        primID -= spheres.size();
-        return quads[primID].shapepdf(x, p);
+        return visit(primID,
+                     [&](const auto& prim) { return prim.shapepdf(x, p); });
     }
 
     float surfacearea(int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].surfacearea();
-        primID -= spheres.size();
-        return quads[primID].surfacearea();
+        return visit(primID,
+                     [&](const auto& prim) { return prim.surfacearea(); });
     }
 
     Dual2<Vec3> normal(const Dual2<Vec3>& p, int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].normal(p);
-        primID -= spheres.size();
-        return quads[primID].normal(p);
+        return visit(primID, [&](const auto& prim) { return prim.normal(p); });
     }
 
     Dual2<Vec2> uv(const Dual2<Vec3>& p, const Dual2<Vec3>& n, Vec3& dPdu,
                    Vec3& dPdv, int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].uv(p, n, dPdu, dPdv);
-        primID -= spheres.size();
-        return quads[primID].uv(p, n, dPdu, dPdv);
+        return visit(primID, [&](const auto& prim) {
+            return prim.uv(p, n, dPdu, dPdv);
+        });
     }
 
     int shaderid(int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].shaderid();
-        primID -= spheres.size();
-        return quads[primID].shaderid();
+        return visit(primID, [&](const auto& prim) { return prim.shaderid(); });
     }
 
     bool islight(int primID) const
     {
-        if (primID < int(spheres.size()))
-            return spheres[primID].islight();
-        primID -= spheres.size();
-        return quads[primID].islight();
+        return visit(primID, [&](const auto& prim) { return prim.islight(); });
     }
 
     std::vector<Sphere> spheres;
     std::vector<Quad> quads;
+    std::vector<Triangle> triangles;
+    std::vector<int> lights;  // the primitives that are lights
+
+private:
+    struct Box {
+        Vec3 lo { std::numeric_limits<float>::max(),
+                  std::numeric_limits<float>::max(),
+                  std::numeric_limits<float>::max() };
+        Vec3 hi { -std::numeric_limits<float>::max(),
+                  -std::numeric_limits<float>::max(),
+                  -std::numeric_limits<float>::max() };
+        void grow(const Vec3& p)
+        {
+            lo = Vec3(std::min(lo.x, p.x), std::min(lo.y, p.y),
+                      std::min(lo.z, p.z));
+            hi = Vec3(std::max(hi.x, p.x), std::max(hi.y, p.y),
+                      std::max(hi.z, p.z));
+        }
+        void grow(const Box& b)
+        {
+            grow(b.lo);
+            grow(b.hi);
+        }
+        Vec3 center() const { return (lo + hi) * 0.5f; }
+        float area() const
+        {
+            Vec3 d = hi - lo;
+            return d.x < 0 ? 0 : d.x * d.y + d.y * d.z + d.z * d.x;
+        }
+    };
+
+    static constexpr int max_bvh_depth = 64;
+
+    // Build the subtree over bvh_prims[begin,end), splitting wherever the
+    // surface area heuristic says is cheapest, among 16 bins per node.
+    void build_bvh(const std::vector<Box>& boxes, int begin, int end,
+                   int depth)
+    {
+        constexpr int nbins = 16;
+        const int index     = int(bvh_nodes.size());
+        bvh_nodes.emplace_back();
+        Box bounds, centers;
+        for (int i = begin; i < end; ++i) {
+            bounds.grow(boxes[bvh_prims[i]]);
+            centers.grow(boxes[bvh_prims[i]].center());
+        }
+        auto make_leaf = [&]() {
+            BVHNode& node = bvh_nodes[index];
+            node.first    = begin;
+            node.count    = end - begin;
+            node.axis     = 0;
+        };
+        for (int a = 0; a < 3; ++a) {
+            bvh_nodes[index].lo[a] = bounds.lo[a];
+            bvh_nodes[index].hi[a] = bounds.hi[a];
+        }
+        bvh_nodes[index].lo[3] = bvh_nodes[index].hi[3] = 0.0f;
+
+        const int n = end - begin;
+        Vec3 extent = centers.hi - centers.lo;
+        int axis    = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                          : (extent.y > extent.z ? 1 : 2);
+        if (n <= 2 || extent[axis] <= 0 || depth >= max_bvh_depth) {
+            make_leaf();
+            return;
+        }
+
+        // Bin the primitives by their centers along the widest axis
+        auto bin_of = [&](int prim) {
+            float c = boxes[prim].center()[axis];
+            int b   = int(nbins * (c - centers.lo[axis]) / extent[axis]);
+            return std::min(b, nbins - 1);
+        };
+        Box bin_bounds[nbins];
+        int bin_count[nbins] = {};
+        for (int i = begin; i < end; ++i) {
+            int b = bin_of(bvh_prims[i]);
+            bin_bounds[b].grow(boxes[bvh_prims[i]]);
+            ++bin_count[b];
+        }
+        // Cost of splitting after each bin: the sum over both sides of
+        // their area times their primitive count
+        float cost[nbins - 1];
+        Box left;
+        int nleft = 0;
+        for (int b = 0; b < nbins - 1; ++b) {
+            left.grow(bin_bounds[b]);
+            nleft += bin_count[b];
+            cost[b] = left.area() * nleft;
+        }
+        Box right;
+        int nright = 0;
+        for (int b = nbins - 1; b > 0; --b) {
+            right.grow(bin_bounds[b]);
+            nright += bin_count[b];
+            cost[b - 1] += right.area() * nright;
+        }
+        int best = int(std::min_element(cost, cost + nbins - 1) - cost);
+        // Against one more box test (costed like a primitive), is
+        // splitting cheaper than testing all of them?
+        if (n <= 8 && 1 + cost[best] / bounds.area() >= n) {
+            make_leaf();
+            return;
+        }
+
+        int* mid = std::partition(&bvh_prims[begin], &bvh_prims[begin] + n,
+                                  [&](int prim) {
+                                      return bin_of(prim) <= best;
+                                  });
+        int split = begin + int(mid - &bvh_prims[begin]);
+        if (split == begin || split == end) {
+            make_leaf();
+            return;
+        }
+        build_bvh(boxes, begin, split, depth + 1);
+        int second = int(bvh_nodes.size());
+        build_bvh(boxes, split, end, depth + 1);
+        BVHNode& node = bvh_nodes[index];
+        node.first    = second;
+        node.count    = 0;
+        node.axis     = axis;
+    }
+
+    std::vector<BVHNode> bvh_nodes;
+    std::vector<int> bvh_prims;
 };
 
 OSL_NAMESPACE_EXIT
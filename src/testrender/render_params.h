@@ -5,6 +5,9 @@
 
 #if OSL_USE_OPTIX || defined(__CUDA_ARCH__)
 
+// Room for the ShadingSystem's pvt::ColorSystem in RenderParams
+#define RENDER_PARAMS_COLOR_SYSTEM_SIZE 4096
+
 struct RenderParams {
     float3 bad_color;
     float3 bg_color;
@@ -17,11 +20,13 @@ struct RenderParams {
     float invw;
     float invh;
 
+    // Are the groups continuation rather than direct callables?
+    int continuation_callables;
+
     CUdeviceptr traversal_handle;
     CUdeviceptr output_buffer;
     CUdeviceptr osl_printf_buffer_start;
     CUdeviceptr osl_printf_buffer_end;
-    CUdeviceptr color_system;
 
     // for transforms
     CUdeviceptr object2common;
@@ -33,6 +38,11 @@ struct RenderParams {
     // for used-data tests
     uint64_t test_str_1;
     uint64_t test_str_2;
+
+    // The ColorSystem, in the launch parameters so that OptiX keeps it in
+    // constant memory with the rest, rather than in a global memory buffer
+    // that every color op would have to read.
+    alignas(16) char color_system[RENDER_PARAMS_COLOR_SYSTEM_SIZE];
 };
 
 
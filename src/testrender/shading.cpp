@@ -1437,47 +1437,36 @@ evaluate_layer_opacity(const OSL::ShaderGlobals& sg,
 
 void
 process_medium_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
-                       const ClosureColor* closure, const Color3& w)
+                       const ClosureColor* closure, const Color3& w);
+
+// set up the medium of one primitive closure component
+void
+process_medium_component(const OSL::ShaderGlobals& sg, ShadingResult& result,
+                         const ClosureFlatComponent& comp)
 {
-    if (!closure)
-        return;
-    switch (closure->id) {
-    case ClosureColor::MUL: {
-        process_medium_closure(sg, result, closure->as_mul()->closure,
-                               w * closure->as_mul()->weight);
-        break;
-    }
-    case ClosureColor::ADD: {
-        process_medium_closure(sg, result, closure->as_add()->closureA, w);
-        process_medium_closure(sg, result, closure->as_add()->closureB, w);
-        break;
-    }
+    const Color3& cw = comp.weight;
+    switch (comp.id) {
     case MX_LAYER_ID: {
-        const ClosureComponent* comp = closure->as_comp();
-        const MxLayerParams* params  = comp->as<MxLayerParams>();
+        const MxLayerParams* params = comp.as<MxLayerParams>();
         Color3 base_w
-            = w
+            = cw
               * (Color3(1)
                  - clamp(evaluate_layer_opacity(sg, params->top), 0.f, 1.f));
-        process_medium_closure(sg, result, params->top, w);
+        process_medium_closure(sg, result, params->top, cw);
         process_medium_closure(sg, result, params->base, base_w);
         break;
     }
     case MX_ANISOTROPIC_VDF_ID: {
-        const ClosureComponent* comp = closure->as_comp();
-        Color3 cw                    = w * comp->w;
-        const auto& params           = *comp->as<MxAnisotropicVdfParams>();
-        result.sigma_t               = cw * params.extinction;
-        result.sigma_s               = params.albedo * result.sigma_t;
-        result.medium_g              = params.anisotropy;
-        result.refraction_ior        = 1.0f;
+        const auto& params    = *comp.as<MxAnisotropicVdfParams>();
+        result.sigma_t        = cw * params.extinction;
+        result.sigma_s        = params.albedo * result.sigma_t;
+        result.medium_g       = params.anisotropy;
+        result.refraction_ior = 1.0f;
         result.priority = 0;  // TODO: should this closure have a priority?
         break;
     }
     case MX_MEDIUM_VDF_ID: {
-        const ClosureComponent* comp = closure->as_comp();
-        Color3 cw                    = w * comp->w;
-        const auto& params           = *comp->as<MxMediumVdfParams>();
+        const auto& params = *comp.as<MxMediumVdfParams>();
         result.sigma_t = { -OIIO::fast_log(params.transmission_color.x),
                            -OIIO::fast_log(params.transmission_color.y),
                            -OIIO::fast_log(params.transmission_color.z) };
@@ -1491,9 +1480,8 @@ process_medium_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
         break;
     }
     case MX_DIELECTRIC_ID: {
-        const ClosureComponent* comp = closure->as_comp();
-        const auto& params           = *comp->as<MxDielectricParams>();
-        if (!is_black(w * comp->w * params.transmission_tint)) {
+        const auto& params = *comp.as<MxDielectricParams>();
+        if (!is_black(cw * params.transmission_tint)) {
             // TODO: properly track a medium stack here ...
             result.refraction_ior = sg.backfacing ? 1.0f / params.ior
                                                   : params.ior;
@@ -1501,9 +1489,8 @@ process_medium_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
         break;
     }
     case MX_GENERALIZED_SCHLICK_ID: {
-        const ClosureComponent* comp = closure->as_comp();
-        const auto& params           = *comp->as<MxGeneralizedSchlickParams>();
-        if (!is_black(w * comp->w * params.transmission_tint)) {
+        const auto& params = *comp.as<MxGeneralizedSchlickParams>();
+        if (!is_black(cw * params.transmission_tint)) {
             // TODO: properly track a medium stack here ...
             float avg_F0  = clamp((params.f0.x + params.f0.y + params.f0.z)
                                       / 3.0f,
@@ -1517,15 +1504,224 @@ process_medium_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
     }
 }
 
-// recursively walk through the closure tree, creating bsdfs as we go
+void
+process_medium_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
+                       const ClosureColor* closure, const Color3& w)
+{
+    if (!closure)
+        return;
+    switch (closure->id) {
+    case ClosureColor::MUL: {
+        process_medium_closure(sg, result, closure->as_mul()->closure,
+                               w * closure->as_mul()->weight);
+        break;
+    }
+    case ClosureColor::ADD: {
+        process_medium_closure(sg, result, closure->as_add()->closureA, w);
+        process_medium_closure(sg, result, closure->as_add()->closureB, w);
+        break;
+    }
+    default: {
+        const ClosureComponent* comp = closure->as_comp();
+        process_medium_component(sg, result,
+                                 { comp->id, w * comp->w, comp->data() });
+        break;
+    }
+    }
+}
+
 void
 process_bsdf_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
                      const ClosureColor* closure, const Color3& w,
-                     bool light_only)
+                     bool light_only);
+
+// create the bsdf of one primitive closure component
+void
+process_bsdf_component(const OSL::ShaderGlobals& sg, ShadingResult& result,
+                       const ClosureFlatComponent& comp, bool light_only)
 {
     static const ustring u_ggx("ggx");
     static const ustring u_beckmann("beckmann");
     static const ustring u_default("default");
+    const Color3& cw = comp.weight;
+    if (comp.id == EMISSION_ID)
+        result.Le += cw;
+    else if (comp.id == MX_UNIFORM_EDF_ID)
+        result.Le += cw * comp.as<MxUniformEdfParams>()->emittance;
+    else if (!light_only) {
+        bool ok = false;
+        switch (comp.id) {
+        case DIFFUSE_ID:
+            ok = result.bsdf.add_bsdf<Diffuse<0>>(
+                cw, *comp.as<DiffuseParams>());
+            break;
+        case OREN_NAYAR_ID:
+            ok = result.bsdf.add_bsdf<OrenNayar>(
+                cw, *comp.as<OrenNayarParams>());
+            break;
+        case TRANSLUCENT_ID:
+            ok = result.bsdf.add_bsdf<Diffuse<1>>(
+                cw, *comp.as<DiffuseParams>());
+            break;
+        case PHONG_ID:
+            ok = result.bsdf.add_bsdf<Phong>(cw, *comp.as<PhongParams>());
+            break;
+        case WARD_ID:
+            ok = result.bsdf.add_bsdf<Ward>(cw, *comp.as<WardParams>());
+            break;
+        case MICROFACET_ID: {
+            const MicrofacetParams* mp = comp.as<MicrofacetParams>();
+            if (mp->dist == u_ggx) {
+                switch (mp->refract) {
+                case 0:
+                    ok = result.bsdf.add_bsdf<MicrofacetGGXRefl>(cw, *mp);
+                    break;
+                case 1:
+                    ok = result.bsdf.add_bsdf<MicrofacetGGXRefr>(cw, *mp);
+                    break;
+                case 2:
+                    ok = result.bsdf.add_bsdf<MicrofacetGGXBoth>(cw, *mp);
+                    break;
+                }
+            } else if (mp->dist == u_beckmann || mp->dist == u_default) {
+                switch (mp->refract) {
+                case 0:
+                    ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefl>(cw,
+                                                                      *mp);
+                    break;
+                case 1:
+                    ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefr>(cw,
+                                                                      *mp);
+                    break;
+                case 2:
+                    ok = result.bsdf.add_bsdf<MicrofacetBeckmannBoth>(cw,
+                                                                      *mp);
+                    break;
+                }
+            }
+            break;
+        }
+        case REFLECTION_ID:
+        case FRESNEL_REFLECTION_ID:
+            ok = result.bsdf.add_bsdf<Reflection>(
+                cw, *comp.as<ReflectionParams>());
+            break;
+        case REFRACTION_ID:
+            ok = result.bsdf.add_bsdf<Refraction>(
+                cw, *comp.as<RefractionParams>());
+            break;
+        case TRANSPARENT_ID:
+            ok = result.bsdf.add_bsdf<Transparent>(cw);
+            break;
+        case MX_OREN_NAYAR_DIFFUSE_ID: {
+            // translate MaterialX parameters into existing closure
+            const MxOrenNayarDiffuseParams* srcparams
+                = comp.as<MxOrenNayarDiffuseParams>();
+            OrenNayarParams params = {};
+            params.N               = srcparams->N;
+            params.sigma           = srcparams->roughness;
+            ok = result.bsdf.add_bsdf<OrenNayar>(cw * srcparams->albedo,
+                                                 params);
+            break;
+        }
+        case MX_BURLEY_DIFFUSE_ID: {
+            const MxBurleyDiffuseParams& params
+                = *comp.as<MxBurleyDiffuseParams>();
+            ok = result.bsdf.add_bsdf<MxBurleyDiffuse>(cw, params);
+            break;
+        }
+        case MX_DIELECTRIC_ID: {
+            const MxDielectricParams& params
+                = *comp.as<MxDielectricParams>();
+            if (is_black(params.transmission_tint))
+                ok = result.bsdf.add_bsdf<
+                    MxMicrofacet<MxDielectricParams, GGXDist, false>>(
+                    cw, params, 1.0f);
+            else
+                ok = result.bsdf.add_bsdf<
+                    MxMicrofacet<MxDielectricParams, GGXDist, true>>(
+                    cw, params, result.refraction_ior);
+            break;
+        }
+        case MX_CONDUCTOR_ID: {
+            const MxConductorParams& params = *comp.as<MxConductorParams>();
+            ok                              = result.bsdf.add_bsdf<
+                MxMicrofacet<MxConductorParams, GGXDist, false>>(cw, params,
+                                                                 1.0f);
+            break;
+        };
+        case MX_GENERALIZED_SCHLICK_ID: {
+            const MxGeneralizedSchlickParams& params
+                = *comp.as<MxGeneralizedSchlickParams>();
+            if (is_black(params.transmission_tint))
+                ok = result.bsdf.add_bsdf<MxMicrofacet<
+                    MxGeneralizedSchlickParams, GGXDist, false>>(cw, params,
+                                                                 1.0f);
+            else
+                ok = result.bsdf.add_bsdf<
+                    MxMicrofacet<MxGeneralizedSchlickParams, GGXDist, true>>(
+                    cw, params, result.refraction_ior);
+            break;
+        };
+        case MX_TRANSLUCENT_ID: {
+            const MxTranslucentParams* srcparams
+                = comp.as<MxTranslucentParams>();
+            DiffuseParams params = {};
+            params.N             = srcparams->N;
+            ok = result.bsdf.add_bsdf<Diffuse<1>>(cw * srcparams->albedo,
+                                                  params);
+            break;
+        }
+        case MX_TRANSPARENT_ID: {
+            ok = result.bsdf.add_bsdf<Transparent>(cw);
+            break;
+        }
+        case MX_SUBSURFACE_ID: {
+            // TODO: implement BSSRDF support?
+            const MxSubsurfaceParams* srcparams
+                = comp.as<MxSubsurfaceParams>();
+            DiffuseParams params = {};
+            params.N             = srcparams->N;
+            ok = result.bsdf.add_bsdf<Diffuse<0>>(cw * srcparams->albedo,
+                                                  params);
+            break;
+        }
+        case MX_SHEEN_ID: {
+            const MxSheenParams& params = *comp.as<MxSheenParams>();
+            ok = result.bsdf.add_bsdf<MxSheen>(cw, params);
+            break;
+        }
+        case MX_LAYER_ID: {
+            const MxLayerParams* srcparams = comp.as<MxLayerParams>();
+            Color3 base_w
+                = cw
+                  * (Color3(1, 1, 1)
+                     - clamp(evaluate_layer_opacity(sg, srcparams->top),
+                             0.f, 1.f));
+            process_bsdf_closure(sg, result, srcparams->top, cw, light_only);
+            if (!is_black(base_w))
+                process_bsdf_closure(sg, result, srcparams->base, base_w,
+                                     light_only);
+            ok = true;
+            break;
+        }
+        case MX_ANISOTROPIC_VDF_ID:
+        case MX_MEDIUM_VDF_ID: {
+            // already processed by process_medium_closure
+            ok = true;
+            break;
+        }
+        }
+        OSL_ASSERT(ok && "Invalid closure invoked in surface shader");
+    }
+}
+
+// recursively walk through the closure tree, creating bsdfs as we go
+void
+process_bsdf_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
+                     const ClosureColor* closure, const Color3& w,
+                     bool light_only)
+{
     if (!closure)
         return;
     switch (closure->id) {
@@ -1544,177 +1740,9 @@ process_bsdf_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
     }
     default: {
         const ClosureComponent* comp = closure->as_comp();
-        Color3 cw                    = w * comp->w;
-        if (comp->id == EMISSION_ID)
-            result.Le += cw;
-        else if (comp->id == MX_UNIFORM_EDF_ID)
-            result.Le += cw * comp->as<MxUniformEdfParams>()->emittance;
-        else if (!light_only) {
-            bool ok = false;
-            switch (comp->id) {
-            case DIFFUSE_ID:
-                ok = result.bsdf.add_bsdf<Diffuse<0>>(
-                    cw, *comp->as<DiffuseParams>());
-                break;
-            case OREN_NAYAR_ID:
-                ok = result.bsdf.add_bsdf<OrenNayar>(
-                    cw, *comp->as<OrenNayarParams>());
-                break;
-            case TRANSLUCENT_ID:
-                ok = result.bsdf.add_bsdf<Diffuse<1>>(
-                    cw, *comp->as<DiffuseParams>());
-                break;
-            case PHONG_ID:
-                ok = result.bsdf.add_bsdf<Phong>(cw, *comp->as<PhongParams>());
-                break;
-            case WARD_ID:
-                ok = result.bsdf.add_bsdf<Ward>(cw, *comp->as<WardParams>());
-                break;
-            case MICROFACET_ID: {
-                const MicrofacetParams* mp = comp->as<MicrofacetParams>();
-                if (mp->dist == u_ggx) {
-                    switch (mp->refract) {
-                    case 0:
-                        ok = result.bsdf.add_bsdf<MicrofacetGGXRefl>(cw, *mp);
-                        break;
-                    case 1:
-                        ok = result.bsdf.add_bsdf<MicrofacetGGXRefr>(cw, *mp);
-                        break;
-                    case 2:
-                        ok = result.bsdf.add_bsdf<MicrofacetGGXBoth>(cw, *mp);
-                        break;
-                    }
-                } else if (mp->dist == u_beckmann || mp->dist == u_default) {
-                    switch (mp->refract) {
-                    case 0:
-                        ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefl>(cw,
-                                                                          *mp);
-                        break;
-                    case 1:
-                        ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefr>(cw,
-                                                                          *mp);
-                        break;
-                    case 2:
-                        ok = result.bsdf.add_bsdf<MicrofacetBeckmannBoth>(cw,
-                                                                          *mp);
-                        break;
-                    }
-                }
-                break;
-            }
-            case REFLECTION_ID:
-            case FRESNEL_REFLECTION_ID:
-                ok = result.bsdf.add_bsdf<Reflection>(
-                    cw, *comp->as<ReflectionParams>());
-                break;
-            case REFRACTION_ID:
-                ok = result.bsdf.add_bsdf<Refraction>(
-                    cw, *comp->as<RefractionParams>());
-                break;
-            case TRANSPARENT_ID:
-                ok = result.bsdf.add_bsdf<Transparent>(cw);
-                break;
-            case MX_OREN_NAYAR_DIFFUSE_ID: {
-                // translate MaterialX parameters into existing closure
-                const MxOrenNayarDiffuseParams* srcparams
-                    = comp->as<MxOrenNayarDiffuseParams>();
-                OrenNayarParams params = {};
-                params.N               = srcparams->N;
-                params.sigma           = srcparams->roughness;
-                ok = result.bsdf.add_bsdf<OrenNayar>(cw * srcparams->albedo,
-                                                     params);
-                break;
-            }
-            case MX_BURLEY_DIFFUSE_ID: {
-                const MxBurleyDiffuseParams& params
-                    = *comp->as<MxBurleyDiffuseParams>();
-                ok = result.bsdf.add_bsdf<MxBurleyDiffuse>(cw, params);
-                break;
-            }
-            case MX_DIELECTRIC_ID: {
-                const MxDielectricParams& params
-                    = *comp->as<MxDielectricParams>();
-                if (is_black(params.transmission_tint))
-                    ok = result.bsdf.add_bsdf<
-                        MxMicrofacet<MxDielectricParams, GGXDist, false>>(
-                        cw, params, 1.0f);
-                else
-                    ok = result.bsdf.add_bsdf<
-                        MxMicrofacet<MxDielectricParams, GGXDist, true>>(
-                        cw, params, result.refraction_ior);
-                break;
-            }
-            case MX_CONDUCTOR_ID: {
-                const MxConductorParams& params = *comp->as<MxConductorParams>();
-                ok                              = result.bsdf.add_bsdf<
-                    MxMicrofacet<MxConductorParams, GGXDist, false>>(cw, params,
-                                                                     1.0f);
-                break;
-            };
-            case MX_GENERALIZED_SCHLICK_ID: {
-                const MxGeneralizedSchlickParams& params
-                    = *comp->as<MxGeneralizedSchlickParams>();
-                if (is_black(params.transmission_tint))
-                    ok = result.bsdf.add_bsdf<MxMicrofacet<
-                        MxGeneralizedSchlickParams, GGXDist, false>>(cw, params,
-                                                                     1.0f);
-                else
-                    ok = result.bsdf.add_bsdf<
-                        MxMicrofacet<MxGeneralizedSchlickParams, GGXDist, true>>(
-                        cw, params, result.refraction_ior);
-                break;
-            };
-            case MX_TRANSLUCENT_ID: {
-                const MxTranslucentParams* srcparams
-                    = comp->as<MxTranslucentParams>();
-                DiffuseParams params = {};
-                params.N             = srcparams->N;
-                ok = result.bsdf.add_bsdf<Diffuse<1>>(cw * srcparams->albedo,
-                                                      params);
-                break;
-            }
-            case MX_TRANSPARENT_ID: {
-                ok = result.bsdf.add_bsdf<Transparent>(cw);
-                break;
-            }
-            case MX_SUBSURFACE_ID: {
-                // TODO: implement BSSRDF support?
-                const MxSubsurfaceParams* srcparams
-                    = comp->as<MxSubsurfaceParams>();
-                DiffuseParams params = {};
-                params.N             = srcparams->N;
-                ok = result.bsdf.add_bsdf<Diffuse<0>>(cw * srcparams->albedo,
-                                                      params);
-                break;
-            }
-            case MX_SHEEN_ID: {
-                const MxSheenParams& params = *comp->as<MxSheenParams>();
-                ok = result.bsdf.add_bsdf<MxSheen>(cw, params);
-                break;
-            }
-            case MX_LAYER_ID: {
-                const MxLayerParams* srcparams = comp->as<MxLayerParams>();
-                Color3 base_w
-                    = w
-                      * (Color3(1, 1, 1)
-                         - clamp(evaluate_layer_opacity(sg, srcparams->top),
-                                 0.f, 1.f));
-                process_bsdf_closure(sg, result, srcparams->top, w, light_only);
-                if (!is_black(base_w))
-                    process_bsdf_closure(sg, result, srcparams->base, base_w,
-                                         light_only);
-                ok = true;
-                break;
-            }
-            case MX_ANISOTROPIC_VDF_ID:
-            case MX_MEDIUM_VDF_ID: {
-                // already processed by process_medium_closure
-                ok = true;
-                break;
-            }
-            }
-            OSL_ASSERT(ok && "Invalid closure invoked in surface shader");
-        }
+        process_bsdf_component(sg, result,
+                               { comp->id, w * comp->w, comp->data() },
+                               light_only);
         break;
     }
     }
@@ -1733,6 +1761,17 @@ process_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
     process_bsdf_closure(sg, result, Ci, Color3(1), light_only);
 }
 
+void
+process_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
+                cspan<ClosureFlatComponent> Ci, bool light_only)
+{
+    if (!light_only)
+        for (const auto& comp : Ci)
+            process_medium_component(sg, result, comp);
+    for (const auto& comp : Ci)
+        process_bsdf_component(sg, result, comp, light_only);
+}
+
 Vec3
 process_background_closure(const ClosureColor* closure)
 {
@@ -1756,5 +1795,17 @@ process_background_closure(const ClosureColor* closure)
     return Vec3(0, 0, 0);
 }
 
+Vec3
+process_background_closure(cspan<ClosureFlatComponent> Ci)
+{
+    Vec3 result(0, 0, 0);
+    for (const auto& comp : Ci) {
+        OSL_ASSERT(comp.id == BACKGROUND_ID
+                   && "Invalid closure invoked in background shader");
+        result += comp.weight;
+    }
+    return result;
+}
+
 
 OSL_NAMESPACE_EXIT
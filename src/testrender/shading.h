@@ -156,7 +156,12 @@ register_closures(ShadingSystem* shadingsys);
 void
 process_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
                 const ClosureColor* Ci, bool light_only);
+void
+process_closure(const OSL::ShaderGlobals& sg, ShadingResult& result,
+                cspan<ClosureFlatComponent> Ci, bool light_only);
 Vec3
 process_background_closure(const ClosureColor* Ci);
+Vec3
+process_background_closure(cspan<ClosureFlatComponent> Ci);
 
 OSL_NAMESPACE_EXIT
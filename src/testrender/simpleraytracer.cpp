@@ -2,8 +2,16 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <numeric>
+#include <thread>
+
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/parallel.h>
+#include <OpenImageIO/thread.h>
+#include <OpenImageIO/timer.h>
 
 #include <pugixml.hpp>
 
@@ -11,6 +19,10 @@
 namespace pugi = OIIO::pugi;
 #endif
 
+#if OSL_USE_BATCHED
+#    include <OSL/batched_shaderglobals.h>
+#endif
+
 #include "raytracer.h"
 #include "shading.h"
 #include "simpleraytracer.h"
@@ -50,6 +62,10 @@ private:
 
 
 SimpleRaytracer::SimpleRaytracer()
+#if OSL_USE_BATCHED
+    : m_batch_16_raytracer(*this)
+    , m_batch_8_raytracer(*this)
+#endif
 {
     m_errhandler.reset(new SimpleRaytracer::ErrorHandler(*this));
 
@@ -332,6 +348,30 @@ SimpleRaytracer::parse_scene_xml(const std::string& scenefile)
                 scene.add_quad(
                     Quad(co, ex, ey, int(shaders().size()) - 1, is_light));
             }
+        } else if (strcmp(node.name(), "Triangle") == 0) {
+            // load triangle
+            pugi::xml_attribute p0_attr = node.attribute("p0");
+            pugi::xml_attribute p1_attr = node.attribute("p1");
+            pugi::xml_attribute p2_attr = node.attribute("p2");
+            if (p0_attr && p1_attr && p2_attr) {
+                pugi::xml_attribute light_attr = node.attribute("is_light");
+                bool is_light = light_attr ? strtobool(light_attr.value())
+                                           : false;
+                add_triangle(strtovec(p0_attr.value()),
+                             strtovec(p1_attr.value()),
+                             strtovec(p2_attr.value()),
+                             int(shaders().size()) - 1, is_light);
+            }
+        } else if (strcmp(node.name(), "Mesh") == 0) {
+            // load triangles (and polygons, as fans) from an .obj file
+            pugi::xml_attribute file_attr = node.attribute("filename");
+            if (file_attr) {
+                pugi::xml_attribute light_attr = node.attribute("is_light");
+                bool is_light = light_attr ? strtobool(light_attr.value())
+                                           : false;
+                load_obj(file_attr.value(), int(shaders().size()) - 1,
+                         is_light);
+            }
         } else if (strcmp(node.name(), "Background") == 0) {
             pugi::xml_attribute res_attr = node.attribute("resolution");
             if (res_attr)
@@ -846,43 +886,187 @@ SimpleRaytracer::eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx,
     return process_background_closure(sg.Ci);
 }
 
+Ray
+SimpleRaytracer::camera_ray(int x, int y, Sampler& sampler)
+{
+    // jitter pixel coordinate [0,1)^2
+    Vec3 j = sampler.get();
+    // warp distribution to approximate a tent filter [-1,+1)^2
+    j.x *= 2;
+    j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
+    j.y *= 2;
+    j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+    // eye ray (apply jitter from center of the pixel)
+    return camera.get(x + 0.5f + j.x, y + 0.5f + j.y);
+}
+
+
+
+// Trace the path's ray against the scene.  Returns true if it hit
+// something, whose id and distance land in id and t; otherwise the path
+// is finished, and picks up its background contribution.
+bool
+SimpleRaytracer::trace_path(PathState& path, Dual2<float>& t, int& id,
+                            ShadingContext* ctx)
+{
+    id = path.prev_id;
+    if (scene.intersect(path.ray, t, id))
+        return true;
+    // we hit nothing? check background shader
+    if (backgroundShaderID >= 0) {
+        if (path.bounce > 0 && backgroundResolution > 0) {
+            float bg_pdf = 0;
+            Vec3 bg      = background.eval(path.ray.direction, bg_pdf);
+            path.radiance += path.weight * bg
+                             * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(
+                                 path.bsdf_pdf, bg_pdf);
+        } else {
+            // we aren't importance sampling the background - so just run it directly
+            path.radiance += path.weight
+                             * eval_background(path.ray.direction, ctx,
+                                               path.bounce);
+        }
+    }
+    return false;
+}
+
+
+
+// Given the shaded hit at the end of the path (sg, and the closures
+// already processed into result), add its emission and direct lighting,
+// and sample the next ray.  Returns false if the path is finished.
+bool
+SimpleRaytracer::scatter_path(PathState& path, const ShaderGlobals& sg,
+                              ShadingResult& result, int id, float radius,
+                              ShadingContext* ctx)
+{
+    Ray& r                = path.ray;
+    Color3& path_weight   = path.weight;
+    Color3& path_radiance = path.radiance;
+
+    // add self-emission
+    float k = 1;
+    if (scene.islight(id)) {
+        // figure out the probability of reaching this point
+        float light_pdf = scene.shapepdf(id, r.origin, sg.P);
+        k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(path.bsdf_pdf, light_pdf);
+    }
+    path_radiance += path_weight * k * result.Le;
+
+    // last bounce? nothing left to do
+    if (path.bounce >= max_bounces)
+        return false;
+
+    // build internal pdf for sampling between bsdf closures
+    result.bsdf.prepare(-sg.I, path_weight, path.bounce >= rr_depth);
+
+    if (show_albedo_scale > 0) {
+        // Instead of path tracing, just visualize the albedo
+        // of the bsdf. This can be used to validate the accuracy of
+        // the get_albedo method for a particular bsdf.
+        path_radiance += path_weight * result.bsdf.get_albedo(-sg.I)
+                         * show_albedo_scale;
+        return false;
+    }
+
+    // get three random numbers
+    Vec3 s   = path.sampler.get();
+    float xi = s.x;
+    float yi = s.y;
+    float zi = s.z;
+
+    // trace one ray to the background
+    if (backgroundResolution > 0) {
+        Dual2<Vec3> bg_dir;
+        float bg_pdf   = 0;
+        Vec3 bg        = background.sample(xi, yi, bg_dir, bg_pdf);
+        BSDF::Sample b = result.bsdf.eval(-sg.I, bg_dir.val());
+        Color3 contrib = path_weight * b.weight * bg
+                         * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bg_pdf,
+                                                                    b.pdf);
+        if ((contrib.x + contrib.y + contrib.z) > 0) {
+            int shadow_id  = id;
+            Ray shadow_ray = Ray(sg.P, bg_dir.val(), radius, 0, Ray::SHADOW);
+            Dual2<float> shadow_dist;
+            if (!scene.intersect(shadow_ray, shadow_dist,
+                                 shadow_id))  // ray reached the background?
+                path_radiance += contrib;
+        }
+    }
+
+    // trace one ray to each light
+    for (int lid : scene.lights) {
+        if (lid == id)
+            continue;  // skip self
+        int shaderID = scene.shaderid(lid);
+        if (shaderID < 0 || !m_shaders[shaderID])
+            continue;  // no shader attached to this light
+        // sample a random direction towards the object
+        float light_pdf;
+        Vec3 ldir      = scene.sample(lid, sg.P, xi, yi, light_pdf);
+        BSDF::Sample b = result.bsdf.eval(-sg.I, ldir);
+        Color3 contrib = path_weight * b.weight
+                         * MIS::power_heuristic<MIS::EVAL_WEIGHT>(light_pdf,
+                                                                  b.pdf);
+        if ((contrib.x + contrib.y + contrib.z) > 0) {
+            Ray shadow_ray = Ray(sg.P, ldir, radius, 0, Ray::SHADOW);
+            // trace a shadow ray and see if we actually hit the target
+            // in this tiny renderer, tracing a ray is probably cheaper than evaluating the light shader
+            int shadow_id = id;  // ignore self hit
+            Dual2<float> shadow_dist;
+            if (scene.intersect(shadow_ray, shadow_dist, shadow_id)
+                && shadow_id == lid) {
+                // setup a shader global for the point on the light
+                ShaderGlobals light_sg;
+                globals_from_hit(light_sg, shadow_ray, shadow_dist, lid);
+                // execute the light shader (for emissive closures only)
+                shadingsys->execute(*ctx, *m_shaders[shaderID], light_sg);
+                ShadingResult light_result;
+                process_closure(light_sg, light_result,
+                                shadingsys->flatten_closure(*ctx,
+                                                            light_sg.Ci),
+                                true);
+                // accumulate contribution
+                path_radiance += contrib * light_result.Le;
+            }
+        }
+    }
+
+    // trace indirect ray and continue
+    BSDF::Sample p = result.bsdf.sample(-sg.I, xi, yi, zi);
+    path_weight *= p.weight;
+    path.bsdf_pdf = p.pdf;
+    r.raytype     = Ray::DIFFUSE;  // FIXME? Use DIFFUSE for all indiirect rays
+    r.direction   = p.wi;
+    r.radius      = radius;
+    // Just simply use roughness as spread slope
+    r.spread = std::max(r.spread, p.roughness);
+    if (!(path_weight.x > 0) && !(path_weight.y > 0) && !(path_weight.z > 0))
+        return false;  // filter out all 0's or NaNs
+    path.prev_id = id;
+    r.origin     = sg.P;
+    path.bounce += 1;
+    return true;
+}
+
+
+
 Color3
-SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
+SimpleRaytracer::subpixel_radiance(const Ray& r, const Sampler& sampler,
                                    ShadingContext* ctx)
 {
-    Ray r = camera.get(x, y);
-    Color3 path_weight(1, 1, 1);
-    Color3 path_radiance(0, 0, 0);
-    int prev_id    = -1;
-    float bsdf_pdf = std::numeric_limits<
-        float>::infinity();  // camera ray has only one possible direction
-    for (int b = 0; b <= max_bounces; b++) {
+    PathState path(r, sampler);
+    while (path.bounce <= max_bounces) {
         // trace the ray against the scene
         Dual2<float> t;
-        int id = prev_id;
-        if (!scene.intersect(r, t, id)) {
-            // we hit nothing? check background shader
-            if (backgroundShaderID >= 0) {
-                if (b > 0 && backgroundResolution > 0) {
-                    float bg_pdf = 0;
-                    Vec3 bg      = background.eval(r.direction, bg_pdf);
-                    path_radiance
-                        += path_weight * bg
-                           * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bsdf_pdf,
-                                                                      bg_pdf);
-                } else {
-                    // we aren't importance sampling the background - so just run it directly
-                    path_radiance += path_weight
-                                     * eval_background(r.direction, ctx, b);
-                }
-            }
+        int id;
+        if (!trace_path(path, t, id, ctx))
             break;
-        }
 
         // construct a shader globals for the hit point
         ShaderGlobals sg;
-        globals_from_hit(sg, r, t, id);
-        const float radius = r.radius + r.spread * t.val();
+        globals_from_hit(sg, path.ray, t, id);
+        const float radius = path.ray.radius + path.ray.spread * t.val();
         int shaderID       = scene.shaderid(id);
         if (shaderID < 0 || !m_shaders[shaderID])
             break;  // no shader attached? done
@@ -890,162 +1074,382 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
         // execute shader and process the resulting list of closures
         shadingsys->execute(*ctx, *m_shaders[shaderID], sg);
         ShadingResult result;
-        bool last_bounce = b == max_bounces;
-        process_closure(sg, result, sg.Ci, last_bounce);
-
-        // add self-emission
-        float k = 1;
-        if (scene.islight(id)) {
-            // figure out the probability of reaching this point
-            float light_pdf = scene.shapepdf(id, r.origin, sg.P);
-            k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(bsdf_pdf, light_pdf);
-        }
-        path_radiance += path_weight * k * result.Le;
-
-        // last bounce? nothing left to do
-        if (last_bounce)
+        process_closure(sg, result, shadingsys->flatten_closure(*ctx, sg.Ci),
+                        path.bounce == max_bounces);
+        if (!scatter_path(path, sg, result, id, radius, ctx))
             break;
+    }
+    return path.radiance;
+}
 
-        // build internal pdf for sampling between bsdf closures
-        result.bsdf.prepare(-sg.I, path_weight, b >= rr_depth);
 
-        if (show_albedo_scale > 0) {
-            // Instead of path tracing, just visualize the albedo
-            // of the bsdf. This can be used to validate the accuracy of
-            // the get_albedo method for a particular bsdf.
-            path_radiance += path_weight * result.bsdf.get_albedo(-sg.I)
-                             * show_albedo_scale;
-            break;
-        }
 
-        // get three random numbers
-        Vec3 s   = sampler.get();
-        float xi = s.x;
-        float yi = s.y;
-        float zi = s.z;
-
-        // trace one ray to the background
-        if (backgroundResolution > 0) {
-            Dual2<Vec3> bg_dir;
-            float bg_pdf   = 0;
-            Vec3 bg        = background.sample(xi, yi, bg_dir, bg_pdf);
-            BSDF::Sample b = result.bsdf.eval(-sg.I, bg_dir.val());
-            Color3 contrib = path_weight * b.weight * bg
-                             * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bg_pdf,
-                                                                        b.pdf);
-            if ((contrib.x + contrib.y + contrib.z) > 0) {
-                int shadow_id  = id;
-                Ray shadow_ray = Ray(sg.P, bg_dir.val(), radius, 0,
-                                     Ray::SHADOW);
-                Dual2<float> shadow_dist;
-                if (!scene.intersect(shadow_ray, shadow_dist,
-                                     shadow_id))  // ray reached the background?
-                    path_radiance += contrib;
+// Mix the sample r into the pixel
+static void
+add_sample(SimpleRaytracer::PixelState& pixel, const Color3& r)
+{
+    // mix in result via lerp for numerical stability
+    pixel.n += 1;
+    Color3 old  = pixel.color;
+    pixel.color = OIIO::lerp(pixel.color, r, 1.0f / pixel.n);
+    // Welford's update of the luminance variance, for the noise level
+    float lum     = (r.x + r.y + r.z) * (1.0f / 3.0f);
+    float oldmean = (old.x + old.y + old.z) * (1.0f / 3.0f);
+    float newmean = (pixel.color.x + pixel.color.y + pixel.color.z)
+                    * (1.0f / 3.0f);
+    pixel.m2 += (lum - oldmean) * (lum - newmean);
+}
+
+
+
+void
+SimpleRaytracer::antialias_pixel(int x, int y, int sbegin, int send,
+                                 PixelState& pixel, ShadingContext* ctx)
+{
+    for (int si = sbegin; si < send; si++) {
+        Sampler sampler(x, y, si);
+        Ray r = camera_ray(x, y, sampler);
+        add_sample(pixel, subpixel_radiance(r, sampler, ctx));
+    }
+}
+
+
+#if OSL_USE_BATCHED
+// Copy one point's globals into a lane of the batch
+template<int WidthT>
+static void
+load_lane(BatchedShaderGlobals<WidthT>& bsg, int lane, const ShaderGlobals& sg)
+{
+    auto& vsg                = bsg.varying;
+    vsg.P[lane]              = sg.P;
+    vsg.dPdx[lane]           = sg.dPdx;
+    vsg.dPdy[lane]           = sg.dPdy;
+    vsg.dPdz[lane]           = sg.dPdz;
+    vsg.I[lane]              = sg.I;
+    vsg.dIdx[lane]           = sg.dIdx;
+    vsg.dIdy[lane]           = sg.dIdy;
+    vsg.N[lane]              = sg.N;
+    vsg.Ng[lane]             = sg.Ng;
+    vsg.u[lane]              = sg.u;
+    vsg.dudx[lane]           = sg.dudx;
+    vsg.dudy[lane]           = sg.dudy;
+    vsg.v[lane]              = sg.v;
+    vsg.dvdx[lane]           = sg.dvdx;
+    vsg.dvdy[lane]           = sg.dvdy;
+    vsg.dPdu[lane]           = sg.dPdu;
+    vsg.dPdv[lane]           = sg.dPdv;
+    vsg.time[lane]           = sg.time;
+    vsg.dtime[lane]          = sg.dtime;
+    vsg.dPdtime[lane]        = sg.dPdtime;
+    vsg.Ps[lane]             = sg.Ps;
+    vsg.dPsdx[lane]          = sg.dPsdx;
+    vsg.dPsdy[lane]          = sg.dPsdy;
+    vsg.object2common[lane]  = sg.object2common;
+    vsg.shader2common[lane]  = sg.shader2common;
+    vsg.Ci[lane]             = nullptr;
+    vsg.surfacearea[lane]    = sg.surfacearea;
+    vsg.flipHandedness[lane] = sg.flipHandedness;
+    vsg.backfacing[lane]     = sg.backfacing;
+}
+
+
+
+// Render the samples [sbegin,send) of the pixels of roi as a wavefront:
+// the paths of all the samples advance one bounce at a time, and the hits
+// of each bounce are shaded WidthT at a time by batched execution, grouped
+// by shader and raytype since those must be uniform within a batch.  Light
+// and background shaders still run one point at a time.
+template<int WidthT>
+void
+SimpleRaytracer::antialias_tile_batched(const OIIO::ROI& roi, int sbegin,
+                                        int send, PixelState* pixels,
+                                        int xres, ShadingContext* ctx)
+{
+    std::vector<PathState> paths;
+    std::vector<PixelState*> path_pixel;
+    paths.reserve(size_t(roi.npixels()) * (send - sbegin));
+    path_pixel.reserve(paths.capacity());
+    for (int y = roi.ybegin; y < roi.yend; ++y) {
+        for (int x = roi.xbegin; x < roi.xend; ++x) {
+            for (int si = sbegin; si < send; si++) {
+                Sampler sampler(x, y, si);
+                Ray r = camera_ray(x, y, sampler);
+                paths.emplace_back(r, sampler);
+                path_pixel.push_back(&pixels[size_t(y) * xres + x]);
             }
         }
+    }
 
-        // trace one ray to each light
-        for (int lid = 0; lid < scene.num_prims(); lid++) {
-            if (lid == id)
-                continue;  // skip self
-            if (!scene.islight(lid))
-                continue;  // doesn't want to be sampled as a light
-            int shaderID = scene.shaderid(lid);
-            if (shaderID < 0 || !m_shaders[shaderID])
-                continue;  // no shader attached to this light
-            // sample a random direction towards the object
-            float light_pdf;
-            Vec3 ldir      = scene.sample(lid, sg.P, xi, yi, light_pdf);
-            BSDF::Sample b = result.bsdf.eval(-sg.I, ldir);
-            Color3 contrib = path_weight * b.weight
-                             * MIS::power_heuristic<MIS::EVAL_WEIGHT>(light_pdf,
-                                                                      b.pdf);
-            if ((contrib.x + contrib.y + contrib.z) > 0) {
-                Ray shadow_ray = Ray(sg.P, ldir, radius, 0, Ray::SHADOW);
-                // trace a shadow ray and see if we actually hit the target
-                // in this tiny renderer, tracing a ray is probably cheaper than evaluating the light shader
-                int shadow_id = id;  // ignore self hit
-                Dual2<float> shadow_dist;
-                if (scene.intersect(shadow_ray, shadow_dist, shadow_id)
-                    && shadow_id == lid) {
-                    // setup a shader global for the point on the light
-                    ShaderGlobals light_sg;
-                    globals_from_hit(light_sg, shadow_ray, shadow_dist, lid);
-                    // execute the light shader (for emissive closures only)
-                    shadingsys->execute(*ctx, *m_shaders[shaderID], light_sg);
-                    ShadingResult light_result;
-                    process_closure(light_sg, light_result, light_sg.Ci, true);
-                    // accumulate contribution
-                    path_radiance += contrib * light_result.Le;
-                }
+    // What the ray of a live path hit
+    struct Hit {
+        int path;
+        int id;
+        int shaderID;
+        Dual2<float> t;
+    };
+    std::vector<int> alive(paths.size());
+    std::iota(alive.begin(), alive.end(), 0);
+    std::vector<Hit> hits;
+    std::vector<ShaderGlobals> sgs;
+    BatchedShaderGlobals<WidthT> bsg;
+    memset(&bsg.uniform, 0, sizeof(UniformShaderGlobals));
+    // In our SimpleRaytracer, the "renderstate" is just a pointer to the
+    // globals, which for a batch are the batched ones.
+    bsg.uniform.renderstate = &bsg;
+    Block<int, WidthT> shadeindex;
+    for (int lane = 0; lane < WidthT; ++lane)
+        shadeindex[lane] = lane;
+
+    while (!alive.empty()) {
+        // Trace the rays of all the live paths
+        hits.clear();
+        for (int p : alive) {
+            Hit hit;
+            hit.path = p;
+            if (!trace_path(paths[p], hit.t, hit.id, ctx))
+                continue;
+            hit.shaderID = scene.shaderid(hit.id);
+            if (hit.shaderID < 0 || !m_shaders[hit.shaderID])
+                continue;  // no shader attached? done
+            hits.push_back(hit);
+        }
+        auto raytype = [&](const Hit& h) { return paths[h.path].ray.raytype; };
+        std::stable_sort(hits.begin(), hits.end(),
+                         [&](const Hit& a, const Hit& b) {
+                             if (a.shaderID != b.shaderID)
+                                 return a.shaderID < b.shaderID;
+                             return raytype(a) < raytype(b);
+                         });
+
+        // Shade the hits, a batch at a time
+        alive.clear();
+        sgs.resize(std::min(hits.size(), size_t(WidthT)));
+        for (size_t begin = 0, n = hits.size(); begin < n;) {
+            const Hit& first = hits[begin];
+            int batch_size   = 1;
+            while (batch_size < WidthT && begin + batch_size < n
+                   && hits[begin + batch_size].shaderID == first.shaderID
+                   && raytype(hits[begin + batch_size]) == raytype(first))
+                ++batch_size;
+            bsg.uniform.raytype = raytype(first);
+            for (int lane = 0; lane < batch_size; ++lane) {
+                const Hit& hit = hits[begin + lane];
+                globals_from_hit(sgs[lane], paths[hit.path].ray, hit.t,
+                                 hit.id);
+                load_lane(bsg, lane, sgs[lane]);
+            }
+            shadingsys->batched<WidthT>().execute(*ctx,
+                                                  *m_shaders[first.shaderID],
+                                                  batch_size, shadeindex, bsg,
+                                                  nullptr, nullptr);
+
+            // The closures only live until the context's next execute, and
+            // scattering runs the light shaders, so process every lane's
+            // closures first.
+            ShadingResult results[WidthT];
+            int lane_begins[WidthT + 1];
+            cspan<ClosureFlatComponent> flat
+                = shadingsys->batched<WidthT>().flatten_closures(*ctx,
+                                                                 batch_size,
+                                                                 bsg,
+                                                                 lane_begins);
+            for (int lane = 0; lane < batch_size; ++lane) {
+                const PathState& path = paths[hits[begin + lane].path];
+                cspan<ClosureFlatComponent> Ci(flat.data() + lane_begins[lane],
+                                               lane_begins[lane + 1]
+                                                   - lane_begins[lane]);
+                process_closure(sgs[lane], results[lane], Ci,
+                                path.bounce == max_bounces);
             }
+            for (int lane = 0; lane < batch_size; ++lane) {
+                const Hit& hit = hits[begin + lane];
+                PathState& path(paths[hit.path]);
+                const float radius = path.ray.radius
+                                     + path.ray.spread * hit.t.val();
+                if (scatter_path(path, sgs[lane], results[lane], hit.id,
+                                 radius, ctx))
+                    alive.push_back(hit.path);
+            }
+            begin += batch_size;
         }
+        // Keep the paths in sample order, for coherence
+        std::sort(alive.begin(), alive.end());
+    }
 
-        // trace indirect ray and continue
-        BSDF::Sample p = result.bsdf.sample(-sg.I, xi, yi, zi);
-        path_weight *= p.weight;
-        bsdf_pdf  = p.pdf;
-        r.raytype = Ray::DIFFUSE;  // FIXME? Use DIFFUSE for all indiirect rays
-        r.direction = p.wi;
-        r.radius    = radius;
-        // Just simply use roughness as spread slope
-        r.spread = std::max(r.spread, p.roughness);
-        if (!(path_weight.x > 0) && !(path_weight.y > 0)
-            && !(path_weight.z > 0))
-            break;  // filter out all 0's or NaNs
-        prev_id  = id;
-        r.origin = sg.P;
+    // Samples of a pixel are consecutive, so they mix in the same order
+    // as in antialias_pixel.
+    for (size_t p = 0; p < paths.size(); ++p)
+        add_sample(*path_pixel[p], paths[p].radiance);
+}
+
+
+
+// Evaluate the background shader for row y of the background's grid,
+// WidthT directions at a time by batched execution.
+template<int WidthT>
+void
+SimpleRaytracer::eval_background_row_batched(int y, ShadingContext* ctx)
+{
+    BatchedShaderGlobals<WidthT> bsg;
+    memset(&bsg.uniform, 0, sizeof(UniformShaderGlobals));
+    bsg.uniform.renderstate = &bsg;
+    Block<int, WidthT> shadeindex;
+    for (int lane = 0; lane < WidthT; ++lane)
+        shadeindex[lane] = lane;
+    ShaderGlobals sg;
+    memset((char*)&sg, 0, sizeof(ShaderGlobals));
+    for (int begin = 0, res = background.resolution(); begin < res;
+         begin += WidthT) {
+        int batch_size = std::min(WidthT, res - begin);
+        for (int lane = 0; lane < batch_size; ++lane) {
+            // As eval_background sets them up for one direction
+            Dual2<Vec3> dir = background.direction(begin + lane, y);
+            sg.I            = dir.val();
+            sg.dIdx         = dir.dx();
+            sg.dIdy         = dir.dy();
+            load_lane(bsg, lane, sg);
+        }
+        shadingsys->batched<WidthT>().execute(*ctx,
+                                              *m_shaders[backgroundShaderID],
+                                              batch_size, shadeindex, bsg,
+                                              nullptr, nullptr);
+        int lane_begins[WidthT + 1];
+        cspan<ClosureFlatComponent> flat
+            = shadingsys->batched<WidthT>().flatten_closures(*ctx, batch_size,
+                                                             bsg, lane_begins);
+        for (int lane = 0; lane < batch_size; ++lane) {
+            cspan<ClosureFlatComponent> Ci(flat.data() + lane_begins[lane],
+                                           lane_begins[lane + 1]
+                                               - lane_begins[lane]);
+            background.set_value(begin + lane, y,
+                                 process_background_closure(Ci));
+        }
     }
-    return path_radiance;
 }
+#endif
 
-Color3
-SimpleRaytracer::antialias_pixel(int x, int y, ShadingContext* ctx)
+
+
+void
+SimpleRaytracer::add_triangle(const Vec3& p0, const Vec3& p1, const Vec3& p2,
+                              int shaderID, bool is_light)
 {
-    Color3 result(0, 0, 0);
-    for (int si = 0, n = aa * aa; si < n; si++) {
-        Sampler sampler(x, y, si);
-        // jitter pixel coordinate [0,1)^2
-        Vec3 j = sampler.get();
-        // warp distribution to approximate a tent filter [-1,+1)^2
-        j.x *= 2;
-        j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
-        j.y *= 2;
-        j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
-        // trace eye ray (apply jitter from center of the pixel)
-        Color3 r = subpixel_radiance(x + 0.5f + j.x, y + 0.5f + j.y, sampler,
-                                     ctx);
-        // mix in result via lerp for numerical stability
-        result = OIIO::lerp(result, r, 1.0f / (si + 1));
+    if ((p1 - p0).cross(p2 - p0).length2() > 0)  // skip degenerate ones
+        scene.add_triangle(Triangle(p0, p1, p2, shaderID, is_light));
+}
+
+
+
+void
+SimpleRaytracer::load_obj(const std::string& filename, int shaderID,
+                          bool is_light)
+{
+    std::string text;
+    if (!OIIO::Filesystem::read_text_file(filename, text)) {
+        errhandler().errorfmt("Could not read mesh \"{}\"", filename);
+        return;
     }
-    return result;
+    // Only the vertex positions ("v") and faces ("f") are used
+    std::vector<Vec3> verts;
+    for (string_view line : OIIO::Strutil::splitsv(text, "\n")) {
+        string_view tag = OIIO::Strutil::parse_word(line);
+        if (tag == "v") {
+            Vec3 v(0, 0, 0);
+            OIIO::Strutil::parse_float(line, v.x);
+            OIIO::Strutil::parse_float(line, v.y);
+            OIIO::Strutil::parse_float(line, v.z);
+            verts.push_back(v);
+        } else if (tag == "f") {
+            // Corners are "v", "v/vt", "v//vn" or "v/vt/vn"; negative
+            // indices count back from the last vertex read.
+            std::vector<int> corners;
+            int index = 0;
+            while (OIIO::Strutil::parse_int(line, index)) {
+                index = index < 0 ? int(verts.size()) + index : index - 1;
+                if (index < 0 || index >= int(verts.size())) {
+                    errhandler().errorfmt("Bad vertex index in mesh \"{}\"",
+                                          filename);
+                    return;
+                }
+                corners.push_back(index);
+                OIIO::Strutil::parse_until(line, " \t\r");
+            }
+            for (size_t i = 2; i < corners.size(); ++i)
+                add_triangle(verts[corners[0]], verts[corners[i - 1]],
+                             verts[corners[i]], shaderID, is_light);
+        }
+    }
+}
+
+
+
+// How many threads to share njobs between: as many as OIIO's "threads"
+// attribute asks for, or as there are cores, but no more than the jobs.
+static int
+worker_count(int njobs)
+{
+    int nworkers = 0;
+    OIIO::getattribute("threads", nworkers);
+    if (nworkers <= 0)
+        nworkers = int(std::thread::hardware_concurrency());
+    return std::max(1, std::min(nworkers, njobs));
 }
 
 
+
 void
 SimpleRaytracer::prepare_render()
 {
+    // Acceleration structure and lights, now that the scene is complete
+    scene.prepare();
+
     // Retrieve and validate options
     aa                = std::max(1, options.get_int("aa"));
     max_bounces       = options.get_int("max_bounces");
     rr_depth          = options.get_int("rr_depth");
     show_albedo_scale = options.get_float("show_albedo_scale");
+    passes            = std::max(1, options.get_int("passes"));
+    tile_size         = std::max(1, options.get_int("tile_size", 16));
+    noise_target      = options.get_float("noise_target");
+#if OSL_USE_BATCHED
+    batch_width = options.get_int("batched");
+#endif
 
     // prepare background importance table (if requested)
     if (backgroundResolution > 0 && backgroundShaderID >= 0) {
-        // get a context so we can make several background shader calls
-        OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
-        ShadingContext* ctx             = shadingsys->get_context(thread_info);
-
-        // build importance table to optimize background sampling
-        auto evaler = [this](const Dual2<Vec3>& dir, ShadingContext* ctx) {
-            return this->eval_background(dir, ctx);
+        // Evaluate the background shader over the grid a row at a time,
+        // each worker with its own context, then build the importance
+        // table to optimize background sampling
+        background.init(backgroundResolution);
+        const int res      = background.resolution();
+        const int nworkers = worker_count(res);
+        std::atomic<int> next_row { 0 };
+        auto worker = [&]() {
+            OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
+            ShadingContext* ctx = shadingsys->get_context(thread_info);
+            for (int y; (y = next_row++) < res;) {
+#if OSL_USE_BATCHED
+                if (batch_width == 16)
+                    eval_background_row_batched<16>(y, ctx);
+                else if (batch_width == 8)
+                    eval_background_row_batched<8>(y, ctx);
+#endif
+                if (!batch_width)
+                    for (int x = 0; x < res; ++x)
+                        background.set_value(
+                            x, y,
+                            eval_background(background.direction(x, y), ctx));
+            }
+            shadingsys->release_context(ctx);
+            shadingsys->destroy_thread_info(thread_info);
         };
-        background.prepare(backgroundResolution, evaler, ctx);
-
-        // release context
-        shadingsys->release_context(ctx);
-        shadingsys->destroy_thread_info(thread_info);
+        std::vector<std::thread> threads;
+        for (int w = 1; w < nworkers; ++w)
+            threads.emplace_back(worker);
+        worker();
+        for (auto&& t : threads)
+            t.join();
+        background.build();
     } else {
         // we aren't directly evaluating the background
         backgroundResolution = 0;
@@ -1054,34 +1458,142 @@ SimpleRaytracer::prepare_render()
 
 
 
+// Estimate how noisy the image is: the root mean square of the pixels'
+// standard errors of luminance, relative to the mean luminance.
+static float
+noise_level(const std::vector<SimpleRaytracer::PixelState>& pixels)
+{
+    double err2 = 0, lum = 0;
+    for (auto&& p : pixels) {
+        if (p.n > 1)
+            err2 += p.m2 / (double(p.n) * (p.n - 1));
+        lum += (p.color.x + p.color.y + p.color.z) * (1.0 / 3.0);
+    }
+    if (pixels.empty() || lum <= 0)
+        return 0.0f;
+    return float(std::sqrt(err2 / pixels.size()) / (lum / pixels.size()));
+}
+
+
+
 void
 SimpleRaytracer::render(int xres, int yres)
 {
     ShadingSystem* shadingsys = this->shadingsys;
-    OIIO::parallel_for_chunked(
-        0, yres, 0, [&, this](int64_t ybegin, int64_t yend) {
-            // Request an OSL::PerThreadInfo for this thread.
-            OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
-
-            // Request a shading context so that we can execute the shader.
-            // We could get_context/release_context for each shading point,
-            // but to save overhead, it's more efficient to reuse a context
-            // within a thread.
-            ShadingContext* ctx = shadingsys->get_context(thread_info);
+    const int ntilesx = (xres + tile_size - 1) / tile_size;
+    const int ntilesy = (yres + tile_size - 1) / tile_size;
+    const int ntiles   = ntilesx * ntilesy;
+    const int nworkers = worker_count(ntiles);
+
+    // One PerThreadInfo and ShadingContext per worker, for the whole
+    // render. We could get_context/release_context for each shading
+    // point, but it's more efficient to reuse a context within a thread.
+    std::vector<OSL::PerThreadInfo*> thread_infos(nworkers);
+    std::vector<ShadingContext*> contexts(nworkers);
+    for (int w = 0; w < nworkers; ++w) {
+        thread_infos[w] = shadingsys->create_thread_info();
+        contexts[w]     = shadingsys->get_context(thread_infos[w]);
+    }
 
-            OIIO::ImageBuf::Iterator<float> p(pixelbuf,
-                                              OIIO::ROI(0, xres, ybegin, yend));
-            for (; !p.done(); ++p) {
-                Color3 c = antialias_pixel(p.x(), p.y(), ctx);
-                p[0]     = c.x;
-                p[1]     = c.y;
-                p[2]     = c.z;
+    // Each worker starts with its own run of tiles, taking them from the
+    // front; one that runs out steals the back half of another's.
+    struct TileQueue {
+        OIIO::spin_mutex mutex;
+        int begin = 0, end = 0;
+    };
+    std::vector<TileQueue> queues(nworkers);
+    auto next_tile = [&](int w) {
+        {
+            OIIO::spin_lock lock(queues[w].mutex);
+            if (queues[w].begin < queues[w].end)
+                return queues[w].begin++;
+        }
+        for (int v = (w + 1) % nworkers; v != w; v = (v + 1) % nworkers) {
+            int begin, end;
+            {
+                OIIO::spin_lock lock(queues[v].mutex);
+                int left = queues[v].end - queues[v].begin;
+                if (left <= 0)
+                    continue;
+                end           = queues[v].end;
+                begin         = end - (left + 1) / 2;
+                queues[v].end = begin;
             }
+            OIIO::spin_lock lock(queues[w].mutex);
+            queues[w].begin = begin + 1;
+            queues[w].end   = end;
+            return begin;
+        }
+        return -1;
+    };
+
+    std::vector<PixelState> pixels(size_t(xres) * yres);
+    const int nsamples = aa * aa;
+    OIIO::Timer timer;
+    for (int pass = 0; pass < passes; ++pass) {
+        // This pass's share of the samples of every pixel
+        const int sbegin = int(int64_t(nsamples) * pass / passes);
+        const int send   = int(int64_t(nsamples) * (pass + 1) / passes);
+        for (int w = 0; w < nworkers; ++w) {
+            queues[w].begin = int(int64_t(ntiles) * w / nworkers);
+            queues[w].end   = int(int64_t(ntiles) * (w + 1) / nworkers);
+        }
+        auto worker = [&](int w) {
+            for (int tile; (tile = next_tile(w)) >= 0;) {
+                int xbegin = (tile % ntilesx) * tile_size;
+                int ybegin = (tile / ntilesx) * tile_size;
+                OIIO::ROI roi(xbegin, std::min(xbegin + tile_size, xres),
+                              ybegin, std::min(ybegin + tile_size, yres));
+#if OSL_USE_BATCHED
+                if (batch_width == 16)
+                    antialias_tile_batched<16>(roi, sbegin, send,
+                                               pixels.data(), xres,
+                                               contexts[w]);
+                else if (batch_width == 8)
+                    antialias_tile_batched<8>(roi, sbegin, send, pixels.data(),
+                                              xres, contexts[w]);
+#endif
+                OIIO::ImageBuf::Iterator<float> p(pixelbuf, roi);
+                for (; !p.done(); ++p) {
+                    PixelState& pixel(pixels[size_t(p.y()) * xres + p.x()]);
+                    if (!batch_width)
+                        antialias_pixel(p.x(), p.y(), sbegin, send, pixel,
+                                        contexts[w]);
+                    p[0] = pixel.color.x;
+                    p[1] = pixel.color.y;
+                    p[2] = pixel.color.z;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int w = 1; w < nworkers; ++w)
+            threads.emplace_back(worker, w);
+        worker(0);
+        for (auto&& t : threads)
+            t.join();
+
+        if (passes > 1 || noise_target > 0) {
+            float noise = noise_level(pixels);
+            errhandler().infofmt(
+                "Pass {}/{}: {} samples per pixel, noise {:.4g}, {}", pass + 1,
+                passes, send, noise,
+                OIIO::Strutil::timeintervalformat(timer(), 2));
+            if (noise_target > 0 && noise <= noise_target) {
+                errhandler().infofmt("Reached noise {} at {} samples per "
+                                     "pixel, in {}",
+                                     noise_target, send,
+                                     OIIO::Strutil::timeintervalformat(timer(),
+                                                                       2));
+                break;
+            }
+        }
+    }
 
-            // We're done shading with this context.
-            shadingsys->release_context(ctx);
-            shadingsys->destroy_thread_info(thread_info);
-        });
+    // We're done shading with these contexts.
+    for (int w = 0; w < nworkers; ++w) {
+        shadingsys->release_context(contexts[w]);
+        shadingsys->destroy_thread_info(thread_infos[w]);
+    }
 }
 
 
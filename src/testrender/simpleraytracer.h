@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <limits>
 #include <map>
 #include <memory>
 #include <unordered_map>
@@ -17,9 +18,15 @@
 #include "raytracer.h"
 #include "sampling.h"
 
+#if OSL_USE_BATCHED
+#    include "batched_simpleraytracer.h"
+#endif
+
 
 OSL_NAMESPACE_ENTER
 
+struct ShadingResult;
+
 
 class SimpleRaytracer : public RendererServices {
 public:
@@ -80,7 +87,17 @@ public:
                                float yon, int xres, int yres);
 
     virtual void parse_scene_xml(const std::string& scenefile);
+    void add_triangle(const Vec3& p0, const Vec3& p1, const Vec3& p2,
+                      int shaderID, bool is_light);
+    void load_obj(const std::string& filename, int shaderID, bool is_light);
     virtual void prepare_render();
+
+    // The running state of one pixel, across progressive passes
+    struct PixelState {
+        Color3 color { 0, 0, 0 };  // mean of the samples so far
+        float m2 = 0;              // sum of squared luminance deviations
+        int n    = 0;              // number of samples
+    };
     virtual void warmup() {}
     virtual void render(int xres, int yres);
     virtual void clear() {}
@@ -100,7 +117,24 @@ public:
     OIIO::ParamValueList options;
     OIIO::ImageBuf pixelbuf;
 
+#if OSL_USE_BATCHED
+    BatchedRendererServices<16>* batched(WidthOf<16>) override
+    {
+        return &m_batch_16_raytracer;
+    }
+    BatchedRendererServices<8>* batched(WidthOf<8>) override
+    {
+        return &m_batch_8_raytracer;
+    }
+#endif
+
 private:
+#if OSL_USE_BATCHED
+    BatchedSimpleRaytracer<16> m_batch_16_raytracer;
+    BatchedSimpleRaytracer<8> m_batch_8_raytracer;
+    template<int WidthT> friend class BatchedSimpleRaytracer;
+#endif
+
     // Camera parameters
     Matrix44 m_world_to_camera;
     ustring m_projection;
@@ -114,6 +148,10 @@ private:
     int max_bounces          = 1000000;
     int rr_depth             = 5;
     float show_albedo_scale  = 0.0f;
+    int passes               = 1;   // progressive passes over the image
+    int tile_size            = 16;  // width and height of a tile
+    float noise_target       = 0.0f;  // stop passes once this noisy
+    int batch_width          = 0;  // shade in batches of this many, or 0
     std::vector<ShaderGroupRef> m_shaders;
 
     class ErrorHandler;  // subclass ErrorHandler for SimpleRaytracer
@@ -169,14 +207,45 @@ private:
                                   ustringhash object, TypeDesc type,
                                   ustringhash name, void* val);
 
+    // The state of one path, carried between the steps of the integrator
+    struct PathState {
+        PathState(const Ray& ray, const Sampler& sampler)
+            : ray(ray), sampler(sampler)
+        {
+        }
+        Ray ray;
+        Sampler sampler;
+        Color3 weight { 1, 1, 1 };
+        Color3 radiance { 0, 0, 0 };
+        // camera ray has only one possible direction
+        float bsdf_pdf = std::numeric_limits<float>::infinity();
+        int prev_id    = -1;
+        int bounce     = 0;
+    };
+
     // CPU renderer helpers
     void globals_from_hit(ShaderGlobals& sg, const Ray& r,
                           const Dual2<float>& t, int id);
     Vec3 eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx,
                          int bounce = -1);
-    Color3 subpixel_radiance(float x, float y, Sampler& sampler,
+    Ray camera_ray(int x, int y, Sampler& sampler);
+    bool trace_path(PathState& path, Dual2<float>& t, int& id,
+                    ShadingContext* ctx);
+    bool scatter_path(PathState& path, const ShaderGlobals& sg,
+                      ShadingResult& result, int id, float radius,
+                      ShadingContext* ctx);
+    Color3 subpixel_radiance(const Ray& r, const Sampler& sampler,
                              ShadingContext* ctx);
-    Color3 antialias_pixel(int x, int y, ShadingContext* ctx);
+    void antialias_pixel(int x, int y, int sbegin, int send,
+                         PixelState& pixel, ShadingContext* ctx);
+#if OSL_USE_BATCHED
+    template<int WidthT>
+    void antialias_tile_batched(const OIIO::ROI& roi, int sbegin, int send,
+                                PixelState* pixels, int xres,
+                                ShadingContext* ctx);
+    template<int WidthT>
+    void eval_background_row_batched(int y, ShadingContext* ctx);
+#endif
 
     friend class ErrorHandler;
 };
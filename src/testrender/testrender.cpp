@@ -46,13 +46,18 @@ static int llvm_opt              = 1;  // LLVM optimization level
 static bool debugnan             = false;
 static bool debug_uninit         = false;
 static bool userdata_isconnected = false;
+static bool batched              = false;
+static int batch_width           = 0;  // chosen from what the target supports
 static std::string extraoptions;
 static std::string texoptions;
 static int xres = 640, yres = 480;
 static int aa = 1, max_bounces = 1000000, rr_depth = 5;
+static int passes = 1, tile_size = 16;
+static float noise_target = 0.0f;
 static float show_albedo_scale = 0.0f;
 static int num_threads         = 0;
 static int iters               = 1;
+static int scaling_threads     = -1;  // --scaling: sweep threads up to this
 static std::string scenefile, imagefile;
 static std::string shaderpath;
 static bool shadingsys_options_set = false;
@@ -87,6 +92,8 @@ set_shadingsys_options()
     shadingsys->attribute("llvm_optimize", llvm_opt);
 
     shadingsys->attribute("profile", int(profile));
+    if (scaling_threads >= 0)
+        shadingsys->attribute("lock_stats", 1);
     shadingsys->attribute("debug_nan", debugnan);
     shadingsys->attribute("debug_uninit", debug_uninit);
     shadingsys->attribute("userdata_isconnected", userdata_isconnected);
@@ -100,6 +107,30 @@ set_shadingsys_options()
     shadingsys->attribute("llvm_debugging_symbols", 1);
     shadingsys->attribute("llvm_profiling_events", 1);
 
+    // For batched allow FMA if build of OSL supports it
+    shadingsys->attribute("llvm_jit_fma", int(batched));
+    batch_width = 0;
+    if (batched && !use_optix) {
+#if OSL_USE_BATCHED
+        if (shadingsys->configure_batch_execution_at(16))
+            batch_width = 16;
+        else if (shadingsys->configure_batch_execution_at(8))
+            batch_width = 8;
+        else
+            OSL::print(
+                "WARNING: Hardware or library requirements to utilize batched "
+                "execution are not met, ignoring --batched\n");
+#else
+        OSL::print("WARNING: OSL was built without batched execution, "
+                   "ignoring --batched\n");
+#endif
+    }
+    if (!batch_width) {
+        // Uniform and varying temps don't coalesce with each other when
+        // batched analysis is enabled, so only do it if we need it.
+        shadingsys->attribute("opt_batched_analysis", 0);
+    }
+
     // We rely on the default set of "raytypes" tags. To use a custom set,
     // this is where we would do:
     //      shadingsys->attribute("raytypes", TypeDesc(TypeDesc::STRING, num_raytypes),
@@ -133,6 +164,8 @@ getargs(int argc, const char* argv[])
       .help("Set resolution");
     ap.arg("--optix", &use_optix)
       .help("Use OptiX if available");
+    ap.arg("--batched", &batched)
+      .help("Shade the hits of each bounce in batches (CPU only)");
     ap.arg("--debug", &debug1)
       .help("Lots of debugging info");
     ap.arg("--debug2", &debug2)
@@ -153,10 +186,18 @@ getargs(int argc, const char* argv[])
       .hidden();
     ap.arg("-aa %d:N", &aa)
       .help("Trace NxN rays per pixel");
+    ap.arg("--passes %d:N", &passes)
+      .help("Render the -aa samples progressively, in N passes");
+    ap.arg("--noise %f:LEVEL", &noise_target)
+      .help("Stop the passes once the relative noise is at most LEVEL");
+    ap.arg("--tile %d:N", &tile_size)
+      .help("Render in NxN pixel tiles (default: 16)");
     ap.arg("-albedo %f:SCALE", &show_albedo_scale)
       .help("Visualize the albedo of each pixel instead of path tracing");
     ap.arg("--iters %d:N", &iters)
       .help("Number of iterations");
+    ap.arg("--scaling %d:MAXTHREADS", &scaling_threads)
+      .help("Also time renders with 1, 2, 4, ... MAXTHREADS threads (0 = all cores)");
     ap.arg("-O0", &O0)
       .help("Do no runtime shader optimization");
     ap.arg("-O1", &O1)
@@ -197,6 +238,62 @@ getargs(int argc, const char* argv[])
     }
 }
 
+
+
+// Time all threads spent waiting for the shading system's shared locks
+static void
+lock_waits(double waits[4])
+{
+    static const char* stats[] = { "stat:opt_locking_time",
+                                   "stat:masters_lock_time",
+                                   "stat:dictionary_lock_time",
+                                   "stat:pointcloud_lock_time" };
+    for (int i = 0; i < 4; ++i) {
+        waits[i] = 0.0;
+        shadingsys->getattribute(stats[i], waits[i]);
+    }
+}
+
+
+
+// --scaling: render with 1, 2, 4, ... threads up to maxthreads, each
+// count after an untimed render with it, and report the speedup and
+// efficiency over one thread and the time waited for each lock.
+static void
+scaling_report(SimpleRaytracer* rend, int maxthreads)
+{
+    std::vector<int> counts;
+    for (int t = 1; t < maxthreads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxthreads);
+
+    OSL::print("\nThread scaling:\n");
+    OSL::print("  {:>7} {:>10} {:>8} {:>6}   lock waits, all threads: {:>10} "
+               "{:>10} {:>10} {:>10}\n",
+               "threads", "time", "speedup", "eff", "optimize", "masters",
+               "dictionary", "pointcloud");
+    double time1 = 0.0;
+    for (int nthreads : counts) {
+        OIIO::attribute("threads", nthreads);
+        rend->render(xres, yres);
+        double before[4], after[4];
+        lock_waits(before);
+        OIIO::Timer timer;
+        rend->render(xres, yres);
+        double time = timer();
+        lock_waits(after);
+        if (nthreads == 1)
+            time1 = time;
+        double speedup = time > 0.0 ? time1 / time : 0.0;
+        OSL::print("  {:>7} {:>10.6f} {:>8.2f} {:>5.0f}%   {:>35.6f} {:>10.6f} "
+                   "{:>10.6f} {:>10.6f}\n",
+                   nthreads, time, speedup, 100.0 * speedup / nthreads,
+                   after[0] - before[0], after[1] - before[1],
+                   after[2] - before[2], after[3] - before[3]);
+    }
+    OIIO::attribute("threads", num_threads);
+}
+
 }  // anonymous namespace
 
 
@@ -248,6 +345,9 @@ main(int argc, const char* argv[])
     rend->attribute("max_bounces", max_bounces);
     rend->attribute("rr_depth", rr_depth);
     rend->attribute("aa", aa);
+    rend->attribute("passes", passes);
+    rend->attribute("tile_size", tile_size);
+    rend->attribute("noise_target", noise_target);
     rend->attribute("show_albedo_scale", show_albedo_scale);
     OIIO::attribute("threads", num_threads);
 
@@ -266,6 +366,7 @@ main(int argc, const char* argv[])
 
     // Setup common attributes
     set_shadingsys_options();
+    rend->attribute("batched", batch_width);
 
 #if OSL_USE_OPTIX
     if (use_optix)
@@ -310,6 +411,14 @@ main(int argc, const char* argv[])
                                     rend->pixelbuf.geterror());
     double writetime = timer.lap();
 
+    // After writing the image, which the extra renders would change
+    if (scaling_threads >= 0 && !use_optix) {
+        int maxthreads = scaling_threads;
+        if (maxthreads == 0)
+            maxthreads = OIIO::Sysutil::hardware_concurrency();
+        scaling_report(rend, maxthreads);
+    }
+
     // Print some debugging info
     if (debug1 || runstats || profile) {
         std::cout << "\n";
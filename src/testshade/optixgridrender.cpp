@@ -2,9 +2,12 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <mutex>
 #include <vector>
 
 #include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/parallel.h>
 #include <OpenImageIO/sysutil.h>
 
 #include <OSL/oslconfig.h>
@@ -90,17 +93,91 @@ OptixGridRenderer::OptixGridRenderer()
     // Initialize CUDA
     cudaFree(0);
 
+    OPTIX_CHECK(optixInit());
+    // The devices get their contexts in init_optix_context, once the
+    // "gpus" option says how many to use.
+}
+
+
+
+// Set up the next device to render on: its CUDA stream and OptiX context,
+// and the buffers the launch parameters point to.
+void
+OptixGridRenderer::init_device(int id)
+{
+    m_devices.emplace_back();
+    Device& dev(m_devices.back());
+    dev.id = id;
+    CUDA_CHECK(cudaSetDevice(id));
+    cudaDeviceProp prop;
+    if (cudaGetDeviceProperties(&prop, id) == cudaSuccess)
+        dev.name = prop.name;
+    CUDA_CHECK(cudaFree(0));
     CUcontext cuCtx = nullptr;  // zero means take the current context
 
     OptixDeviceContextOptions ctx_options = {};
     ctx_options.logCallbackFunction       = context_log_cb;
     ctx_options.logCallbackLevel          = 4;
 
-    OPTIX_CHECK(optixInit());
-    OPTIX_CHECK(optixDeviceContextCreate(cuCtx, &ctx_options, &m_optix_ctx));
+    OPTIX_CHECK(optixDeviceContextCreate(cuCtx, &ctx_options, &dev.ctx));
+    // OptiX keeps the modules it creates in a disk cache of its own, keyed
+    // by their PTX and compile options, unless OPTIX_CACHE_MAXSIZE=0 turns
+    // it off (OPTIX_CACHE_PATH moves it).  With the "jit_cache_dir" option
+    // also caching the groups' PTX, a warm start compiles nothing at all.
+
+    CUDA_CHECK(cudaStreamCreate(&dev.stream));
+    CUDA_CHECK(cudaEventCreate(&dev.start));
+    CUDA_CHECK(cudaEventCreate(&dev.stop));
+
+    auto upload = [&](const void* data, size_t size) {
+        CUdeviceptr d_ptr = 0;
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_ptr), size));
+        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_ptr), data, size,
+                              cudaMemcpyHostToDevice));
+        dev.ptrs_to_free.push_back(reinterpret_cast<void*>(d_ptr));
+        return d_ptr;
+    };
 
-    CUDA_CHECK(cudaSetDevice(0));
-    CUDA_CHECK(cudaStreamCreate(&m_cuda_stream));
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&dev.d_osl_printf_buffer),
+                          OSL_PRINTF_BUFFER_SIZE));
+    CUDA_CHECK(cudaMemset(reinterpret_cast<void*>(dev.d_osl_printf_buffer), 0,
+                          OSL_PRINTF_BUFFER_SIZE));
+    dev.ptrs_to_free.push_back(
+        reinterpret_cast<void*>(dev.d_osl_printf_buffer));
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&dev.d_launch_params),
+                          sizeof(RenderParams)));
+    dev.ptrs_to_free.push_back(reinterpret_cast<void*>(dev.d_launch_params));
+
+    // Transforms
+    dev.d_object2common     = upload(&m_object2common, sizeof(OSL::Matrix44));
+    dev.d_shader2common     = upload(&m_shader2common, sizeof(OSL::Matrix44));
+    dev.d_xform_name_buffer = upload(m_xform_names.data(),
+                                     sizeof(uint64_t) * m_xform_names.size());
+    dev.d_xform_buffer      = upload(m_xforms.data(),
+                                     sizeof(OSL::Matrix44) * m_xforms.size());
+}
+
+
+
+void
+OptixGridRenderer::destroy_device(Device& dev)
+{
+    CUDA_CHECK(cudaSetDevice(dev.id));
+    for (void* p : dev.ptrs_to_free)
+        cudaFree(p);
+    dev.ptrs_to_free.clear();
+    if (dev.d_output_buffer)
+        cudaFree(reinterpret_cast<void*>(dev.d_output_buffer));
+    dev.d_output_buffer = 0;
+    dev.output_size     = 0;
+    if (dev.start)
+        cudaEventDestroy(dev.start);
+    if (dev.stop)
+        cudaEventDestroy(dev.stop);
+    dev.start = dev.stop = nullptr;
+    if (dev.ctx)
+        OPTIX_CHECK(optixDeviceContextDestroy(dev.ctx));
+    dev.ctx = nullptr;
 }
 
 
@@ -133,6 +210,77 @@ OptixGridRenderer::fetch_global(const std::string& str, uint64_t* value)
 
 
 
+// Create an OptiX module from each of the PTX strings.  With the task API,
+// the compile of every module is split into tasks, and the tasks of all
+// the modules (with the subtasks they spawn) run across the cores of the
+// thread pool, rather than one module being compiled after another.
+static std::vector<OptixModule>
+create_optix_modules(OptixDeviceContext optix_ctx,
+                     const OptixModuleCompileOptions* module_options,
+                     const OptixPipelineCompileOptions* pipeline_options,
+                     const std::vector<std::string>& ptx,
+                     const std::vector<std::string>& names)
+{
+    std::vector<OptixModule> modules(ptx.size());
+    char msg_log[8192];
+    size_t sizeof_msg_log;
+#if OPTIX_VERSION >= 70400
+    std::vector<OptixTask> tasks(ptx.size());
+    for (size_t i = 0; i < ptx.size(); ++i) {
+        sizeof_msg_log = sizeof(msg_log);
+        OPTIX_CHECK_MSG(optixModuleCreateFromPTXWithTasks(
+                            optix_ctx, module_options, pipeline_options,
+                            ptx[i].c_str(), ptx[i].size(), msg_log,
+                            &sizeof_msg_log, &modules[i], &tasks[i]),
+                        fmtformat("Creating module for PTX group {}: {}",
+                                  names[i], msg_log));
+    }
+
+    // A task's subtasks may only run once it has, so run the tasks a
+    // generation at a time, each generation in parallel.
+    const unsigned int max_subtasks = std::max(
+        OIIO::Sysutil::hardware_concurrency(), 1u);
+    std::mutex spawned_mutex;
+    while (!tasks.empty()) {
+        std::vector<OptixTask> spawned;
+        OIIO::parallel_for(size_t(0), tasks.size(), [&](size_t t) {
+            std::vector<OptixTask> subtasks(max_subtasks);
+            unsigned int nsubtasks = 0;
+            OPTIX_CHECK(optixTaskExecute(tasks[t], subtasks.data(),
+                                         max_subtasks, &nsubtasks));
+            std::lock_guard<std::mutex> lock(spawned_mutex);
+            spawned.insert(spawned.end(), subtasks.begin(),
+                           subtasks.begin() + nsubtasks);
+        });
+        tasks.swap(spawned);
+    }
+
+    for (size_t i = 0; i < modules.size(); ++i) {
+        OptixModuleCompileState state;
+        OPTIX_CHECK(optixModuleGetCompilationState(modules[i], &state));
+        if (state != OPTIX_MODULE_COMPILE_STATE_COMPLETED) {
+            print(stderr, "[OPTIX ERROR] Compiling module for PTX group {}"
+                  " failed\n", names[i]);
+            exit(1);
+        }
+    }
+#else
+    for (size_t i = 0; i < ptx.size(); ++i) {
+        sizeof_msg_log = sizeof(msg_log);
+        OPTIX_CHECK_MSG(optixModuleCreateFromPTX(optix_ctx, module_options,
+                                                 pipeline_options,
+                                                 ptx[i].c_str(), ptx[i].size(),
+                                                 msg_log, &sizeof_msg_log,
+                                                 &modules[i]),
+                        fmtformat("Creating module for PTX group {}: {}",
+                                  names[i], msg_log));
+    }
+#endif
+    return modules;
+}
+
+
+
 std::string
 OptixGridRenderer::load_ptx_file(string_view filename)
 {
@@ -154,10 +302,14 @@ OptixGridRenderer::load_ptx_file(string_view filename)
 
 OptixGridRenderer::~OptixGridRenderer()
 {
-    for (void* p : m_ptrs_to_free)
-        cudaFree(p);
-    if (m_optix_ctx)
-        OPTIX_CHECK(optixDeviceContextDestroy(m_optix_ctx));
+    if (!m_devices.empty()) {
+        // The textures are all on the first device
+        CUDA_CHECK(cudaSetDevice(m_devices[0].id));
+        for (cudaMipmappedArray_t a : m_arrays_to_free)
+            cudaFreeMipmappedArray(a);
+    }
+    for (Device& dev : m_devices)
+        destroy_device(dev);
 }
 
 
@@ -174,6 +326,14 @@ bool
 OptixGridRenderer::init_optix_context(int xres OSL_MAYBE_UNUSED,
                                       int yres OSL_MAYBE_UNUSED)
 {
+    // Render on the first "gpus" devices, or on all of them if it's 0
+    int ndevices = 0;
+    CUDA_CHECK(cudaGetDeviceCount(&ndevices));
+    int gpus = options.get_int("gpus");
+    if (gpus > 0)
+        ndevices = std::min(ndevices, gpus);
+    for (int id = 0; id < std::max(ndevices, 1); ++id)
+        init_device(id);
     return true;
 }
 
@@ -211,44 +371,22 @@ OptixGridRenderer::synch_attributes()
         const size_t podDataSize = cpuDataSize
                                    - sizeof(StringParam) * numStrings;
 
-        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_color_system),
-                              podDataSize + sizeof(uint64_t) * numStrings));
-        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_color_system), colorSys,
-                              podDataSize, cudaMemcpyHostToDevice));
-        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_osl_printf_buffer),
-                              OSL_PRINTF_BUFFER_SIZE));
-        CUDA_CHECK(cudaMemset(reinterpret_cast<void*>(d_osl_printf_buffer), 0,
-                              OSL_PRINTF_BUFFER_SIZE));
-
-        // Transforms
-        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_object2common),
-                              sizeof(OSL::Matrix44)));
-        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_object2common),
-                              &m_object2common, sizeof(OSL::Matrix44),
-                              cudaMemcpyHostToDevice));
-        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_shader2common),
-                              sizeof(OSL::Matrix44)));
-        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_shader2common),
-                              &m_shader2common, sizeof(OSL::Matrix44),
-                              cudaMemcpyHostToDevice));
-
-        m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_color_system));
-        m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_osl_printf_buffer));
-
-        // then copy the device string to the end, first strings starting at dataPtr - (numStrings)
-        // FIXME -- Should probably handle alignment better.
-        const ustring* cpuString
-            = (const ustring*)(colorSys
-                               + (cpuDataSize
-                                  - sizeof(StringParam) * numStrings));
-        CUdeviceptr gpuStrings = d_color_system + podDataSize;
+        // Keep a copy laid out for the device, with the strings hashed,
+        // to copy into the launch parameters.
+        m_color_system.assign(colorSys, colorSys + podDataSize);
+        const ustring* cpuString = (const ustring*)(colorSys + podDataSize);
         for (const ustring* end = cpuString + numStrings; cpuString < end;
              ++cpuString) {
             // convert the ustring to a device string
             uint64_t devStr = cpuString->hash();
-            CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(gpuStrings), &devStr,
-                                  sizeof(devStr), cudaMemcpyHostToDevice));
-            gpuStrings += sizeof(DeviceString);
+            m_color_system.insert(m_color_system.end(), (const char*)&devStr,
+                                  (const char*)&devStr + sizeof(devStr));
+        }
+        if (m_color_system.size() > RENDER_PARAMS_COLOR_SYSTEM_SIZE) {
+            errhandler().errorfmt(
+                "The colorsystem ({} bytes) doesn't fit in RenderParams",
+                m_color_system.size());
+            return false;
         }
     }
     return true;
@@ -262,12 +400,85 @@ OptixGridRenderer::make_optix_materials()
     // Stand-in: names of shader outputs to preserve
     // FIXME
     std::vector<const char*> outputs { "Cout" };
-
-    // Optimize each ShaderGroup in the scene, and use the resulting
-    // PTX to create OptiX Programs which can be called by the closest
-    // hit program in the wrapper to execute the compiled OSL shader.
     int mtl_id = 0;
 
+    // Optimize all the groups, generating their PTX, in parallel.  The
+    // texture objects they resolve are made on the first device.
+    CUDA_CHECK(cudaSetDevice(m_devices[0].id));
+    for (const auto& groupref : shaders())
+        shadingsys->attribute(groupref.get(), "renderer_outputs",
+                              TypeDesc(TypeDesc::STRING, outputs.size()),
+                              outputs.data());
+    shadingsys->optimize_all_groups();
+
+    // Retrieve the compiled ShaderGroup PTX
+    std::vector<std::string> group_ptx, group_names;
+    for (const auto& groupref : shaders()) {
+        if (!shadingsys->find_symbol(*groupref.get(), ustring(outputs[0]))) {
+            // FIXME: This is for cases where testshade is run with 1x1 resolution
+            //        Those tests may not have a Cout parameter to write to.
+            if (m_xres > 1 && m_yres > 1) {
+                errhandler().warningfmt(
+                    "Requested output '{}', which wasn't found", outputs[0]);
+            }
+        }
+
+        std::string group_name;
+        shadingsys->getattribute(groupref.get(), "groupname", group_name);
+
+        std::string osl_ptx;
+        shadingsys->getattribute(groupref.get(), "ptx_compiled_version",
+                                 OSL::TypeDesc::PTR, &osl_ptx);
+
+        if (osl_ptx.empty()) {
+            errhandler().errorfmt("Failed to generate PTX for ShaderGroup {}",
+                                  group_name);
+            return false;
+        }
+
+        if (options.get_int("saveptx")) {
+            std::string filename
+                = OIIO::Strutil::fmt::format("{}_{}.ptx", group_name, mtl_id++);
+            OIIO::ofstream out;
+            OIIO::Filesystem::open(out, filename);
+            out << osl_ptx;
+        }
+
+        group_ptx.push_back(std::move(osl_ptx));
+        group_names.push_back(std::move(group_name));
+    }
+
+    // Texture handles are device texture objects, baked into the PTX, so
+    // only the device that made them can run it.
+    if (m_devices.size() > 1 && !m_samplers.empty()) {
+        errhandler().warningfmt(
+            "The shaders use textures, rendering on 1 device of {}",
+            m_devices.size());
+        for (size_t d = 1; d < m_devices.size(); ++d)
+            destroy_device(m_devices[d]);
+        m_devices.resize(1);
+    }
+
+    // The PTX is compiled into modules and linked into a pipeline for
+    // each device
+    for (Device& dev : m_devices)
+        if (!make_optix_pipeline(dev, group_ptx, group_names))
+            return false;
+    return true;
+}
+
+
+
+bool
+OptixGridRenderer::make_optix_pipeline(
+    Device& dev, const std::vector<std::string>& group_ptx,
+    const std::vector<std::string>& group_names)
+{
+    CUDA_CHECK(cudaSetDevice(dev.id));
+
+    // Use the PTX of each ShaderGroup to create OptiX Programs which can
+    // be called by the closest hit program in the wrapper to execute the
+    // compiled OSL shader.
     std::vector<OptixModule> modules;
 
     // Space for message logging
@@ -309,7 +520,7 @@ OptixGridRenderer::make_optix_materials()
 
     sizeof_msg_log = sizeof(msg_log);
     OptixModule program_module;
-    OPTIX_CHECK_MSG(optixModuleCreateFromPTX(m_optix_ctx,
+    OPTIX_CHECK_MSG(optixModuleCreateFromPTX(dev.ctx,
                                              &module_compile_options,
                                              &pipeline_compile_options,
                                              program_ptx.c_str(),
@@ -331,7 +542,7 @@ OptixGridRenderer::make_optix_materials()
 
     OptixProgramGroup raygen_group;
     sizeof_msg_log = sizeof(msg_log);
-    OPTIX_CHECK_MSG(optixProgramGroupCreate(m_optix_ctx, &raygen_desc,
+    OPTIX_CHECK_MSG(optixProgramGroupCreate(dev.ctx, &raygen_desc,
                                             1,  // number of program groups
                                             &program_options,  // program options
                                             msg_log, &sizeof_msg_log,
@@ -347,7 +558,7 @@ OptixGridRenderer::make_optix_materials()
     OptixProgramGroup setglobals_raygen_group;
     sizeof_msg_log = sizeof(msg_log);
     OPTIX_CHECK_MSG(optixProgramGroupCreate(
-                        m_optix_ctx, &setglobals_raygen_desc,
+                        dev.ctx, &setglobals_raygen_desc,
                         1,                 // number of program groups
                         &program_options,  // program options
                         msg_log, &sizeof_msg_log, &setglobals_raygen_group),
@@ -361,7 +572,7 @@ OptixGridRenderer::make_optix_materials()
 
     OptixProgramGroup miss_group;
     sizeof_msg_log = sizeof(msg_log);
-    OPTIX_CHECK_MSG(optixProgramGroupCreate(m_optix_ctx, &miss_desc, 1,
+    OPTIX_CHECK_MSG(optixProgramGroupCreate(dev.ctx, &miss_desc, 1,
                                             &program_options, msg_log,
                                             &sizeof_msg_log, &miss_group),
                     fmtformat("Creating 'miss' program group: {}", msg_log));
@@ -374,7 +585,7 @@ OptixGridRenderer::make_optix_materials()
 
     OptixProgramGroup setglobals_miss_group;
     sizeof_msg_log = sizeof(msg_log);
-    OPTIX_CHECK_MSG(optixProgramGroupCreate(m_optix_ctx, &setglobals_miss_desc,
+    OPTIX_CHECK_MSG(optixProgramGroupCreate(dev.ctx, &setglobals_miss_desc,
                                             1, &program_options, msg_log,
                                             &sizeof_msg_log,
                                             &setglobals_miss_group),
@@ -393,7 +604,7 @@ OptixGridRenderer::make_optix_materials()
 
     sizeof_msg_log = sizeof(msg_log);
     OPTIX_CHECK_MSG(
-        optixProgramGroupCreate(m_optix_ctx, &hitgroup_desc,
+        optixProgramGroupCreate(dev.ctx, &hitgroup_desc,
                                 1,                 // number of program groups
                                 &program_options,  // program options
                                 msg_log, &sizeof_msg_log, &hitgroup_group),
@@ -410,7 +621,7 @@ OptixGridRenderer::make_optix_materials()
     // Create support library program group
     sizeof_msg_log = sizeof(msg_log);
     OptixModule rend_lib_module;
-    OPTIX_CHECK_MSG(optixModuleCreateFromPTX(m_optix_ctx,
+    OPTIX_CHECK_MSG(optixModuleCreateFromPTX(dev.ctx,
                                              &module_compile_options,
                                              &pipeline_compile_options,
                                              rend_lib_ptx.c_str(),
@@ -432,67 +643,26 @@ OptixGridRenderer::make_optix_materials()
     OptixProgramGroup rend_lib_group;
     sizeof_msg_log = sizeof(msg_log);
     OPTIX_CHECK_MSG(
-        optixProgramGroupCreate(m_optix_ctx, &rend_lib_desc,
+        optixProgramGroupCreate(dev.ctx, &rend_lib_desc,
                                 1,                 // number of program groups
                                 &program_options,  // program options
                                 msg_log, &sizeof_msg_log, &rend_lib_group),
         fmtformat("Creating 'hitgroup' program group: {}", msg_log));
 
-    // Create materials
-    for (const auto& groupref : shaders()) {
-        shadingsys->attribute(groupref.get(), "renderer_outputs",
-                              TypeDesc(TypeDesc::STRING, outputs.size()),
-                              outputs.data());
-
-        shadingsys->optimize_group(groupref.get(), nullptr);
+    std::vector<OptixModule> group_modules
+        = create_optix_modules(dev.ctx, &module_compile_options,
+                               &pipeline_compile_options, group_ptx,
+                               group_names);
 
-        if (!shadingsys->find_symbol(*groupref.get(), ustring(outputs[0]))) {
-            // FIXME: This is for cases where testshade is run with 1x1 resolution
-            //        Those tests may not have a Cout parameter to write to.
-            if (m_xres > 1 && m_yres > 1) {
-                errhandler().warningfmt(
-                    "Requested output '{}', which wasn't found", outputs[0]);
-            }
-        }
-
-        std::string group_name, init_name, entry_name;
-        shadingsys->getattribute(groupref.get(), "groupname", group_name);
+    // Create materials
+    for (size_t g = 0; g < group_modules.size(); ++g) {
+        const auto& groupref          = shaders()[g];
+        const std::string& group_name = group_names[g];
+        OptixModule optix_module      = group_modules[g];
+        std::string init_name, entry_name;
         shadingsys->getattribute(groupref.get(), "group_init_name", init_name);
         shadingsys->getattribute(groupref.get(), "group_entry_name",
                                  entry_name);
-
-        // Retrieve the compiled ShaderGroup PTX
-        std::string osl_ptx;
-        shadingsys->getattribute(groupref.get(), "ptx_compiled_version",
-                                 OSL::TypeDesc::PTR, &osl_ptx);
-
-        if (osl_ptx.empty()) {
-            errhandler().errorfmt("Failed to generate PTX for ShaderGroup {}",
-                                  group_name);
-            return false;
-        }
-
-        if (options.get_int("saveptx")) {
-            std::string filename
-                = OIIO::Strutil::fmt::format("{}_{}.ptx", group_name, mtl_id++);
-            OIIO::ofstream out;
-            OIIO::Filesystem::open(out, filename);
-            out << osl_ptx;
-        }
-
-        OptixModule optix_module;
-
-        // Create Programs from the init and group_entry functions,
-        // and set the OSL functions as Callable Programs so that they
-        // can be executed by the closest hit program in the wrapper
-        sizeof_msg_log = sizeof(msg_log);
-        OPTIX_CHECK_MSG(
-            optixModuleCreateFromPTX(m_optix_ctx, &module_compile_options,
-                                     &pipeline_compile_options, osl_ptx.c_str(),
-                                     osl_ptx.size(), msg_log, &sizeof_msg_log,
-                                     &optix_module),
-            fmtformat("Creating Module from PTX-file {}", msg_log));
-
         modules.push_back(optix_module);
 
         // Create 2x program groups (for direct callables)
@@ -513,7 +683,7 @@ OptixGridRenderer::make_optix_materials()
 
         sizeof_msg_log = sizeof(msg_log);
         OPTIX_CHECK_MSG(
-            optixProgramGroupCreate(m_optix_ctx, &pgDesc[0],
+            optixProgramGroupCreate(dev.ctx, &pgDesc[0],
                                     2,  // number of program groups
                                     &program_options,  // program options
                                     msg_log, &sizeof_msg_log,
@@ -539,11 +709,11 @@ OptixGridRenderer::make_optix_materials()
     };
 
     sizeof_msg_log = sizeof(msg_log);
-    OPTIX_CHECK_MSG(optixPipelineCreate(m_optix_ctx, &pipeline_compile_options,
+    OPTIX_CHECK_MSG(optixPipelineCreate(dev.ctx, &pipeline_compile_options,
                                         &pipeline_link_options,
                                         final_groups.data(),
                                         int(final_groups.size()), msg_log,
-                                        &sizeof_msg_log, &m_optix_pipeline),
+                                        &sizeof_msg_log, &dev.pipeline),
                     fmtformat("Creating optix pipeline: {}", msg_log));
 
     // Set the pipeline stack size
@@ -564,7 +734,7 @@ OptixGridRenderer::make_optix_materials()
 
     const uint32_t max_traversal_depth = 1;
     OPTIX_CHECK(optixPipelineSetStackSize(
-        m_optix_pipeline, direct_callable_stack_size_from_traversal,
+        dev.pipeline, direct_callable_stack_size_from_traversal,
         direct_callable_stack_size_from_state, continuation_stack_size,
         max_traversal_depth));
 
@@ -612,13 +782,14 @@ OptixGridRenderer::make_optix_materials()
     CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_setglobals_missRecord),
                           sizeof(EmptyRecord)));
 
-    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_raygenRecord));
-    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_missRecord));
-    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_hitgroupRecord));
-    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_callablesRecord));
-    m_ptrs_to_free.push_back(
+    dev.ptrs_to_free.push_back(reinterpret_cast<void*>(d_raygenRecord));
+    dev.ptrs_to_free.push_back(reinterpret_cast<void*>(d_missRecord));
+    dev.ptrs_to_free.push_back(reinterpret_cast<void*>(d_hitgroupRecord));
+    dev.ptrs_to_free.push_back(reinterpret_cast<void*>(d_callablesRecord));
+    dev.ptrs_to_free.push_back(
         reinterpret_cast<void*>(d_setglobals_raygenRecord));
-    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_setglobals_missRecord));
+    dev.ptrs_to_free.push_back(
+        reinterpret_cast<void*>(d_setglobals_missRecord));
 
     CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_raygenRecord),
                           &raygenRecord, sizeof(EmptyRecord),
@@ -639,23 +810,23 @@ OptixGridRenderer::make_optix_materials()
                           cudaMemcpyHostToDevice));
 
     // Looks like OptixShadingTable needs to be filled out completely
-    m_optix_sbt.raygenRecord                 = d_raygenRecord;
-    m_optix_sbt.missRecordBase               = d_missRecord;
-    m_optix_sbt.missRecordStrideInBytes      = sizeof(EmptyRecord);
-    m_optix_sbt.missRecordCount              = 1;
-    m_optix_sbt.hitgroupRecordBase           = d_hitgroupRecord;
-    m_optix_sbt.hitgroupRecordStrideInBytes  = sizeof(EmptyRecord);
-    m_optix_sbt.hitgroupRecordCount          = 1;
-    m_optix_sbt.callablesRecordBase          = d_callablesRecord;
-    m_optix_sbt.callablesRecordStrideInBytes = sizeof(EmptyRecord);
-    m_optix_sbt.callablesRecordCount         = 2;
+    dev.sbt.raygenRecord                 = d_raygenRecord;
+    dev.sbt.missRecordBase               = d_missRecord;
+    dev.sbt.missRecordStrideInBytes      = sizeof(EmptyRecord);
+    dev.sbt.missRecordCount              = 1;
+    dev.sbt.hitgroupRecordBase           = d_hitgroupRecord;
+    dev.sbt.hitgroupRecordStrideInBytes  = sizeof(EmptyRecord);
+    dev.sbt.hitgroupRecordCount          = 1;
+    dev.sbt.callablesRecordBase          = d_callablesRecord;
+    dev.sbt.callablesRecordStrideInBytes = sizeof(EmptyRecord);
+    dev.sbt.callablesRecordCount         = 2;
 
     // Shader binding table for SetGlobals stage
-    m_setglobals_optix_sbt                         = {};
-    m_setglobals_optix_sbt.raygenRecord            = d_setglobals_raygenRecord;
-    m_setglobals_optix_sbt.missRecordBase          = d_setglobals_missRecord;
-    m_setglobals_optix_sbt.missRecordStrideInBytes = sizeof(EmptyRecord);
-    m_setglobals_optix_sbt.missRecordCount         = 1;
+    dev.setglobals_sbt                         = {};
+    dev.setglobals_sbt.raygenRecord            = d_setglobals_raygenRecord;
+    dev.setglobals_sbt.missRecordBase          = d_setglobals_missRecord;
+    dev.setglobals_sbt.missRecordStrideInBytes = sizeof(EmptyRecord);
+    dev.setglobals_sbt.missRecordCount         = 1;
     return true;
 }
 
@@ -670,6 +841,64 @@ OptixGridRenderer::finalize_scene()
 
 
 
+// The MIP levels of the texture in image, 4 float channels per texel, down
+// to 1x1 as CUDA mipmapped arrays have them.  Levels the file has (e.g.
+// made by maketx) are read if they're the expected size; the others are
+// box filtered down from the level above.
+static std::vector<std::vector<float>>
+texture_mip_levels(OIIO::ImageBuf& image, int& width, int& height)
+{
+    OIIO::ROI roi = OIIO::get_roi_full(image.spec());
+    width         = roi.width();
+    height        = roi.height();
+    std::vector<std::vector<float>> levels;
+    for (int m = 0, w = width, h = height;; ++m) {
+        std::vector<float> pixels(size_t(w) * h * 4, 0.0f);
+        OIIO::ImageBuf file_level;
+        OIIO::ImageBuf* level = m == 0 ? &image : nullptr;
+        if (m && m < image.nmiplevels()
+            && file_level.init_spec(image.name(), 0, m)
+            && file_level.spec().full_width == w
+            && file_level.spec().full_height == h)
+            level = &file_level;
+        if (level) {
+            OIIO::ROI lroi = OIIO::get_roi_full(level->spec());
+            for (int j = 0; j < h; j++)
+                for (int i = 0; i < w; i++)
+                    level->getpixel(lroi.xbegin + i, lroi.ybegin + j, 0,
+                                    &pixels[(size_t(j) * w + i) * 4], 4);
+        } else {
+            // Average the 2x2 texels above, or fewer at an odd edge
+            const std::vector<float>& above(levels.back());
+            int aw = std::max(width >> (m - 1), 1);
+            int ah = std::max(height >> (m - 1), 1);
+            for (int j = 0; j < h; j++) {
+                for (int i = 0; i < w; i++) {
+                    float* out = &pixels[(size_t(j) * w + i) * 4];
+                    int n      = 0;
+                    for (int y = 2 * j; y < std::min(2 * j + 2, ah); y++)
+                        for (int x = 2 * i; x < std::min(2 * i + 2, aw); x++) {
+                            const float* in = &above[(size_t(y) * aw + x) * 4];
+                            for (int c = 0; c < 4; c++)
+                                out[c] += in[c];
+                            ++n;
+                        }
+                    for (int c = 0; c < 4; c++)
+                        out[c] /= float(n);
+                }
+            }
+        }
+        levels.push_back(std::move(pixels));
+        if (w == 1 && h == 1)
+            break;
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+    }
+    return levels;
+}
+
+
+
 /// Return true if the texture handle (previously returned by
 /// get_texture_handle()) is a valid texture that can be subsequently
 /// read or sampled.
@@ -698,33 +927,34 @@ OptixGridRenderer::get_texture_handle(ustringhash filename,
             return (TextureHandle*)nullptr;
         }
 
-        OIIO::ROI roi = OIIO::get_roi_full(image.spec());
-        int32_t width = roi.width(), height = roi.height();
-        std::vector<float> pixels(width * height * 4);
-
-        for (int j = 0; j < height; j++) {
-            for (int i = 0; i < width; i++) {
-                image.getpixel(i, j, 0, &pixels[((j * width) + i) * 4 + 0]);
-            }
-        }
-        cudaResourceDesc res_desc = {};
+        int width, height;
+        std::vector<std::vector<float>> levels
+            = texture_mip_levels(image, width, height);
+        int nlevels = int(levels.size());
 
         // hard-code textures to 4 channels
-        int32_t pitch = width * 4 * sizeof(float);
         cudaChannelFormatDesc channel_desc
             = cudaCreateChannelDesc(32, 32, 32, 32, cudaChannelFormatKindFloat);
 
-        cudaArray_t pixelArray;
-        CUDA_CHECK(cudaMallocArray(&pixelArray, &channel_desc, width, height));
-
-        m_ptrs_to_free.push_back(reinterpret_cast<void*>(pixelArray));
-
-        CUDA_CHECK(cudaMemcpy2DToArray(pixelArray,
-                                       /* offset */ 0, 0, pixels.data(), pitch,
-                                       pitch, height, cudaMemcpyHostToDevice));
+        cudaMipmappedArray_t mipmapped;
+        CUDA_CHECK(cudaMallocMipmappedArray(&mipmapped, &channel_desc,
+                                            make_cudaExtent(width, height, 0),
+                                            nlevels));
+        m_arrays_to_free.push_back(mipmapped);
+        for (int m = 0; m < nlevels; ++m) {
+            int w        = std::max(width >> m, 1);
+            int h        = std::max(height >> m, 1);
+            size_t pitch = size_t(w) * 4 * sizeof(float);
+            cudaArray_t level;
+            CUDA_CHECK(cudaGetMipmappedArrayLevel(&level, mipmapped, m));
+            CUDA_CHECK(cudaMemcpy2DToArray(level, /* offset */ 0, 0,
+                                           levels[m].data(), pitch, pitch, h,
+                                           cudaMemcpyHostToDevice));
+        }
 
-        res_desc.resType         = cudaResourceTypeArray;
-        res_desc.res.array.array = pixelArray;
+        cudaResourceDesc res_desc  = {};
+        res_desc.resType           = cudaResourceTypeMipmappedArray;
+        res_desc.res.mipmap.mipmap = mipmapped;
 
         cudaTextureDesc tex_desc = {};
         tex_desc.addressMode[0]  = cudaAddressModeWrap;
@@ -734,9 +964,9 @@ OptixGridRenderer::get_texture_handle(ustringhash filename,
             = cudaReadModeElementType;  //cudaReadModeNormalizedFloat;
         tex_desc.normalizedCoords    = 1;
         tex_desc.maxAnisotropy       = 1;
-        tex_desc.maxMipmapLevelClamp = 99;
+        tex_desc.maxMipmapLevelClamp = float(nlevels - 1);
         tex_desc.minMipmapLevelClamp = 0;
-        tex_desc.mipmapFilterMode    = cudaFilterModePoint;
+        tex_desc.mipmapFilterMode    = cudaFilterModeLinear;
         tex_desc.borderColor[0]      = 1.0f;
         tex_desc.sRGB                = 0;
 
@@ -766,10 +996,13 @@ OptixGridRenderer::prepare_render()
 void
 OptixGridRenderer::warmup()
 {
-    // Perform a tiny launch to warm up the OptiX context
-    OPTIX_CHECK(optixLaunch(m_optix_pipeline, m_cuda_stream, d_launch_params,
-                            sizeof(RenderParams), &m_optix_sbt, 0, 0, 1));
-    CUDA_SYNC_CHECK();
+    // Perform a tiny launch to warm up each OptiX context
+    for (Device& dev : m_devices) {
+        CUDA_CHECK(cudaSetDevice(dev.id));
+        OPTIX_CHECK(optixLaunch(dev.pipeline, dev.stream, dev.d_launch_params,
+                                sizeof(RenderParams), &dev.sbt, 0, 0, 1));
+        CUDA_SYNC_CHECK();
+    }
 }
 
 
@@ -778,57 +1011,103 @@ OptixGridRenderer::warmup()
 void
 OptixGridRenderer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
 {
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_output_buffer),
-                          xres * yres * 4 * sizeof(float)));
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_launch_params),
-                          sizeof(RenderParams)));
-
-    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_output_buffer));
-    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_launch_params));
-
     m_xres = xres;
     m_yres = yres;
 
-    RenderParams params;
-    params.invw  = 1.0f / m_xres;
-    params.invh  = 1.0f / m_yres;
-    params.flipv = false; /* I don't see flipv being initialized anywhere */
-    params.output_buffer           = d_output_buffer;
-    params.osl_printf_buffer_start = d_osl_printf_buffer;
-    // maybe send buffer size to CUDA instead of the buffer 'end'
-    params.osl_printf_buffer_end = d_osl_printf_buffer + OSL_PRINTF_BUFFER_SIZE;
-    params.color_system          = d_color_system;
-    params.test_str_1            = test_str_1;
-    params.test_str_2            = test_str_2;
-    params.object2common         = d_object2common;
-    params.shader2common         = d_shader2common;
-    params.num_named_xforms      = m_num_named_xforms;
-    params.xform_name_buffer     = d_xform_name_buffer;
-    params.xform_buffer          = d_xform_buffer;
-
-    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_launch_params), &params,
-                          sizeof(RenderParams), cudaMemcpyHostToDevice));
-
-    // Set up global variables
-    OPTIX_CHECK(optixLaunch(m_optix_pipeline, m_cuda_stream, d_launch_params,
-                            sizeof(RenderParams), &m_setglobals_optix_sbt, 1, 1,
-                            1));
-    CUDA_SYNC_CHECK();
-
-    // Launch real render
-    OPTIX_CHECK(optixLaunch(m_optix_pipeline, m_cuda_stream, d_launch_params,
-                            sizeof(RenderParams), &m_optix_sbt, xres, yres, 1));
-    CUDA_SYNC_CHECK();
-
-    //
-    //  Let's print some basic stuff
-    //
-    std::vector<uint8_t> printf_buffer(OSL_PRINTF_BUFFER_SIZE);
-    CUDA_CHECK(cudaMemcpy(printf_buffer.data(),
-                          reinterpret_cast<void*>(d_osl_printf_buffer),
-                          OSL_PRINTF_BUFFER_SIZE, cudaMemcpyDeviceToHost));
-
-    processPrintfBuffer(printf_buffer.data(), OSL_PRINTF_BUFFER_SIZE);
+    // Each device shades a band of whole rows, into a buffer of its own,
+    // and all of them run at once.
+    int ndevices = int(m_devices.size());
+    for (int d = 0; d < ndevices; ++d) {
+        Device& dev(m_devices[d]);
+        CUDA_CHECK(cudaSetDevice(dev.id));
+        int ybegin         = int((long long)yres * d / ndevices);
+        int yend           = int((long long)yres * (d + 1) / ndevices);
+        size_t npixels     = std::max(size_t(xres) * (yend - ybegin),
+                                      size_t(1));
+        size_t output_size = npixels * 4 * sizeof(float);
+        if (output_size != dev.output_size) {
+            if (dev.d_output_buffer)
+                cudaFree(reinterpret_cast<void*>(dev.d_output_buffer));
+            CUDA_CHECK(cudaMalloc(
+                reinterpret_cast<void**>(&dev.d_output_buffer), output_size));
+            dev.output_size = output_size;
+        }
+        dev.ybegin = ybegin;
+        dev.yend   = yend;
+
+        RenderParams params;
+        params.invw  = 1.0f / m_xres;
+        params.invh  = 1.0f / m_yres;
+        params.flipv = false; /* I don't see flipv being initialized anywhere */
+        params.yoffset                 = ybegin;
+        params.output_buffer           = dev.d_output_buffer;
+        params.osl_printf_buffer_start = dev.d_osl_printf_buffer;
+        // maybe send buffer size to CUDA instead of the buffer 'end'
+        params.osl_printf_buffer_end = dev.d_osl_printf_buffer
+                                       + OSL_PRINTF_BUFFER_SIZE;
+        params.test_str_1        = test_str_1;
+        params.test_str_2        = test_str_2;
+        params.object2common     = dev.d_object2common;
+        params.shader2common     = dev.d_shader2common;
+        params.num_named_xforms  = m_xform_names.size();
+        params.xform_name_buffer = dev.d_xform_name_buffer;
+        params.xform_buffer      = dev.d_xform_buffer;
+        memcpy(params.color_system, m_color_system.data(),
+               m_color_system.size());
+
+        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(dev.d_launch_params),
+                              &params, sizeof(RenderParams),
+                              cudaMemcpyHostToDevice));
+
+        // Set up global variables.  The launches on the stream run in
+        // order, so the render launch sees them.
+        OPTIX_CHECK(optixLaunch(dev.pipeline, dev.stream, dev.d_launch_params,
+                                sizeof(RenderParams), &dev.setglobals_sbt, 1,
+                                1, 1));
+
+        // Launch real render
+        CUDA_CHECK(cudaEventRecord(dev.start, dev.stream));
+        if (yend > ybegin)
+            OPTIX_CHECK(optixLaunch(dev.pipeline, dev.stream,
+                                    dev.d_launch_params, sizeof(RenderParams),
+                                    &dev.sbt, xres, yend - ybegin, 1));
+        CUDA_CHECK(cudaEventRecord(dev.stop, dev.stream));
+    }
+
+    for (Device& dev : m_devices) {
+        CUDA_CHECK(cudaSetDevice(dev.id));
+        CUDA_SYNC_CHECK();
+        float ms = 0.0f;
+        CUDA_CHECK(cudaEventElapsedTime(&ms, dev.start, dev.stop));
+        dev.render_time = ms * 1.0e-3;
+
+        //
+        //  Let's print some basic stuff
+        //
+        std::vector<uint8_t> printf_buffer(OSL_PRINTF_BUFFER_SIZE);
+        CUDA_CHECK(cudaMemcpy(printf_buffer.data(),
+                              reinterpret_cast<void*>(dev.d_osl_printf_buffer),
+                              OSL_PRINTF_BUFFER_SIZE, cudaMemcpyDeviceToHost));
+
+        processPrintfBuffer(printf_buffer.data(), OSL_PRINTF_BUFFER_SIZE);
+    }
+
+    if (options.get_int("gpustats")) {
+        // The devices run at once, so the slowest one sets the pace
+        double slowest = 0.0;
+        for (const Device& dev : m_devices) {
+            size_t pixels = size_t(xres) * (dev.yend - dev.ybegin);
+            print("GPU {} ({}): rows {}-{}, {:.3f} ms, {:.2f} Mpixels/s\n",
+                  dev.id, dev.name, dev.ybegin, dev.yend - 1,
+                  dev.render_time * 1.0e3,
+                  dev.render_time > 0.0 ? pixels / dev.render_time * 1.0e-6
+                                        : 0.0);
+            slowest = std::max(slowest, dev.render_time);
+        }
+        print("All {} GPUs: {:.3f} ms, {:.2f} Mpixels/s\n", m_devices.size(),
+              slowest * 1.0e3,
+              slowest > 0.0 ? size_t(xres) * yres / slowest * 1.0e-6 : 0.0);
+    }
 }
 
 
@@ -837,6 +1116,8 @@ void
 OptixGridRenderer::processPrintfBuffer(void* buffer_data, size_t buffer_size)
 {
     const uint8_t* ptr = reinterpret_cast<uint8_t*>(buffer_data);
+    int error_repeats  = 0;
+    shadingsys->getattribute("error_repeats", error_repeats);
     // process until
     std::string fmt_string;
     size_t total_read = 0;
@@ -928,6 +1209,19 @@ OptixGridRenderer::processPrintfBuffer(void* buffer_data, size_t buffer_size)
         total_read += next_args;
 
         buffer[dst++] = '\0';
+        // Like the ShadingSystem, don't repeat a recent error or warning
+        // unless "error_repeats" asks for it.
+        string_view msg(buffer);
+        if (OIIO::Strutil::starts_with(msg, "Shader error")
+            || OIIO::Strutil::starts_with(msg, "Shader warning")) {
+            bool seen = std::find(m_errseen.begin(), m_errseen.end(), msg)
+                        != m_errseen.end();
+            if (seen && !error_repeats)
+                continue;
+            if (m_errseen.size() >= 32)
+                m_errseen.pop_front();
+            m_errseen.emplace_back(msg);
+        }
         print("{}", buffer);
     }
 }
@@ -939,10 +1233,17 @@ OptixGridRenderer::finalize_pixel_buffer()
 {
     std::string buffer_name = "output_buffer";
     std::vector<float> tmp_buff(m_xres * m_yres * 3);
-    CUDA_CHECK(cudaMemcpy(tmp_buff.data(),
-                          reinterpret_cast<void*>(d_output_buffer),
-                          m_xres * m_yres * 3 * sizeof(float),
-                          cudaMemcpyDeviceToHost));
+    // Gather the bands of rows from the devices
+    for (const Device& dev : m_devices) {
+        if (!dev.d_output_buffer || dev.yend <= dev.ybegin)
+            continue;
+        size_t offset = size_t(m_xres) * dev.ybegin * 3;
+        size_t size   = size_t(m_xres) * (dev.yend - dev.ybegin) * 3;
+        CUDA_CHECK(cudaSetDevice(dev.id));
+        CUDA_CHECK(cudaMemcpy(tmp_buff.data() + offset,
+                              reinterpret_cast<void*>(dev.d_output_buffer),
+                              size * sizeof(float), cudaMemcpyDeviceToHost));
+    }
     OIIO::ImageBuf* buf = outputbuf(0);
     if (buf)
         buf->set_pixels(OIIO::ROI::All(), OIIO::TypeFloat, tmp_buff.data());
@@ -954,9 +1255,12 @@ void
 OptixGridRenderer::clear()
 {
     shaders().clear();
-    if (m_optix_ctx) {
-        OPTIX_CHECK(optixDeviceContextDestroy(m_optix_ctx));
-        m_optix_ctx = 0;
+    for (Device& dev : m_devices) {
+        if (dev.ctx) {
+            CUDA_CHECK(cudaSetDevice(dev.id));
+            OPTIX_CHECK(optixDeviceContextDestroy(dev.ctx));
+            dev.ctx = nullptr;
+        }
     }
 }
 
@@ -975,34 +1279,18 @@ OptixGridRenderer::set_transforms(const OSL::Matrix44& object2common,
 void
 OptixGridRenderer::register_named_transforms()
 {
-    std::vector<uint64_t> xform_name_buffer;
-    std::vector<OSL::Matrix44> xform_buffer;
-
     // Gather:
     //   1) All of the named transforms
     //   2) The "string" value associated with the transform name, which is
     //      actually the ustring hash of the transform name.
+    // init_optix_context pushes them to each device.
+    m_xform_names.clear();
+    m_xforms.clear();
     for (const auto& item : m_named_xforms) {
         const uint64_t addr = item.first.hash();
-        xform_name_buffer.push_back(addr);
-        xform_buffer.push_back(*item.second);
+        m_xform_names.push_back(addr);
+        m_xforms.push_back(*item.second);
     }
-
-    // Push the names and transforms to the device
-    size_t sz = sizeof(uint64_t) * xform_name_buffer.size();
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_xform_name_buffer), sz));
-    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_xform_name_buffer),
-                          xform_name_buffer.data(), sz,
-                          cudaMemcpyHostToDevice));
-    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_xform_name_buffer));
-
-    sz = sizeof(OSL::Matrix44) * xform_buffer.size();
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_xform_buffer), sz));
-    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_xform_buffer),
-                          xform_buffer.data(), sz, cudaMemcpyHostToDevice));
-    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_xform_buffer));
-
-    m_num_named_xforms = xform_name_buffer.size();
 }
 
 OSL_NAMESPACE_EXIT
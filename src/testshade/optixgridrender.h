@@ -4,6 +4,10 @@
 
 #pragma once
 
+#include <list>
+#include <string>
+#include <vector>
+
 #include <OpenImageIO/ustring.h>
 
 #include <OSL/oslexec.h>
@@ -64,28 +68,49 @@ public:
                                       ShadingContext* shading_context,
                                       const TextureOpt* options) override;
 
-    OptixDeviceContext optix_ctx() { return m_optix_ctx; }
-    OptixDeviceContext context() { return m_optix_ctx; }
+    OptixDeviceContext optix_ctx() { return m_devices[0].ctx; }
+    OptixDeviceContext context() { return m_devices[0].ctx; }
     OptixDeviceContext operator->() { return context(); }
 
     void processPrintfBuffer(void* buffer_data, size_t buffer_size);
 
 private:
-    optix::Context m_optix_ctx = nullptr;
-
-    CUstream m_cuda_stream;
-    OptixShaderBindingTable m_optix_sbt            = {};
-    OptixShaderBindingTable m_setglobals_optix_sbt = {};
-    OptixPipeline m_optix_pipeline                 = {};
-    CUdeviceptr d_output_buffer;
-    CUdeviceptr d_launch_params = 0;
-    CUdeviceptr d_osl_printf_buffer;
-    CUdeviceptr d_color_system;
-    CUdeviceptr d_object2common;
-    CUdeviceptr d_shader2common;
-    uint64_t m_num_named_xforms;
-    CUdeviceptr d_xform_name_buffer;
-    CUdeviceptr d_xform_buffer;
+    // What it takes to render on one CUDA device: each device renders a
+    // band of rows, with the same PTX compiled into a pipeline of its own.
+    struct Device {
+        int id = 0;
+        std::string name;
+        optix::Context ctx                     = nullptr;
+        CUstream stream                        = nullptr;
+        OptixShaderBindingTable sbt            = {};
+        OptixShaderBindingTable setglobals_sbt = {};
+        OptixPipeline pipeline                 = {};
+        CUdeviceptr d_output_buffer            = 0;
+        size_t output_size                     = 0;  ///< Bytes of it
+        CUdeviceptr d_launch_params            = 0;
+        CUdeviceptr d_osl_printf_buffer        = 0;
+        CUdeviceptr d_object2common            = 0;
+        CUdeviceptr d_shader2common            = 0;
+        CUdeviceptr d_xform_name_buffer        = 0;
+        CUdeviceptr d_xform_buffer             = 0;
+        int ybegin = 0, yend = 0;  ///< Its rows of the last render
+        cudaEvent_t start = nullptr, stop = nullptr;
+        double render_time = 0.0;  ///< Seconds of the last render
+        // CUdeviceptrs that need to be freed after we are done
+        std::vector<void*> ptrs_to_free;
+    };
+
+    void init_device(int id);
+    void destroy_device(Device& dev);
+    bool make_optix_pipeline(Device& dev,
+                             const std::vector<std::string>& group_ptx,
+                             const std::vector<std::string>& group_names);
+
+    std::vector<Device> m_devices;
+    std::list<std::string> m_errseen;     ///< Recent errors & warnings printed
+    std::vector<char> m_color_system;     ///< ColorSystem, as on the device
+    std::vector<uint64_t> m_xform_names;  ///< Hashes of the named xforms
+    std::vector<OSL::Matrix44> m_xforms;  ///< The named xforms
     uint64_t test_str_1;
     uint64_t test_str_2;
     const unsigned long OSL_PRINTF_BUFFER_SIZE = 8 * 1024 * 1024;
@@ -97,8 +122,8 @@ private:
     OSL::Matrix44 m_shader2common;  // "shader" space to "common" space matrix
     OSL::Matrix44 m_object2common;  // "object" space to "common" space matrix
 
-    // CUdeviceptrs that need to be freed after we are done
-    std::vector<void*> m_ptrs_to_free;
+    // Texture arrays (all on the first device) to free after we are done
+    std::vector<cudaMipmappedArray_t> m_arrays_to_free;
 };
 
 
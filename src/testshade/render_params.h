@@ -1,14 +1,17 @@
 #pragma once
 
 #if (OPTIX_VERSION >= 70000)
+// Room for the ShadingSystem's pvt::ColorSystem in RenderParams
+#define RENDER_PARAMS_COLOR_SYSTEM_SIZE 4096
+
 struct RenderParams {
     float invw;
     float invh;
+    int yoffset;  // Row of the image where the launch's band starts
     CUdeviceptr output_buffer;
     bool flipv;
     CUdeviceptr osl_printf_buffer_start;
     CUdeviceptr osl_printf_buffer_end;
-    CUdeviceptr color_system;
 
     // for transforms
     CUdeviceptr object2common;
@@ -20,5 +23,10 @@ struct RenderParams {
     // for used-data tests
     uint64_t test_str_1;
     uint64_t test_str_2;
+
+    // The ColorSystem, in the launch parameters so that OptiX keeps it in
+    // constant memory with the rest, rather than in a global memory buffer
+    // that every color op would have to read.
+    alignas(16) char color_system[RENDER_PARAMS_COLOR_SYSTEM_SIZE];
 };
 #endif
@@ -6,6 +6,7 @@
 #    error OSL_HOST_RS_BITCODE must be defined by your build system.
 #endif
 
+#include <OSL/rendererservices.h>
 #include <OSL/rs_free_function.h>
 
 #include "render_state.h"
@@ -184,3 +185,53 @@ rs_transform_points(OSL::ShaderGlobals* /*sg*/, OSL::StringParam /*from*/,
 {
     return false;
 }
+
+OSL_RSOP bool
+rs_get_array_attribute(OSL::ShaderGlobals* sg, bool derivatives,
+                       OSL::StringParam object, OSL::TypeDesc type,
+                       OSL::StringParam name, int index, void* val)
+{
+    // The camera is described by the render state, so those attributes
+    // inline into the shader. N.B. in a real renderer, some of these may
+    // be time-dependent.
+    auto rs = reinterpret_cast<RenderState*>(sg->renderstate);
+    if (name == STRING_PARAMS(osl_version) && type == OSL::TypeDesc::TypeInt) {
+        ((int*)val)[0] = OSL_VERSION;
+        return true;
+    }
+    if (name == STRING_PARAMS(camera_resolution)
+        && type == OSL::TypeDesc(OSL::TypeDesc::INT, 2)) {
+        ((int*)val)[0] = rs->xres;
+        ((int*)val)[1] = rs->yres;
+        return true;
+    }
+    if (name == STRING_PARAMS(camera_projection)
+        && type == OSL::TypeDesc::TypeString) {
+        ((OSL::StringParam*)val)[0] = rs->projection;
+        return true;
+    }
+    if ((name == STRING_PARAMS(camera_fov)
+         || name == STRING_PARAMS(camera_clip_near)
+         || name == STRING_PARAMS(camera_clip_far))
+        && type == OSL::TypeDesc::TypeFloat) {
+        ((float*)val)[0] = name == STRING_PARAMS(camera_fov) ? rs->fov
+                           : name == STRING_PARAMS(camera_clip_near)
+                               ? rs->hither
+                               : rs->yon;
+        if (derivatives)
+            memset((char*)val + type.size(), 0, 2 * type.size());
+        return true;
+    }
+
+    // Everything else, like userdata, is left to the SimpleRenderer
+    return sg->renderer->get_array_attribute(sg, derivatives, object, type,
+                                             name, index, val);
+}
+
+OSL_RSOP bool
+rs_get_attribute(OSL::ShaderGlobals* sg, bool derivatives,
+                 OSL::StringParam object, OSL::TypeDesc type,
+                 OSL::StringParam name, void* val)
+{
+    return rs_get_array_attribute(sg, derivatives, object, type, name, -1, val);
+}
@@ -16,4 +16,10 @@
 
 RS_STRDECL("perspective", perspective)
 RS_STRDECL("raster", raster)
-RS_STRDECL("myspace", myspace)
\ No newline at end of file
+RS_STRDECL("myspace", myspace)
+RS_STRDECL("osl:version", osl_version)
+RS_STRDECL("camera:resolution", camera_resolution)
+RS_STRDECL("camera:projection", camera_projection)
+RS_STRDECL("camera:fov", camera_fov)
+RS_STRDECL("camera:clip_near", camera_clip_near)
+RS_STRDECL("camera:clip_far", camera_clip_far)
\ No newline at end of file
@@ -219,7 +219,9 @@ register_closures(OSL::ShadingSystem* shadingsys)
 
 SimpleRenderer::SimpleRenderer()
 #if OSL_USE_BATCHED
-    : m_batch_16_simple_renderer(*this), m_batch_8_simple_renderer(*this)
+    : m_batch_16_simple_renderer(*this)
+    , m_batch_8_simple_renderer(*this)
+    , m_batch_4_simple_renderer(*this)
 #endif
 {
     Matrix44 M;
@@ -255,9 +257,10 @@ SimpleRenderer::SimpleRenderer()
 SimpleRenderer::~SimpleRenderer() {}
 
 int
-SimpleRenderer::supports(string_view /*feature*/) const
+SimpleRenderer::supports(string_view feature) const
 {
-    return false;
+    // Our transformations never change while shading
+    return feature == "transform_cache";
 }
 
 
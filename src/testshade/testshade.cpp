@@ -3,6 +3,7 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <iostream>
@@ -68,7 +69,13 @@ static int batch_size     = -1;
 static bool vary_Pdxdy    = false;
 static bool vary_udxdy    = false;
 static bool vary_vdxdy    = false;
+static std::string sgfile;          // --sgfile: recorded shading points
+static float incoherence = 0.0f;    // --incoherent: 0 grid .. 1 random
+static int point_seed    = 0;
+static std::string raytype_mix;     // --raytype_mix: raytypes to mix
 static bool saveptx       = false;
+static int gpus           = 0;
+static bool gpustats      = false;
 static bool warmup        = false;
 static bool profile       = false;
 static bool O0 = false, O1 = false, O2 = false;
@@ -97,6 +104,12 @@ static ParamValueList reparams;
 static std::string reparam_layer;
 static ErrorHandler errhandler;
 static int iters                = 1;
+static int bench_reps           = 0;  // --bench: timed repetitions
+static int bench_warmup         = 1;
+static std::string bench_json;
+static std::string compile_json;  // --compile-json: append compile stats
+static int scaling_threads = -1;  // --scaling: sweep threads up to this
+static std::string scaling_json;
 static std::string raytype_name = "camera";
 static int raytype_bit          = 0;
 static bool raytype_opt         = false;
@@ -187,6 +200,8 @@ set_shadingsys_options()
     }
 
     shadingsys->attribute("profile", int(profile));
+    if (scaling_threads >= 0)
+        shadingsys->attribute("lock_stats", 1);
     shadingsys->attribute("debug_nan", debugnan);
     shadingsys->attribute("debug_uninit", debug_uninit);
     shadingsys->attribute("userdata_isconnected", userdata_isconnected);
@@ -246,6 +261,9 @@ set_shadingsys_options()
         } else if ((!batch_size_requested || batch_size == 8)
                    && shadingsys->configure_batch_execution_at(8)) {
             batch_size = 8;
+        } else if ((!batch_size_requested || batch_size == 4)
+                   && shadingsys->configure_batch_execution_at(4)) {
+            batch_size = 4;
         } else {
             OSL::print(
                 "WARNING:  Hardware or library requirements to utilize batched execution");
@@ -283,6 +301,11 @@ set_shadingsys_options()
         output_placement = false;
     }
 
+    if (use_shade_image) {
+        // shade_image places the outputs into the image it is given itself
+        output_placement = false;
+    }
+
     shadingsys_options_set = true;
 }
 
@@ -655,10 +678,22 @@ getargs(int argc, const char* argv[])
       .help("populate Dx(u) & Dy(u) with varying values (vs. uniform)");
     ap.arg("--vary_vdxdy", &vary_vdxdy)
       .help("populate Dx(v) & Dy(v) with varying values (vs. uniform)");
+    ap.arg("--sgfile %s:FILENAME", &sgfile)
+      .help("Shade the points in FILENAME (as written by the \"capture\" option) instead of the grid");
+    ap.arg("--incoherent %f:AMOUNT", &incoherence)
+      .help("Randomize P, N and uv of the grid points by AMOUNT (0-1)");
+    ap.arg("--seed %d:SEED", &point_seed)
+      .help("Random seed for --incoherent and --raytype_mix");
+    ap.arg("--raytype_mix %s:LIST", &raytype_mix)
+      .help("Give each point a random raytype from the comma separated LIST");
     ap.arg("--profile", &profile)
       .help("Print profile information");
     ap.arg("--saveptx", &saveptx)
       .help("Save the generated PTX (OptiX mode only)");
+    ap.arg("--gpus %d:N", &gpus)
+      .help("Split the image across N GPUs (OptiX mode only; default 0 = all)");
+    ap.arg("--gpustats", &gpustats)
+      .help("Print the throughput of each GPU and of all (OptiX mode only)");
     ap.arg("--warmup", &warmup)
       .help("Perform a warmup launch");
     ap.arg("--res %d:XRES %d:YRES", &xres, &yres)
@@ -707,6 +742,18 @@ getargs(int argc, const char* argv[])
       .help("Specify ray type mask for optimization");
     ap.arg("--iters %d:ITERS", &iters)
       .help("Number of iterations");
+    ap.arg("--bench %d:N", &bench_reps)
+      .help("Benchmark: time N repetitions after warmup and report statistics of each phase");
+    ap.arg("--bench-warmup %d:N", &bench_warmup)
+      .help("Untimed repetitions before the --bench ones (default: 1)");
+    ap.arg("--bench-json %s:FILENAME", &bench_json)
+      .help("Also write the --bench report as JSON (\"-\" for stdout)");
+    ap.arg("--compile-json %s:FILENAME", &compile_json)
+      .help("Append the times of each compile phase, as a line of JSON");
+    ap.arg("--scaling %d:MAXTHREADS", &scaling_threads)
+      .help("Also time shading with 1, 2, 4, ... MAXTHREADS threads (0 = all cores)");
+    ap.arg("--scaling-json %s:FILENAME", &scaling_json)
+      .help("Also write the --scaling report as JSON (\"-\" for stdout)");
     ap.arg("-O0", &O0)
       .help("Do no runtime shader optimization");
     ap.arg("-O1", &O1)
@@ -859,6 +906,129 @@ setup_transformations(SimpleRenderer& rend, OSL::Matrix44& Mshad,
 static RenderState theRenderState;
 
 
+// One shading point recorded by a renderer, as read by --sgfile.  The
+// files are what the ShadingSystem's "capture" attribute writes.
+using PointRecord = ShadingSystem::CapturedPoint;
+
+static std::vector<PointRecord> point_records;
+static std::vector<int> raytype_mix_bits;
+
+
+
+// Read the --sgfile points
+static bool
+load_point_records(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in) {
+        std::cerr << "ERROR: Could not open \"" << filename << "\"\n";
+        return false;
+    }
+    size_t size = size_t(in.tellg());
+    if (size == 0 || size % sizeof(PointRecord)) {
+        std::cerr << "ERROR: \"" << filename << "\" does not hold whole "
+                  << sizeof(PointRecord) << " byte point records\n";
+        return false;
+    }
+    point_records.resize(size / sizeof(PointRecord));
+    in.seekg(0);
+    in.read((char*)point_records.data(), size);
+    return bool(in);
+}
+
+
+
+// A random number in [0,1) for the k-th random choice of point i, so that
+// the points don't depend on the order or the thread they are shaded in.
+static inline float
+point_random(uint32_t i, uint32_t k)
+{
+    uint32_t h = i * 0x9e3779b9u ^ (k + 1) * 0x85ebca6bu
+                 ^ uint32_t(point_seed) * 0xc2b2ae35u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (h >> 8) * (1.0f / (1 << 24));
+}
+
+
+
+static inline bool
+point_source_active()
+{
+    return !point_records.empty() || incoherence > 0
+           || !raytype_mix_bits.empty();
+}
+
+
+
+// The raytype that apply_point_source will give pixel (x,y)
+static inline int
+point_raytype(int x, int y)
+{
+    uint32_t index = uint32_t(y * xres + x);
+    if (!point_records.empty())
+        return point_records[index % point_records.size()].raytype;
+    if (!raytype_mix_bits.empty())
+        return raytype_mix_bits[std::min(
+            size_t(point_random(index, 7) * raytype_mix_bits.size()),
+            raytype_mix_bits.size() - 1)];
+    return raytype_bit;
+}
+
+
+
+// Replace the grid point (x,y) in sg by the recorded or randomized point
+// that the command line asked for.  Recorded points are reused cyclically
+// if there are fewer of them than pixels.
+static void
+apply_point_source(ShaderGlobals& sg, int x, int y)
+{
+    uint32_t index = uint32_t(y * xres + x);
+    if (!point_records.empty()) {
+        const PointRecord& r(point_records[index % point_records.size()]);
+        sg.P          = r.P;
+        sg.dPdx       = r.dPdx;
+        sg.dPdy       = r.dPdy;
+        sg.I          = r.I;
+        sg.N          = r.N;
+        sg.Ng         = r.Ng;
+        sg.u          = r.u;
+        sg.v          = r.v;
+        sg.dudx       = r.dudx;
+        sg.dudy       = r.dudy;
+        sg.dvdx       = r.dvdx;
+        sg.dvdy       = r.dvdy;
+        sg.dPdu       = r.dPdu;
+        sg.dPdv       = r.dPdv;
+        sg.raytype    = r.raytype;
+        sg.backfacing = r.backfacing;
+        return;
+    }
+    if (incoherence > 0) {
+        // Blend the grid point towards a random one: P in the unit cube,
+        // N anywhere on the sphere, uv anywhere on the patch.
+        float a   = std::min(incoherence, 1.0f);
+        float z   = 1.0f - 2.0f * point_random(index, 3);
+        float phi = float(2 * M_PI) * point_random(index, 4);
+        float r   = sqrtf(std::max(0.0f, 1.0f - z * z));
+        Vec3 P(point_random(index, 0), point_random(index, 1),
+               point_random(index, 2));
+        Vec3 N(r * cosf(phi), r * sinf(phi), z);
+        sg.P = OIIO::lerp(sg.P, P, a);
+        N    = OIIO::lerp(sg.N, N, a);
+        if (N.length2() > 0)
+            sg.N = sg.Ng = N.normalized();
+        sg.u = OIIO::lerp(sg.u, point_random(index, 5), a);
+        sg.v = OIIO::lerp(sg.v, point_random(index, 6), a);
+    }
+    sg.raytype = point_raytype(x, y);
+}
+
+
+
 // Set up the ShaderGlobals fields for pixel (x,y).
 static void
 setup_shaderglobals(ShaderGlobals& sg, ShadingSystem* shadingsys, int x, int y)
@@ -951,6 +1121,9 @@ setup_shaderglobals(ShaderGlobals& sg, ShadingSystem* shadingsys, int x, int y)
     // Set the surface area of the patch to 1 (which it is).  This is
     // only used for light shaders that call the surfacearea() function.
     sg.surfacearea = 1;
+
+    if (point_source_active())
+        apply_point_source(sg, x, y);
 }
 
 
@@ -1106,9 +1279,11 @@ setup_output_images(SimpleRenderer* rend, ShadingSystem* shadingsys,
             // jit_group will optimize the group if necesssary
             if (batch_size == 16) {
                 shadingsys->batched<16>().jit_group(shadergroup.get(), ctx);
-            } else {
-                ASSERT((batch_size == 8) && "Unsupported batch size");
+            } else if (batch_size == 8) {
                 shadingsys->batched<8>().jit_group(shadergroup.get(), ctx);
+            } else {
+                ASSERT((batch_size == 4) && "Unsupported batch size");
+                shadingsys->batched<4>().jit_group(shadergroup.get(), ctx);
             }
         } else
 #endif
@@ -1747,6 +1922,30 @@ batched_shade_region(SimpleRenderer* rend, ShaderGroup* shadergroup,
     int rheight = roi.height();
     int nhits   = rwidth * rheight;
 
+    // Points from --sgfile or --raytype_mix may differ in raytype, which
+    // must be uniform within a batch, so shade them grouped by raytype.
+    std::vector<int> hit_order, hit_raytype;
+    if (point_source_active()) {
+        hit_order.resize(nhits);
+        hit_raytype.resize(nhits);
+        for (int h = 0; h < nhits; ++h) {
+            hit_order[h]   = h;
+            hit_raytype[h] = point_raytype(roi.xbegin + h % rwidth,
+                                           roi.ybegin + h / rwidth);
+        }
+        std::stable_sort(hit_order.begin(), hit_order.end(),
+                         [&](int a, int b) {
+                             return hit_raytype[a] < hit_raytype[b];
+                         });
+    }
+
+    // The --sgfile or randomized points are set up as a renderer would
+    // have its hits, an array of structures, and each batch of them is
+    // transposed into sgBatch at once.
+    std::unique_ptr<ShaderGlobals[]> point_sg;
+    if (!hit_order.empty())
+        point_sg.reset(new ShaderGlobals[WidthT]);
+
     int oHitIndex = 0;
     while (oHitIndex < nhits) {
         OSL::Block<int, WidthT> wide_shadeindex_block;
@@ -1754,17 +1953,28 @@ batched_shade_region(SimpleRenderer* rend, ShaderGroup* shadergroup,
         int by[WidthT];
 
         int batchSize = std::min(WidthT, nhits - oHitIndex);
+        if (!hit_order.empty()) {
+            int raytype = hit_raytype[hit_order[oHitIndex]];
+            for (int bi = 1; bi < batchSize; ++bi)
+                if (hit_raytype[hit_order[oHitIndex + bi]] != raytype)
+                    batchSize = bi;
+            sgBatch.uniform.raytype = raytype;
+        }
 
 
         // TODO: vectorize this loop
         for (int bi = 0; bi < batchSize; ++bi) {
-            int lHitIndex = oHitIndex + bi;
+            int lHitIndex = hit_order.empty() ? oHitIndex + bi
+                                              : hit_order[oHitIndex + bi];
             // A real renderer would use the hit index to access data to populate shader globals
             int lx = lHitIndex % rwidth;
             int ly = lHitIndex / rwidth;
             int rx = roi.xbegin + lx;
             int ry = roi.ybegin + ly;
-            setup_varying_shaderglobals(bi, sgBatch, shadingsys, rx, ry);
+            if (hit_order.empty())
+                setup_varying_shaderglobals(bi, sgBatch, shadingsys, rx, ry);
+            else
+                setup_shaderglobals(point_sg[bi], shadingsys, rx, ry);
 
             int shadeindex            = ry * xres + rx;
             wide_shadeindex_block[bi] = shadeindex;
@@ -1775,6 +1985,9 @@ batched_shade_region(SimpleRenderer* rend, ShaderGroup* shadergroup,
                 by[bi] = ry;
             }
         }
+        if (point_sg)
+            sgBatch.varying.gather(point_sg.get(), sizeof(ShaderGlobals),
+                                   Mask<WidthT>((1u << batchSize) - 1));
 
         // Actually run the shader for this point
         if (entrylayer_index.empty()) {
@@ -1828,6 +2041,240 @@ synchio()
     fflush(stderr);
 }
 
+// Summary of the times of several runs of a benchmark phase
+struct BenchStats {
+    size_t n      = 0;
+    double min    = 0;
+    double median = 0;
+    double p95    = 0;
+    double mad    = 0;  // median absolute deviation from the median
+};
+
+
+
+static double
+sorted_median(const std::vector<double>& sorted)
+{
+    size_t n = sorted.size();
+    return n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+}
+
+
+
+static BenchStats
+bench_stats(std::vector<double> times)
+{
+    BenchStats s;
+    s.n = times.size();
+    if (times.empty())
+        return s;
+    std::sort(times.begin(), times.end());
+    s.min    = times.front();
+    s.median = sorted_median(times);
+    // Nearest rank
+    size_t rank = size_t(std::ceil(0.95 * times.size()));
+    s.p95       = times[std::max(rank, size_t(1)) - 1];
+    for (auto&& t : times)
+        t = std::abs(t - s.median);
+    std::sort(times.begin(), times.end());
+    s.mad = sorted_median(times);
+    return s;
+}
+
+
+
+// Print the --bench report, and write it as JSON if requested.  The
+// load, optimize and JIT phases happen once per group, so they have a
+// single sample; execute has one per timed repetition.
+static void
+bench_report(double load, double optimize, double jit,
+             const std::vector<double>& exec_times, int nthreads,
+             size_t npoints)
+{
+    std::vector<std::pair<const char*, BenchStats>> phases = {
+        { "load", bench_stats({ load }) },
+        { "optimize", bench_stats({ optimize }) },
+        { "jit", bench_stats({ jit }) },
+        { "execute", bench_stats(exec_times) },
+    };
+    const BenchStats& exec = phases[3].second;
+    double rate = exec.median > 0 ? npoints / (exec.median * nthreads) : 0.0;
+
+    print("\nBenchmark: {} repetitions after {} warmup, {} points, "
+          "{} threads\n",
+          exec_times.size(), bench_warmup, npoints, nthreads);
+    print("  {:<10} {:>4} {:>12} {:>12} {:>12} {:>12}\n", "phase", "n",
+          "min", "median", "p95", "MAD");
+    for (auto&& p : phases)
+        print("  {:<10} {:>4} {:>12.6f} {:>12.6f} {:>12.6f} {:>12.6f}\n",
+              p.first, p.second.n, p.second.min, p.second.median,
+              p.second.p95, p.second.mad);
+    print("  Execute: {:.6g} shades/s/thread (median)\n", rate);
+
+    if (bench_json.empty())
+        return;
+    std::string json = "{\n  \"phases\": {\n";
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const BenchStats& s = phases[i].second;
+        json += fmtformat("    \"{}\": {{ \"n\": {}, \"min\": {:.9g}, "
+                          "\"median\": {:.9g}, \"p95\": {:.9g}, "
+                          "\"mad\": {:.9g} }}{}\n",
+                          phases[i].first, s.n, s.min, s.median, s.p95, s.mad,
+                          i + 1 < phases.size() ? "," : "");
+    }
+    json += fmtformat("  }},\n  \"repetitions\": {},\n  \"warmup\": {},\n"
+                      "  \"threads\": {},\n  \"points\": {},\n"
+                      "  \"shades_per_second_per_thread\": {:.9g}\n}}\n",
+                      exec_times.size(), bench_warmup, nthreads, npoints,
+                      rate);
+    if (bench_json == "-") {
+        print("{}", json);
+    } else if (!OIIO::Filesystem::write_text_file(bench_json, json)) {
+        errhandler.errorfmt("Could not write benchmark report \"{}\"",
+                            bench_json);
+    }
+}
+
+
+
+// The time all threads spent waiting for the shading system's shared
+// locks (with its "lock_stats" option on), by lock.
+struct LockWaits {
+    double opt = 0, masters = 0, dictionary = 0, pointcloud = 0;
+
+    static LockWaits get()
+    {
+        LockWaits w;
+        shadingsys->getattribute("stat:opt_locking_time", w.opt);
+        shadingsys->getattribute("stat:masters_lock_time", w.masters);
+        shadingsys->getattribute("stat:dictionary_lock_time", w.dictionary);
+        shadingsys->getattribute("stat:pointcloud_lock_time", w.pointcloud);
+        return w;
+    }
+};
+
+
+
+// --scaling: shade the image with 1, 2, 4, ... threads up to maxthreads,
+// each count after an untimed run with it (so its threads have warm
+// contexts), and report the throughput, the speedup and efficiency over
+// one thread, and the time waited for each lock per repetition.
+template<typename F>
+static void
+scaling_report(F&& shade_once, int maxthreads, int reps, size_t npoints)
+{
+    std::vector<int> counts;
+    for (int t = 1; t < maxthreads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxthreads);
+    reps = std::max(reps, 1);
+
+    print("\nThread scaling: {} repetitions of {} points each\n", reps,
+          npoints);
+    print("  {:>7} {:>10} {:>12} {:>8} {:>6}   lock waits per rep, all "
+          "threads:\n",
+          "threads", "median", "shades/s", "speedup", "eff");
+    print("  {:>47} {:>10} {:>10} {:>10} {:>10}\n", "", "optimize",
+          "masters", "dictionary", "pointcloud");
+    std::string json = "{\n  \"scaling\": [\n";
+    double rate1     = 0.0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        int nthreads = counts[i];
+        OIIO::attribute("threads", nthreads);
+        shade_once(nthreads, false);
+        LockWaits before = LockWaits::get();
+        std::vector<double> times;
+        for (int r = 0; r < reps; ++r) {
+            OIIO::Timer timer;
+            shade_once(nthreads, false);
+            times.push_back(timer());
+        }
+        LockWaits after = LockWaits::get();
+        double median   = bench_stats(times).median;
+        double rate     = median > 0.0 ? npoints / median : 0.0;
+        if (i == 0)
+            rate1 = rate;
+        double speedup    = rate1 > 0.0 ? rate / rate1 : 0.0;
+        double efficiency = speedup / nthreads;
+        LockWaits w;
+        w.opt        = (after.opt - before.opt) / reps;
+        w.masters    = (after.masters - before.masters) / reps;
+        w.dictionary = (after.dictionary - before.dictionary) / reps;
+        w.pointcloud = (after.pointcloud - before.pointcloud) / reps;
+        print("  {:>7} {:>10.6f} {:>12.6g} {:>8.2f} {:>5.0f}% "
+              "{:>10.6f} {:>10.6f} {:>10.6f} {:>10.6f}\n",
+              nthreads, median, rate, speedup, 100.0 * efficiency, w.opt,
+              w.masters, w.dictionary, w.pointcloud);
+        json += fmtformat("    {{ \"threads\": {}, \"median\": {:.9g}, "
+                          "\"shades_per_second\": {:.9g}, "
+                          "\"speedup\": {:.9g}, \"efficiency\": {:.9g}, "
+                          "\"lock_waits\": {{ \"optimize\": {:.9g}, "
+                          "\"masters\": {:.9g}, \"dictionary\": {:.9g}, "
+                          "\"pointcloud\": {:.9g} }} }}{}\n",
+                          nthreads, median, rate, speedup, efficiency, w.opt,
+                          w.masters, w.dictionary, w.pointcloud,
+                          i + 1 < counts.size() ? "," : "");
+    }
+    json += fmtformat("  ],\n  \"repetitions\": {},\n  \"points\": {}\n}}\n",
+                      reps, npoints);
+    if (scaling_json.empty())
+        return;
+    if (scaling_json == "-") {
+        print("{}", json);
+    } else if (!OIIO::Filesystem::write_text_file(scaling_json, json)) {
+        errhandler.errorfmt("Could not write scaling report \"{}\"",
+                            scaling_json);
+    }
+}
+
+
+
+// Append, as one line of JSON, the time of each phase of loading and
+// compiling the group(s) of this run, and their sizes before and after
+// optimization.  The times are the shading system's totals.
+static void
+compile_report(ShaderGroup* group)
+{
+    ustring name;
+    shadingsys->getattribute(group, "groupname", name);
+    std::string backend = use_optix ? "optix"
+                          : batched ? fmtformat("batched{}", batch_size)
+                                    : "scalar";
+    std::string json    = fmtformat("{{\"group\": \"{}\", \"backend\": \"{}\"",
+                                    name, backend);
+    for (const char* stat :
+         { "master_load_time", "opt_prepare_time", "opt_forward_time",
+           "opt_backward_time", "opt_postopt_time", "opt_collapse_time",
+           "opt_inventory_time", "specialization_time", "llvm_setup_time",
+           "llvm_irgen_time", "llvm_opt_time", "llvm_jit_time" }) {
+        float t = 0.0f;
+        shadingsys->getattribute(fmtformat("stat:{}", stat), t);
+        json += fmtformat(", \"{}\": {:.9g}", stat, t);
+    }
+    for (const char* stat : { "preopt_ops", "postopt_ops" }) {
+        int n = 0;
+        shadingsys->getattribute(fmtformat("stat:{}", stat), n);
+        json += fmtformat(", \"{}\": {}", stat, n);
+    }
+    for (const char* stat : { "llvm_preopt_insts", "llvm_postopt_insts" }) {
+        long long n = 0;
+        shadingsys->getattribute(fmtformat("stat:{}", stat),
+                                 TypeDesc::INT64, &n);
+        json += fmtformat(", \"{}\": {}", stat, n);
+    }
+    json += "}\n";
+
+    OIIO::ofstream out;
+    OIIO::Filesystem::open(out, compile_json, std::ios::out | std::ios::app);
+    if (out)
+        out << json;
+    else
+        errhandler.errorfmt("Could not write compile report \"{}\"",
+                            compile_json);
+}
+
+
+
 extern "C" OSL_DLL_EXPORT int
 test_shade(int argc, const char* argv[])
 {
@@ -1857,6 +2304,8 @@ test_shade(int argc, const char* argv[])
     if (debug1 || verbose)
         rend->errhandler().verbosity(ErrorHandler::VERBOSE);
     rend->attribute("saveptx", (int)saveptx);
+    rend->attribute("gpus", gpus);
+    rend->attribute("gpustats", (int)gpustats);
 
     // Hand the userdata options from the command line over to the renderer
     rend->userdata.merge(userdata);
@@ -1935,6 +2384,13 @@ test_shade(int argc, const char* argv[])
     // options change their values.
     set_shadingsys_options();
 
+    // Where the shading points come from, if not the plain grid
+    raytype_bit = shadingsys->raytype_bit(ustring(raytype_name));
+    for (auto&& name : OIIO::Strutil::splitsv(raytype_mix, ","))
+        raytype_mix_bits.push_back(shadingsys->raytype_bit(ustring(name)));
+    if (!sgfile.empty() && !load_point_records(sgfile))
+        return EXIT_FAILURE;
+
     if (use_rs_bitcode) {
         SimpleRenderer::register_JIT_Global_Variables();
     }
@@ -2047,20 +2503,25 @@ test_shade(int argc, const char* argv[])
 
     // Allow a settable number of iterations to "render" the whole image,
     // which is useful for time trials of things that would be too quick
-    // to accurately time for a single iteration
-    for (int iter = 0; iter < iters; ++iter) {
+    // to accurately time for a single iteration.  In --bench mode, the
+    // warmup iterations (during which the group is optimized and JITed)
+    // come first, then the individually timed ones.
+    bench_warmup = std::max(1, bench_warmup);
+    if (bench_reps > 0)
+        iters = bench_warmup + bench_reps;
+
+    // Shade the whole image once, with nthreads threads
+    auto shade_once = [&](int nthreads, bool save) {
         OIIO::ROI roi(0, xres, 0, yres);
-
         if (use_optix) {
             rend->render(xres, yres);
         } else if (use_shade_image) {
-            // TODO: do we need a batched option/version of shade_image?
+            // shade_image batches by itself if batched shading is set up
             OSL::shade_image(*shadingsys, *shadergroup, NULL,
                              *rend->outputbuf(0), outputvarnames,
                              pixelcenters ? ShadePixelCenters : ShadePixelGrid,
-                             roi, num_threads);
+                             roi, nthreads);
         } else {
-            bool save = (iter == (iters - 1));  // save on last iteration
 #if 0
             shade_region (rend, shadergroup.get(), roi, save);
 #else
@@ -2068,28 +2529,41 @@ test_shade(int argc, const char* argv[])
             if (batched) {
                 if (batch_size == 16) {
                     OIIO::ImageBufAlgo::parallel_image(
-                        roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
+                        roi, nthreads, [&](OIIO::ROI sub_roi) -> void {
                             batched_shade_region<16>(rend, shadergroup.get(),
                                                      sub_roi, save);
                         });
-                } else {
-                    ASSERT((batch_size == 8) && "Unsupported batch size");
+                } else if (batch_size == 8) {
                     OIIO::ImageBufAlgo::parallel_image(
-                        roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
+                        roi, nthreads, [&](OIIO::ROI sub_roi) -> void {
                             batched_shade_region<8>(rend, shadergroup.get(),
                                                     sub_roi, save);
                         });
+                } else {
+                    ASSERT((batch_size == 4) && "Unsupported batch size");
+                    OIIO::ImageBufAlgo::parallel_image(
+                        roi, nthreads, [&](OIIO::ROI sub_roi) -> void {
+                            batched_shade_region<4>(rend, shadergroup.get(),
+                                                    sub_roi, save);
+                        });
                 }
             } else
 #    endif
             {
                 OIIO::ImageBufAlgo::parallel_image(
-                    roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
+                    roi, nthreads, [&](OIIO::ROI sub_roi) -> void {
                         shade_region(rend, shadergroup.get(), sub_roi, save);
                     });
             }
 #endif
         }
+    };
+    std::vector<double> exec_times;
+    for (int iter = 0; iter < iters; ++iter) {
+        OIIO::Timer itertimer;
+        shade_once(num_threads, iter == iters - 1);  // save on last iteration
+        if (bench_reps > 0 && iter >= bench_warmup)
+            exec_times.push_back(itertimer());
 
         // If any reparam was requested, do it now
         if (reparams.size() && reparam_layer.size() && (iter + 1 < iters)) {
@@ -2103,6 +2577,26 @@ test_shade(int argc, const char* argv[])
     }
     double runtime = timer.lap();
 
+    if (bench_reps > 0) {
+        double load = 0, opt = 0, llvm = 0;
+        shadingsys->getattribute("stat:master_load_time", load);
+        shadingsys->getattribute("stat:optimization_time", opt);
+        shadingsys->getattribute("stat:total_llvm_time", llvm);
+        // The optimization time includes the LLVM (JIT) time
+        bench_report(load, opt - llvm, llvm, exec_times,
+                     use_optix ? 1 : num_threads, size_t(xres) * yres);
+    }
+    if (compile_json.size())
+        compile_report(shadergroup.get());
+    if (scaling_threads >= 0 && !use_optix) {
+        int maxthreads = scaling_threads;
+        if (maxthreads == 0)
+            maxthreads = OIIO::Sysutil::hardware_concurrency();
+        scaling_report(shade_once, maxthreads, bench_reps ? bench_reps : 3,
+                       size_t(xres) * yres);
+        OIIO::attribute("threads", num_threads);
+    }
+
     // This awkward condition preserves an output oddity from long ago,
     // eliminating the need to update hundreds of ref outputs.
     if (outputfiles.size() == 1 && outputfiles[0] == "null")
@@ -0,0 +1,134 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Time the compile of every testsuite test that runs testshade: rerun each
+# test's own run.py, through runtest.py, with testshade appending the time
+# of each compile phase (loading, each pass of the runtime optimizer, IR
+# generation, LLVM optimization and JIT) and the size of the IR before and
+# after optimization to a JSON file.  Each test can be run on the scalar,
+# batched (8 or 16 wide) and OptiX (PTX) backends, and the totals of every
+# test and backend are written to one JSON file, to track over time.
+#
+# Usage: compilebench.py [options] [test...]
+
+from __future__ import print_function, absolute_import
+import datetime
+import glob
+import json
+import os
+import platform
+import shutil
+import subprocess
+import sys
+
+from optparse import OptionParser
+
+
+OSL_BUILD_DIR = os.environ.get("OSL_BUILD_DIR", "build")
+testsuite = os.path.dirname(os.path.abspath(__file__))
+
+backend_env = {
+    "scalar":    {},
+    "batched8":  { "TESTSHADE_BATCHED": "1", "TESTSHADE_BATCH_SIZE": "8" },
+    "batched16": { "TESTSHADE_BATCHED": "1", "TESTSHADE_BATCH_SIZE": "16" },
+    "optix":     { "TESTSHADE_OPTIX": "1" },
+}
+
+parser = OptionParser(usage="%prog [options] [test...]")
+parser.add_option("--backends", help="comma separated backends to time "
+                  "(of " + ",".join(sorted(backend_env)) + ")",
+                  action="store", type="string", dest="backends",
+                  default="scalar")
+parser.add_option("--scratch", help="directory to run the tests in",
+                  action="store", type="string", dest="scratch",
+                  default="compilebench")
+parser.add_option("-o", help="JSON file of the results",
+                  action="store", type="string", dest="output",
+                  default="compilebench.json")
+(options, tests) = parser.parse_args()
+backends = options.backends.split(",")
+for b in backends :
+    if b not in backend_env :
+        parser.error("unknown backend '{}'".format(b))
+if not tests :
+    tests = sorted([os.path.basename(os.path.dirname(f)) for f in
+                    glob.glob(os.path.join(testsuite, "*", "run.py"))])
+
+testshade = os.path.abspath(os.path.join(OSL_BUILD_DIR, "bin", "testshade"))
+runtest = os.path.join(testsuite, "runtest.py")
+
+
+# Rerun one test on one backend, and return the compile records its
+# testshade runs appended, or None if it doesn't run testshade at all.
+def time_test (test, backend) :
+    srcdir = os.path.join(testsuite, test)
+    with open(os.path.join(srcdir, "run.py")) as f :
+        if "testshade" not in f.read() :
+            return None
+    rundir = os.path.abspath(os.path.join(options.scratch, backend, test))
+    shutil.rmtree(rundir, ignore_errors=True)
+    os.makedirs(rundir)
+    records = os.path.join(rundir, "compile.jsonl")
+    env = dict(os.environ)
+    env.update(backend_env[backend])
+    env["OSL_TESTSHADE_NAME"] = testshade + " --compile-json " + records
+    env["OSL_TESTSUITE_SRC"] = srcdir
+    env["OSL_TESTSUITE_SKIP_DIFF"] = "1"
+    env["OSL_BUILD_DIR"] = os.path.abspath(OSL_BUILD_DIR)
+    with open(os.path.join(rundir, "compilebench.log"), "w") as log :
+        ret = subprocess.call([sys.executable, runtest, rundir,
+                               os.path.abspath(OSL_BUILD_DIR)], env=env,
+                              stdout=log, stderr=subprocess.STDOUT, cwd=rundir)
+    result = []
+    if os.path.exists(records) :
+        with open(records) as f :
+            result = [ json.loads(line) for line in f if line.strip() ]
+    if ret != 0 :
+        print("  {} {}: exited with {}".format(test, backend, ret))
+    return result
+
+
+# Sum the numbers of a test's records, which are each the totals of one
+# testshade run.
+def total (records) :
+    sums = {}
+    for r in records :
+        for key, value in r.items() :
+            if isinstance(value, (int, float)) :
+                sums[key] = sums.get(key, 0) + value
+    sums["runs"] = len(records)
+    return sums
+
+
+results = {}
+for test in tests :
+    for backend in backends :
+        records = time_test(test, backend)
+        if records is None :
+            break
+        if records :
+            results.setdefault(test, {})[backend] = total(records)
+
+summary = {}
+for backend in backends :
+    summary[backend] = total([ r[backend] for r in results.values()
+                               if backend in r ])
+    summary[backend].pop("runs")
+    print("{}: {} tests, load {:.3f}s, optimize {:.3f}s, "
+          "llvm irgen {:.3f}s, opt {:.3f}s, jit {:.3f}s".format(
+          backend, sum(1 for r in results.values() if backend in r),
+          summary[backend].get("master_load_time", 0),
+          summary[backend].get("specialization_time", 0),
+          summary[backend].get("llvm_irgen_time", 0),
+          summary[backend].get("llvm_opt_time", 0),
+          summary[backend].get("llvm_jit_time", 0)))
+
+with open(options.output, "w") as f :
+    json.dump({ "tests": results, "total": summary,
+                "host": platform.node(),
+                "date": datetime.datetime.now().isoformat() },
+              f, indent=4, sort_keys=True)
+print("Wrote", options.output)
@@ -0,0 +1,17 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# scale is folded into the code, so the reparam between the iterations
+# rebuilds the group and JITs it again, replacing the first code. With
+# jit_free_with_group that code lives in memory of the group's own.
+# Either way both iterations must shade as the params say. (The option
+# is ignored when the renderer has batched shading, so only builds
+# without it run the group-owned memory here.)
+for free in [ "1", "0" ] :
+    command += testshade("-g 2 1 -options reparam_reoptimize=1,"
+                         + "jit_free_with_group=" + free
+                         + " --layer testlay -param scale 2.0 test"
+                         + " -iters 2 -reparam testlay scale 3.0")
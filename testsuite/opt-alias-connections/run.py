@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The same connected array, with the downstream param aliased to the
+# upstream output and copied into it as before. Both must shade the same.
+for alias in [ "1", "0" ] :
+    command += testshade("-g 2 1 -options opt_alias_connections=" + alias
+                         + " -layer up up -layer down down"
+                         + " -connect up ramp down ramp")
@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Batched or one call apiece, the getattribute calls must find the same.
+# At -O0 none of them is folded away, so the whole run is batched.
+command += testshade("-g 2 1 -options opt_batch_getattribute=1 test")
+command += testshade("-g 2 1 -options opt_batch_getattribute=0 test")
+command += testshade("-g 2 1 -O0 -options opt_batch_getattribute=1 test")
+command += testshade("-g 2 1 -O0 -options opt_batch_getattribute=0 test")
@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The runtime optimizer folds such params into constants itself, so the
+# shared arrays are only used at -O0. Shared or copied, they must shade
+# the same, as must the optimized group.
+command += testshade("-g 2 1 -O0 -options opt_shared_constant_arrays=64 test")
+command += testshade("-g 2 1 -O0 -options opt_shared_constant_arrays=0 test")
+command += testshade("-g 2 1 test")
@@ -0,0 +1,46 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# List the user function calls left in each .oso file, with their %pure
+# hints, and check that every jump of every op lands after the op, in
+# order, and within the code.
+
+from __future__ import print_function
+import sys
+
+for filename in sys.argv[1:] :
+    consts = {}
+    ops = []
+    incode = False
+    for line in open(filename) :
+        if line.startswith("code ") :
+            incode = True
+            continue
+        fields = [f for f in line.rstrip("\n").split("\t") if f]
+        if not fields or fields[0].startswith("#") :
+            continue
+        if not incode :
+            if fields[0] == "const" and fields[1] == "string" :
+                consts[fields[2]] = fields[3].strip('"')
+        elif fields[0] != "end" :
+            args = [f for f in fields[1:] if not f.startswith("%")]
+            hints = [f for f in fields[1:] if f.startswith("%")]
+            words = args[0].split() if args else []
+            ops.append((fields[0], [w for w in words if not w.isdigit()],
+                        [int(w) for w in words if w.isdigit()],
+                        " ".join(hints)))
+    print (filename + ":")
+    ok = True
+    for i, (opname, args, jumps, hints) in enumerate(ops) :
+        if opname == "functioncall" :
+            pure = " pure" if "%pure" in hints.split() else ""
+            print ("  functioncall " + consts.get(args[0], args[0]) + pure)
+        if jumps and (jumps[0] <= i or jumps != sorted(jumps)
+                      or jumps[-1] > len(ops)) :
+            print ("  bad jumps", jumps, "of op", i, opname)
+            ok = False
+    if ok :
+        print ("  jumps ok")
@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# test.oso is compiled with the default optimization, which strips the
+# unused calls; test_O0.oso keeps them all. Both must shade the same.
+command += oslc("-O0 -o test_O0.oso test.osl")
+command += run_app(pythonbin + " listcalls.py test_O0.oso test.oso")
+command += testshade("-g 2 1 test_O0")
+command += testshade("-g 2 1 test")
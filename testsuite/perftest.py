@@ -0,0 +1,137 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Time one "perf" test: compile the shaders of a testsuite directory, run
+# testshade or testrender on them a few times with --runstats, and record
+# their "Run" times as JSON in <testname>.json.  With a baselines file,
+# fail if the median time is slower than the test's baseline by more than
+# the tolerance, or (with --update, or $OSL_PERF_UPDATE set) store the
+# median as the new baseline.
+#
+# Usage: perftest.py [options] testname app [args...]
+
+from __future__ import print_function, absolute_import
+import datetime
+import glob
+import json
+import os
+import platform
+import re
+import shutil
+import subprocess
+import sys
+import time
+
+from optparse import OptionParser
+
+
+OSL_BUILD_DIR = os.environ.get("OSL_BUILD_DIR", "..")
+
+parser = OptionParser(usage="%prog [options] testname app [args...]")
+parser.add_option("--srcdir", help="testsuite directory of the shaders",
+                  action="store", type="string", dest="srcdir", default=".")
+parser.add_option("--repeats", help="number of timed runs",
+                  action="store", type="int", dest="repeats", default=5)
+parser.add_option("--baselines", help="JSON file of the baseline times",
+                  action="store", type="string", dest="baselines", default="")
+parser.add_option("--tolerance", help="slowdown over the baseline that fails",
+                  action="store", type="float", dest="tolerance", default=0.1)
+parser.add_option("--update", help="store the times as the new baselines",
+                  action="store_true", dest="update",
+                  default=bool(os.environ.get("OSL_PERF_UPDATE")))
+parser.disable_interspersed_args()
+(options, args) = parser.parse_args()
+if len(args) < 2 :
+    parser.error("need a test name and the app to run")
+testname = args[0]
+app = args[1]
+appargs = args[2:]
+
+
+def osl_app (app) :
+    return os.path.join(OSL_BUILD_DIR, "bin", app)
+
+
+# Parse a time as printed by Strutil::timeintervalformat, e.g. "1.5s" or
+# "2m 3.1s", into seconds.
+def parse_interval (text) :
+    units = { "d": 86400, "h": 3600, "m": 60, "s": 1 }
+    seconds = 0.0
+    for value, unit in re.findall(r"([0-9.]+)\s*([dhms])", text) :
+        seconds += float(value) * units[unit]
+    return seconds
+
+
+# Run the app once, returning the "Run" time it reports, or the wall clock
+# time of the whole run if it reports none.
+def timed_run (command) :
+    start = time.time()
+    proc = subprocess.Popen(command, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, universal_newlines=True)
+    output = proc.communicate()[0]
+    wall = time.time() - start
+    if proc.returncode != 0 :
+        print(output)
+        print("FAILED: '{}' exited with {}".format(" ".join(command),
+                                                   proc.returncode))
+        sys.exit(1)
+    match = re.search(r"^Run\s*:\s*(.*)$", output, re.MULTILINE)
+    return parse_interval(match.group(1)) if match else wall
+
+
+# Copy and compile the shaders, as runtest.py does
+for filetype in [ "*.osl", "*.h", "*.oslgroup", "*.xml" ] :
+    for f in glob.glob(os.path.join(options.srcdir, filetype)) :
+        shutil.copyfile(f, os.path.basename(f))
+for f in sorted(glob.glob("*.osl")) :
+    if subprocess.call([osl_app("oslc"), "-q", f]) != 0 :
+        print("FAILED: could not compile", f)
+        sys.exit(1)
+
+command = [ osl_app(app) ] + appargs + [ "--runstats" ]
+timed_run(command)  # warm up the caches, and check that it runs at all
+times = [ timed_run(command) for i in range(max(options.repeats, 1)) ]
+times_sorted = sorted(times)
+median = times_sorted[len(times) // 2]
+result = { "test": testname,
+           "command": " ".join([app] + appargs),
+           "times": times,
+           "median": median,
+           "best": times_sorted[0],
+           "host": platform.node(),
+           "date": datetime.datetime.now().isoformat() }
+print("{}: median {:.4f}s, best {:.4f}s of {} runs".format(
+      testname, median, times_sorted[0], len(times)))
+
+ret = 0
+if options.baselines :
+    baselines = {}
+    if os.path.exists(options.baselines) :
+        with open(options.baselines) as f :
+            baselines = json.load(f)
+    baseline = baselines.get(testname, {}).get("median")
+    if options.update :
+        baselines[testname] = { "median": median, "host": result["host"],
+                                "date": result["date"] }
+        with open(options.baselines, "w") as f :
+            json.dump(baselines, f, indent=4, sort_keys=True)
+        print("Updated the baseline in", options.baselines)
+    elif baseline :
+        ratio = median / baseline
+        result["baseline"] = baseline
+        result["ratio"] = ratio
+        print("baseline {:.4f}s, ratio {:.3f} (tolerance {:.3f})".format(
+              baseline, ratio, 1.0 + options.tolerance))
+        if ratio > 1.0 + options.tolerance :
+            print("FAILED: slower than the baseline")
+            ret = 1
+    else :
+        print("No baseline for", testname)
+
+with open(testname + ".json", "w") as f :
+    json.dump(result, f, indent=4, sort_keys=True)
+
+sys.exit(ret)